@@ -0,0 +1,122 @@
+/******************************************************************************
+Copyright (c) 2010, Google Inc.
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without 
+modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice, 
+      this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+    * Neither the name of the <ORGANIZATION> nor the names of its contributors 
+    may be used to endorse or promote products derived from this software 
+    without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE 
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE 
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL 
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR 
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER 
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, 
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE 
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+******************************************************************************/
+
+#include "StdAfx.h"
+#include "EventIndex.h"
+
+/*-----------------------------------------------------------------------------
+-----------------------------------------------------------------------------*/
+CEventIndex::CEventIndex(void)
+{
+}
+
+/*-----------------------------------------------------------------------------
+-----------------------------------------------------------------------------*/
+CEventIndex::~CEventIndex(void)
+{
+}
+
+/*-----------------------------------------------------------------------------
+	Stable sort of the events by start time
+-----------------------------------------------------------------------------*/
+void CEventIndex::Sort(CAtlArray<CTrackedEvent *> & events)
+{
+	size_t count = events.GetCount();
+	CAtlArray<__int64> start;
+	start.SetCount(count);
+	for( size_t i = 0; i < count; i++ )
+		start[i] = events[i]->start;
+
+	CEventOrder order;
+	order.Build(start.GetData(), count);
+
+	CAtlArray<CTrackedEvent *> unsorted;
+	unsorted.Copy(events);
+	for( size_t i = 0; i < count; i++ )
+		events[i] = unsorted[order[i]];
+}
+
+/*-----------------------------------------------------------------------------
+	Index all of the events with a valid start time
+-----------------------------------------------------------------------------*/
+void CEventIndex::Build(CAtlList<CTrackedEvent *> & events)
+{
+	Reset();
+
+	CAtlArray<CTrackedEvent *> unsorted;
+	CAtlArray<__int64> start;
+	unsorted.SetCount(0, (int)events.GetCount());
+	start.SetCount(0, (int)events.GetCount());
+	POSITION pos = events.GetHeadPosition();
+	while( pos )
+	{
+		CTrackedEvent * e = events.GetNext(pos);
+		if( e && e->start )
+		{
+			unsorted.Add(e);
+			start.Add(e->start);
+		}
+	}
+
+	size_t count = unsorted.GetCount();
+	order.Build(start.GetData(), count);
+	sorted.SetCount(count);
+	for( size_t i = 0; i < count; i++ )
+		sorted[i] = unsorted[order[i]];
+}
+
+/*-----------------------------------------------------------------------------
+-----------------------------------------------------------------------------*/
+void CEventIndex::Reset(void)
+{
+	sorted.RemoveAll();
+	order.Reset();
+}
+
+/*-----------------------------------------------------------------------------
+	All events that started at or before "time", in start order
+-----------------------------------------------------------------------------*/
+void CEventIndex::StartedBefore(__int64 time, 
+								CAtlList<CTrackedEvent *> & result) const
+{
+	size_t count = order.StartedBy(time);
+	for( size_t i = 0; i < count; i++ )
+		result.AddTail(sorted[i]);
+}
+
+/*-----------------------------------------------------------------------------
+	Same as above but only for a single type of event
+-----------------------------------------------------------------------------*/
+void CEventIndex::StartedBefore(__int64 time, CTrackedEvent::EventType type, 
+								CAtlList<CTrackedEvent *> & result) const
+{
+	size_t count = order.StartedBy(time);
+	for( size_t i = 0; i < count; i++ )
+		if( sorted[i]->type == type )
+			result.AddTail(sorted[i]);
+}
@@ -0,0 +1,58 @@
+/******************************************************************************
+Copyright (c) 2010, Google Inc.
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without 
+modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice, 
+      this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+    * Neither the name of the <ORGANIZATION> nor the names of its contributors 
+    may be used to endorse or promote products derived from this software 
+    without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE 
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE 
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL 
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR 
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER 
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, 
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE 
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+******************************************************************************/
+
+#pragma once
+#include "TrackedEvent.h"
+#include "EventOrder.h"
+
+/*-----------------------------------------------------------------------------
+	Read-only index over the tracked events, ordered by start time 
+	(CEventOrder).  Answers "which events started before time T" with a 
+	binary search.  The index holds raw pointers into the events list so it
+	must be rebuilt if the list changes.
+-----------------------------------------------------------------------------*/
+class CEventIndex
+{
+public:
+	CEventIndex(void);
+	~CEventIndex(void);
+
+	void Build(CAtlList<CTrackedEvent *> & events);
+	void Reset(void);
+	size_t GetCount(void) const { return sorted.GetCount(); }
+
+	static void Sort(CAtlArray<CTrackedEvent *> & events);
+
+	void StartedBefore(__int64 time, CAtlList<CTrackedEvent *> & result) const;
+	void StartedBefore(__int64 time, CTrackedEvent::EventType type, 
+						CAtlList<CTrackedEvent *> & result) const;
+
+private:
+	CAtlArray<CTrackedEvent *>	sorted;	// events ordered by start time
+	CEventOrder					order;
+};
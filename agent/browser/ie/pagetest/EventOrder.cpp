@@ -0,0 +1,97 @@
+/******************************************************************************
+Copyright (c) 2010, Google Inc.
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without 
+modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice, 
+      this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+    * Neither the name of the <ORGANIZATION> nor the names of its contributors 
+    may be used to endorse or promote products derived from this software 
+    without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE 
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE 
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL 
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR 
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER 
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, 
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE 
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+******************************************************************************/
+
+// No precompiled header, this file has to build without the Windows SDK
+#include "EventOrder.h"
+#include <algorithm>
+
+/*-----------------------------------------------------------------------------
+	Strict weak ordering of event positions by start time
+-----------------------------------------------------------------------------*/
+class EventStartsBefore
+{
+public:
+	EventStartsBefore(const long long * start):start(start){}
+	bool operator()(size_t a, size_t b) const { return start[a] < start[b]; }
+private:
+	const long long * start;
+};
+
+/*-----------------------------------------------------------------------------
+-----------------------------------------------------------------------------*/
+CEventOrder::CEventOrder(void)
+{
+}
+
+/*-----------------------------------------------------------------------------
+-----------------------------------------------------------------------------*/
+CEventOrder::~CEventOrder(void)
+{
+}
+
+/*-----------------------------------------------------------------------------
+	Order the events by start time
+-----------------------------------------------------------------------------*/
+void CEventOrder::Build(const long long * start, size_t count)
+{
+	order.resize(count);
+	for( size_t i = 0; i < count; i++ )
+		order[i] = i;
+	std::stable_sort(order.begin(), order.end(), EventStartsBefore(start));
+
+	sortedStart.resize(count);
+	for( size_t i = 0; i < count; i++ )
+		sortedStart[i] = start[order[i]];
+}
+
+/*-----------------------------------------------------------------------------
+-----------------------------------------------------------------------------*/
+void CEventOrder::Reset(void)
+{
+	order.clear();
+	sortedStart.clear();
+}
+
+/*-----------------------------------------------------------------------------
+	Number of events that started at or before "time" (they are the first
+	ones in the order)
+-----------------------------------------------------------------------------*/
+size_t CEventOrder::StartedBy(long long time) const
+{
+	size_t lo = 0;
+	size_t hi = sortedStart.size();
+	while( lo < hi )
+	{
+		size_t mid = lo + (hi - lo) / 2;
+		if( sortedStart[mid] <= time )
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
@@ -0,0 +1,57 @@
+/******************************************************************************
+Copyright (c) 2010, Google Inc.
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without 
+modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice, 
+      this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+    * Neither the name of the <ORGANIZATION> nor the names of its contributors 
+    may be used to endorse or promote products derived from this software 
+    without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE 
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE 
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL 
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR 
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER 
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, 
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE 
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+******************************************************************************/
+
+#pragma once
+#include <stddef.h>
+#include <vector>
+
+/*-----------------------------------------------------------------------------
+	Stable ordering of a set of events by start time (events that start at
+	the same time keep the order they were recorded in) and a binary search
+	for the events that started by a given time.  Works on the start times
+	so CEventIndex and SortEvents share it for the tracked events.
+	Portable (no precompiled header) so it can be benchmarked on Linux 
+	(event_index_bench).
+-----------------------------------------------------------------------------*/
+class CEventOrder
+{
+public:
+	CEventOrder(void);
+	~CEventOrder(void);
+
+	void Build(const long long * start, size_t count);
+	void Reset(void);
+	size_t GetCount(void) const { return order.size(); }
+	// position (in the start times passed to Build) of the i'th event to start
+	size_t operator[](size_t i) const { return order[i]; }
+	size_t StartedBy(long long time) const;
+
+private:
+	std::vector<size_t>		order;
+	std::vector<long long>	sortedStart;	// start times in order
+};
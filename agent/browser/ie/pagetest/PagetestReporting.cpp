@@ -34,6 +34,7 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <shlobj.h>
 #include <atlenc.h>
 #include "cdn.h"
+#include "../../../wpthook/analysis.h"
 #include "zlib/zlib.h"
 #include "jsmin/JSMin.h"
 #include "PageSpeed/include/pagespeed/core/engine.h"
@@ -1532,6 +1533,8 @@ void CPagetestReporting::CheckOptimization(void)
 {
 	if( checkOpt )
 	{
+		eventIndex.Build(events);
+
 		CheckKeepAlive();
 		CheckGzip();
 		CheckImageCompression();
@@ -1550,6 +1553,8 @@ void CPagetestReporting::CheckOptimization(void)
 		if( saveEverything )
 			ProtectedCheckPageSpeed();
 
+		eventIndex.Reset();
+
 		RepaintWaterfall();
 	}
 }
@@ -1866,7 +1871,8 @@ void CPagetestReporting::CheckGzip()
 				w->gzipScore = 0;
 				DWORD target = w->in;
 				
-				if( enc.Find(_T("gzip")) >= 0 || enc.Find(_T("deflate")) >= 0 )
+				CStringA encoding(enc);
+				if( AnalysisIsCompressedEncoding(encoding, encoding.GetLength()) )
 					w->gzipScore = 100;
 				else if( w->in < 1400 )	// if it's less than 1 packet anyway, give it a pass
 					w->gzipScore = -1;
@@ -1954,16 +1960,14 @@ void CPagetestReporting::CheckGzip()
 
 
 /*-----------------------------------------------------------------------------
-	Make sure any host that served more than one asset used keep-alives
+	Portable records of the tracked requests for the shared checks
 -----------------------------------------------------------------------------*/
-void CPagetestReporting::CheckKeepAlive()
+static void GetAnalysisRequests(CAtlList<CTrackedEvent *>& events,
+                                std::vector<AnalysisRequest>& records,
+                                CAtlArray<CWinInetRequest *>& requests)
 {
-	keepAliveScore = -1;
-	int count = 0;
-	int total = 0;
-	
-	ATLTRACE(_T("[Pagetest] - CheckKeepAlive\n"));
-	
+	records.clear();
+	requests.RemoveAll();
 	POSITION pos = events.GetHeadPosition();
 	while( pos )
 	{
@@ -1971,67 +1975,44 @@ void CPagetestReporting::CheckKeepAlive()
 		if( e && e->type == CTrackedEvent::etWinInetRequest && !e->ignore )
 		{
 			CWinInetRequest * w = (CWinInetRequest *)e;
-			if( w->result == 200 && w->fromNet )
-			{
-				w->keepAliveScore = 0;
-
-				CString conn = w->response.connection;
-				conn.MakeLower();
-				if( conn.Find(_T("keep-alive")) > -1 &&
-            conn.Find(_T("close")) == -1)
-					w->keepAliveScore = 100;
-				else
-				{
-					// see if there were any other requests from the same host
-					CString host = w->host;
-					bool needed = false;
-					bool reused = false;
-					
-					POSITION pos2 = events.GetHeadPosition();
-					while( pos2 )
-					{
-						CTrackedEvent * e2 = events.GetNext(pos2);
-						if( e2 && e != e2 && e2->type == CTrackedEvent::etWinInetRequest && !e2->ignore )
-						{
-							CWinInetRequest * w2 = (CWinInetRequest *)e2;
-							if( !w2->host.CompareNoCase(host) )
-							{
-								needed = true;
-								if( w2->socketId == w->socketId )
-									reused = true;
-							}
-						}
-					}
-					
-					if( reused )
-						w->keepAliveScore = 100;
-					else if( needed )
-					{
-						// HTTP 1.1 defaults to keep-alive
-						if( conn.Find(_T("close")) > -1 || w->response.ver < 1.1 )
-							w->keepAliveScore = 0;
-						else
-							w->keepAliveScore = 100;
-					}
-					else
-						w->keepAliveScore = -1;
-				}
+			AnalysisRequest record;
+			CString value = w->host;
+			record.host_ = (LPCSTR)CT2A(value.MakeLower());
+			record.result_ = (int)w->result;
+			record.socket_id_ = w->socketId;
+			record.http_version_ = w->response.ver;
+			record.from_network_ = w->fromNet;
+			value = w->response.connection;
+			record.connection_ = (LPCSTR)CT2A(value.MakeLower());
+			value = w->response.contentType;
+			record.mime_ = (LPCSTR)CT2A(value.Trim().MakeLower());
+			records.push_back(record);
+			requests.Add(w);
+		}
+	}
+}
 
-				if( !w->keepAliveScore )
-					w->warning = true;
+/*-----------------------------------------------------------------------------
+	Make sure any host that served more than one asset used keep-alives
+-----------------------------------------------------------------------------*/
+void CPagetestReporting::CheckKeepAlive()
+{
+	ATLTRACE(_T("[Pagetest] - CheckKeepAlive\n"));
 
-				if( w->keepAliveScore != -1 )
-				{
-					count++;
-					total += w->keepAliveScore;
-				}
-			}
+	std::vector<AnalysisRequest> records;
+	CAtlArray<CWinInetRequest *> requests;
+	GetAnalysisRequests(events, records, requests);
+	keepAliveScore = AnalysisCheckKeepAlive(records);
+	for( size_t i = 0; i < records.size(); i++ )
+	{
+		CWinInetRequest * w = requests[i];
+		if( w->result == 200 && w->fromNet )
+		{
+			w->keepAliveScore = records[i].keep_alive_score_;
+			if( !w->keepAliveScore )
+				w->warning = true;
 		}
 	}
-
-	// average the keep alive scores of all of the objects for the page
-	if( count )
-		keepAliveScore = total / count;
 }
 
 /*-----------------------------------------------------------------------------
@@ -2189,47 +2170,27 @@ bool GetExpiresRemaining(CWinInetRequest * w, bool& expiration_set,
 -----------------------------------------------------------------------------*/
 void CPagetestReporting::CheckCache()
 {
-	cacheScore = -1;
-	int count = 0;
-	int total = 0;
-
 	ATLTRACE(_T("[Pagetest] - CheckCache\n"));
-	
-	POSITION pos = events.GetHeadPosition();
-	while( pos )
+
+	std::vector<AnalysisRequest> records;
+	CAtlArray<CWinInetRequest *> requests;
+	GetAnalysisRequests(events, records, requests);
+	for( size_t i = 0; i < records.size(); i++ )
 	{
-		CTrackedEvent * e = events.GetNext(pos);
-		if( e && e->type == CTrackedEvent::etWinInetRequest && !e->ignore )
+		AnalysisRequest& record = records[i];
+		record.has_expiration_ = record.result_ == 200 &&
+		    GetExpiresRemaining(requests[i], record.expiration_set_,
+		                        record.seconds_remaining_);
+	}
+	cacheScore = AnalysisCheckCache(records);
+	for( size_t i = 0; i < records.size(); i++ )
+	{
+		if( records[i].cache_score_ != -1 )
 		{
-			CWinInetRequest * w = (CWinInetRequest *)e;
-			CString mime = w->response.contentType.Trim().MakeLower();
-      bool expiration_set;
-      int seconds_remaining;
-      if (w->result == 200 && mime.Find(_T("/cache-manifest")) == -1 && 
-          GetExpiresRemaining(w, expiration_set, seconds_remaining))
-      {
-        count++;
-        w->cacheScore = 0;
-        w->ttl = seconds_remaining;
-        if( expiration_set ) 
-        {
-          // If age more than 7 days give 100
-          // else if more than hour, give 50
-          if( seconds_remaining >= 604800 )
-            w->cacheScore = 100;
-          else if( seconds_remaining >= 3600 )
-            w->cacheScore = 50;
-        }
-
-        // Add the score to the total.
-        total += w->cacheScore;
-      }
-    }
-  }
-
-  // average the Cache scores of all of the objects for the page
-	if( count )
-		cacheScore = total / count;
+			requests[i]->cacheScore = records[i].cache_score_;
+			requests[i]->ttl = records[i].cache_time_secs_;
+		}
+	}
 }
 
 /*-----------------------------------------------------------------------------
@@ -2244,12 +2205,16 @@ void CPagetestReporting::CheckCombine()
 	int cssCount = 0;
 
 	ATLTRACE(_T("[Pagetest] - CheckCombine\n"));
+
+	// only the requests that started before render matter
+	CAtlList<CTrackedEvent *> beforeRender;
+	eventIndex.StartedBefore(startRender, CTrackedEvent::etWinInetRequest, beforeRender);
 	
-	POSITION pos = events.GetHeadPosition();
+	POSITION pos = beforeRender.GetHeadPosition();
 	while( pos )
 	{
-		CTrackedEvent * e = events.GetNext(pos);
-		if( e && e->type == CTrackedEvent::etWinInetRequest && !e->ignore && e->start <= startRender )
+		CTrackedEvent * e = beforeRender.GetNext(pos);
+		if( e && !e->ignore )
 		{
 			CWinInetRequest * w = (CWinInetRequest *)e;
 			CString mime = w->response.contentType;
@@ -2280,11 +2245,11 @@ void CPagetestReporting::CheckCombine()
 				
 				int cnt = 0;
 				
-				POSITION pos2 = events.GetHeadPosition();
+				POSITION pos2 = beforeRender.GetHeadPosition();
 				while( pos2 )
 				{
-					CTrackedEvent * e2 = events.GetNext(pos2);
-					if( e2 && e2->type == CTrackedEvent::etWinInetRequest && e2->start <= startRender )
+					CTrackedEvent * e2 = beforeRender.GetNext(pos2);
+					if( e2 )
 					{
 						CWinInetRequest * w2 = (CWinInetRequest *)e2;
 						CString mime2 = w2->response.contentType;
@@ -3114,47 +3079,22 @@ void CPagetestReporting::SaveHistogram(CxImage& image, CString file) {
 CStringA CPagetestReporting::GetHistogram(CxImage& image) {
   CStringA histogram;
   if (image.IsValid()) {
-    DWORD r[256], g[256], b[256];
-    for (int i = 0; i < 256; i++) {
-      r[i] = g[i] = b[i] = 0;
+    ColorHistogram colors;
+    bool ok = false;
+    if (image.GetBpp() >= 24) {
+      ok = BitmapHistogram(GetAnalysisBitmap(image), RIGHT_MARGIN,
+                           BOTTOM_MARGIN, colors);
+    } else {
+      CxImage rgb(image);
+      if (rgb.IncreaseBpp(24))
+        ok = BitmapHistogram(GetAnalysisBitmap(rgb), RIGHT_MARGIN,
+                             BOTTOM_MARGIN, colors);
     }
-    DWORD width = __max(image.GetWidth() - RIGHT_MARGIN, 0);
-    DWORD height = image.GetHeight();
-    for (DWORD y = BOTTOM_MARGIN; y < height; y++) {
-      for (DWORD x = 0; x < width; x++) {
-        RGBQUAD pixel = image.GetPixelColor(x,y);
-        if (pixel.rgbRed != 255 || 
-            pixel.rgbGreen != 255 || 
-            pixel.rgbBlue != 255) {
-          r[pixel.rgbRed]++;
-          g[pixel.rgbGreen]++;
-          b[pixel.rgbBlue]++;
-        }
-      }
-    }
-    CStringA red = "\"r\":[";
-    CStringA green = "\"g\":[";
-    CStringA blue = "\"b\":[";
-    CStringA buff;
-    for (int i = 0; i < 256; i++) {
-      if (i) {
-        red += ",";
-        green += ",";
-        blue += ",";
-      }
-      buff.Format("%d", r[i]);
-      red += buff;
-      buff.Format("%d", g[i]);
-      green += buff;
-      buff.Format("%d", b[i]);
-      blue += buff;
+    if (ok) {
+      std::string json;
+      HistogramJSON(colors, json);
+      histogram = json.c_str();
     }
-    red += "]";
-    green += "]";
-    blue += "]";
-    histogram = CStringA("{") + red + 
-                CStringA(",") + green + 
-                CStringA(",") + blue + CStringA("}");
   }
   return histogram;
 }
@@ -3250,9 +3190,10 @@ void CPagetestReporting::Log404s()
 -----------------------------------------------------------------------------*/
 void CPagetestReporting::SortEvents()
 {
-	CAtlList<CTrackedEvent *>	tmp;
+	CAtlArray<CTrackedEvent *>	tmp;
+	tmp.SetCount(0, (int)events.GetCount());
 
-	// move all of the events over to a temporary list, making sure the start times are set correctly
+	// move all of the events over to a temporary array, making sure the start times are set correctly
 	POSITION pos = events.GetHeadPosition();
 	while( pos )
 	{
@@ -3264,44 +3205,18 @@ void CPagetestReporting::SortEvents()
 				w->start = w->created;
 
 			if( e->start )
-				tmp.AddTail(e);
+				tmp.Add(e);
 		}
 	}
 
 	events.RemoveAll();
 
-	pos = tmp.GetHeadPosition();
-	while( pos )
-	{
-		CTrackedEvent * e = tmp.GetNext(pos);
-		if( e )
-		{
-			if( events.IsEmpty() )
-				events.AddTail(e);
-			else
-			{
-				// figure out where to insert it
-				bool inserted = false;
-				POSITION next = events.GetHeadPosition();
-				while( !inserted && next )
-				{
-					POSITION p = next;
-					CTrackedEvent * n = events.GetNext(next);
-					if( n )
-					{
-						if( e->start < n->start )
-						{
-							events.InsertBefore(p, e);
-							inserted = true;
-						}
-					}
-				}
+	// stable sort so events with the same start time stay in the order they were recorded
+	CEventIndex::Sort(tmp);
 
-				if( !inserted )
-					events.AddTail(e);
-			}
-		}
-	}
+	size_t count = tmp.GetCount();
+	for( size_t i = 0; i < count; i++ )
+		events.AddTail(tmp[i]);
 }
 
 /*-----------------------------------------------------------------------------
@@ -3444,27 +3359,28 @@ bool CPagetestReporting::ImagesAreDifferent(CxImage * img1, CxImage* img2)
     {
       different = false;
       if (img1->GetBpp() >= 15) 
-      {
-        DWORD pixel_bytes = 3;
-        if (img1->GetBpp() == 32)
-          pixel_bytes = 4;
-        DWORD width = __max(img1->GetWidth() - RIGHT_MARGIN, 0);
-        DWORD height = img1->GetHeight();
-        DWORD row_length = width * pixel_bytes;
-        for (DWORD row = BOTTOM_MARGIN; row < height && !different; row++) 
-        {
-          BYTE * r1 = img1->GetBits(row);
-          BYTE * r2 = img2->GetBits(row);
-          if (r1 && r2 && memcmp(r1, r2, row_length))
-            different = true;
-        }
-      }
+        different = BitmapsDiffer(GetAnalysisBitmap(*img1), 
+                                  GetAnalysisBitmap(*img2),
+                                  RIGHT_MARGIN, BOTTOM_MARGIN);
     }
   }
 
   return different;
 }
 
+/*-----------------------------------------------------------------------------
+  Raw view of the image bits for the portable analysis code
+-----------------------------------------------------------------------------*/
+AnalysisBitmap CPagetestReporting::GetAnalysisBitmap(CxImage& image)
+{
+  AnalysisBitmap bitmap;
+  if (image.IsValid() && image.GetBpp() >= 8)
+    bitmap = AnalysisBitmap(image.GetBits(), image.GetWidth(),
+                            image.GetHeight(), image.GetEffWidth(),
+                            image.GetBpp() / 8);
+  return bitmap;
+}
+
 /*-----------------------------------------------------------------------------
 -----------------------------------------------------------------------------*/
 void CPagetestReporting::CheckCustomRules() {
@@ -3604,18 +3520,8 @@ void CPagetestReporting::CheckProgressiveJpeg()
 			if( w->fromNet && 
 				w->result == 200 && 
 				mime.Find(_T("image/")) >= 0 && 
-				body && bodyLen > 2 &&
-				body[0] == 0xff && body[1] == 0xd8) {
-        w->jpegScans = 0;
-        DWORD pos = 0;
-        BYTE * marker;
-        DWORD marker_length;
-        while (FindJPEGMarker(body, bodyLen, pos, marker, marker_length) &&
-               marker) {
-          if (marker[0] == 0xff && marker[1] == 0xda)
-            w->jpegScans++;
-          pos += marker_length;
-        }
+				JpegIsJpeg(body, bodyLen)) {
+        w->jpegScans = JpegCountScans(body, bodyLen);
         
         if (bodyLen > 10240 && w->jpegScans > 0) {
           total_bytes += bodyLen;
@@ -3630,59 +3536,6 @@ void CPagetestReporting::CheckProgressiveJpeg()
     progressiveJpegScore = (int)((progressive_bytes * 100.0 / total_bytes) + 0.5);
 }
 
-/*-----------------------------------------------------------------------------
-  Given a JPEG byte stream, find the next marker
------------------------------------------------------------------------------*/
-bool CPagetestReporting::FindJPEGMarker(BYTE * buff, DWORD len, DWORD &pos,
-                                        BYTE * &marker, DWORD &marker_len) {
-  bool found = false;
-  marker = NULL;
-  marker_len = 0;
-  BYTE sos = 0xda;
-  if (pos < len) {
-    BYTE val = buff[pos];
-    if (val == 0xff) {
-      // ff can repeat, the actual marker comes from the first non-ff
-      while (val == 0xff && pos < len) {
-        pos++;
-        val = buff[pos];
-      }
-      marker = &buff[pos - 1];
-      pos++;
-      if ((val >= 0xd0 && val <= 0xd9) || val == 0x01) {
-        found = true;
-      } else if(val == sos) {
-        // image data
-        DWORD marker_end = pos + 1;
-        DWORD next_marker = len;
-        while (marker_end < len - 1 && !found) {
-          val = buff[marker_end];
-          if (val == 0xff) {
-            DWORD i = marker_end + 1;
-            val = buff[i];
-            if (val != 0x00) {   // escaping
-              while (i < len - 1 && val == 0xff) {
-                i++;
-                val = buff[i];
-              }
-              next_marker = marker_end;
-              found = true;
-            }
-          }
-          marker_end++;
-        }
-        marker_len = next_marker - pos;
-      } else if (pos + 1 < len) {
-        BYTE v1 = buff[pos];
-        BYTE v2 = buff[pos + 1];
-        marker_len = (DWORD)v1 * 256 + (DWORD)v2;
-        found = true;
-      }
-    }
-  }
-  return found;
-}
-
 /*-----------------------------------------------------------------------------
   Run some in-page javascript to get the navigation timing data from
   supported browsers (IE 9+).
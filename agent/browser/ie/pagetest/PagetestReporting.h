@@ -30,6 +30,9 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #pragma once
 #include "ScriptEngine.h"
+#include "EventIndex.h"
+
+class AnalysisBitmap;
 
 namespace pagespeed {
 	class PagespeedInput;
@@ -196,6 +199,7 @@ protected:
 
 	bool IsCDN(CWinInetRequest * w, CString &provider);
 	CAtlList<CCDNEntry> cdnLookups;
+	CEventIndex eventIndex;		// start-time index of the events (valid during the optimization checks)
 private:
 	void SaveUrls(void);
 	void GetLinks(CComQIPtr<IHTMLDocument2> &doc, CAtlList<CStringA> &urls);
@@ -206,10 +210,9 @@ private:
 	void SortEvents();
   void SaveVideo();
   bool ImagesAreDifferent(CxImage * img1, CxImage* img2);
+  AnalysisBitmap GetAnalysisBitmap(CxImage& image);
   void SaveHistogram(CxImage& image, CString file);
   CStringA JSONEscape(CStringA src);
-  bool FindJPEGMarker(BYTE * buff, DWORD len, DWORD &pos,
-                      BYTE * &marker, DWORD &marker_len);
   CStringA GetHistogram(CxImage& image);
 };
 
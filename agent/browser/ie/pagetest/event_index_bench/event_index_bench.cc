@@ -0,0 +1,272 @@
+/******************************************************************************
+Copyright (c) 2010, Google Inc.
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without 
+modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice, 
+      this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+    * Neither the name of the <ORGANIZATION> nor the names of its contributors 
+    may be used to endorse or promote products derived from this software 
+    without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE 
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE 
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL 
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR 
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER 
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, 
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE 
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+******************************************************************************/
+
+// How sorting and querying the pagetest events scales with the size of the
+// page.  Compares the old SortEvents (re-inserting every event into the list
+// with a linear scan) with the stable sort by start time, and the old
+// CheckCombine walk (every event, filtered on type and start time, for every
+// script or stylesheet) with the CEventIndex "started before render" list,
+// on synthetic event logs.  Checks that both give the same answers.
+//
+// The ordering and search are the real CEventOrder (EventOrder.cpp) that
+// CEventIndex and SortEvents use.  CTrackedEvent and CAtlList need the
+// Windows SDK so the events here only have the type/start/end fields and
+// std::list plays CAtlList.
+//
+//   event_index_bench [events]
+#include "../EventOrder.h"
+#include <list>
+#include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+static const int TIMING_RUNS = 5;			// best of
+static const int JITTER_PERCENT = 20;		// events recorded out of order
+static const int SCRIPT_PERCENT = 30;		// requests that are js or css
+
+enum EventType
+{
+	etDNS,
+	etSocketConnect,
+	etWinInetRequest
+};
+
+class BenchEvent
+{
+public:
+	EventType	type;
+	long long	start;
+	long long	end;
+	bool		script;
+};
+
+typedef std::list<BenchEvent *>		EventList;
+typedef std::vector<BenchEvent *>	EventArray;
+
+/*-----------------------------------------------------------------------------
+-----------------------------------------------------------------------------*/
+static double NowMs()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+/*-----------------------------------------------------------------------------
+	A DNS lookup, connect and request per object, mostly recorded in start
+	order (events are added when they complete so some show up late) with
+	duplicate start times from the timer resolution.  Ticks are microseconds.
+-----------------------------------------------------------------------------*/
+static void MakeEvents(size_t count, std::vector<BenchEvent> & storage, 
+						EventList & events)
+{
+	srand(1);
+	storage.resize(count);
+	events.clear();
+	long long now = 1000;
+	for( size_t i = 0; i < count; i++ )
+	{
+		BenchEvent & e = storage[i];
+		e.type = (EventType)(i % 3);
+		now += rand() % 200;
+		e.start = now;
+		if( rand() % 100 < JITTER_PERCENT )
+			e.start -= rand() % 50000;
+		if( e.start < 1 )
+			e.start = 1;
+		e.end = e.start + rand() % 100000;
+		e.script = e.type == etWinInetRequest && 
+					rand() % 100 < SCRIPT_PERCENT;
+		events.push_back(&e);
+	}
+}
+
+/*-----------------------------------------------------------------------------
+	The old CPagetestReporting::SortEvents
+-----------------------------------------------------------------------------*/
+static void SortByInsertion(EventList & events)
+{
+	EventList tmp;
+	tmp.swap(events);
+	for( EventList::iterator it = tmp.begin(); it != tmp.end(); ++it )
+	{
+		BenchEvent * e = *it;
+		EventList::iterator next = events.begin();
+		while( next != events.end() && !(e->start < (*next)->start) )
+			++next;
+		events.insert(next, e);
+	}
+}
+
+/*-----------------------------------------------------------------------------
+	Put the events in CEventOrder order (what CEventIndex::Sort does)
+-----------------------------------------------------------------------------*/
+static void SortByOrder(EventArray & events, CEventOrder & order)
+{
+	std::vector<long long> start(events.size());
+	for( size_t i = 0; i < events.size(); i++ )
+		start[i] = events[i]->start;
+	order.Build(start.empty() ? NULL : &start[0], start.size());
+
+	EventArray unsorted(events);
+	for( size_t i = 0; i < events.size(); i++ )
+		events[i] = unsorted[order[i]];
+}
+
+/*-----------------------------------------------------------------------------
+	The new CPagetestReporting::SortEvents
+-----------------------------------------------------------------------------*/
+static void SortStable(EventList & events)
+{
+	EventArray tmp(events.begin(), events.end());
+	CEventOrder order;
+	SortByOrder(tmp, order);
+	events.assign(tmp.begin(), tmp.end());
+}
+
+/*-----------------------------------------------------------------------------
+	The old CheckCombine loops: every event for every script that started 
+	before render
+-----------------------------------------------------------------------------*/
+static size_t CombineScan(const EventList & events, long long startRender)
+{
+	size_t pairs = 0;
+	for( EventList::const_iterator it = events.begin(); it != events.end(); ++it )
+	{
+		const BenchEvent * e = *it;
+		if( e->type == etWinInetRequest && e->start <= startRender && e->script )
+			for( EventList::const_iterator it2 = events.begin(); 
+					it2 != events.end(); ++it2 )
+			{
+				const BenchEvent * e2 = *it2;
+				if( e2->type == etWinInetRequest && e2->start <= startRender && 
+					e2->script )
+					pairs++;
+			}
+	}
+	return pairs;
+}
+
+/*-----------------------------------------------------------------------------
+	The new CheckCombine: build the index and walk the requests that started
+	before render
+-----------------------------------------------------------------------------*/
+static size_t CombineIndex(const EventList & events, long long startRender)
+{
+	EventArray sorted(events.begin(), events.end());
+	CEventOrder order;
+	SortByOrder(sorted, order);
+
+	EventList beforeRender;
+	size_t count = order.StartedBy(startRender);
+	for( size_t i = 0; i < count; i++ )
+		if( sorted[i]->type == etWinInetRequest )
+			beforeRender.push_back(sorted[i]);
+
+	size_t pairs = 0;
+	for( EventList::const_iterator it = beforeRender.begin(); 
+			it != beforeRender.end(); ++it )
+		if( (*it)->script )
+			for( EventList::const_iterator it2 = beforeRender.begin(); 
+					it2 != beforeRender.end(); ++it2 )
+				if( (*it2)->script )
+					pairs++;
+	return pairs;
+}
+
+/*-----------------------------------------------------------------------------
+-----------------------------------------------------------------------------*/
+int main(int argc, char * argv[])
+{
+	size_t max_count = argc > 1 ? (size_t)atoi(argv[1]) : 12000;
+	int failed = 0;
+	printf("%8s %12s %12s %12s %12s\n", "events", "insert ms", "stable ms", 
+			"scan ms", "index ms");
+	for( size_t count = 375; count <= max_count; count *= 2 )
+	{
+		std::vector<BenchEvent> storage;
+		EventList events;
+		MakeEvents(count, storage, events);
+
+		// sort: both have to come out in exactly the same order
+		double insert_ms = 0, stable_ms = 0;
+		EventList inserted, stable;
+		for( int run = 0; run < TIMING_RUNS; run++ )
+		{
+			inserted = events;
+			double start = NowMs();
+			SortByInsertion(inserted);
+			double elapsed = NowMs() - start;
+			if( !run || elapsed < insert_ms )
+				insert_ms = elapsed;
+
+			stable = events;
+			start = NowMs();
+			SortStable(stable);
+			elapsed = NowMs() - start;
+			if( !run || elapsed < stable_ms )
+				stable_ms = elapsed;
+		}
+		if( inserted != stable )
+		{
+			printf("%d events: the stable sort order differs\n", (int)count);
+			failed++;
+		}
+
+		// render about a third of the way through the page
+		long long startRender = stable.back()->start / 3;
+		double scan_ms = 0, index_ms = 0;
+		size_t scan_pairs = 0, index_pairs = 0;
+		for( int run = 0; run < TIMING_RUNS; run++ )
+		{
+			double start = NowMs();
+			scan_pairs = CombineScan(stable, startRender);
+			double elapsed = NowMs() - start;
+			if( !run || elapsed < scan_ms )
+				scan_ms = elapsed;
+
+			start = NowMs();
+			index_pairs = CombineIndex(stable, startRender);
+			elapsed = NowMs() - start;
+			if( !run || elapsed < index_ms )
+				index_ms = elapsed;
+		}
+		if( scan_pairs != index_pairs )
+		{
+			printf("%d events: %d pairs from the index, %d from the scan\n", 
+					(int)count, (int)index_pairs, (int)scan_pairs);
+			failed++;
+		}
+
+		printf("%8d %12.2f %12.2f %12.2f %12.2f\n", (int)count, insert_ms, 
+				stable_ms, scan_ms, index_ms);
+	}
+	printf("%d mismatches\n", failed);
+	return failed ? 1 : 0;
+}
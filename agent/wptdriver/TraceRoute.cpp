@@ -33,12 +33,18 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <iphlpapi.h>
 #include <icmpapi.h>
 
+static const char * TRACEROUTE_SEPARATORS = " ,;\t\r\n";
+static volatile LONG traceroute_count = 0;
+
 /*-----------------------------------------------------------------------------
 -----------------------------------------------------------------------------*/
-CTraceRoute::CTraceRoute(WptTestDriver &test, int maxHops, DWORD timeout):
+CTraceRoute::CTraceRoute(WptTestDriver &test, int maxHops, DWORD timeout,
+                         int probesPerHop, DWORD interval):
   _test(test)
   , _maxHops(maxHops)
-  , _timeout(timeout) {
+  , _timeout(timeout)
+  , _probesPerHop(probesPerHop)
+  , _interval(interval) {
 }
 
 /*-----------------------------------------------------------------------------
@@ -47,17 +53,28 @@ CTraceRoute::~CTraceRoute(void) {
 }
 
 /*-----------------------------------------------------------------------------
+  Trace the route to every host in the test URL (separated by spaces, commas
+  or semicolons).  The first host goes to _traceroute.txt like before and
+  any additional hosts to _traceroute_2.txt, _traceroute_3.txt...
 -----------------------------------------------------------------------------*/
 void CTraceRoute::Run() {
-  __int64 freq, start, end;
-  QueryPerformanceFrequency((LARGE_INTEGER *)&freq);
-  freq = freq / 1000;
-
-  CStringA result = "Hop,IP,ms,FQDN\r\n-1,";
-  CStringA buff;
+  CAtlArray<CStringA> hosts;
+  CStringA url = CT2A(_test._url);
+  int pos = 0;
+  CStringA host = url.Tokenize(TRACEROUTE_SEPARATORS, pos);
+  while (pos >= 0) {
+    hosts.Add(host);
+    host = url.Tokenize(TRACEROUTE_SEPARATORS, pos);
+  }
+  if (hosts.IsEmpty())
+    hosts.Add(url);
 
-  HANDLE hIcmpFile = IcmpCreateFile();
-  if (hIcmpFile != INVALID_HANDLE_VALUE) {
+  // resolve all of the targets
+  CAtlArray<ULONG> addresses;
+  CAtlArray<size_t> target_host;
+  CAtlArray<CStringA> results;
+  for (size_t i = 0; i < hosts.GetCount(); i++) {
+    CStringA result = "Hop,IP,ms,FQDN\r\n-1,";
     unsigned long ipaddr = 0;
     struct addrinfo aiHints;
     memset(&aiHints, 0, sizeof(aiHints));
@@ -65,79 +82,277 @@ void CTraceRoute::Run() {
     aiHints.ai_socktype = SOCK_STREAM;
     aiHints.ai_protocol = IPPROTO_TCP;
     struct addrinfo *aiList = NULL;
-    if( !getaddrinfo(LPCSTR(CT2A(_test._url)), "80", &aiHints, &aiList) && 
+    if( !getaddrinfo(hosts[i], "80", &aiHints, &aiList) && 
       aiList[0].ai_family == AF_INET && 
       aiList[0].ai_addrlen >= sizeof(struct sockaddr_in) &&
       aiList[0].ai_addr) {
       ipaddr = ((struct sockaddr_in *)(aiList[0].ai_addr))->sin_addr.s_addr;
     }
+    if (aiList)
+      freeaddrinfo(aiList);
 
     if (ipaddr) {
       in_addr addr;
       addr.s_addr = ipaddr;
-      result += CStringA(inet_ntoa(addr)) + CStringA(",0,") + 
-                CStringA(CT2A(_test._url)) + "\r\n";
-
-      char SendData[32] = "Slow? Fast? Dunno.  Let's See.";
-      DWORD ReplySize = sizeof(ICMP_ECHO_REPLY) + sizeof(SendData);
-      ICMP_ECHO_REPLY * reply = (ICMP_ECHO_REPLY *)malloc(ReplySize);
-      IP_OPTION_INFORMATION options;
-      DWORD count = 0;
-
-      int hop = 1;
-      bool done = false;
-      int sequentialFailures = 0;
-      while (hop < _maxHops && sequentialFailures < 4 && !done) {
-        memset(&options, 0, sizeof(options));
-        options.Ttl = (UCHAR)hop;
-
-        // time the actual ping
-        QueryPerformanceCounter((LARGE_INTEGER *)&start);
-        count = IcmpSendEcho(hIcmpFile, ipaddr, SendData, sizeof(SendData), 
-                              &options, reply, ReplySize, _timeout);
-        QueryPerformanceCounter((LARGE_INTEGER *)&end);
-
-        double elapsed = (double)(end - start) / (double)freq;
-
-        if (count) {
-          sequentialFailures = 0;
-          if( reply->Status == IP_SUCCESS )
-            done = true;
-
-          // figure out the host name
-          struct sockaddr_in saGNI;
-          char hostname[NI_MAXHOST] = {0};
-          saGNI.sin_family = AF_INET;
-          saGNI.sin_addr.s_addr = reply->Address;
-          saGNI.sin_port = htons(80);
-
-          getnameinfo((struct sockaddr *) &saGNI, sizeof (struct sockaddr),
-                       hostname, NI_MAXHOST, NULL,  0, 0);
-
-          addr.s_addr = reply->Address;
-          buff.Format("%d,%s,%0.3f,%s\r\n", hop, inet_ntoa(addr), elapsed, hostname);
-          result += buff;
+      result += CStringA(inet_ntoa(addr)) + CStringA(",0,") + hosts[i] +
+                "\r\n";
+      addresses.Add(ipaddr);
+      target_host.Add(i);
+    }
+    results.Add(result);
+  }
+
+  if (!addresses.IsEmpty()) {
+    // probe everything at once, falling back to one hop at a time through
+    // the ICMP API if raw sockets aren't available (or get filtered)
+    std::vector<std::vector<TracerouteHop>> hops;
+    if (!RunParallel(addresses, hops)) {
+      hops.clear();
+      hops.resize(addresses.GetCount());
+      for (size_t i = 0; i < addresses.GetCount(); i++)
+        RunSequential(addresses[i], hops[i]);
+    }
+
+    CAtlMap<ULONG, CStringA> names;
+    LookupHostNames(hops, names);
+
+    CStringA buff;
+    for (size_t i = 0; i < hops.size(); i++) {
+      CStringA& result = results[target_host[i]];
+      for (size_t hop = 0; hop < hops[i].size(); hop++) {
+        const TracerouteHop& entry = hops[i][hop];
+        if (entry.responded) {
+          in_addr addr;
+          addr.s_addr = entry.address;
+          CStringA name;
+          names.Lookup(entry.address, name);
+          buff.Format("%d,%s,%0.3f,%s\r\n", entry.ttl, inet_ntoa(addr),
+                      entry.ms, (LPCSTR)name);
         } else {
-          sequentialFailures++;
-          
-          buff.Format("%d,,,\r\n", hop);
-          result += buff;
+          buff.Format("%d,,,\r\n", entry.ttl);
         }
-        hop++;
+        result += buff;
       }
     }
+  }
 
-    // save out the result of the traceroute
-    if (_test._file_base.GetLength()) {
-      HANDLE hFile = CreateFile(_test._file_base + _T("_traceroute.txt"), 
-                                GENERIC_WRITE, 0, 0, CREATE_ALWAYS, 0, 0);
-      if (hFile != INVALID_HANDLE_VALUE) {
-        DWORD written;
-        WriteFile(hFile, (LPCSTR)result, result.GetLength(), &written, 0);
-        CloseHandle(hFile);
+  for (size_t i = 0; i < results.GetCount(); i++)
+    Save(results[i], i);
+}
+
+/*-----------------------------------------------------------------------------
+  Send all of the probes for all of the targets over a raw ICMP socket and
+  let the scheduler match up the replies (needs admin rights, which the
+  agent normally has).
+-----------------------------------------------------------------------------*/
+bool CTraceRoute::RunParallel(CAtlArray<ULONG>& addresses,
+                              std::vector<std::vector<TracerouteHop>>& hops) {
+  bool ok = false;
+  SOCKET s = socket(AF_INET, SOCK_RAW, IPPROTO_ICMP);
+  if (s == INVALID_SOCKET) {
+    WptTrace(loglevel::kTrace,
+             _T("[wptdriver] Traceroute - raw socket not available (%d)\n"),
+             WSAGetLastError());
+    return false;
+  }
+  struct sockaddr_in local;
+  memset(&local, 0, sizeof(local));
+  local.sin_family = AF_INET;
+  local.sin_addr.s_addr = INADDR_ANY;
+  if (!bind(s, (struct sockaddr *)&local, sizeof(local))) {
+    LARGE_INTEGER freq, start, now;
+    QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&start);
+    uint16_t identifier = (uint16_t)((GetCurrentProcessId() << 4) +
+                            InterlockedIncrement(&traceroute_count));
+    // the sequential version stopped one short of max hops
+    TracerouteScheduler scheduler(identifier, _maxHops - 1, _probesPerHop,
+                                  (uint64_t)_interval * 1000,
+                                  (uint64_t)_timeout * 1000);
+    for (size_t i = 0; i < addresses.GetCount(); i++)
+      scheduler.AddTarget(addresses[i]);
+
+    uint8_t packet[TRACEROUTE_PACKET_SIZE];
+    char buff[1500];
+    uint64_t now_us = 0;
+    bool send_failed = false;
+    while (!send_failed && !scheduler.Done(now_us)) {
+      TracerouteProbe probe;
+      while (!send_failed && scheduler.NextProbe(now_us, probe)) {
+        int ttl = probe.ttl;
+        setsockopt(s, IPPROTO_IP, IP_TTL, (const char *)&ttl, sizeof(ttl));
+        TracerouteBuildEcho(identifier, probe.sequence, packet);
+        struct sockaddr_in dest;
+        memset(&dest, 0, sizeof(dest));
+        dest.sin_family = AF_INET;
+        dest.sin_addr.s_addr = scheduler.TargetAddress(probe.target);
+        if (sendto(s, (const char *)packet, sizeof(packet), 0,
+                   (struct sockaddr *)&dest, sizeof(dest)) == SOCKET_ERROR)
+          send_failed = true;
+      }
+
+      uint64_t wait_us = scheduler.NextEvent(now_us);
+      fd_set read_fds;
+      FD_ZERO(&read_fds);
+      FD_SET(s, &read_fds);
+      struct timeval timeout;
+      timeout.tv_sec = (long)(wait_us / 1000000);
+      timeout.tv_usec = (long)(wait_us % 1000000);
+      int ready = select(0, &read_fds, NULL, NULL, &timeout);
+      QueryPerformanceCounter(&now);
+      now_us = (uint64_t)(now.QuadPart - start.QuadPart) * 1000000 /
+               freq.QuadPart;
+      if (ready > 0) {
+        int len = recv(s, buff, sizeof(buff), 0);
+        if (len > 0)
+          scheduler.OnPacket(now_us, (const uint8_t *)buff, len);
+      } else if (ready == SOCKET_ERROR) {
+        send_failed = true;
       }
     }
 
+    if (!send_failed) {
+      hops.resize(addresses.GetCount());
+      for (size_t i = 0; i < addresses.GetCount(); i++) {
+        scheduler.GetHops((uint32_t)i, hops[i]);
+        for (size_t hop = 0; hop < hops[i].size(); hop++)
+          if (hops[i][hop].responded)
+            ok = true;
+      }
+      WptTrace(loglevel::kTrace,
+               _T("[wptdriver] Traceroute - %d probes in %dms\n"),
+               (int)scheduler.ProbesSent(), (int)(now_us / 1000));
+    }
+  }
+  closesocket(s);
+  return ok;
+}
+
+/*-----------------------------------------------------------------------------
+  One probe at a time through the ICMP API (no admin rights needed)
+-----------------------------------------------------------------------------*/
+void CTraceRoute::RunSequential(ULONG address,
+                                std::vector<TracerouteHop>& hops) {
+  __int64 freq, start, end;
+  QueryPerformanceFrequency((LARGE_INTEGER *)&freq);
+  freq = freq / 1000;
+
+  HANDLE hIcmpFile = IcmpCreateFile();
+  if (hIcmpFile != INVALID_HANDLE_VALUE) {
+    char SendData[32] = "Slow? Fast? Dunno.  Let's See.";
+    DWORD ReplySize = sizeof(ICMP_ECHO_REPLY) + sizeof(SendData);
+    ICMP_ECHO_REPLY * reply = (ICMP_ECHO_REPLY *)malloc(ReplySize);
+    IP_OPTION_INFORMATION options;
+    DWORD count = 0;
+
+    int hop = 1;
+    bool done = false;
+    int sequentialFailures = 0;
+    while (hop < _maxHops && sequentialFailures < 4 && !done) {
+      memset(&options, 0, sizeof(options));
+      options.Ttl = (UCHAR)hop;
+
+      // time the actual ping
+      QueryPerformanceCounter((LARGE_INTEGER *)&start);
+      count = IcmpSendEcho(hIcmpFile, address, SendData, sizeof(SendData), 
+                            &options, reply, ReplySize, _timeout);
+      QueryPerformanceCounter((LARGE_INTEGER *)&end);
+
+      TracerouteHop entry;
+      memset(&entry, 0, sizeof(entry));
+      entry.ttl = hop;
+      if (count) {
+        sequentialFailures = 0;
+        if( reply->Status == IP_SUCCESS )
+          done = true;
+        entry.responded = true;
+        entry.address = reply->Address;
+        entry.ms = (double)(end - start) / (double)freq;
+        entry.terminal = done;
+      } else {
+        sequentialFailures++;
+      }
+      hops.push_back(entry);
+      hop++;
+    }
+
+    free(reply);
     IcmpCloseHandle(hIcmpFile);
   }
 }
+
+/*-----------------------------------------------------------------------------
+  Reverse lookups for every address that responded, all at once (a hop
+  without a PTR record can take seconds to time out).
+-----------------------------------------------------------------------------*/
+typedef struct {
+  ULONG address;
+  char  hostname[NI_MAXHOST];
+} HOST_NAME_LOOKUP;
+
+static unsigned __stdcall HostNameLookupThreadProc(void* arg) {
+  HOST_NAME_LOOKUP * lookup = (HOST_NAME_LOOKUP *)arg;
+  struct sockaddr_in saGNI;
+  memset(&saGNI, 0, sizeof(saGNI));
+  saGNI.sin_family = AF_INET;
+  saGNI.sin_addr.s_addr = lookup->address;
+  saGNI.sin_port = htons(80);
+  getnameinfo((struct sockaddr *) &saGNI, sizeof (struct sockaddr),
+               lookup->hostname, NI_MAXHOST, NULL,  0, 0);
+  return 0;
+}
+
+void CTraceRoute::LookupHostNames(
+    std::vector<std::vector<TracerouteHop>>& hops,
+    CAtlMap<ULONG, CStringA>& names) {
+  CAtlArray<HOST_NAME_LOOKUP *> lookups;
+  CAtlArray<HANDLE> threads;
+  for (size_t i = 0; i < hops.size(); i++) {
+    for (size_t hop = 0; hop < hops[i].size(); hop++) {
+      const TracerouteHop& entry = hops[i][hop];
+      if (entry.responded && !names.Lookup(entry.address)) {
+        names.SetAt(entry.address, "");
+        HOST_NAME_LOOKUP * lookup = new HOST_NAME_LOOKUP;
+        memset(lookup, 0, sizeof(HOST_NAME_LOOKUP));
+        lookup->address = entry.address;
+        HANDLE thread = (HANDLE)_beginthreadex(0, 0,
+                          ::HostNameLookupThreadProc, lookup, 0, 0);
+        if (thread) {
+          lookups.Add(lookup);
+          threads.Add(thread);
+        } else {
+          HostNameLookupThreadProc(lookup);
+          names.SetAt(lookup->address, lookup->hostname);
+          delete lookup;
+        }
+      }
+    }
+  }
+  for (size_t i = 0; i < threads.GetCount(); i++) {
+    WaitForSingleObject(threads[i], INFINITE);
+    CloseHandle(threads[i]);
+    names.SetAt(lookups[i]->address, lookups[i]->hostname);
+    delete lookups[i];
+  }
+}
+
+/*-----------------------------------------------------------------------------
+  Save out the result of the traceroute
+-----------------------------------------------------------------------------*/
+void CTraceRoute::Save(CStringA& result, size_t index) {
+  if (_test._file_base.GetLength()) {
+    CString file = _test._file_base + _T("_traceroute");
+    if (index) {
+      CString suffix;
+      suffix.Format(_T("_%d"), (int)index + 1);
+      file += suffix;
+    }
+    HANDLE hFile = CreateFile(file + _T(".txt"), 
+                              GENERIC_WRITE, 0, 0, CREATE_ALWAYS, 0, 0);
+    if (hFile != INVALID_HANDLE_VALUE) {
+      DWORD written;
+      WriteFile(hFile, (LPCSTR)result, result.GetLength(), &written, 0);
+      CloseHandle(hFile);
+    }
+  }
+}
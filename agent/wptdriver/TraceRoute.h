@@ -27,15 +27,26 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 ******************************************************************************/
 
 #pragma once
+#include "traceroute_engine.h"
 
 class CTraceRoute {
 public:
-  CTraceRoute(WptTestDriver &test, int maxHops = 30, DWORD timeout = 1000);
+  CTraceRoute(WptTestDriver &test, int maxHops = 30, DWORD timeout = 1000,
+              int probesPerHop = 3, DWORD interval = 5);
   ~CTraceRoute(void);
   void Run();
 
 private:
+  bool RunParallel(CAtlArray<ULONG>& addresses,
+                   std::vector<std::vector<TracerouteHop>>& hops);
+  void RunSequential(ULONG address, std::vector<TracerouteHop>& hops);
+  void LookupHostNames(std::vector<std::vector<TracerouteHop>>& hops,
+                       CAtlMap<ULONG, CStringA>& names);
+  void Save(CStringA& result, size_t index);
+
   WptTestDriver& _test;
   int _maxHops;
   DWORD _timeout;
+  int _probesPerHop;
+  DWORD _interval;
 };
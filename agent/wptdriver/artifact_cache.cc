@@ -0,0 +1,413 @@
+/******************************************************************************
+Copyright (c) 2013, Google Inc.
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without 
+modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice, 
+      this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+    * Neither the name of the <ORGANIZATION> nor the names of its contributors 
+    may be used to endorse or promote products derived from this software 
+    without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE 
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE 
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL 
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR 
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER 
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, 
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE 
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+******************************************************************************/
+
+#include "StdAfx.h"
+#include "artifact_cache.h"
+#include <Wincrypt.h>
+#include <WinInet.h>
+
+ArtifactCache global_artifact_cache;
+
+static const int ARTIFACT_MAX_AGE_SECONDS = 30 * 86400;  // unused for 30 days
+static const DWORD ARTIFACT_CONNECT_TIMEOUT = 300000;
+static const DWORD ARTIFACT_RECEIVE_TIMEOUT = 360000;
+static const DWORD ARTIFACT_READ_BUFFER = 65536;
+static const DWORD ARTIFACT_WAIT_INTERVAL = 100;
+
+/*-----------------------------------------------------------------------------
+  Incremental MD5 (formatted the same way as HashFileMD5)
+-----------------------------------------------------------------------------*/
+class ArtifactHash {
+public:
+  ArtifactHash(void):_crypto(0), _hash(0) {
+    if (CryptAcquireContext(&_crypto, NULL, NULL, PROV_RSA_FULL,
+                            CRYPT_VERIFYCONTEXT) &&
+        !CryptCreateHash(_crypto, CALG_MD5, 0, 0, &_hash))
+      _hash = 0;
+  }
+  ~ArtifactHash(void) {
+    if (_hash)
+      CryptDestroyHash(_hash);
+    if (_crypto)
+      CryptReleaseContext(_crypto, 0);
+  }
+  bool Add(const void * data, DWORD len) {
+    return _hash && CryptHashData(_hash, (const BYTE *)data, len, 0);
+  }
+  CString Finish(void) {
+    CString result;
+    BYTE h[16];
+    DWORD len = sizeof(h);
+    if (_hash && CryptGetHashParam(_hash, HP_HASHVAL, h, &len, 0)) {
+      TCHAR hex[40];
+      wsprintf(hex, _T("%02X%02X%02X%02X%02X%02X%02X%02X")
+                    _T("%02X%02X%02X%02X%02X%02X%02X%02X"),
+               h[0], h[1], h[2], h[3], h[4], h[5], h[6], h[7],
+               h[8], h[9], h[10], h[11], h[12], h[13], h[14], h[15]);
+      result = hex;
+    }
+    return result;
+  }
+
+private:
+  HCRYPTPROV  _crypto;
+  HCRYPTHASH  _hash;
+};
+
+/*-----------------------------------------------------------------------------
+-----------------------------------------------------------------------------*/
+static CString QueryHeader(HINTERNET request, DWORD header) {
+  CString value;
+  TCHAR buff[1024];
+  DWORD len = sizeof(buff);
+  DWORD index = 0;
+  if (HttpQueryInfo(request, header, buff, &len, &index))
+    value = buff;
+  return value;
+}
+
+/*-----------------------------------------------------------------------------
+-----------------------------------------------------------------------------*/
+ArtifactCache::ArtifactCache(void):
+  _initialized(false) {
+  InitializeCriticalSection(&cs);
+}
+
+/*-----------------------------------------------------------------------------
+-----------------------------------------------------------------------------*/
+ArtifactCache::~ArtifactCache(void) {
+  DeleteCriticalSection(&cs);
+}
+
+/*-----------------------------------------------------------------------------
+  Make sure the content for the given url is in the cache (and matches the
+  md5 if one is provided) and return the path to the cached copy.
+  Setting *cancel aborts the download, the partial file is kept so it can
+  be resumed.
+-----------------------------------------------------------------------------*/
+bool ArtifactCache::Fetch(CString url, CString md5, CString& cached_file,
+                          volatile LONG * cancel) {
+  bool ok = false;
+  bool download = false;
+  url.Trim();
+  md5.Trim();
+  md5.MakeUpper();
+  CString key;
+  EnterCriticalSection(&cs);
+  if (url.GetLength() && Init()) {
+    key = UrlKey(url);
+    bool waiting = true;
+    while (waiting) {
+      if (md5.GetLength() && FileExists(ObjectPath(md5))) {
+        // a known hash never needs to go to the network
+        cached_file = ObjectPath(md5);
+        ok = true;
+        waiting = false;
+      } else if (cancel && *cancel) {
+        waiting = false;
+      } else if (!_downloading.Find(key)) {
+        _downloading.AddTail(key);
+        download = true;
+        waiting = false;
+      } else {
+        LeaveCriticalSection(&cs);
+        Sleep(ARTIFACT_WAIT_INTERVAL);
+        EnterCriticalSection(&cs);
+      }
+    }
+  }
+  LeaveCriticalSection(&cs);
+
+  if (download) {
+    CString known = GetIndex(key, _T("md5"));
+    bool conditional = !md5.GetLength() && known.GetLength() &&
+                       FileExists(ObjectPath(known));
+    CString hash;
+    bool not_modified = false;
+    if (Download(url, key, md5, conditional, hash, not_modified, cancel)) {
+      if (not_modified)
+        hash = known;
+      cached_file = ObjectPath(hash);
+      ok = true;
+    }
+    EnterCriticalSection(&cs);
+    POSITION pos = _downloading.Find(key);
+    if (pos)
+      _downloading.RemoveAt(pos);
+    LeaveCriticalSection(&cs);
+  }
+  if (ok)
+    Touch(cached_file);
+  WptTrace(loglevel::kFunction,
+           _T("[wptdriver] ArtifactCache::Fetch %s - %s\n"), (LPCTSTR)url,
+           ok ? (LPCTSTR)cached_file : _T("FAILED"));
+  return ok;
+}
+
+/*-----------------------------------------------------------------------------
+  Fetch and put a private copy of the file at the given location
+-----------------------------------------------------------------------------*/
+bool ArtifactCache::FetchTo(CString url, CString md5, CString destination,
+                            volatile LONG * cancel) {
+  bool ok = false;
+  CString cached_file;
+  if (Fetch(url, md5, cached_file, cancel)) {
+    TCHAR directory[MAX_PATH];
+    lstrcpyn(directory, destination, _countof(directory));
+    *PathFindFileName(directory) = NULL;
+    if (lstrlen(directory) > 3)
+      SHCreateDirectoryEx(NULL, directory, NULL);
+    ok = CopyFile(cached_file, destination, FALSE) != FALSE;
+    if (ok)
+      SetFileAttributes(destination, FILE_ATTRIBUTE_NORMAL);
+  }
+  return ok;
+}
+
+/*-----------------------------------------------------------------------------
+  Set up the cache directories and expire anything that hasn't been used
+-----------------------------------------------------------------------------*/
+bool ArtifactCache::Init(void) {
+  if (!_initialized) {
+    CString app_data = CreateAppDataDir();
+    if (app_data.GetLength()) {
+      _directory = app_data + _T("\\artifacts");
+      CreateDirectory(_directory, NULL);
+      CreateDirectory(_directory + _T("\\partial"), NULL);
+      _index = _directory + _T("\\index.ini");
+      DeleteOldDirectoryEntries(_directory + _T("\\objects"),
+                                ARTIFACT_MAX_AGE_SECONDS);
+      DeleteOldDirectoryEntries(_directory + _T("\\partial"),
+                                ARTIFACT_MAX_AGE_SECONDS);
+      CreateDirectory(_directory + _T("\\objects"), NULL);
+      _initialized = true;
+    }
+  }
+  return _initialized;
+}
+
+/*-----------------------------------------------------------------------------
+  Stream the url into the partial file for it, hashing as it arrives.
+  Resumes an earlier partial download when the server still has the same
+  version (If-Range) and revalidates the cached copy when asked to.
+  Runs without the lock, the caller owns the url key while it is in flight.
+-----------------------------------------------------------------------------*/
+bool ArtifactCache::Download(CString url, CString key, CString md5,
+                             bool conditional, CString& hash,
+                             bool& not_modified, volatile LONG * cancel) {
+  bool ok = false;
+  not_modified = false;
+  if (cancel && *cancel)
+    return false;
+  CString partial = _directory + _T("\\partial\\") + key;
+
+  // only resume if we know which version the partial file came from
+  LONGLONG partial_size = 0;
+  CString validator = GetIndex(key, _T("partial_validator"));
+  WIN32_FILE_ATTRIBUTE_DATA info;
+  if (validator.GetLength() &&
+      GetFileAttributesEx(partial, GetFileExInfoStandard, &info))
+    partial_size = ((LONGLONG)info.nFileSizeHigh << 32) | info.nFileSizeLow;
+
+  CString headers;
+  if (partial_size) {
+    headers.Format(_T("Range: bytes=%I64d-\r\nIf-Range: %s\r\n"),
+                   partial_size, (LPCTSTR)validator);
+  } else if (conditional) {
+    CString etag = GetIndex(key, _T("etag"));
+    CString last_modified = GetIndex(key, _T("last_modified"));
+    if (etag.GetLength())
+      headers += _T("If-None-Match: ") + etag + _T("\r\n");
+    if (last_modified.GetLength())
+      headers += _T("If-Modified-Since: ") + last_modified + _T("\r\n");
+  }
+
+  HINTERNET internet = InternetOpen(_T("WebPagetest Driver"),
+                                    INTERNET_OPEN_TYPE_PRECONFIG,
+                                    NULL, NULL, 0);
+  if (internet) {
+    DWORD timeout = ARTIFACT_CONNECT_TIMEOUT;
+    DWORD fetch_timeout = ARTIFACT_RECEIVE_TIMEOUT;
+    InternetSetOption(internet, INTERNET_OPTION_CONNECT_TIMEOUT,
+                      &timeout, sizeof(timeout));
+    InternetSetOption(internet, INTERNET_OPTION_RECEIVE_TIMEOUT,
+                      &fetch_timeout, sizeof(fetch_timeout));
+    InternetSetOption(internet, INTERNET_OPTION_SEND_TIMEOUT,
+                      &timeout, sizeof(timeout));
+    HINTERNET request = NULL;
+    if (!cancel || !*cancel)
+      request = InternetOpenUrl(internet, url,
+                              headers.GetLength() ? (LPCTSTR)headers : NULL,
+                              headers.GetLength() ? (DWORD)-1 : 0,
+                              INTERNET_FLAG_NO_CACHE_WRITE |
+                              INTERNET_FLAG_NO_UI |
+                              INTERNET_FLAG_PRAGMA_NOCACHE |
+                              INTERNET_FLAG_RELOAD, NULL);
+    if (request) {
+      // non-HTTP urls don't have a status, treat them as a full response
+      DWORD status = 200;
+      DWORD len = sizeof(status);
+      DWORD index = 0;
+      if (!HttpQueryInfo(request, HTTP_QUERY_STATUS_CODE |
+                         HTTP_QUERY_FLAG_NUMBER, &status, &len, &index))
+        status = 200;
+      CString etag = QueryHeader(request, HTTP_QUERY_ETAG);
+      CString last_modified = QueryHeader(request, HTTP_QUERY_LAST_MODIFIED);
+      if (status == 304 && conditional) {
+        not_modified = true;
+        ok = true;
+      } else if (status == 416) {
+        // the partial file doesn't match the resource any more
+        DeleteFile(partial);
+        SetIndex(key, _T("partial_validator"), _T(""));
+      } else if (status == 200 || (status == 206 && partial_size)) {
+        ArtifactHash content_hash;
+        bool hashed = true;
+        HANDLE file = INVALID_HANDLE_VALUE;
+        BYTE * buff = (BYTE *)malloc(ARTIFACT_READ_BUFFER);
+        if (buff && status == 206) {
+          // hash what we already have and append the rest
+          file = CreateFile(partial, GENERIC_READ | GENERIC_WRITE, 0, 0,
+                            OPEN_EXISTING, 0, 0);
+          if (file != INVALID_HANDLE_VALUE) {
+            DWORD bytes = 0;
+            while (hashed && ReadFile(file, buff, ARTIFACT_READ_BUFFER,
+                                      &bytes, 0) && bytes)
+              hashed = content_hash.Add(buff, bytes);
+            SetFilePointer(file, 0, 0, FILE_END);
+          }
+        } else if (buff) {
+          file = CreateFile(partial, GENERIC_WRITE, 0, 0, CREATE_ALWAYS, 0, 0);
+          validator = etag.GetLength() ? etag : last_modified;
+          SetIndex(key, _T("partial_validator"), validator);
+        }
+        if (file != INVALID_HANDLE_VALUE) {
+          bool complete = false;
+          bool failed = !hashed;
+          DWORD bytes = 0;
+          while (!failed && !complete) {
+            if (cancel && *cancel) {
+              failed = true;
+            } else if (!InternetReadFile(request, buff, ARTIFACT_READ_BUFFER,
+                                         &bytes)) {
+              failed = true;
+            } else if (!bytes) {
+              complete = true;
+            } else {
+              DWORD written = 0;
+              if (!WriteFile(file, buff, bytes, &written, 0) ||
+                  written != bytes || !content_hash.Add(buff, bytes))
+                failed = true;
+            }
+          }
+          CloseHandle(file);
+          if (complete) {
+            hash = content_hash.Finish();
+            if (hash.GetLength() && (!md5.GetLength() || hash == md5)) {
+              if (FileExists(ObjectPath(hash)) ||
+                  MoveFileEx(partial, ObjectPath(hash),
+                             MOVEFILE_REPLACE_EXISTING)) {
+                DeleteFile(partial);
+                SetIndex(key, _T("url"), url);
+                SetIndex(key, _T("md5"), hash);
+                SetIndex(key, _T("etag"), etag);
+                SetIndex(key, _T("last_modified"), last_modified);
+                SetIndex(key, _T("partial_validator"), _T(""));
+                ok = true;
+              }
+            } else {
+              WptTrace(loglevel::kTrace,
+                       _T("[wptdriver] Hash mismatch - %s (expected %s)\n"),
+                       (LPCTSTR)hash, (LPCTSTR)md5);
+              DeleteFile(partial);
+              SetIndex(key, _T("partial_validator"), _T(""));
+            }
+          }
+        }
+        if (buff)
+          free(buff);
+      }
+      InternetCloseHandle(request);
+    }
+    InternetCloseHandle(internet);
+  }
+  return ok;
+}
+
+/*-----------------------------------------------------------------------------
+-----------------------------------------------------------------------------*/
+CString ArtifactCache::ObjectPath(CString hash) {
+  return _directory + _T("\\objects\\") + hash;
+}
+
+/*-----------------------------------------------------------------------------
+  Index section for a url (the url itself can't be used as an ini section)
+-----------------------------------------------------------------------------*/
+CString ArtifactCache::UrlKey(CString url) {
+  CStringA utf8 = CT2A(url, CP_UTF8);
+  ArtifactHash url_hash;
+  url_hash.Add((LPCSTR)utf8, utf8.GetLength());
+  return url_hash.Finish();
+}
+
+/*-----------------------------------------------------------------------------
+-----------------------------------------------------------------------------*/
+CString ArtifactCache::GetIndex(CString key, LPCTSTR name) {
+  TCHAR buff[4096];
+  CString value;
+  EnterCriticalSection(&cs);
+  if (GetPrivateProfileString(key, name, _T(""), buff, _countof(buff),
+                              _index))
+    value = buff;
+  LeaveCriticalSection(&cs);
+  return value;
+}
+
+/*-----------------------------------------------------------------------------
+-----------------------------------------------------------------------------*/
+void ArtifactCache::SetIndex(CString key, LPCTSTR name, CString value) {
+  EnterCriticalSection(&cs);
+  WritePrivateProfileString(key, name,
+                            value.GetLength() ? (LPCTSTR)value : NULL, _index);
+  LeaveCriticalSection(&cs);
+}
+
+/*-----------------------------------------------------------------------------
+  Mark the cached file as used so it doesn't expire
+-----------------------------------------------------------------------------*/
+void ArtifactCache::Touch(CString file) {
+  HANDLE file_handle = CreateFile(file, FILE_WRITE_ATTRIBUTES,
+                                  FILE_SHARE_READ | FILE_SHARE_WRITE, 0,
+                                  OPEN_EXISTING, 0, 0);
+  if (file_handle != INVALID_HANDLE_VALUE) {
+    FILETIME now;
+    GetSystemTimeAsFileTime(&now);
+    SetFileTime(file_handle, NULL, NULL, &now);
+    CloseHandle(file_handle);
+  }
+}
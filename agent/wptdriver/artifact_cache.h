@@ -0,0 +1,71 @@
+/******************************************************************************
+Copyright (c) 2013, Google Inc.
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without 
+modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice, 
+      this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+    * Neither the name of the <ORGANIZATION> nor the names of its contributors 
+    may be used to endorse or promote products derived from this software 
+    without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE 
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE 
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL 
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR 
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER 
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, 
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE 
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+******************************************************************************/
+
+#pragma once
+
+/*-----------------------------------------------------------------------------
+  Local cache of downloaded installers and browser packages.
+
+  Files are stored by the MD5 of their contents so a package that is
+  already on disk is never fetched (or re-hashed) again, no matter which
+  URL it is requested from.  Per-URL validators (ETag/Last-Modified) are
+  kept in an index so a URL without a known hash can be revalidated with a
+  conditional GET.  Downloads are hashed while they stream in and an
+  interrupted download is resumed with a range request the next time.
+
+  The lock only covers the index, downloads run without it (a second
+  request for a url that is already downloading waits for that download).
+-----------------------------------------------------------------------------*/
+class ArtifactCache {
+public:
+  ArtifactCache(void);
+  ~ArtifactCache(void);
+
+  bool Fetch(CString url, CString md5, CString& cached_file,
+             volatile LONG * cancel = NULL);
+  bool FetchTo(CString url, CString md5, CString destination,
+               volatile LONG * cancel = NULL);
+
+private:
+  bool Init(void);
+  bool Download(CString url, CString key, CString md5, bool conditional,
+                CString& hash, bool& not_modified, volatile LONG * cancel);
+  CString ObjectPath(CString hash);
+  CString UrlKey(CString url);
+  CString GetIndex(CString key, LPCTSTR name);
+  void SetIndex(CString key, LPCTSTR name, CString value);
+  void Touch(CString file);
+
+  CRITICAL_SECTION  cs;
+  bool              _initialized;
+  CString           _directory;
+  CString           _index;
+  CAtlList<CString> _downloading;     // url keys with a download in flight
+};
+
+extern ArtifactCache global_artifact_cache;
@@ -0,0 +1,572 @@
+/******************************************************************************
+Copyright (c) 2013, Google Inc.
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without 
+modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice, 
+      this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+    * Neither the name of the <ORGANIZATION> nor the names of its contributors 
+    may be used to endorse or promote products derived from this software 
+    without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE 
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE 
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL 
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR 
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER 
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, 
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE 
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+******************************************************************************/
+
+#include "StdAfx.h"
+#include "profile_snapshots.h"
+#include <winioctl.h>
+
+ProfileSnapshots global_profile_snapshots;
+
+static const TCHAR * TRASH_DIRECTORY = _T("wpt-trash");
+static const TCHAR * STORE_DIRECTORY = _T("wpt-profile-store");
+static const LONGLONG MAX_CACHED_FILE = 1024 * 1024;
+static const size_t MAX_CACHED_BYTES = 64 * 1024 * 1024;
+static const LONGLONG MAX_CLONE_CHUNK = 1024 * 1024 * 1024;
+static const DWORD PURGE_STOP_TIMEOUT = 10000;
+
+// Block cloning (ReFS) definitions missing from older SDKs
+#ifndef FILE_SUPPORTS_BLOCK_REFCOUNTING
+#define FILE_SUPPORTS_BLOCK_REFCOUNTING 0x08000000
+#endif
+#ifndef FSCTL_DUPLICATE_EXTENTS_TO_FILE
+#define FSCTL_DUPLICATE_EXTENTS_TO_FILE \
+    CTL_CODE(FILE_DEVICE_FILE_SYSTEM, 209, METHOD_BUFFERED, FILE_WRITE_ACCESS)
+typedef struct _DUPLICATE_EXTENTS_DATA {
+  HANDLE FileHandle;
+  LARGE_INTEGER SourceFileOffset;
+  LARGE_INTEGER TargetFileOffset;
+  LARGE_INTEGER ByteCount;
+} DUPLICATE_EXTENTS_DATA;
+#endif
+#ifndef THREAD_MODE_BACKGROUND_BEGIN
+#define THREAD_MODE_BACKGROUND_BEGIN 0x00010000
+#endif
+
+/*-----------------------------------------------------------------------------
+-----------------------------------------------------------------------------*/
+static unsigned __stdcall PurgeThreadProc(void* arg) {
+  ProfileSnapshots * snapshots = (ProfileSnapshots *)arg;
+  if (snapshots)
+    snapshots->PurgeThread();
+  return 0;
+}
+
+/*-----------------------------------------------------------------------------
+-----------------------------------------------------------------------------*/
+ProfileSnapshots::ProfileSnapshots(void):
+  _cached_bytes(0)
+  , _trash_count(0)
+  , _purge_thread(NULL)
+  , _purge_paused(0)
+  , _exit(0) {
+  InitializeCriticalSection(&cs);
+  QueryPerformanceFrequency(&_frequency);
+  _purge_event = CreateEvent(NULL, FALSE, FALSE, NULL);
+}
+
+/*-----------------------------------------------------------------------------
+-----------------------------------------------------------------------------*/
+ProfileSnapshots::~ProfileSnapshots(void) {
+  Stop();
+  POSITION pos = _templates.GetStartPosition();
+  while (pos)
+    delete _templates.GetNextValue(pos);
+  _templates.RemoveAll();
+  pos = _content.GetStartPosition();
+  while (pos)
+    delete _content.GetNextValue(pos);
+  _content.RemoveAll();
+  if (_purge_event)
+    CloseHandle(_purge_event);
+  DeleteCriticalSection(&cs);
+}
+
+/*-----------------------------------------------------------------------------
+  Start timing a profile reset (the stats cover everything until EndReset)
+-----------------------------------------------------------------------------*/
+void ProfileSnapshots::BeginReset(void) {
+  LARGE_INTEGER now;
+  QueryPerformanceCounter(&now);
+  _stats.Reset();
+  _stats._start = now.QuadPart;
+}
+
+/*-----------------------------------------------------------------------------
+-----------------------------------------------------------------------------*/
+void ProfileSnapshots::EndReset(void) {
+  LARGE_INTEGER now;
+  QueryPerformanceCounter(&now);
+  _stats._total_ticks = now.QuadPart - _stats._start;
+}
+
+/*-----------------------------------------------------------------------------
+-----------------------------------------------------------------------------*/
+CStringA ProfileSnapshots::GetResetJSON(void) {
+  double ms = _frequency.QuadPart ? 1000.0 / (double)_frequency.QuadPart : 0;
+  CStringA json;
+  json.Format("{\"reset_ms\":%.3f,\"discard_ms\":%.3f,"
+              "\"materialize_ms\":%.3f,\"discarded\":%d,\"deleted\":%d,"
+              "\"files\":%d,\"bytes\":%I64d,\"cloned\":%d,\"cached\":%d,"
+              "\"copied\":%d}",
+              (double)_stats._total_ticks * ms,
+              (double)_stats._discard_ticks * ms,
+              (double)_stats._materialize_ticks * ms,
+              _stats._discarded, _stats._deleted, _stats._files,
+              _stats._bytes, _stats._cloned, _stats._cached, _stats._copied);
+  return json;
+}
+
+/*-----------------------------------------------------------------------------
+  Build a fresh copy of the template in the (empty) destination directory
+-----------------------------------------------------------------------------*/
+bool ProfileSnapshots::Materialize(CString template_dir, CString destination) {
+  bool ok = false;
+  LARGE_INTEGER start, end;
+  QueryPerformanceCounter(&start);
+  template_dir.TrimRight(_T('\\'));
+  destination.TrimRight(_T('\\'));
+  CAtlArray<ProfileTemplateEntry> * entries = ScanTemplate(template_dir);
+  if (entries) {
+    ok = true;
+    SHCreateDirectoryEx(NULL, destination, NULL);
+    CString volume = VolumeRoot(destination);
+    DWORD cluster_size = CloneClusterSize(volume);
+    for (size_t i = 0; i < entries->GetCount(); i++) {
+      ProfileTemplateEntry& entry = entries->GetAt(i);
+      CString dest = destination + _T("\\") + entry._path;
+      if (entry._is_directory) {
+        CreateDirectory(dest, NULL);
+      } else {
+        CString src = template_dir + _T("\\") + entry._path;
+        ProfileContent * content = entry._content;
+        _stats._files++;
+        _stats._bytes += entry._size;
+        if (content && cluster_size &&
+            CloneFromStore(content, src, dest, volume, cluster_size,
+                           entry._write_time)) {
+          _stats._cloned++;
+        } else if (content &&
+                   (LONGLONG)content->_data.GetCount() == entry._size &&
+                   WriteFromMemory(content, dest, entry._write_time)) {
+          _stats._cached++;
+        } else {
+          CopyFile(src, dest, FALSE);
+          SetFileAttributes(dest, FILE_ATTRIBUTE_NORMAL);
+          _stats._copied++;
+        }
+      }
+    }
+  }
+  QueryPerformanceCounter(&end);
+  _stats._materialize_ticks += end.QuadPart - start.QuadPart;
+  return ok;
+}
+
+/*-----------------------------------------------------------------------------
+  Same semantics as DeleteDirectory (optionally keeping the directory
+  itself) but the contents are moved out of the way for the background
+  purge instead of being deleted in-line.
+-----------------------------------------------------------------------------*/
+void ProfileSnapshots::Discard(CString directory, bool remove) {
+  LARGE_INTEGER start, end;
+  QueryPerformanceCounter(&start);
+  directory.TrimRight(_T('\\'));
+  if (directory.GetLength() &&
+      GetFileAttributes(directory) != INVALID_FILE_ATTRIBUTES) {
+    if (remove) {
+      if (MoveToTrash(directory)) {
+        _stats._discarded++;
+      } else {
+        DeleteDirectory(directory, true);
+        _stats._deleted++;
+      }
+    } else {
+      WIN32_FIND_DATA fd;
+      HANDLE find = FindFirstFile(directory + _T("\\*.*"), &fd);
+      if (find != INVALID_HANDLE_VALUE) {
+        do {
+          if (lstrcmp(fd.cFileName, _T(".")) &&
+              lstrcmp(fd.cFileName, _T(".."))) {
+            CString path = directory + _T("\\") + fd.cFileName;
+            if (MoveToTrash(path)) {
+              _stats._discarded++;
+            } else {
+              if (fd.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
+                DeleteDirectory(path, true);
+              else
+                DeleteFile(path);
+              _stats._deleted++;
+            }
+          }
+        } while (FindNextFile(find, &fd));
+        FindClose(find);
+      }
+    }
+  }
+  QueryPerformanceCounter(&end);
+  _stats._discard_ticks += end.QuadPart - start.QuadPart;
+}
+
+/*-----------------------------------------------------------------------------
+  Stop purging while a test is running so it doesn't compete for the disk
+-----------------------------------------------------------------------------*/
+void ProfileSnapshots::PausePurge(void) {
+  InterlockedExchange(&_purge_paused, 1);
+}
+
+/*-----------------------------------------------------------------------------
+-----------------------------------------------------------------------------*/
+void ProfileSnapshots::ResumePurge(void) {
+  InterlockedExchange(&_purge_paused, 0);
+  if (_purge_event)
+    SetEvent(_purge_event);
+}
+
+/*-----------------------------------------------------------------------------
+-----------------------------------------------------------------------------*/
+void ProfileSnapshots::Stop(void) {
+  InterlockedExchange(&_exit, 1);
+  if (_purge_thread) {
+    SetEvent(_purge_event);
+    WaitForSingleObject(_purge_thread, PURGE_STOP_TIMEOUT);
+    CloseHandle(_purge_thread);
+    _purge_thread = NULL;
+  }
+}
+
+/*-----------------------------------------------------------------------------
+  Empty the trash directories whenever purging is allowed
+-----------------------------------------------------------------------------*/
+void ProfileSnapshots::PurgeThread(void) {
+  SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_LOWEST);
+  SetThreadPriority(GetCurrentThread(), THREAD_MODE_BACKGROUND_BEGIN);
+  while (!_exit) {
+    WaitForSingleObject(_purge_event, INFINITE);
+    CAtlList<CString> trash;
+    EnterCriticalSection(&cs);
+    trash.AddTailList(&_trash_directories);
+    LeaveCriticalSection(&cs);
+    POSITION pos = trash.GetHeadPosition();
+    while (pos && !_exit && !_purge_paused) {
+      CString directory = trash.GetNext(pos);
+      WIN32_FIND_DATA fd;
+      HANDLE find = FindFirstFile(directory + _T("\\*.*"), &fd);
+      if (find != INVALID_HANDLE_VALUE) {
+        bool keep_going = true;
+        do {
+          if (lstrcmp(fd.cFileName, _T(".")) &&
+              lstrcmp(fd.cFileName, _T(".."))) {
+            CString path = directory + _T("\\") + fd.cFileName;
+            if (fd.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) {
+              keep_going = PurgeDirectory(path);
+            } else {
+              SetFileAttributes(path, FILE_ATTRIBUTE_NORMAL);
+              DeleteFile(path);
+              keep_going = !_exit && !_purge_paused;
+            }
+          }
+        } while (keep_going && FindNextFile(find, &fd));
+        FindClose(find);
+      }
+    }
+  }
+}
+
+/*-----------------------------------------------------------------------------
+  Recursively delete a directory, bailing out as soon as purging is paused
+-----------------------------------------------------------------------------*/
+bool ProfileSnapshots::PurgeDirectory(CString directory) {
+  bool complete = true;
+  WIN32_FIND_DATA fd;
+  HANDLE find = FindFirstFile(directory + _T("\\*.*"), &fd);
+  if (find != INVALID_HANDLE_VALUE) {
+    do {
+      if (lstrcmp(fd.cFileName, _T(".")) && lstrcmp(fd.cFileName, _T(".."))) {
+        CString path = directory + _T("\\") + fd.cFileName;
+        if (fd.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) {
+          complete = PurgeDirectory(path);
+        } else {
+          if (fd.dwFileAttributes & FILE_ATTRIBUTE_READONLY)
+            SetFileAttributes(path, FILE_ATTRIBUTE_NORMAL);
+          DeleteFile(path);
+        }
+        if (_exit || _purge_paused)
+          complete = false;
+      }
+    } while (complete && FindNextFile(find, &fd));
+    FindClose(find);
+  }
+  if (complete) {
+    SetFileAttributes(directory, FILE_ATTRIBUTE_NORMAL);
+    RemoveDirectory(directory);
+  }
+  return complete;
+}
+
+/*-----------------------------------------------------------------------------
+  Rename a file or directory into the trash on its volume
+-----------------------------------------------------------------------------*/
+bool ProfileSnapshots::MoveToTrash(CString path) {
+  bool moved = false;
+  CString volume = VolumeRoot(path);
+  if (volume.GetLength()) {
+    CString trash = volume + TRASH_DIRECTORY;
+    EnterCriticalSection(&cs);
+    if (!_trash_directories.Find(trash)) {
+      if (CreateDirectory(trash, NULL) ||
+          GetLastError() == ERROR_ALREADY_EXISTS) {
+        SetFileAttributes(trash, FILE_ATTRIBUTE_HIDDEN);
+        _trash_directories.AddTail(trash);
+      }
+    }
+    bool have_trash = _trash_directories.Find(trash) != NULL;
+    LeaveCriticalSection(&cs);
+    if (have_trash) {
+      CString name;
+      name.Format(_T("%s\\%08X-%08X-%d"), (LPCTSTR)trash,
+                  GetCurrentProcessId(), GetTickCount(), ++_trash_count);
+      // no MOVEFILE_COPY_ALLOWED, only a rename is any faster than deleting
+      if (MoveFileEx(path, name, 0)) {
+        moved = true;
+        StartPurgeThread();
+      }
+    }
+  }
+  return moved;
+}
+
+/*-----------------------------------------------------------------------------
+-----------------------------------------------------------------------------*/
+void ProfileSnapshots::StartPurgeThread(void) {
+  if (!_purge_thread && _purge_event && !_exit)
+    _purge_thread = (HANDLE)_beginthreadex(0, 0, ::PurgeThreadProc, this, 0,
+                                           0);
+  if (!_purge_paused)
+    SetEvent(_purge_event);
+}
+
+/*-----------------------------------------------------------------------------
+  Get the template's file list, re-hashing only files that changed since
+  the last time it was used
+-----------------------------------------------------------------------------*/
+CAtlArray<ProfileTemplateEntry> * ProfileSnapshots::ScanTemplate(
+    CString template_dir) {
+  CAtlArray<ProfileTemplateEntry> * entries = NULL;
+  if (template_dir.GetLength() &&
+      GetFileAttributes(template_dir) != INVALID_FILE_ATTRIBUTES) {
+    CString key = template_dir;
+    key.MakeLower();
+    CAtlArray<ProfileTemplateEntry> * previous_entries = NULL;
+    _templates.Lookup(key, previous_entries);
+    CAtlMap<CString, ProfileTemplateEntry *> previous;
+    if (previous_entries) {
+      for (size_t i = 0; i < previous_entries->GetCount(); i++) {
+        ProfileTemplateEntry& entry = previous_entries->GetAt(i);
+        previous.SetAt(entry._path, &entry);
+      }
+    }
+    entries = new CAtlArray<ProfileTemplateEntry>;
+    ScanDirectory(template_dir, _T(""), *entries, previous);
+    _templates.SetAt(key, entries);
+    if (previous_entries)
+      delete previous_entries;
+  }
+  return entries;
+}
+
+/*-----------------------------------------------------------------------------
+  Directories are listed before their contents so they can be created in
+  order when the template is materialized.
+-----------------------------------------------------------------------------*/
+void ProfileSnapshots::ScanDirectory(CString root, CString relative,
+                       CAtlArray<ProfileTemplateEntry>& entries,
+                       CAtlMap<CString, ProfileTemplateEntry *>& previous) {
+  CString directory = relative.GetLength() ? root + _T("\\") + relative : root;
+  WIN32_FIND_DATA fd;
+  HANDLE find = FindFirstFile(directory + _T("\\*.*"), &fd);
+  if (find != INVALID_HANDLE_VALUE) {
+    CAtlList<CString> directories;
+    do {
+      if (lstrcmp(fd.cFileName, _T(".")) && lstrcmp(fd.cFileName, _T(".."))) {
+        ProfileTemplateEntry entry;
+        entry._path = relative.GetLength() ?
+                      relative + _T("\\") + fd.cFileName : fd.cFileName;
+        if (fd.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) {
+          entry._is_directory = true;
+          directories.AddTail(entry._path);
+        } else {
+          entry._size = ((LONGLONG)fd.nFileSizeHigh << 32) | fd.nFileSizeLow;
+          entry._write_time = fd.ftLastWriteTime;
+          ProfileTemplateEntry * last = NULL;
+          if (previous.Lookup(entry._path, last) && last &&
+              last->_size == entry._size &&
+              !CompareFileTime(&last->_write_time, &entry._write_time))
+            entry._content = last->_content;
+          else
+            entry._content = GetContent(directory + _T("\\") + fd.cFileName,
+                                        entry._size);
+        }
+        entries.Add(entry);
+      }
+    } while (FindNextFile(find, &fd));
+    FindClose(find);
+    POSITION pos = directories.GetHeadPosition();
+    while (pos)
+      ScanDirectory(root, directories.GetNext(pos), entries, previous);
+  }
+}
+
+/*-----------------------------------------------------------------------------
+  Find (or add) the content-addressed copy of a template file.  Small files
+  are kept in memory so materializing them is a single write.
+-----------------------------------------------------------------------------*/
+ProfileContent * ProfileSnapshots::GetContent(CString file, LONGLONG size) {
+  ProfileContent * content = NULL;
+  CString hash = HashFileMD5(file);
+  if (hash.GetLength() && !_content.Lookup(hash, content)) {
+    content = new ProfileContent;
+    content->_hash = hash;
+    content->_size = size;
+    if (size <= MAX_CACHED_FILE &&
+        _cached_bytes + (size_t)size <= MAX_CACHED_BYTES) {
+      HANDLE file_handle = CreateFile(file, GENERIC_READ, FILE_SHARE_READ, 0,
+                                      OPEN_EXISTING, 0, 0);
+      if (file_handle != INVALID_HANDLE_VALUE) {
+        DWORD bytes = 0;
+        if (content->_data.SetCount((size_t)size) &&
+            (!size || (ReadFile(file_handle, content->_data.GetData(),
+                                (DWORD)size, &bytes, 0) &&
+                       bytes == (DWORD)size)))
+          _cached_bytes += (size_t)size;
+        else
+          content->_data.RemoveAll();
+        CloseHandle(file_handle);
+      }
+    }
+    _content.SetAt(hash, content);
+  }
+  return content;
+}
+
+/*-----------------------------------------------------------------------------
+-----------------------------------------------------------------------------*/
+bool ProfileSnapshots::WriteFromMemory(ProfileContent * content, CString dest,
+                                       const FILETIME& write_time) {
+  bool ok = false;
+  HANDLE file = CreateFile(dest, GENERIC_WRITE, 0, 0, CREATE_ALWAYS,
+                           FILE_ATTRIBUTE_NORMAL, 0);
+  if (file != INVALID_HANDLE_VALUE) {
+    DWORD len = (DWORD)content->_data.GetCount();
+    DWORD written = 0;
+    ok = !len || (WriteFile(file, content->_data.GetData(), len, &written, 0)
+                  && written == len);
+    SetFileTime(file, NULL, NULL, &write_time);
+    CloseHandle(file);
+  }
+  return ok;
+}
+
+/*-----------------------------------------------------------------------------
+  Block-clone the file from the volume's content store (copying it into
+  the store the first time it is needed).  The clone shares the extents
+  with the store copy until the browser writes to it.
+-----------------------------------------------------------------------------*/
+bool ProfileSnapshots::CloneFromStore(ProfileContent * content, CString source,
+                                      CString dest, CString volume,
+                                      DWORD cluster_size,
+                                      const FILETIME& write_time) {
+  bool ok = false;
+  CString store = volume + STORE_DIRECTORY;
+  CString stored = store + _T("\\") + content->_hash;
+  if (GetFileAttributes(stored) == INVALID_FILE_ATTRIBUTES) {
+    CreateDirectory(store, NULL);
+    CString temp = stored + _T(".tmp");
+    if (CopyFile(source, temp, FALSE)) {
+      SetFileAttributes(temp, FILE_ATTRIBUTE_NORMAL);
+      if (!MoveFileEx(temp, stored, MOVEFILE_REPLACE_EXISTING))
+        DeleteFile(temp);
+    }
+  }
+  HANDLE src = CreateFile(stored, GENERIC_READ, FILE_SHARE_READ, 0,
+                          OPEN_EXISTING, 0, 0);
+  if (src != INVALID_HANDLE_VALUE) {
+    HANDLE dst = CreateFile(dest, GENERIC_READ | GENERIC_WRITE, 0, 0,
+                            CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, 0);
+    if (dst != INVALID_HANDLE_VALUE) {
+      LARGE_INTEGER size;
+      size.QuadPart = content->_size;
+      ok = SetFilePointerEx(dst, size, NULL, FILE_BEGIN) &&
+           SetEndOfFile(dst);
+      // the clone ranges have to be cluster-aligned, the end of the file
+      // (already set) trims the last one
+      LONGLONG offset = 0;
+      while (ok && offset < content->_size) {
+        LONGLONG len = min(MAX_CLONE_CHUNK, content->_size - offset);
+        len = (len + cluster_size - 1) / cluster_size * cluster_size;
+        DUPLICATE_EXTENTS_DATA extents;
+        extents.FileHandle = src;
+        extents.SourceFileOffset.QuadPart = offset;
+        extents.TargetFileOffset.QuadPart = offset;
+        extents.ByteCount.QuadPart = len;
+        DWORD bytes = 0;
+        ok = DeviceIoControl(dst, FSCTL_DUPLICATE_EXTENTS_TO_FILE, &extents,
+                             sizeof(extents), NULL, 0, &bytes, NULL) != FALSE;
+        offset += len;
+      }
+      if (ok)
+        SetFileTime(dst, NULL, NULL, &write_time);
+      CloseHandle(dst);
+      if (!ok)
+        DeleteFile(dest);
+    }
+    CloseHandle(src);
+  }
+  return ok;
+}
+
+/*-----------------------------------------------------------------------------
+  Cluster size of the volume if it supports block cloning, 0 otherwise
+-----------------------------------------------------------------------------*/
+DWORD ProfileSnapshots::CloneClusterSize(CString volume) {
+  DWORD cluster_size = 0;
+  if (volume.GetLength() && !_clone_cluster_size.Lookup(volume, cluster_size)) {
+    DWORD flags = 0;
+    if (GetVolumeInformation(volume, NULL, 0, NULL, NULL, &flags, NULL, 0) &&
+        (flags & FILE_SUPPORTS_BLOCK_REFCOUNTING)) {
+      DWORD sectors_per_cluster, bytes_per_sector, free_clusters, clusters;
+      if (GetDiskFreeSpace(volume, &sectors_per_cluster, &bytes_per_sector,
+                           &free_clusters, &clusters))
+        cluster_size = sectors_per_cluster * bytes_per_sector;
+    }
+    _clone_cluster_size.SetAt(volume, cluster_size);
+  }
+  return cluster_size;
+}
+
+/*-----------------------------------------------------------------------------
+  Root of the volume the path lives on (with a trailing backslash)
+-----------------------------------------------------------------------------*/
+CString ProfileSnapshots::VolumeRoot(CString path) {
+  CString volume;
+  TCHAR root[MAX_PATH];
+  if (GetVolumePathName(path, root, _countof(root)))
+    volume = root;
+  if (volume.GetLength() && volume.Right(1) != _T("\\"))
+    volume += _T("\\");
+  return volume;
+}
@@ -0,0 +1,145 @@
+/******************************************************************************
+Copyright (c) 2013, Google Inc.
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without 
+modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice, 
+      this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+    * Neither the name of the <ORGANIZATION> nor the names of its contributors 
+    may be used to endorse or promote products derived from this software 
+    without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE 
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE 
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL 
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR 
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER 
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, 
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE 
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+******************************************************************************/
+
+#pragma once
+
+/*-----------------------------------------------------------------------------
+  Per-reset accounting (reported with each run)
+-----------------------------------------------------------------------------*/
+class ProfileResetStats {
+public:
+  ProfileResetStats(void) { Reset(); }
+  void Reset(void) { memset(this, 0, sizeof(*this)); }
+
+  LONGLONG  _start;
+  LONGLONG  _total_ticks;
+  LONGLONG  _discard_ticks;
+  LONGLONG  _materialize_ticks;
+  DWORD     _discarded;   // entries renamed into the trash
+  DWORD     _deleted;     // entries that had to be deleted in-line
+  DWORD     _files;
+  LONGLONG  _bytes;
+  DWORD     _cloned;      // block-cloned from the store
+  DWORD     _cached;      // written from the in-memory copy
+  DWORD     _copied;
+};
+
+/*-----------------------------------------------------------------------------
+  A template file, addressed by the hash of its contents so identical files
+  in different templates share the in-memory and on-disk copies.
+-----------------------------------------------------------------------------*/
+class ProfileContent {
+public:
+  ProfileContent(void):_size(0) {}
+  CString           _hash;
+  LONGLONG          _size;
+  CAtlArray<BYTE>   _data;  // empty if the file is too large to cache
+};
+
+class ProfileTemplateEntry {
+public:
+  ProfileTemplateEntry(void):_is_directory(false), _size(0), _content(NULL){
+    _write_time.dwLowDateTime = _write_time.dwHighDateTime = 0;
+  }
+  CString           _path;  // relative to the template root
+  bool              _is_directory;
+  LONGLONG          _size;
+  FILETIME          _write_time;
+  ProfileContent *  _content;
+};
+
+/*-----------------------------------------------------------------------------
+  Builds browser profiles from the templates and disposes of used profile
+  and cache directories without making the next run wait on the disk.
+
+  Materialize: the template is scanned (metadata only, files are only
+  re-hashed when their size or time stamp changes) and every file is
+  block-cloned from a per-volume content store when the file system
+  supports it (ReFS), written from memory for small files or copied.
+  Hardlinks are deliberately not used, the browsers update profile files in
+  place and would write straight through into the template.
+
+  Discard: entries are renamed into a trash directory on the same volume
+  and purged by a low-priority background thread that only runs while the
+  agent is idle between tests.  Anything that can't be renamed (in use,
+  different volume) is deleted in-line the way it always was.
+-----------------------------------------------------------------------------*/
+class ProfileSnapshots {
+public:
+  ProfileSnapshots(void);
+  ~ProfileSnapshots(void);
+
+  void BeginReset(void);
+  void EndReset(void);
+  CStringA GetResetJSON(void);
+
+  bool Materialize(CString template_dir, CString destination);
+  void Discard(CString directory, bool remove = true);
+
+  void PausePurge(void);
+  void ResumePurge(void);
+  void Stop(void);
+  void PurgeThread(void);
+
+private:
+  CAtlArray<ProfileTemplateEntry> * ScanTemplate(CString template_dir);
+  void ScanDirectory(CString root, CString relative,
+                     CAtlArray<ProfileTemplateEntry>& entries,
+                     CAtlMap<CString, ProfileTemplateEntry *>& previous);
+  ProfileContent * GetContent(CString file, LONGLONG size);
+  bool WriteFromMemory(ProfileContent * content, CString dest,
+                       const FILETIME& write_time);
+  bool CloneFromStore(ProfileContent * content, CString source, CString dest,
+                      CString volume, DWORD cluster_size,
+                      const FILETIME& write_time);
+  DWORD CloneClusterSize(CString volume);
+  CString VolumeRoot(CString path);
+  bool MoveToTrash(CString path);
+  bool PurgeDirectory(CString directory);
+  void StartPurgeThread(void);
+
+  CRITICAL_SECTION  cs;
+  ProfileResetStats _stats;
+  LARGE_INTEGER     _frequency;
+
+  // template file lists by (lower-case) template directory
+  CAtlMap<CString, CAtlArray<ProfileTemplateEntry> *> _templates;
+  CAtlMap<CString, ProfileContent *>  _content;        // by hash
+  size_t                              _cached_bytes;
+  CAtlMap<CString, DWORD>             _clone_cluster_size;  // by volume, 0
+                                                           // if unsupported
+
+  CAtlList<CString> _trash_directories;
+  DWORD             _trash_count;
+  HANDLE            _purge_thread;
+  HANDLE            _purge_event;
+  volatile LONG     _purge_paused;
+  volatile LONG     _exit;
+};
+
+extern ProfileSnapshots global_profile_snapshots;
@@ -1,6 +1,7 @@
 #include "StdAfx.h"
 #include "software_update.h"
 #include "wpt_status.h"
+#include "artifact_cache.h"
 #include <Shellapi.h>
 
 static const DWORD SOFTWARE_UPDATE_INTERVAL_MINUTES = 60;  // hourly
@@ -11,7 +12,13 @@ static const TCHAR * SOFTWARE_REG_ROOT =
 /*-----------------------------------------------------------------------------
 -----------------------------------------------------------------------------*/
 SoftwareUpdate::SoftwareUpdate(WptStatus &status):
-  _status(status) {
+  _status(status)
+  ,_background_thread(NULL)
+  ,_stop_event(NULL)
+  ,_paused(0)
+  ,_install_pending(0) {
+  InitializeCriticalSection(&cs);
+  _resume_event = CreateEvent(NULL, TRUE, TRUE, NULL);
   // figure out what our working diriectory is
   TCHAR path[MAX_PATH];
   if( SUCCEEDED(SHGetFolderPath(NULL, CSIDL_APPDATA | CSIDL_FLAG_CREATE,
@@ -32,6 +39,10 @@ SoftwareUpdate::SoftwareUpdate(WptStatus &status):
 /*-----------------------------------------------------------------------------
 -----------------------------------------------------------------------------*/
 SoftwareUpdate::~SoftwareUpdate(void) {
+  StopBackgroundChecks();
+  if (_resume_event)
+    CloseHandle(_resume_event);
+  DeleteCriticalSection(&cs);
 }
 
 /*-----------------------------------------------------------------------------
@@ -74,65 +85,88 @@ void SoftwareUpdate::LoadSettings(CString settings_ini) {
 bool SoftwareUpdate::UpdateSoftware(bool force) {
   bool ok = true;
   if (force || TimeToCheck()) {
-    ok = UpdateBrowsers();
-    if (ok && _software_url.GetLength()) {
-      CString info = HttpGetText(_software_url);
-      if (info.GetLength()) {
-        CString app, version, command, file_url, md5;
-        int token_position = 0;
-        CString line = info.Tokenize(_T("\r\n"), token_position).Trim();
-        while (ok && token_position >= 0) {
-          if (line.Left(1) == _T('[')) {
-            if (app.GetLength()) {
-              ok = InstallSoftware(app, file_url, md5, version, command, 1, 
-                                    _T(""));
-            }
-            app = line.Trim(_T("[] \t"));
-            version.Empty();
-            command.Empty();
-            file_url.Empty();
-            md5.Empty();
-          } else if (app.GetLength()) {
-            int separator = line.Find(_T('='));
-            if (separator > 0) {
-              CString tag = line.Left(separator).Trim().MakeLower();
-              CString value = line.Mid(separator + 1).Trim();
-              if (tag == _T("url"))
-                file_url = value;
-              else if (tag == _T("md5"))
-                md5 = value;
-              else if (tag == _T("version"))
-                version = value;
-              else if (tag == _T("command"))
-                command = value;
-            }
+    EnterCriticalSection(&cs);
+    InterlockedExchange(&_install_pending, 0);
+    ok = CheckSoftware(false);
+    if (ok) {
+      QueryPerformanceCounter(&_last_update_check);
+    }
+    LeaveCriticalSection(&cs);
+  }
+  return ok;
+}
+
+/*-----------------------------------------------------------------------------
+  Check all of the browsers and software packages for new versions and
+  either install them or (prefetch) just make sure the installers are in
+  the local cache.  A prefetch stops as soon as a test pauses it (the
+  metadata fetches can't be cancelled once they start so they are skipped).
+-----------------------------------------------------------------------------*/
+bool SoftwareUpdate::CheckSoftware(bool prefetch) {
+  bool ok = UpdateBrowsers(prefetch);
+  if (ok && _software_url.GetLength() && !(prefetch && _paused)) {
+    CString info = HttpGetText(_software_url);
+    if (info.GetLength()) {
+      CString app, version, command, file_url, md5;
+      int token_position = 0;
+      CString line = info.Tokenize(_T("\r\n"), token_position).Trim();
+      while (ok && token_position >= 0 && !(prefetch && _paused)) {
+        if (line.Left(1) == _T('[')) {
+          if (app.GetLength()) {
+            ok = InstallSoftware(app, file_url, md5, version, command, 1,
+                                 _T(""), prefetch);
+          }
+          app = line.Trim(_T("[] \t"));
+          version.Empty();
+          command.Empty();
+          file_url.Empty();
+          md5.Empty();
+        } else if (app.GetLength()) {
+          int separator = line.Find(_T('='));
+          if (separator > 0) {
+            CString tag = line.Left(separator).Trim().MakeLower();
+            CString value = line.Mid(separator + 1).Trim();
+            if (tag == _T("url"))
+              file_url = value;
+            else if (tag == _T("md5"))
+              md5 = value;
+            else if (tag == _T("version"))
+              version = value;
+            else if (tag == _T("command"))
+              command = value;
           }
-          line = info.Tokenize(_T("\r\n"), token_position).Trim();
-        }
-        if (ok && app.GetLength()) {
-          ok = InstallSoftware(app, file_url, md5, version, command, 1, 
-                                _T(""));
         }
+        line = info.Tokenize(_T("\r\n"), token_position).Trim();
+      }
+      if (ok && app.GetLength() && !(prefetch && _paused)) {
+        ok = InstallSoftware(app, file_url, md5, version, command, 1,
+                               _T(""), prefetch);
       }
-    }
-    if (ok) {
-      QueryPerformanceCounter(&_last_update_check);
     }
   }
   return ok;
 }
 
 /*-----------------------------------------------------------------------------
+  A prefetch runs without the lock so it works from its own copy of the
+  browser list.
 -----------------------------------------------------------------------------*/
-bool SoftwareUpdate::UpdateBrowsers(void) {
+bool SoftwareUpdate::UpdateBrowsers(bool prefetch) {
   bool ok = true;
   WptTrace(loglevel::kFunction,
             _T("[wptdriver] SoftwareUpdate::UpdateBrowsers\n"));
-  POSITION pos = _browsers.GetHeadPosition();
-  while (ok && pos) {
+  CAtlList<BrowserInfo> prefetch_browsers;
+  if (prefetch) {
+    EnterCriticalSection(&cs);
+    prefetch_browsers.AddTailList(&_browsers);
+    LeaveCriticalSection(&cs);
+  }
+  CAtlList<BrowserInfo>& browsers = prefetch ? prefetch_browsers : _browsers;
+  POSITION pos = browsers.GetHeadPosition();
+  while (ok && pos && !(prefetch && _paused)) {
     DWORD update = 1;
     POSITION current_pos = pos;
-    BrowserInfo browser_info = _browsers.GetNext(pos);
+    BrowserInfo browser_info = browsers.GetNext(pos);
     CString url = browser_info._installer.Trim();
     if (url.GetLength()) {
       WptTrace(loglevel::kFunction,
@@ -164,13 +198,13 @@ bool SoftwareUpdate::UpdateBrowsers(void) {
         }
 
         ok = InstallSoftware(browser, file_url, md5, version, command, update,
-                              browser_info._exe);
+                              browser_info._exe, prefetch);
       }
     }
 
     // if we don't need to automatically update the browser then 
     // remove it from the list
-    if (ok && !update) {
+    if (ok && !update && !prefetch) {
       _browsers.RemoveAt(current_pos);
     }
   }
@@ -181,10 +215,12 @@ bool SoftwareUpdate::UpdateBrowsers(void) {
 }
 
 /*-----------------------------------------------------------------------------
-  Download and install the software if necessary
+  Download and install the software if necessary (or only download it into
+  the cache when prefetching)
 -----------------------------------------------------------------------------*/
 bool SoftwareUpdate::InstallSoftware(CString app, CString file_url,CString md5,
-          CString version, CString command, DWORD update, CString check_file) {
+          CString version, CString command, DWORD update, CString check_file,
+          bool prefetch) {
   bool ok = true;
   bool already_installed = false;
 
@@ -208,8 +244,13 @@ bool SoftwareUpdate::InstallSoftware(CString app, CString file_url,CString md5,
           install = false;
       }
 
-      // download and install it
-      if (install) {
+      if (install && prefetch) {
+        // get the installer into the cache, it is installed between tests
+        CString cached_file;
+        if (global_artifact_cache.Fetch(file_url, md5, cached_file, &_paused))
+          InterlockedExchange(&_install_pending, 1);
+      } else if (install) {
+        // download and install it
         ok = false;
         DeleteDirectory(_directory, false);
         int file_pos = file_url.ReverseFind(_T('/'));
@@ -219,63 +260,53 @@ bool SoftwareUpdate::InstallSoftware(CString app, CString file_url,CString md5,
           _status.Set(_T("Downloading installer for %s"), (LPCTSTR)app);
           WptTrace(loglevel::kTrace,
                     _T("[wptdriver] Downloading - %s\n"), (LPCTSTR)file_url);
-          if (HttpSaveFile(file_url, file_path)) {
-            if (md5.GetLength()) {
-              CString file_md5 = HashFileMD5(file_path);
-              if (file_md5.CompareNoCase(md5)) {
-                WptTrace(loglevel::kTrace,
-                          _T("[wptdriver] Hash mismatch - %s (expected %s)\n"), (LPCTSTR)file_md5, (LPCTSTR)md5);
-                install = false;
+          if (global_artifact_cache.FetchTo(file_url, md5, file_path)) {
+            // run the install command from the download directory
+            SHELLEXECUTEINFO shell_info;
+            memset(&shell_info, 0, sizeof(shell_info));
+            shell_info.cbSize = sizeof(shell_info);
+            shell_info.fMask = SEE_MASK_NOCLOSEPROCESS | SEE_MASK_NOASYNC;
+            TCHAR exe[MAX_PATH];
+            TCHAR parameters[MAX_PATH];
+            int separator = command.Find(_T(' '));
+            if (separator > 0) {
+              lstrcpy(exe, command.Left(separator).Trim());
+              lstrcpy(parameters, command.Mid(separator + 1).Trim());
+              if (lstrlen(parameters)) {
+                shell_info.lpParameters = parameters;
               }
+            } else {
+              lstrcpy(exe, command);
+              lstrcpy(parameters, _T(''));
             }
-            if (install) {
-              // run the install command from the download directory
-              SHELLEXECUTEINFO shell_info;
-              memset(&shell_info, 0, sizeof(shell_info));
-              shell_info.cbSize = sizeof(shell_info);
-              shell_info.fMask = SEE_MASK_NOCLOSEPROCESS | SEE_MASK_NOASYNC;
-              TCHAR exe[MAX_PATH];
-              TCHAR parameters[MAX_PATH];
-              int separator = command.Find(_T(' '));
-              if (separator > 0) {
-                lstrcpy(exe, command.Left(separator).Trim());
-                lstrcpy(parameters, command.Mid(separator + 1).Trim());
-                if (lstrlen(parameters)) {
-                  shell_info.lpParameters = parameters;
-                }
-              } else {
-                lstrcpy(exe, command);
-                lstrcpy(parameters, _T(''));
-              }
-              shell_info.lpFile = exe;
-              TCHAR directory[MAX_PATH];
-              lstrcpy(directory, _directory);
-              shell_info.lpDirectory = directory;
-              shell_info.nShow = SW_SHOWNORMAL;
-              _status.Set(_T("Installing %s"), (LPCTSTR)app);
-              WptTrace(loglevel::kTrace,
-                 _T("[wptdriver] Running '%s' with parameters '%s' in '%s'\n"),
-                 exe, parameters, directory);
-              if (ShellExecuteEx(&shell_info) && shell_info.hProcess) {
-                if (WaitForSingleObject(shell_info.hProcess, 
-                      SOFTWARE_INSTALL_TIMEOUT) == WAIT_OBJECT_0) {
-                  WaitForChildProcesses(GetProcessId(shell_info.hProcess), SOFTWARE_INSTALL_TIMEOUT);
-                  WaitForProcessesByName(exe, SOFTWARE_INSTALL_TIMEOUT);
-                  ok = true;
-                }
-                CloseHandle(shell_info.hProcess);
-              } else {
-                _status.Set(_T("Error installing %s"), (LPCTSTR)app);
-                WptTrace(loglevel::kTrace,
-                          _T("[wptdriver] Error Running Installer\n"));
+            shell_info.lpFile = exe;
+            TCHAR directory[MAX_PATH];
+            lstrcpy(directory, _directory);
+            shell_info.lpDirectory = directory;
+            shell_info.nShow = SW_SHOWNORMAL;
+            _status.Set(_T("Installing %s"), (LPCTSTR)app);
+            WptTrace(loglevel::kTrace,
+               _T("[wptdriver] Running '%s' with parameters '%s' in '%s'\n"),
+               exe, parameters, directory);
+            if (ShellExecuteEx(&shell_info) && shell_info.hProcess) {
+              if (WaitForSingleObject(shell_info.hProcess, 
+                    SOFTWARE_INSTALL_TIMEOUT) == WAIT_OBJECT_0) {
+                WaitForChildProcesses(GetProcessId(shell_info.hProcess), SOFTWARE_INSTALL_TIMEOUT);
+                WaitForProcessesByName(exe, SOFTWARE_INSTALL_TIMEOUT);
+                ok = true;
               }
+              CloseHandle(shell_info.hProcess);
             } else {
-              _status.Set(_T("Error downloading installer for %s"),
-                          (LPCTSTR)app);
+              _status.Set(_T("Error installing %s"), (LPCTSTR)app);
               WptTrace(loglevel::kTrace,
-                        _T("[wptdriver] File download corrupt\n"));
+                        _T("[wptdriver] Error Running Installer\n"));
             }
             DeleteFile(file_path);
+          } else {
+            _status.Set(_T("Error downloading installer for %s"),
+                        (LPCTSTR)app);
+            WptTrace(loglevel::kTrace,
+                      _T("[wptdriver] File download failed or corrupt\n"));
           }
         }
         if (ok) {
@@ -337,3 +368,83 @@ bool SoftwareUpdate::ReInstallBrowser(CString browser) {
   }
   return UpdateSoftware(true);
 }
+
+/*-----------------------------------------------------------------------------
+-----------------------------------------------------------------------------*/
+static unsigned __stdcall BackgroundCheckThreadProc(void* arg) {
+  SoftwareUpdate * software_update = (SoftwareUpdate *)arg;
+  if (software_update)
+    software_update->BackgroundThread();
+  return 0;
+}
+
+/*-----------------------------------------------------------------------------
+  Start a low-priority thread that periodically checks for updates and pulls
+  the installers into the artifact cache while the agent is idle.
+-----------------------------------------------------------------------------*/
+void SoftwareUpdate::StartBackgroundChecks(void) {
+  if (!_background_thread) {
+    _stop_event = CreateEvent(NULL, TRUE, FALSE, NULL);
+    _background_thread = (HANDLE)_beginthreadex(0, 0,
+                              ::BackgroundCheckThreadProc, this, 0, 0);
+    if (!_background_thread) {
+      CloseHandle(_stop_event);
+      _stop_event = NULL;
+    }
+  }
+}
+
+/*-----------------------------------------------------------------------------
+-----------------------------------------------------------------------------*/
+void SoftwareUpdate::StopBackgroundChecks(void) {
+  if (_background_thread) {
+    InterlockedIncrement(&_paused);
+    SetEvent(_stop_event);
+    WaitForSingleObject(_background_thread, INFINITE);
+    CloseHandle(_background_thread);
+    _background_thread = NULL;
+    CloseHandle(_stop_event);
+    _stop_event = NULL;
+    InterlockedDecrement(&_paused);
+  }
+}
+
+/*-----------------------------------------------------------------------------
+  Pausing also cancels any download that is in flight (it resumes from the
+  partial file the next time around).
+-----------------------------------------------------------------------------*/
+void SoftwareUpdate::PauseBackgroundChecks(void) {
+  InterlockedIncrement(&_paused);
+  ResetEvent(_resume_event);
+}
+
+/*-----------------------------------------------------------------------------
+-----------------------------------------------------------------------------*/
+void SoftwareUpdate::ResumeBackgroundChecks(void) {
+  if (!InterlockedDecrement(&_paused))
+    SetEvent(_resume_event);
+}
+
+/*-----------------------------------------------------------------------------
+-----------------------------------------------------------------------------*/
+void SoftwareUpdate::BackgroundThread(void) {
+  SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_BELOW_NORMAL);
+  DWORD interval = SOFTWARE_UPDATE_INTERVAL_MINUTES * 60000;
+  DWORD delay = 0;
+  HANDLE events[2] = {_stop_event, _resume_event};
+  while (WaitForSingleObject(_stop_event, delay) == WAIT_TIMEOUT) {
+    // only run while the agent is between tests
+    if (WaitForMultipleObjects(2, events, FALSE, INFINITE) != WAIT_OBJECT_0+1)
+      break;
+    WptTrace(loglevel::kFunction,
+              _T("[wptdriver] SoftwareUpdate::BackgroundThread - checking\n"));
+    // no lock, a test that starts while this is downloading pauses it and
+    // an install between tests must not wait for the network
+    bool ok = CheckSoftware(true);
+    // if the check was interrupted by a test, pick it back up when idle
+    if (_paused)
+      delay = 0;
+    else
+      delay = ok ? interval : 60000;
+  }
+}
@@ -26,6 +26,15 @@ public:
   bool UpdateSoftware(bool force = false);
   bool ReInstallBrowser(CString browser);
 
+  // download updates in the background (installs still happen inline)
+  void StartBackgroundChecks(void);
+  void StopBackgroundChecks(void);
+  void PauseBackgroundChecks(void);
+  void ResumeBackgroundChecks(void);
+  bool BackgroundChecksActive(void) const {return _background_thread != NULL;}
+  bool InstallPending(void) const { return _install_pending != 0; }
+  void BackgroundThread(void);
+
 protected:
   CAtlList<BrowserInfo> _browsers;
   CString           _software_url;
@@ -33,10 +42,18 @@ protected:
   LARGE_INTEGER     _last_update_check;
   LARGE_INTEGER     _perf_frequency_minutes;
   WptStatus         &_status;
+  CRITICAL_SECTION  cs;
+  HANDLE            _background_thread;
+  HANDLE            _stop_event;
+  HANDLE            _resume_event;
+  volatile LONG     _paused;           // also cancels background downloads
+  volatile LONG     _install_pending;
 
-  bool UpdateBrowsers(void);
+  bool CheckSoftware(bool prefetch);
+  bool UpdateBrowsers(bool prefetch);
   bool InstallSoftware(CString browser, CString file_url, CString md5,
-           CString version, CString command, DWORD update, CString check_file);
+           CString version, CString command, DWORD update, CString check_file,
+           bool prefetch);
   bool TimeToCheck(void);
 };
 
@@ -0,0 +1,351 @@
+/******************************************************************************
+Copyright (c) 2013, Google Inc.
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without 
+modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice, 
+      this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+    * Neither the name of the <ORGANIZATION> nor the names of its contributors 
+    may be used to endorse or promote products derived from this software 
+    without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE 
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE 
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL 
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR 
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER 
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, 
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE 
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+******************************************************************************/
+
+// No precompiled header, this file has to build without the Windows SDK
+#include "traceroute_engine.h"
+#include <string.h>
+
+static const char TRACEROUTE_PAYLOAD[TRACEROUTE_PAYLOAD_SIZE] =
+    "Slow? Fast? Dunno.  Let's See.";
+static const int TRACEROUTE_MAX_FAILURES = 4;  // consecutive silent hops
+static const size_t TRACEROUTE_MAX_PROBES = 0x10000;  // 16-bit sequence
+
+static const uint8_t ICMP_ECHO_REPLY_TYPE = 0;
+static const uint8_t ICMP_UNREACHABLE_TYPE = 3;
+static const uint8_t ICMP_ECHO_TYPE = 8;
+static const uint8_t ICMP_TIME_EXCEEDED_TYPE = 11;
+static const uint8_t IP_PROTOCOL_ICMP = 1;
+
+/*-----------------------------------------------------------------------------
+-----------------------------------------------------------------------------*/
+static inline uint16_t ReadUint16(const uint8_t * p) {
+  return (uint16_t)((p[0] << 8) | p[1]);
+}
+
+/*-----------------------------------------------------------------------------
+  Addresses are kept in network byte order (the same as in_addr.s_addr)
+-----------------------------------------------------------------------------*/
+static inline uint32_t ReadAddress(const uint8_t * p) {
+  uint32_t address;
+  memcpy(&address, p, sizeof(address));
+  return address;
+}
+
+/*-----------------------------------------------------------------------------
+  Length of the IPv4 header at the start of the buffer (0 if it isn't one)
+-----------------------------------------------------------------------------*/
+static size_t IpHeaderLength(const uint8_t * packet, size_t len) {
+  size_t header_len = 0;
+  if (len >= 20 && (packet[0] >> 4) == 4) {
+    header_len = (packet[0] & 0x0F) * 4;
+    if (header_len < 20 || header_len > len ||
+        packet[9] != IP_PROTOCOL_ICMP)
+      header_len = 0;
+  }
+  return header_len;
+}
+
+/*-----------------------------------------------------------------------------
+  Build an ICMP echo request (header + payload, TRACEROUTE_PACKET_SIZE bytes)
+-----------------------------------------------------------------------------*/
+void TracerouteBuildEcho(uint16_t identifier, uint16_t sequence,
+                         uint8_t * packet) {
+  memset(packet, 0, 8);
+  packet[0] = ICMP_ECHO_TYPE;
+  packet[4] = (uint8_t)(identifier >> 8);
+  packet[5] = (uint8_t)(identifier & 0xFF);
+  packet[6] = (uint8_t)(sequence >> 8);
+  packet[7] = (uint8_t)(sequence & 0xFF);
+  memcpy(packet + 8, TRACEROUTE_PAYLOAD, TRACEROUTE_PAYLOAD_SIZE);
+  uint32_t sum = 0;
+  for (size_t i = 0; i < TRACEROUTE_PACKET_SIZE; i += 2)
+    sum += ReadUint16(packet + i);
+  while (sum >> 16)
+    sum = (sum & 0xFFFF) + (sum >> 16);
+  uint16_t checksum = (uint16_t)~sum;
+  packet[2] = (uint8_t)(checksum >> 8);
+  packet[3] = (uint8_t)(checksum & 0xFF);
+}
+
+/*-----------------------------------------------------------------------------
+  Pull the identifier and sequence number of the probe a raw ICMP packet
+  (IP header included, the way raw sockets deliver them) is responding to.
+  Echo replies carry them directly, time exceeded and unreachable messages
+  quote the IP header and first 8 bytes of the original probe.
+-----------------------------------------------------------------------------*/
+bool TracerouteParseReply(const uint8_t * packet, size_t len,
+                          TracerouteReply& reply) {
+  bool ok = false;
+  size_t header_len = IpHeaderLength(packet, len);
+  if (header_len && len >= header_len + 8) {
+    const uint8_t * icmp = packet + header_len;
+    reply.responder = ReadAddress(packet + 12);
+    if (icmp[0] == ICMP_ECHO_REPLY_TYPE) {
+      reply.identifier = ReadUint16(icmp + 4);
+      reply.sequence = ReadUint16(icmp + 6);
+      reply.probed = reply.responder;
+      reply.status = TRACEROUTE_ECHO_REPLY;
+      ok = true;
+    } else if (icmp[0] == ICMP_TIME_EXCEEDED_TYPE ||
+               icmp[0] == ICMP_UNREACHABLE_TYPE) {
+      const uint8_t * inner = icmp + 8;
+      size_t inner_len = len - header_len - 8;
+      size_t inner_header_len = IpHeaderLength(inner, inner_len);
+      if (inner_header_len && inner_len >= inner_header_len + 8 &&
+          inner[inner_header_len] == ICMP_ECHO_TYPE) {
+        reply.identifier = ReadUint16(inner + inner_header_len + 4);
+        reply.sequence = ReadUint16(inner + inner_header_len + 6);
+        reply.probed = ReadAddress(inner + 16);
+        reply.status = icmp[0] == ICMP_TIME_EXCEEDED_TYPE ?
+            TRACEROUTE_TIME_EXCEEDED : TRACEROUTE_UNREACHABLE;
+        ok = true;
+      }
+    }
+  }
+  return ok;
+}
+
+/*-----------------------------------------------------------------------------
+-----------------------------------------------------------------------------*/
+TracerouteScheduler::TracerouteScheduler(uint16_t identifier, int max_hops,
+    int probes_per_hop, uint64_t interval_us, uint64_t timeout_us):
+  _identifier(identifier)
+  ,_max_hops(max_hops > 0 ? max_hops : 1)
+  ,_probes_per_hop(probes_per_hop > 0 ? probes_per_hop : 1)
+  ,_interval_us(interval_us)
+  ,_timeout_us(timeout_us)
+  ,_last_send_us(0)
+  ,_planned(false)
+  ,_next(0)
+  ,_sent(0)
+  ,_outstanding(0) {
+}
+
+/*-----------------------------------------------------------------------------
+-----------------------------------------------------------------------------*/
+TracerouteScheduler::~TracerouteScheduler(void) {
+}
+
+/*-----------------------------------------------------------------------------
+  Targets have to be added before the first probe goes out
+-----------------------------------------------------------------------------*/
+uint32_t TracerouteScheduler::AddTarget(uint32_t address) {
+  Target target;
+  target.address = address;
+  target.terminal_ttl = 0;
+  _targets.push_back(target);
+  return (uint32_t)(_targets.size() - 1);
+}
+
+/*-----------------------------------------------------------------------------
+  Lay the probes out in send order (which is also their sequence number).
+  All of the TTLs for all of the targets go out before the next round of
+  attempts so a full path is mapped as early as possible and the repeat
+  probes for a hop are spread out in time (routers rate-limit ICMP).
+-----------------------------------------------------------------------------*/
+void TracerouteScheduler::Plan(void) {
+  _planned = true;
+  _probes.clear();
+  for (int attempt = 0; attempt < _probes_per_hop; attempt++) {
+    for (int ttl = 1; ttl <= _max_hops; ttl++) {
+      for (uint32_t target = 0; target < _targets.size(); target++) {
+        if (_probes.size() < TRACEROUTE_MAX_PROBES) {
+          TracerouteProbe probe;
+          memset(&probe, 0, sizeof(probe));
+          probe.target = target;
+          probe.ttl = ttl;
+          probe.attempt = attempt;
+          probe.sequence = (uint16_t)_probes.size();
+          probe.status = TRACEROUTE_NOT_SENT;
+          _probes.push_back(probe);
+        }
+      }
+    }
+  }
+}
+
+/*-----------------------------------------------------------------------------
+  Hand out the next probe if the pacing interval allows it.  Probes past
+  the point where a target has already been reached are skipped.
+-----------------------------------------------------------------------------*/
+bool TracerouteScheduler::NextProbe(uint64_t now_us, TracerouteProbe& probe) {
+  bool ret = false;
+  if (!_planned)
+    Plan();
+  if (_sent && now_us < _last_send_us + _interval_us)
+    return false;
+  while (!ret && _next < _probes.size()) {
+    TracerouteProbe& next = _probes[_next++];
+    const Target& target = _targets[next.target];
+    if (!target.terminal_ttl || next.ttl <= target.terminal_ttl) {
+      next.sent_us = now_us;
+      next.status = TRACEROUTE_PENDING;
+      _last_send_us = now_us;
+      _sent++;
+      _outstanding++;
+      probe = next;
+      ret = true;
+    }
+  }
+  return ret;
+}
+
+/*-----------------------------------------------------------------------------
+-----------------------------------------------------------------------------*/
+bool TracerouteScheduler::OnPacket(uint64_t now_us, const uint8_t * packet,
+                                   size_t len) {
+  TracerouteReply reply;
+  return TracerouteParseReply(packet, len, reply) && OnReply(now_us, reply);
+}
+
+/*-----------------------------------------------------------------------------
+  Match a reply to its probe.  Only the first answer to a probe that is
+  still waiting counts (late answers after a timeout are dropped, the same
+  as the sequential version).
+-----------------------------------------------------------------------------*/
+bool TracerouteScheduler::OnReply(uint64_t now_us,
+                                  const TracerouteReply& reply) {
+  bool matched = false;
+  Expire(now_us);
+  if (reply.identifier == _identifier && reply.sequence < _next) {
+    TracerouteProbe& probe = _probes[reply.sequence];
+    Target& target = _targets[probe.target];
+    if (probe.status == TRACEROUTE_PENDING &&
+        reply.probed == target.address) {
+      probe.status = reply.status;
+      probe.responder = reply.responder;
+      probe.rtt_us = now_us > probe.sent_us ? now_us - probe.sent_us : 0;
+      _outstanding--;
+      if (reply.status == TRACEROUTE_ECHO_REPLY ||
+          reply.status == TRACEROUTE_UNREACHABLE) {
+        if (!target.terminal_ttl || probe.ttl < target.terminal_ttl)
+          target.terminal_ttl = probe.ttl;
+      }
+      matched = true;
+    }
+  }
+  return matched;
+}
+
+/*-----------------------------------------------------------------------------
+-----------------------------------------------------------------------------*/
+void TracerouteScheduler::Expire(uint64_t now_us) {
+  for (size_t i = 0; i < _next && _outstanding; i++) {
+    TracerouteProbe& probe = _probes[i];
+    if (probe.status == TRACEROUTE_PENDING &&
+        now_us >= probe.sent_us + _timeout_us) {
+      probe.status = TRACEROUTE_TIMED_OUT;
+      _outstanding--;
+    }
+  }
+}
+
+/*-----------------------------------------------------------------------------
+  How long the caller can wait for replies before it needs to come back
+  (to send the next probe or time one out)
+-----------------------------------------------------------------------------*/
+uint64_t TracerouteScheduler::NextEvent(uint64_t now_us) {
+  if (!_planned)
+    Plan();
+  Expire(now_us);
+  uint64_t next_us = UINT64_MAX;
+  if (_next < _probes.size())
+    next_us = _sent ? _last_send_us + _interval_us : now_us;
+  for (size_t i = 0; i < _next && _outstanding; i++) {
+    const TracerouteProbe& probe = _probes[i];
+    if (probe.status == TRACEROUTE_PENDING) {
+      // probes go out in order so the first pending one expires first
+      if (probe.sent_us + _timeout_us < next_us)
+        next_us = probe.sent_us + _timeout_us;
+      break;
+    }
+  }
+  if (next_us == UINT64_MAX)
+    return 0;
+  return next_us > now_us ? next_us - now_us : 0;
+}
+
+/*-----------------------------------------------------------------------------
+-----------------------------------------------------------------------------*/
+bool TracerouteScheduler::Done(uint64_t now_us) {
+  if (!_planned)
+    Plan();
+  Expire(now_us);
+  // skip over anything that no longer needs to be sent
+  while (_next < _probes.size()) {
+    const TracerouteProbe& probe = _probes[_next];
+    const Target& target = _targets[probe.target];
+    if (!target.terminal_ttl || probe.ttl <= target.terminal_ttl)
+      break;
+    _next++;
+  }
+  return _next >= _probes.size() && !_outstanding;
+}
+
+/*-----------------------------------------------------------------------------
+  Collapse the probes into one line per hop, reporting the same hops the
+  sequential version would have: everything up to and including the hop
+  that reached the target, stopping after 4 silent hops in a row.
+-----------------------------------------------------------------------------*/
+void TracerouteScheduler::GetHops(uint32_t target,
+                                  std::vector<TracerouteHop>& hops) const {
+  hops.clear();
+  if (target >= _targets.size())
+    return;
+  const Target& info = _targets[target];
+  std::vector<const TracerouteProbe *> best(_max_hops + 1, NULL);
+  for (size_t i = 0; i < _probes.size(); i++) {
+    const TracerouteProbe& probe = _probes[i];
+    if (probe.target == target && probe.status != TRACEROUTE_NOT_SENT &&
+        probe.status != TRACEROUTE_PENDING &&
+        probe.status != TRACEROUTE_TIMED_OUT) {
+      const TracerouteProbe * current = best[probe.ttl];
+      if (!current || probe.rtt_us < current->rtt_us)
+        best[probe.ttl] = &probe;
+    }
+  }
+  int failures = 0;
+  for (int ttl = 1; ttl <= _max_hops && failures < TRACEROUTE_MAX_FAILURES;
+       ttl++) {
+    TracerouteHop hop;
+    memset(&hop, 0, sizeof(hop));
+    hop.ttl = ttl;
+    if (best[ttl]) {
+      failures = 0;
+      hop.responded = true;
+      hop.address = best[ttl]->responder;
+      hop.ms = (double)best[ttl]->rtt_us / 1000.0;
+      hop.terminal = (ttl == info.terminal_ttl);
+    } else {
+      failures++;
+    }
+    hops.push_back(hop);
+    if (hop.terminal)
+      break;
+  }
+}
@@ -0,0 +1,131 @@
+/******************************************************************************
+Copyright (c) 2013, Google Inc.
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without 
+modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice, 
+      this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+    * Neither the name of the <ORGANIZATION> nor the names of its contributors 
+    may be used to endorse or promote products derived from this software 
+    without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE 
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE 
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL 
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR 
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER 
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, 
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE 
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+******************************************************************************/
+
+#pragma once
+// Probe scheduling and reply matching for the parallel traceroute.
+// Portable like wpthook/analysis.h: no Win32, ATL or precompiled header so the
+// scheduler can be driven by a simulated network on any platform. The
+// platform code owns the socket and the clock and just feeds packets and
+// timestamps in.
+//
+// Every TTL for every target is probed concurrently (paced by a fixed
+// interval between sends) with several probes per hop. Each probe gets a
+// unique ICMP sequence number under a shared identifier so replies, TTL
+// exceeded and unreachable messages can be matched back to the probe that
+// triggered them, in any order.
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+const size_t TRACEROUTE_PAYLOAD_SIZE = 32;
+const size_t TRACEROUTE_PACKET_SIZE = 8 + TRACEROUTE_PAYLOAD_SIZE;
+
+// what came back for a single probe
+typedef enum {
+  TRACEROUTE_NOT_SENT,
+  TRACEROUTE_PENDING,
+  TRACEROUTE_TIME_EXCEEDED,   // router along the path
+  TRACEROUTE_ECHO_REPLY,      // the target itself
+  TRACEROUTE_UNREACHABLE,     // path ends here
+  TRACEROUTE_TIMED_OUT
+} TRACEROUTE_STATUS;
+
+struct TracerouteProbe {
+  uint32_t  target;     // index from AddTarget
+  int       ttl;
+  int       attempt;
+  uint16_t  sequence;
+  uint64_t  sent_us;
+  uint64_t  rtt_us;
+  uint32_t  responder;  // IPv4, network byte order
+  TRACEROUTE_STATUS status;
+};
+
+// A hop as written to the results (fastest reply wins)
+struct TracerouteHop {
+  int       ttl;
+  bool      responded;
+  uint32_t  address;    // IPv4, network byte order
+  double    ms;
+  bool      terminal;   // target reached (or unreachable), nothing after it
+};
+
+// Reply parsed out of a raw ICMP packet (starting at the IP header)
+struct TracerouteReply {
+  uint16_t  identifier;
+  uint16_t  sequence;
+  uint32_t  responder;
+  uint32_t  probed;     // destination of the original probe
+  TRACEROUTE_STATUS status;
+};
+
+void TracerouteBuildEcho(uint16_t identifier, uint16_t sequence,
+                         uint8_t * packet);
+bool TracerouteParseReply(const uint8_t * packet, size_t len,
+                          TracerouteReply& reply);
+
+class TracerouteScheduler {
+public:
+  TracerouteScheduler(uint16_t identifier, int max_hops, int probes_per_hop,
+                      uint64_t interval_us, uint64_t timeout_us);
+  ~TracerouteScheduler(void);
+
+  uint32_t AddTarget(uint32_t address);
+  bool NextProbe(uint64_t now_us, TracerouteProbe& probe);
+  bool OnPacket(uint64_t now_us, const uint8_t * packet, size_t len);
+  bool OnReply(uint64_t now_us, const TracerouteReply& reply);
+  uint64_t NextEvent(uint64_t now_us);
+  bool Done(uint64_t now_us);
+  void GetHops(uint32_t target, std::vector<TracerouteHop>& hops) const;
+
+  uint16_t Identifier(void) const { return _identifier; }
+  uint32_t TargetAddress(uint32_t target) const {
+    return _targets[target].address; }
+  size_t ProbesSent(void) const { return _sent; }
+
+private:
+  struct Target {
+    uint32_t  address;
+    int       terminal_ttl;   // lowest TTL that reached the end, 0 if none
+  };
+  void Expire(uint64_t now_us);
+  void Plan(void);
+
+  uint16_t  _identifier;
+  int       _max_hops;
+  int       _probes_per_hop;
+  uint64_t  _interval_us;
+  uint64_t  _timeout_us;
+  uint64_t  _last_send_us;
+  bool      _planned;
+  size_t    _next;            // next probe to send (in send order)
+  size_t    _sent;
+  size_t    _outstanding;
+  std::vector<Target>           _targets;
+  std::vector<TracerouteProbe>  _probes;  // indexed by sequence
+};
@@ -0,0 +1,490 @@
+/******************************************************************************
+Copyright (c) 2013, Google Inc.
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without 
+modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice, 
+      this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+    * Neither the name of the <ORGANIZATION> nor the names of its contributors 
+    may be used to endorse or promote products derived from this software 
+    without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE 
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE 
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL 
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR 
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER 
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, 
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE 
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+******************************************************************************/
+
+// Drives the traceroute scheduler (traceroute_engine.cc) against a simulated
+// network on a virtual clock: routers that answer with TTL exceeded after a
+// fixed round trip, silent hops, targets that answer the echo, paths that end
+// in an unreachable and paths that just go dark.
+//
+//   make test
+#include "../traceroute_engine.h"
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <utility>
+
+static int failures = 0;
+static int checks = 0;
+
+#define CHECK(condition) \
+  do { \
+    checks++; \
+    if (!(condition)) { \
+      failures++; \
+      printf("%s:%d: %s: CHECK(%s) failed\n", __FILE__, __LINE__, \
+             current_test, #condition); \
+    } \
+  } while (0)
+
+static const char * current_test = "";
+
+static const uint16_t IDENTIFIER = 0x5750;
+static const uint64_t INTERVAL_US = 1000;
+static const uint64_t TIMEOUT_US = 500000;
+
+/*-----------------------------------------------------------------------------
+  IPv4 address in network byte order (the same as in_addr.s_addr)
+-----------------------------------------------------------------------------*/
+static uint32_t Ip(uint8_t a, uint8_t b, uint8_t c, uint8_t d) {
+  uint8_t bytes[4] = {a, b, c, d};
+  uint32_t address;
+  memcpy(&address, bytes, sizeof(address));
+  return address;
+}
+
+static const uint32_t LOCAL = Ip(192, 168, 1, 10);
+
+/*-----------------------------------------------------------------------------
+  IPv4 header for an ICMP packet
+-----------------------------------------------------------------------------*/
+static void WriteIpHeader(uint8_t * p, uint32_t source, uint32_t dest) {
+  memset(p, 0, 20);
+  p[0] = 0x45;
+  p[8] = 64;
+  p[9] = 1;
+  memcpy(p + 12, &source, 4);
+  memcpy(p + 16, &dest, 4);
+}
+
+/*-----------------------------------------------------------------------------
+  Simulated network
+-----------------------------------------------------------------------------*/
+struct SimHop {
+  uint32_t  address;
+  uint64_t  rtt_us;
+  uint64_t  first_extra_us;   // added to the first attempt only
+  bool      silent;
+};
+
+enum SimEnd {SIM_REACHED, SIM_UNREACHABLE, SIM_BLACK_HOLE};
+
+struct SimPath {
+  uint32_t            target;
+  std::vector<SimHop> hops;   // routers, then the target itself if reached
+  SimEnd              end;
+};
+
+struct SimArrival {
+  uint64_t              time_us;
+  std::vector<uint8_t>  packet;
+  bool operator<(const SimArrival& other) const {
+    return time_us < other.time_us;
+  }
+};
+
+class SimNetwork {
+public:
+  SimNetwork() {}
+  void AddPath(const SimPath& path) { paths_.push_back(path); }
+
+  // an ICMP echo request leaves the host
+  void Send(uint64_t now_us, uint32_t dest, int ttl, const uint8_t * echo) {
+    sent_us_.push_back(now_us);
+    const SimPath * path = NULL;
+    for (size_t i = 0; i < paths_.size(); i++)
+      if (paths_[i].target == dest)
+        path = &paths_[i];
+    if (!path || path->hops.empty())
+      return;
+    // the last hop answers for every TTL at or past it unless the path just
+    // goes dark after the last router
+    size_t hop_count = path->hops.size();
+    if (path->end == SIM_BLACK_HOLE && (size_t)ttl > hop_count)
+      return;
+    bool last = (size_t)ttl >= hop_count && path->end != SIM_BLACK_HOLE;
+    const SimHop& hop = path->hops[last ? hop_count - 1 : ttl - 1];
+    if (hop.silent)
+      return;
+    SimArrival arrival;
+    arrival.time_us = now_us + hop.rtt_us;
+    std::pair<uint32_t, int> probed(dest, ttl);
+    if (std::find(probed_.begin(), probed_.end(), probed) == probed_.end()) {
+      probed_.push_back(probed);
+      arrival.time_us += hop.first_extra_us;
+    }
+    if (last && path->end == SIM_REACHED) {
+      // echo reply straight back from the target
+      arrival.packet.resize(20 + TRACEROUTE_PACKET_SIZE);
+      WriteIpHeader(&arrival.packet[0], dest, LOCAL);
+      memcpy(&arrival.packet[20], echo, TRACEROUTE_PACKET_SIZE);
+      arrival.packet[20] = 0;
+    } else {
+      // TTL exceeded or unreachable quoting the probe
+      arrival.packet.resize(20 + 8 + 20 + 8);
+      WriteIpHeader(&arrival.packet[0], hop.address, LOCAL);
+      arrival.packet[20] = last ? 3 : 11;
+      WriteIpHeader(&arrival.packet[28], LOCAL, dest);
+      memcpy(&arrival.packet[48], echo, 8);
+    }
+    in_flight_.push_back(arrival);
+    std::stable_sort(in_flight_.begin(), in_flight_.end());
+  }
+
+  // drive the scheduler until it is done, returns false if it never finished
+  bool Run(TracerouteScheduler& scheduler) {
+    uint64_t now_us = 0;
+    for (int loops = 0; loops < 1000000; loops++) {
+      while (!in_flight_.empty() && in_flight_.front().time_us <= now_us) {
+        const std::vector<uint8_t>& packet = in_flight_.front().packet;
+        scheduler.OnPacket(now_us, &packet[0], packet.size());
+        in_flight_.erase(in_flight_.begin());
+      }
+      if (scheduler.Done(now_us))
+        return true;
+      TracerouteProbe probe;
+      while (scheduler.NextProbe(now_us, probe)) {
+        uint8_t echo[TRACEROUTE_PACKET_SIZE];
+        TracerouteBuildEcho(scheduler.Identifier(), probe.sequence, echo);
+        Send(now_us, scheduler.TargetAddress(probe.target), probe.ttl, echo);
+      }
+      uint64_t next_us = now_us + scheduler.NextEvent(now_us);
+      if (!in_flight_.empty() && in_flight_.front().time_us < next_us)
+        next_us = in_flight_.front().time_us;
+      now_us = std::max(next_us, now_us + 1);
+    }
+    return false;
+  }
+
+  std::vector<uint64_t> sent_us_;
+
+private:
+  std::vector<SimPath>    paths_;
+  std::vector<std::pair<uint32_t, int> > probed_;
+  std::vector<SimArrival> in_flight_;
+};
+
+/*-----------------------------------------------------------------------------
+  Path of routers 10.0.<n>.1 with a round trip of n milliseconds at hop n
+-----------------------------------------------------------------------------*/
+static SimPath Path(uint32_t target, uint8_t net, int routers, SimEnd end) {
+  SimPath path;
+  path.target = target;
+  path.end = end;
+  for (int i = 1; i <= routers; i++) {
+    SimHop hop;
+    hop.address = Ip(10, net, (uint8_t)i, 1);
+    hop.rtt_us = i * 1000;
+    hop.first_extra_us = 0;
+    hop.silent = false;
+    path.hops.push_back(hop);
+  }
+  if (end == SIM_REACHED) {
+    SimHop hop;
+    hop.address = target;
+    hop.rtt_us = (routers + 1) * 1000;
+    hop.first_extra_us = 0;
+    hop.silent = false;
+    path.hops.push_back(hop);
+  }
+  return path;
+}
+
+/*-----------------------------------------------------------------------------
+-----------------------------------------------------------------------------*/
+static void TestPackets() {
+  current_test = "echo request";
+  uint8_t echo[TRACEROUTE_PACKET_SIZE];
+  TracerouteBuildEcho(0x1234, 0xABCD, echo);
+  CHECK(echo[0] == 8);
+  CHECK(echo[1] == 0);
+  CHECK(echo[4] == 0x12 && echo[5] == 0x34);
+  CHECK(echo[6] == 0xAB && echo[7] == 0xCD);
+  uint32_t sum = 0;
+  for (size_t i = 0; i < TRACEROUTE_PACKET_SIZE; i += 2)
+    sum += (echo[i] << 8) | echo[i + 1];
+  while (sum >> 16)
+    sum = (sum & 0xFFFF) + (sum >> 16);
+  CHECK(sum == 0xFFFF);
+
+  current_test = "parse echo reply";
+  uint32_t target = Ip(93, 184, 216, 34);
+  uint8_t packet[64];
+  WriteIpHeader(packet, target, LOCAL);
+  memcpy(packet + 20, echo, TRACEROUTE_PACKET_SIZE);
+  packet[20] = 0;
+  TracerouteReply reply;
+  CHECK(TracerouteParseReply(packet, 20 + TRACEROUTE_PACKET_SIZE, reply));
+  CHECK(reply.status == TRACEROUTE_ECHO_REPLY);
+  CHECK(reply.identifier == 0x1234);
+  CHECK(reply.sequence == 0xABCD);
+  CHECK(reply.responder == target);
+  CHECK(reply.probed == target);
+
+  current_test = "parse time exceeded";
+  uint32_t router = Ip(10, 0, 0, 1);
+  WriteIpHeader(packet, router, LOCAL);
+  memset(packet + 20, 0, 8);
+  packet[20] = 11;
+  WriteIpHeader(packet + 28, LOCAL, target);
+  memcpy(packet + 48, echo, 8);
+  CHECK(TracerouteParseReply(packet, 56, reply));
+  CHECK(reply.status == TRACEROUTE_TIME_EXCEEDED);
+  CHECK(reply.identifier == 0x1234);
+  CHECK(reply.sequence == 0xABCD);
+  CHECK(reply.responder == router);
+  CHECK(reply.probed == target);
+
+  current_test = "parse unreachable";
+  packet[20] = 3;
+  CHECK(TracerouteParseReply(packet, 56, reply));
+  CHECK(reply.status == TRACEROUTE_UNREACHABLE);
+
+  current_test = "parse garbage";
+  CHECK(!TracerouteParseReply(packet, 55, reply));    // quote cut short
+  CHECK(!TracerouteParseReply(packet, 19, reply));
+  packet[48] = 0;                                     // quoting a reply
+  CHECK(!TracerouteParseReply(packet, 56, reply));
+  packet[48] = 8;
+  packet[20] = 5;                                     // redirect
+  CHECK(!TracerouteParseReply(packet, 56, reply));
+  packet[20] = 11;
+  packet[9] = 17;                                     // UDP
+  CHECK(!TracerouteParseReply(packet, 56, reply));
+  packet[9] = 1;
+  packet[0] = 0x60;                                   // IPv6
+  CHECK(!TracerouteParseReply(packet, 56, reply));
+}
+
+/*-----------------------------------------------------------------------------
+-----------------------------------------------------------------------------*/
+static void TestReached() {
+  current_test = "reached";
+  uint32_t target = Ip(93, 184, 216, 34);
+  SimNetwork network;
+  network.AddPath(Path(target, 0, 4, SIM_REACHED));
+  TracerouteScheduler scheduler(IDENTIFIER, 30, 3, INTERVAL_US, TIMEOUT_US);
+  uint32_t index = scheduler.AddTarget(target);
+  CHECK(network.Run(scheduler));
+  std::vector<TracerouteHop> hops;
+  scheduler.GetHops(index, hops);
+  CHECK(hops.size() == 5);
+  for (size_t i = 0; i < hops.size() && i < 5; i++) {
+    CHECK(hops[i].ttl == (int)i + 1);
+    CHECK(hops[i].responded);
+    CHECK(hops[i].ms == (double)(i + 1));
+    CHECK(hops[i].terminal == (i == 4));
+  }
+  if (hops.size() == 5) {
+    CHECK(hops[0].address == Ip(10, 0, 1, 1));
+    CHECK(hops[3].address == Ip(10, 0, 4, 1));
+    CHECK(hops[4].address == target);
+  }
+  // probes for hops past the target stop once it answers
+  CHECK(scheduler.ProbesSent() >= 15);
+  CHECK(scheduler.ProbesSent() < 30 * 3);
+  CHECK(scheduler.ProbesSent() == network.sent_us_.size());
+
+  current_test = "pacing";
+  bool paced = true;
+  for (size_t i = 1; i < network.sent_us_.size(); i++)
+    if (network.sent_us_[i] < network.sent_us_[i - 1] + INTERVAL_US)
+      paced = false;
+  CHECK(paced);
+  TracerouteScheduler fresh(IDENTIFIER, 30, 3, INTERVAL_US, TIMEOUT_US);
+  fresh.AddTarget(target);
+  TracerouteProbe probe;
+  CHECK(fresh.NextEvent(0) == 0);
+  CHECK(fresh.NextProbe(0, probe));
+  CHECK(fresh.NextEvent(0) == INTERVAL_US);
+  CHECK(!fresh.NextProbe(INTERVAL_US - 1, probe));
+  CHECK(fresh.NextProbe(INTERVAL_US, probe));
+  CHECK(probe.ttl == 2);
+  CHECK(probe.sequence == 1);
+}
+
+/*-----------------------------------------------------------------------------
+-----------------------------------------------------------------------------*/
+static void TestSilentHops() {
+  current_test = "silent hop";
+  uint32_t target = Ip(93, 184, 216, 34);
+  SimPath path = Path(target, 0, 5, SIM_REACHED);
+  path.hops[2].silent = true;
+  SimNetwork network;
+  network.AddPath(path);
+  TracerouteScheduler scheduler(IDENTIFIER, 30, 3, INTERVAL_US, TIMEOUT_US);
+  uint32_t index = scheduler.AddTarget(target);
+  CHECK(network.Run(scheduler));
+  std::vector<TracerouteHop> hops;
+  scheduler.GetHops(index, hops);
+  CHECK(hops.size() == 6);
+  if (hops.size() == 6) {
+    CHECK(hops[1].responded);
+    CHECK(!hops[2].responded);
+    CHECK(hops[2].address == 0);
+    CHECK(hops[3].responded);
+    CHECK(hops[5].terminal);
+    CHECK(hops[5].address == target);
+  }
+
+  current_test = "black hole";
+  network = SimNetwork();
+  network.AddPath(Path(target, 0, 3, SIM_BLACK_HOLE));
+  TracerouteScheduler dark(IDENTIFIER, 30, 3, INTERVAL_US, TIMEOUT_US);
+  index = dark.AddTarget(target);
+  CHECK(network.Run(dark));
+  dark.GetHops(index, hops);
+  // the three routers then four silent hops
+  CHECK(hops.size() == 7);
+  for (size_t i = 0; i < hops.size(); i++) {
+    CHECK(hops[i].responded == (i < 3));
+    CHECK(!hops[i].terminal);
+  }
+  // nothing ever reached the end so every probe went out
+  CHECK(dark.ProbesSent() == 30 * 3);
+}
+
+/*-----------------------------------------------------------------------------
+-----------------------------------------------------------------------------*/
+static void TestUnreachable() {
+  current_test = "unreachable";
+  uint32_t target = Ip(203, 0, 113, 9);
+  SimNetwork network;
+  network.AddPath(Path(target, 0, 4, SIM_UNREACHABLE));
+  TracerouteScheduler scheduler(IDENTIFIER, 30, 2, INTERVAL_US, TIMEOUT_US);
+  uint32_t index = scheduler.AddTarget(target);
+  CHECK(network.Run(scheduler));
+  std::vector<TracerouteHop> hops;
+  scheduler.GetHops(index, hops);
+  CHECK(hops.size() == 4);
+  if (hops.size() == 4) {
+    CHECK(hops[3].responded);
+    CHECK(hops[3].terminal);
+    CHECK(hops[3].address == Ip(10, 0, 4, 1));
+  }
+  CHECK(scheduler.ProbesSent() < 30 * 2);
+}
+
+/*-----------------------------------------------------------------------------
+-----------------------------------------------------------------------------*/
+static void TestMultipleTargets() {
+  current_test = "multiple targets";
+  uint32_t first = Ip(93, 184, 216, 34);
+  uint32_t second = Ip(151, 101, 1, 69);
+  uint32_t third = Ip(203, 0, 113, 9);
+  SimNetwork network;
+  network.AddPath(Path(first, 1, 2, SIM_REACHED));
+  network.AddPath(Path(second, 2, 7, SIM_REACHED));
+  network.AddPath(Path(third, 3, 3, SIM_UNREACHABLE));
+  TracerouteScheduler scheduler(IDENTIFIER, 20, 3, INTERVAL_US, TIMEOUT_US);
+  uint32_t a = scheduler.AddTarget(first);
+  uint32_t b = scheduler.AddTarget(second);
+  uint32_t c = scheduler.AddTarget(third);
+  CHECK(network.Run(scheduler));
+  std::vector<TracerouteHop> hops;
+  scheduler.GetHops(a, hops);
+  CHECK(hops.size() == 3);
+  CHECK(!hops.empty() && hops.back().terminal &&
+        hops.back().address == first);
+  CHECK(!hops.empty() && hops[0].address == Ip(10, 1, 1, 1));
+  scheduler.GetHops(b, hops);
+  CHECK(hops.size() == 8);
+  CHECK(!hops.empty() && hops.back().terminal &&
+        hops.back().address == second);
+  CHECK(hops.size() > 6 && hops[6].address == Ip(10, 2, 7, 1));
+  scheduler.GetHops(c, hops);
+  CHECK(hops.size() == 3);
+  CHECK(!hops.empty() && hops.back().terminal &&
+        hops.back().address == Ip(10, 3, 3, 1));
+  scheduler.GetHops(3, hops);
+  CHECK(hops.empty());
+}
+
+/*-----------------------------------------------------------------------------
+-----------------------------------------------------------------------------*/
+static void TestReplyMatching() {
+  current_test = "fastest reply wins";
+  uint32_t target = Ip(93, 184, 216, 34);
+  SimPath path = Path(target, 0, 3, SIM_REACHED);
+  path.hops[1].first_extra_us = 40000;
+  SimNetwork network;
+  network.AddPath(path);
+  TracerouteScheduler scheduler(IDENTIFIER, 30, 3, INTERVAL_US, TIMEOUT_US);
+  uint32_t index = scheduler.AddTarget(target);
+  CHECK(network.Run(scheduler));
+  std::vector<TracerouteHop> hops;
+  scheduler.GetHops(index, hops);
+  CHECK(hops.size() == 4);
+  CHECK(hops.size() > 1 && hops[1].ms == 2.0);
+
+  current_test = "late reply";
+  path = Path(target, 0, 3, SIM_REACHED);
+  path.hops[1].rtt_us = TIMEOUT_US + 1000;
+  network = SimNetwork();
+  network.AddPath(path);
+  TracerouteScheduler late(IDENTIFIER, 30, 3, INTERVAL_US, TIMEOUT_US);
+  index = late.AddTarget(target);
+  CHECK(network.Run(late));
+  late.GetHops(index, hops);
+  CHECK(hops.size() == 4);
+  CHECK(hops.size() > 1 && !hops[1].responded);
+
+  current_test = "stray replies";
+  TracerouteScheduler stray(IDENTIFIER, 30, 3, INTERVAL_US, TIMEOUT_US);
+  stray.AddTarget(target);
+  TracerouteProbe probe;
+  CHECK(stray.NextProbe(0, probe));
+  TracerouteReply reply;
+  reply.identifier = IDENTIFIER + 1;
+  reply.sequence = probe.sequence;
+  reply.responder = Ip(10, 0, 1, 1);
+  reply.probed = target;
+  reply.status = TRACEROUTE_TIME_EXCEEDED;
+  CHECK(!stray.OnReply(100, reply));          // someone else's ping
+  reply.identifier = IDENTIFIER;
+  reply.probed = Ip(8, 8, 8, 8);
+  CHECK(!stray.OnReply(100, reply));          // different destination
+  reply.probed = target;
+  reply.sequence = probe.sequence + 1;
+  CHECK(!stray.OnReply(100, reply));          // not sent yet
+  reply.sequence = probe.sequence;
+  CHECK(stray.OnReply(100, reply));
+  CHECK(!stray.OnReply(200, reply));          // duplicate
+}
+
+/*-----------------------------------------------------------------------------
+-----------------------------------------------------------------------------*/
+int main() {
+  TestPackets();
+  TestReached();
+  TestSilentHops();
+  TestUnreachable();
+  TestMultipleTargets();
+  TestReplyMatching();
+  printf("%d checks, %d failed\n", checks, failures);
+  return failures ? 1 : 0;
+}
@@ -29,6 +29,7 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include "util.h"
 #include "globals.h"
 #include "web_browser.h"
+#include "profile_snapshots.h"
 
 typedef void(__stdcall * LPINSTALLHOOK)(DWORD thread_id);
 
@@ -203,29 +204,31 @@ bool WebBrowser::RunAndWait() {
 
 /*-----------------------------------------------------------------------------
   Delete the user profile as well as the flash and silverlight caches
+  (the time it takes is saved with the run)
 -----------------------------------------------------------------------------*/
 void WebBrowser::ClearUserData() {
+  global_profile_snapshots.BeginReset();
   TerminateProcessesByName(PathFindFileName((LPCTSTR)_browser._exe));
   _browser.ResetProfile(_test._clear_certs);
   TCHAR path[MAX_PATH];
   if (SUCCEEDED(SHGetFolderPath(NULL, CSIDL_APPDATA, NULL, 
                     SHGFP_TYPE_CURRENT, path))) {
     if (PathAppend(path, FLASH_CACHE_DIR)) {
-      DeleteDirectory(path, false);
+      global_profile_snapshots.Discard(path, false);
     }
   }
   if (SUCCEEDED(SHGetFolderPath(NULL, CSIDL_LOCAL_APPDATA, NULL, 
                     SHGFP_TYPE_CURRENT, path))) {
     if (PathAppend(path, SILVERLIGHT_CACHE_DIR)) {
-      DeleteDirectory(path, false);
+      global_profile_snapshots.Discard(path, false);
     }
   }
   if (GetTempPath(MAX_PATH, path)) {
-      DeleteDirectory(path, false);
+      global_profile_snapshots.Discard(path, false);
   }
   GetModuleFileName(NULL, path, MAX_PATH);
   lstrcpy(PathFindFileName(path), _T("symbols"));
-  DeleteDirectory(path, false);
+  global_profile_snapshots.Discard(path, false);
 
   // Clean out any old windows update downloads (over 1 month old)
   const unsigned __int64 TICKS_PER_MONTH = 10000000ui64 * 60ui64 * 60ui64 * 24ui64 * 30L;
@@ -257,6 +260,16 @@ void WebBrowser::ClearUserData() {
     } while (FindNextFile(hFind, &fd));
     FindClose(hFind);
   }
+
+  global_profile_snapshots.EndReset();
+  CStringA reset_stats = global_profile_snapshots.GetResetJSON();
+  HANDLE file = CreateFile(_test._file_base + _T("_profile_reset.json"),
+                           GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, 0, 0);
+  if (file != INVALID_HANDLE_VALUE) {
+    DWORD bytes;
+    WriteFile(file, (LPCSTR)reset_stats, reset_stats.GetLength(), &bytes, 0);
+    CloseHandle(file);
+  }
 }
 
 /*-----------------------------------------------------------------------------
@@ -30,6 +30,7 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include "web_page_replay.h"
 #include "wpt_driver_core.h"
 #include "web_driver.h"
+#include "profile_snapshots.h"
 #include "zlib/contrib/minizip/unzip.h"
 #include <Wtsapi32.h>
 #include <D3D9.h>
@@ -53,6 +54,8 @@ const TCHAR * DIALOG_WHITELIST[] = {
 
 const DWORD SOFTWARE_INSTALL_RETRY_DELAY = 30000; // try every 30 seconds
 const DWORD HOUSEKEEPING_INTERVAL = 500;
+const int TRACEROUTE_MAX_HOPS = 30;
+const DWORD TRACEROUTE_TIMEOUT = 1000;
 WptDriverCore * global_core = NULL;
 extern HINSTANCE hInst;
 
@@ -184,6 +187,8 @@ void WptDriverCore::WorkThread(void) {
     WptTestDriver test(_settings._timeout * SECONDS_TO_MS, has_gpu_);
     bool pause = NeedsPause();
     if (!pause && _webpagetest.GetTest(test)) {
+      global_profile_snapshots.PausePurge();
+      _settings._software_update.PauseBackgroundChecks();
       PreTest();
       test._run = test._specific_run ? test._specific_run : 1;
       _status.Set(_T("Starting test..."));
@@ -191,7 +196,7 @@ void WptDriverCore::WorkThread(void) {
                                test._browser_md5, test._client)) {
         CString profiles_dir = _settings._browser._profiles;
         if (profiles_dir.GetLength())
-          DeleteDirectory(profiles_dir, false);
+          global_profile_snapshots.Discard(profiles_dir, false);
         WebBrowser browser(_settings, test, _status, _settings._browser, 
                            _ipfw);
         if (SetupWebPageReplay(test, browser) &&
@@ -223,15 +228,20 @@ void WptDriverCore::WorkThread(void) {
             }
             if (test._specific_run)
               break;
-            else if (test._discard > 0)
+            else if (test._discard > 0) {
+              // the next run reuses this run's file names so forget the
+              // response bodies it stored
+              if (test._dedup_bodies)
+                DeleteDirectory(test._directory + _T("\\bodies"));
               test._discard--;
+            }
             else
               test._index++;
           }
         }
         test._run = test._specific_run ? test._specific_run : test._runs;
         if (profiles_dir.GetLength())
-          DeleteDirectory(profiles_dir, false);
+          global_profile_snapshots.Discard(profiles_dir, false);
       } else {
         test._test_error = test._run_error =
             CStringA("Invalid Browser Selected: ") + CT2A(test._browser);
@@ -245,6 +255,9 @@ void WptDriverCore::WorkThread(void) {
       PostTest();
       CleanupUnwantedProcesses();
       ReleaseMutex(_testing_mutex);
+      // empty the profile trash while we are idle
+      global_profile_snapshots.ResumePurge();
+      _settings._software_update.ResumeBackgroundChecks();
     } else {
       ReleaseMutex(_testing_mutex);
       if (pause) {
@@ -271,7 +284,9 @@ bool WptDriverCore::TracerouteTest(WptTestDriver& test) {
 
   if (!test._test_type.CompareNoCase(_T("traceroute"))) {
     ret = true;
-    CTraceRoute trace_route(test);
+    CTraceRoute trace_route(test, TRACEROUTE_MAX_HOPS, TRACEROUTE_TIMEOUT,
+                            _settings._traceroute_probes,
+                            _settings._traceroute_interval);
     test._index = test._specific_index ? test._specific_index : 1;
     for (test._run = 1; test._run <= test._runs; test._run++) {
       test._run_error.Empty();
@@ -526,6 +541,8 @@ void WptDriverCore::Init(void){
     _status.Set(_T("Installing software..."));
   }
   _installing = false;
+  if (_settings._background_updates)
+    _settings._software_update.StartBackgroundChecks();
 
   SetupScreen();
 
@@ -538,6 +555,8 @@ void WptDriverCore::Init(void){
   Do our cleanup on exit
 -----------------------------------------------------------------------------*/
 void WptDriverCore::Cleanup(void) {
+  global_profile_snapshots.Stop();
+  _settings._software_update.StopBackgroundChecks();
   if (housekeeping_timer_) {
     DeleteTimerQueueTimer(NULL, housekeeping_timer_, NULL);
     housekeeping_timer_ = NULL;
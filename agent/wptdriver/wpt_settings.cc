@@ -29,6 +29,8 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include "StdAfx.h"
 #include "wpt_settings.h"
 #include "wpt_status.h"
+#include "profile_snapshots.h"
+#include "artifact_cache.h"
 #include <WinInet.h>
 #include "zlib/contrib/minizip/unzip.h"
 
@@ -84,7 +86,10 @@ WptSettings::WptSettings(WptStatus &status):
   ,_software_update(status)
   ,_requireValidCertificate(true)
   ,_webdriver_supported(false)
-  ,_reboot_on_lock_screen(false) {
+  ,_reboot_on_lock_screen(false)
+  ,_background_updates(false)
+  ,_traceroute_probes(DEFAULT_TRACEROUTE_PROBES)
+  ,_traceroute_interval(DEFAULT_TRACEROUTE_INTERVAL) {
 }
 
 /*-----------------------------------------------------------------------------
@@ -207,6 +212,17 @@ bool WptSettings::Load(void) {
     _reboot_on_lock_screen = true;
   }
 
+  if (GetPrivateProfileInt(_T("WebPagetest"), _T("Background Updates"), 0,
+                           iniFile)) {
+    _background_updates = true;
+  }
+
+  // traceroute probes per hop and the spacing between probes (ms)
+  _traceroute_probes = GetPrivateProfileInt(_T("WebPagetest"),
+      _T("Traceroute Probes"), _traceroute_probes, iniFile);
+  _traceroute_interval = GetPrivateProfileInt(_T("WebPagetest"),
+      _T("Traceroute Interval"), _traceroute_interval, iniFile);
+
   if (GetPrivateProfileInt(_T("WebPagetest"), _T("WebDriver"), 0, iniFile)) {
     _webdriver_supported = true;
   }
@@ -448,10 +464,19 @@ bool WptSettings::SetBrowser(CString browser, CString url,
 }
 
 /*-----------------------------------------------------------------------------
-  Update the various browsers
+  Update the various browsers.  When the downloads are handled in the
+  background this only runs the installers that are already in the cache.
 -----------------------------------------------------------------------------*/
 bool WptSettings::UpdateSoftware() {
-  return _software_update.UpdateSoftware();
+  bool ok = true;
+  if (!_software_update.BackgroundChecksActive()) {
+    ok = _software_update.UpdateSoftware();
+  } else if (_software_update.InstallPending()) {
+    _software_update.PauseBackgroundChecks();
+    ok = _software_update.UpdateSoftware(true);
+    _software_update.ResumeBackgroundChecks();
+  }
+  return ok;
 }
 
 /*-----------------------------------------------------------------------------
@@ -596,15 +621,13 @@ bool BrowserSettings::Install(CString browser, CString url, CString md5) {
     }
     ret = true;
   } else {
-    CString browser_zip = _exe_directory + _T(".zip");
-    if (HttpSaveFile(url, browser_zip) &&
-        !HashFileMD5(browser_zip).CompareNoCase(md5) &&
+    CString browser_zip;
+    if (global_artifact_cache.Fetch(url, md5, browser_zip) &&
         Unzip(browser_zip, (LPCSTR)CT2A(_exe_directory)) &&
         FileExists(_exe))
       ret = true;
     else
       DeleteDirectory(_exe_directory);
-    DeleteFile(browser_zip);
   }
 
   return ret;
@@ -625,18 +648,20 @@ void BrowserSettings::CleanupCustomBrowsers(CString browser) {
 }
 
 /*-----------------------------------------------------------------------------
-  Reset the browser user profile (nuke the directory, copy the template over)
+  Reset the browser user profile (move the old one out of the way and
+  materialize a fresh copy of the template)
 -----------------------------------------------------------------------------*/
 void BrowserSettings::ResetProfile(bool clear_certs) {
   // clear the browser-specific profile directory
   if (_cache_directory.GetLength()) {
-    DeleteDirectory(_cache_directory, false);
+    global_profile_snapshots.Discard(_cache_directory, false);
   }
   if (_profile_directory.GetLength() ) {
     SHCreateDirectoryEx(NULL, _profile_directory, NULL);
-    DeleteDirectory(_profile_directory, false);
-    CopyDirectoryTree(_wpt_directory + CString(_T("\\templates\\"))+_template,
-                      _profile_directory);
+    global_profile_snapshots.Discard(_profile_directory, false);
+    global_profile_snapshots.Materialize(
+        _wpt_directory + CString(_T("\\templates\\")) + _template,
+        _profile_directory);
   }
 
   // flush the certificate revocation caches
@@ -655,17 +680,17 @@ void BrowserSettings::ResetProfile(bool clear_certs) {
     DeleteRegKey(HKEY_CURRENT_USER,
         _T("Software\\Microsoft\\Internet Explorer\\DOMStorage"),
         false);
-    DeleteDirectory(cookies_dir_, false);
-    DeleteDirectory(history_dir_, false);
-    DeleteDirectory(dom_storage_dir_, false);
-    DeleteDirectory(temp_files_dir_, false);
-    DeleteDirectory(temp_dir_, false);
-    DeleteDirectory(silverlight_dir_, false);
-    DeleteDirectory(recovery_dir_, false);
-    DeleteDirectory(flash_dir_, false);
-    DeleteDirectory(windows_dir_ + _T("\\temp"), false);
-    DeleteDirectory(app_data_dir_ + _T("\\Roaming\\Mozilla\\Firefox\\Crash Reports"), false);
-    DeleteDirectory(local_app_data_dir_ + _T("\\Microsoft\\Windows\\WER"), false);
+    global_profile_snapshots.Discard(cookies_dir_, false);
+    global_profile_snapshots.Discard(history_dir_, false);
+    global_profile_snapshots.Discard(dom_storage_dir_, false);
+    global_profile_snapshots.Discard(temp_files_dir_, false);
+    global_profile_snapshots.Discard(temp_dir_, false);
+    global_profile_snapshots.Discard(silverlight_dir_, false);
+    global_profile_snapshots.Discard(recovery_dir_, false);
+    global_profile_snapshots.Discard(flash_dir_, false);
+    global_profile_snapshots.Discard(windows_dir_ + _T("\\temp"), false);
+    global_profile_snapshots.Discard(app_data_dir_ + _T("\\Roaming\\Mozilla\\Firefox\\Crash Reports"), false);
+    global_profile_snapshots.Discard(local_app_data_dir_ + _T("\\Microsoft\\Windows\\WER"), false);
     ClearWinInetCache();
     ClearWebCache();
   }
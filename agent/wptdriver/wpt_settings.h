@@ -38,6 +38,8 @@ const DWORD DEFAULT_TEST_TIMEOUT = 120;
 const DWORD DEFAULT_ACTIVITY_TIMEOUT = 2000;
 const DWORD DEFAULT_STARTUP_DELAY = 10;
 const DWORD DEFAULT_POLLING_DELAY = 5;
+const int DEFAULT_TRACEROUTE_PROBES = 3;
+const DWORD DEFAULT_TRACEROUTE_INTERVAL = 5;
 const DWORD UPLOAD_RETRY_COUNT = 5;
 const DWORD UPLOAD_RETRY_DELAY = 10;
 
@@ -140,4 +142,7 @@ public:
   CString _hawk_command;
   bool _webdriver_supported;
   bool _reboot_on_lock_screen;
+  bool _background_updates;
+  int _traceroute_probes;
+  DWORD _traceroute_interval;
 };
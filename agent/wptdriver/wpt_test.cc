@@ -105,6 +105,7 @@ void WptTest::Reset(void) {
   _doc_complete = false;
   _ignore_ssl = false;
   _tcpdump = false;
+  _hook_pcap = false;
   _timeline = false;
   _timelineStackDepth = 0;
   _trace = false;
@@ -149,10 +150,15 @@ void WptTest::Reset(void) {
   _dns_override.RemoveAll();
   _dns_name_override.RemoveAll();
   _block_requests.RemoveAll();
+  _ignore_activity.RemoveAll();
+  _adaptive_done = false;
+  _process_samples = false;
   _save_response_bodies = false;
   _save_html_body = false;
+  _dedup_bodies = false;
   _preserve_user_agent = false;
   _check_responsive = false;
+  _binary_request_log = false;
   _browser_width = BROWSER_WIDTH;
   _browser_height = BROWSER_HEIGHT;
   _viewport_width = 0;
@@ -216,6 +222,8 @@ bool WptTest::Load(CString& test) {
           _ignore_ssl = true;
         else if (!key.CompareNoCase(_T("tcpdump")) && _ttoi(value.Trim()))
           _tcpdump = true;
+        else if (!key.CompareNoCase(_T("hookpcap")) && _ttoi(value.Trim()))
+          _hook_pcap = true;
         else if (!key.CompareNoCase(_T("timeline")) && _ttoi(value.Trim()))
           _timeline = true;
         else if (!key.CompareNoCase(_T("timelineStackDepth")))
@@ -270,10 +278,15 @@ bool WptTest::Load(CString& test) {
           _save_response_bodies = true;
         else if (!key.CompareNoCase(_T("htmlbody")) && _ttoi(value.Trim()))
           _save_html_body = true;
+        else if (!key.CompareNoCase(_T("dedupBodies")) && _ttoi(value.Trim()))
+          _dedup_bodies = true;
         else if (!key.CompareNoCase(_T("keepua")) && _ttoi(value.Trim()))
           _preserve_user_agent = true;
         else if (!key.CompareNoCase(_T("responsive")) && _ttoi(value.Trim()))
           _check_responsive = true;
+        else if (!key.CompareNoCase(_T("binaryRequestLog")) &&
+                 _ttoi(value.Trim()))
+          _binary_request_log = true;
         else if (!key.CompareNoCase(_T("client")))
           _client = value.Trim();
         else if (!key.CompareNoCase(_T("customRule"))) {
@@ -305,6 +318,18 @@ bool WptTest::Load(CString& test) {
         else if (!key.CompareNoCase(_T("continuousVideo")) &&
           _ttoi(value.Trim()))
           _continuous_video = true;
+        else if (!key.CompareNoCase(_T("adaptiveDone")))
+          _adaptive_done = _ttoi(value.Trim()) != 0;
+        else if (!key.CompareNoCase(_T("processSamples")))
+          _process_samples = _ttoi(value.Trim()) != 0;
+        else if (!key.CompareNoCase(_T("ignoreActivity"))) {
+          int pattern_pos = 0;
+          while (pattern_pos >= 0) {
+            CString pattern = value.Tokenize(_T(" ,"), pattern_pos).Trim();
+            if (pattern.GetLength())
+              _ignore_activity.AddTail(pattern);
+          }
+        }
         else if (!key.CompareNoCase(_T("timeout"))) {
           _test_timeout = _ttoi(value.Trim()) * 1000;
           _script_timeout_multiplier = 1;
@@ -641,7 +666,13 @@ bool WptTest::ProcessCommand(ScriptCommand& command, bool &consumed) {
     if (seconds > 0 && seconds < 600)
       _measurement_timeout = seconds * 1000;
   } else if (cmd == _T("setactivitytimeout")) {
+    // an explicit activity timeout takes precedence over the adaptive check
     _activity_timeout = __min(__max(_ttoi(command.target), 0), 30000);
+    _adaptive_done = false;
+  } else if (cmd == _T("ignoreactivity")) {
+    EnterCriticalSection(&cs_);
+    _ignore_activity.AddTail(command.target);
+    LeaveCriticalSection(&cs_);
   } else if (cmd == _T("setuseragent")) {
     _user_agent = CT2A(command.target);
   } else if (cmd == _T("addheader")) {
@@ -975,6 +1006,26 @@ bool WptTest::BlockRequest(CString host, CString object) {
   return block;
 }
 
+/*-----------------------------------------------------------------------------
+  See if traffic for the given request should be ignored when deciding if
+  the page has gone quiet
+-----------------------------------------------------------------------------*/
+bool WptTest::IgnoreActivity(CString host, CString object) {
+  bool ignore = false;
+  EnterCriticalSection(&cs_);
+  if (!_ignore_activity.IsEmpty()) {
+    CString request = host + object;
+    POSITION pos = _ignore_activity.GetHeadPosition();
+    while (!ignore && pos) {
+      CString pattern = _ignore_activity.GetNext(pos);
+      if (request.Find(pattern) >= 0)
+        ignore = true;
+    }
+  }
+  LeaveCriticalSection(&cs_);
+  return ignore;
+}
+
 /*-----------------------------------------------------------------------------
   See if the host for the outbound request needs to be modified
 -----------------------------------------------------------------------------*/
@@ -131,6 +131,7 @@ public:
   void  OverridePort(const struct sockaddr FAR * name, int namelen);
   bool  ModifyRequestHeader(CStringA& header) const;
   bool  BlockRequest(CString host, CString object);
+  bool  IgnoreActivity(CString host, CString object);
   bool  OverrideHost(CString host, CString &new_host);
   bool  GetHeadersToSet(CString host, CAtlList<CString> &headers);
   bool  GetHeadersToAdd(CString host, CAtlList<CString> &headers);
@@ -155,6 +156,7 @@ public:
   bool    _doc_complete;
   bool    _ignore_ssl;
   bool    _tcpdump;
+  bool    _hook_pcap;
   bool    _timeline;
   int     _timelineStackDepth;
   bool    _trace;
@@ -188,14 +190,18 @@ public:
   DWORD   _minimum_duration;
   bool    _save_response_bodies;
   bool    _save_html_body;
+  bool    _dedup_bodies;
   bool    _preserve_user_agent;
   bool    _check_responsive;
+  bool    _binary_request_log;
   DWORD   _browser_width;
   DWORD   _browser_height;
   DWORD   _viewport_width;
   DWORD   _viewport_height;
   CAtlList<CustomRule> _custom_rules;
   DWORD   _activity_timeout;
+  bool    _adaptive_done;
+  bool    _process_samples;
   CString _client;
   CString _device_scale_factor;
   bool    _continuous_video;
@@ -254,6 +260,9 @@ protected:
   // requests to block
   CAtlList<CString> _block_requests;
 
+  // long-lived requests (beacons, long-polling) that do not count as activity
+  CAtlList<CString> _ignore_activity;
+
   // header overrides
   CAtlList<HttpHeaderValue> _add_headers;
   CAtlList<HttpHeaderValue> _set_headers;
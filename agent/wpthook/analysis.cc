@@ -0,0 +1,1070 @@
+/******************************************************************************
+Copyright (c) 2013, Google Inc.
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without 
+modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice, 
+      this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+    * Neither the name of the <ORGANIZATION> nor the names of its contributors 
+    may be used to endorse or promote products derived from this software 
+    without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE 
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE 
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL 
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR 
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER 
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, 
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE 
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+******************************************************************************/
+
+// No precompiled header, this file has to build without the Windows SDK
+#include "analysis.h"
+#include "compress_savings.h"
+#include <ctype.h>
+#include <string.h>
+#include <stdio.h>
+#include <algorithm>
+#include <regex>
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#include <process.h>
+#else
+#include <pthread.h>
+#include <unistd.h>
+#endif
+
+// VS2008 only has the TR1 regex
+#if defined(_MSC_VER) && _MSC_VER < 1600
+namespace analysis_regex = std::tr1;
+#else
+namespace analysis_regex = std;
+#endif
+
+static const unsigned ANALYSIS_MAX_THREADS = 4;
+
+static const unsigned char JPEG_SOS = 0xDA;
+static const unsigned char JPEG_DQT = 0xDB;
+
+// Position in the 8x8 block (row-major) of each zig-zag coefficient
+const int jpeg_zigzag_to_natural[64] = {
+   0,  1,  8, 16,  9,  2,  3, 10, 17, 24, 32, 25, 18, 11,  4,  5,
+  12, 19, 26, 33, 40, 48, 41, 34, 27, 20, 13,  6,  7, 14, 21, 28,
+  35, 42, 49, 56, 57, 50, 43, 36, 29, 22, 15, 23, 30, 37, 44, 51,
+  58, 59, 52, 45, 38, 31, 39, 46, 53, 60, 61, 54, 47, 55, 62, 63
+};
+
+// Example tables from the JPEG spec (K.1 and K.2) that the IJG encoder
+// scales for its quality setting (row-major order)
+static const unsigned short JPEG_STD_LUMA[64] = {
+  16,  11,  10,  16,  24,  40,  51,  61,
+  12,  12,  14,  19,  26,  58,  60,  55,
+  14,  13,  16,  24,  40,  57,  69,  56,
+  14,  17,  22,  29,  51,  87,  80,  62,
+  18,  22,  37,  56,  68, 109, 103,  77,
+  24,  35,  55,  64,  81, 104, 113,  92,
+  49,  64,  78,  87, 103, 121, 120, 101,
+  72,  92,  95,  98, 112, 100, 103,  99
+};
+static const unsigned short JPEG_STD_CHROMA[64] = {
+  17,  18,  24,  47,  99,  99,  99,  99,
+  18,  21,  26,  66,  99,  99,  99,  99,
+  24,  26,  56,  99,  99,  99,  99,  99,
+  47,  66,  99,  99,  99,  99,  99,  99,
+  99,  99,  99,  99,  99,  99,  99,  99,
+  99,  99,  99,  99,  99,  99,  99,  99,
+  99,  99,  99,  99,  99,  99,  99,  99,
+  99,  99,  99,  99,  99,  99,  99,  99
+};
+
+/*-----------------------------------------------------------------------------
+-----------------------------------------------------------------------------*/
+void ColorHistogram::Reset() {
+  memset(r_, 0, sizeof(r_));
+  memset(g_, 0, sizeof(g_));
+  memset(b_, 0, sizeof(b_));
+}
+
+/*-----------------------------------------------------------------------------
+  Given a JPEG byte stream, find the next marker
+-----------------------------------------------------------------------------*/
+bool JpegFindMarker(const unsigned char * buff, size_t len, size_t &pos,
+                    const unsigned char * &marker, size_t &marker_len) {
+  bool found = false;
+  marker = NULL;
+  marker_len = 0;
+  if (pos < len) {
+    unsigned char val = buff[pos];
+    if (val == 0xff) {
+      // ff can repeat, the actual marker comes from the first non-ff
+      while (val == 0xff && pos + 1 < len) {
+        pos++;
+        val = buff[pos];
+      }
+      if (val == 0xff)
+        return false;
+      marker = &buff[pos - 1];
+      pos++;
+      if ((val >= 0xd0 && val <= 0xd9) || val == 0x01) {
+        found = true;
+      } else if(val == JPEG_SOS) {
+        // image data
+        size_t marker_end = pos + 1;
+        size_t next_marker = len;
+        while (marker_end + 1 < len && !found) {
+          if (buff[marker_end] == 0xff &&
+              buff[marker_end + 1] != 0x00) {   // escaping
+            next_marker = marker_end;
+            found = true;
+          }
+          marker_end++;
+        }
+        marker_len = next_marker > pos ? next_marker - pos : 0;
+      } else if (pos + 1 < len) {
+        marker_len = (size_t)buff[pos] * 256 + (size_t)buff[pos + 1];
+        found = true;
+      }
+    }
+  }
+  return found;
+}
+
+/*-----------------------------------------------------------------------------
+-----------------------------------------------------------------------------*/
+bool JpegIsJpeg(const unsigned char * buff, size_t len) {
+  return buff && len > 2 && buff[0] == 0xFF && buff[1] == 0xD8;
+}
+
+/*-----------------------------------------------------------------------------
+  Count the scans in a JPEG (more than one means it is progressive)
+-----------------------------------------------------------------------------*/
+int JpegCountScans(const unsigned char * buff, size_t len) {
+  int scans = 0;
+  if (JpegIsJpeg(buff, len)) {
+    size_t pos = 0;
+    const unsigned char * marker;
+    size_t marker_length;
+    while (JpegFindMarker(buff, len, pos, marker, marker_length) && marker) {
+      if (marker[0] == 0xff && marker[1] == JPEG_SOS)
+        scans++;
+      pos += marker_length;
+    }
+  }
+  return scans;
+}
+
+/*-----------------------------------------------------------------------------
+  Pull quantization table |id| out of the DQT markers (row-major order).
+-----------------------------------------------------------------------------*/
+bool JpegGetQuantTable(const unsigned char * buff, size_t len, int id,
+                       unsigned short table[64]) {
+  bool found = false;
+  if (JpegIsJpeg(buff, len)) {
+    size_t pos = 0;
+    const unsigned char * marker;
+    size_t marker_length;
+    while (!found &&
+           JpegFindMarker(buff, len, pos, marker, marker_length) && marker) {
+      if (marker[1] == JPEG_SOS)
+        break;
+      if (marker[1] == JPEG_DQT && marker_length > 2 &&
+          pos + marker_length <= len) {
+        const unsigned char * data = &buff[pos + 2];
+        const unsigned char * end = &buff[pos + marker_length];
+        while (!found && data < end) {
+          int precision = data[0] >> 4;
+          int table_id = data[0] & 0x0F;
+          size_t table_len = precision ? 128 : 64;
+          data++;
+          if ((size_t)(end - data) < table_len)
+            break;
+          if (table_id == id) {
+            for (int i = 0; i < 64; i++) {
+              table[jpeg_zigzag_to_natural[i]] = precision ?
+                  (unsigned short)(data[i * 2] * 256 + data[i * 2 + 1]) :
+                  data[i];
+            }
+            found = true;
+          }
+          data += table_len;
+        }
+      }
+      pos += marker_length;
+    }
+  }
+  return found;
+}
+
+/*-----------------------------------------------------------------------------
+  Estimate the IJG quality setting (1-100) that produced a quantization
+  table by comparing it to the standard table it would have been scaled
+  from.  Tables from other encoders get the closest equivalent quality.
+-----------------------------------------------------------------------------*/
+int JpegTableQuality(const unsigned short table[64], bool chroma) {
+  const unsigned short * std_table = chroma ? JPEG_STD_CHROMA : JPEG_STD_LUMA;
+  unsigned long total = 0;
+  unsigned long std_total = 0;
+  bool all_ones = true;
+  for (int i = 0; i < 64; i++) {
+    total += table[i];
+    std_total += std_table[i];
+    if (table[i] > 1)
+      all_ones = false;
+  }
+  if (all_ones)
+    return 100;
+  double scale = (double)total * 100.0 / (double)std_total;
+  double quality = scale <= 100.0 ? (200.0 - scale) / 2.0 : 5000.0 / scale;
+  int result = (int)(quality + 0.5);
+  if (result < 1)
+    result = 1;
+  if (result > 100)
+    result = 100;
+  return result;
+}
+
+/*-----------------------------------------------------------------------------
+  Estimated quality of the luminance table (-1 if there isn't one).
+-----------------------------------------------------------------------------*/
+int JpegEstimateQuality(const unsigned char * buff, size_t len) {
+  int quality = -1;
+  unsigned short table[64];
+  if (JpegGetQuantTable(buff, len, 0, table))
+    quality = JpegTableQuality(table, false);
+  return quality;
+}
+
+/*-----------------------------------------------------------------------------
+  The table the IJG encoder would use for |quality| (row-major order).
+-----------------------------------------------------------------------------*/
+void JpegScaledQuantTable(int quality, bool chroma, unsigned short table[64]) {
+  const unsigned short * std_table = chroma ? JPEG_STD_CHROMA : JPEG_STD_LUMA;
+  if (quality < 1)
+    quality = 1;
+  if (quality > 100)
+    quality = 100;
+  long scale = quality < 50 ? 5000 / quality : 200 - quality * 2;
+  for (int i = 0; i < 64; i++) {
+    long value = ((long)std_table[i] * scale + 50) / 100;
+    if (value < 1)
+      value = 1;
+    if (value > 255)
+      value = 255;
+    table[i] = (unsigned short)value;
+  }
+}
+
+/*-----------------------------------------------------------------------------
+  Compare two frames of the same dimensions, ignoring the margins where the
+  scroll bar and status bar live.
+-----------------------------------------------------------------------------*/
+bool BitmapsDiffer(const AnalysisBitmap& img1, const AnalysisBitmap& img2,
+                   size_t right_margin, size_t bottom_margin) {
+  if (!img1.IsValid() || !img2.IsValid() ||
+      img1.width_ != img2.width_ || img1.height_ != img2.height_ ||
+      img1.bytes_per_pixel_ != img2.bytes_per_pixel_)
+    return true;
+
+  size_t width = img1.width_ > right_margin ? img1.width_ - right_margin : 0;
+  size_t row_length = width * img1.bytes_per_pixel_;
+  for (size_t row = bottom_margin; row < img1.height_; row++) {
+    if (memcmp(img1.Row(row), img2.Row(row), row_length))
+      return true;
+  }
+
+  return false;
+}
+
+/*-----------------------------------------------------------------------------
+  Histogram of the non-white pixels of a 24 or 32-bit frame
+-----------------------------------------------------------------------------*/
+bool BitmapHistogram(const AnalysisBitmap& img, size_t right_margin,
+                     size_t bottom_margin, ColorHistogram& histogram) {
+  histogram.Reset();
+  if (!img.IsValid() || img.bytes_per_pixel_ < 3)
+    return false;
+
+  size_t width = img.width_ > right_margin ? img.width_ - right_margin : 0;
+  size_t pixel_bytes = img.bytes_per_pixel_;
+  for (size_t y = bottom_margin; y < img.height_; y++) {
+    const unsigned char * pixel = img.Row(y);
+    const unsigned char * end = pixel + width * pixel_bytes;
+    for (; pixel < end; pixel += pixel_bytes) {
+      unsigned char b = pixel[0];
+      unsigned char g = pixel[1];
+      unsigned char r = pixel[2];
+      if ((r & g & b) != 255) {
+        histogram.r_[r]++;
+        histogram.g_[g]++;
+        histogram.b_[b]++;
+      }
+    }
+  }
+  return true;
+}
+
+/*-----------------------------------------------------------------------------
+-----------------------------------------------------------------------------*/
+static void AppendChannel(std::string& json, const char * name,
+                          const unsigned long * values) {
+  char buff[16];
+  json += "\"";
+  json += name;
+  json += "\":[";
+  for (int i = 0; i < 256; i++) {
+    if (i)
+      json += ",";
+    sprintf(buff, "%lu", values[i]);
+    json += buff;
+  }
+  json += "]";
+}
+
+/*-----------------------------------------------------------------------------
+  Serialize the histogram in the format the server expects:
+  {"r":[...],"g":[...],"b":[...]}
+-----------------------------------------------------------------------------*/
+void HistogramJSON(const ColorHistogram& histogram, std::string& json) {
+  json.clear();
+  json.reserve(256 * 3 * 4 + 32);
+  json += "{";
+  AppendChannel(json, "r", histogram.r_);
+  json += ",";
+  AppendChannel(json, "g", histogram.g_);
+  json += ",";
+  AppendChannel(json, "b", histogram.b_);
+  json += "}";
+}
+
+/*-----------------------------------------------------------------------------
+-----------------------------------------------------------------------------*/
+AnalysisVideo::AnalysisVideo(size_t right_margin, size_t bottom_margin):
+  right_margin_(right_margin)
+  , bottom_margin_(bottom_margin) {
+  Reset();
+}
+
+/*-----------------------------------------------------------------------------
+-----------------------------------------------------------------------------*/
+void AnalysisVideo::Reset() {
+  frame_count_ = 0;
+  histogram_count_ = 0;
+  has_render_start_ = false;
+  render_start_ms_ = 0;
+  visually_complete_ms_ = 0;
+}
+
+/*-----------------------------------------------------------------------------
+  Run the next frame through the pipeline (last is the previous frame, or an
+  empty bitmap for the first one).  The first frame is always kept at time
+  zero, after that a frame is kept when it differs from the last one
+  outside of the margins.  Returns true if the frame should be saved.
+-----------------------------------------------------------------------------*/
+bool AnalysisVideo::AddFrame(const AnalysisBitmap& frame,
+                             const AnalysisBitmap& last,
+                             unsigned long time_ms,
+                             AnalysisVideoFrame& result) {
+  bool first = !frame_count_;
+  frame_count_++;
+  result.time_ms_ = first ? 0 : time_ms;
+  // we save the frames in increments of 100ms (for now anyway)
+  // round it to the closest interval
+  result.interval_ = (result.time_ms_ + 50) / 100;
+  result.changed_ = first;
+  result.histogram_.clear();
+  if (!first && frame.width_ == last.width_ && frame.height_ == last.height_) {
+    result.changed_ = BitmapsDiffer(last, frame, right_margin_,
+                                    bottom_margin_);
+    if (result.changed_) {
+      if (!has_render_start_) {
+        has_render_start_ = true;
+        render_start_ms_ = time_ms;
+      }
+      visually_complete_ms_ = time_ms;
+    }
+  }
+  if (result.changed_) {
+    ColorHistogram colors;
+    if (BitmapHistogram(frame, right_margin_, bottom_margin_, colors))
+      HistogramJSON(colors, result.histogram_);
+  }
+  return result.changed_;
+}
+
+/*-----------------------------------------------------------------------------
+  Add the frame's entry to the histograms array that is being built up
+  (the caller writes the brackets around it).
+-----------------------------------------------------------------------------*/
+void AnalysisVideo::AppendHistogram(const AnalysisVideoFrame& frame,
+                                    std::string& json) {
+  if (frame.histogram_.empty())
+    return;
+  char time[32];
+  sprintf(time, "%lu", frame.time_ms_);
+  if (histogram_count_)
+    json += ", ";
+  json += "{\"histogram\": ";
+  json += frame.histogram_;
+  json += ", \"time\": ";
+  json += time;
+  json += "}";
+  histogram_count_++;
+}
+
+/*-----------------------------------------------------------------------------
+-----------------------------------------------------------------------------*/
+AnalysisRequest::AnalysisRequest():
+  result_(0)
+  , socket_id_(0)
+  , http_version_(0)
+  , from_network_(true)
+  , is_static_(false)
+  , response_bytes_(0)
+  , header_bytes_(0)
+  , body_(NULL)
+  , body_len_(0)
+  , text_(NULL)
+  , text_len_(0)
+  , has_expiration_(false)
+  , expiration_set_(false)
+  , seconds_remaining_(0)
+  , start_(0)
+  , first_byte_(0)
+  , end_(0)
+  , dns_start_(0)
+  , dns_end_(0)
+  , connect_start_(0)
+  , connect_end_(0)
+  , keep_alive_score_(-1)
+  , gzip_score_(-1)
+  , gzip_total_(0)
+  , gzip_target_(0)
+  , cache_score_(-1)
+  , cache_time_secs_(-1)
+  , static_cdn_score_(-1)
+  , image_compression_score_(-1)
+  , image_compress_total_(0)
+  , image_compress_target_(0)
+  , jpeg_scans_(0)
+  , combine_score_(-1) {
+}
+
+/*-----------------------------------------------------------------------------
+  Check all the connections for keep-alive and reuse
+-----------------------------------------------------------------------------*/
+int AnalysisCheckKeepAlive(std::vector<AnalysisRequest>& requests) {
+  int score = -1;
+  int count = 0;
+  int total = 0;
+  for (size_t i = 0; i < requests.size(); i++) {
+    AnalysisRequest& request = requests[i];
+    if (request.result_ != 200 || !request.from_network_)
+      continue;
+    const std::string& connection = request.connection_;
+    if (connection.find("keep-alive") != std::string::npos &&
+        connection.find("close") == std::string::npos) {
+      request.keep_alive_score_ = 100;
+    } else {
+      // see if there were any other requests from the same host
+      bool needed = false;
+      bool reused = false;
+      for (size_t j = 0; j < requests.size(); j++) {
+        const AnalysisRequest& other = requests[j];
+        if (j != i && !other.host_.empty() && other.host_ == request.host_) {
+          needed = true;
+          if (other.socket_id_ == request.socket_id_)
+            reused = true;
+        }
+      }
+      if (reused)
+        request.keep_alive_score_ = 100;
+      else if (needed)
+        // HTTP 1.1 defaults to keep-alive
+        request.keep_alive_score_ =
+            (connection.find("close") != std::string::npos ||
+             request.http_version_ < 1.1) ? 0 : 100;
+      else
+        request.keep_alive_score_ = -1;
+    }
+    if (request.keep_alive_score_ != -1) {
+      count++;
+      total += request.keep_alive_score_;
+    }
+  }
+  if (count)
+    score = total / count;
+  return score;
+}
+
+/*-----------------------------------------------------------------------------
+  Known image formats that shouldn't be gzipped (JPEG, PNG and GIF)
+-----------------------------------------------------------------------------*/
+static bool IsCompressedImage(const unsigned char * data, size_t len) {
+  static const unsigned char png[8] =
+      {0x89, 0x50, 0x4E, 0x47, 0x0D, 0x0A, 0x1A, 0x0A};
+  return (len > 3 && data[0] == 0xFF && data[1] == 0xD8 && data[2] == 0xFF) ||
+         (len > 8 && !memcmp(data, png, sizeof(png))) ||
+         (len > 6 && data[0] == 0x47 && data[1] == 0x49 && data[2] == 0x46 &&
+          data[3] == 0x38 && data[5] == 0x61);
+}
+
+/*-----------------------------------------------------------------------------
+  Content-Encoding that already compresses the body (the header is a comma
+  separated list of codings, matched as whole tokens)
+-----------------------------------------------------------------------------*/
+bool AnalysisIsCompressedEncoding(const char * encoding, size_t len) {
+  static const char * const compressed[] = {"gzip", "x-gzip", "deflate",
+                                            "br", "zstd"};
+  size_t pos = 0;
+  while (pos < len) {
+    while (pos < len && (encoding[pos] == ',' || encoding[pos] == ' ' ||
+                         encoding[pos] == '\t'))
+      pos++;
+    size_t start = pos;
+    while (pos < len && encoding[pos] != ',' && encoding[pos] != ' ' &&
+           encoding[pos] != '\t')
+      pos++;
+    size_t token_len = pos - start;
+    for (size_t i = 0; token_len &&
+         i < sizeof(compressed) / sizeof(compressed[0]); i++) {
+      if (strlen(compressed[i]) == token_len) {
+        size_t c = 0;
+        while (c < token_len &&
+               tolower((unsigned char)encoding[start + c]) == compressed[i][c])
+          c++;
+        if (c == token_len)
+          return true;
+      }
+    }
+  }
+  return false;
+}
+
+/*-----------------------------------------------------------------------------
+  Bodies that need real compression to see what they would save
+-----------------------------------------------------------------------------*/
+class GzipJobs {
+public:
+  std::vector<AnalysisRequest> * requests_;
+  std::vector<size_t>            queued_;   // request index
+  std::vector<size_t>            sizes_;    // gzipped size per job
+};
+
+static void CompressTask(size_t index, void * context) {
+  GzipJobs * jobs = (GzipJobs *)context;
+  AnalysisRequest& request = (*jobs->requests_)[jobs->queued_[index]];
+  jobs->sizes_[index] = CompressedSize(COMPRESS_GZIP, request.body_,
+                                       request.body_len_);
+}
+
+/*-----------------------------------------------------------------------------
+  Check whether the responses are compressed.  A quick LZ estimate rules out
+  bodies that could not save enough, the rest are gzipped in parallel.
+-----------------------------------------------------------------------------*/
+int AnalysisCheckGzip(std::vector<AnalysisRequest>& requests,
+                      size_t& total_bytes, size_t& target_bytes) {
+  int score = -1;
+  int count = 0;
+  total_bytes = 0;
+  target_bytes = 0;
+  GzipJobs jobs;
+  jobs.requests_ = &requests;
+  for (size_t i = 0; i < requests.size(); i++) {
+    AnalysisRequest& request = requests[i];
+    if (request.result_ != 200 || !request.from_network_)
+      continue;
+    const std::string& encoding = request.content_encoding_;
+    size_t request_bytes = request.response_bytes_;
+    bool queued = false;
+    request.gzip_score_ = 0;
+
+    // If there is gzip (or brotli/zstd) encoding, then we are all set.
+    // Spare small (<1 packet) responses.
+    if (AnalysisIsCompressedEncoding(encoding.c_str(), encoding.length()))
+      request.gzip_score_ = 100;
+    else if (request_bytes < 1400)
+      request.gzip_score_ = -1;
+
+    if (!request.gzip_score_) {
+      if (IsCompressedImage(request.body_, request.body_len_)) {
+        request.gzip_score_ = -1;
+      } else if (request.body_ && request.body_len_) {
+        // skip the compression when even the best case from the estimate
+        // doesn't get 10% savings or 1400 bytes
+        size_t best_bytes = CompressEstimateMinSize(request.body_,
+                                                    request.body_len_) +
+                            request.header_bytes_;
+        if (best_bytes >= request_bytes * 0.9 ||
+            request_bytes - best_bytes < 1400) {
+          request.gzip_score_ = -1;
+        } else {
+          jobs.queued_.push_back(i);
+          queued = true;
+        }
+      }
+    }
+
+    // compressed bodies are scored once the compression is done
+    if (request.gzip_score_ != -1 && !queued) {
+      count++;
+      request.gzip_total_ = request_bytes;
+      request.gzip_target_ = request_bytes;
+      total_bytes += request_bytes;
+      target_bytes += request_bytes;
+    }
+  }
+
+  jobs.sizes_.resize(jobs.queued_.size(), 0);
+  AnalysisParallelFor(jobs.queued_.size(), CompressTask, &jobs);
+  for (size_t i = 0; i < jobs.queued_.size(); i++) {
+    AnalysisRequest& request = requests[jobs.queued_[i]];
+    size_t original_bytes = request.response_bytes_;
+    size_t target = original_bytes;
+    if (jobs.sizes_[i])
+      target = jobs.sizes_[i] + request.header_bytes_;
+    // allow a pass if we don't get 10% savings or less than 1400 bytes
+    if (target >= original_bytes * 0.9 || original_bytes - target < 1400) {
+      request.gzip_score_ = -1;
+    } else {
+      count++;
+      request.gzip_total_ = original_bytes;
+      request.gzip_target_ = target;
+      total_bytes += original_bytes;
+      target_bytes += target;
+    }
+  }
+
+  if (count && total_bytes)
+    score = (int)(target_bytes * 100 / total_bytes);
+  return score;
+}
+
+/*-----------------------------------------------------------------------------
+  Check each static element to make sure it was cachable
+-----------------------------------------------------------------------------*/
+int AnalysisCheckCache(std::vector<AnalysisRequest>& requests) {
+  int score = -1;
+  int count = 0;
+  int total = 0;
+  for (size_t i = 0; i < requests.size(); i++) {
+    AnalysisRequest& request = requests[i];
+    if (!request.has_expiration_ ||
+        request.mime_.find("/cache-manifest") != std::string::npos)
+      continue;
+    count++;
+    request.cache_score_ = 0;
+    request.cache_time_secs_ = request.seconds_remaining_;
+    if (request.expiration_set_) {
+      // If age more than 7 days give 100
+      // else if more than hour, give 50
+      if (request.seconds_remaining_ >= 604800)
+        request.cache_score_ = 100;
+      else if (request.seconds_remaining_ >= 3600)
+        request.cache_score_ = 50;
+    }
+    total += request.cache_score_;
+  }
+  if (count)
+    score = total / count;
+  return score;
+}
+
+/*-----------------------------------------------------------------------------
+  Make sure all static content is served from a CDN
+-----------------------------------------------------------------------------*/
+int AnalysisCheckStaticCdn(std::vector<AnalysisRequest>& requests) {
+  int score = -1;
+  int count = 0;
+  int total = 0;
+  for (size_t i = 0; i < requests.size(); i++) {
+    AnalysisRequest& request = requests[i];
+    if (request.result_ == 200 && request.is_static_) {
+      request.static_cdn_score_ = request.cdn_provider_.empty() ? 0 : 100;
+      count++;
+      total += request.static_cdn_score_;
+    }
+  }
+  if (count)
+    score = total / count;
+  return score;
+}
+
+/*-----------------------------------------------------------------------------
+  Custom rules with their regexes compiled once for all of the requests
+-----------------------------------------------------------------------------*/
+class CompiledRule {
+public:
+  std::string           name_;
+  analysis_regex::regex mime_;
+  analysis_regex::regex match_;
+};
+
+class CustomRuleJobs {
+public:
+  std::vector<AnalysisRequest> * requests_;
+  std::vector<CompiledRule>      rules_;
+};
+
+static void CustomRuleTask(size_t index, void * context) {
+  CustomRuleJobs * jobs = (CustomRuleJobs *)context;
+  AnalysisRequest& request = (*jobs->requests_)[index];
+  if (!request.text_ || !request.text_len_)
+    return;
+  std::string body(request.text_, request.text_len_);
+  for (size_t i = 0; i < jobs->rules_.size(); i++) {
+    const CompiledRule& rule = jobs->rules_[i];
+    if (analysis_regex::regex_search(request.mime_, rule.mime_)) {
+      AnalysisRuleMatch match;
+      match.name_ = rule.name_;
+      const analysis_regex::sregex_token_iterator end;
+      analysis_regex::sregex_token_iterator it(body.begin(), body.end(),
+                                               rule.match_);
+      for (; it != end; ++it) {
+        if (!match.count_)
+          match.value_ = *it;
+        match.count_++;
+      }
+      request.rule_matches_.push_back(match);
+    }
+  }
+}
+
+/*-----------------------------------------------------------------------------
+  Run the test's custom rules against the decoded bodies (a rule with a
+  regex that doesn't compile is skipped)
+-----------------------------------------------------------------------------*/
+void AnalysisCheckCustomRules(std::vector<AnalysisRequest>& requests,
+                              const std::vector<AnalysisCustomRule>& rules) {
+  CustomRuleJobs jobs;
+  jobs.requests_ = &requests;
+  analysis_regex::regex_constants::syntax_option_type flags =
+      analysis_regex::regex_constants::icase |
+      analysis_regex::regex_constants::ECMAScript;
+  for (size_t i = 0; i < rules.size(); i++) {
+    try {
+      CompiledRule rule;
+      rule.name_ = rules[i].name_;
+      rule.mime_.assign(rules[i].mime_, flags);
+      rule.match_.assign(rules[i].regex_, flags);
+      jobs.rules_.push_back(rule);
+    } catch (...) {
+    }
+  }
+  if (!jobs.rules_.empty())
+    AnalysisParallelFor(requests.size(), CustomRuleTask, &jobs);
+}
+
+/*-----------------------------------------------------------------------------
+  Check whether the JPEGs are compressed well, the target size of each one
+  comes from the agent's image_target.
+-----------------------------------------------------------------------------*/
+int AnalysisCheckImageCompression(std::vector<AnalysisRequest>& requests,
+                                  AnalysisImageTarget image_target,
+                                  void * context, size_t& total_bytes,
+                                  size_t& target_bytes) {
+  int score = -1;
+  int count = 0;
+  total_bytes = 0;
+  target_bytes = 0;
+  for (size_t i = 0; i < requests.size(); i++) {
+    AnalysisRequest& request = requests[i];
+    if (request.result_ != 200 ||
+        request.mime_.find("image/") == std::string::npos ||
+        !request.body_ || request.body_len_ <= 2 ||
+        request.body_[0] != 0xFF || request.body_[1] != 0xD8)
+      continue;
+    count++;
+    size_t size = request.body_len_;
+    size_t target = size;
+    if (image_target &&
+        image_target(request.body_, size, target, context)) {
+      if (target > size)
+        target = size;
+      total_bytes += size;
+      target_bytes += target;
+      request.image_compress_total_ = size;
+      request.image_compress_target_ = target;
+      request.image_compression_score_ = (int)(target * 100 / size);
+    }
+  }
+  if (count && total_bytes)
+    score = (int)(target_bytes * 100 / total_bytes);
+  return score;
+}
+
+/*-----------------------------------------------------------------------------
+  Count the scans of the JPEGs, the score is the share of the bytes of the
+  JPEGs over 10KB that are progressive.
+-----------------------------------------------------------------------------*/
+int AnalysisCheckProgressiveJpeg(std::vector<AnalysisRequest>& requests) {
+  int score = -1;
+  double progressive_bytes = 0;
+  double total_bytes = 0;
+  for (size_t i = 0; i < requests.size(); i++) {
+    AnalysisRequest& request = requests[i];
+    if (request.result_ != 200 ||
+        request.mime_.find("image/") == std::string::npos ||
+        !request.body_ || !request.body_len_ ||
+        !JpegIsJpeg(request.body_, request.body_len_))
+      continue;
+    request.jpeg_scans_ = JpegCountScans(request.body_, request.body_len_);
+    if (request.body_len_ > 10240 && request.jpeg_scans_ > 0) {
+      total_bytes += request.body_len_;
+      if (request.jpeg_scans_ > 1)
+        progressive_bytes += request.body_len_;
+    }
+  }
+  if (total_bytes > 0)
+    score = (int)((progressive_bytes * 100.0 / total_bytes) + 0.5);
+  return score;
+}
+
+/*-----------------------------------------------------------------------------
+  Check to make sure the static CSS and JS before start render are combined,
+  each extra file of the same type costs 10 (js) or 5 (css) points.  No
+  applicable objects is a success.
+-----------------------------------------------------------------------------*/
+int AnalysisCheckCombine(std::vector<AnalysisRequest>& requests,
+                         long long render_start) {
+  int count = 0;
+  int js_redundant_count = 0;
+  int css_redundant_count = 0;
+  for (size_t i = 0; i < requests.size(); i++) {
+    AnalysisRequest& request = requests[i];
+    if (request.result_ != 200 || request.start_ > render_start ||
+        !request.is_static_)
+      continue;
+    const std::string& mime = request.mime_;
+    bool css = mime.find("/css") != std::string::npos;
+    if (!css && mime.find("javascript") == std::string::npos)
+      continue;
+    int combinable_requests = 0;
+    for (size_t j = 0; j < requests.size(); j++) {
+      const AnalysisRequest& other = requests[j];
+      if (j != i && other.is_static_ && other.start_ <= render_start &&
+          other.mime_ == mime)
+        combinable_requests++;
+    }
+    count++;
+    if (combinable_requests <= 0) {
+      request.combine_score_ = 100;
+    } else {
+      request.combine_score_ = 0;
+      if (css)
+        css_redundant_count++;
+      else
+        js_redundant_count++;
+    }
+  }
+  int score = 100;
+  if (count) {
+    score = 100 - js_redundant_count * 10 - css_redundant_count * 5;
+    if (score < 0)
+      score = 0;
+  }
+  return score;
+}
+
+/*-----------------------------------------------------------------------------
+-----------------------------------------------------------------------------*/
+AnalysisRequestSummary::AnalysisRequestSummary():
+  count_ok_(0)
+  , count_ok_doc_(0)
+  , count_redirect_(0)
+  , count_redirect_doc_(0)
+  , count_not_modified_(0)
+  , count_not_modified_doc_(0)
+  , count_not_found_(0)
+  , count_not_found_doc_(0)
+  , count_other_(0)
+  , count_other_doc_(0)
+  , count_dns_(0)
+  , count_dns_doc_(0)
+  , count_connect_(0)
+  , count_connect_doc_(0)
+  , base_page_(-1)
+  , base_page_redirects_(0)
+  , last_activity_(0)
+  , first_byte_(0) {
+}
+
+static bool IsRedirect(int result) {
+  return result == 301 || result == 302 || result == 401;
+}
+
+/*-----------------------------------------------------------------------------
+  Count the responses (in total and up to onload), find the base page (the
+  first request that isn't a redirect or an auth challenge) and the first
+  byte and last activity for the page.
+-----------------------------------------------------------------------------*/
+void AnalysisSummarizeRequests(const std::vector<AnalysisRequest>& requests,
+                               long long on_load,
+                               AnalysisRequestSummary& summary) {
+  summary = AnalysisRequestSummary();
+  for (size_t i = 0; i < requests.size(); i++) {
+    const AnalysisRequest& request = requests[i];
+    int result = request.result_;
+    int doc_increment = request.start_ <= on_load ? 1 : 0;
+    switch (result) {
+      case 200:
+        summary.count_ok_++;
+        summary.count_ok_doc_ += doc_increment;
+        break;
+      case 301:
+      case 302:
+        summary.count_redirect_++;
+        summary.count_redirect_doc_ += doc_increment;
+        break;
+      case 304:
+        summary.count_not_modified_++;
+        summary.count_not_modified_doc_ += doc_increment;
+        break;
+      case 404:
+        summary.count_not_found_++;
+        summary.count_not_found_doc_ += doc_increment;
+        break;
+      default:
+        summary.count_other_++;
+        summary.count_other_doc_ += doc_increment;
+        break;
+    }
+    if (request.dns_start_) {
+      summary.count_dns_++;
+      summary.count_dns_doc_ += doc_increment;
+    }
+    if (request.connect_start_) {
+      summary.count_connect_++;
+      summary.count_connect_doc_ += doc_increment;
+    }
+    if (summary.base_page_ < 0) {
+      if (IsRedirect(result))
+        summary.base_page_redirects_++;
+      else
+        summary.base_page_ = (int)i;
+    }
+    const long long times[] = {request.end_, request.start_,
+      request.first_byte_, request.dns_start_, request.dns_end_,
+      request.connect_start_, request.connect_end_};
+    for (size_t t = 0; t < sizeof(times) / sizeof(times[0]); t++)
+      if (times[t] > summary.last_activity_)
+        summary.last_activity_ = times[t];
+    if (request.first_byte_ && !IsRedirect(result) &&
+        (!summary.first_byte_ || request.first_byte_ < summary.first_byte_))
+      summary.first_byte_ = request.first_byte_;
+  }
+}
+
+/*-----------------------------------------------------------------------------
+  Look for the 2257 record-keeping statement or the RTA label
+-----------------------------------------------------------------------------*/
+bool AnalysisIsAdultContent(const char * text, size_t len) {
+  if (!text || !len)
+    return false;
+  static const char rta[] = "RTA-5042-1996-1400-1577-RTA";
+  const char * end = text + len;
+  if (std::search(text, end, rta, rta + sizeof(rta) - 1) != end)
+    return true;
+  analysis_regex::regex adult_regex("[^0-9a-zA-Z]2257[^0-9a-zA-Z]");
+  return analysis_regex::regex_search(text, end, adult_regex);
+}
+
+/*-----------------------------------------------------------------------------
+  Work shared by the threads of one AnalysisParallelFor
+-----------------------------------------------------------------------------*/
+class ParallelWork {
+public:
+  AnalysisTask  task_;
+  void *        context_;
+  size_t        count_;
+#ifdef _WIN32
+  volatile LONG next_;
+#else
+  volatile long next_;
+#endif
+};
+
+static size_t NextIndex(ParallelWork& work) {
+#ifdef _WIN32
+  return (size_t)InterlockedIncrement(&work.next_);
+#else
+  return (size_t)__sync_add_and_fetch(&work.next_, 1);
+#endif
+}
+
+#ifdef _WIN32
+static unsigned __stdcall ParallelThreadProc(void * arg) {
+#else
+static void * ParallelThreadProc(void * arg) {
+#endif
+  ParallelWork * work = (ParallelWork *)arg;
+  size_t index;
+  while ((index = NextIndex(*work)) < work->count_)
+    work->task_(index, work->context_);
+  return 0;
+}
+
+/*-----------------------------------------------------------------------------
+  Cores to spread the work across (capped, the agent is still running)
+-----------------------------------------------------------------------------*/
+unsigned AnalysisThreadCount() {
+  unsigned count = 1;
+#ifdef _WIN32
+  SYSTEM_INFO info;
+  GetSystemInfo(&info);
+  if (info.dwNumberOfProcessors)
+    count = info.dwNumberOfProcessors;
+#else
+  long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+  if (cpus > 0)
+    count = (unsigned)cpus;
+#endif
+  return count < ANALYSIS_MAX_THREADS ? count : ANALYSIS_MAX_THREADS;
+}
+
+/*-----------------------------------------------------------------------------
+-----------------------------------------------------------------------------*/
+void AnalysisParallelFor(size_t count, AnalysisTask task, void * context) {
+  if (!count || !task)
+    return;
+  ParallelWork work;
+  work.task_ = task;
+  work.context_ = context;
+  work.count_ = count;
+  work.next_ = -1;
+  size_t thread_count = AnalysisThreadCount();
+  if (thread_count > count)
+    thread_count = count;
+  size_t started = 0;
+#ifdef _WIN32
+  HANDLE threads[ANALYSIS_MAX_THREADS];
+  for (size_t i = 1; i < thread_count; i++) {
+    HANDLE thread = (HANDLE)_beginthreadex(0, 0, ParallelThreadProc, &work,
+                                           0, 0);
+    if (thread)
+      threads[started++] = thread;
+  }
+  ParallelThreadProc(&work);
+  if (started) {
+    WaitForMultipleObjects((DWORD)started, threads, TRUE, INFINITE);
+    for (size_t i = 0; i < started; i++)
+      CloseHandle(threads[i]);
+  }
+#else
+  pthread_t threads[ANALYSIS_MAX_THREADS];
+  for (size_t i = 1; i < thread_count; i++)
+    if (!pthread_create(&threads[started], NULL, ParallelThreadProc, &work))
+      started++;
+  ParallelThreadProc(&work);
+  for (size_t i = 0; i < started; i++)
+    pthread_join(threads[i], NULL);
+#endif
+}
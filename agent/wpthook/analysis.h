@@ -0,0 +1,267 @@
+/******************************************************************************
+Copyright (c) 2013, Google Inc.
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without 
+modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice, 
+      this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+    * Neither the name of the <ORGANIZATION> nor the names of its contributors 
+    may be used to endorse or promote products derived from this software 
+    without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE 
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE 
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL 
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR 
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER 
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, 
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE 
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+******************************************************************************/
+
+#pragma once
+// Portable analysis helpers shared by wpthook and the IE pagetest agent.
+// Nothing in here may depend on Win32, ATL or CxImage (and it needs to stay
+// buildable with the older VS2008 toolchain that pagetest uses) so the same
+// code can be compiled and exercised on any platform.  analysis_test/ builds
+// it (with compress_savings.cc) as a library along with its unit tests.
+#include <stddef.h>
+#include <string>
+#include <vector>
+
+/*-----------------------------------------------------------------------------
+  Raw view of a 24 or 32-bit bitmap in memory (BGR byte order).  Rows are
+  addressed the same way as the underlying DIB (row 0 is the bottom row).
+-----------------------------------------------------------------------------*/
+class AnalysisBitmap {
+public:
+  AnalysisBitmap():bits_(NULL), width_(0), height_(0), stride_(0),
+    bytes_per_pixel_(0){}
+  AnalysisBitmap(const unsigned char * bits, size_t width, size_t height,
+                 size_t stride, size_t bytes_per_pixel):
+    bits_(bits), width_(width), height_(height), stride_(stride),
+    bytes_per_pixel_(bytes_per_pixel){}
+
+  bool IsValid() const {return bits_ && width_ && height_ && bytes_per_pixel_;}
+  const unsigned char * Row(size_t row) const {return bits_ + row * stride_;}
+
+  const unsigned char * bits_;
+  size_t width_;
+  size_t height_;
+  size_t stride_;
+  size_t bytes_per_pixel_;
+};
+
+/*-----------------------------------------------------------------------------
+  Per-channel color histogram (white pixels are excluded)
+-----------------------------------------------------------------------------*/
+class ColorHistogram {
+public:
+  ColorHistogram(){Reset();}
+  void Reset();
+
+  unsigned long r_[256];
+  unsigned long g_[256];
+  unsigned long b_[256];
+};
+
+// JPEG
+bool JpegFindMarker(const unsigned char * buff, size_t len, size_t &pos,
+                    const unsigned char * &marker, size_t &marker_len);
+bool JpegIsJpeg(const unsigned char * buff, size_t len);
+int  JpegCountScans(const unsigned char * buff, size_t len);
+bool JpegGetQuantTable(const unsigned char * buff, size_t len, int id,
+                       unsigned short table[64]);
+int  JpegTableQuality(const unsigned short table[64], bool chroma);
+int  JpegEstimateQuality(const unsigned char * buff, size_t len);
+void JpegScaledQuantTable(int quality, bool chroma, unsigned short table[64]);
+extern const int jpeg_zigzag_to_natural[64];
+
+// Video frames
+bool BitmapsDiffer(const AnalysisBitmap& img1, const AnalysisBitmap& img2,
+                   size_t right_margin, size_t bottom_margin);
+bool BitmapHistogram(const AnalysisBitmap& img, size_t right_margin,
+                     size_t bottom_margin, ColorHistogram& histogram);
+void HistogramJSON(const ColorHistogram& histogram, std::string& json);
+
+/*-----------------------------------------------------------------------------
+  One captured frame after it went through AnalysisVideo
+-----------------------------------------------------------------------------*/
+class AnalysisVideoFrame {
+public:
+  AnalysisVideoFrame():time_ms_(0), interval_(0), changed_(false){}
+  unsigned long time_ms_;   // from the start of the test (0 for the first)
+  unsigned long interval_;  // closest 100ms interval, for the file names
+  bool          changed_;   // first frame or different from the last one
+  std::string   histogram_; // JSON, only for the changed frames
+};
+
+/*-----------------------------------------------------------------------------
+  The video frame pipeline: the frames are passed in order (cropped or
+  expanded to the size of the first one) and the ones that changed get a
+  histogram and move the render start and visually complete times.
+-----------------------------------------------------------------------------*/
+class AnalysisVideo {
+public:
+  AnalysisVideo(size_t right_margin, size_t bottom_margin);
+  void Reset();
+  bool AddFrame(const AnalysisBitmap& frame, const AnalysisBitmap& last,
+                unsigned long time_ms, AnalysisVideoFrame& result);
+  void AppendHistogram(const AnalysisVideoFrame& frame, std::string& json);
+
+  size_t        frame_count_;
+  size_t        histogram_count_;
+  bool          has_render_start_;
+  unsigned long render_start_ms_;
+  unsigned long visually_complete_ms_;
+
+private:
+  size_t        right_margin_;
+  size_t        bottom_margin_;
+};
+
+/*-----------------------------------------------------------------------------
+  Custom rule from the test (the regexes are ECMAScript, case-insensitive)
+  and what it matched in a response body.
+-----------------------------------------------------------------------------*/
+class AnalysisCustomRule {
+public:
+  std::string name_;
+  std::string mime_;
+  std::string regex_;
+};
+
+class AnalysisRuleMatch {
+public:
+  AnalysisRuleMatch():count_(0){}
+  std::string name_;
+  int         count_;
+  std::string value_;   // first match
+};
+
+/*-----------------------------------------------------------------------------
+  Request record for the request-level checks.  The agents fill in what the
+  checks look at (hosts and header values in lower case) and copy the scores
+  back out, a score of -1 means the check doesn't apply to the request.
+  The body pointers are not owned and have to outlive the checks.
+-----------------------------------------------------------------------------*/
+class AnalysisRequest {
+public:
+  AnalysisRequest();
+
+  // inputs
+  std::string host_;
+  int         result_;
+  unsigned long socket_id_;
+  double      http_version_;
+  bool        from_network_;
+  bool        is_static_;
+  std::string connection_;
+  std::string content_encoding_;
+  std::string mime_;
+  size_t      response_bytes_;      // headers and body as received
+  size_t      header_bytes_;
+  const unsigned char * body_;      // as received (still content-encoded)
+  size_t      body_len_;
+  const char * text_;               // decoded body for the custom rules
+  size_t      text_len_;
+  bool        has_expiration_;      // the expiration could be evaluated
+  bool        expiration_set_;
+  int         seconds_remaining_;
+  std::string cdn_provider_;        // empty when not served by a known CDN
+  // times in any one unit (0 = didn't happen), the render start and onload
+  // passed to the checks have to be in the same unit
+  long long   start_;
+  long long   first_byte_;
+  long long   end_;
+  long long   dns_start_;
+  long long   dns_end_;
+  long long   connect_start_;
+  long long   connect_end_;
+
+  // scores
+  int         keep_alive_score_;
+  int         gzip_score_;
+  size_t      gzip_total_;
+  size_t      gzip_target_;
+  int         cache_score_;
+  int         cache_time_secs_;
+  int         static_cdn_score_;
+  int         image_compression_score_;
+  size_t      image_compress_total_;
+  size_t      image_compress_target_;
+  int         jpeg_scans_;
+  int         combine_score_;
+  std::vector<AnalysisRuleMatch> rule_matches_;
+};
+
+/*-----------------------------------------------------------------------------
+  Request counts, base page and page times from the processed requests
+-----------------------------------------------------------------------------*/
+class AnalysisRequestSummary {
+public:
+  AnalysisRequestSummary();
+
+  int count_ok_;
+  int count_ok_doc_;
+  int count_redirect_;
+  int count_redirect_doc_;
+  int count_not_modified_;
+  int count_not_modified_doc_;
+  int count_not_found_;
+  int count_not_found_doc_;
+  int count_other_;
+  int count_other_doc_;
+  int count_dns_;
+  int count_dns_doc_;
+  int count_connect_;
+  int count_connect_doc_;
+  int base_page_;             // index of the base page, -1 if there isn't one
+  int base_page_redirects_;
+  long long last_activity_;   // 0 if there was no activity
+  long long first_byte_;      // of the first non-redirect response
+};
+
+// Size a compressed version of the image would be, false if it couldn't be
+// worked out.  The agents plug in their JPEG re-encode (or estimate) here.
+typedef bool (*AnalysisImageTarget)(const unsigned char * image, size_t len,
+                                    size_t& target_len, void * context);
+
+// Content-Encoding is one of the compressing codings (gzip, deflate, br...)
+bool AnalysisIsCompressedEncoding(const char * encoding, size_t len);
+
+// Request-level checks.  Each one scores the requests it applies to and
+// returns the score for the page (-1 if nothing applied).
+int  AnalysisCheckKeepAlive(std::vector<AnalysisRequest>& requests);
+int  AnalysisCheckGzip(std::vector<AnalysisRequest>& requests,
+                       size_t& total_bytes, size_t& target_bytes);
+int  AnalysisCheckCache(std::vector<AnalysisRequest>& requests);
+int  AnalysisCheckStaticCdn(std::vector<AnalysisRequest>& requests);
+void AnalysisCheckCustomRules(std::vector<AnalysisRequest>& requests,
+                              const std::vector<AnalysisCustomRule>& rules);
+int  AnalysisCheckImageCompression(std::vector<AnalysisRequest>& requests,
+                                   AnalysisImageTarget image_target,
+                                   void * context, size_t& total_bytes,
+                                   size_t& target_bytes);
+int  AnalysisCheckProgressiveJpeg(std::vector<AnalysisRequest>& requests);
+int  AnalysisCheckCombine(std::vector<AnalysisRequest>& requests,
+                          long long render_start);
+
+// Page-level processing of the requests (in the order they were made)
+void AnalysisSummarizeRequests(const std::vector<AnalysisRequest>& requests,
+                               long long on_load,
+                               AnalysisRequestSummary& summary);
+bool AnalysisIsAdultContent(const char * text, size_t len);
+
+// Run task(0..count-1) spread across the cores (the calling thread does its
+// share).  Tasks must only touch their own index.
+typedef void (*AnalysisTask)(size_t index, void * context);
+void     AnalysisParallelFor(size_t count, AnalysisTask task, void * context);
+unsigned AnalysisThreadCount();
@@ -0,0 +1,945 @@
+/******************************************************************************
+Copyright (c) 2013, Google Inc.
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without 
+modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice, 
+      this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+    * Neither the name of the <ORGANIZATION> nor the names of its contributors 
+    may be used to endorse or promote products derived from this software 
+    without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE 
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE 
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL 
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR 
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER 
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, 
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE 
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+******************************************************************************/
+
+// Offline replay of the agent's result processing against the files that a
+// run already produced, so the processing and its cost can be measured on
+// Linux without the browser or the agent:
+//
+//   analysis_replay [-r rules.txt] [-v progress dir] <run file base>...
+//
+// where the run file base is the path without the suffixes (e.g.
+// results/1_Cached).  It reads <base>_IEWTR.txt (the request data),
+// <base>_IEWPG.txt (the page data), <base>_report.txt (the raw headers) and,
+// when there is one, <base>_bodies.zip.  The requests then go through the
+// same code as Results::ProcessRequests (counts, base page, page times),
+// OptimizationChecks (all of the checks, JPEGs are sized with
+// jpeg_savings.cc) and, with -v, Results::SaveVideo (frame differences,
+// histograms, render start and visually complete) for the progress_NNNN.png
+// frames the agent saved.  Only the Win32 parts around them (the request
+// timing capture, the CxImage decode and the file output) are left out.
+// The results, along with the time and memory of each stage in the same
+// form as the agent's _processing_stages.json, are written to stdout as
+// JSON.  Any of the run files may also be gzipped (.gz).
+//
+// The rules file has one custom rule per line as name=mime<tab>regex.
+#include "../analysis.h"
+#include "../cache_policy.h"
+#include "../jpeg_savings.h"
+#include <ctype.h>
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <time.h>
+#include <unistd.h>
+#include <png.h>
+#include <zlib.h>
+#include <algorithm>
+#include <map>
+
+// same margins as Results::SaveVideo
+static const size_t RIGHT_MARGIN = 25;
+static const size_t BOTTOM_MARGIN = 25;
+
+// columns of the request data (see Results::SaveRequest)
+enum RequestColumn {
+  COLUMN_HOST = 5,
+  COLUMN_URL = 6,
+  COLUMN_RESULT = 7,
+  COLUMN_TTFB = 9,
+  COLUMN_START = 10,
+  COLUMN_BYTES_IN = 12,
+  COLUMN_CONTENT_TYPE = 18,
+  COLUMN_CONTENT_ENCODING = 19,
+  COLUMN_SOCKET = 21,
+  COLUMN_END = 23,
+  COLUMN_SEQUENCE = 34,
+  COLUMN_CDN_PROVIDER = 60,
+  COLUMN_DNS_START = 61,
+  COLUMN_DNS_END = 62,
+  COLUMN_CONNECT_START = 63,
+  COLUMN_CONNECT_END = 64
+};
+
+// columns of the page data (see Results::SavePageData)
+enum PageColumn {
+  PAGE_COLUMN_LOAD_TIME = 4,
+  PAGE_COLUMN_START_RENDER = 18
+};
+
+/*-----------------------------------------------------------------------------
+  What the run files have for one request
+-----------------------------------------------------------------------------*/
+class ReplayRequest {
+public:
+  ReplayRequest(): number_(0), result_(0), socket_(0), start_ms_(0),
+    first_byte_ms_(-1), end_ms_(0), dns_start_ms_(0), dns_end_ms_(0),
+    connect_start_ms_(0), connect_end_ms_(0), bytes_in_(0),
+    http_version_(0), header_bytes_(0), has_headers_(false) {}
+  int         number_;
+  std::string host_;
+  std::string url_;
+  int         result_;
+  unsigned long socket_;
+  // ms from the start of the step
+  int         start_ms_;
+  int         first_byte_ms_;   // -1 if there was no response
+  int         end_ms_;
+  int         dns_start_ms_;
+  int         dns_end_ms_;
+  int         connect_start_ms_;
+  int         connect_end_ms_;
+  size_t      bytes_in_;
+  std::string mime_;
+  std::string content_encoding_;
+  std::string cdn_provider_;
+  // from the response headers
+  double      http_version_;
+  size_t      header_bytes_;
+  bool        has_headers_;
+  std::string connection_;
+  CachePolicy policy_;
+  std::string body_;
+};
+
+/*-----------------------------------------------------------------------------
+  Time and memory used by each stage of the replay
+-----------------------------------------------------------------------------*/
+class ReplayStages {
+public:
+  ReplayStages() { Start(); }
+  void Start() { start_ = Now(); }
+  void Finish(const char * stage) {
+    double now = Now();
+    if (!json_.empty())
+      json_ += ',';
+    char buff[256];
+    snprintf(buff, sizeof(buff), "{\"stage\":\"%s\",\"ms\":%d,"
+             "\"workingSetKB\":%lu,\"peakWorkingSetKB\":%lu}", stage,
+             (int)(now - start_ + 0.5), WorkingSetKB(), PeakWorkingSetKB());
+    json_ += buff;
+    start_ = now;
+  }
+  std::string json_;
+
+private:
+  static double Now() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000.0 + now.tv_nsec / 1000000.0;
+  }
+  static unsigned long WorkingSetKB() {
+    unsigned long size = 0, resident = 0;
+    FILE * file = fopen("/proc/self/statm", "r");
+    if (file) {
+      if (fscanf(file, "%lu %lu", &size, &resident) != 2)
+        resident = 0;
+      fclose(file);
+    }
+    return resident * (unsigned long)sysconf(_SC_PAGESIZE) / 1024;
+  }
+  static unsigned long PeakWorkingSetKB() {
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage))
+      return 0;
+    return (unsigned long)usage.ru_maxrss;
+  }
+  double start_;
+};
+
+static std::string Lower(const std::string& value) {
+  std::string lower(value);
+  for (size_t i = 0; i < lower.length(); i++)
+    lower[i] = (char)tolower((unsigned char)lower[i]);
+  return lower;
+}
+
+static std::string Trim(const std::string& value) {
+  size_t start = value.find_first_not_of(" \t\r\n");
+  if (start == std::string::npos)
+    return std::string();
+  size_t end = value.find_last_not_of(" \t\r\n");
+  return value.substr(start, end - start + 1);
+}
+
+/*-----------------------------------------------------------------------------
+  Whole file (or the .gz version of it), gzread passes plain files through
+-----------------------------------------------------------------------------*/
+static bool ReadTextFile(const std::string& path, std::string& data) {
+  data.clear();
+  gzFile file = gzopen(path.c_str(), "rb");
+  if (!file)
+    file = gzopen((path + ".gz").c_str(), "rb");
+  if (!file)
+    return false;
+  char buff[65536];
+  int len;
+  while ((len = gzread(file, buff, sizeof(buff))) > 0)
+    data.append(buff, len);
+  gzclose(file);
+  return true;
+}
+
+static bool ReadBinaryFile(const std::string& path, std::string& data) {
+  data.clear();
+  FILE * file = fopen(path.c_str(), "rb");
+  if (!file)
+    return false;
+  char buff[65536];
+  size_t len;
+  while ((len = fread(buff, 1, sizeof(buff), file)) > 0)
+    data.append(buff, len);
+  fclose(file);
+  return true;
+}
+
+/*-----------------------------------------------------------------------------
+  Minimal zip reader (stored and deflated entries, no zip64), enough for
+  the bodies zips that the agent writes
+-----------------------------------------------------------------------------*/
+class ZipReader {
+public:
+  bool Open(const std::string& path) {
+    entries_.clear();
+    if (!ReadBinaryFile(path, data_) || data_.length() < 22)
+      return false;
+    // end of central directory record, possibly followed by a comment
+    size_t eocd = data_.length() - 22;
+    while (eocd > 0 && Read32(eocd) != 0x06054b50)
+      eocd--;
+    if (Read32(eocd) != 0x06054b50)
+      return false;
+    size_t count = Read16(eocd + 10);
+    size_t pos = Read32(eocd + 16);
+    for (size_t i = 0; i < count; i++) {
+      if (pos + 46 > data_.length() || Read32(pos) != 0x02014b50)
+        return false;
+      size_t name_len = Read16(pos + 28);
+      size_t extra_len = Read16(pos + 30);
+      size_t comment_len = Read16(pos + 32);
+      if (pos + 46 + name_len > data_.length())
+        return false;
+      entries_[data_.substr(pos + 46, name_len)] = Read32(pos + 42);
+      pos += 46 + name_len + extra_len + comment_len;
+    }
+    return true;
+  }
+
+  bool Get(const std::string& name, std::string& contents) const {
+    contents.clear();
+    std::map<std::string, size_t>::const_iterator entry = entries_.find(name);
+    if (entry == entries_.end())
+      return false;
+    size_t pos = entry->second;
+    if (pos + 30 > data_.length() || Read32(pos) != 0x04034b50)
+      return false;
+    int method = Read16(pos + 8);
+    size_t compressed = Read32(pos + 18);
+    size_t size = Read32(pos + 22);
+    size_t data = pos + 30 + Read16(pos + 26) + Read16(pos + 28);
+    if (Read16(pos + 6) & 0x08) {
+      // sizes are in the data descriptor, use the central directory ones
+      if (!CentralSizes(name, compressed, size))
+        return false;
+    }
+    if (data > data_.length() || compressed > data_.length() - data)
+      return false;
+    if (method == 0) {
+      contents = data_.substr(data, compressed);
+      return true;
+    }
+    if (method != 8)
+      return false;
+    contents.resize(size);
+    z_stream stream;
+    memset(&stream, 0, sizeof(stream));
+    if (inflateInit2(&stream, -MAX_WBITS) != Z_OK)
+      return false;
+    stream.next_in = (Bytef *)(data_.data() + data);
+    stream.avail_in = (uInt)compressed;
+    stream.next_out = (Bytef *)(size ? &contents[0] : NULL);
+    stream.avail_out = (uInt)size;
+    int result = inflate(&stream, Z_FINISH);
+    inflateEnd(&stream);
+    if (result != Z_STREAM_END) {
+      contents.clear();
+      return false;
+    }
+    contents.resize(stream.total_out);
+    return true;
+  }
+
+  const std::map<std::string, size_t>& Entries() const { return entries_; }
+
+private:
+  unsigned Read16(size_t pos) const {
+    const unsigned char * p = (const unsigned char *)data_.data() + pos;
+    return p[0] | (p[1] << 8);
+  }
+  unsigned long Read32(size_t pos) const {
+    const unsigned char * p = (const unsigned char *)data_.data() + pos;
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((unsigned long)p[3] << 24);
+  }
+  bool CentralSizes(const std::string& name, size_t& compressed,
+                    size_t& size) const {
+    size_t eocd = data_.length() - 22;
+    while (eocd > 0 && Read32(eocd) != 0x06054b50)
+      eocd--;
+    size_t count = Read16(eocd + 10);
+    size_t pos = Read32(eocd + 16);
+    for (size_t i = 0; i < count && pos + 46 <= data_.length(); i++) {
+      size_t name_len = Read16(pos + 28);
+      if (!data_.compare(pos + 46, name_len, name)) {
+        compressed = Read32(pos + 20);
+        size = Read32(pos + 24);
+        return true;
+      }
+      pos += 46 + name_len + Read16(pos + 30) + Read16(pos + 32);
+    }
+    return false;
+  }
+
+  std::string data_;
+  std::map<std::string, size_t> entries_;   // name -> local header offset
+};
+
+static void SplitColumns(const std::string& line,
+                         std::vector<std::string>& columns) {
+  columns.clear();
+  size_t start = 0;
+  for (;;) {
+    size_t tab = line.find('\t', start);
+    columns.push_back(Trim(line.substr(start, tab == std::string::npos ?
+                                       std::string::npos : tab - start)));
+    if (tab == std::string::npos)
+      break;
+    start = tab + 1;
+  }
+}
+
+/*-----------------------------------------------------------------------------
+  The request data, one request per line (the header row is skipped)
+-----------------------------------------------------------------------------*/
+static bool LoadRequests(const std::string& base,
+                         std::vector<ReplayRequest>& requests) {
+  std::string data;
+  if (!ReadTextFile(base + "_IEWTR.txt", data))
+    return false;
+  size_t pos = 0;
+  while (pos < data.length()) {
+    size_t end = data.find('\n', pos);
+    if (end == std::string::npos)
+      end = data.length();
+    std::string line = data.substr(pos, end - pos);
+    pos = end + 1;
+    if (line.empty() || !line.compare(0, 5, "Date\t"))
+      continue;
+    std::vector<std::string> columns;
+    SplitColumns(line, columns);
+    if (columns.size() <= COLUMN_SEQUENCE)
+      continue;
+    ReplayRequest request;
+    request.number_ = atoi(columns[COLUMN_SEQUENCE].c_str());
+    request.host_ = Lower(columns[COLUMN_HOST]);
+    request.url_ = Lower(columns[COLUMN_URL]);
+    request.result_ = atoi(columns[COLUMN_RESULT].c_str());
+    request.socket_ = strtoul(columns[COLUMN_SOCKET].c_str(), NULL, 10);
+    request.bytes_in_ = strtoul(columns[COLUMN_BYTES_IN].c_str(), NULL, 10);
+    request.mime_ = Lower(columns[COLUMN_CONTENT_TYPE]);
+    request.content_encoding_ = Lower(columns[COLUMN_CONTENT_ENCODING]);
+    request.start_ms_ = atoi(columns[COLUMN_START].c_str());
+    if (!columns[COLUMN_TTFB].empty())
+      request.first_byte_ms_ = request.start_ms_ +
+                               atoi(columns[COLUMN_TTFB].c_str());
+    request.end_ms_ = atoi(columns[COLUMN_END].c_str());
+    if (columns.size() > COLUMN_CDN_PROVIDER)
+      request.cdn_provider_ = columns[COLUMN_CDN_PROVIDER];
+    if (columns.size() > COLUMN_CONNECT_END) {
+      request.dns_start_ms_ = atoi(columns[COLUMN_DNS_START].c_str());
+      request.dns_end_ms_ = atoi(columns[COLUMN_DNS_END].c_str());
+      request.connect_start_ms_ = atoi(columns[COLUMN_CONNECT_START].c_str());
+      request.connect_end_ms_ = atoi(columns[COLUMN_CONNECT_END].c_str());
+    }
+    requests.push_back(request);
+  }
+  return true;
+}
+
+/*-----------------------------------------------------------------------------
+  Onload and start render (ms) from the page data, 0 if not there
+-----------------------------------------------------------------------------*/
+static void LoadPage(const std::string& base, int& on_load_ms,
+                     int& render_start_ms) {
+  on_load_ms = 0;
+  render_start_ms = 0;
+  std::string data;
+  if (!ReadTextFile(base + "_IEWPG.txt", data))
+    return;
+  size_t pos = 0;
+  while (pos < data.length()) {
+    size_t end = data.find('\n', pos);
+    if (end == std::string::npos)
+      end = data.length();
+    std::string line = data.substr(pos, end - pos);
+    pos = end + 1;
+    if (line.empty() || !line.compare(0, 5, "Date\t"))
+      continue;
+    std::vector<std::string> columns;
+    SplitColumns(line, columns);
+    if (columns.size() > PAGE_COLUMN_START_RENDER) {
+      on_load_ms = atoi(columns[PAGE_COLUMN_LOAD_TIME].c_str());
+      render_start_ms = atoi(columns[PAGE_COLUMN_START_RENDER].c_str());
+      return;
+    }
+  }
+}
+
+/*-----------------------------------------------------------------------------
+  Response headers from the report:
+    Request details:
+    Step name:<name>
+    Request <number>:
+    Request Headers:
+    ...
+    Response Headers:
+    HTTP/1.1 200 OK
+    ...
+-----------------------------------------------------------------------------*/
+static void ApplyResponseHeaders(ReplayRequest& request,
+                                 const std::string& raw) {
+  request.has_headers_ = true;
+  request.header_bytes_ = raw.length() + 4;
+  request.policy_.SetStatus(request.result_);
+  size_t pos = 0;
+  bool first = true;
+  while (pos < raw.length()) {
+    size_t end = raw.find('\n', pos);
+    if (end == std::string::npos)
+      end = raw.length();
+    std::string line = Trim(raw.substr(pos, end - pos));
+    pos = end + 1;
+    if (first) {
+      first = false;
+      if (!line.compare(0, 5, "HTTP/"))
+        request.http_version_ = atof(line.c_str() + 5);
+      continue;
+    }
+    size_t colon = line.find(':');
+    if (colon == std::string::npos || !colon)
+      continue;
+    std::string name = Lower(Trim(line.substr(0, colon)));
+    std::string value = Trim(line.substr(colon + 1));
+    request.policy_.AddHeader(name.c_str(), value.c_str());
+    if (name == "connection") {
+      if (!request.connection_.empty())
+        request.connection_ += ", ";
+      request.connection_ += Lower(value);
+    }
+  }
+}
+
+static void LoadHeaders(const std::string& base,
+                        std::vector<ReplayRequest>& requests) {
+  std::string data;
+  if (!ReadTextFile(base + "_report.txt", data))
+    return;
+  std::map<int, size_t> by_number;
+  for (size_t i = 0; i < requests.size(); i++)
+    by_number[requests[i].number_] = i;
+  static const char request_marker[] = "\nRequest ";
+  static const char response_marker[] = "Response Headers:";
+  static const char details_marker[] = "Request details:";
+  size_t pos = data.find(details_marker);
+  while (pos != std::string::npos) {
+    size_t next = data.find(details_marker, pos + 1);
+    size_t block_end = next == std::string::npos ? data.length() : next;
+    size_t number_pos = data.find(request_marker, pos);
+    size_t response = data.find(response_marker, pos);
+    if (number_pos < block_end && response < block_end) {
+      int number = atoi(data.c_str() + number_pos + strlen(request_marker));
+      std::map<int, size_t>::iterator index = by_number.find(number);
+      if (index != by_number.end()) {
+        size_t start = data.find('\n', response);
+        if (start < block_end) {
+          std::string raw = data.substr(start + 1, block_end - start - 1);
+          ApplyResponseHeaders(requests[index->second], Trim(raw));
+        }
+      }
+    }
+    pos = next;
+  }
+}
+
+/*-----------------------------------------------------------------------------
+  Decoded response bodies, in either layout (see BodyStore)
+-----------------------------------------------------------------------------*/
+static void LoadBodies(const std::string& base,
+                       std::vector<ReplayRequest>& requests) {
+  ZipReader zip;
+  if (!zip.Open(base + "_bodies.zip"))
+    return;
+  std::map<int, size_t> by_number;
+  for (size_t i = 0; i < requests.size(); i++)
+    by_number[requests[i].number_] = i;
+  std::string manifest;
+  if (zip.Get("manifest.txt", manifest)) {
+    std::string dir;
+    size_t slash = base.rfind('/');
+    if (slash != std::string::npos)
+      dir = base.substr(0, slash + 1);
+    std::map<std::string, ZipReader> others;
+    size_t pos = 0;
+    while (pos < manifest.length()) {
+      size_t end = manifest.find('\n', pos);
+      if (end == std::string::npos)
+        end = manifest.length();
+      std::string line = Trim(manifest.substr(pos, end - pos));
+      pos = end + 1;
+      size_t tab1 = line.find('\t');
+      size_t tab2 = tab1 == std::string::npos ? tab1 : line.find('\t', tab1 + 1);
+      if (tab2 == std::string::npos)
+        continue;
+      std::map<int, size_t>::iterator index =
+          by_number.find(atoi(line.c_str()));
+      if (index == by_number.end())
+        continue;
+      std::string name = line.substr(tab1 + 1, tab2 - tab1 - 1) + ".txt";
+      std::string holder = line.substr(tab2 + 1);
+      size_t holder_slash = holder.find_last_of("/\\");
+      if (holder_slash != std::string::npos)
+        holder = holder.substr(holder_slash + 1);
+      std::string& body = requests[index->second].body_;
+      if (!zip.Get(name, body)) {
+        if (others.find(holder) == others.end())
+          others[holder].Open(dir + holder);
+        others[holder].Get(name, body);
+      }
+    }
+  } else {
+    const std::map<std::string, size_t>& entries = zip.Entries();
+    for (std::map<std::string, size_t>::const_iterator entry =
+         entries.begin(); entry != entries.end(); ++entry) {
+      std::map<int, size_t>::iterator index =
+          by_number.find(atoi(entry->first.c_str()));
+      if (index != by_number.end())
+        zip.Get(entry->first, requests[index->second].body_);
+    }
+  }
+}
+
+/*-----------------------------------------------------------------------------
+  Same rules as Request::IsStatic
+-----------------------------------------------------------------------------*/
+static bool IsStatic(const ReplayRequest& request) {
+  const std::string& mime = request.mime_;
+  const CachePolicy& policy = request.policy_;
+  const std::string& url = request.url_;
+  return request.result_ == 304 ||
+    (request.result_ == 200 && !policy.expires_invalid_ &&
+     !policy.no_store_ && !policy.MustValidate() &&
+     mime.find("/html") == std::string::npos &&
+     mime.find("/xhtml") == std::string::npos &&
+     mime.find("/cache-manifest") == std::string::npos &&
+     (mime.find("shockwave-flash") != std::string::npos ||
+      (url.length() >= 4 && !url.compare(url.length() - 4, 4, ".swf")) ||
+      mime.find("text/") != std::string::npos ||
+      mime.find("javascript") != std::string::npos ||
+      mime.find("image/") != std::string::npos));
+}
+
+/*-----------------------------------------------------------------------------
+  The shared code treats a time of 0 as "didn't happen", so the ms from the
+  start of the step are shifted by one (the first action is at 0)
+-----------------------------------------------------------------------------*/
+static long long ReplayTime(int ms) {
+  return ms + 1LL;
+}
+
+static int ReplayMs(long long time) {
+  return time ? (int)(time - 1) : -1;
+}
+
+static void BuildAnalysisRequests(const std::vector<ReplayRequest>& requests,
+                                  std::vector<AnalysisRequest>& analysis) {
+  analysis.clear();
+  analysis.reserve(requests.size());
+  for (size_t i = 0; i < requests.size(); i++) {
+    const ReplayRequest& request = requests[i];
+    AnalysisRequest record;
+    record.host_ = request.host_;
+    record.result_ = request.result_;
+    record.socket_id_ = request.socket_;
+    record.http_version_ = request.http_version_;
+    record.is_static_ = IsStatic(request);
+    record.start_ = ReplayTime(request.start_ms_);
+    if (request.first_byte_ms_ >= 0)
+      record.first_byte_ = ReplayTime(request.first_byte_ms_);
+    record.end_ = ReplayTime(request.end_ms_);
+    if (request.dns_start_ms_ || request.dns_end_ms_) {
+      record.dns_start_ = ReplayTime(request.dns_start_ms_);
+      record.dns_end_ = ReplayTime(request.dns_end_ms_);
+    }
+    if (request.connect_start_ms_ || request.connect_end_ms_) {
+      record.connect_start_ = ReplayTime(request.connect_start_ms_);
+      record.connect_end_ = ReplayTime(request.connect_end_ms_);
+    }
+    record.connection_ = request.connection_;
+    record.content_encoding_ = request.content_encoding_;
+    record.mime_ = request.mime_;
+    record.response_bytes_ = request.bytes_in_;
+    record.header_bytes_ = request.header_bytes_;
+    // the saved bodies are decoded, which is what the gzip check looks at
+    // for the responses that were not compressed
+    if (!request.body_.empty()) {
+      record.body_ = (const unsigned char *)request.body_.data();
+      record.body_len_ = request.body_.length();
+      record.text_ = request.body_.data();
+      record.text_len_ = request.body_.length();
+    }
+    if (request.has_headers_)
+      record.has_expiration_ = request.policy_.ExpiresRemaining(
+          record.expiration_set_, record.seconds_remaining_);
+    record.cdn_provider_ = request.cdn_provider_;
+    analysis.push_back(record);
+  }
+}
+
+/*-----------------------------------------------------------------------------
+  Quality-85 size of a JPEG (the agent falls back to a CxImage re-encode)
+-----------------------------------------------------------------------------*/
+static bool ImageTarget(const unsigned char * image, size_t len,
+                        size_t& target_len, void *) {
+  JpegSavings savings;
+  if (!JpegEstimateSavings(image, len, 85, savings))
+    return false;
+  target_len = savings.target_size_;
+  return true;
+}
+
+/*-----------------------------------------------------------------------------
+  A saved video frame as a bottom-up BGR bitmap, like the agent's DIBs
+-----------------------------------------------------------------------------*/
+class ReplayFrame {
+public:
+  ReplayFrame(): time_ms_(0), width_(0), height_(0) {}
+  AnalysisBitmap Bitmap() const {
+    if (bits_.empty())
+      return AnalysisBitmap();
+    return AnalysisBitmap(&bits_[0], width_, height_, width_ * 3, 3);
+  }
+  std::string file_;
+  unsigned long time_ms_;
+  size_t width_;
+  size_t height_;
+  std::vector<unsigned char> bits_;
+};
+
+static bool LoadFrame(ReplayFrame& frame) {
+  png_image image;
+  memset(&image, 0, sizeof(image));
+  image.version = PNG_IMAGE_VERSION;
+  if (!png_image_begin_read_from_file(&image, frame.file_.c_str()))
+    return false;
+  image.format = PNG_FORMAT_BGR;
+  frame.width_ = image.width;
+  frame.height_ = image.height;
+  frame.bits_.resize(PNG_IMAGE_SIZE(image));
+  // a negative stride stores the rows bottom-up
+  if (frame.bits_.empty() ||
+      !png_image_finish_read(&image, NULL, &frame.bits_[0],
+                             -(png_int_32)PNG_IMAGE_ROW_STRIDE(image),
+                             NULL)) {
+    png_image_free(&image);
+    frame.bits_.clear();
+    return false;
+  }
+  return true;
+}
+
+static bool FrameTime(const ReplayFrame& a, const ReplayFrame& b) {
+  return a.time_ms_ < b.time_ms_;
+}
+
+/*-----------------------------------------------------------------------------
+  The progress_NNNN.png frames in the directory (NNNN is the 100ms interval)
+-----------------------------------------------------------------------------*/
+static void ListFrames(const std::string& dir,
+                       std::vector<ReplayFrame>& frames) {
+  frames.clear();
+  DIR * directory = opendir(dir.c_str());
+  if (!directory)
+    return;
+  struct dirent * entry;
+  while ((entry = readdir(directory)) != NULL) {
+    std::string name = entry->d_name;
+    if (name.length() != 17 || name.compare(0, 9, "progress_") ||
+        name.compare(13, 4, ".png") ||
+        name.find_first_not_of("0123456789", 9) != 13)
+      continue;
+    ReplayFrame frame;
+    frame.file_ = dir + "/" + name;
+    frame.time_ms_ = strtoul(name.c_str() + 9, NULL, 10) * 100;
+    frames.push_back(frame);
+  }
+  closedir(directory);
+  std::sort(frames.begin(), frames.end(), FrameTime);
+}
+
+/*-----------------------------------------------------------------------------
+  Run the frames through the video pipeline, one decoded frame at a time
+  plus the last one.  Frames that are not the size of the first one are
+  skipped (the agent crops or expands them before they get here).
+-----------------------------------------------------------------------------*/
+static void ReplayVideo(const std::string& dir, AnalysisVideo& video,
+                        std::string& histograms) {
+  std::vector<ReplayFrame> frames;
+  ListFrames(dir, frames);
+  ReplayFrame last;
+  for (size_t i = 0; i < frames.size(); i++) {
+    ReplayFrame& frame = frames[i];
+    if (!LoadFrame(frame))
+      continue;
+    if (!last.bits_.empty() &&
+        (frame.width_ != last.width_ || frame.height_ != last.height_)) {
+      frame.bits_.clear();
+      continue;
+    }
+    AnalysisVideoFrame result;
+    video.AddFrame(frame.Bitmap(), last.Bitmap(), frame.time_ms_, result);
+    video.AppendHistogram(result, histograms);
+    last.bits_.swap(frame.bits_);
+    last.width_ = frame.width_;
+    last.height_ = frame.height_;
+    frame.bits_.clear();
+  }
+}
+
+static bool LoadRules(const char * path,
+                      std::vector<AnalysisCustomRule>& rules) {
+  std::string data;
+  if (!ReadTextFile(path, data))
+    return false;
+  size_t pos = 0;
+  while (pos < data.length()) {
+    size_t end = data.find('\n', pos);
+    if (end == std::string::npos)
+      end = data.length();
+    std::string line = data.substr(pos, end - pos);
+    pos = end + 1;
+    if (!line.empty() && line[line.length() - 1] == '\r')
+      line.erase(line.length() - 1);
+    size_t equals = line.find('=');
+    size_t tab = line.find('\t', equals == std::string::npos ? 0 : equals);
+    if (equals == std::string::npos || tab == std::string::npos)
+      continue;
+    AnalysisCustomRule rule;
+    rule.name_ = Trim(line.substr(0, equals));
+    rule.mime_ = line.substr(equals + 1, tab - equals - 1);
+    rule.regex_ = line.substr(tab + 1);
+    if (!rule.name_.empty())
+      rules.push_back(rule);
+  }
+  return true;
+}
+
+static void JsonString(const std::string& value) {
+  putchar('"');
+  for (size_t i = 0; i < value.length(); i++) {
+    unsigned char c = (unsigned char)value[i];
+    if (c == '"' || c == '\\')
+      printf("\\%c", c);
+    else if (c < 0x20)
+      printf("\\u%04x", c);
+    else
+      putchar(c);
+  }
+  putchar('"');
+}
+
+/*-----------------------------------------------------------------------------
+  Replay one run and write its JSON
+-----------------------------------------------------------------------------*/
+static bool Replay(const std::string& base,
+                   const std::vector<AnalysisCustomRule>& rules,
+                   const char * progress_dir) {
+  ReplayStages stages;
+  std::vector<ReplayRequest> requests;
+  if (!LoadRequests(base, requests)) {
+    fprintf(stderr, "Unable to read %s_IEWTR.txt\n", base.c_str());
+    printf("{\"run\":");
+    JsonString(base);
+    printf(",\"error\":\"no request data\"}");
+    return false;
+  }
+  stages.Finish("LoadRequests");
+  int on_load_ms = 0, render_start_ms = 0;
+  LoadPage(base, on_load_ms, render_start_ms);
+  stages.Finish("LoadPage");
+  LoadHeaders(base, requests);
+  stages.Finish("LoadHeaders");
+  LoadBodies(base, requests);
+  stages.Finish("LoadBodies");
+  std::vector<AnalysisRequest> analysis;
+  BuildAnalysisRequests(requests, analysis);
+  stages.Finish("BuildAnalysisRequests");
+  AnalysisRequestSummary summary;
+  AnalysisSummarizeRequests(analysis, on_load_ms ? ReplayTime(on_load_ms) : 0,
+                            summary);
+  bool adult_site = false;
+  if (summary.base_page_ >= 0 && analysis[summary.base_page_].result_ == 200)
+    adult_site = AnalysisIsAdultContent(analysis[summary.base_page_].text_,
+                                        analysis[summary.base_page_].text_len_);
+  stages.Finish("ProcessRequests");
+  int keep_alive = AnalysisCheckKeepAlive(analysis);
+  stages.Finish("CheckKeepAlive");
+  size_t gzip_total = 0, gzip_target = 0;
+  int gzip = AnalysisCheckGzip(analysis, gzip_total, gzip_target);
+  stages.Finish("CheckGzip");
+  size_t image_total = 0, image_target = 0;
+  int image_compression = AnalysisCheckImageCompression(analysis, ImageTarget,
+      NULL, image_total, image_target);
+  stages.Finish("CheckImageCompression");
+  int progressive_jpeg = AnalysisCheckProgressiveJpeg(analysis);
+  stages.Finish("CheckProgressiveJpeg");
+  int cache = AnalysisCheckCache(analysis);
+  stages.Finish("CheckCache");
+  int static_cdn = AnalysisCheckStaticCdn(analysis);
+  stages.Finish("CheckStaticCdn");
+  int combine = AnalysisCheckCombine(analysis, render_start_ms ?
+                                     ReplayTime(render_start_ms) : 0);
+  stages.Finish("CheckCombine");
+  if (!rules.empty()) {
+    AnalysisCheckCustomRules(analysis, rules);
+    stages.Finish("CheckCustomRules");
+  }
+  AnalysisVideo video(RIGHT_MARGIN, BOTTOM_MARGIN);
+  std::string histograms;
+  if (progress_dir) {
+    ReplayVideo(progress_dir, video, histograms);
+    stages.Finish("SaveVideo");
+  }
+
+  printf("{\"run\":");
+  JsonString(base);
+  printf(",\"requests\":%d,\"threads\":%u", (int)requests.size(),
+         AnalysisThreadCount());
+  printf(",\"score_keep-alive\":%d,\"score_gzip\":%d,\"gzip_total\":%lu,"
+         "\"gzip_savings\":%lu,\"score_cache\":%d,\"score_cdn\":%d",
+         keep_alive, gzip, (unsigned long)gzip_total,
+         (unsigned long)(gzip_total - gzip_target), cache, static_cdn);
+  printf(",\"image_savings\":%lu,\"image_total\":%lu,"
+         "\"score_compress\":%d,\"score_progressive_jpeg\":%d,"
+         "\"score_combine\":%d",
+         (unsigned long)(image_total - image_target),
+         (unsigned long)image_total, image_compression, progressive_jpeg,
+         combine);
+  printf(",\"responses_200\":%d,\"responses_200_doc\":%d,"
+         "\"responses_redirect\":%d,\"responses_redirect_doc\":%d,"
+         "\"responses_304\":%d,\"responses_304_doc\":%d,"
+         "\"responses_404\":%d,\"responses_404_doc\":%d,"
+         "\"responses_other\":%d,\"responses_other_doc\":%d,"
+         "\"dns\":%d,\"dns_doc\":%d,\"connections\":%d,"
+         "\"connections_doc\":%d",
+         summary.count_ok_, summary.count_ok_doc_, summary.count_redirect_,
+         summary.count_redirect_doc_, summary.count_not_modified_,
+         summary.count_not_modified_doc_, summary.count_not_found_,
+         summary.count_not_found_doc_, summary.count_other_,
+         summary.count_other_doc_, summary.count_dns_, summary.count_dns_doc_,
+         summary.count_connect_, summary.count_connect_doc_);
+  printf(",\"base_page\":%d,\"base_page_redirects\":%d,"
+         "\"TTFB\":%d,\"lastActivity\":%d,\"adult_site\":%d",
+         summary.base_page_ >= 0 ? requests[summary.base_page_].number_ : -1,
+         summary.base_page_redirects_, ReplayMs(summary.first_byte_),
+         ReplayMs(summary.last_activity_), adult_site ? 1 : 0);
+  if (progress_dir) {
+    printf(",\"video\":{\"frames\":%d,\"histogram_count\":%d,"
+           "\"render\":%d,\"visualComplete\":%d,\"histograms\":[%s]}",
+           (int)video.frame_count_, (int)video.histogram_count_,
+           video.has_render_start_ ? (int)video.render_start_ms_ : -1,
+           (int)video.visually_complete_ms_, histograms.c_str());
+  }
+  if (!rules.empty()) {
+    printf(",\"custom_rules\":{");
+    bool first_request = true;
+    for (size_t i = 0; i < analysis.size(); i++) {
+      const std::vector<AnalysisRuleMatch>& matches =
+          analysis[i].rule_matches_;
+      if (matches.empty())
+        continue;
+      printf("%s\"%d\":{", first_request ? "" : ",", requests[i].number_);
+      first_request = false;
+      for (size_t j = 0; j < matches.size(); j++) {
+        if (j)
+          putchar(',');
+        JsonString(matches[j].name_);
+        printf(":{\"value\":");
+        JsonString(matches[j].value_);
+        printf(",\"count\":%d}", matches[j].count_);
+      }
+      putchar('}');
+    }
+    putchar('}');
+  }
+  printf(",\"stages\":[%s]}", stages.json_.c_str());
+  return true;
+}
+
+int main(int argc, char * argv[]) {
+  std::vector<AnalysisCustomRule> rules;
+  const char * progress_dir = NULL;
+  int arg = 1;
+  while (arg + 1 < argc && argv[arg][0] == '-') {
+    if (!strcmp(argv[arg], "-r")) {
+      if (!LoadRules(argv[arg + 1], rules)) {
+        fprintf(stderr, "Unable to read %s\n", argv[arg + 1]);
+        return 1;
+      }
+    } else if (!strcmp(argv[arg], "-v")) {
+      progress_dir = argv[arg + 1];
+    } else {
+      break;
+    }
+    arg += 2;
+  }
+  if (arg >= argc) {
+    fprintf(stderr, "Usage: %s [-r rules.txt] [-v progress dir] "
+            "<run file base>...\n", argv[0]);
+    return 1;
+  }
+  int failed = 0;
+  printf("[");
+  for (int i = arg; i < argc; i++) {
+    if (i > arg)
+      printf(",\n");
+    if (!Replay(argv[i], rules, progress_dir))
+      failed++;
+  }
+  printf("]\n");
+  return failed ? 1 : 0;
+}
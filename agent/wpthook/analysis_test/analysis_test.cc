@@ -0,0 +1,597 @@
+/******************************************************************************
+Copyright (c) 2013, Google Inc.
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without 
+modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice, 
+      this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+    * Neither the name of the <ORGANIZATION> nor the names of its contributors 
+    may be used to endorse or promote products derived from this software 
+    without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE 
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE 
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL 
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR 
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER 
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, 
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE 
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+******************************************************************************/
+
+// Unit tests for the portable analysis code (analysis.cc) shared by wpthook
+// and pagetest.
+//
+//   make test
+#include "../analysis.h"
+#include <stdio.h>
+#include <string.h>
+
+static int failures = 0;
+static int checks = 0;
+
+#define CHECK(condition) \
+  do { \
+    checks++; \
+    if (!(condition)) { \
+      failures++; \
+      printf("%s:%d: %s: CHECK(%s) failed\n", __FILE__, __LINE__, \
+             current_test, #condition); \
+    } \
+  } while (0)
+
+static const char * current_test = "";
+
+/*-----------------------------------------------------------------------------
+  Minimal JPEG stream: SOI, one quantization table, |scans| scans, EOI
+-----------------------------------------------------------------------------*/
+static std::string MakeJpeg(int scans, const unsigned short table[64]) {
+  std::string jpeg("\xFF\xD8", 2);
+  jpeg.append("\xFF\xDB\x00\x43\x00", 5);
+  for (int i = 0; i < 64; i++)
+    jpeg += (char)table[jpeg_zigzag_to_natural[i]];
+  for (int i = 0; i < scans; i++) {
+    jpeg.append("\xFF\xDA\x00\x08\x01\x01\x00\x00\x3F\x00", 10);
+    jpeg.append("\x12\x34\xFF\x00\x56", 5);   // entropy data, FF escaped
+  }
+  jpeg.append("\xFF\xD9", 2);
+  return jpeg;
+}
+
+static const unsigned char * Bytes(const std::string& data) {
+  return (const unsigned char *)data.data();
+}
+
+/*-----------------------------------------------------------------------------
+-----------------------------------------------------------------------------*/
+static void TestJpeg() {
+  current_test = "jpeg scans";
+  unsigned short table[64];
+  JpegScaledQuantTable(75, false, table);
+  std::string baseline = MakeJpeg(1, table);
+  std::string progressive = MakeJpeg(3, table);
+  CHECK(JpegIsJpeg(Bytes(baseline), baseline.size()));
+  CHECK(!JpegIsJpeg((const unsigned char *)"GIF89a", 6));
+  CHECK(JpegCountScans(Bytes(baseline), baseline.size()) == 1);
+  CHECK(JpegCountScans(Bytes(progressive), progressive.size()) == 3);
+  // truncated in the middle of a marker
+  CHECK(JpegCountScans(Bytes(baseline), 8) == 0);
+
+  current_test = "jpeg quality";
+  unsigned short found[64];
+  CHECK(JpegGetQuantTable(Bytes(baseline), baseline.size(), 0, found));
+  CHECK(!memcmp(found, table, sizeof(table)));
+  CHECK(!JpegGetQuantTable(Bytes(baseline), baseline.size(), 1, found));
+  CHECK(JpegEstimateQuality(Bytes(baseline), baseline.size()) == 75);
+  JpegScaledQuantTable(100, false, table);
+  CHECK(table[0] == 1);
+  JpegScaledQuantTable(50, true, table);
+  CHECK(table[0] == 17);
+}
+
+/*-----------------------------------------------------------------------------
+-----------------------------------------------------------------------------*/
+static void TestBitmaps() {
+  current_test = "bitmaps";
+  const size_t width = 4, height = 3, stride = 12;
+  unsigned char white[stride * height];
+  unsigned char changed[stride * height];
+  memset(white, 255, sizeof(white));
+  memset(changed, 255, sizeof(changed));
+  AnalysisBitmap img1(white, width, height, stride, 3);
+  AnalysisBitmap img2(changed, width, height, stride, 3);
+  CHECK(!BitmapsDiffer(img1, img2, 0, 0));
+  // bottom-right pixel, inside the margins
+  changed[3 * 3] = 0;
+  CHECK(!BitmapsDiffer(img1, img2, 1, 1));
+  CHECK(BitmapsDiffer(img1, img2, 0, 0));
+  CHECK(BitmapsDiffer(img1, AnalysisBitmap(), 0, 0));
+
+  ColorHistogram histogram;
+  CHECK(BitmapHistogram(img2, 0, 0, histogram));
+  CHECK(histogram.b_[0] == 1);
+  CHECK(histogram.g_[255] == 1);
+  CHECK(histogram.r_[255] == 1);
+  CHECK(BitmapHistogram(img2, 1, 1, histogram));
+  CHECK(histogram.b_[0] == 0);
+  std::string json;
+  HistogramJSON(histogram, json);
+  CHECK(json.compare(0, 9, "{\"r\":[0,0") == 0);
+  CHECK(json[json.size() - 1] == '}');
+}
+
+/*-----------------------------------------------------------------------------
+-----------------------------------------------------------------------------*/
+static void TestVideo() {
+  current_test = "video";
+  const size_t width = 4, height = 3, stride = 12;
+  unsigned char white[stride * height];
+  unsigned char changed[stride * height];
+  memset(white, 255, sizeof(white));
+  memset(changed, 255, sizeof(changed));
+  changed[stride * 2] = 0;
+  AnalysisBitmap img1(white, width, height, stride, 3);
+  AnalysisBitmap img2(changed, width, height, stride, 3);
+  AnalysisVideo video(1, 1);
+  AnalysisVideoFrame frame;
+  std::string json;
+
+  // the first frame is always kept at time zero
+  CHECK(video.AddFrame(img1, AnalysisBitmap(), 120, frame));
+  CHECK(frame.time_ms_ == 0 && frame.interval_ == 0);
+  CHECK(!frame.histogram_.empty());
+  video.AppendHistogram(frame, json);
+  CHECK(!video.AddFrame(img1, img1, 340, frame));
+  CHECK(frame.histogram_.empty());
+  video.AppendHistogram(frame, json);
+  CHECK(!video.has_render_start_);
+  CHECK(video.AddFrame(img2, img1, 1260, frame));
+  CHECK(frame.time_ms_ == 1260 && frame.interval_ == 13);
+  video.AppendHistogram(frame, json);
+  CHECK(video.AddFrame(img1, img2, 2049, frame));
+  CHECK(frame.interval_ == 20);
+  CHECK(video.has_render_start_ && video.render_start_ms_ == 1260);
+  CHECK(video.visually_complete_ms_ == 2049);
+  CHECK(video.frame_count_ == 4);
+  CHECK(video.histogram_count_ == 2);
+  CHECK(json.compare(0, 14, "{\"histogram\": ") == 0);
+  CHECK(json.find("\"time\": 0}, {\"histogram\": ") != std::string::npos);
+  CHECK(json.rfind(", \"time\": 1260}") == json.size() - 15);
+  video.Reset();
+  CHECK(video.AddFrame(img2, img1, 500, frame) && frame.time_ms_ == 0);
+}
+
+/*-----------------------------------------------------------------------------
+-----------------------------------------------------------------------------*/
+static AnalysisRequest Request(const char * host, unsigned long socket_id,
+                               const char * connection) {
+  AnalysisRequest request;
+  request.host_ = host;
+  request.result_ = 200;
+  request.socket_id_ = socket_id;
+  request.http_version_ = 1.1;
+  request.connection_ = connection;
+  return request;
+}
+
+static void TestKeepAlive() {
+  current_test = "keep-alive";
+  std::vector<AnalysisRequest> requests;
+  requests.push_back(Request("www.example.com", 1, "keep-alive"));
+  requests.push_back(Request("www.example.com", 1, ""));
+  requests.push_back(Request("cdn.example.com", 2, "close"));
+  requests.push_back(Request("cdn.example.com", 3, "close"));
+  requests.push_back(Request("img.example.com", 4, ""));
+  requests.push_back(Request("img.example.com", 5, ""));
+  requests.push_back(Request("once.example.com", 6, ""));
+  requests[5].http_version_ = 1.0;
+  CHECK(AnalysisCheckKeepAlive(requests) == 50);
+  CHECK(requests[0].keep_alive_score_ == 100);
+  CHECK(requests[1].keep_alive_score_ == 100);    // reused
+  CHECK(requests[2].keep_alive_score_ == 0);
+  CHECK(requests[4].keep_alive_score_ == 100);    // HTTP/1.1 default
+  CHECK(requests[5].keep_alive_score_ == 0);      // HTTP/1.0
+  CHECK(requests[6].keep_alive_score_ == -1);     // nothing else to reuse
+
+  current_test = "keep-alive skips requests that aren't scored";
+  std::vector<AnalysisRequest> none;
+  none.push_back(Request("www.example.com", 1, "close"));
+  none.push_back(Request("www.example.com", 2, "close"));
+  none[0].result_ = 304;
+  none[1].from_network_ = false;
+  CHECK(AnalysisCheckKeepAlive(none) == -1);
+  CHECK(none[0].keep_alive_score_ == -1);
+}
+
+/*-----------------------------------------------------------------------------
+-----------------------------------------------------------------------------*/
+static AnalysisRequest Response(const std::string& body,
+                                const char * encoding) {
+  AnalysisRequest request = Request("www.example.com", 1, "");
+  request.content_encoding_ = encoding;
+  request.header_bytes_ = 200;
+  request.response_bytes_ = request.header_bytes_ + body.size();
+  request.body_ = Bytes(body);
+  request.body_len_ = body.size();
+  return request;
+}
+
+static void TestGzip() {
+  current_test = "gzip";
+  std::string text;
+  while (text.size() < 50000)
+    text += "<div class=\"item\">Some repetitive markup for the page</div>\n";
+  std::string random;
+  unsigned int seed = 12345;
+  while (random.size() < 50000) {
+    seed = seed * 1103515245 + 12345;
+    random += (char)(seed >> 16);
+  }
+  std::string small(1000, 'a');
+  std::string jpeg("\xFF\xD8\xFF\xE0", 4);
+  jpeg.append(20000, 'x');
+
+  std::vector<AnalysisRequest> requests;
+  requests.push_back(Response(text, ""));
+  requests.push_back(Response(text, "gzip"));
+  requests.push_back(Response(random, ""));
+  requests.push_back(Response(small, ""));
+  requests.push_back(Response(jpeg, ""));
+  size_t total = 0, target = 0;
+  int score = AnalysisCheckGzip(requests, total, target);
+  CHECK(requests[0].gzip_score_ == 0);
+  CHECK(requests[0].gzip_total_ == requests[0].response_bytes_);
+  CHECK(requests[0].gzip_target_ > requests[0].header_bytes_);
+  CHECK(requests[0].gzip_target_ < requests[0].response_bytes_ / 10);
+  CHECK(requests[1].gzip_score_ == 100);
+  CHECK(requests[1].gzip_target_ == requests[1].response_bytes_);
+  CHECK(requests[2].gzip_score_ == -1);   // incompressible
+  CHECK(requests[3].gzip_score_ == -1);   // smaller than a packet
+  CHECK(requests[4].gzip_score_ == -1);   // already a compressed image
+  CHECK(total == requests[0].response_bytes_ + requests[1].response_bytes_);
+  CHECK(target == requests[0].gzip_target_ + requests[1].gzip_target_);
+  CHECK(score == (int)(target * 100 / total));
+  CHECK(score >= 50 && score < 55);
+
+  current_test = "gzip with nothing to check";
+  std::vector<AnalysisRequest> empty;
+  CHECK(AnalysisCheckGzip(empty, total, target) == -1);
+  CHECK(total == 0 && target == 0);
+
+  current_test = "content-encoding tokens";
+  CHECK(AnalysisIsCompressedEncoding("br", 2));
+  CHECK(AnalysisIsCompressedEncoding("GZIP", 4));
+  CHECK(AnalysisIsCompressedEncoding("identity, zstd", 14));
+  CHECK(!AnalysisIsCompressedEncoding("", 0));
+  CHECK(!AnalysisIsCompressedEncoding("identity", 8));
+  CHECK(!AnalysisIsCompressedEncoding("brotli-ish", 10));
+  CHECK(!AnalysisIsCompressedEncoding("x-br", 4));
+  std::vector<AnalysisRequest> coded;
+  coded.push_back(Response(text, "x-brand"));
+  coded.push_back(Response(text, "br"));
+  AnalysisCheckGzip(coded, total, target);
+  CHECK(coded[0].gzip_score_ == 0);
+  CHECK(coded[1].gzip_score_ == 100);
+}
+
+/*-----------------------------------------------------------------------------
+-----------------------------------------------------------------------------*/
+static AnalysisRequest Cached(bool set, int seconds, const char * mime) {
+  AnalysisRequest request = Request("www.example.com", 1, "");
+  request.has_expiration_ = true;
+  request.expiration_set_ = set;
+  request.seconds_remaining_ = seconds;
+  request.mime_ = mime;
+  return request;
+}
+
+static void TestCache() {
+  current_test = "cache";
+  std::vector<AnalysisRequest> requests;
+  requests.push_back(Cached(true, 30 * 86400, "image/png"));
+  requests.push_back(Cached(true, 7200, "text/css"));
+  requests.push_back(Cached(true, 60, "text/css"));
+  requests.push_back(Cached(false, 0, "text/javascript"));
+  requests.push_back(Cached(true, 0, "text/cache-manifest"));
+  requests.push_back(Cached(true, 30 * 86400, "image/png"));
+  requests[5].has_expiration_ = false;    // explicitly not cacheable
+  CHECK(AnalysisCheckCache(requests) == 37);
+  CHECK(requests[0].cache_score_ == 100);
+  CHECK(requests[0].cache_time_secs_ == 30 * 86400);
+  CHECK(requests[1].cache_score_ == 50);
+  CHECK(requests[2].cache_score_ == 0);
+  CHECK(requests[3].cache_score_ == 0);
+  CHECK(requests[4].cache_score_ == -1);
+  CHECK(requests[5].cache_score_ == -1);
+  CHECK(requests[5].cache_time_secs_ == -1);
+}
+
+/*-----------------------------------------------------------------------------
+-----------------------------------------------------------------------------*/
+static void TestStaticCdn() {
+  current_test = "static cdn";
+  std::vector<AnalysisRequest> requests;
+  requests.push_back(Request("a.example.com", 1, ""));
+  requests.push_back(Request("b.example.com", 2, ""));
+  requests.push_back(Request("c.example.com", 3, ""));
+  requests[0].is_static_ = true;
+  requests[0].cdn_provider_ = "Akamai";
+  requests[1].is_static_ = true;
+  requests[2].cdn_provider_ = "Akamai";   // not static, not scored
+  CHECK(AnalysisCheckStaticCdn(requests) == 50);
+  CHECK(requests[0].static_cdn_score_ == 100);
+  CHECK(requests[1].static_cdn_score_ == 0);
+  CHECK(requests[2].static_cdn_score_ == -1);
+}
+
+/*-----------------------------------------------------------------------------
+-----------------------------------------------------------------------------*/
+static void TestCustomRules() {
+  current_test = "custom rules";
+  std::string html = "<p>Foo1 and foo22 and FOO3</p>";
+  std::string css = "body {color: red}";
+  std::vector<AnalysisRequest> requests;
+  requests.push_back(Request("www.example.com", 1, ""));
+  requests.push_back(Request("www.example.com", 1, ""));
+  requests.push_back(Request("www.example.com", 1, ""));
+  requests[0].mime_ = "text/html";
+  requests[0].text_ = html.c_str();
+  requests[0].text_len_ = html.size();
+  requests[1].mime_ = "text/css";
+  requests[1].text_ = css.c_str();
+  requests[1].text_len_ = css.size();
+  requests[2].mime_ = "text/html";   // no body
+
+  std::vector<AnalysisCustomRule> rules;
+  AnalysisCustomRule rule;
+  rule.name_ = "foo";
+  rule.mime_ = "HTML";
+  rule.regex_ = "foo[0-9]+";
+  rules.push_back(rule);
+  rule.name_ = "broken";
+  rule.regex_ = "([";
+  rules.push_back(rule);
+  rule.name_ = "red";
+  rule.mime_ = "css";
+  rule.regex_ = "red";
+  rules.push_back(rule);
+  AnalysisCheckCustomRules(requests, rules);
+  CHECK(requests[0].rule_matches_.size() == 1);
+  if (requests[0].rule_matches_.size() == 1) {
+    CHECK(requests[0].rule_matches_[0].name_ == "foo");
+    CHECK(requests[0].rule_matches_[0].count_ == 3);
+    CHECK(requests[0].rule_matches_[0].value_ == "Foo1");
+  }
+  CHECK(requests[1].rule_matches_.size() == 1);
+  if (requests[1].rule_matches_.size() == 1)
+    CHECK(requests[1].rule_matches_[0].count_ == 1);
+  CHECK(requests[2].rule_matches_.empty());
+
+  current_test = "custom rule without a match";
+  rules.clear();
+  rule.name_ = "missing";
+  rule.mime_ = "html";
+  rule.regex_ = "bar";
+  rules.push_back(rule);
+  requests[0].rule_matches_.clear();
+  AnalysisCheckCustomRules(requests, rules);
+  CHECK(requests[0].rule_matches_.size() == 1);
+  if (requests[0].rule_matches_.size() == 1) {
+    CHECK(requests[0].rule_matches_[0].count_ == 0);
+    CHECK(requests[0].rule_matches_[0].value_.empty());
+  }
+}
+
+/*-----------------------------------------------------------------------------
+  Image target for the tests: JPEGs can be half their size
+-----------------------------------------------------------------------------*/
+static bool HalfSize(const unsigned char *, size_t len,
+                     size_t& target_len, void * context) {
+  int * calls = (int *)context;
+  (*calls)++;
+  if (len > 1000)
+    return false;
+  target_len = len / 2;
+  return true;
+}
+
+static AnalysisRequest Image(const std::string& body, const char * mime) {
+  AnalysisRequest request;
+  request.result_ = 200;
+  request.mime_ = mime;
+  request.body_ = Bytes(body);
+  request.body_len_ = body.size();
+  return request;
+}
+
+/*-----------------------------------------------------------------------------
+-----------------------------------------------------------------------------*/
+static void TestImages() {
+  current_test = "images";
+  unsigned short table[64];
+  JpegScaledQuantTable(75, false, table);
+  std::string small = MakeJpeg(1, table);
+  std::string baseline = MakeJpeg(1, table);
+  std::string progressive = MakeJpeg(3, table);
+  while (baseline.size() < 20000)
+    baseline.insert(baseline.size() - 2, "\x12\x34", 2);
+  while (progressive.size() < 60000)
+    progressive.insert(progressive.size() - 2, "\x12\x34", 2);
+  std::string png("\x89PNG\r\n\x1a\n", 8);
+  std::vector<AnalysisRequest> requests;
+  requests.push_back(Image(small, "image/jpeg"));
+  requests.push_back(Image(baseline, "image/jpeg"));
+  requests.push_back(Image(progressive, "image/jpeg"));
+  requests.push_back(Image(png, "image/png"));
+  requests.push_back(Image(small, "text/plain"));
+
+  int calls = 0;
+  size_t total = 0, target = 0;
+  int score = AnalysisCheckImageCompression(requests, HalfSize, &calls,
+                                            total, target);
+  CHECK(calls == 3);
+  CHECK(total == small.size() && target == small.size() / 2);
+  CHECK(score == (int)(target * 100 / total));
+  CHECK(requests[0].image_compression_score_ == score);
+  CHECK(requests[0].image_compress_total_ == small.size());
+  CHECK(requests[1].image_compression_score_ == -1);
+  CHECK(requests[3].image_compression_score_ == -1);
+  CHECK(requests[4].image_compression_score_ == -1);
+  std::vector<AnalysisRequest> none;
+  CHECK(AnalysisCheckImageCompression(none, HalfSize, &calls,
+                                      total, target) == -1);
+
+  // only the JPEGs over 10KB count towards the progressive score
+  score = AnalysisCheckProgressiveJpeg(requests);
+  CHECK(requests[0].jpeg_scans_ == 1);
+  CHECK(requests[1].jpeg_scans_ == 1);
+  CHECK(requests[2].jpeg_scans_ == 3);
+  CHECK(requests[3].jpeg_scans_ == 0);
+  CHECK(requests[4].jpeg_scans_ == 0);
+  CHECK(score == (int)(progressive.size() * 100.0 /
+                       (progressive.size() + baseline.size()) + 0.5));
+  requests.pop_back();
+  requests.erase(requests.begin() + 1, requests.end());
+  CHECK(AnalysisCheckProgressiveJpeg(requests) == -1);
+}
+
+static AnalysisRequest Script(const char * mime, long long start) {
+  AnalysisRequest request;
+  request.result_ = 200;
+  request.is_static_ = true;
+  request.mime_ = mime;
+  request.start_ = start;
+  return request;
+}
+
+/*-----------------------------------------------------------------------------
+-----------------------------------------------------------------------------*/
+static void TestCombine() {
+  current_test = "combine";
+  std::vector<AnalysisRequest> requests;
+  requests.push_back(Script("text/css", 10));
+  requests.push_back(Script("application/javascript", 20));
+  requests.push_back(Script("application/javascript", 30));
+  requests.push_back(Script("application/javascript", 40));
+  requests.push_back(Script("image/png", 40));
+  // after start render
+  requests.push_back(Script("text/css", 200));
+  CHECK(AnalysisCheckCombine(requests, 100) == 70);
+  CHECK(requests[0].combine_score_ == 100);
+  CHECK(requests[1].combine_score_ == 0);
+  CHECK(requests[3].combine_score_ == 0);
+  CHECK(requests[4].combine_score_ == -1);
+  CHECK(requests[5].combine_score_ == -1);
+  requests[5].start_ = 50;
+  CHECK(AnalysisCheckCombine(requests, 100) == 60);
+  CHECK(requests[0].combine_score_ == 0);
+  // no start render, nothing applies
+  std::vector<AnalysisRequest> later;
+  later.push_back(Script("text/css", 10));
+  CHECK(AnalysisCheckCombine(later, 0) == 100);
+  CHECK(later[0].combine_score_ == -1);
+}
+
+static AnalysisRequest Timed(int result, long long start, long long end) {
+  AnalysisRequest request;
+  request.result_ = result;
+  request.start_ = start;
+  request.first_byte_ = start + 5;
+  request.end_ = end;
+  return request;
+}
+
+/*-----------------------------------------------------------------------------
+-----------------------------------------------------------------------------*/
+static void TestSummary() {
+  current_test = "summary";
+  std::vector<AnalysisRequest> requests;
+  requests.push_back(Timed(301, 100, 110));
+  requests[0].dns_start_ = 90;
+  requests[0].dns_end_ = 95;
+  requests[0].connect_start_ = 95;
+  requests[0].connect_end_ = 99;
+  requests.push_back(Timed(401, 120, 130));
+  requests.push_back(Timed(200, 140, 190));
+  requests.push_back(Timed(304, 150, 160));
+  requests.push_back(Timed(404, 170, 400));
+  requests.push_back(Timed(500, 300, 310));
+  requests.push_back(Timed(302, 320, 330));
+  requests[6].connect_start_ = 315;
+  requests[6].connect_end_ = 450;
+  AnalysisRequestSummary summary;
+  AnalysisSummarizeRequests(requests, 200, summary);
+  CHECK(summary.base_page_ == 2);
+  CHECK(summary.base_page_redirects_ == 2);
+  CHECK(summary.count_ok_ == 1 && summary.count_ok_doc_ == 1);
+  CHECK(summary.count_redirect_ == 2 && summary.count_redirect_doc_ == 1);
+  CHECK(summary.count_not_modified_ == 1);
+  CHECK(summary.count_not_found_ == 1 && summary.count_not_found_doc_ == 1);
+  CHECK(summary.count_other_ == 2 && summary.count_other_doc_ == 1);
+  CHECK(summary.count_dns_ == 1 && summary.count_dns_doc_ == 1);
+  CHECK(summary.count_connect_ == 2 && summary.count_connect_doc_ == 1);
+  CHECK(summary.last_activity_ == 450);
+  CHECK(summary.first_byte_ == 145);
+  requests.resize(2);
+  AnalysisSummarizeRequests(requests, 0, summary);
+  CHECK(summary.base_page_ == -1 && summary.first_byte_ == 0);
+  CHECK(summary.count_ok_doc_ == 0 && summary.count_redirect_doc_ == 0);
+
+  std::string page = "<p>18 U.S.C. 2257 Record-Keeping</p>";
+  CHECK(AnalysisIsAdultContent(page.data(), page.size()));
+  page = "<meta name=\"rating\" content=\"RTA-5042-1996-1400-1577-RTA\">";
+  CHECK(AnalysisIsAdultContent(page.data(), page.size()));
+  page = "<p>Call 555-22578 or 2257x</p>";
+  CHECK(!AnalysisIsAdultContent(page.data(), page.size()));
+  CHECK(!AnalysisIsAdultContent(NULL, 0));
+}
+
+/*-----------------------------------------------------------------------------
+-----------------------------------------------------------------------------*/
+static void Double(size_t index, void * context) {
+  size_t * values = (size_t *)context;
+  values[index] = index * 2;
+}
+
+static void TestParallel() {
+  current_test = "parallel";
+  CHECK(AnalysisThreadCount() >= 1 && AnalysisThreadCount() <= 4);
+  const size_t count = 10000;
+  std::vector<size_t> values(count, 0);
+  AnalysisParallelFor(count, Double, &values[0]);
+  bool all = true;
+  for (size_t i = 0; i < count; i++)
+    if (values[i] != i * 2)
+      all = false;
+  CHECK(all);
+  size_t one = 7;
+  AnalysisParallelFor(1, Double, &one);
+  CHECK(one == 0);
+  AnalysisParallelFor(0, Double, NULL);
+}
+
+/*-----------------------------------------------------------------------------
+-----------------------------------------------------------------------------*/
+int main() {
+  TestJpeg();
+  TestBitmaps();
+  TestVideo();
+  TestKeepAlive();
+  TestGzip();
+  TestCache();
+  TestStaticCdn();
+  TestCustomRules();
+  TestImages();
+  TestCombine();
+  TestSummary();
+  TestParallel();
+  printf("%d checks, %d failed\n", checks, failures);
+  return failures ? 1 : 0;
+}
@@ -0,0 +1,177 @@
+/******************************************************************************
+Copyright (c) 2013, Google Inc.
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without 
+modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice, 
+      this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+    * Neither the name of the <ORGANIZATION> nor the names of its contributors 
+    may be used to endorse or promote products derived from this software 
+    without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE 
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE 
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL 
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR 
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER 
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, 
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE 
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+******************************************************************************/
+
+#include "StdAfx.h"
+#include "arrival_timeline.h"
+
+/*-----------------------------------------------------------------------------
+-----------------------------------------------------------------------------*/
+ArrivalTimeline::ArrivalTimeline(void) {
+  LARGE_INTEGER frequency;
+  QueryPerformanceFrequency(&frequency);
+  initial_width_ = max(frequency.QuadPart / 1000, 1);  // 1ms buckets
+  Reset();
+}
+
+/*-----------------------------------------------------------------------------
+-----------------------------------------------------------------------------*/
+ArrivalTimeline::~ArrivalTimeline(void) {
+}
+
+/*-----------------------------------------------------------------------------
+-----------------------------------------------------------------------------*/
+void ArrivalTimeline::Reset(void) {
+  buckets_.RemoveAll();
+  bucket_width_ = initial_width_;
+  first_ = 0;
+  last_ = 0;
+  max_stall_ = 0;
+  total_bytes_ = 0;
+}
+
+/*-----------------------------------------------------------------------------
+-----------------------------------------------------------------------------*/
+void ArrivalTimeline::AddBytes(LONGLONG when, DWORD bytes) {
+  if (!bytes)
+    return;
+  if (!total_bytes_) {
+    first_ = when;
+    last_ = when;
+  }
+  if (when < first_)
+    when = first_;
+  if (when > last_) {
+    max_stall_ = max(max_stall_, when - last_);
+    last_ = when;
+  }
+  total_bytes_ += bytes;
+
+  // widen the buckets until the arrival fits
+  size_t index = (size_t)((when - first_) / bucket_width_);
+  while (index >= MAX_BUCKETS) {
+    size_t count = buckets_.GetCount();
+    for (size_t i = 0; i < count; i += 2) {
+      DWORD merged = buckets_[i];
+      if (i + 1 < count)
+        merged += buckets_[i + 1];
+      buckets_[i / 2] = merged;
+    }
+    buckets_.SetCount((count + 1) / 2);
+    bucket_width_ *= 2;
+    index = (size_t)((when - first_) / bucket_width_);
+  }
+  if (index >= buckets_.GetCount()) {
+    size_t count = buckets_.GetCount();
+    buckets_.SetCount(index + 1);
+    for (size_t i = count; i <= index; i++)
+      buckets_[i] = 0;
+  }
+  buckets_[index] += bytes;
+}
+
+/*-----------------------------------------------------------------------------
+  Effective throughput in bytes/sec from the first to the last arrival
+  (frequency is the performance counter frequency)
+-----------------------------------------------------------------------------*/
+double ArrivalTimeline::Throughput(LONGLONG frequency) const {
+  double throughput = 0;
+  if (last_ > first_ && frequency > 0)
+    throughput = (double)total_bytes_ /
+                 ((double)(last_ - first_) / (double)frequency);
+  return throughput;
+}
+
+/*-----------------------------------------------------------------------------
+  Ticks from the first arrival until the given percentage of the bytes had
+  arrived (to the end of the bucket that crossed it)
+-----------------------------------------------------------------------------*/
+LONGLONG ArrivalTimeline::TimeToPercent(int percent) const {
+  LONGLONG elapsed = 0;
+  if (total_bytes_ && percent >= 100) {
+    elapsed = last_ - first_;
+  } else if (total_bytes_ && percent > 0) {
+    LONGLONG target = (total_bytes_ * percent + 99) / 100;
+    LONGLONG bytes = 0;
+    size_t count = buckets_.GetCount();
+    for (size_t i = 0; i < count; i++) {
+      bytes += buckets_[i];
+      if (bytes >= target) {
+        elapsed = min((LONGLONG)(i + 1) * bucket_width_, last_ - first_);
+        break;
+      }
+    }
+  }
+  return elapsed;
+}
+
+/*-----------------------------------------------------------------------------
+  Compact delta-encoded timeline for the request records:
+  "ms:bytes,ms:bytes,..." where the first offset is from the start time and
+  each following offset is from the previous non-empty bucket.
+-----------------------------------------------------------------------------*/
+CStringA ArrivalTimeline::GetTimeline(LONGLONG start,
+                                      LONGLONG ms_frequency) const {
+  CStringA timeline, entry;
+  if (total_bytes_ && ms_frequency > 0) {
+    LONGLONG previous = start;
+    size_t count = buckets_.GetCount();
+    for (size_t i = 0; i < count; i++) {
+      LONGLONG bucket_start = first_ + (LONGLONG)i * bucket_width_;
+      if (buckets_[i] && bucket_start >= start) {
+        entry.Format("%s%d:%u", timeline.IsEmpty() ? "" : ",",
+                     (int)((bucket_start - previous) / ms_frequency),
+                     buckets_[i]);
+        timeline += entry;
+        // keep the deltas in whole ms so they sum without drift
+        previous += ((bucket_start - previous) / ms_frequency) * ms_frequency;
+      }
+    }
+  }
+  return timeline;
+}
+
+/*-----------------------------------------------------------------------------
+  Timeline and the derived metrics as a JSON object
+-----------------------------------------------------------------------------*/
+CStringA ArrivalTimeline::GetJSON(LONGLONG start, LONGLONG ms_frequency) const {
+  CStringA json;
+  if (total_bytes_ && ms_frequency > 0) {
+    double ms = (double)ms_frequency;
+    json.Format("{\"bytes\":%I64d,\"bucket_ms\":%0.3f,\"max_stall_ms\":%0.3f,"
+                "\"throughput\":%0.0f,\"time_to_50_ms\":%0.3f,"
+                "\"time_to_90_ms\":%0.3f,\"time_to_100_ms\":%0.3f,"
+                "\"timeline\":\"",
+                total_bytes_, (double)bucket_width_ / ms,
+                (double)max_stall_ / ms, Throughput(ms_frequency * 1000),
+                (double)TimeToPercent(50) / ms, (double)TimeToPercent(90) / ms,
+                (double)TimeToPercent(100) / ms);
+    json += GetTimeline(start, ms_frequency);
+    json += "\"}";
+  }
+  return json;
+}
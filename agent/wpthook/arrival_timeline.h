@@ -0,0 +1,70 @@
+/******************************************************************************
+Copyright (c) 2013, Google Inc.
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without 
+modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice, 
+      this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+    * Neither the name of the <ORGANIZATION> nor the names of its contributors 
+    may be used to endorse or promote products derived from this software 
+    without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE 
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE 
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL 
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR 
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER 
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, 
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE 
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+******************************************************************************/
+
+#pragma once
+
+/*-----------------------------------------------------------------------------
+  Time series of when the bytes for a request (or socket) arrived.
+  Arrivals are coalesced into fixed-width buckets so the memory stays
+  bounded no matter how many chunks come in: when the time span outgrows
+  the bucket array the bucket width is doubled and neighbouring buckets
+  are merged.  The gaps between individual arrivals are tracked exactly
+  so a stall is never hidden by the coalescing.
+
+  Not thread safe, callers hold their own locks.
+-----------------------------------------------------------------------------*/
+class ArrivalTimeline {
+public:
+  ArrivalTimeline(void);
+  ~ArrivalTimeline(void);
+
+  void Reset(void);
+  void AddBytes(LONGLONG when, DWORD bytes);
+
+  bool IsEmpty(void) const { return total_bytes_ == 0; }
+  LONGLONG TotalBytes(void) const { return total_bytes_; }
+  LONGLONG First(void) const { return first_; }
+  LONGLONG Last(void) const { return last_; }
+  LONGLONG MaxStall(void) const { return max_stall_; }
+  double Throughput(LONGLONG frequency) const;
+  LONGLONG TimeToPercent(int percent) const;
+
+  CStringA GetTimeline(LONGLONG start, LONGLONG ms_frequency) const;
+  CStringA GetJSON(LONGLONG start, LONGLONG ms_frequency) const;
+
+private:
+  static const size_t MAX_BUCKETS = 256;
+
+  CAtlArray<DWORD> buckets_;      // bytes per bucket, starting at first_
+  LONGLONG         bucket_width_; // in ticks
+  LONGLONG         initial_width_;
+  LONGLONG         first_;
+  LONGLONG         last_;
+  LONGLONG         max_stall_;
+  LONGLONG         total_bytes_;
+};
@@ -0,0 +1,160 @@
+/******************************************************************************
+Copyright (c) 2013, Google Inc.
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without 
+modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice, 
+      this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+    * Neither the name of the <ORGANIZATION> nor the names of its contributors 
+    may be used to endorse or promote products derived from this software 
+    without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE 
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE 
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL 
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR 
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER 
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, 
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE 
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+******************************************************************************/
+
+#include "StdAfx.h"
+#include "body_store.h"
+#include <Wincrypt.h>
+
+static const TCHAR * BODY_INDEX_DIR = _T("bodies");
+static const char * BODY_MANIFEST = "manifest.txt";
+
+/*-----------------------------------------------------------------------------
+-----------------------------------------------------------------------------*/
+BodyStore::BodyStore(void):
+  bodies_(0)
+  , stored_(0)
+  , zip_(NULL) {
+}
+
+/*-----------------------------------------------------------------------------
+-----------------------------------------------------------------------------*/
+BodyStore::~BodyStore(void) {
+  if (zip_)
+    zipClose(zip_, 0);
+}
+
+/*-----------------------------------------------------------------------------
+  Start this run's zip (the index lives next to it)
+-----------------------------------------------------------------------------*/
+bool BodyStore::Open(const CString& zip_file) {
+  bodies_ = 0;
+  stored_ = 0;
+  manifest_.Empty();
+  TCHAR path[MAX_PATH];
+  lstrcpyn(path, zip_file, MAX_PATH);
+  zip_name_ = CT2A(PathFindFileName(path));
+  PathRemoveFileSpec(path);
+  PathAppend(path, BODY_INDEX_DIR);
+  CreateDirectory(path, NULL);
+  index_dir_ = path;
+  zip_ = zipOpen(CT2A(zip_file), APPEND_STATUS_CREATE);
+  return zip_ != NULL;
+}
+
+/*-----------------------------------------------------------------------------
+  Reference the body from the manifest and store it if no run has yet
+-----------------------------------------------------------------------------*/
+bool BodyStore::Add(DWORD request_number, const BYTE * data, DWORD len) {
+  if (!zip_ || !data || !len)
+    return false;
+  CStringA hash = HashBody(data, len);
+  if (hash.IsEmpty())
+    return false;
+
+  CString marker = index_dir_ + _T("\\") + CA2T(hash);
+  CStringA holder;
+  HANDLE file = CreateFile(marker, GENERIC_READ, FILE_SHARE_READ, 0,
+                           OPEN_EXISTING, 0, 0);
+  if (file != INVALID_HANDLE_VALUE) {
+    char name[MAX_PATH];
+    DWORD bytes = 0;
+    if (ReadFile(file, name, sizeof(name) - 1, &bytes, 0) && bytes) {
+      name[bytes] = 0;
+      holder = name;
+    }
+    CloseHandle(file);
+  }
+
+  if (holder.IsEmpty()) {
+    if (zipOpenNewFileInZip(zip_, hash + ".txt", 0, 0, 0, 0, 0, 0,
+                            Z_DEFLATED, Z_BEST_COMPRESSION))
+      return false;
+    zipWriteInFileInZip(zip_, data, len);
+    zipCloseFileInZip(zip_);
+    holder = zip_name_;
+    stored_++;
+    file = CreateFile(marker, GENERIC_WRITE, 0, 0, CREATE_ALWAYS, 0, 0);
+    if (file != INVALID_HANDLE_VALUE) {
+      DWORD bytes;
+      WriteFile(file, (LPCSTR)holder, holder.GetLength(), &bytes, 0);
+      CloseHandle(file);
+    }
+  }
+
+  CStringA line;
+  line.Format("%03d\t%s\t%s\r\n", request_number, (LPCSTR)hash,
+              (LPCSTR)holder);
+  manifest_ += line;
+  bodies_++;
+  return true;
+}
+
+/*-----------------------------------------------------------------------------
+  Write the manifest and finish the zip, false if it has nothing in it
+-----------------------------------------------------------------------------*/
+bool BodyStore::Close(void) {
+  bool ret = false;
+  if (zip_) {
+    if (bodies_ && !zipOpenNewFileInZip(zip_, BODY_MANIFEST, 0, 0, 0, 0, 0, 0,
+                                        Z_DEFLATED, Z_BEST_COMPRESSION)) {
+      zipWriteInFileInZip(zip_, (LPCSTR)manifest_, manifest_.GetLength());
+      zipCloseFileInZip(zip_);
+      ret = true;
+    }
+    zipClose(zip_, 0);
+    zip_ = NULL;
+  }
+  return ret;
+}
+
+/*-----------------------------------------------------------------------------
+  SHA-1 of the body as lower-case hex
+-----------------------------------------------------------------------------*/
+CStringA BodyStore::HashBody(const BYTE * data, DWORD len) {
+  CStringA result;
+  HCRYPTPROV crypto = 0;
+  if (CryptAcquireContext(&crypto, NULL, NULL, PROV_RSA_FULL,
+                          CRYPT_VERIFYCONTEXT)) {
+    HCRYPTHASH hash = 0;
+    if (CryptCreateHash(crypto, CALG_SHA1, 0, 0, &hash)) {
+      BYTE digest[20];
+      DWORD digest_len = sizeof(digest);
+      if (CryptHashData(hash, data, len, 0) &&
+          CryptGetHashParam(hash, HP_HASHVAL, digest, &digest_len, 0)) {
+        static const char hex[] = "0123456789abcdef";
+        for (DWORD i = 0; i < digest_len; i++) {
+          result += hex[digest[i] >> 4];
+          result += hex[digest[i] & 0x0F];
+        }
+      }
+      CryptDestroyHash(hash);
+    }
+    CryptReleaseContext(crypto, 0);
+  }
+  return result;
+}
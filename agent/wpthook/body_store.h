@@ -0,0 +1,64 @@
+/******************************************************************************
+Copyright (c) 2013, Google Inc.
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without 
+modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice, 
+      this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+    * Neither the name of the <ORGANIZATION> nor the names of its contributors 
+    may be used to endorse or promote products derived from this software 
+    without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE 
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE 
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL 
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR 
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER 
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, 
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE 
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+******************************************************************************/
+
+#pragma once
+#include <zip.h>
+
+/*-----------------------------------------------------------------------------
+  Content-addressed store for the response bodies of all of the runs of a
+  test.
+
+  Each run still writes its own <run>_bodies.zip but only the bodies that
+  no earlier run of the test saved go into it (as <sha1>.txt), so a bundle
+  that every run and view downloads is compressed and uploaded once.  A
+  manifest.txt in every zip maps the run's request numbers to the body:
+    <request number>\t<sha1>\t<zip that holds it>
+  The hashes already stored are kept as marker files in a bodies
+  directory next to the results, which survives between the runs (the
+  per-run files are uploaded and deleted) and is cleared with the test.
+-----------------------------------------------------------------------------*/
+class BodyStore {
+public:
+  BodyStore(void);
+  ~BodyStore(void);
+
+  bool Open(const CString& zip_file);
+  bool Add(DWORD request_number, const BYTE * data, DWORD len);
+  bool Close(void);
+
+  DWORD bodies_;                    // bodies referenced by this run
+  DWORD stored_;                    // new bodies written to this run's zip
+
+private:
+  CStringA HashBody(const BYTE * data, DWORD len);
+
+  zipFile   zip_;
+  CStringA  zip_name_;
+  CString   index_dir_;
+  CStringA  manifest_;
+};
@@ -0,0 +1,174 @@
+/******************************************************************************
+Copyright (c) 2013, Google Inc.
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without 
+modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice, 
+      this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+    * Neither the name of the <ORGANIZATION> nor the names of its contributors 
+    may be used to endorse or promote products derived from this software 
+    without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE 
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE 
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL 
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR 
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER 
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, 
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE 
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+******************************************************************************/
+
+#include "StdAfx.h"
+#include "buffer_pool.h"
+
+// Upper limit on the memory kept in the free lists between allocations
+static const size_t MAX_CACHED_BYTES = 8 * 1024 * 1024;
+
+BufferPool global_buffer_pool;
+
+/*-----------------------------------------------------------------------------
+-----------------------------------------------------------------------------*/
+BufferPool::BufferPool(void):
+  cached_bytes_(0) {
+  InitializeCriticalSection(&cs_);
+  for (int i = 0; i < SIZE_CLASSES; i++)
+    free_[i] = NULL;
+  ResetStats();
+}
+
+/*-----------------------------------------------------------------------------
+-----------------------------------------------------------------------------*/
+BufferPool::~BufferPool(void) {
+  Trim();
+  DeleteCriticalSection(&cs_);
+}
+
+/*-----------------------------------------------------------------------------
+  Smallest size class that will fit the buffer (SIZE_CLASSES if it is too
+  big to be pooled)
+-----------------------------------------------------------------------------*/
+int BufferPool::SizeClass(size_t len) const {
+  int size_class = 0;
+  while (size_class < SIZE_CLASSES && ClassSize(size_class) < len)
+    size_class++;
+  return size_class;
+}
+
+/*-----------------------------------------------------------------------------
+-----------------------------------------------------------------------------*/
+void * BufferPool::Alloc(size_t len) {
+  int size_class = SizeClass(len);
+  BufferHeader * header = NULL;
+  EnterCriticalSection(&cs_);
+  if (size_class < SIZE_CLASSES && free_[size_class]) {
+    FreeBuffer * buffer = free_[size_class];
+    free_[size_class] = buffer->_next;
+    cached_bytes_ -= ClassSize(size_class);
+    header = (BufferHeader *)buffer - 1;
+  } else {
+    heap_allocations_++;
+  }
+  allocations_++;
+  bytes_allocated_ += len;
+  bytes_in_use_ += len;
+  if (bytes_in_use_ > peak_bytes_in_use_)
+    peak_bytes_in_use_ = bytes_in_use_;
+  LeaveCriticalSection(&cs_);
+
+  if (!header) {
+    size_t size = size_class < SIZE_CLASSES ? ClassSize(size_class) : len;
+    header = (BufferHeader *)malloc(sizeof(BufferHeader) + size);
+    if (!header) {
+      EnterCriticalSection(&cs_);
+      bytes_in_use_ -= len;
+      LeaveCriticalSection(&cs_);
+      return NULL;
+    }
+  }
+  header->_size_class = size_class;
+  header->_length = len;
+  return header + 1;
+}
+
+/*-----------------------------------------------------------------------------
+-----------------------------------------------------------------------------*/
+void BufferPool::Free(void * buffer) {
+  if (buffer) {
+    BufferHeader * header = (BufferHeader *)buffer - 1;
+    int size_class = (int)header->_size_class;
+    bool cached = false;
+    EnterCriticalSection(&cs_);
+    bytes_in_use_ -= header->_length;
+    if (size_class < SIZE_CLASSES &&
+        cached_bytes_ + ClassSize(size_class) <= MAX_CACHED_BYTES) {
+      FreeBuffer * free_buffer = (FreeBuffer *)buffer;
+      free_buffer->_next = free_[size_class];
+      free_[size_class] = free_buffer;
+      cached_bytes_ += ClassSize(size_class);
+      if (cached_bytes_ > peak_cached_bytes_)
+        peak_cached_bytes_ = cached_bytes_;
+      cached = true;
+    }
+    LeaveCriticalSection(&cs_);
+    if (!cached)
+      free(header);
+  }
+}
+
+/*-----------------------------------------------------------------------------
+  Release all of the cached buffers back to the heap (buffers that are still
+  in use are returned to the heap or the pool as they are freed)
+-----------------------------------------------------------------------------*/
+void BufferPool::Trim(void) {
+  FreeBuffer * lists[SIZE_CLASSES];
+  EnterCriticalSection(&cs_);
+  for (int i = 0; i < SIZE_CLASSES; i++) {
+    lists[i] = free_[i];
+    free_[i] = NULL;
+  }
+  cached_bytes_ = 0;
+  LeaveCriticalSection(&cs_);
+
+  for (int i = 0; i < SIZE_CLASSES; i++) {
+    FreeBuffer * buffer = lists[i];
+    while (buffer) {
+      FreeBuffer * next = buffer->_next;
+      free((BufferHeader *)buffer - 1);
+      buffer = next;
+    }
+  }
+}
+
+/*-----------------------------------------------------------------------------
+-----------------------------------------------------------------------------*/
+void BufferPool::ResetStats(void) {
+  EnterCriticalSection(&cs_);
+  allocations_ = 0;
+  bytes_allocated_ = 0;
+  heap_allocations_ = 0;
+  peak_bytes_in_use_ = bytes_in_use_;
+  peak_cached_bytes_ = cached_bytes_;
+  LeaveCriticalSection(&cs_);
+}
+
+/*-----------------------------------------------------------------------------
+-----------------------------------------------------------------------------*/
+CStringA BufferPool::GetStatsJSON(void) {
+  CStringA json;
+  EnterCriticalSection(&cs_);
+  json.Format("{\"allocations\":%I64u,\"bytesAllocated\":%I64u,"
+              "\"heapAllocations\":%I64u,\"bytesInUse\":%Iu,"
+              "\"peakBytesInUse\":%Iu,\"peakCachedBytes\":%Iu}",
+              allocations_, bytes_allocated_, heap_allocations_,
+              bytes_in_use_, peak_bytes_in_use_, peak_cached_bytes_);
+  LeaveCriticalSection(&cs_);
+  return json;
+}
@@ -0,0 +1,79 @@
+/******************************************************************************
+Copyright (c) 2013, Google Inc.
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without 
+modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice, 
+      this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+    * Neither the name of the <ORGANIZATION> nor the names of its contributors 
+    may be used to endorse or promote products derived from this software 
+    without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE 
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE 
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL 
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR 
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER 
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, 
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE 
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+******************************************************************************/
+
+#pragma once
+
+/*-----------------------------------------------------------------------------
+  Size-class buffer pool for the capture path (request objects, data chunks
+  and header copies).  wpthook runs inside the browser we are measuring so
+  the per-packet allocations are served from cached free lists instead of
+  the process heap and the cached memory is released when the requests are
+  reset for the next test step.  The counters are written out with the
+  results so the hook's own memory use can be tracked.
+-----------------------------------------------------------------------------*/
+class BufferPool {
+public:
+  BufferPool(void);
+  ~BufferPool(void);
+
+  void * Alloc(size_t len);
+  void   Free(void * buffer);
+  void   Trim(void);
+  void   ResetStats(void);
+  CStringA GetStatsJSON(void);
+
+private:
+  static const int SIZE_CLASSES = 11;   // 64 bytes - 64KB
+
+  class BufferHeader {
+  public:
+    size_t  _size_class;
+    size_t  _length;
+  };
+  class FreeBuffer {
+  public:
+    FreeBuffer * _next;
+  };
+
+  int    SizeClass(size_t len) const;
+  size_t ClassSize(int size_class) const { return (size_t)64 << size_class; }
+
+  CRITICAL_SECTION cs_;
+  FreeBuffer * free_[SIZE_CLASSES];
+  size_t       cached_bytes_;
+
+  // stats
+  unsigned __int64 allocations_;
+  unsigned __int64 bytes_allocated_;
+  unsigned __int64 heap_allocations_;
+  size_t           bytes_in_use_;
+  size_t           peak_bytes_in_use_;
+  size_t           peak_cached_bytes_;
+};
+
+extern BufferPool global_buffer_pool;
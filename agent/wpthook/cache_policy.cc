@@ -0,0 +1,437 @@
+/******************************************************************************
+Copyright (c) 2013, Google Inc.
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without 
+modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice, 
+      this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+    * Neither the name of the <ORGANIZATION> nor the names of its contributors 
+    may be used to endorse or promote products derived from this software 
+    without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE 
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE 
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL 
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR 
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER 
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, 
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE 
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+******************************************************************************/
+
+// No precompiled header, this file has to build without the Windows SDK
+#include "cache_policy.h"
+#include <string.h>
+
+// delta-seconds larger than this are capped (RFC 7234 1.2.1)
+static const int64_t MAX_DELTA_SECONDS = 2147483648LL;
+// heuristic freshness is this fraction of the time since Last-Modified
+static const int64_t HEURISTIC_DIVISOR = 10;
+
+static const char * month_names[12] = {"jan", "feb", "mar", "apr", "may",
+    "jun", "jul", "aug", "sep", "oct", "nov", "dec"};
+
+static inline bool IsSpace(char c) {
+  return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+static inline bool IsDigit(char c) {
+  return c >= '0' && c <= '9';
+}
+
+static inline char ToLower(char c) {
+  return (c >= 'A' && c <= 'Z') ? c + ('a' - 'A') : c;
+}
+
+static bool EqualsNoCase(const char * a, size_t len, const char * b) {
+  size_t i = 0;
+  for (; i < len && b[i]; i++)
+    if (ToLower(a[i]) != b[i])
+      return false;
+  return i == len && !b[i];
+}
+
+/*-----------------------------------------------------------------------------
+  Non-negative decimal, -1 if empty or not all digits (capped)
+-----------------------------------------------------------------------------*/
+static int64_t ParseDelta(const char * p, size_t len) {
+  if (!len)
+    return -1;
+  int64_t value = 0;
+  for (size_t i = 0; i < len; i++) {
+    if (!IsDigit(p[i]))
+      return -1;
+    if (value < MAX_DELTA_SECONDS)
+      value = value * 10 + (p[i] - '0');
+  }
+  return value < MAX_DELTA_SECONDS ? value : MAX_DELTA_SECONDS;
+}
+
+/*-----------------------------------------------------------------------------
+  Days from 1970-01-01 for a proleptic Gregorian date (month 1-12)
+-----------------------------------------------------------------------------*/
+static int64_t DaysFromCivil(int64_t year, int month, int day) {
+  year -= month <= 2;
+  int64_t era = (year >= 0 ? year : year - 399) / 400;
+  int64_t year_of_era = year - era * 400;
+  int64_t day_of_year = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 +
+                        day - 1;
+  int64_t day_of_era = year_of_era * 365 + year_of_era / 4 -
+                       year_of_era / 100 + day_of_year;
+  return era * 146097 + day_of_era - 719468;
+}
+
+/*-----------------------------------------------------------------------------
+  The three HTTP-date formats are all made of the same tokens (weekday,
+  day, month name, year and hh:mm:ss) in different orders, so classify
+  the tokens instead of matching each layout.
+-----------------------------------------------------------------------------*/
+bool HttpDateToSeconds(const char * value, size_t len, int64_t& seconds) {
+  int day = -1, month = -1, year = -1, hour = -1, minute = -1, second = -1;
+  const char * p = value;
+  const char * end = value + len;
+  while (p < end) {
+    while (p < end && (IsSpace(*p) || *p == ',' || *p == '-'))
+      p++;
+    const char * token = p;
+    while (p < end && !IsSpace(*p) && *p != ',' && *p != '-')
+      p++;
+    size_t token_len = p - token;
+    if (!token_len)
+      break;
+    if (IsDigit(token[0])) {
+      if (memchr(token, ':', token_len)) {
+        if (hour >= 0 || token_len != 8 || token[2] != ':' || token[5] != ':')
+          return false;
+        int fields[3];
+        for (int i = 0; i < 3; i++) {
+          const char * field = token + i * 3;
+          if (!IsDigit(field[0]) || !IsDigit(field[1]))
+            return false;
+          fields[i] = (field[0] - '0') * 10 + (field[1] - '0');
+        }
+        hour = fields[0];
+        minute = fields[1];
+        second = fields[2];
+      } else {
+        int64_t number = ParseDelta(token, token_len);
+        if (number < 0)
+          return false;
+        if (token_len <= 2 && day < 0) {
+          day = (int)number;
+        } else if (year < 0 && (token_len == 2 || token_len == 4)) {
+          year = (int)number;
+          if (token_len == 2)   // RFC 850
+            year += year < 70 ? 2000 : 1900;
+        } else {
+          return false;
+        }
+      }
+    } else if (token_len >= 3 && month < 0) {
+      for (int i = 0; i < 12 && month < 0; i++)
+        if (EqualsNoCase(token, 3, month_names[i]))
+          month = i + 1;
+      // anything else is the weekday or the time zone (always GMT)
+    }
+  }
+  if (day < 1 || day > 31 || month < 1 || year < 1970 || hour < 0 ||
+      hour > 23 || minute > 59 || second > 60)
+    return false;
+  seconds = DaysFromCivil(year, month, day) * 86400 + hour * 3600 +
+            minute * 60 + second;
+  return true;
+}
+
+/*-----------------------------------------------------------------------------
+-----------------------------------------------------------------------------*/
+CacheDirectives::CacheDirectives(const char * value, size_t len):
+  name_(NULL), name_len_(0), value_(NULL), value_len_(0),
+  pos_(value), end_(value + len) {
+}
+
+/*-----------------------------------------------------------------------------
+  Advance to the next directive, false at the end of the list
+-----------------------------------------------------------------------------*/
+bool CacheDirectives::Next() {
+  name_ = NULL;
+  name_len_ = 0;
+  value_ = NULL;
+  value_len_ = 0;
+  while (pos_ < end_ && !name_len_) {
+    while (pos_ < end_ && (IsSpace(*pos_) || *pos_ == ','))
+      pos_++;
+    name_ = pos_;
+    while (pos_ < end_ && !IsSpace(*pos_) && *pos_ != ',' && *pos_ != '=')
+      pos_++;
+    name_len_ = pos_ - name_;
+    while (pos_ < end_ && IsSpace(*pos_))
+      pos_++;
+    if (pos_ < end_ && *pos_ == '=') {
+      pos_++;
+      while (pos_ < end_ && IsSpace(*pos_))
+        pos_++;
+      if (pos_ < end_ && *pos_ == '"') {
+        value_ = ++pos_;
+        while (pos_ < end_ && *pos_ != '"') {
+          if (*pos_ == '\\' && pos_ + 1 < end_)
+            pos_++;
+          pos_++;
+        }
+        value_len_ = pos_ - value_;
+        if (pos_ < end_)
+          pos_++;
+      } else {
+        value_ = pos_;
+        while (pos_ < end_ && !IsSpace(*pos_) && *pos_ != ',')
+          pos_++;
+        value_len_ = pos_ - value_;
+      }
+    }
+    // skip anything unexpected up to the next directive
+    while (pos_ < end_ && *pos_ != ',')
+      pos_++;
+  }
+  return name_len_ != 0;
+}
+
+bool CacheDirectives::Is(const char * name) const {
+  return EqualsNoCase(name_, name_len_, name);
+}
+
+int64_t CacheDirectives::Seconds() const {
+  return ParseDelta(value_, value_len_);
+}
+
+/*-----------------------------------------------------------------------------
+-----------------------------------------------------------------------------*/
+CachePolicy::CachePolicy() {
+  Reset();
+}
+
+void CachePolicy::Reset() {
+  status_ = 0;
+  has_cache_control_ = false;
+  no_store_ = false;
+  no_cache_ = false;
+  private_ = false;
+  public_ = false;
+  must_revalidate_ = false;
+  immutable_ = false;
+  pragma_no_cache_ = false;
+  expires_invalid_ = false;
+  has_etag_ = false;
+  max_age_ = -1;
+  s_maxage_ = -1;
+  stale_while_revalidate_ = -1;
+  date_ = -1;
+  expires_ = -1;
+  last_modified_ = -1;
+  age_ = -1;
+  response_time_ = -1;
+}
+
+/*-----------------------------------------------------------------------------
+  Feed one response header (repeated headers accumulate)
+-----------------------------------------------------------------------------*/
+void CachePolicy::AddHeader(const char * name, const char * value) {
+  if (!name || !value)
+    return;
+  size_t name_len = strlen(name);
+  size_t len = strlen(value);
+  while (len && IsSpace(*value)) {
+    value++;
+    len--;
+  }
+  while (len && IsSpace(value[len - 1]))
+    len--;
+
+  if (EqualsNoCase(name, name_len, "cache-control")) {
+    has_cache_control_ = true;
+    CacheDirectives directives(value, len);
+    while (directives.Next()) {
+      if (directives.Is("no-store")) {
+        no_store_ = true;
+      } else if (directives.Is("no-cache")) {
+        // no-cache="field" only limits what may be reused, not the response
+        if (!directives.value_)
+          no_cache_ = true;
+      } else if (directives.Is("max-age")) {
+        // an invalid max-age makes the response stale
+        int64_t seconds = directives.Seconds();
+        max_age_ = seconds >= 0 ? seconds : 0;
+      } else if (directives.Is("s-maxage")) {
+        int64_t seconds = directives.Seconds();
+        s_maxage_ = seconds >= 0 ? seconds : 0;
+      } else if (directives.Is("stale-while-revalidate")) {
+        stale_while_revalidate_ = directives.Seconds();
+      } else if (directives.Is("private")) {
+        private_ = true;
+      } else if (directives.Is("public")) {
+        public_ = true;
+      } else if (directives.Is("must-revalidate") ||
+                 directives.Is("proxy-revalidate")) {
+        must_revalidate_ = true;
+      } else if (directives.Is("immutable")) {
+        immutable_ = true;
+      }
+    }
+  } else if (EqualsNoCase(name, name_len, "pragma")) {
+    CacheDirectives directives(value, len);
+    while (directives.Next())
+      if (directives.Is("no-cache"))
+        pragma_no_cache_ = true;
+  } else if (EqualsNoCase(name, name_len, "date")) {
+    int64_t seconds;
+    if (date_ < 0 && HttpDateToSeconds(value, len, seconds))
+      date_ = seconds;
+  } else if (EqualsNoCase(name, name_len, "expires")) {
+    int64_t seconds;
+    if (expires_ < 0 && !expires_invalid_) {
+      if (HttpDateToSeconds(value, len, seconds))
+        expires_ = seconds;
+      else
+        expires_invalid_ = true;
+    }
+  } else if (EqualsNoCase(name, name_len, "last-modified")) {
+    int64_t seconds;
+    if (last_modified_ < 0 && HttpDateToSeconds(value, len, seconds))
+      last_modified_ = seconds;
+  } else if (EqualsNoCase(name, name_len, "age")) {
+    if (age_ < 0)
+      age_ = ParseDelta(value, len);
+  } else if (EqualsNoCase(name, name_len, "etag")) {
+    has_etag_ = len != 0;
+  }
+}
+
+/*-----------------------------------------------------------------------------
+  Status codes that are cacheable by default (RFC 7231 6.1, RFC 7538)
+-----------------------------------------------------------------------------*/
+static bool IsHeuristicStatus(int status) {
+  switch (status) {
+    case 200: case 203: case 204: case 206: case 300: case 301: case 308:
+    case 404: case 405: case 410: case 414: case 501:
+      return true;
+  }
+  return false;
+}
+
+int64_t CachePolicy::DateOrResponseTime() const {
+  return date_ >= 0 ? date_ : response_time_;
+}
+
+/*-----------------------------------------------------------------------------
+  Whether a browser cache would keep the response at all (304s refresh a
+  stored response so they count as stored)
+-----------------------------------------------------------------------------*/
+bool CachePolicy::IsStorable() const {
+  if (no_store_)
+    return false;
+  return status_ <= 0 || status_ == 304 || IsHeuristicStatus(status_) ||
+         HasExplicitFreshness();
+}
+
+bool CachePolicy::MustValidate() const {
+  return no_cache_ || (!has_cache_control_ && pragma_no_cache_);
+}
+
+bool CachePolicy::HasExplicitFreshness(bool shared) const {
+  return (shared && s_maxage_ >= 0) || max_age_ >= 0 || expires_ >= 0 ||
+         expires_invalid_;
+}
+
+bool CachePolicy::IsHeuristic() const {
+  return !HasExplicitFreshness(true) && last_modified_ >= 0 &&
+         (public_ || status_ <= 0 || IsHeuristicStatus(status_));
+}
+
+/*-----------------------------------------------------------------------------
+  How long the response is fresh for (RFC 7234 4.2.1 and 4.2.2)
+-----------------------------------------------------------------------------*/
+int64_t CachePolicy::FreshnessLifetime(bool shared) const {
+  if (shared && s_maxage_ >= 0)
+    return s_maxage_;
+  if (max_age_ >= 0)
+    return max_age_;
+  if (expires_invalid_)
+    return 0;
+  int64_t date = DateOrResponseTime();
+  if (expires_ >= 0)
+    return date >= 0 && expires_ > date ? expires_ - date : 0;
+  if (IsHeuristic() && date > last_modified_)
+    return (date - last_modified_) / HEURISTIC_DIVISOR;
+  return 0;
+}
+
+/*-----------------------------------------------------------------------------
+  Age of the response (RFC 7234 4.2.3) once it has sat in the cache for
+  resident_seconds (network delay is not known here and is ignored)
+-----------------------------------------------------------------------------*/
+int64_t CachePolicy::CurrentAge(int64_t resident_seconds) const {
+  int64_t apparent_age = 0;
+  if (date_ >= 0 && response_time_ > date_)
+    apparent_age = response_time_ - date_;
+  int64_t age = age_ > apparent_age ? age_ : apparent_age;
+  return age + (resident_seconds > 0 ? resident_seconds : 0);
+}
+
+int64_t CachePolicy::RemainingSeconds(bool shared) const {
+  return FreshnessLifetime(shared) - CurrentAge();
+}
+
+/*-----------------------------------------------------------------------------
+  The cache score's view of the expiration: false if the object is
+  explicitly not cacheable (no-store, no-cache or an Expires that has
+  already passed).  Only the Age header counts against the lifetime, not
+  the time since the Date header (server clocks are off).
+-----------------------------------------------------------------------------*/
+bool CachePolicy::ExpiresRemaining(bool& expiration_set,
+                                   int& seconds_remaining) const {
+  expiration_set = false;
+  seconds_remaining = 0;
+  if (no_store_ || MustValidate())
+    return false;
+  if (max_age_ < 0 && expires_ >= 0 && FreshnessLifetime() <= 0)
+    return false;
+  if (HasExplicitFreshness() && FreshnessLifetime() > 0) {
+    expiration_set = true;
+    seconds_remaining = (int)(FreshnessLifetime() - (age_ > 0 ? age_ : 0));
+  }
+  return true;
+}
+
+/*-----------------------------------------------------------------------------
+  Predict what a repeat view elapsed_seconds later would do
+-----------------------------------------------------------------------------*/
+RepeatViewCache CachePolicy::RepeatView(int64_t elapsed_seconds) const {
+  if (!IsStorable())
+    return REPEAT_VIEW_FETCH;
+  if (!MustValidate()) {
+    int64_t lifetime = FreshnessLifetime();
+    int64_t age = CurrentAge(elapsed_seconds);
+    if (lifetime > age)
+      return REPEAT_VIEW_CACHED;
+    // served stale while it revalidates in the background
+    if (!must_revalidate_ && stale_while_revalidate_ > 0 &&
+        lifetime + stale_while_revalidate_ > age)
+      return REPEAT_VIEW_CACHED;
+  }
+  if (has_etag_ || last_modified_ >= 0)
+    return REPEAT_VIEW_VALIDATE;
+  return REPEAT_VIEW_FETCH;
+}
+
+const char * CachePolicy::RepeatViewName(RepeatViewCache cache) {
+  switch (cache) {
+    case REPEAT_VIEW_CACHED: return "cache";
+    case REPEAT_VIEW_VALIDATE: return "validate";
+    default: return "fetch";
+  }
+}
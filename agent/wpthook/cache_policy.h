@@ -0,0 +1,116 @@
+/******************************************************************************
+Copyright (c) 2013, Google Inc.
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without 
+modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice, 
+      this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+    * Neither the name of the <ORGANIZATION> nor the names of its contributors 
+    may be used to endorse or promote products derived from this software 
+    without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE 
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE 
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL 
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR 
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER 
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, 
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE 
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+******************************************************************************/
+
+#pragma once
+// Portable (no Win32/ATL, no precompiled header) HTTP caching model
+// (RFC 7234) so it can be unit tested on Linux (cache_policy_test).
+#include <stddef.h>
+#include <stdint.h>
+
+// What the browser cache would do with the response on a repeat view
+enum RepeatViewCache {
+  REPEAT_VIEW_FETCH = 0,    // not stored, or stale with nothing to validate
+  REPEAT_VIEW_VALIDATE,     // stale (or no-cache), conditional request
+  REPEAT_VIEW_CACHED        // served from the cache without a request
+};
+
+// HTTP-date (IMF-fixdate, RFC 850 or asctime) to seconds since 1970
+bool HttpDateToSeconds(const char * value, size_t len, int64_t& seconds);
+
+/*-----------------------------------------------------------------------------
+  Walks a Cache-Control style list in place (no allocations):
+    name[=token|="quoted"], name...
+-----------------------------------------------------------------------------*/
+class CacheDirectives {
+public:
+  CacheDirectives(const char * value, size_t len);
+  bool Next();
+  bool Is(const char * name) const;
+  int64_t Seconds() const;          // delta-seconds value, -1 if invalid
+
+  const char * name_;
+  size_t       name_len_;
+  const char * value_;              // excluding any quotes
+  size_t       value_len_;
+private:
+  const char * pos_;
+  const char * end_;
+};
+
+/*-----------------------------------------------------------------------------
+  The caching-relevant parts of a response, parsed once.
+
+  Times are seconds since 1970 and -1 when the header is missing.  The
+  freshness model is the browser's (private cache) one unless a shared
+  cache is asked for: s-maxage, then max-age, then Expires - Date, then
+  the 10% of (Date - Last-Modified) heuristic for status codes that allow
+  it.
+-----------------------------------------------------------------------------*/
+class CachePolicy {
+public:
+  CachePolicy();
+  void Reset();
+  void AddHeader(const char * name, const char * value);
+  void SetStatus(int status) { status_ = status; }
+  // when the response arrived (stands in for a missing Date)
+  void SetResponseTime(int64_t seconds) { response_time_ = seconds; }
+
+  bool IsStorable() const;
+  bool MustValidate() const;        // no-cache (or Pragma without it)
+  bool HasExplicitFreshness(bool shared = false) const;
+  bool IsHeuristic() const;
+  int64_t FreshnessLifetime(bool shared = false) const;
+  int64_t CurrentAge(int64_t resident_seconds = 0) const;
+  int64_t RemainingSeconds(bool shared = false) const;
+  bool ExpiresRemaining(bool& expiration_set, int& seconds_remaining) const;
+  RepeatViewCache RepeatView(int64_t elapsed_seconds = 0) const;
+  static const char * RepeatViewName(RepeatViewCache cache);
+
+  int     status_;
+  bool    has_cache_control_;
+  bool    no_store_;
+  bool    no_cache_;
+  bool    private_;
+  bool    public_;
+  bool    must_revalidate_;
+  bool    immutable_;
+  bool    pragma_no_cache_;
+  bool    expires_invalid_;         // present but not a date ("0", "-1")
+  bool    has_etag_;
+  int64_t max_age_;
+  int64_t s_maxage_;
+  int64_t stale_while_revalidate_;
+  int64_t date_;
+  int64_t expires_;
+  int64_t last_modified_;
+  int64_t age_;
+  int64_t response_time_;
+
+private:
+  int64_t DateOrResponseTime() const;
+};
@@ -0,0 +1,372 @@
+/******************************************************************************
+Copyright (c) 2013, Google Inc.
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without 
+modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice, 
+      this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+    * Neither the name of the <ORGANIZATION> nor the names of its contributors 
+    may be used to endorse or promote products derived from this software 
+    without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE 
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE 
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL 
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR 
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER 
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, 
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE 
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+******************************************************************************/
+
+// Header cases for the RFC 7234 cache model (cache_policy.cc).
+//
+//   make test
+#include "../cache_policy.h"
+#include <stdio.h>
+#include <string.h>
+
+static int failures = 0;
+static int checks = 0;
+
+#define CHECK(condition) \
+  do { \
+    checks++; \
+    if (!(condition)) { \
+      failures++; \
+      printf("%s:%d: %s: CHECK(%s) failed\n", __FILE__, __LINE__, \
+             current_test, #condition); \
+    } \
+  } while (0)
+
+static const char * current_test = "";
+
+// Sun, 06 Nov 1994 08:49:37 GMT
+static const int64_t RFC_DATE = 784111777;
+static const char * DATE = "Sun, 06 Nov 1994 08:49:37 GMT";
+
+/*-----------------------------------------------------------------------------
+  Policy for a response received at the Date, headers as name, value pairs
+-----------------------------------------------------------------------------*/
+static CachePolicy Policy(int status, const char * const * headers) {
+  CachePolicy policy;
+  policy.SetStatus(status);
+  policy.SetResponseTime(RFC_DATE);
+  for (; headers[0]; headers += 2)
+    policy.AddHeader(headers[0], headers[1]);
+  return policy;
+}
+
+static bool ParseDate(const char * value, int64_t& seconds) {
+  return HttpDateToSeconds(value, strlen(value), seconds);
+}
+
+/*-----------------------------------------------------------------------------
+-----------------------------------------------------------------------------*/
+static void TestHttpDates() {
+  current_test = "http dates";
+  int64_t seconds = 0;
+  CHECK(ParseDate("Sun, 06 Nov 1994 08:49:37 GMT", seconds));
+  CHECK(seconds == RFC_DATE);
+  seconds = 0;
+  CHECK(ParseDate("Sunday, 06-Nov-94 08:49:37 GMT", seconds));
+  CHECK(seconds == RFC_DATE);
+  seconds = 0;
+  CHECK(ParseDate("Sun Nov  6 08:49:37 1994", seconds));
+  CHECK(seconds == RFC_DATE);
+  CHECK(ParseDate("thu, 01 jan 1970 00:00:00 gmt", seconds));
+  CHECK(seconds == 0);
+  CHECK(ParseDate("Tue, 29 Feb 2028 23:59:59 GMT", seconds));
+  CHECK(seconds == 1835481599);
+  CHECK(ParseDate("Wed, 01-Jan-25 00:00:00 GMT", seconds));
+  CHECK(seconds == 1735689600);
+
+  CHECK(!ParseDate("", seconds));
+  CHECK(!ParseDate("0", seconds));
+  CHECK(!ParseDate("-1", seconds));
+  CHECK(!ParseDate("never", seconds));
+  CHECK(!ParseDate("Sun, 32 Nov 1994 08:49:37 GMT", seconds));
+  CHECK(!ParseDate("Sun, 06 Nov 1994 8:49:37 GMT", seconds));
+  CHECK(!ParseDate("Sun, 06 Nov 1994 GMT", seconds));
+}
+
+/*-----------------------------------------------------------------------------
+-----------------------------------------------------------------------------*/
+static void TestDirectives() {
+  current_test = "directives";
+  const char * value =
+      " max-age = 60 ,no-cache=\"Set-Cookie, X-Foo\",, PRIVATE,ext=\"a\\\"b\"";
+  CacheDirectives directives(value, strlen(value));
+  CHECK(directives.Next());
+  CHECK(directives.Is("max-age"));
+  CHECK(directives.Seconds() == 60);
+  CHECK(directives.Next());
+  CHECK(directives.Is("no-cache"));
+  CHECK(directives.value_len_ == 17);
+  CHECK(!strncmp(directives.value_, "Set-Cookie, X-Foo", 17));
+  CHECK(directives.Next());
+  CHECK(directives.Is("private"));
+  CHECK(directives.value_ == NULL);
+  CHECK(directives.Seconds() == -1);
+  CHECK(directives.Next());
+  CHECK(directives.Is("ext"));
+  CHECK(directives.value_len_ == 4);
+  CHECK(!directives.Next());
+
+  CacheDirectives empty("", 0);
+  CHECK(!empty.Next());
+
+  const char * big = "max-age=99999999999999999999";
+  CacheDirectives capped(big, strlen(big));
+  CHECK(capped.Next());
+  CHECK(capped.Seconds() == 2147483648LL);
+}
+
+/*-----------------------------------------------------------------------------
+-----------------------------------------------------------------------------*/
+static void TestExplicitFreshness() {
+  current_test = "max-age beats expires";
+  const char * max_age[] = {"Date", DATE,
+      "Expires", "Sun, 06 Nov 1994 09:49:37 GMT",
+      "Cache-Control", "public, max-age=60", NULL};
+  CachePolicy policy = Policy(200, max_age);
+  CHECK(policy.HasExplicitFreshness());
+  CHECK(policy.FreshnessLifetime() == 60);
+  CHECK(policy.RepeatView() == REPEAT_VIEW_CACHED);
+  CHECK(policy.RepeatView(61) == REPEAT_VIEW_FETCH);
+
+  current_test = "expires";
+  const char * expires[] = {"Date", DATE,
+      "Expires", "Sun, 06 Nov 1994 09:49:37 GMT", NULL};
+  policy = Policy(200, expires);
+  CHECK(policy.FreshnessLifetime() == 3600);
+  CHECK(policy.RemainingSeconds() == 3600);
+
+  current_test = "expires in the past";
+  const char * past[] = {"Date", DATE,
+      "Expires", "Sun, 06 Nov 1994 07:49:37 GMT",
+      "ETag", "\"abc\"", NULL};
+  policy = Policy(200, past);
+  CHECK(policy.FreshnessLifetime() == 0);
+  CHECK(policy.RepeatView() == REPEAT_VIEW_VALIDATE);
+
+  current_test = "invalid expires";
+  const char * invalid[] = {"Date", DATE, "Expires", "0",
+      "Last-Modified", "Sat, 01 Jan 1994 00:00:00 GMT", NULL};
+  policy = Policy(200, invalid);
+  CHECK(policy.expires_invalid_);
+  CHECK(!policy.IsHeuristic());
+  CHECK(policy.FreshnessLifetime() == 0);
+  CHECK(policy.RepeatView() == REPEAT_VIEW_VALIDATE);
+
+  current_test = "invalid max-age";
+  const char * bad_max_age[] = {"Cache-Control", "max-age=soon", NULL};
+  policy = Policy(200, bad_max_age);
+  CHECK(policy.max_age_ == 0);
+  CHECK(policy.RepeatView() == REPEAT_VIEW_FETCH);
+
+  current_test = "s-maxage is for shared caches";
+  const char * s_maxage[] = {"Cache-Control", "s-maxage=600, max-age=10",
+      NULL};
+  policy = Policy(200, s_maxage);
+  CHECK(policy.FreshnessLifetime() == 10);
+  CHECK(policy.FreshnessLifetime(true) == 600);
+
+  current_test = "case insensitive";
+  const char * upper[] = {"CACHE-CONTROL", "MAX-AGE=100, Immutable", NULL};
+  policy = Policy(200, upper);
+  CHECK(policy.max_age_ == 100);
+  CHECK(policy.immutable_);
+
+  current_test = "repeated cache-control";
+  const char * repeated[] = {"Cache-Control", "public",
+      "cache-control", "max-age=30", NULL};
+  policy = Policy(200, repeated);
+  CHECK(policy.public_);
+  CHECK(policy.FreshnessLifetime() == 30);
+}
+
+/*-----------------------------------------------------------------------------
+-----------------------------------------------------------------------------*/
+static void TestAge() {
+  current_test = "age header";
+  const char * age[] = {"Date", DATE, "Age", "50",
+      "Cache-Control", "max-age=60", NULL};
+  CachePolicy policy = Policy(200, age);
+  CHECK(policy.CurrentAge() == 50);
+  CHECK(policy.RemainingSeconds() == 10);
+  CHECK(policy.RepeatView(5) == REPEAT_VIEW_CACHED);
+  CHECK(policy.RepeatView(15) == REPEAT_VIEW_FETCH);
+
+  current_test = "apparent age";
+  const char * old_date[] = {"Date", "Sun, 06 Nov 1994 08:48:37 GMT",
+      "Cache-Control", "max-age=100", NULL};
+  policy = Policy(200, old_date);
+  CHECK(policy.CurrentAge() == 60);
+  CHECK(policy.RemainingSeconds() == 40);
+
+  current_test = "missing date";
+  const char * no_date[] = {"Expires", "Sun, 06 Nov 1994 08:59:37 GMT",
+      NULL};
+  policy = Policy(200, no_date);
+  CHECK(policy.FreshnessLifetime() == 600);
+}
+
+/*-----------------------------------------------------------------------------
+-----------------------------------------------------------------------------*/
+static void TestHeuristic() {
+  current_test = "heuristic freshness";
+  const char * heuristic[] = {"Date", DATE,
+      "Last-Modified", "Thu, 27 Oct 1994 08:49:37 GMT", NULL};
+  CachePolicy policy = Policy(200, heuristic);
+  CHECK(!policy.HasExplicitFreshness());
+  CHECK(policy.IsHeuristic());
+  CHECK(policy.FreshnessLifetime() == 86400);
+  CHECK(policy.RepeatView() == REPEAT_VIEW_CACHED);
+  CHECK(policy.RepeatView(86401) == REPEAT_VIEW_VALIDATE);
+
+  current_test = "no heuristic for redirects";
+  policy = Policy(302, heuristic);
+  CHECK(!policy.IsHeuristic());
+  CHECK(!policy.IsStorable());
+  CHECK(policy.RepeatView() == REPEAT_VIEW_FETCH);
+
+  current_test = "public allows heuristic";
+  const char * public_redirect[] = {"Date", DATE, "Cache-Control", "public",
+      "Last-Modified", "Thu, 27 Oct 1994 08:49:37 GMT", NULL};
+  policy = Policy(302, public_redirect);
+  CHECK(policy.IsHeuristic());
+
+  current_test = "no freshness or validator";
+  const char * nothing[] = {"Date", DATE, NULL};
+  policy = Policy(200, nothing);
+  CHECK(policy.FreshnessLifetime() == 0);
+  CHECK(policy.RepeatView() == REPEAT_VIEW_FETCH);
+}
+
+/*-----------------------------------------------------------------------------
+-----------------------------------------------------------------------------*/
+static void TestRevalidation() {
+  current_test = "no-store";
+  const char * no_store[] = {"Cache-Control", "no-store, max-age=600",
+      "ETag", "\"x\"", NULL};
+  CachePolicy policy = Policy(200, no_store);
+  CHECK(!policy.IsStorable());
+  CHECK(policy.RepeatView() == REPEAT_VIEW_FETCH);
+
+  current_test = "no-cache with a validator";
+  const char * no_cache[] = {"Cache-Control", "no-cache, max-age=600",
+      "ETag", "\"x\"", NULL};
+  policy = Policy(200, no_cache);
+  CHECK(policy.MustValidate());
+  CHECK(policy.RepeatView() == REPEAT_VIEW_VALIDATE);
+
+  current_test = "no-cache without a validator";
+  const char * no_cache_only[] = {"Cache-Control", "no-cache", NULL};
+  policy = Policy(200, no_cache_only);
+  CHECK(policy.RepeatView() == REPEAT_VIEW_FETCH);
+
+  current_test = "no-cache with field names";
+  const char * no_cache_field[] = {"Cache-Control",
+      "no-cache=\"Set-Cookie\", max-age=600", NULL};
+  policy = Policy(200, no_cache_field);
+  CHECK(!policy.MustValidate());
+  CHECK(policy.RepeatView() == REPEAT_VIEW_CACHED);
+
+  current_test = "pragma without cache-control";
+  const char * pragma[] = {"Pragma", "no-cache", "Expires",
+      "Sun, 06 Nov 1994 09:49:37 GMT", "Date", DATE,
+      "Last-Modified", DATE, NULL};
+  policy = Policy(200, pragma);
+  CHECK(policy.MustValidate());
+  CHECK(policy.RepeatView() == REPEAT_VIEW_VALIDATE);
+
+  current_test = "pragma ignored with cache-control";
+  const char * pragma_cc[] = {"Pragma", "no-cache",
+      "Cache-Control", "max-age=60", NULL};
+  policy = Policy(200, pragma_cc);
+  CHECK(!policy.MustValidate());
+  CHECK(policy.RepeatView() == REPEAT_VIEW_CACHED);
+
+  current_test = "stale-while-revalidate";
+  const char * swr[] = {"Cache-Control",
+      "max-age=1, stale-while-revalidate=60", "Age", "10", NULL};
+  policy = Policy(200, swr);
+  CHECK(policy.stale_while_revalidate_ == 60);
+  CHECK(policy.RepeatView() == REPEAT_VIEW_CACHED);
+  CHECK(policy.RepeatView(60) == REPEAT_VIEW_FETCH);
+
+  current_test = "must-revalidate beats stale-while-revalidate";
+  const char * must[] = {"Cache-Control",
+      "max-age=1, stale-while-revalidate=60, must-revalidate", "Age", "10",
+      "ETag", "W/\"1\"", NULL};
+  policy = Policy(200, must);
+  CHECK(policy.RepeatView() == REPEAT_VIEW_VALIDATE);
+
+  current_test = "304 refreshes the stored response";
+  const char * not_modified[] = {"Cache-Control", "max-age=300", NULL};
+  policy = Policy(304, not_modified);
+  CHECK(policy.IsStorable());
+  CHECK(policy.RepeatView() == REPEAT_VIEW_CACHED);
+
+  current_test = "names";
+  CHECK(!strcmp(CachePolicy::RepeatViewName(REPEAT_VIEW_CACHED), "cache"));
+  CHECK(!strcmp(CachePolicy::RepeatViewName(REPEAT_VIEW_VALIDATE),
+                "validate"));
+  CHECK(!strcmp(CachePolicy::RepeatViewName(REPEAT_VIEW_FETCH), "fetch"));
+}
+
+/*-----------------------------------------------------------------------------
+-----------------------------------------------------------------------------*/
+static void TestExpiresRemaining() {
+  bool expiration_set = false;
+  int seconds_remaining = 0;
+
+  current_test = "expires remaining: max-age less the Age header";
+  const char * max_age[] = {"Date", DATE, "Cache-Control", "max-age=3600",
+                            "Age", "600", NULL};
+  CachePolicy policy = Policy(200, max_age);
+  CHECK(policy.ExpiresRemaining(expiration_set, seconds_remaining));
+  CHECK(expiration_set);
+  CHECK(seconds_remaining == 3000);
+
+  current_test = "expires remaining: no-store is not cacheable";
+  const char * no_store[] = {"Cache-Control", "no-store, max-age=3600", NULL};
+  policy = Policy(200, no_store);
+  CHECK(!policy.ExpiresRemaining(expiration_set, seconds_remaining));
+  CHECK(!expiration_set);
+
+  current_test = "expires remaining: Expires in the past";
+  const char * expired[] = {"Date", DATE,
+                            "Expires", "Sat, 05 Nov 1994 08:49:37 GMT", NULL};
+  policy = Policy(200, expired);
+  CHECK(!policy.ExpiresRemaining(expiration_set, seconds_remaining));
+
+  current_test = "expires remaining: no explicit lifetime";
+  const char * none[] = {"Content-Type", "text/css", NULL};
+  policy = Policy(200, none);
+  CHECK(policy.ExpiresRemaining(expiration_set, seconds_remaining));
+  CHECK(!expiration_set);
+  CHECK(seconds_remaining == 0);
+}
+
+/*-----------------------------------------------------------------------------
+-----------------------------------------------------------------------------*/
+int main() {
+  TestHttpDates();
+  TestDirectives();
+  TestExplicitFreshness();
+  TestAge();
+  TestHeuristic();
+  TestRevalidation();
+  TestExpiresRemaining();
+  printf("%d checks, %d failed\n", checks, failures);
+  return failures ? 1 : 0;
+}
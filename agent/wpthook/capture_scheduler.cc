@@ -0,0 +1,205 @@
+/******************************************************************************
+Copyright (c) 2013, Google Inc.
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without 
+modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice, 
+      this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+    * Neither the name of the <ORGANIZATION> nor the names of its contributors 
+    may be used to endorse or promote products derived from this software 
+    without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE 
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE 
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL 
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR 
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER 
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, 
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE 
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+******************************************************************************/
+
+#include "StdAfx.h"
+#include "capture_scheduler.h"
+
+static const DWORD CAPTURE_MIN_INTERVAL = 50;     // max 20 frames/sec
+static const DWORD CAPTURE_COALESCE_TIME = 10;    // gather a paint burst
+static const DWORD TIMED_INTERVAL = 100;          // full frames, slowing
+static const DWORD TIMED_INCREMENTS = 200;        // down as the test runs
+
+/*-----------------------------------------------------------------------------
+-----------------------------------------------------------------------------*/
+CaptureScheduler::CaptureScheduler(void):
+  ms_frequency_(1)
+  ,timer_(NULL)
+  ,timer_period_(0) {
+  InitializeCriticalSection(&cs_);
+  Reset(1);
+}
+
+/*-----------------------------------------------------------------------------
+-----------------------------------------------------------------------------*/
+CaptureScheduler::~CaptureScheduler(void) {
+  DeleteCriticalSection(&cs_);
+}
+
+/*-----------------------------------------------------------------------------
+-----------------------------------------------------------------------------*/
+void CaptureScheduler::Reset(LONGLONG ms_frequency) {
+  EnterCriticalSection(&cs_);
+  ms_frequency_ = ms_frequency > 0 ? ms_frequency : 1;
+  paint_driven_ = false;
+  pending_ = false;
+  SetRectEmpty(&dirty_);
+  first_paint_ = 0;
+  last_capture_ = 0;
+  frames_ = 0;
+  paint_frames_ = 0;
+  timed_frames_ = 0;
+  paints_ = 0;
+  capture_cpu_100ns_ = 0;
+  latency_count_ = 0;
+  latency_total_ms_ = 0;
+  latency_max_ms_ = 0;
+  LeaveCriticalSection(&cs_);
+}
+
+/*-----------------------------------------------------------------------------
+  Timer-queue timer that captures the video frames (NULL to detach it
+  before it is deleted).
+-----------------------------------------------------------------------------*/
+void CaptureScheduler::AttachTimer(HANDLE timer, DWORD period) {
+  EnterCriticalSection(&cs_);
+  timer_ = timer;
+  timer_period_ = period;
+  LeaveCriticalSection(&cs_);
+}
+
+/*-----------------------------------------------------------------------------
+  Add a painted rectangle (already clipped to the capture area).
+-----------------------------------------------------------------------------*/
+void CaptureScheduler::OnPaint(const RECT& rect, LONGLONG now) {
+  EnterCriticalSection(&cs_);
+  paints_++;
+  paint_driven_ = true;
+  if (pending_) {
+    UnionRect(&dirty_, &dirty_, &rect);
+  } else {
+    dirty_ = rect;
+    first_paint_ = now;
+    pending_ = true;
+    if (timer_)
+      ChangeTimerQueueTimer(NULL, timer_, CaptureDelay(now), timer_period_);
+  }
+  LeaveCriticalSection(&cs_);
+}
+
+/*-----------------------------------------------------------------------------
+  See if a frame should be captured now.  If it should, the pending dirty
+  region is handed off in dirty (full is set when the whole frame needs to
+  be read) along with the time of the oldest paint it covers.
+-----------------------------------------------------------------------------*/
+bool CaptureScheduler::CaptureDue(LONGLONG now, RECT& dirty, bool& full,
+                                  LONGLONG& paint_time) {
+  bool due = false;
+  full = true;
+  paint_time = 0;
+  EnterCriticalSection(&cs_);
+  if (!last_capture_) {
+    due = true;
+  } else {
+    DWORD since_capture = ElapsedMs(last_capture_, now);
+    // the timed full frames are always taken, composited (GPU) content
+    // changes without any GDI paints so paints can only add frames
+    DWORD interval = TIMED_INTERVAL;
+    if (timed_frames_ > TIMED_INCREMENTS * 2)
+      interval *= 20;
+    else if (timed_frames_ > TIMED_INCREMENTS)
+      interval *= 5;
+    if (since_capture >= interval) {
+      due = true;
+      timed_frames_++;
+    } else if (paint_driven_ && pending_ &&
+               since_capture >= CAPTURE_MIN_INTERVAL &&
+               ElapsedMs(first_paint_, now) >= CAPTURE_COALESCE_TIME) {
+      due = true;
+      full = false;
+      dirty = dirty_;
+      paint_frames_++;
+    }
+  }
+  if (due) {
+    if (pending_)
+      paint_time = first_paint_;
+    pending_ = false;
+    SetRectEmpty(&dirty_);
+  }
+  LeaveCriticalSection(&cs_);
+  return due;
+}
+
+/*-----------------------------------------------------------------------------
+  Record a completed capture.
+-----------------------------------------------------------------------------*/
+void CaptureScheduler::OnCapture(LONGLONG now, LONGLONG paint_time,
+                                 LONGLONG cpu_100ns) {
+  EnterCriticalSection(&cs_);
+  last_capture_ = now;
+  frames_++;
+  capture_cpu_100ns_ += cpu_100ns;
+  if (paint_time) {
+    DWORD latency = ElapsedMs(paint_time, now);
+    latency_count_++;
+    latency_total_ms_ += latency;
+    latency_max_ms_ = max(latency_max_ms_, latency);
+  }
+  LeaveCriticalSection(&cs_);
+}
+
+/*-----------------------------------------------------------------------------
+-----------------------------------------------------------------------------*/
+CStringA CaptureScheduler::GetStatsJSON(void) {
+  CStringA json;
+  EnterCriticalSection(&cs_);
+  json.Format("{\"paintDriven\":%s,\"frames\":%u,\"paintFrames\":%u,"
+              "\"timedFrames\":%u,\"paints\":%u,"
+              "\"captureCpuMs\":%I64d,\"paintLatencyAvgMs\":%I64d,"
+              "\"paintLatencyMaxMs\":%u}",
+              paint_driven_ ? "true" : "false", frames_, paint_frames_,
+              timed_frames_, paints_, capture_cpu_100ns_ / 10000,
+              latency_count_ ? latency_total_ms_ / latency_count_ : 0,
+              latency_max_ms_);
+  LeaveCriticalSection(&cs_);
+  return json;
+}
+
+/*-----------------------------------------------------------------------------
+  How long (in ms) until the pending paints can be captured.
+-----------------------------------------------------------------------------*/
+DWORD CaptureScheduler::CaptureDelay(LONGLONG now) const {
+  DWORD since_paint = ElapsedMs(first_paint_, now);
+  DWORD delay = since_paint < CAPTURE_COALESCE_TIME ?
+                CAPTURE_COALESCE_TIME - since_paint : 0;
+  if (last_capture_) {
+    DWORD since_capture = ElapsedMs(last_capture_, now);
+    if (since_capture < CAPTURE_MIN_INTERVAL)
+      delay = max(delay, CAPTURE_MIN_INTERVAL - since_capture);
+  }
+  return max(delay, (DWORD)1);
+}
+
+/*-----------------------------------------------------------------------------
+-----------------------------------------------------------------------------*/
+DWORD CaptureScheduler::ElapsedMs(LONGLONG start, LONGLONG end) const {
+  DWORD elapsed = 0;
+  if (start && end > start)
+    elapsed = (DWORD)((end - start) / ms_frequency_);
+  return elapsed;
+}
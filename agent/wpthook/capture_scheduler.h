@@ -0,0 +1,83 @@
+/******************************************************************************
+Copyright (c) 2013, Google Inc.
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without 
+modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice, 
+      this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+    * Neither the name of the <ORGANIZATION> nor the names of its contributors 
+    may be used to endorse or promote products derived from this software 
+    without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE 
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE 
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL 
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR 
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER 
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, 
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE 
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+******************************************************************************/
+
+#pragma once
+
+/*-----------------------------------------------------------------------------
+  Decides when a video frame should be captured.  Paint notifications from
+  the GDI hooks are coalesced into a single dirty rectangle and captured
+  once the burst settles, no faster than the maximum frame rate.  The
+  timer-driven full frames (with the usual falloff) are always captured
+  as well since GPU-composited content changes without any GDI paints,
+  the paints only get changes on screen sooner.
+
+  OnPaint is called on the browser's UI thread from inside the hooks so it
+  only takes the scheduler's own lock and never blocks on a capture.  The
+  first paint of a burst moves the attached timer up so the capture
+  happens as soon as it is allowed.  All times are QueryPerformanceCounter
+  ticks.
+-----------------------------------------------------------------------------*/
+class CaptureScheduler {
+public:
+  CaptureScheduler(void);
+  ~CaptureScheduler(void);
+
+  void  Reset(LONGLONG ms_frequency);
+  void  AttachTimer(HANDLE timer, DWORD period);
+  void  OnPaint(const RECT& rect, LONGLONG now);
+  bool  CaptureDue(LONGLONG now, RECT& dirty, bool& full,
+                   LONGLONG& paint_time);
+  void  OnCapture(LONGLONG now, LONGLONG paint_time, LONGLONG cpu_100ns);
+  CStringA GetStatsJSON(void);
+
+private:
+  DWORD CaptureDelay(LONGLONG now) const;
+  DWORD ElapsedMs(LONGLONG start, LONGLONG end) const;
+
+  CRITICAL_SECTION cs_;
+  LONGLONG  ms_frequency_;
+  HANDLE    timer_;
+  DWORD     timer_period_;
+
+  // pending paints
+  bool      paint_driven_;    // paints have been seen in the capture area
+  bool      pending_;
+  RECT      dirty_;
+  LONGLONG  first_paint_;     // oldest paint in the pending burst
+  LONGLONG  last_capture_;
+
+  // stats
+  DWORD     frames_;
+  DWORD     paint_frames_;
+  DWORD     timed_frames_;
+  DWORD     paints_;
+  LONGLONG  capture_cpu_100ns_;
+  DWORD     latency_count_;
+  LONGLONG  latency_total_ms_;
+  DWORD     latency_max_ms_;
+};
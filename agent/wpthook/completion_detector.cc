@@ -0,0 +1,198 @@
+/******************************************************************************
+Copyright (c) 2013, Google Inc.
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without 
+modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice, 
+      this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+    * Neither the name of the <ORGANIZATION> nor the names of its contributors 
+    may be used to endorse or promote products derived from this software 
+    without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE 
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE 
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL 
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR 
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER 
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, 
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE 
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+******************************************************************************/
+
+#include "StdAfx.h"
+#include "completion_detector.h"
+
+static const DWORD NETWORK_QUIET_TIME = 500;
+static const DWORD REQUESTS_QUIET_TIME = 100;
+static const DWORD VISUAL_QUIET_TIME = 500;
+static const DWORD CPU_QUIET_TIME = 500;
+static const double CPU_BUSY_THRESHOLD = 15.0;    // percent
+
+static const char * SIGNAL_NAMES[CompletionDetector::SIGNAL_COUNT] = {
+  "network",
+  "requests",
+  "visual",
+  "cpu"
+};
+
+/*-----------------------------------------------------------------------------
+-----------------------------------------------------------------------------*/
+CompletionDetector::CompletionDetector(void) {
+  InitializeCriticalSection(&cs_);
+  Reset(1, NETWORK_QUIET_TIME);
+}
+
+/*-----------------------------------------------------------------------------
+-----------------------------------------------------------------------------*/
+CompletionDetector::~CompletionDetector(void) {
+  DeleteCriticalSection(&cs_);
+}
+
+/*-----------------------------------------------------------------------------
+-----------------------------------------------------------------------------*/
+void CompletionDetector::Reset(LONGLONG ms_frequency, DWORD activity_timeout) {
+  EnterCriticalSection(&cs_);
+  ms_frequency_ = ms_frequency > 0 ? ms_frequency : 1;
+  quiet_ms_[NETWORK] = min(NETWORK_QUIET_TIME, activity_timeout);
+  quiet_ms_[REQUESTS] = REQUESTS_QUIET_TIME;
+  quiet_ms_[VISUAL] = VISUAL_QUIET_TIME;
+  quiet_ms_[CPU] = CPU_QUIET_TIME;
+  for (int i = 0; i < SIGNAL_COUNT; i++) {
+    last_busy_[i] = 0;
+    busy_events_[i] = 0;
+    satisfied_[i] = 0;
+  }
+  limiting_ = -1;
+  complete_ = 0;
+  finished_ = 0;
+  ignored_ = 0;
+  adaptive_ = false;
+  reason_.Empty();
+  LeaveCriticalSection(&cs_);
+}
+
+/*-----------------------------------------------------------------------------
+-----------------------------------------------------------------------------*/
+void CompletionDetector::Busy(SIGNAL signal, LONGLONG now) {
+  if (signal >= 0 && signal < SIGNAL_COUNT) {
+    EnterCriticalSection(&cs_);
+    if (now > last_busy_[signal])
+      last_busy_[signal] = now;
+    busy_events_[signal]++;
+    satisfied_[signal] = 0;
+    LeaveCriticalSection(&cs_);
+  }
+}
+
+/*-----------------------------------------------------------------------------
+  System-wide CPU utilization from the periodic data collection.
+-----------------------------------------------------------------------------*/
+void CompletionDetector::CpuUtilization(double cpu, LONGLONG now) {
+  if (cpu > CPU_BUSY_THRESHOLD)
+    Busy(CPU, now);
+}
+
+/*-----------------------------------------------------------------------------
+  Traffic on a long-lived request.
+-----------------------------------------------------------------------------*/
+void CompletionDetector::Ignored(void) {
+  EnterCriticalSection(&cs_);
+  ignored_++;
+  LeaveCriticalSection(&cs_);
+}
+
+/*-----------------------------------------------------------------------------
+  Have all of the signals been quiet for their windows since the page
+  loaded?
+-----------------------------------------------------------------------------*/
+bool CompletionDetector::IsComplete(LONGLONG loaded, LONGLONG now) {
+  bool complete = true;
+  DWORD longest_wait = 0;
+  EnterCriticalSection(&cs_);
+  for (int i = 0; i < SIGNAL_COUNT; i++) {
+    LONGLONG quiet_start = max(last_busy_[i], loaded);
+    DWORD quiet = ElapsedMs(quiet_start, now);
+    if (quiet >= quiet_ms_[i]) {
+      if (!satisfied_[i])
+        satisfied_[i] = now;
+    } else {
+      complete = false;
+      DWORD wait = quiet_ms_[i] - quiet;
+      if (wait > longest_wait) {
+        limiting_ = i;
+        longest_wait = wait;
+      }
+    }
+  }
+  if (complete && !complete_)
+    complete_ = now;
+  LeaveCriticalSection(&cs_);
+  return complete;
+}
+
+/*-----------------------------------------------------------------------------
+  The step ended (for whatever reason).
+-----------------------------------------------------------------------------*/
+void CompletionDetector::Finish(LONGLONG now, CString reason, bool adaptive) {
+  EnterCriticalSection(&cs_);
+  if (!finished_) {
+    finished_ = now;
+    reason_ = CT2A(reason);
+    reason_.Replace("\\", "\\\\");
+    reason_.Replace("\"", "\\\"");
+    adaptive_ = adaptive;
+  }
+  LeaveCriticalSection(&cs_);
+}
+
+/*-----------------------------------------------------------------------------
+  What each signal contributed to the end of the step (times in ms from
+  the step start, -1 if they never happened).
+-----------------------------------------------------------------------------*/
+CStringA CompletionDetector::GetJSON(LONGLONG step_start) {
+  CStringA json, signals, buff;
+  EnterCriticalSection(&cs_);
+  for (int i = 0; i < SIGNAL_COUNT; i++) {
+    buff.Format("%s\"%s\":{\"quietMs\":%u,\"lastBusyMs\":%I64d,"
+                "\"busyEvents\":%u,\"satisfiedMs\":%I64d}",
+                i ? "," : "", SIGNAL_NAMES[i], quiet_ms_[i],
+                RelativeMs(step_start, last_busy_[i]), busy_events_[i],
+                RelativeMs(step_start, satisfied_[i]));
+    signals += buff;
+  }
+  json.Format("{\"adaptive\":%s,\"reason\":\"%s\",\"endMs\":%I64d,"
+              "\"adaptiveCompleteMs\":%I64d,\"limiting\":\"%s\","
+              "\"ignoredActivity\":%u,\"signals\":{%s}}",
+              adaptive_ ? "true" : "false", (LPCSTR)reason_,
+              RelativeMs(step_start, finished_),
+              RelativeMs(step_start, complete_),
+              limiting_ >= 0 ? SIGNAL_NAMES[limiting_] : "",
+              ignored_, (LPCSTR)signals);
+  LeaveCriticalSection(&cs_);
+  return json;
+}
+
+/*-----------------------------------------------------------------------------
+-----------------------------------------------------------------------------*/
+DWORD CompletionDetector::ElapsedMs(LONGLONG start, LONGLONG end) const {
+  DWORD elapsed = 0;
+  if (start && end > start)
+    elapsed = (DWORD)((end - start) / ms_frequency_);
+  return elapsed;
+}
+
+/*-----------------------------------------------------------------------------
+-----------------------------------------------------------------------------*/
+LONGLONG CompletionDetector::RelativeMs(LONGLONG start, LONGLONG time) const {
+  LONGLONG ms = -1;
+  if (time && start && time >= start)
+    ms = (time - start) / ms_frequency_;
+  return ms;
+}
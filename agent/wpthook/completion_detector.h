@@ -0,0 +1,80 @@
+/******************************************************************************
+Copyright (c) 2013, Google Inc.
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without 
+modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice, 
+      this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+    * Neither the name of the <ORGANIZATION> nor the names of its contributors 
+    may be used to endorse or promote products derived from this software 
+    without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE 
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE 
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL 
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR 
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER 
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, 
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE 
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+******************************************************************************/
+
+#pragma once
+
+/*-----------------------------------------------------------------------------
+  Decides when a loaded page has settled enough to end the step without
+  waiting out the full network activity timeout.  Each signal (network
+  activity, outstanding requests, visual changes and CPU use) reports when
+  it was last busy and is satisfied once it has been quiet for its own
+  window after onload.  Activity on long-lived requests (websockets,
+  server-sent events, ignored beacons) is counted but never makes the
+  network busy.
+
+  The detector only tracks state; TestState::IsDone decides whether the
+  adaptive result is used.  All times are QueryPerformanceCounter ticks.
+-----------------------------------------------------------------------------*/
+class CompletionDetector {
+public:
+  typedef enum {
+    NETWORK,
+    REQUESTS,
+    VISUAL,
+    CPU,
+    SIGNAL_COUNT
+  } SIGNAL;
+
+  CompletionDetector(void);
+  ~CompletionDetector(void);
+
+  void  Reset(LONGLONG ms_frequency, DWORD activity_timeout);
+  void  Busy(SIGNAL signal, LONGLONG now);
+  void  CpuUtilization(double cpu, LONGLONG now);
+  void  Ignored(void);
+  bool  IsComplete(LONGLONG loaded, LONGLONG now);
+  void  Finish(LONGLONG now, CString reason, bool adaptive);
+  CStringA GetJSON(LONGLONG step_start);
+
+private:
+  DWORD ElapsedMs(LONGLONG start, LONGLONG end) const;
+  LONGLONG RelativeMs(LONGLONG start, LONGLONG time) const;
+
+  CRITICAL_SECTION cs_;
+  LONGLONG  ms_frequency_;
+  DWORD     quiet_ms_[SIGNAL_COUNT];
+  LONGLONG  last_busy_[SIGNAL_COUNT];
+  DWORD     busy_events_[SIGNAL_COUNT];
+  LONGLONG  satisfied_[SIGNAL_COUNT];   // when the current quiet run was met
+  int       limiting_;                  // signal that last held things up
+  LONGLONG  complete_;                  // first time all signals were quiet
+  LONGLONG  finished_;
+  DWORD     ignored_;
+  bool      adaptive_;
+  CStringA  reason_;
+};
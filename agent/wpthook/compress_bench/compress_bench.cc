@@ -0,0 +1,218 @@
+/******************************************************************************
+Copyright (c) 2013, Google Inc.
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without 
+modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice, 
+      this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+    * Neither the name of the <ORGANIZATION> nor the names of its contributors 
+    may be used to endorse or promote products derived from this software 
+    without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE 
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE 
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL 
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR 
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER 
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, 
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE 
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+******************************************************************************/
+
+// Compares the sampled gzip estimate with real compression for accuracy and
+// time, and shows how many bodies CheckGzip no longer has to compress.
+// Brotli and zstd sizes are included when built with WPT_BROTLI / WPT_ZSTD.
+//
+//   compress_bench [-v] <file or directory>...
+#include "../compress_savings.h"
+#include <dirent.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <string>
+#include <vector>
+
+static const int TIMING_RUNS = 3;     // best of
+// CheckGzip's bar: at least 10% and 1400 bytes saved, bodies over 1400 bytes
+static const size_t MIN_BYTES = 1400;
+static const double MAX_RATIO = 0.9;
+
+/*-----------------------------------------------------------------------------
+-----------------------------------------------------------------------------*/
+static double NowMs() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+/*-----------------------------------------------------------------------------
+-----------------------------------------------------------------------------*/
+static bool ReadFile(const std::string& path, std::vector<unsigned char>& data) {
+  bool ok = false;
+  FILE * file = fopen(path.c_str(), "rb");
+  if (file) {
+    fseek(file, 0, SEEK_END);
+    long len = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    if (len > 0) {
+      data.resize(len);
+      ok = fread(&data[0], 1, len, file) == (size_t)len;
+    }
+    fclose(file);
+  }
+  return ok;
+}
+
+/*-----------------------------------------------------------------------------
+-----------------------------------------------------------------------------*/
+static void AddPath(const std::string& path, std::vector<std::string>& files) {
+  struct stat info;
+  if (stat(path.c_str(), &info))
+    return;
+  if (S_ISDIR(info.st_mode)) {
+    DIR * dir = opendir(path.c_str());
+    if (dir) {
+      struct dirent * entry;
+      while ((entry = readdir(dir)) != NULL) {
+        if (entry->d_name[0] != '.')
+          AddPath(path + "/" + entry->d_name, files);
+      }
+      closedir(dir);
+    }
+  } else {
+    files.push_back(path);
+  }
+}
+
+static bool Passes(size_t original, size_t compressed) {
+  return compressed < original * MAX_RATIO &&
+         original - compressed >= MIN_BYTES;
+}
+
+/*-----------------------------------------------------------------------------
+-----------------------------------------------------------------------------*/
+int main(int argc, char ** argv) {
+  bool verbose = false;
+  std::vector<std::string> files;
+  for (int i = 1; i < argc; i++) {
+    if (!strcmp(argv[i], "-v"))
+      verbose = true;
+    else
+      AddPath(argv[i], files);
+  }
+  if (files.empty()) {
+    fprintf(stderr, "usage: compress_bench [-v] <file or directory>...\n");
+    return 1;
+  }
+
+  std::vector<std::vector<unsigned char> > bodies;
+  for (size_t i = 0; i < files.size(); i++) {
+    std::vector<unsigned char> data;
+    if (ReadFile(files[i], data) && data.size() >= MIN_BYTES)
+      bodies.push_back(data);
+    else
+      files.erase(files.begin() + i--);
+  }
+
+  size_t count = bodies.size(), skipped = 0, false_skips = 0, passing = 0;
+  double error_sum = 0, error_max = 0;
+  size_t totals[COMPRESS_CODEC_COUNT] = {0};
+  size_t original_total = 0;
+  if (verbose)
+    printf("%-40s %10s %10s %10s %10s %10s\n", "file", "bytes", "estimate",
+           "gzip", "br", "zstd");
+  for (size_t i = 0; i < count; i++) {
+    const unsigned char * data = &bodies[i][0];
+    size_t len = bodies[i].size();
+    size_t estimate = CompressEstimateSize(data, len);
+    size_t minimum = CompressEstimateMinSize(data, len);
+    size_t sizes[COMPRESS_CODEC_COUNT];
+    for (int codec = 0; codec < COMPRESS_CODEC_COUNT; codec++) {
+      sizes[codec] = CompressedSize((CompressCodec)codec, data, len);
+      totals[codec] += sizes[codec] ? sizes[codec] : len;
+    }
+    original_total += len;
+    double error = fabs((double)estimate - (double)sizes[COMPRESS_GZIP]) *
+                   100.0 / (double)len;
+    error_sum += error;
+    if (error > error_max)
+      error_max = error;
+    bool passes = Passes(len, sizes[COMPRESS_GZIP]);
+    if (passes)
+      passing++;
+    if (!Passes(len, minimum)) {
+      skipped++;
+      if (passes) {
+        false_skips++;
+        printf("false skip: %s (%lu -> %lu, estimate %lu)\n", files[i].c_str(),
+               (unsigned long)len, (unsigned long)sizes[COMPRESS_GZIP],
+               (unsigned long)estimate);
+      }
+    }
+    if (verbose) {
+      std::string name = files[i];
+      if (name.length() > 40)
+        name = name.substr(name.length() - 40);
+      printf("%-40s %10lu %10lu %10lu %10lu %10lu\n", name.c_str(),
+             (unsigned long)len, (unsigned long)estimate,
+             (unsigned long)sizes[COMPRESS_GZIP],
+             (unsigned long)sizes[COMPRESS_BROTLI],
+             (unsigned long)sizes[COMPRESS_ZSTD]);
+    }
+  }
+
+  // Old: gzip every body.  New: estimate every body and gzip the rest.
+  double old_ms = 0, new_ms = 0, estimate_ms = 0;
+  for (int run = 0; run < TIMING_RUNS; run++) {
+    double start = NowMs();
+    for (size_t i = 0; i < count; i++)
+      CompressedSize(COMPRESS_GZIP, &bodies[i][0], bodies[i].size());
+    double elapsed = NowMs() - start;
+    if (!run || elapsed < old_ms)
+      old_ms = elapsed;
+
+    start = NowMs();
+    for (size_t i = 0; i < count; i++)
+      CompressEstimateMinSize(&bodies[i][0], bodies[i].size());
+    elapsed = NowMs() - start;
+    if (!run || elapsed < estimate_ms)
+      estimate_ms = elapsed;
+
+    start = NowMs();
+    for (size_t i = 0; i < count; i++) {
+      const unsigned char * data = &bodies[i][0];
+      size_t len = bodies[i].size();
+      if (Passes(len, CompressEstimateMinSize(data, len)))
+        CompressedSize(COMPRESS_GZIP, data, len);
+    }
+    elapsed = NowMs() - start;
+    if (!run || elapsed < new_ms)
+      new_ms = elapsed;
+  }
+
+  printf("\n%lu bodies, %lu worth compressing, %lu skipped by the estimate "
+         "(%lu wrongly)\n", (unsigned long)count, (unsigned long)passing,
+         (unsigned long)skipped, (unsigned long)false_skips);
+  printf("estimate error (%% of body size): mean %.2f, max %.2f\n",
+         count ? error_sum / count : 0.0, error_max);
+  printf("total bytes: original %lu", (unsigned long)original_total);
+  for (int codec = 0; codec < COMPRESS_CODEC_COUNT; codec++) {
+    if (CompressCodecAvailable((CompressCodec)codec))
+      printf(", %s %lu", CompressCodecName((CompressCodec)codec),
+             (unsigned long)totals[codec]);
+  }
+  printf("\ntime (best of %d): gzip all %.1fms, estimate all %.1fms, "
+         "estimate + gzip %.1fms (%.1fx faster)\n", TIMING_RUNS, old_ms,
+         estimate_ms, new_ms, new_ms > 0 ? old_ms / new_ms : 0.0);
+  return 0;
+}
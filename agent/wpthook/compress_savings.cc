@@ -0,0 +1,272 @@
+/******************************************************************************
+Copyright (c) 2013, Google Inc.
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without 
+modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice, 
+      this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+    * Neither the name of the <ORGANIZATION> nor the names of its contributors 
+    may be used to endorse or promote products derived from this software 
+    without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE 
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE 
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL 
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR 
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER 
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, 
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE 
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+******************************************************************************/
+
+// No precompiled header, this file has to build without the Windows SDK
+#include "compress_savings.h"
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <zlib.h>
+#ifdef WPT_BROTLI
+#include <brotli/encode.h>
+#endif
+#ifdef WPT_ZSTD
+#include <zstd.h>
+#endif
+
+// Bodies up to SAMPLE_WINDOWS windows are parsed completely, larger ones
+// are sampled (a window is deflate's 32KB history)
+static const size_t SAMPLE_WINDOW = 32768;
+static const size_t SAMPLE_WINDOWS = 4;
+static const int    SAMPLE_HASH_BITS = 12;
+static const size_t SAMPLE_HASH_WAYS = 4;
+// Dynamic Huffman table for each deflate block
+static const double BLOCK_HEADER_BITS = 600.0;
+// Worst case error as a fraction of the body size
+static const double ESTIMATE_MARGIN = 0.08;
+
+// Levels a typical static-asset build would use (not the slowest settings)
+static const int GZIP_LEVEL = 7;
+static const int BROTLI_QUALITY = 9;
+static const int ZSTD_LEVEL = 15;
+
+static const char * codec_names[COMPRESS_CODEC_COUNT] =
+    {"gzip", "br", "zstd"};
+
+/*-----------------------------------------------------------------------------
+  Approximate cost in bits of one deflate match (length and distance codes
+  plus their extra bits), calibrated against zlib level 7 with compress_bench
+-----------------------------------------------------------------------------*/
+static inline double MatchBits(size_t distance, size_t length) {
+  int distance_bits = 0;
+  while (distance > 4) {
+    distance >>= 1;
+    distance_bits++;
+  }
+  int length_bits = 0;
+  if (length > 10) {
+    length_bits = 1;
+    length -= 3;
+    while (length > 16) {
+      length >>= 1;
+      length_bits++;
+    }
+  }
+  // Huffman-coded length (~4 bits) and distance (~5 bits) symbols
+  return 9.0 + length_bits + distance_bits;
+}
+
+/*-----------------------------------------------------------------------------
+  Hash of the 4 bytes at p
+-----------------------------------------------------------------------------*/
+static inline size_t Hash4(const unsigned char * p) {
+  unsigned long value = (unsigned long)p[0] | ((unsigned long)p[1] << 8) |
+                        ((unsigned long)p[2] << 16) |
+                        ((unsigned long)p[3] << 24);
+  return (size_t)(((value * 2654435761UL) & 0xFFFFFFFFUL) >>
+                  (32 - SAMPLE_HASH_BITS));
+}
+
+/*-----------------------------------------------------------------------------
+  Remember position i (stored +1 so 0 is empty), most recent first
+-----------------------------------------------------------------------------*/
+static inline void Insert(unsigned short * bucket, size_t i) {
+  for (size_t way = SAMPLE_HASH_WAYS - 1; way > 0; way--)
+    bucket[way] = bucket[way - 1];
+  bucket[0] = (unsigned short)(i + 1);
+}
+
+/*-----------------------------------------------------------------------------
+  Greedy LZ77 parse of one window, returns the estimated deflate bits
+-----------------------------------------------------------------------------*/
+static double EstimateWindowBits(const unsigned char * p, size_t n,
+                                 unsigned short * table) {
+  memset(table, 0, (SAMPLE_HASH_WAYS << SAMPLE_HASH_BITS) *
+                   sizeof(unsigned short));
+  unsigned long histogram[256];
+  memset(histogram, 0, sizeof(histogram));
+  size_t literals = 0;
+  double match_bits = 0;
+
+  size_t i = 0;
+  while (i + 4 <= n) {
+    unsigned short * bucket = table + Hash4(p + i) * SAMPLE_HASH_WAYS;
+    size_t length = 0, distance = 0;
+    for (size_t way = 0; way < SAMPLE_HASH_WAYS && bucket[way]; way++) {
+      const unsigned char * match = p + bucket[way] - 1;
+      size_t len = 0;
+      while (i + len < n && len < 258 && match[len] == p[i + len])
+        len++;
+      if (len >= 4 && len > length) {
+        length = len;
+        distance = (p + i) - match;
+      }
+    }
+    Insert(bucket, i);
+    if (length) {
+      match_bits += MatchBits(distance, length);
+      // index the positions inside the match like deflate does
+      size_t end = i + length;
+      for (i++; i < end && i + 4 <= n; i++)
+        Insert(table + Hash4(p + i) * SAMPLE_HASH_WAYS, i);
+      i = end;
+    } else {
+      histogram[p[i]]++;
+      literals++;
+      i++;
+    }
+  }
+  for (; i < n; i++) {
+    histogram[p[i]]++;
+    literals++;
+  }
+
+  double literal_bits = 0;
+  if (literals) {
+    for (int symbol = 0; symbol < 256; symbol++) {
+      if (histogram[symbol]) {
+        double count = (double)histogram[symbol];
+        literal_bits -= count * log(count / (double)literals);
+      }
+    }
+    literal_bits /= log(2.0);
+  }
+  return literal_bits + match_bits + BLOCK_HEADER_BITS;
+}
+
+/*-----------------------------------------------------------------------------
+  Estimated gzip size from a sampled LZ parse
+-----------------------------------------------------------------------------*/
+size_t CompressEstimateSize(const unsigned char * buff, size_t len) {
+  if (!buff || !len)
+    return 0;
+  unsigned short * table = (unsigned short *)malloc(
+      (SAMPLE_HASH_WAYS << SAMPLE_HASH_BITS) * sizeof(unsigned short));
+  if (!table)
+    return len;
+
+  double bits = 0;
+  size_t sampled = 0;
+  if (len <= SAMPLE_WINDOW * SAMPLE_WINDOWS) {
+    for (size_t offset = 0; offset < len; offset += SAMPLE_WINDOW) {
+      size_t n = len - offset < SAMPLE_WINDOW ? len - offset : SAMPLE_WINDOW;
+      bits += EstimateWindowBits(buff + offset, n, table);
+    }
+    sampled = len;
+  } else {
+    size_t stride = (len - SAMPLE_WINDOW) / (SAMPLE_WINDOWS - 1);
+    for (size_t window = 0; window < SAMPLE_WINDOWS; window++) {
+      bits += EstimateWindowBits(buff + window * stride, SAMPLE_WINDOW, table);
+      sampled += SAMPLE_WINDOW;
+    }
+  }
+  free(table);
+
+  double estimate = bits / 8.0 * ((double)len / (double)sampled);
+  return (size_t)estimate + 6;
+}
+
+/*-----------------------------------------------------------------------------
+  Smallest size the body could realistically compress to
+-----------------------------------------------------------------------------*/
+size_t CompressEstimateMinSize(const unsigned char * buff, size_t len) {
+  size_t estimate = CompressEstimateSize(buff, len);
+  size_t margin = (size_t)(len * ESTIMATE_MARGIN);
+  return estimate > margin ? estimate - margin : 0;
+}
+
+/*-----------------------------------------------------------------------------
+  Actual compressed size with the given codec
+-----------------------------------------------------------------------------*/
+size_t CompressedSize(CompressCodec codec, const unsigned char * buff,
+                      size_t len) {
+  size_t compressed = 0;
+  if (!buff || !len)
+    return compressed;
+  switch (codec) {
+    case COMPRESS_GZIP: {
+        uLongf out_len = compressBound((uLong)len);
+        unsigned char * out = (unsigned char *)malloc(out_len);
+        if (out) {
+          if (compress2(out, &out_len, buff, (uLong)len, GZIP_LEVEL) == Z_OK)
+            compressed = out_len;
+          free(out);
+        }
+      }
+      break;
+#ifdef WPT_BROTLI
+    case COMPRESS_BROTLI: {
+        size_t out_len = BrotliEncoderMaxCompressedSize(len);
+        unsigned char * out = out_len ? (unsigned char *)malloc(out_len) : 0;
+        if (out) {
+          if (BrotliEncoderCompress(BROTLI_QUALITY, BROTLI_DEFAULT_WINDOW,
+                                    BROTLI_MODE_TEXT, len, buff, &out_len,
+                                    out))
+            compressed = out_len;
+          free(out);
+        }
+      }
+      break;
+#endif
+#ifdef WPT_ZSTD
+    case COMPRESS_ZSTD: {
+        size_t out_len = ZSTD_compressBound(len);
+        unsigned char * out = (unsigned char *)malloc(out_len);
+        if (out) {
+          size_t ret = ZSTD_compress(out, out_len, buff, len, ZSTD_LEVEL);
+          if (!ZSTD_isError(ret))
+            compressed = ret;
+          free(out);
+        }
+      }
+      break;
+#endif
+    default:
+      break;
+  }
+  return compressed;
+}
+
+bool CompressCodecAvailable(CompressCodec codec) {
+  switch (codec) {
+    case COMPRESS_GZIP: return true;
+#ifdef WPT_BROTLI
+    case COMPRESS_BROTLI: return true;
+#endif
+#ifdef WPT_ZSTD
+    case COMPRESS_ZSTD: return true;
+#endif
+    default: return false;
+  }
+}
+
+const char * CompressCodecName(CompressCodec codec) {
+  if (codec >= 0 && codec < COMPRESS_CODEC_COUNT)
+    return codec_names[codec];
+  return "";
+}
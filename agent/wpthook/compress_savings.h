@@ -0,0 +1,60 @@
+/******************************************************************************
+Copyright (c) 2013, Google Inc.
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without 
+modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice, 
+      this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+    * Neither the name of the <ORGANIZATION> nor the names of its contributors 
+    may be used to endorse or promote products derived from this software 
+    without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE 
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE 
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL 
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR 
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER 
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, 
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE 
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+******************************************************************************/
+
+#pragma once
+// Portable (no Win32/ATL, no precompiled header) compression savings.
+// Gzip uses the zlib wpthook ships with.  Brotli and zstd are only for
+// compress_bench (built with WPT_BROTLI / WPT_ZSTD), neither library is
+// part of the agent build so the agent only measures gzip.
+#include <stddef.h>
+
+enum CompressCodec {
+  COMPRESS_GZIP = 0,
+  COMPRESS_BROTLI,
+  COMPRESS_ZSTD,
+  COMPRESS_CODEC_COUNT
+};
+
+/*-----------------------------------------------------------------------------
+  Fast estimate of the gzip (deflate) size of a body.
+
+  A greedy LZ77 parse (4-way hash buckets) over a few evenly spaced sample windows
+  counts the literals and matches and the literal entropy; the result is
+  scaled up to the full body.  It is several times faster than deflate so
+  bodies that are clearly incompressible (or would save too little to
+  matter) can be ruled out without compressing them.  The minimum size
+  allows for the worst estimate error seen in compress_bench.
+-----------------------------------------------------------------------------*/
+size_t CompressEstimateSize(const unsigned char * buff, size_t len);
+size_t CompressEstimateMinSize(const unsigned char * buff, size_t len);
+
+// Real compressed size of the body (0 if the codec is not built in or fails)
+size_t CompressedSize(CompressCodec codec, const unsigned char * buff,
+                      size_t len);
+bool CompressCodecAvailable(CompressCodec codec);
+const char * CompressCodecName(CompressCodec codec);
@@ -52,6 +52,7 @@ DevTools::~DevTools(void) {
 void DevTools::Reset() {
   EnterCriticalSection(&cs_);
   events_.RemoveAll();
+  raw_events_.Reset();
   LeaveCriticalSection(&cs_);
 }
 
@@ -87,7 +88,8 @@ CStringA DevTools::GetUsedHeap() {
 bool DevTools::Write(CString file) {
   bool ok = false;
   EnterCriticalSection(&cs_);
-  if (!events_.IsEmpty()) {
+  size_t raw_count = raw_events_.GetCount();
+  if (!events_.IsEmpty() || raw_count) {
     HANDLE file_handle = CreateFile(file, GENERIC_WRITE, 0, 0,
                                     CREATE_ALWAYS, 0, 0);
     if (file_handle != INVALID_HANDLE_VALUE) {
@@ -106,6 +108,16 @@ bool DevTools::Write(CString file) {
           first = false;
         }
       }
+      for (size_t i = 0; i < raw_count; i++) {
+        const char * data;
+        size_t len;
+        if (raw_events_.GetEvent(i, data, len) && len) {
+          if (!first)
+            WriteFile(file_handle, ",", 1, &bytes_written, 0);
+          WriteFile(file_handle, data, (DWORD)len, &bytes_written, 0);
+          first = false;
+        }
+      }
       WriteFile(file_handle, "]", 1, &bytes_written, 0);
       CloseHandle(file_handle);
     }
@@ -186,16 +198,15 @@ void DevTools::RequestStart(double id, CStringA pageUrl, CStringA url,
 }
 
 /*-----------------------------------------------------------------------------
-  Add raw dev tools events from a webkit browser that supports them.
-  This disables the synthetic events and just records whatever the browser
-  provides;
+  Raw dev tools events are arriving from a webkit browser that supports
+  them (straight into Raw()).  This disables the synthetic events and just
+  records whatever the browser provides;
 -----------------------------------------------------------------------------*/
-void DevTools::AddRawEvents(CStringA data) {
+void DevTools::UseRawEvents(void) {
   EnterCriticalSection(&cs_);
   if (!using_raw_events_) {
     events_.RemoveAll();
     using_raw_events_ = true;
   }
-  events_.AddTail(data);
   LeaveCriticalSection(&cs_);
 }
\ No newline at end of file
@@ -26,6 +26,8 @@ OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
 OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 ******************************************************************************/
 #pragma once
+#include "raw_events.h"
+
 class DevTools {
 public:
   DevTools(void);
@@ -34,7 +36,8 @@ public:
   void Reset();
   bool Write(CString file);
   void SetStartTime(LARGE_INTEGER &start_time);
-  void AddRawEvents(CStringA data);
+  RawEvents& Raw(void) { return raw_events_; }
+  void UseRawEvents(void);
   void AddEvent(LPCSTR method, CStringA data, bool at_head = false);
   void RequestStart(double id, CStringA pageUrl, CStringA url, CStringA method,
                     CAtlArray<CString> &headers);
@@ -45,6 +48,7 @@ private:
 
   CRITICAL_SECTION cs_;
   CAtlList<CStringA> events_;
+  RawEvents     raw_events_;
   LARGE_INTEGER start_time_;
   long double counters_per_ms_;
   bool  using_raw_events_;
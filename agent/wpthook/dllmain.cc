@@ -30,6 +30,7 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include "stdafx.h"
 #include "wpthook.h"
 #include "shared_mem.h"
+#include "hook_profiler.h"
 
 HINSTANCE global_dll_handle = NULL; // DLL handle
 extern WptHook * global_hook;
@@ -92,8 +93,10 @@ BOOL APIENTRY DllMain( HMODULE hModule,
           }
         }
       } break;
-    case DLL_THREAD_ATTACH:
     case DLL_THREAD_DETACH:
+      global_hook_profiler.ThreadExit();
+      // fall through
+    case DLL_THREAD_ATTACH:
     case DLL_PROCESS_DETACH:
       if (global_hook) {
         global_hook->FlushLogs();
@@ -0,0 +1,150 @@
+/******************************************************************************
+Copyright (c) 2013, Google Inc.
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without 
+modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice, 
+      this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+    * Neither the name of the <ORGANIZATION> nor the names of its contributors 
+    may be used to endorse or promote products derived from this software 
+    without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE 
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE 
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL 
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR 
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER 
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, 
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE 
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+******************************************************************************/
+
+// No precompiled header, this file has to build without the Windows SDK
+#include "dns_index.h"
+
+/*-----------------------------------------------------------------------------
+-----------------------------------------------------------------------------*/
+DnsLookupIndex::DnsLookupIndex(void) {
+}
+
+/*-----------------------------------------------------------------------------
+-----------------------------------------------------------------------------*/
+DnsLookupIndex::~DnsLookupIndex(void) {
+}
+
+/*-----------------------------------------------------------------------------
+  Lookups almost always arrive in start order so the sorted inserts only
+  need to look at the last entry or two.
+-----------------------------------------------------------------------------*/
+void DnsLookupIndex::Add(const std::string& host, DnsLookup * lookup) {
+  if (!lookup)
+    return;
+  HostLookups& lookups = hosts_[host];
+  size_t index = lookups.lookups_.size();
+  while (index > lookups.claimed_ &&
+         lookups.lookups_[index - 1]->start_ > lookup->start_)
+    index--;
+  lookups.lookups_.insert(lookups.lookups_.begin() + index, lookup);
+
+  index = starts_.size();
+  while (index && starts_[index - 1] > lookup->start_)
+    index--;
+  starts_.insert(starts_.begin() + index, lookup->start_);
+}
+
+/*-----------------------------------------------------------------------------
+  All of the completed lookups for the host before the given time are
+  claimed and the most recent one is returned.
+-----------------------------------------------------------------------------*/
+bool DnsLookupIndex::Claim(const std::string& host, int64_t before,
+                           int64_t& start, int64_t& end) {
+  bool is_claimed = false;
+  std::map<std::string, HostLookups>::iterator it = hosts_.find(host);
+  if (it != hosts_.end()) {
+    HostLookups& lookups = it->second;
+    bool settled = true;
+    size_t count = lookups.lookups_.size();
+    for (size_t i = lookups.claimed_;
+         i < count && lookups.lookups_[i]->start_ <= before; i++) {
+      DnsLookup * lookup = lookups.lookups_[i];
+      if (!lookup->accounted_for_ && lookup->success_ &&
+          lookup->end_ <= before) {
+        lookup->accounted_for_ = true;
+        is_claimed = true;
+        start = lookup->start_;
+        end = lookup->end_;
+      }
+      // move the cursor past lookups that are claimed or that failed
+      if (settled) {
+        if (lookup->accounted_for_ || (lookup->end_ && !lookup->success_))
+          lookups.claimed_ = i + 1;
+        else
+          settled = false;
+      }
+    }
+  }
+  return is_claimed;
+}
+
+/*-----------------------------------------------------------------------------
+-----------------------------------------------------------------------------*/
+void DnsLookupIndex::ClaimAll(void) {
+  std::map<std::string, HostLookups>::iterator it;
+  for (it = hosts_.begin(); it != hosts_.end(); ++it) {
+    HostLookups& lookups = it->second;
+    for (size_t i = 0; i < lookups.lookups_.size(); i++)
+      lookups.lookups_[i]->accounted_for_ = true;
+    lookups.claimed_ = lookups.lookups_.size();
+  }
+}
+
+/*-----------------------------------------------------------------------------
+  Earliest successful lookup for the host (claimed or not)
+-----------------------------------------------------------------------------*/
+const DnsLookup * DnsLookupIndex::FindSuccessful(
+    const std::string& host) const {
+  const DnsLookup * found = NULL;
+  std::map<std::string, HostLookups>::const_iterator it = hosts_.find(host);
+  if (it != hosts_.end()) {
+    const HostLookups& lookups = it->second;
+    for (size_t i = 0; i < lookups.lookups_.size() && !found; i++)
+      if (lookups.lookups_[i]->success_)
+        found = lookups.lookups_[i];
+  }
+  return found;
+}
+
+/*-----------------------------------------------------------------------------
+  Earliest start time of a lookup at or after the given time (0 if none)
+-----------------------------------------------------------------------------*/
+int64_t DnsLookupIndex::GetEarliest(int64_t after) const {
+  int64_t earliest = 0;
+  size_t low = 0;
+  size_t high = starts_.size();
+  while (low < high) {
+    size_t mid = low + (high - low) / 2;
+    if (starts_[mid] < after)
+      low = mid + 1;
+    else
+      high = mid;
+  }
+  while (low < starts_.size() && !earliest) {
+    earliest = starts_[low];
+    low++;
+  }
+  return earliest;
+}
+
+/*-----------------------------------------------------------------------------
+-----------------------------------------------------------------------------*/
+void DnsLookupIndex::Reset(void) {
+  hosts_.clear();
+  starts_.clear();
+}
@@ -0,0 +1,86 @@
+/******************************************************************************
+Copyright (c) 2013, Google Inc.
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without 
+modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice, 
+      this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+    * Neither the name of the <ORGANIZATION> nor the names of its contributors 
+    may be used to endorse or promote products derived from this software 
+    without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE 
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE 
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL 
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR 
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER 
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, 
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE 
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+******************************************************************************/
+
+#pragma once
+// Portable (no precompiled header) so the lookup matching can be
+// benchmarked on Linux (dns_index_bench).
+#include <stddef.h>
+#include <stdint.h>
+#include <map>
+#include <string>
+#include <vector>
+
+// Timing for one tracked lookup (QueryPerformanceCounter ticks)
+class DnsLookup {
+public:
+  DnsLookup():
+    start_(0)
+    , end_(0)
+    , success_(false)
+    , accounted_for_(false) {}
+
+  int64_t start_;
+  int64_t end_;     // 0 until the lookup completes
+  bool    success_;
+  bool    accounted_for_;
+};
+
+/*-----------------------------------------------------------------------------
+  Tracked lookups indexed by host name so a connection can claim its lookup
+  without walking every lookup in the test.  Each host keeps its lookups in
+  start order with a cursor past the ones that are already claimed (or
+  failed and never can be), and the start times of all of them are kept
+  sorted for GetEarliest.  The lookups are owned by the caller and have to
+  outlive the index (until Reset).  Not thread safe, TrackDns holds its
+  lock around every call.
+-----------------------------------------------------------------------------*/
+class DnsLookupIndex {
+public:
+  DnsLookupIndex(void);
+  ~DnsLookupIndex(void);
+
+  void Add(const std::string& host, DnsLookup * lookup);
+  bool Claim(const std::string& host, int64_t before, int64_t& start,
+             int64_t& end);
+  void ClaimAll(void);
+  const DnsLookup * FindSuccessful(const std::string& host) const;
+  int64_t GetEarliest(int64_t after) const;
+  size_t GetCount(void) const { return starts_.size(); }
+  void Reset(void);
+
+private:
+  class HostLookups {
+  public:
+    HostLookups():claimed_(0){}
+    std::vector<DnsLookup *>  lookups_;
+    size_t                    claimed_;
+  };
+
+  std::map<std::string, HostLookups>  hosts_;
+  std::vector<int64_t>                starts_;  // sorted
+};
@@ -0,0 +1,243 @@
+/******************************************************************************
+Copyright (c) 2013, Google Inc.
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without 
+modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice, 
+      this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+    * Neither the name of the <ORGANIZATION> nor the names of its contributors 
+    may be used to endorse or promote products derived from this software 
+    without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE 
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE 
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL 
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR 
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER 
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, 
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE 
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+******************************************************************************/
+
+// How connection claiming scales with the number of DNS lookups in a test.
+// Compares DnsLookupIndex against walking every lookup on every claim (what
+// TrackDns::Claim, Find and GetEarliest used to do) for a page with up to
+// 5,000 lookups and one claim, find and earliest-lookup query per
+// connection, and checks that both hand out exactly the same lookups.
+//
+//   dns_index_bench [lookups]
+#include "../dns_index.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+static const int TIMING_RUNS = 5;       // best of
+static const int LOOKUPS_PER_HOST = 5;  // re-resolves, prefetches, retries
+static const int FAILED_PERCENT = 5;
+
+/*-----------------------------------------------------------------------------
+-----------------------------------------------------------------------------*/
+static double NowMs() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+class BenchLookup : public DnsLookup {
+public:
+  std::string host_;
+};
+
+class BenchConnection {
+public:
+  std::string host_;
+  int64_t     time_;
+};
+
+class BenchPage {
+public:
+  std::vector<BenchLookup>      lookups_;   // in start order
+  std::vector<BenchConnection>  connections_;
+};
+
+/*-----------------------------------------------------------------------------
+  Lookups spread over the page load (ticks are microseconds here) and a
+  connection to a random host after each one
+-----------------------------------------------------------------------------*/
+static void MakePage(size_t count, BenchPage& page) {
+  srand(1);
+  size_t hosts = count / LOOKUPS_PER_HOST;
+  if (!hosts)
+    hosts = 1;
+  page.lookups_.resize(count);
+  page.connections_.resize(count);
+  char buff[64];
+  int64_t now = 1000000;
+  for (size_t i = 0; i < count; i++) {
+    BenchLookup& lookup = page.lookups_[i];
+    snprintf(buff, sizeof(buff), "host%d.cdn%d.example.com",
+             (int)(i % hosts), (int)(i % 7));
+    lookup.host_ = buff;
+    now += rand() % 2000;
+    lookup.start_ = now;
+    lookup.end_ = now + 1000 + rand() % 50000;
+    lookup.success_ = rand() % 100 >= FAILED_PERCENT;
+
+    BenchConnection& connection = page.connections_[i];
+    snprintf(buff, sizeof(buff), "host%d.cdn%d.example.com",
+             (int)(rand() % hosts), (int)(i % 7));
+    connection.host_ = buff;
+    connection.time_ = now + rand() % 100000;
+  }
+}
+
+static void ResetClaims(BenchPage& page) {
+  for (size_t i = 0; i < page.lookups_.size(); i++)
+    page.lookups_[i].accounted_for_ = false;
+}
+
+/*-----------------------------------------------------------------------------
+  The previous TrackDns: every call walks all of the lookups.  (They are
+  walked in start order instead of hash order so the answers can be
+  compared exactly.)
+-----------------------------------------------------------------------------*/
+static bool ScanClaim(BenchPage& page, const std::string& host,
+                      int64_t before, int64_t& start, int64_t& end) {
+  bool is_claimed = false;
+  for (size_t i = 0; i < page.lookups_.size(); i++) {
+    BenchLookup& lookup = page.lookups_[i];
+    if (!lookup.accounted_for_ && lookup.success_ &&
+        lookup.start_ <= before && lookup.end_ <= before &&
+        host == lookup.host_) {
+      lookup.accounted_for_ = true;
+      is_claimed = true;
+      start = lookup.start_;
+      end = lookup.end_;
+    }
+  }
+  return is_claimed;
+}
+
+static const DnsLookup * ScanFind(const BenchPage& page,
+                                  const std::string& host) {
+  for (size_t i = 0; i < page.lookups_.size(); i++)
+    if (page.lookups_[i].success_ && host == page.lookups_[i].host_)
+      return &page.lookups_[i];
+  return NULL;
+}
+
+static int64_t ScanEarliest(const BenchPage& page, int64_t after) {
+  int64_t earliest = 0;
+  for (size_t i = 0; i < page.lookups_.size(); i++) {
+    int64_t start = page.lookups_[i].start_;
+    if (start && start >= after && (!earliest || start <= earliest))
+      earliest = start;
+  }
+  return earliest;
+}
+
+/*-----------------------------------------------------------------------------
+  One claim, find and earliest query per connection.  Returns a checksum
+  of the answers so the two versions can be compared.
+-----------------------------------------------------------------------------*/
+static int64_t RunScan(BenchPage& page) {
+  int64_t sum = 0;
+  for (size_t i = 0; i < page.connections_.size(); i++) {
+    const BenchConnection& connection = page.connections_[i];
+    int64_t start = 0, end = 0;
+    if (ScanClaim(page, connection.host_, connection.time_, start, end))
+      sum += start * 3 + end;
+    const DnsLookup * lookup = ScanFind(page, connection.host_);
+    if (lookup)
+      sum += lookup->start_;
+    sum += ScanEarliest(page, connection.time_ - 50000);
+  }
+  return sum;
+}
+
+static int64_t RunIndex(BenchPage& page, DnsLookupIndex& index) {
+  int64_t sum = 0;
+  for (size_t i = 0; i < page.connections_.size(); i++) {
+    const BenchConnection& connection = page.connections_[i];
+    int64_t start = 0, end = 0;
+    if (index.Claim(connection.host_, connection.time_, start, end))
+      sum += start * 3 + end;
+    const DnsLookup * lookup = index.FindSuccessful(connection.host_);
+    if (lookup)
+      sum += lookup->start_;
+    sum += index.GetEarliest(connection.time_ - 50000);
+  }
+  return sum;
+}
+
+static void BuildIndex(BenchPage& page, DnsLookupIndex& index) {
+  index.Reset();
+  for (size_t i = 0; i < page.lookups_.size(); i++)
+    index.Add(page.lookups_[i].host_, &page.lookups_[i]);
+}
+
+/*-----------------------------------------------------------------------------
+-----------------------------------------------------------------------------*/
+int main(int argc, char * argv[]) {
+  size_t max_lookups = argc > 1 ? (size_t)atoi(argv[1]) : 5000;
+  int failed = 0;
+  printf("%8s %12s %12s %10s %10s\n", "lookups", "scan ms", "index ms",
+         "scan us/c", "index us/c");
+  for (size_t count = 500; count <= max_lookups; count *= 2) {
+    if (count * 2 > max_lookups)
+      count = max_lookups;
+    BenchPage page;
+    MakePage(count, page);
+    DnsLookupIndex index;
+
+    // same answers and the same lookups claimed
+    ResetClaims(page);
+    int64_t scan_sum = RunScan(page);
+    std::vector<bool> scan_claimed(count);
+    for (size_t i = 0; i < count; i++)
+      scan_claimed[i] = page.lookups_[i].accounted_for_;
+    ResetClaims(page);
+    BuildIndex(page, index);
+    int64_t index_sum = RunIndex(page, index);
+    bool same = scan_sum == index_sum && index.GetCount() == count;
+    for (size_t i = 0; i < count; i++)
+      if (scan_claimed[i] != page.lookups_[i].accounted_for_)
+        same = false;
+    if (!same) {
+      printf("%d lookups: the index answers differ from the scan\n",
+             (int)count);
+      failed++;
+    }
+
+    double scan_ms = 0, index_ms = 0;
+    for (int run = 0; run < TIMING_RUNS; run++) {
+      ResetClaims(page);
+      double start = NowMs();
+      RunScan(page);
+      double elapsed = NowMs() - start;
+      if (!run || elapsed < scan_ms)
+        scan_ms = elapsed;
+
+      ResetClaims(page);
+      start = NowMs();
+      BuildIndex(page, index);
+      RunIndex(page, index);
+      elapsed = NowMs() - start;
+      if (!run || elapsed < index_ms)
+        index_ms = elapsed;
+    }
+    printf("%8d %12.2f %12.2f %10.2f %10.2f\n", (int)count, scan_ms,
+           index_ms, scan_ms * 1000.0 / count, index_ms * 1000.0 / count);
+    if (count == max_lookups)
+      break;
+  }
+  printf("%d mismatches\n", failed);
+  return failed ? 1 : 0;
+}
@@ -0,0 +1,760 @@
+/******************************************************************************
+Copyright (c) 2013, Google Inc.
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without 
+modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice, 
+      this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+    * Neither the name of the <ORGANIZATION> nor the names of its contributors 
+    may be used to endorse or promote products derived from this software 
+    without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE 
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE 
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL 
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR 
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER 
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, 
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE 
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+******************************************************************************/
+
+#include "StdAfx.h"
+#include "h2_connection.h"
+#include "test_state.h"
+#include <nghttp2/nghttp2.h>
+
+static const DWORD H2_FRAME_HEADER_LENGTH = 9;
+static const DWORD H2_CLIENT_PREFACE_LENGTH = 24;
+static const DWORD H2_MAX_BUFFERED_PAYLOAD = 1024 * 1024;
+// frames kept for the timeline per connection (about 3MB), later frames
+// are still parsed but only counted
+static const size_t H2_MAX_FRAMES = 50000;
+static const size_t H2_NO_FRAME = (size_t)-1;
+static const LONGLONG H2_DEFAULT_WINDOW = 65535;
+
+/*-----------------------------------------------------------------------------
+-----------------------------------------------------------------------------*/
+static const char * H2FrameType(int type) {
+  switch (type) {
+    case NGHTTP2_DATA: return "DATA";
+    case NGHTTP2_HEADERS: return "HEADERS";
+    case NGHTTP2_PRIORITY: return "PRIORITY";
+    case NGHTTP2_RST_STREAM: return "RST_STREAM";
+    case NGHTTP2_SETTINGS: return "SETTINGS";
+    case NGHTTP2_PUSH_PROMISE: return "PUSH_PROMISE";
+    case NGHTTP2_PING: return "PING";
+    case NGHTTP2_GOAWAY: return "GOAWAY";
+    case NGHTTP2_WINDOW_UPDATE: return "WINDOW_UPDATE";
+    case NGHTTP2_CONTINUATION: return "CONTINUATION";
+    default: return "UNKNOWN";
+  }
+}
+
+/*-----------------------------------------------------------------------------
+-----------------------------------------------------------------------------*/
+static inline DWORD H2ReadUInt32(const BYTE * p) {
+  return ((DWORD)p[0] << 24) | ((DWORD)p[1] << 16) | ((DWORD)p[2] << 8) |
+         (DWORD)p[3];
+}
+
+/*-----------------------------------------------------------------------------
+-----------------------------------------------------------------------------*/
+H2StreamInfo::H2StreamInfo():
+  parent_(0)
+  , weight_(15)
+  , exclusive_(false)
+  , pushed_(false)
+  , cancelled_(false)
+  , promised_by_(0)
+  , window_(H2_DEFAULT_WINDOW)
+  , bytes_in_(0)
+  , open_(0)
+  , end_(0)
+  , blocked_since_(0)
+  , blocked_(0)
+  , busy_at_open_(0)
+  , busy_at_end_(0)
+  , busy_own_(0) {
+}
+
+/*-----------------------------------------------------------------------------
+-----------------------------------------------------------------------------*/
+H2FrameReader::H2FrameReader(DATA_DIRECTION direction):
+  direction_(direction)
+  , preface_remaining_(direction == DATA_OUT ? H2_CLIENT_PREFACE_LENGTH : 0)
+  , header_length_(0)
+  , in_frame_(false)
+  , frame_index_(0)
+  , payload_remaining_(0)
+  , need_pad_length_(false)
+  , data_remaining_(0)
+  , header_block_stream_(0)
+  , header_block_bytes_(0)
+  , header_block_pushed_(false)
+  , header_block_end_stream_(false)
+  , inflater_(NULL)
+  , inflater_failed_(false) {
+  memset(&frame_, 0, sizeof(frame_));
+  if (nghttp2_hd_inflate_new(&inflater_))
+    inflater_ = NULL;
+}
+
+/*-----------------------------------------------------------------------------
+-----------------------------------------------------------------------------*/
+H2FrameReader::~H2FrameReader(void) {
+  if (inflater_)
+    nghttp2_hd_inflate_del(inflater_);
+}
+
+/*-----------------------------------------------------------------------------
+-----------------------------------------------------------------------------*/
+H2Connection::H2Connection(TrackSockets& sockets, DWORD socket_id):
+  sockets_(sockets)
+  , socket_id_(socket_id)
+  , in_(DATA_IN)
+  , out_(DATA_OUT)
+  , initial_window_(H2_DEFAULT_WINDOW)
+  , connection_window_(H2_DEFAULT_WINDOW)
+  , busy_(0)
+  , last_in_time_(0)
+  , last_in_was_data_(false)
+  , dropped_frames_(0) {
+}
+
+/*-----------------------------------------------------------------------------
+-----------------------------------------------------------------------------*/
+H2Connection::~H2Connection(void) {
+}
+
+/*-----------------------------------------------------------------------------
+-----------------------------------------------------------------------------*/
+void H2Connection::DataIn(const char * data, size_t len) {
+  if (data && len)
+    Process(in_, (const BYTE *)data, len);
+}
+
+/*-----------------------------------------------------------------------------
+  Outbound data starts with the client connection preface
+-----------------------------------------------------------------------------*/
+void H2Connection::DataOut(const char * data, size_t len) {
+  if (data && len)
+    Process(out_, (const BYTE *)data, len);
+}
+
+/*-----------------------------------------------------------------------------
+  Split the byte stream into frames.  Frames can span any number of socket
+  reads so all of the state lives in the reader.
+-----------------------------------------------------------------------------*/
+void H2Connection::Process(H2FrameReader& reader, const BYTE * data,
+                           size_t len) {
+  while (len) {
+    if (reader.preface_remaining_) {
+      size_t skip = min(len, (size_t)reader.preface_remaining_);
+      reader.preface_remaining_ -= (DWORD)skip;
+      data += skip;
+      len -= skip;
+    } else if (!reader.in_frame_) {
+      size_t copy = min(len,
+          (size_t)(H2_FRAME_HEADER_LENGTH - reader.header_length_));
+      memcpy(&reader.header_[reader.header_length_], data, copy);
+      reader.header_length_ += (DWORD)copy;
+      data += copy;
+      len -= copy;
+      if (reader.header_length_ == H2_FRAME_HEADER_LENGTH) {
+        FrameStart(reader);
+        if (!reader.payload_remaining_)
+          FrameComplete(reader);
+      }
+    } else {
+      size_t bytes = min(len, (size_t)reader.payload_remaining_);
+      FrameData(reader, data, bytes);
+      reader.payload_remaining_ -= (DWORD)bytes;
+      data += bytes;
+      len -= bytes;
+      if (!reader.payload_remaining_)
+        FrameComplete(reader);
+    }
+  }
+}
+
+/*-----------------------------------------------------------------------------
+  A full 9-byte frame header is available
+-----------------------------------------------------------------------------*/
+void H2Connection::FrameStart(H2FrameReader& reader) {
+  const BYTE * h = reader.header_;
+  H2Frame& frame = reader.frame_;
+  QueryPerformanceCounter(&frame.time_);
+  frame.direction_ = reader.direction_;
+  frame.length_ = ((DWORD)h[0] << 16) | ((DWORD)h[1] << 8) | (DWORD)h[2];
+  frame.type_ = h[3];
+  frame.flags_ = h[4];
+  frame.stream_id_ = H2ReadUInt32(&h[5]) & 0x7FFFFFFF;
+  frame.param_ = 0;
+  frame.weight_ = 0;
+  frame.exclusive_ = false;
+  frame.has_priority_ = false;
+  frame.window_ = 0;
+  frame.connection_window_ = 0;
+
+  // DATA is streamed through so the window and busy-time accounting for
+  // inbound DATA happens as soon as the frame starts
+  if (reader.direction_ == DATA_IN) {
+    LONGLONG now = frame.time_.QuadPart;
+    if (frame.type_ == NGHTTP2_DATA && frame.stream_id_) {
+      H2StreamInfo& stream = GetStream(frame.stream_id_);
+      if (last_in_was_data_ && now > last_in_time_) {
+        busy_ += now - last_in_time_;
+        stream.busy_own_ += now - last_in_time_;
+      }
+      stream.bytes_in_ += frame.length_;
+      stream.window_ -= frame.length_;
+      LONGLONG previous = connection_window_;
+      connection_window_ -= frame.length_;
+      frame.window_ = stream.window_;
+      frame.connection_window_ = connection_window_;
+      UpdateBlocked(stream, now);
+      ConnectionWindowChanged(previous, now);
+      last_in_was_data_ = true;
+    } else {
+      last_in_was_data_ = false;
+    }
+    last_in_time_ = now;
+  }
+  if (frames_.GetCount() < H2_MAX_FRAMES) {
+    reader.frame_index_ = frames_.Add(frame);
+  } else {
+    reader.frame_index_ = H2_NO_FRAME;
+    dropped_frames_++;
+  }
+
+  reader.header_length_ = 0;
+  reader.in_frame_ = true;
+  reader.payload_remaining_ = frame.length_;
+  reader.payload_.RemoveAll();
+  reader.need_pad_length_ = false;
+  reader.data_remaining_ = 0;
+  if (frame.type_ == NGHTTP2_DATA) {
+    if (frame.flags_ & NGHTTP2_FLAG_PADDED)
+      reader.need_pad_length_ = true;
+    else
+      reader.data_remaining_ = frame.length_;
+  }
+}
+
+/*-----------------------------------------------------------------------------
+  Payload bytes for the current frame.  DATA payloads are passed through
+  as they arrive (without the padding), everything else is buffered until
+  the frame is complete.
+-----------------------------------------------------------------------------*/
+void H2Connection::FrameData(H2FrameReader& reader, const BYTE * data,
+                             size_t len) {
+  H2Frame& frame = reader.frame_;
+  if (frame.type_ == NGHTTP2_DATA) {
+    if (reader.need_pad_length_ && len) {
+      DWORD pad_length = data[0];
+      reader.need_pad_length_ = false;
+      reader.data_remaining_ = frame.length_ > pad_length ?
+          frame.length_ - 1 - pad_length : 0;
+      data++;
+      len--;
+    }
+    size_t bytes = min(len, (size_t)reader.data_remaining_);
+    if (bytes) {
+      reader.data_remaining_ -= (DWORD)bytes;
+      sockets_.H2Data(reader.direction_, socket_id_, frame.stream_id_, bytes,
+                      (const char *)data);
+      sockets_.H2Bytes(reader.direction_, socket_id_, frame.stream_id_,
+                       bytes);
+    }
+  } else {
+    size_t count = reader.payload_.GetCount();
+    if (count + len <= H2_MAX_BUFFERED_PAYLOAD) {
+      reader.payload_.SetCount(count + len);
+      memcpy(reader.payload_.GetData() + count, data, len);
+    } else if (frame.type_ == NGHTTP2_HEADERS ||
+               frame.type_ == NGHTTP2_PUSH_PROMISE ||
+               frame.type_ == NGHTTP2_CONTINUATION) {
+      // the header compression state is lost if we drop part of a block
+      reader.inflater_failed_ = true;
+    }
+  }
+}
+
+/*-----------------------------------------------------------------------------
+-----------------------------------------------------------------------------*/
+void H2Connection::FrameComplete(H2FrameReader& reader) {
+  H2Frame& frame = reader.frame_;
+  const BYTE * payload = reader.payload_.GetData();
+  DWORD len = (DWORD)reader.payload_.GetCount();
+  LONGLONG now = frame.time_.QuadPart;
+  reader.in_frame_ = false;
+
+  switch (frame.type_) {
+    case NGHTTP2_DATA: {
+        if (frame.flags_ & NGHTTP2_FLAG_END_STREAM &&
+            reader.direction_ == DATA_IN) {
+          CloseStream(GetStream(frame.stream_id_), now);
+          sockets_.H2CloseStream(reader.direction_, socket_id_,
+                                 frame.stream_id_);
+        }
+      }
+      break;
+    case NGHTTP2_HEADERS:
+    case NGHTTP2_PUSH_PROMISE: {
+        DWORD offset = 0;
+        DWORD pad_length = 0;
+        if (frame.flags_ & NGHTTP2_FLAG_PADDED && len) {
+          pad_length = payload[0];
+          offset++;
+        }
+        DWORD stream_id = frame.stream_id_;
+        bool pushed = false;
+        if (frame.type_ == NGHTTP2_PUSH_PROMISE) {
+          if (offset + 4 <= len)
+            stream_id = H2ReadUInt32(&payload[offset]) & 0x7FFFFFFF;
+          offset += 4;
+          pushed = true;
+          frame.param_ = stream_id;
+          H2StreamInfo& promised = GetStream(stream_id);
+          promised.pushed_ = true;
+          promised.promised_by_ = frame.stream_id_;
+          OpenStream(promised, now);
+        } else {
+          if (frame.flags_ & NGHTTP2_FLAG_PRIORITY) {
+            if (offset < len)
+              ProcessPriority(frame, payload + offset, len - offset);
+            offset += 5;
+          }
+          if (reader.direction_ == DATA_OUT)
+            OpenStream(GetStream(stream_id), now);
+          else if (frame.flags_ & NGHTTP2_FLAG_END_STREAM)
+            CloseStream(GetStream(stream_id), now);
+        }
+        if (offset + pad_length <= len) {
+          if (!pushed)
+            sockets_.H2BeginHeaders(reader.direction_, socket_id_, stream_id);
+          reader.header_block_.RemoveAll();
+          reader.header_block_stream_ = stream_id;
+          reader.header_block_pushed_ = pushed;
+          reader.header_block_end_stream_ =
+              !pushed && (frame.flags_ & NGHTTP2_FLAG_END_STREAM);
+          reader.header_block_bytes_ = pushed ? 0 : frame.length_;
+          HeaderBlockFragment(reader, payload + offset,
+                              len - offset - pad_length,
+                              (frame.flags_ & NGHTTP2_FLAG_END_HEADERS) != 0);
+        }
+      }
+      break;
+    case NGHTTP2_CONTINUATION: {
+        if (reader.header_block_stream_ && !reader.header_block_pushed_)
+          reader.header_block_bytes_ += frame.length_;
+        if (reader.header_block_stream_)
+          HeaderBlockFragment(reader, payload, len,
+                              (frame.flags_ & NGHTTP2_FLAG_END_HEADERS) != 0);
+      }
+      break;
+    case NGHTTP2_RST_STREAM: {
+        if (len >= 4)
+          frame.param_ = H2ReadUInt32(payload);
+        H2StreamInfo& stream = GetStream(frame.stream_id_);
+        if (reader.direction_ == DATA_OUT && stream.pushed_ && !stream.end_)
+          stream.cancelled_ = true;
+        CloseStream(stream, now);
+        sockets_.H2CloseStream(reader.direction_, socket_id_,
+                               frame.stream_id_);
+      }
+      break;
+    case NGHTTP2_SETTINGS: {
+        if (!(frame.flags_ & NGHTTP2_FLAG_ACK))
+          ProcessSettings(reader);
+      }
+      break;
+    case NGHTTP2_PRIORITY: {
+        ProcessPriority(frame, payload, len);
+      }
+      break;
+    case NGHTTP2_WINDOW_UPDATE: {
+        if (len >= 4) {
+          frame.param_ = H2ReadUInt32(payload) & 0x7FFFFFFF;
+          // only the windows the browser advertises are tracked
+          if (reader.direction_ == DATA_OUT) {
+            if (frame.stream_id_) {
+              H2StreamInfo& stream = GetStream(frame.stream_id_);
+              stream.window_ += frame.param_;
+              frame.window_ = stream.window_;
+              UpdateBlocked(stream, now);
+            } else {
+              LONGLONG previous = connection_window_;
+              connection_window_ += frame.param_;
+              ConnectionWindowChanged(previous, now);
+            }
+            frame.connection_window_ = connection_window_;
+          }
+        }
+      }
+      break;
+  }
+  if (reader.frame_index_ != H2_NO_FRAME)
+    frames_[reader.frame_index_] = frame;
+  reader.payload_.RemoveAll();
+}
+
+/*-----------------------------------------------------------------------------
+  Priority fields from a PRIORITY frame or a HEADERS frame with the
+  PRIORITY flag (exclusive bit + 31-bit dependency, then weight - 1)
+-----------------------------------------------------------------------------*/
+void H2Connection::ProcessPriority(H2Frame& frame, const BYTE * data,
+                                   size_t len) {
+  if (data && len >= 5 && frame.stream_id_) {
+    DWORD dependency = H2ReadUInt32(data);
+    frame.has_priority_ = true;
+    frame.exclusive_ = (dependency & 0x80000000) != 0;
+    frame.param_ = dependency & 0x7FFFFFFF;
+    frame.weight_ = data[4];
+    H2StreamInfo& stream = GetStream(frame.stream_id_);
+    stream.parent_ = frame.param_;
+    stream.exclusive_ = frame.exclusive_;
+    stream.weight_ = frame.weight_;
+  }
+}
+
+/*-----------------------------------------------------------------------------
+-----------------------------------------------------------------------------*/
+H2StreamInfo& H2Connection::GetStream(DWORD stream_id) {
+  CAtlMap<DWORD, H2StreamInfo>::CPair * pair = streams_.Lookup(stream_id);
+  if (!pair) {
+    H2StreamInfo stream;
+    stream.window_ = initial_window_;
+    streams_.SetAt(stream_id, stream);
+    pair = streams_.Lookup(stream_id);
+  }
+  return pair->m_value;
+}
+
+/*-----------------------------------------------------------------------------
+-----------------------------------------------------------------------------*/
+void H2Connection::OpenStream(H2StreamInfo& stream, LONGLONG now) {
+  if (!stream.open_) {
+    stream.open_ = now;
+    stream.busy_at_open_ = busy_;
+    stream.busy_own_ = 0;
+    UpdateBlocked(stream, now);
+  }
+}
+
+/*-----------------------------------------------------------------------------
+-----------------------------------------------------------------------------*/
+void H2Connection::CloseStream(H2StreamInfo& stream, LONGLONG now) {
+  if (stream.open_ && !stream.end_) {
+    stream.end_ = now;
+    stream.busy_at_end_ = busy_;
+    UpdateBlocked(stream, now);
+  }
+}
+
+/*-----------------------------------------------------------------------------
+  An open stream is blocked whenever either its own window or the
+  connection window is exhausted.
+-----------------------------------------------------------------------------*/
+void H2Connection::UpdateBlocked(H2StreamInfo& stream, LONGLONG now) {
+  bool blocked = stream.open_ && !stream.end_ &&
+                 (stream.window_ <= 0 || connection_window_ <= 0);
+  if (blocked && !stream.blocked_since_) {
+    stream.blocked_since_ = now;
+  } else if (!blocked && stream.blocked_since_) {
+    stream.blocked_ += now - stream.blocked_since_;
+    stream.blocked_since_ = 0;
+  }
+}
+
+/*-----------------------------------------------------------------------------
+  The connection window only affects every stream when it crosses zero
+-----------------------------------------------------------------------------*/
+void H2Connection::ConnectionWindowChanged(LONGLONG previous, LONGLONG now) {
+  if ((previous <= 0) != (connection_window_ <= 0)) {
+    POSITION pos = streams_.GetStartPosition();
+    while (pos) {
+      CAtlMap<DWORD, H2StreamInfo>::CPair * pair = streams_.GetNext(pos);
+      UpdateBlocked(pair->m_value, now);
+    }
+  }
+}
+
+/*-----------------------------------------------------------------------------
+  Flow-control blocked and head-of-line wait times (in ticks) for a stream
+-----------------------------------------------------------------------------*/
+bool H2Connection::GetStreamTimes(DWORD stream_id, LONGLONG& blocked,
+                                  LONGLONG& hol_wait) {
+  bool found = false;
+  blocked = 0;
+  hol_wait = 0;
+  const CAtlMap<DWORD, H2StreamInfo>::CPair * pair =
+      streams_.Lookup(stream_id);
+  if (pair && pair->m_value.open_) {
+    const H2StreamInfo& stream = pair->m_value;
+    found = true;
+    blocked = stream.blocked_;
+    if (stream.blocked_since_) {
+      LARGE_INTEGER now;
+      QueryPerformanceCounter(&now);
+      if (now.QuadPart > stream.blocked_since_)
+        blocked += now.QuadPart - stream.blocked_since_;
+    }
+    LONGLONG busy = stream.end_ ? stream.busy_at_end_ : busy_;
+    hol_wait = busy - stream.busy_at_open_ - stream.busy_own_;
+    if (hol_wait < 0)
+      hol_wait = 0;
+  }
+  return found;
+}
+
+/*-----------------------------------------------------------------------------
+-----------------------------------------------------------------------------*/
+void H2Connection::HeaderBlockFragment(H2FrameReader& reader,
+                                       const BYTE * data, size_t len,
+                                       bool end_headers) {
+  if (len) {
+    size_t count = reader.header_block_.GetCount();
+    reader.header_block_.SetCount(count + len);
+    memcpy(reader.header_block_.GetData() + count, data, len);
+  }
+  if (end_headers)
+    DecodeHeaderBlock(reader);
+}
+
+/*-----------------------------------------------------------------------------
+  Every header block has to go through the decoder (even if we don't care
+  about the request) to keep the dynamic table in sync with the peer.
+-----------------------------------------------------------------------------*/
+void H2Connection::DecodeHeaderBlock(H2FrameReader& reader) {
+  DWORD stream_id = reader.header_block_stream_;
+  bool pushed = reader.header_block_pushed_;
+  // headers from a PUSH_PROMISE are the request headers for the pushed stream
+  DATA_DIRECTION direction = reader.direction_;
+  if (pushed)
+    direction = direction == DATA_IN ? DATA_OUT : DATA_IN;
+
+  size_t len = reader.header_block_.GetCount();
+  if (len && reader.inflater_ && !reader.inflater_failed_) {
+    BYTE * in = reader.header_block_.GetData();
+    for (;;) {
+      nghttp2_nv nv;
+      int flags = 0;
+      ssize_t r = nghttp2_hd_inflate_hd(reader.inflater_, &nv, &flags,
+                                        in, len, 1);
+      if (r < 0) {
+        AtlTrace("[%d] HPACK decode error %d", socket_id_, r);
+        reader.inflater_failed_ = true;
+        break;
+      }
+      in += r;
+      len -= r;
+      if (flags & NGHTTP2_HD_INFLATE_EMIT) {
+        CStringA name((LPCSTR)nv.name, (int)nv.namelen);
+        CStringA value((LPCSTR)nv.value, (int)nv.valuelen);
+        sockets_.H2Header(direction, socket_id_, stream_id, name, value,
+                          pushed);
+      }
+      if (flags & NGHTTP2_HD_INFLATE_FINAL) {
+        nghttp2_hd_inflate_end_headers(reader.inflater_);
+        break;
+      }
+      if (!(flags & NGHTTP2_HD_INFLATE_EMIT) && !len)
+        break;
+    }
+  }
+
+  if (reader.header_block_bytes_)
+    sockets_.H2Bytes(reader.direction_, socket_id_, stream_id,
+                     reader.header_block_bytes_);
+  if (reader.header_block_end_stream_ && reader.direction_ == DATA_IN)
+    sockets_.H2CloseStream(reader.direction_, socket_id_, stream_id);
+
+  reader.header_block_.RemoveAll();
+  reader.header_block_stream_ = 0;
+  reader.header_block_bytes_ = 0;
+}
+
+/*-----------------------------------------------------------------------------
+  A header table size advertised by one side limits the encoder on the
+  other side so it applies to the decoder for the opposite direction.
+-----------------------------------------------------------------------------*/
+void H2Connection::ProcessSettings(H2FrameReader& reader) {
+  H2FrameReader& peer = reader.direction_ == DATA_IN ? out_ : in_;
+  const BYTE * payload = reader.payload_.GetData();
+  size_t len = reader.payload_.GetCount();
+  CStringA settings, entry;
+  for (size_t offset = 0; offset + 6 <= len; offset += 6) {
+    DWORD id = ((DWORD)payload[offset] << 8) | (DWORD)payload[offset + 1];
+    DWORD value = H2ReadUInt32(&payload[offset + 2]);
+    entry.Format("%s\"%d\":%u", settings.IsEmpty() ? "" : ",", id, value);
+    settings += entry;
+    if (id == NGHTTP2_SETTINGS_HEADER_TABLE_SIZE && peer.inflater_)
+      nghttp2_hd_inflate_change_table_size(peer.inflater_, value);
+    // the browser's initial window applies to the response direction and
+    // adjusts the windows of all of the existing streams
+    if (id == NGHTTP2_SETTINGS_INITIAL_WINDOW_SIZE &&
+        reader.direction_ == DATA_OUT) {
+      LONGLONG delta = (LONGLONG)value - initial_window_;
+      initial_window_ = value;
+      LONGLONG now = reader.frame_.time_.QuadPart;
+      POSITION pos = streams_.GetStartPosition();
+      while (pos) {
+        CAtlMap<DWORD, H2StreamInfo>::CPair * pair = streams_.GetNext(pos);
+        pair->m_value.window_ += delta;
+        UpdateBlocked(pair->m_value, now);
+      }
+    }
+  }
+  if (!settings.IsEmpty() && reader.frame_index_ != H2_NO_FRAME)
+    settings_.SetAt(reader.frame_index_, settings);
+}
+
+/*-----------------------------------------------------------------------------
+  Type-specific details for a frame in the timeline (empty if none)
+-----------------------------------------------------------------------------*/
+CStringA H2Connection::FrameDetailsJSON(const H2Frame& frame, size_t index) {
+  CStringA details;
+  switch (frame.type_) {
+    case NGHTTP2_HEADERS:
+    case NGHTTP2_PRIORITY: {
+        if (frame.has_priority_)
+          details.Format("{\"parent\":%u,\"weight\":%d,\"exclusive\":%d}",
+                         frame.param_, (int)frame.weight_ + 1,
+                         frame.exclusive_ ? 1 : 0);
+      }
+      break;
+    case NGHTTP2_DATA: {
+        if (frame.direction_ == DATA_IN)
+          details.Format("{\"window\":%I64d,\"connection_window\":%I64d}",
+                         frame.window_, frame.connection_window_);
+      }
+      break;
+    case NGHTTP2_WINDOW_UPDATE: {
+        if (frame.direction_ == DATA_OUT) {
+          if (frame.stream_id_)
+            details.Format("{\"increment\":%u,\"window\":%I64d}",
+                           frame.param_, frame.window_);
+          else
+            details.Format("{\"increment\":%u,\"window\":%I64d}",
+                           frame.param_, frame.connection_window_);
+        } else {
+          details.Format("{\"increment\":%u}", frame.param_);
+        }
+      }
+      break;
+    case NGHTTP2_PUSH_PROMISE: {
+        details.Format("{\"promised\":%u}", frame.param_);
+      }
+      break;
+    case NGHTTP2_RST_STREAM: {
+        details.Format("{\"error\":%u}", frame.param_);
+      }
+      break;
+    case NGHTTP2_SETTINGS: {
+        const CAtlMap<size_t, CStringA>::CPair * settings =
+            settings_.Lookup(index);
+        if (settings)
+          details = "{\"settings\":{" + settings->m_value + "}}";
+      }
+      break;
+  }
+  return details;
+}
+
+/*-----------------------------------------------------------------------------
+  Frames for the current step grouped by stream along with the priority,
+  flow-control and push state for each stream:
+  {"id":socket,"dropped_frames":n,
+   "push":{"promised":n,"cancelled":n,"bytes":n},
+   "streams":{"<stream>":{"parent":n,"weight":n,"exclusive":0|1,
+                          "pushed":0|1,"promised_by":n,"cancelled":0|1,
+                          "bytes_in":n,"blocked_ms":n,"hol_wait_ms":n,
+                          "frames":[[ms,"in|out","TYPE",flags,length,
+                                     {details}],...]},...}}
+-----------------------------------------------------------------------------*/
+CStringA H2Connection::GetTimelineJSON(TestState& test_state) {
+  CStringA json;
+  CAtlArray<DWORD> stream_order;
+  CAtlMap<DWORD, CStringA> stream_frames;
+  double frequency = (double)test_state._ms_frequency.QuadPart;
+  size_t count = frames_.GetCount();
+  for (size_t i = 0; i < count && frequency > 0; i++) {
+    const H2Frame& frame = frames_[i];
+    if (frame.time_.QuadPart >= test_state._start.QuadPart) {
+      CAtlMap<DWORD, CStringA>::CPair * stream =
+          stream_frames.Lookup(frame.stream_id_);
+      if (!stream) {
+        stream_order.Add(frame.stream_id_);
+        stream_frames.SetAt(frame.stream_id_, CStringA());
+        stream = stream_frames.Lookup(frame.stream_id_);
+      }
+      CStringA entry;
+      entry.Format("%s[%0.3f,\"%s\",\"%s\",%d,%d",
+          stream->m_value.IsEmpty() ? "" : ",",
+          (double)(frame.time_.QuadPart - test_state._start.QuadPart) /
+              frequency,
+          frame.direction_ == DATA_IN ? "in" : "out",
+          H2FrameType(frame.type_), frame.flags_, frame.length_);
+      CStringA details = FrameDetailsJSON(frame, i);
+      if (!details.IsEmpty())
+        entry += "," + details;
+      stream->m_value += entry + "]";
+    }
+  }
+  if (!stream_order.IsEmpty()) {
+    // pushed streams may not have any frames of their own
+    DWORD promised = 0, cancelled = 0;
+    LONGLONG pushed_bytes = 0;
+    POSITION pos = streams_.GetStartPosition();
+    while (pos) {
+      const CAtlMap<DWORD, H2StreamInfo>::CPair * pair = streams_.GetNext(pos);
+      const H2StreamInfo& stream = pair->m_value;
+      if (stream.pushed_ && stream.open_ >= test_state._start.QuadPart) {
+        promised++;
+        pushed_bytes += stream.bytes_in_;
+        if (stream.cancelled_)
+          cancelled++;
+      }
+    }
+    CStringA streams, entry;
+    for (size_t i = 0; i < stream_order.GetCount(); i++) {
+      DWORD stream_id = stream_order[i];
+      entry.Format("%s\"%d\":{", i ? "," : "", stream_id);
+      streams += entry;
+      const CAtlMap<DWORD, H2StreamInfo>::CPair * pair =
+          streams_.Lookup(stream_id);
+      if (pair && stream_id) {
+        const H2StreamInfo& stream = pair->m_value;
+        LONGLONG blocked = 0, hol_wait = 0;
+        GetStreamTimes(stream_id, blocked, hol_wait);
+        entry.Format("\"parent\":%u,\"weight\":%d,\"exclusive\":%d,"
+                     "\"pushed\":%d,\"promised_by\":%u,\"cancelled\":%d,"
+                     "\"bytes_in\":%I64d,\"blocked_ms\":%0.3f,"
+                     "\"hol_wait_ms\":%0.3f,",
+                     stream.parent_, (int)stream.weight_ + 1,
+                     stream.exclusive_ ? 1 : 0, stream.pushed_ ? 1 : 0,
+                     stream.promised_by_, stream.cancelled_ ? 1 : 0,
+                     stream.bytes_in_, (double)blocked / frequency,
+                     (double)hol_wait / frequency);
+        streams += entry;
+      }
+      streams += "\"frames\":[" + stream_frames[stream_id] + "]}";
+    }
+    json.Format("{\"id\":%d,\"dropped_frames\":%u,"
+                "\"push\":{\"promised\":%u,\"cancelled\":%u,"
+                "\"bytes\":%I64d},\"streams\":{",
+                socket_id_, (DWORD)dropped_frames_, promised, cancelled,
+                pushed_bytes);
+    json += streams + "}}";
+  }
+  return json;
+}
@@ -0,0 +1,165 @@
+/******************************************************************************
+Copyright (c) 2013, Google Inc.
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without 
+modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice, 
+      this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+    * Neither the name of the <ORGANIZATION> nor the names of its contributors 
+    may be used to endorse or promote products derived from this software 
+    without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE 
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE 
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL 
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR 
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER 
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, 
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE 
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+******************************************************************************/
+
+#pragma once
+#include "track_sockets.h"
+
+class TestState;
+struct nghttp2_hd_inflater;
+
+/*-----------------------------------------------------------------------------
+  A single HTTP/2 frame as seen on the wire
+-----------------------------------------------------------------------------*/
+class H2Frame {
+public:
+  LARGE_INTEGER   time_;
+  DATA_DIRECTION  direction_;
+  BYTE            type_;
+  BYTE            flags_;
+  DWORD           stream_id_;
+  DWORD           length_;
+  // frame-specific details (dependency, window increment, promised stream
+  // or error code depending on the type)
+  DWORD           param_;
+  BYTE            weight_;
+  bool            exclusive_;
+  bool            has_priority_;
+  // receive windows the browser has left for the response direction
+  LONGLONG        window_;
+  LONGLONG        connection_window_;
+};
+
+/*-----------------------------------------------------------------------------
+  Priority, flow-control and push state for a single stream.  All of the
+  times are in performance counter ticks.
+-----------------------------------------------------------------------------*/
+class H2StreamInfo {
+public:
+  H2StreamInfo();
+
+  DWORD     parent_;
+  BYTE      weight_;
+  bool      exclusive_;
+  bool      pushed_;
+  bool      cancelled_;
+  DWORD     promised_by_;
+  LONGLONG  window_;
+  LONGLONG  bytes_in_;
+  LONGLONG  open_;            // request sent (or push promised)
+  LONGLONG  end_;             // response complete or reset
+  LONGLONG  blocked_since_;   // currently out of flow-control window
+  LONGLONG  blocked_;
+  LONGLONG  busy_at_open_;    // connection DATA time when the stream opened
+  LONGLONG  busy_at_end_;
+  LONGLONG  busy_own_;        // connection DATA time spent on this stream
+};
+
+/*-----------------------------------------------------------------------------
+  Frame reassembly state for one direction of a connection
+-----------------------------------------------------------------------------*/
+class H2FrameReader {
+public:
+  H2FrameReader(DATA_DIRECTION direction);
+  ~H2FrameReader(void);
+
+  DATA_DIRECTION        direction_;
+  DWORD                 preface_remaining_;
+  BYTE                  header_[9];
+  DWORD                 header_length_;
+  bool                  in_frame_;
+  H2Frame               frame_;
+  size_t                frame_index_;
+  DWORD                 payload_remaining_;
+  CAtlArray<BYTE>       payload_;         // non-DATA frames only
+  bool                  need_pad_length_; // DATA frames only
+  DWORD                 data_remaining_;  // DATA frames only
+  CAtlArray<BYTE>       header_block_;    // HEADERS + CONTINUATION
+  DWORD                 header_block_stream_;   // 0 = no open block
+  DWORD                 header_block_bytes_;
+  bool                  header_block_pushed_;
+  bool                  header_block_end_stream_;
+  nghttp2_hd_inflater * inflater_;
+  bool                  inflater_failed_;
+};
+
+/*-----------------------------------------------------------------------------
+  Passive HTTP/2 connection parser.  Only does what we need for
+  measurement: frame boundaries, HPACK-decoded headers, DATA byte counts
+  and stream close events (no stream state machine).  DATA payloads are
+  handed straight through from the socket buffers.
+
+  The priority, flow-control and push frames are tracked per stream so we
+  can tell how long each response was stalled because the browser's
+  receive window was exhausted ("blocked") and how long the connection
+  spent sending DATA for other streams while it was waiting ("head-of-line
+  wait").  The DATA time is approximated by the gaps between consecutive
+  inbound DATA frames, attributed to the stream of the later frame.
+
+  Must be called inside of the TrackSockets critical section.
+-----------------------------------------------------------------------------*/
+class H2Connection {
+public:
+  H2Connection(TrackSockets& sockets, DWORD socket_id);
+  ~H2Connection(void);
+
+  void DataIn(const char * data, size_t len);
+  void DataOut(const char * data, size_t len);
+  CStringA GetTimelineJSON(TestState& test_state);
+  bool GetStreamTimes(DWORD stream_id, LONGLONG& blocked, LONGLONG& hol_wait);
+
+private:
+  void Process(H2FrameReader& reader, const BYTE * data, size_t len);
+  void FrameStart(H2FrameReader& reader);
+  void FrameData(H2FrameReader& reader, const BYTE * data, size_t len);
+  void FrameComplete(H2FrameReader& reader);
+  void HeaderBlockFragment(H2FrameReader& reader, const BYTE * data,
+                           size_t len, bool end_headers);
+  void DecodeHeaderBlock(H2FrameReader& reader);
+  void ProcessSettings(H2FrameReader& reader);
+  void ProcessPriority(H2Frame& frame, const BYTE * data, size_t len);
+  H2StreamInfo& GetStream(DWORD stream_id);
+  void OpenStream(H2StreamInfo& stream, LONGLONG now);
+  void CloseStream(H2StreamInfo& stream, LONGLONG now);
+  void UpdateBlocked(H2StreamInfo& stream, LONGLONG now);
+  void ConnectionWindowChanged(LONGLONG previous, LONGLONG now);
+  CStringA FrameDetailsJSON(const H2Frame& frame, size_t index);
+
+  TrackSockets&       sockets_;
+  DWORD               socket_id_;
+  H2FrameReader       in_;
+  H2FrameReader       out_;
+  CAtlArray<H2Frame>  frames_;
+  CAtlMap<size_t, CStringA>     settings_;    // by frame index
+  CAtlMap<DWORD, H2StreamInfo>  streams_;
+  LONGLONG            initial_window_;
+  LONGLONG            connection_window_;
+  LONGLONG            busy_;
+  LONGLONG            last_in_time_;
+  bool                last_in_was_data_;
+  size_t              dropped_frames_;  // past the frames_ cap
+};
@@ -0,0 +1,162 @@
+/******************************************************************************
+Copyright (c) 2013, Google Inc.
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without 
+modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice, 
+      this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+    * Neither the name of the <ORGANIZATION> nor the names of its contributors 
+    may be used to endorse or promote products derived from this software 
+    without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE 
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE 
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL 
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR 
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER 
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, 
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE 
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+******************************************************************************/
+
+#include "StdAfx.h"
+#include "test_state.h"
+#include "hook_profiler.h"
+#include "hook_gdi.h"
+
+static GdiHook* g_hook = NULL;
+
+// Stub Functions
+
+BOOL __stdcall BitBlt_Hook(HDC hdc, int x, int y, int cx, int cy,
+                           HDC hdcSrc, int x1, int y1, DWORD rop) {
+  BOOL ret = FALSE;
+  if (g_hook)
+    ret = g_hook->BitBlt(hdc, x, y, cx, cy, hdcSrc, x1, y1, rop);
+  return ret;
+}
+
+BOOL __stdcall EndPaint_Hook(HWND hWnd, CONST PAINTSTRUCT *lpPaint) {
+  BOOL ret = FALSE;
+  if (g_hook)
+    ret = g_hook->EndPaint(hWnd, lpPaint);
+  return ret;
+}
+
+/*-----------------------------------------------------------------------------
+-----------------------------------------------------------------------------*/
+GdiHook::GdiHook(TestState& test_state):
+  _test_state(test_state)
+  ,_hook(NULL)
+  ,_BitBlt(NULL)
+  ,_EndPaint(NULL) {
+}
+
+/*-----------------------------------------------------------------------------
+-----------------------------------------------------------------------------*/
+GdiHook::~GdiHook(void) {
+  if (g_hook == this)
+    g_hook = NULL;
+  if (_hook)
+    delete _hook;  // remove all the hooks
+}
+
+/*-----------------------------------------------------------------------------
+-----------------------------------------------------------------------------*/
+void GdiHook::Init() {
+  if (_hook || g_hook)
+    return;
+  _hook = new NCodeHookIA32();
+  g_hook = this;
+  WptTrace(loglevel::kProcess, _T("[wpthook] GdiHook::Init()\n"));
+
+  _BitBlt = _hook->createHookByName("gdi32.dll", "BitBlt", BitBlt_Hook);
+  _EndPaint = _hook->createHookByName("user32.dll", "EndPaint",
+                                      EndPaint_Hook);
+}
+
+/*-----------------------------------------------------------------------------
+-----------------------------------------------------------------------------*/
+void GdiHook::Unregister() {
+  WptTrace(loglevel::kProcess, _T("[wpthook] GdiHook::Unregister()\n"));
+  if (_hook) {
+    if (_BitBlt) _hook->removeHook(BitBlt_Hook);
+    if (_EndPaint) _hook->removeHook(EndPaint_Hook);
+  }
+}
+
+/*-----------------------------------------------------------------------------
+  Blits into memory DCs (including our own screen captures) have no window
+  and are ignored.
+-----------------------------------------------------------------------------*/
+BOOL GdiHook::BitBlt(HDC hdc, int x, int y, int cx, int cy, HDC hdcSrc,
+                     int x1, int y1, DWORD rop) {
+  HookTimer timer(HOOK_PROFILE_BITBLT);
+  BOOL ret = FALSE;
+
+  timer.StartOriginal();
+  if (_BitBlt)
+    ret = _BitBlt(hdc, x, y, cx, cy, hdcSrc, x1, y1, rop);
+  timer.EndOriginal();
+  DWORD error = GetLastError();
+
+  if (ret && cx && cy) {
+    HWND wnd = WindowFromDC(hdc);
+    if (wnd && IsBrowserWindow(wnd)) {
+      POINT points[2] = {{x, y}, {x + cx, y + cy}};
+      POINT origin;
+      if (LPtoDP(hdc, points, 2) && GetDCOrgEx(hdc, &origin)) {
+        RECT rect;
+        SetRect(&rect, min(points[0].x, points[1].x) + origin.x,
+                       min(points[0].y, points[1].y) + origin.y,
+                       max(points[0].x, points[1].x) + origin.x,
+                       max(points[0].y, points[1].y) + origin.y);
+        _test_state.OnPaint(rect);
+      }
+    }
+  }
+
+  SetLastError(error);
+  return ret;
+}
+
+/*-----------------------------------------------------------------------------
+-----------------------------------------------------------------------------*/
+BOOL GdiHook::EndPaint(HWND hWnd, CONST PAINTSTRUCT *lpPaint) {
+  HookTimer timer(HOOK_PROFILE_ENDPAINT);
+  BOOL ret = FALSE;
+
+  RECT rect;
+  bool painted = false;
+  if (lpPaint && !IsRectEmpty(&lpPaint->rcPaint) && IsBrowserWindow(hWnd)) {
+    rect = lpPaint->rcPaint;
+    MapWindowPoints(hWnd, NULL, (LPPOINT)&rect, 2);
+    painted = true;
+  }
+
+  timer.StartOriginal();
+  if (_EndPaint)
+    ret = _EndPaint(hWnd, lpPaint);
+  timer.EndOriginal();
+  DWORD error = GetLastError();
+
+  if (painted)
+    _test_state.OnPaint(rect);
+
+  SetLastError(error);
+  return ret;
+}
+
+/*-----------------------------------------------------------------------------
+-----------------------------------------------------------------------------*/
+bool GdiHook::IsBrowserWindow(HWND wnd) {
+  HWND frame = _test_state._frame_window;
+  return frame && (wnd == frame || IsChild(frame, wnd));
+}
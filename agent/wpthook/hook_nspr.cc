@@ -34,6 +34,7 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include "test_state.h"
 #include "track_sockets.h"
 #include "wpt_test_hook.h"
+#include "hook_profiler.h"
 
 #include "hook_nspr.h"
 
@@ -175,9 +176,12 @@ void NsprHook::SetSslFd(PRFileDesc *fd) {
 
 // NSPR hooks
 PRFileDesc* NsprHook::SSL_ImportFD(PRFileDesc *model, PRFileDesc *fd) {
+  HookTimer timer(HOOK_PROFILE_SSL_IMPORTFD);
   PRFileDesc* ret = NULL;
   if (_SSL_ImportFD) {
+    timer.StartOriginal();
     ret = _SSL_ImportFD(model, fd);
+    timer.EndOriginal();
     if (ret != NULL) {
       _sockets.SetSslFd(ret);
       if (_PR_FileDesc2NativeHandle)
@@ -188,9 +192,12 @@ PRFileDesc* NsprHook::SSL_ImportFD(PRFileDesc *model, PRFileDesc *fd) {
 }
 
 PRStatus NsprHook::PR_Close(PRFileDesc *fd) {
+  HookTimer timer(HOOK_PROFILE_PR_CLOSE);
   PRStatus ret = PR_FAILURE;
   if (_PR_Close) {
+    timer.StartOriginal();
     ret = _PR_Close(fd);
+    timer.EndOriginal();
     _sockets.ClearSslFd(fd);
   }
   return ret;
@@ -203,6 +210,7 @@ PRStatus NsprHook::PR_Close(PRFileDesc *fd) {
   is to keep a mapping of file descriptors to SSL socket numbers.
 -----------------------------------------------------------------------------*/
 PRInt32 NsprHook::PR_Write(PRFileDesc *fd, const void *buf, PRInt32 amount) {
+  HookTimer timer(HOOK_PROFILE_PR_WRITE);
   PRInt32 ret = -1;
   if (_PR_Write) {
     DataChunk chunk((LPCSTR)buf, amount);
@@ -211,7 +219,9 @@ PRInt32 NsprHook::PR_Write(PRFileDesc *fd, const void *buf, PRInt32 amount) {
     if (buf && !_test_state._exit && _sockets.SslSocketLookup(fd, s)) {
       _sockets.ModifyDataOut(s, chunk, true);
     }
+    timer.StartOriginal();
     ret = _PR_Write(fd, chunk.GetData(), chunk.GetLength());
+    timer.EndOriginal();
     if (ret > 0 && s != INVALID_SOCKET) {
       _sockets.DataOut(s, chunk, true);
       ret = original_amount;
@@ -221,9 +231,13 @@ PRInt32 NsprHook::PR_Write(PRFileDesc *fd, const void *buf, PRInt32 amount) {
 }
 
 PRInt32 NsprHook::PR_Read(PRFileDesc *fd, void *buf, PRInt32 amount) {
+  HookTimer timer(HOOK_PROFILE_PR_READ);
   PRInt32 ret = -1;
   if (_PR_Read) {
+    timer.StartOriginal();
     ret = _PR_Read(fd, buf, amount);
+    timer.EndOriginal();
+
     if (ret > 0 && buf && !_test_state._exit) {
       SOCKET s = INVALID_SOCKET;
       if (_sockets.SslSocketLookup(fd, s)) {
@@ -0,0 +1,316 @@
+/******************************************************************************
+Copyright (c) 2013, Google Inc.
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without 
+modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice, 
+      this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+    * Neither the name of the <ORGANIZATION> nor the names of its contributors 
+    may be used to endorse or promote products derived from this software 
+    without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE 
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE 
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL 
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR 
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER 
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, 
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE 
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+******************************************************************************/
+
+#include "StdAfx.h"
+#include "hook_profiler.h"
+
+HookProfiler global_hook_profiler;
+
+static const char * HOOK_PROFILE_NAMES[HOOK_PROFILE_COUNT] = {
+  "closesocket",
+  "connect",
+  "recv",
+  "WSARecv",
+  "send",
+  "WSASend",
+  "select",
+  "getaddrinfo",
+  "GetAddrInfoW",
+  "gethostbyname",
+  "WSAGetOverlappedResult",
+  "PR_Read",
+  "PR_Write",
+  "PR_Close",
+  "SSL_ImportFD",
+  "EncryptMessage",
+  "DecryptMessage",
+  "InitializeSecurityContext",
+  "InternetConnect",
+  "HttpOpenRequest",
+  "HttpSendRequest",
+  "InternetStatusCallback",
+  "BitBlt",
+  "EndPaint"
+};
+
+/*-----------------------------------------------------------------------------
+-----------------------------------------------------------------------------*/
+void HookProfiler::Histogram::Clear(void) {
+  count_ = 0;
+  total_ns_ = 0;
+  max_ns_ = 0;
+  memset(buckets_, 0, sizeof(buckets_));
+}
+
+/*-----------------------------------------------------------------------------
+-----------------------------------------------------------------------------*/
+void HookProfiler::Histogram::Add(const Histogram& src) {
+  count_ += src.count_;
+  total_ns_ += src.total_ns_;
+  max_ns_ = max(max_ns_, src.max_ns_);
+  for (int i = 0; i < BUCKETS; i++)
+    buckets_[i] += src.buckets_[i];
+}
+
+/*-----------------------------------------------------------------------------
+  Remove the counts that were there when the profiler was last reset (the
+  max can't be un-merged so it is kept as-is)
+-----------------------------------------------------------------------------*/
+void HookProfiler::Histogram::Subtract(const Histogram& src) {
+  count_ -= min(count_, src.count_);
+  total_ns_ -= min(total_ns_, src.total_ns_);
+  for (int i = 0; i < BUCKETS; i++)
+    buckets_[i] -= min(buckets_[i], src.buckets_[i]);
+}
+
+/*-----------------------------------------------------------------------------
+-----------------------------------------------------------------------------*/
+HookProfiler::HookProfiler(void):
+  threads_(NULL)
+  , ns_per_tick_(0) {
+  InitializeCriticalSection(&cs_);
+  tls_index_ = TlsAlloc();
+  LARGE_INTEGER freq;
+  if (QueryPerformanceFrequency(&freq) && freq.QuadPart)
+    ns_per_tick_ = 1000000000.0 / (double)freq.QuadPart;
+  for (int i = 0; i < HOOK_PROFILE_COUNT; i++) {
+    baseline_[i].Clear();
+    exited_[i].Clear();
+  }
+}
+
+/*-----------------------------------------------------------------------------
+-----------------------------------------------------------------------------*/
+HookProfiler::~HookProfiler(void) {
+  ThreadStats * stats = threads_;
+  threads_ = NULL;
+  while (stats) {
+    ThreadStats * next = stats->next_;
+    HeapFree(GetProcessHeap(), 0, stats);
+    stats = next;
+  }
+  if (tls_index_ != TLS_OUT_OF_INDEXES)
+    TlsFree(tls_index_);
+  DeleteCriticalSection(&cs_);
+}
+
+/*-----------------------------------------------------------------------------
+  Called on DLL_THREAD_DETACH: fold the exiting thread's histograms into
+  the totals and release its block.  New blocks are only ever pushed onto
+  the head of the list so anything behind the head can be unlinked under
+  the lock while other threads keep recording.
+-----------------------------------------------------------------------------*/
+void HookProfiler::ThreadExit(void) {
+  if (tls_index_ == TLS_OUT_OF_INDEXES)
+    return;
+  ThreadStats * stats = (ThreadStats *)TlsGetValue(tls_index_);
+  if (stats) {
+    TlsSetValue(tls_index_, NULL);
+    EnterCriticalSection(&cs_);
+    if (InterlockedCompareExchangePointer((PVOID volatile *)&threads_,
+                                          stats->next_, stats) != stats) {
+      ThreadStats * previous = threads_;
+      while (previous && previous->next_ != stats)
+        previous = previous->next_;
+      if (previous)
+        previous->next_ = stats->next_;
+    }
+    for (int i = 0; i < HOOK_PROFILE_COUNT; i++)
+      exited_[i].Add(stats->functions_[i]);
+    LeaveCriticalSection(&cs_);
+    HeapFree(GetProcessHeap(), 0, stats);
+  }
+}
+
+/*-----------------------------------------------------------------------------
+  Find (or create) the stats block for the current thread.  New blocks are
+  pushed onto the front of the list with a compare-exchange so creating
+  one never blocks another thread.
+-----------------------------------------------------------------------------*/
+HookProfiler::ThreadStats * HookProfiler::GetThreadStats(void) {
+  ThreadStats * stats = NULL;
+  if (tls_index_ != TLS_OUT_OF_INDEXES) {
+    stats = (ThreadStats *)TlsGetValue(tls_index_);
+    if (!stats) {
+      stats = (ThreadStats *)HeapAlloc(GetProcessHeap(), HEAP_ZERO_MEMORY,
+                                       sizeof(ThreadStats));
+      if (stats) {
+        ThreadStats * head;
+        do {
+          head = threads_;
+          stats->next_ = head;
+        } while (InterlockedCompareExchangePointer(
+                    (PVOID volatile *)&threads_, stats, head) != head);
+        TlsSetValue(tls_index_, stats);
+      }
+    }
+  }
+  return stats;
+}
+
+/*-----------------------------------------------------------------------------
+  Bucket layout: values below SUB_BUCKETS ns get their own bucket, after
+  that each power of 2 is split into SUB_BUCKETS linear buckets.
+-----------------------------------------------------------------------------*/
+int HookProfiler::BucketIndex(unsigned __int64 ns) {
+  if (ns < SUB_BUCKETS)
+    return (int)ns;
+  int msb = 0;
+  unsigned __int64 value = ns;
+  while (value >>= 1)
+    msb++;
+  int sub = (int)((ns >> (msb - SUB_BUCKET_BITS)) & (SUB_BUCKETS - 1));
+  int index = (msb - SUB_BUCKET_BITS + 1) * SUB_BUCKETS + sub;
+  return min(index, BUCKETS - 1);
+}
+
+/*-----------------------------------------------------------------------------
+-----------------------------------------------------------------------------*/
+unsigned __int64 HookProfiler::BucketUpperBound(int index) {
+  if (index < SUB_BUCKETS)
+    return index;
+  int msb = index / SUB_BUCKETS + SUB_BUCKET_BITS - 1;
+  unsigned __int64 sub = index % SUB_BUCKETS;
+  return (((unsigned __int64)SUB_BUCKETS + sub + 1) <<
+          (msb - SUB_BUCKET_BITS)) - 1;
+}
+
+/*-----------------------------------------------------------------------------
+  Only touches memory owned by the calling thread (no locks)
+-----------------------------------------------------------------------------*/
+void HookProfiler::Record(HookProfileFunction function, LONGLONG ticks) {
+  if (function >= 0 && function < HOOK_PROFILE_COUNT) {
+    ThreadStats * stats = GetThreadStats();
+    if (stats) {
+      unsigned __int64 ns = ticks > 0 ?
+          (unsigned __int64)((double)ticks * ns_per_tick_) : 0;
+      Histogram& histogram = stats->functions_[function];
+      histogram.count_++;
+      histogram.total_ns_ += ns;
+      if (ns > histogram.max_ns_)
+        histogram.max_ns_ = ns;
+      histogram.buckets_[BucketIndex(ns)]++;
+    }
+  }
+}
+
+/*-----------------------------------------------------------------------------
+  Sum the histograms from all of the threads (the counters may be a few
+  calls behind for threads that are actively recording)
+-----------------------------------------------------------------------------*/
+void HookProfiler::Sum(Histogram * totals) {
+  for (int i = 0; i < HOOK_PROFILE_COUNT; i++) {
+    totals[i].Clear();
+    totals[i].Add(exited_[i]);
+  }
+  ThreadStats * stats = threads_;
+  while (stats) {
+    for (int i = 0; i < HOOK_PROFILE_COUNT; i++)
+      totals[i].Add(stats->functions_[i]);
+    stats = stats->next_;
+  }
+}
+
+/*-----------------------------------------------------------------------------
+  The recording threads own their counters so rather than clearing them
+  we remember the current totals and report relative to those.
+-----------------------------------------------------------------------------*/
+void HookProfiler::Reset(void) {
+  EnterCriticalSection(&cs_);
+  Sum(baseline_);
+  LeaveCriticalSection(&cs_);
+}
+
+/*-----------------------------------------------------------------------------
+-----------------------------------------------------------------------------*/
+unsigned __int64 HookProfiler::Percentile(const Histogram& histogram,
+                                          double percentile) {
+  unsigned __int64 value = 0;
+  if (histogram.count_) {
+    unsigned __int64 target =
+        (unsigned __int64)((double)histogram.count_ * percentile / 100.0);
+    if (target < 1)
+      target = 1;
+    unsigned __int64 count = 0;
+    for (int i = 0; i < BUCKETS; i++) {
+      count += histogram.buckets_[i];
+      if (count >= target) {
+        value = min(BucketUpperBound(i), histogram.max_ns_);
+        break;
+      }
+    }
+  }
+  return value;
+}
+
+/*-----------------------------------------------------------------------------
+  {"send":{"count":n,"totalNs":n,"maxNs":n,"p50Ns":n,"p90Ns":n,"p99Ns":n,
+           "histogram":[[upper bound ns, count],...]}, ...}
+  (only the functions that were called and the buckets that have counts)
+-----------------------------------------------------------------------------*/
+CStringA HookProfiler::GetStatsJSON(void) {
+  Histogram * totals = new Histogram[HOOK_PROFILE_COUNT];
+  EnterCriticalSection(&cs_);
+  Sum(totals);
+  for (int i = 0; i < HOOK_PROFILE_COUNT; i++)
+    totals[i].Subtract(baseline_[i]);
+  LeaveCriticalSection(&cs_);
+
+  CStringA json = "{";
+  bool first = true;
+  CStringA buff;
+  for (int i = 0; i < HOOK_PROFILE_COUNT; i++) {
+    Histogram& histogram = totals[i];
+    if (histogram.count_) {
+      if (!first)
+        json += ",";
+      first = false;
+      buff.Format("\"%s\":{\"count\":%I64u,\"totalNs\":%I64u,\"maxNs\":%I64u,"
+                  "\"p50Ns\":%I64u,\"p90Ns\":%I64u,\"p99Ns\":%I64u,"
+                  "\"histogram\":[",
+                  HOOK_PROFILE_NAMES[i], histogram.count_,
+                  histogram.total_ns_, histogram.max_ns_,
+                  Percentile(histogram, 50), Percentile(histogram, 90),
+                  Percentile(histogram, 99));
+      json += buff;
+      bool first_bucket = true;
+      for (int bucket = 0; bucket < BUCKETS; bucket++) {
+        if (histogram.buckets_[bucket]) {
+          buff.Format("%s[%I64u,%u]", first_bucket ? "" : ",",
+                      BucketUpperBound(bucket), histogram.buckets_[bucket]);
+          json += buff;
+          first_bucket = false;
+        }
+      }
+      json += "]}";
+    }
+  }
+  json += "}";
+  delete [] totals;
+  return json;
+}
@@ -0,0 +1,149 @@
+/******************************************************************************
+Copyright (c) 2013, Google Inc.
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without 
+modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice, 
+      this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+    * Neither the name of the <ORGANIZATION> nor the names of its contributors 
+    may be used to endorse or promote products derived from this software 
+    without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE 
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE 
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL 
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR 
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER 
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, 
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE 
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+******************************************************************************/
+
+#pragma once
+
+/*-----------------------------------------------------------------------------
+  Self-profiling of the hook entry points.  Each hooked call records the time
+  spent in our own code (the time spent in the original function is
+  excluded) into a per-thread log-linear histogram so the recording path
+  never takes a lock.  The histograms from all of the threads are summed
+  when the results are saved.
+-----------------------------------------------------------------------------*/
+typedef enum {
+  HOOK_PROFILE_CLOSESOCKET = 0,
+  HOOK_PROFILE_CONNECT,
+  HOOK_PROFILE_RECV,
+  HOOK_PROFILE_WSARECV,
+  HOOK_PROFILE_SEND,
+  HOOK_PROFILE_WSASEND,
+  HOOK_PROFILE_SELECT,
+  HOOK_PROFILE_GETADDRINFO,
+  HOOK_PROFILE_GETADDRINFOW,
+  HOOK_PROFILE_GETHOSTBYNAME,
+  HOOK_PROFILE_WSAGETOVERLAPPEDRESULT,
+  HOOK_PROFILE_PR_READ,
+  HOOK_PROFILE_PR_WRITE,
+  HOOK_PROFILE_PR_CLOSE,
+  HOOK_PROFILE_SSL_IMPORTFD,
+  HOOK_PROFILE_ENCRYPTMESSAGE,
+  HOOK_PROFILE_DECRYPTMESSAGE,
+  HOOK_PROFILE_INITIALIZESECURITYCONTEXT,
+  HOOK_PROFILE_INTERNETCONNECT,
+  HOOK_PROFILE_HTTPOPENREQUEST,
+  HOOK_PROFILE_HTTPSENDREQUEST,
+  HOOK_PROFILE_INTERNETSTATUSCALLBACK,
+  HOOK_PROFILE_BITBLT,
+  HOOK_PROFILE_ENDPAINT,
+  HOOK_PROFILE_COUNT
+} HookProfileFunction;
+
+class HookProfiler {
+public:
+  HookProfiler(void);
+  ~HookProfiler(void);
+
+  void Record(HookProfileFunction function, LONGLONG ticks);
+  void ThreadExit(void);
+  void Reset(void);
+  CStringA GetStatsJSON(void);
+
+  // 8 linear sub-buckets for each power of 2 of nanoseconds (~12% precision)
+  static const int SUB_BUCKET_BITS = 3;
+  static const int SUB_BUCKETS = 1 << SUB_BUCKET_BITS;
+  static const int BUCKETS = 40 * SUB_BUCKETS;
+
+  class Histogram {
+  public:
+    void Clear(void);
+    void Add(const Histogram& src);
+    void Subtract(const Histogram& src);
+
+    unsigned __int64  count_;
+    unsigned __int64  total_ns_;
+    unsigned __int64  max_ns_;
+    DWORD             buckets_[BUCKETS];
+  };
+
+private:
+  class ThreadStats {
+  public:
+    ThreadStats * next_;
+    Histogram     functions_[HOOK_PROFILE_COUNT];
+  };
+
+  static int BucketIndex(unsigned __int64 ns);
+  static unsigned __int64 BucketUpperBound(int index);
+  static unsigned __int64 Percentile(const Histogram& histogram,
+                                     double percentile);
+  ThreadStats * GetThreadStats(void);
+  void Sum(Histogram * totals);
+
+  DWORD                   tls_index_;
+  ThreadStats * volatile  threads_;
+  double                  ns_per_tick_;
+  CRITICAL_SECTION        cs_;            // not used when recording
+  Histogram               baseline_[HOOK_PROFILE_COUNT];
+  Histogram               exited_[HOOK_PROFILE_COUNT];  // finished threads
+};
+
+extern HookProfiler global_hook_profiler;
+
+/*-----------------------------------------------------------------------------
+  Scoped timer for a hook entry point.  Wrap the call to the original
+  function in StartOriginal()/EndOriginal() so it is not counted.
+  The destructor runs after the original function returned so it has to
+  leave the thread's last error alone (callers check for WSAEWOULDBLOCK,
+  WSA_IO_PENDING, etc).
+-----------------------------------------------------------------------------*/
+class HookTimer {
+public:
+  HookTimer(HookProfileFunction function):function_(function),original_(0){
+    QueryPerformanceCounter(&start_);
+  }
+  ~HookTimer() {
+    DWORD error = GetLastError();
+    LARGE_INTEGER end;
+    QueryPerformanceCounter(&end);
+    global_hook_profiler.Record(function_,
+                                end.QuadPart - start_.QuadPart - original_);
+    SetLastError(error);
+  }
+  void StartOriginal() { QueryPerformanceCounter(&original_start_); }
+  void EndOriginal() {
+    LARGE_INTEGER end;
+    QueryPerformanceCounter(&end);
+    original_ += end.QuadPart - original_start_.QuadPart;
+  }
+
+private:
+  HookProfileFunction function_;
+  LARGE_INTEGER       start_;
+  LARGE_INTEGER       original_start_;
+  LONGLONG            original_;
+};
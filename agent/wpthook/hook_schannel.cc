@@ -3,6 +3,7 @@
 #include "test_state.h"
 #include "track_sockets.h"
 #include "wpt_test_hook.h"
+#include "hook_profiler.h"
 #include "hook_schannel.h"
 
 static SchannelHook* g_hook = NULL;
@@ -161,11 +162,14 @@ SECURITY_STATUS SchannelHook::InitializeSecurityContextW(
     unsigned long Reserved2, PCtxtHandle phNewContext,
     PSecBufferDesc pOutput, unsigned long * pfContextAttr,
     PTimeStamp ptsExpiry) {
+  HookTimer timer(HOOK_PROFILE_INITIALIZESECURITYCONTEXT);
   SECURITY_STATUS ret = SEC_E_INTERNAL_ERROR;
   if (InitializeSecurityContextW_) {
+    timer.StartOriginal();
     ret = InitializeSecurityContextW_(phCredential, phContext,
             pszTargetName, fContextReq, Reserved1, TargetDataRep, pInput,
             Reserved2, phNewContext, pOutput, pfContextAttr, ptsExpiry);
+    timer.EndOriginal();
     if (!phContext && phNewContext) {
       _sockets.SetSslFd((PRFileDesc *)phNewContext);
     }
@@ -183,11 +187,14 @@ SECURITY_STATUS SchannelHook::InitializeSecurityContextA(
     unsigned long Reserved2, PCtxtHandle phNewContext,
     PSecBufferDesc pOutput, unsigned long * pfContextAttr,
     PTimeStamp ptsExpiry) {
+  HookTimer timer(HOOK_PROFILE_INITIALIZESECURITYCONTEXT);
   SECURITY_STATUS ret = SEC_E_INTERNAL_ERROR;
   if (InitializeSecurityContextA_) {
+    timer.StartOriginal();
     ret = InitializeSecurityContextA_(phCredential, phContext,
             pszTargetName, fContextReq, Reserved1, TargetDataRep, pInput,
             Reserved2, phNewContext, pOutput, pfContextAttr, ptsExpiry);
+    timer.EndOriginal();
     if (!phContext && phNewContext) {
       _sockets.SetSslFd((PRFileDesc *)phNewContext);
     }
@@ -211,6 +218,7 @@ SECURITY_STATUS SchannelHook::DeleteSecurityContext(PCtxtHandle phContext) {
 -----------------------------------------------------------------------------*/
 SECURITY_STATUS SchannelHook::EncryptMessage(PCtxtHandle phContext, 
     unsigned long fQOP, PSecBufferDesc pMessage, unsigned long MessageSeqNo) {
+  HookTimer timer(HOOK_PROFILE_ENCRYPTMESSAGE);
   SECURITY_STATUS ret = SEC_E_INTERNAL_ERROR;
   if (EncryptMessage_) {
     SOCKET s = INVALID_SOCKET;
@@ -228,7 +236,9 @@ SECURITY_STATUS SchannelHook::EncryptMessage(PCtxtHandle phContext,
         }
       }
     }
+    timer.StartOriginal();
     ret = EncryptMessage_(phContext, fQOP, pMessage, MessageSeqNo);
+    timer.EndOriginal();
   }
   return ret;
 }
@@ -237,10 +247,14 @@ SECURITY_STATUS SchannelHook::EncryptMessage(PCtxtHandle phContext,
 -----------------------------------------------------------------------------*/
 SECURITY_STATUS SchannelHook::DecryptMessage(PCtxtHandle phContext, 
     PSecBufferDesc pMessage,unsigned long MessageSeqNo,unsigned long * pfQOP) {
+  HookTimer timer(HOOK_PROFILE_DECRYPTMESSAGE);
   SECURITY_STATUS ret = SEC_E_INTERNAL_ERROR;
   if (DecryptMessage_) {
     SOCKET s = INVALID_SOCKET;
+    timer.StartOriginal();
     ret = DecryptMessage_(phContext, pMessage, MessageSeqNo, pfQOP);
+    timer.EndOriginal();
+
     if (ret == SEC_E_OK && pMessage && !_test_state._exit) {
       if (_sockets.SslSocketLookup((PRFileDesc *)phContext, s) && 
             s != INVALID_SOCKET) {
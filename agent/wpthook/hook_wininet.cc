@@ -3,6 +3,7 @@
 #include "test_state.h"
 #include "track_sockets.h"
 #include "hook_wininet.h"
+#include "hook_profiler.h"
 #include "../wptdriver/wpt_test.h"
 
 static WinInetHook* g_hook = NULL;
@@ -307,6 +308,7 @@ INTERNET_STATUS_CALLBACK WinInetHook::InternetSetStatusCallback(
 void WinInetHook::InternetStatusCallback(HINTERNET hInternet, 
   DWORD_PTR dwContext, DWORD dwInternetStatus, LPVOID lpvStatusInformation, 
   DWORD dwStatusInformationLength) {
+  HookTimer timer(HOOK_PROFILE_INTERNETSTATUSCALLBACK);
 
   AtlTrace(_T("WinInetHook::InternetStatusCallback"));
 
@@ -379,8 +381,10 @@ void WinInetHook::InternetStatusCallback(HINTERNET hInternet,
   LeaveCriticalSection(&cs);
   
   if (cb) {
+    timer.StartOriginal();
     cb(hInternet, dwContext, dwInternetStatus, lpvStatusInformation, 
       dwStatusInformationLength);
+    timer.EndOriginal();
   }
 }
 
@@ -389,6 +393,7 @@ void WinInetHook::InternetStatusCallback(HINTERNET hInternet,
 HINTERNET WinInetHook::InternetConnectW(HINTERNET hInternet, 
   LPCWSTR lpszServerName, INTERNET_PORT nServerPort, LPCWSTR lpszUserName, 
   LPCWSTR lpszPassword, DWORD dwService, DWORD dwFlags, DWORD_PTR dwContext) {
+  HookTimer timer(HOOK_PROFILE_INTERNETCONNECT);
   HINTERNET ret = NULL;
   CString server((LPCTSTR)CW2T(lpszServerName));
   CString originalServer = server;
@@ -405,9 +410,12 @@ HINTERNET WinInetHook::InternetConnectW(HINTERNET hInternet,
   }
   LeaveCriticalSection(&cs);
 
-  if (_InternetConnectW)
+  if (_InternetConnectW) {
+    timer.StartOriginal();
     ret = _InternetConnectW(hInternet, (LPCWSTR)server, nServerPort, 
             lpszUserName, lpszPassword, dwService, dwFlags, dwContext);
+    timer.EndOriginal();
+  }
     
   if (ret) {
     EnterCriticalSection(&cs);
@@ -424,15 +432,20 @@ HINTERNET WinInetHook::InternetConnectW(HINTERNET hInternet,
 HINTERNET WinInetHook::InternetConnectA(HINTERNET hInternet, 
   LPCSTR lpszServerName, INTERNET_PORT nServerPort, LPCSTR lpszUserName, 
   LPCSTR lpszPassword, DWORD dwService, DWORD dwFlags, DWORD_PTR dwContext) {
+  HookTimer timer(HOOK_PROFILE_INTERNETCONNECT);
   HINTERNET ret = NULL;
   CString server((LPCTSTR)CA2T(lpszServerName));
   CString originalServer = server;
 
   AtlTrace(_T("WinInetHook::InternetConnectA"));
 
-  if (_InternetConnectA)
-    ret = _InternetConnectA(hInternet, (LPCSTR)CT2A(server), nServerPort, 
+  if (_InternetConnectA) {
+    CT2A server_name(server);
+    timer.StartOriginal();
+    ret = _InternetConnectA(hInternet, (LPCSTR)server_name, nServerPort, 
           lpszUserName, lpszPassword, dwService, dwFlags, dwContext);
+    timer.EndOriginal();
+  }
     
   if (ret) {
     EnterCriticalSection(&cs);
@@ -452,6 +465,7 @@ HINTERNET WinInetHook::HttpOpenRequestW(HINTERNET hConnect, LPCWSTR lpszVerb,
 
   AtlTrace(_T("WinInetHook::HttpOpenRequestW"));
 
+  HookTimer timer(HOOK_PROFILE_HTTPOPENREQUEST);
   HINTERNET ret = NULL;
   void * dlgContext = NULL;
   _hook_OpenA = false;
@@ -463,8 +477,10 @@ HINTERNET WinInetHook::HttpOpenRequestW(HINTERNET hConnect, LPCWSTR lpszVerb,
     SetLastError(ERROR_INTERNET_INVALID_URL);
   } else {	
     if( _HttpOpenRequestW ) {
+      timer.StartOriginal();
       ret = _HttpOpenRequestW(hConnect, lpszVerb, lpszObjectName, lpszVersion, 
                       lpszReferrer, lplpszAcceptTypes, dwFlags, dwContext);
+      timer.EndOriginal();
     }
       
     if (ret) {
@@ -490,6 +506,7 @@ HINTERNET WinInetHook::HttpOpenRequestA(HINTERNET hConnect, LPCSTR lpszVerb,
 
   AtlTrace(_T("WinInetHook::HttpOpenRequestA"));
 
+  HookTimer timer(HOOK_PROFILE_HTTPOPENREQUEST);
   HINTERNET ret = NULL;
   bool block = false;
   CString host;
@@ -503,8 +520,10 @@ HINTERNET WinInetHook::HttpOpenRequestA(HINTERNET hConnect, LPCSTR lpszVerb,
     SetLastError(ERROR_INTERNET_INVALID_URL);
   } else {
     if (_HttpOpenRequestA) {
+      timer.StartOriginal();
       ret = _HttpOpenRequestA(hConnect, lpszVerb, lpszObjectName, 
           lpszVersion, lpszReferrer, lplpszAcceptTypes, dwFlags, dwContext);
+      timer.EndOriginal();
     }
     if (_hook_OpenA && ret) {
       EnterCriticalSection(&cs);
@@ -525,15 +544,20 @@ HINTERNET WinInetHook::HttpOpenRequestA(HINTERNET hConnect, LPCSTR lpszVerb,
 -----------------------------------------------------------------------------*/
 BOOL WinInetHook::HttpSendRequestW(HINTERNET hRequest, LPCWSTR lpszHeaders, 
   DWORD dwHeadersLength, LPVOID lpOptional, DWORD dwOptionalLength) {
+  HookTimer timer(HOOK_PROFILE_HTTPSENDREQUEST);
   BOOL ret = FALSE;
 
   AtlTrace(_T("WinInetHook::HttpSendRequestW"));
 
   SetHeaders(hRequest);  
   CString headers(lpszHeaders);
-  if (_HttpSendRequestW)
-    ret = _HttpSendRequestW(hRequest, (LPCWSTR)CT2W(headers), 
+  if (_HttpSendRequestW) {
+    CT2W request_headers(headers);
+    timer.StartOriginal();
+    ret = _HttpSendRequestW(hRequest, (LPCWSTR)request_headers, 
             headers.GetLength(), lpOptional, dwOptionalLength);
+    timer.EndOriginal();
+  }
 
   return ret;
 }
@@ -542,15 +566,21 @@ BOOL WinInetHook::HttpSendRequestW(HINTERNET hRequest, LPCWSTR lpszHeaders,
 -----------------------------------------------------------------------------*/
 BOOL WinInetHook::HttpSendRequestA(HINTERNET hRequest, LPCSTR lpszHeaders, 
   DWORD dwHeadersLength, LPVOID lpOptional, DWORD dwOptionalLength) {
+  HookTimer timer(HOOK_PROFILE_HTTPSENDREQUEST);
   BOOL ret = FALSE;
   
   AtlTrace(_T("WinInetHook::HttpSendRequestA"));
 
   SetHeaders(hRequest);
   CString headers((LPCTSTR)CA2T(lpszHeaders));
-  if (_HttpSendRequestA)
-    ret = _HttpSendRequestA(hRequest, (LPCSTR)CT2A(headers), 
+  if (_HttpSendRequestA) {
+    CT2A request_headers(headers);
+    timer.StartOriginal();
+    ret = _HttpSendRequestA(hRequest, (LPCSTR)request_headers, 
             headers.GetLength(), lpOptional, dwOptionalLength);
+    timer.EndOriginal();
+  }
+
 
   return ret;
 }
@@ -34,6 +34,7 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include "track_dns.h"
 #include "track_sockets.h"
 #include "test_state.h"
+#include "hook_profiler.h"
 
 static CWsHook * pHook = NULL;
 
@@ -387,6 +388,7 @@ SOCKET CWsHook::WSASocketW(int af, int type, int protocol,
 /*-----------------------------------------------------------------------------
 -----------------------------------------------------------------------------*/
 int CWsHook::closesocket(SOCKET s) {
+  HookTimer timer(HOOK_PROFILE_CLOSESOCKET);
 #ifdef TRACE_WINSOCK
   ATLTRACE(_T("%d - closesocket"), s);
 #endif
@@ -397,8 +399,11 @@ int CWsHook::closesocket(SOCKET s) {
   LeaveCriticalSection(&cs);
   if (!_test_state._exit)
     _sockets.Close(s);
-  if (_closesocket)
+  if (_closesocket) {
+    timer.StartOriginal();
     ret = _closesocket(s);
+    timer.EndOriginal();
+  }
   return ret;
 }
 
@@ -418,13 +423,17 @@ int CWsHook::connect(IN SOCKET s, const struct sockaddr FAR * name,
     ATLTRACE(_T("%d - connect started, unsupported protocol"), s);
   }
 #endif
+  HookTimer timer(HOOK_PROFILE_CONNECT);
   int ret = SOCKET_ERROR;
   bool allowed = true;
   _sockets.ResetSslFd();
   if (!_test_state._exit)
     allowed = _sockets.Connect(s, name, namelen);
-  if (allowed && _connect)
+  if (allowed && _connect) {
+    timer.StartOriginal();
     ret = _connect(s, name, namelen);
+    timer.EndOriginal();
+  }
   if (!ret) {
     _sockets.Connected(s);
 #ifdef TRACE_WINSOCK
@@ -491,9 +500,13 @@ BOOL CWsHook::ConnectEx(SOCKET s, const struct sockaddr FAR *name, int namelen,
 /*-----------------------------------------------------------------------------
 -----------------------------------------------------------------------------*/
 int	CWsHook::recv(SOCKET s, char FAR * buf, int len, int flags) {
+  HookTimer timer(HOOK_PROFILE_RECV);
   int ret = SOCKET_ERROR;
-  if (_recv)
+  if (_recv) {
+    timer.StartOriginal();
     ret = _recv(s, buf, len, flags);
+    timer.EndOriginal();
+  }
   if (!_test_state._exit) {
     if (ret == SOCKET_ERROR && len == 1) {
       _sockets.SetSslSocket(s);
@@ -514,10 +527,14 @@ int	CWsHook::WSARecv(SOCKET s, LPWSABUF lpBuffers, DWORD dwBufferCount,
                      LPDWORD lpNumberOfBytesRecvd, LPDWORD lpFlags, 
                      LPWSAOVERLAPPED lpOverlapped, 
                      LPWSAOVERLAPPED_COMPLETION_ROUTINE lpCompletionRoutine) {
+  HookTimer timer(HOOK_PROFILE_WSARECV);
   int ret = SOCKET_ERROR;
-  if (_WSARecv)
+  if (_WSARecv) {
+    timer.StartOriginal();
     ret = _WSARecv(s, lpBuffers, dwBufferCount, lpNumberOfBytesRecvd, lpFlags, 
                                             lpOverlapped, lpCompletionRoutine);
+    timer.EndOriginal();
+  }
 
   if (!_test_state._exit && lpBuffers && dwBufferCount) {
     if (ret == 0 && lpNumberOfBytesRecvd && *lpNumberOfBytesRecvd) {
@@ -547,6 +564,7 @@ int	CWsHook::WSARecv(SOCKET s, LPWSABUF lpBuffers, DWORD dwBufferCount,
 /*-----------------------------------------------------------------------------
 -----------------------------------------------------------------------------*/
 int CWsHook::send(SOCKET s, const char FAR * buf, int len, int flags) {
+  HookTimer timer(HOOK_PROFILE_SEND);
   int ret = SOCKET_ERROR;
 #ifdef TRACE_WINSOCK
   ATLTRACE(_T("%d - send %d bytes"), s, len);
@@ -559,7 +577,9 @@ int CWsHook::send(SOCKET s, const char FAR * buf, int len, int flags) {
       _sockets.ModifyDataOut(s, chunk, false);
       _sockets.DataOut(s, chunk, false);
     }
+    timer.StartOriginal();
     ret = _send(s, chunk.GetData(), chunk.GetLength(), flags);
+    timer.EndOriginal();
     if (ret != SOCKET_ERROR) {
         ret = original_len;
     }
@@ -574,6 +594,7 @@ int CWsHook::WSASend(SOCKET s, LPWSABUF lpBuffers, DWORD dwBufferCount,
               LPDWORD lpNumberOfBytesSent, DWORD dwFlags, 
               LPWSAOVERLAPPED lpOverlapped,
               LPWSAOVERLAPPED_COMPLETION_ROUTINE lpCompletionRoutine) {
+  HookTimer timer(HOOK_PROFILE_WSASEND);
   int ret = SOCKET_ERROR;
 #ifdef TRACE_WINSOCK
   ATLTRACE(_T("%d - WSASend %d buffers"), s, dwBufferCount);
@@ -603,8 +624,10 @@ int CWsHook::WSASend(SOCKET s, LPWSABUF lpBuffers, DWORD dwBufferCount,
       WSABUF out;
       out.buf = (char *)chunk.GetData();
       out.len = chunk.GetLength();
+      timer.StartOriginal();
       ret = _WSASend(s, &out, 1, lpNumberOfBytesSent, dwFlags, lpOverlapped,
                      lpCompletionRoutine);
+      timer.EndOriginal();
       // Respond with the number of bytes the sending app was expecting
       // to be written.  It can get confused if you write more data than
       // they provided.
@@ -616,8 +639,10 @@ int CWsHook::WSASend(SOCKET s, LPWSABUF lpBuffers, DWORD dwBufferCount,
         _send_buffers.SetAt(lpOverlapped, chunk);
       }
     } else {
+      timer.StartOriginal();
       ret = _WSASend(s, lpBuffers, dwBufferCount, lpNumberOfBytesSent,
                      dwFlags, lpOverlapped, lpCompletionRoutine);
+      timer.EndOriginal();
     }
   }
   _sockets.ResetSslFd();
@@ -629,10 +654,14 @@ int CWsHook::WSASend(SOCKET s, LPWSABUF lpBuffers, DWORD dwBufferCount,
 -----------------------------------------------------------------------------*/
 int CWsHook::select(int nfds, fd_set FAR * readfds, fd_set FAR * writefds,
               fd_set FAR * exceptfds, const struct timeval FAR * timeout) {
+  HookTimer timer(HOOK_PROFILE_SELECT);
   int ret = SOCKET_ERROR;
   _sockets.ResetSslFd();
-  if (_select)
+  if (_select) {
+    timer.StartOriginal();
     ret = _select(nfds, readfds, writefds, exceptfds, timeout);
+    timer.EndOriginal();
+  }
   if (ret > 0 && writefds && writefds->fd_count && !_connecting.IsEmpty()) {
     EnterCriticalSection(&cs);
     for (u_int i = 0; i < writefds->fd_count; i++) {
@@ -652,6 +681,7 @@ int CWsHook::select(int nfds, fd_set FAR * readfds, fd_set FAR * writefds,
 -----------------------------------------------------------------------------*/
 int	CWsHook::getaddrinfo(PCSTR pNodeName, PCSTR pServiceName, 
                          ADDRINFOA * pHints, PADDRINFOA * ppResult) {
+  HookTimer timer(HOOK_PROFILE_GETADDRINFO);
   int ret = WSAEINVAL;
   _sockets.ResetSslFd();
   void * context = NULL;
@@ -662,8 +692,12 @@ int	CWsHook::getaddrinfo(PCSTR pNodeName, PCSTR pServiceName,
     if (pHints)
       pHints->ai_flags |= AI_CANONNAME;
 
-    if (_getaddrinfo)
-      ret = _getaddrinfo(CT2A((LPCTSTR)name), pServiceName, pHints, ppResult);
+    if (_getaddrinfo) {
+      CT2A host((LPCTSTR)name);
+      timer.StartOriginal();
+      ret = _getaddrinfo(host, pServiceName, pHints, ppResult);
+      timer.EndOriginal();
+    }
 
     if (!ret && !_test_state._exit) {
       PADDRINFOA addr = *ppResult;
@@ -691,6 +725,7 @@ int	CWsHook::getaddrinfo(PCSTR pNodeName, PCSTR pServiceName,
 -----------------------------------------------------------------------------*/
 int	CWsHook::GetAddrInfoW(PCWSTR pNodeName, PCWSTR pServiceName, 
                           ADDRINFOW * pHints, PADDRINFOW * ppResult) {
+  HookTimer timer(HOOK_PROFILE_GETADDRINFOW);
   int ret = WSAEINVAL;
   _sockets.ResetSslFd();
   void * context = NULL;
@@ -701,8 +736,11 @@ int	CWsHook::GetAddrInfoW(PCWSTR pNodeName, PCWSTR pServiceName,
     if (pHints)
       pHints->ai_flags |= AI_CANONNAME;
 
-    if (_GetAddrInfoW)
+    if (_GetAddrInfoW) {
+      timer.StartOriginal();
       ret = _GetAddrInfoW(CT2W((LPCWSTR)name), pServiceName, pHints, ppResult);
+      timer.EndOriginal();
+    }
 
     if (!ret && !_test_state._exit) {
       PADDRINFOW addr = (PADDRINFOW)*ppResult;
@@ -730,6 +768,7 @@ int	CWsHook::GetAddrInfoW(PCWSTR pNodeName, PCWSTR pServiceName,
   Firefox falls back to gethostbyname if ipv6 isn't detected on the machine
 -----------------------------------------------------------------------------*/
 struct hostent * CWsHook::gethostbyname(const char * pNodeName) {
+  HookTimer timer(HOOK_PROFILE_GETHOSTBYNAME);
   struct hostent * ret = NULL;
   _sockets.ResetSslFd();
   void * context = NULL;
@@ -738,8 +777,12 @@ struct hostent * CWsHook::gethostbyname(const char * pNodeName) {
     if (!_test_state._exit)
         context = _dns.LookupStart(name);
 
-    if (_gethostbyname)
-      ret = _gethostbyname((LPCSTR)CT2A(name));
+    if (_gethostbyname) {
+      CT2A host(name);
+      timer.StartOriginal();
+      ret = _gethostbyname((LPCSTR)host);
+      timer.EndOriginal();
+    }
 
     if (ret && !_test_state._exit) {
       if (ret->h_name)
@@ -803,11 +846,16 @@ BOOL CWsHook::WSAGetOverlappedResult(SOCKET s, LPWSAOVERLAPPED lpOverlapped,
 #ifdef TRACE_WINSOCK
   ATLTRACE(_T("%d - WSAGetOverlappedResult"), s);
 #endif
+  HookTimer timer(HOOK_PROFILE_WSAGETOVERLAPPEDRESULT);
   BOOL ret = false;
   _sockets.ResetSslFd();
-  if (_WSAGetOverlappedResult)
+  if (_WSAGetOverlappedResult) {
+    timer.StartOriginal();
     ret = _WSAGetOverlappedResult(s, lpOverlapped, lpcbTransfer, fWait, 
                                   lpdwFlags);
+    timer.EndOriginal();
+  }
+
 
   if (ret && lpcbTransfer && !_test_state._exit)
     ProcessOverlappedIo(s, lpOverlapped, lpcbTransfer);
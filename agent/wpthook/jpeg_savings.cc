@@ -0,0 +1,309 @@
+/******************************************************************************
+Copyright (c) 2013, Google Inc.
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without 
+modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice, 
+      this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+    * Neither the name of the <ORGANIZATION> nor the names of its contributors 
+    may be used to endorse or promote products derived from this software 
+    without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE 
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE 
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL 
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR 
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER 
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, 
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE 
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+******************************************************************************/
+
+// No precompiled header, this file has to build without the Windows SDK
+#include "jpeg_savings.h"
+#include "analysis.h"
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <setjmp.h>
+#include "jpeglib.h"
+
+// Lossless re-encode only for images up to ~0.7 megapixels (4:2:0)
+static const size_t LOSSLESS_MAX_BLOCKS = 16384;
+// markers, tables and frame/scan headers of a re-encoded image
+static const size_t ESTIMATE_HEADER_BYTES = 600;
+// Requantizing already-quantized coefficients leaves a few more non-zero
+// values than the encoder gets from fresh DCT output (calibrated with
+// jpeg_savings_bench)
+static const double REQUANTIZE_CORRECTION = 0.96;
+
+/*-----------------------------------------------------------------------------
+  libjpeg errors long-jump back out instead of exiting
+-----------------------------------------------------------------------------*/
+struct SavingsErrorMgr {
+  struct jpeg_error_mgr pub;
+  jmp_buf               jump;
+};
+
+static void SavingsErrorExit(j_common_ptr cinfo) {
+  SavingsErrorMgr * err = (SavingsErrorMgr *)cinfo->err;
+  longjmp(err->jump, 1);
+}
+
+static void SavingsOutputMessage(j_common_ptr) {
+}
+
+/*-----------------------------------------------------------------------------
+  Symbol counts for one Huffman table
+-----------------------------------------------------------------------------*/
+class SymbolStats {
+public:
+  SymbolStats(){memset(counts_, 0, sizeof(counts_));}
+  void Add(int symbol){counts_[symbol & 0xFF]++;}
+
+  // Bits an optimal code would take (close to the optimized Huffman size)
+  double Bits() const {
+    double total = 0;
+    for (int i = 0; i < 256; i++)
+      total += (double)counts_[i];
+    double bits = 0;
+    if (total > 0) {
+      for (int i = 0; i < 256; i++) {
+        if (counts_[i])
+          bits += (double)counts_[i] * (log(total / (double)counts_[i]) /
+                                        log(2.0));
+      }
+    }
+    return bits;
+  }
+
+  unsigned long counts_[256];
+};
+
+/*-----------------------------------------------------------------------------
+-----------------------------------------------------------------------------*/
+static inline int MagnitudeBits(int value) {
+  if (value < 0)
+    value = -value;
+  int bits = 0;
+  if (value >= 256) {
+    bits += 8;
+    value >>= 8;
+  }
+  if (value >= 16) {
+    bits += 4;
+    value >>= 4;
+  }
+  if (value >= 4) {
+    bits += 2;
+    value >>= 2;
+  }
+  if (value >= 2) {
+    bits++;
+    value >>= 1;
+  }
+  return bits + value;
+}
+
+/*-----------------------------------------------------------------------------
+  Requantize one coefficient from the original table entry to the target
+  one (coarser targets only, requantizing can't add detail back).
+-----------------------------------------------------------------------------*/
+static inline int Requantize(int value, int from, int to) {
+  if (to <= from)
+    return value;
+  // only reached for from < to <= 255 so this fits in an int
+  int scaled = value * from;
+  int half = to / 2;
+  return scaled >= 0 ? (scaled + half) / to : -((-scaled + half) / to);
+}
+
+/*-----------------------------------------------------------------------------
+  Predict the scan size of an optimized baseline encoding of the
+  coefficients after requantizing them to |target_quality|.
+-----------------------------------------------------------------------------*/
+static size_t PredictScanBytes(j_decompress_ptr cinfo,
+                               jvirt_barray_ptr * coefs, int target_quality,
+                               size_t& blocks) {
+  SymbolStats dc[2], ac[2];
+  double magnitude_bits = 0;
+  blocks = 0;
+  for (int ci = 0; ci < cinfo->num_components; ci++) {
+    jpeg_component_info * comp = &cinfo->comp_info[ci];
+    int table = ci ? 1 : 0;
+    unsigned short natural_to[64];
+    JpegScaledQuantTable(target_quality, table != 0, natural_to);
+    // tables in zig-zag order so the inner loop walks them linearly
+    int pos[64], from[64], to[64];
+    for (int k = 0; k < 64; k++) {
+      pos[k] = jpeg_zigzag_to_natural[k];
+      from[k] = comp->quant_table ? comp->quant_table->quantval[pos[k]] : 1;
+      to[k] = natural_to[pos[k]];
+    }
+    int last_dc = 0;
+    for (JDIMENSION row = 0; row < comp->height_in_blocks; row++) {
+      JBLOCKARRAY rows = (*cinfo->mem->access_virt_barray)
+          ((j_common_ptr)cinfo, coefs[ci], row, 1, FALSE);
+      JBLOCKROW block_row = rows[0];
+      for (JDIMENSION col = 0; col < comp->width_in_blocks; col++) {
+        JCOEF * block = block_row[col];
+        blocks++;
+        int value = Requantize(block[0], from[0], to[0]);
+        int diff = value - last_dc;
+        last_dc = value;
+        int bits = MagnitudeBits(diff);
+        dc[table].Add(bits);
+        magnitude_bits += bits;
+        int run = 0;
+        for (int k = 1; k < 64; k++) {
+          value = block[pos[k]];
+          if (value)
+            value = Requantize(value, from[k], to[k]);
+          if (!value) {
+            run++;
+          } else {
+            while (run > 15) {
+              ac[table].Add(0xF0);
+              run -= 16;
+            }
+            bits = MagnitudeBits(value);
+            ac[table].Add((run << 4) | bits);
+            magnitude_bits += bits;
+            run = 0;
+          }
+        }
+        if (run)
+          ac[table].Add(0x00);
+      }
+    }
+  }
+  double bits = magnitude_bits + dc[0].Bits() + dc[1].Bits() +
+                ac[0].Bits() + ac[1].Bits();
+  size_t bytes = (size_t)(bits / 8.0);
+  return bytes + bytes / 256;   // 0xFF byte stuffing
+}
+
+/*-----------------------------------------------------------------------------
+  Destination that only counts the bytes (re-uses one small buffer)
+-----------------------------------------------------------------------------*/
+struct CountingDest {
+  struct jpeg_destination_mgr pub;
+  JOCTET  buffer[16384];
+  size_t  count;
+};
+
+static void CountingInit(j_compress_ptr cinfo) {
+  CountingDest * dest = (CountingDest *)cinfo->dest;
+  dest->pub.next_output_byte = dest->buffer;
+  dest->pub.free_in_buffer = sizeof(dest->buffer);
+  dest->count = 0;
+}
+
+static boolean CountingEmpty(j_compress_ptr cinfo) {
+  CountingDest * dest = (CountingDest *)cinfo->dest;
+  dest->count += sizeof(dest->buffer);
+  dest->pub.next_output_byte = dest->buffer;
+  dest->pub.free_in_buffer = sizeof(dest->buffer);
+  return TRUE;
+}
+
+static void CountingTerm(j_compress_ptr cinfo) {
+  CountingDest * dest = (CountingDest *)cinfo->dest;
+  dest->count += sizeof(dest->buffer) - dest->pub.free_in_buffer;
+}
+
+/*-----------------------------------------------------------------------------
+  jpegtran-style lossless re-encode: same coefficients, optimized Huffman
+  tables and progressive scans.  The destination comes from the compressor's
+  own pool (like jpeg_stdio_dest) so an error long-jumping out can't leak it.
+-----------------------------------------------------------------------------*/
+static size_t LosslessSize(j_decompress_ptr src, jvirt_barray_ptr * coefs) {
+  volatile size_t size = 0;
+  struct jpeg_compress_struct dst;
+  SavingsErrorMgr err;
+  dst.err = jpeg_std_error(&err.pub);
+  err.pub.error_exit = SavingsErrorExit;
+  err.pub.output_message = SavingsOutputMessage;
+  if (!setjmp(err.jump)) {
+    jpeg_create_compress(&dst);
+#ifndef WPT_SYSTEM_LIBJPEG
+    // mozjpeg defaults to an exhaustive scan search, keep it to one pass
+    jpeg_c_set_int_param(&dst, JINT_COMPRESS_PROFILE, JCP_FASTEST);
+#endif
+    CountingDest * dest = (CountingDest *)(*dst.mem->alloc_small)
+        ((j_common_ptr)&dst, JPOOL_PERMANENT, sizeof(CountingDest));
+    dest->pub.init_destination = CountingInit;
+    dest->pub.empty_output_buffer = CountingEmpty;
+    dest->pub.term_destination = CountingTerm;
+    dest->count = 0;
+    dst.dest = &dest->pub;
+    jpeg_copy_critical_parameters(src, &dst);
+    dst.optimize_coding = TRUE;
+    jpeg_simple_progression(&dst);
+    jpeg_write_coefficients(&dst, coefs);
+    jpeg_finish_compress(&dst);
+    size = dest->count;
+  }
+  jpeg_destroy_compress(&dst);
+  return size;
+}
+
+/*-----------------------------------------------------------------------------
+  Estimate the smallest size the JPEG could be at |target_quality|.
+-----------------------------------------------------------------------------*/
+bool JpegEstimateSavings(const unsigned char * buff, size_t len,
+                         int target_quality, JpegSavings& savings) {
+  savings = JpegSavings();
+  if (!JpegIsJpeg(buff, len))
+    return false;
+  savings.original_size_ = len;
+  savings.target_size_ = len;
+  savings.quality_ = JpegEstimateQuality(buff, len);
+  savings.progressive_ = JpegCountScans(buff, len) > 1;
+
+  bool ok = false;
+  struct jpeg_decompress_struct cinfo;
+  SavingsErrorMgr err;
+  cinfo.err = jpeg_std_error(&err.pub);
+  err.pub.error_exit = SavingsErrorExit;
+  err.pub.output_message = SavingsOutputMessage;
+  if (setjmp(err.jump)) {
+    jpeg_destroy_decompress(&cinfo);
+    return false;
+  }
+  jpeg_create_decompress(&cinfo);
+  jpeg_mem_src(&cinfo, (unsigned char *)buff, (unsigned long)len);
+  if (jpeg_read_header(&cinfo, TRUE) == JPEG_HEADER_OK) {
+    jvirt_barray_ptr * coefs = jpeg_read_coefficients(&cinfo);
+    if (coefs) {
+      size_t blocks = 0;
+      size_t scan = PredictScanBytes(&cinfo, coefs, target_quality, blocks);
+      if (savings.quality_ > target_quality)
+        scan = (size_t)((double)scan * REQUANTIZE_CORRECTION);
+      savings.predicted_size_ = ESTIMATE_HEADER_BYTES + scan;
+      if (savings.predicted_size_ < savings.target_size_)
+        savings.target_size_ = savings.predicted_size_;
+
+      // Nothing gets requantized when the original is already at or below
+      // the target quality, the only savings left are in the entropy
+      // coding and the exact answer is cheap for small images.
+      if (blocks <= LOSSLESS_MAX_BLOCKS &&
+          savings.quality_ <= target_quality) {
+        savings.lossless_size_ = LosslessSize(&cinfo, coefs);
+        if (savings.lossless_size_)
+          savings.target_size_ = savings.lossless_size_ < len ?
+                                 savings.lossless_size_ : len;
+      }
+      ok = true;
+    }
+  }
+  jpeg_destroy_decompress(&cinfo);
+  return ok;
+}
@@ -0,0 +1,60 @@
+/******************************************************************************
+Copyright (c) 2013, Google Inc.
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without 
+modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice, 
+      this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+    * Neither the name of the <ORGANIZATION> nor the names of its contributors 
+    may be used to endorse or promote products derived from this software 
+    without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE 
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE 
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL 
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR 
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER 
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, 
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE 
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+******************************************************************************/
+
+#pragma once
+// Portable (no Win32/ATL, no precompiled header) JPEG savings estimate.
+// Only needs the libjpeg API so it builds against the vendored mozjpeg in
+// wpthook and against the system libjpeg for the Linux benchmark.
+#include <stddef.h>
+
+/*-----------------------------------------------------------------------------
+  How much smaller a JPEG could be.
+
+  The quantization tables give the quality the image was saved at.  The
+  entropy-coded DCT coefficients are then read without any pixel decode,
+  requantized to the target quality's tables and the size of an optimized
+  encoding is predicted from the symbol statistics.  A lossless
+  jpegtran-style re-encode (optimized Huffman tables, progressive) only
+  runs when the image is small and already at or below the target quality,
+  where it is the better answer and costs about as much as the estimate.
+-----------------------------------------------------------------------------*/
+class JpegSavings {
+public:
+  JpegSavings():quality_(-1), progressive_(false), original_size_(0),
+    predicted_size_(0), lossless_size_(0), target_size_(0) {}
+
+  int     quality_;         // estimated quality of the original (-1 unknown)
+  bool    progressive_;
+  size_t  original_size_;
+  size_t  predicted_size_;  // coefficient estimate at the target quality
+  size_t  lossless_size_;   // exact lossless optimization (0 if not run)
+  size_t  target_size_;     // smallest of the above and the original
+};
+
+bool JpegEstimateSavings(const unsigned char * buff, size_t len,
+                         int target_quality, JpegSavings& savings);
@@ -0,0 +1,325 @@
+/******************************************************************************
+Copyright (c) 2013, Google Inc.
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without 
+modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice, 
+      this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+    * Neither the name of the <ORGANIZATION> nor the names of its contributors 
+    may be used to endorse or promote products derived from this software 
+    without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE 
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE 
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL 
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR 
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER 
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, 
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE 
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+******************************************************************************/
+
+// Compares the coefficient-based JPEG savings estimate with the previous
+// method (full decode and re-encode at the target quality, optimized and
+// progressive, which is what CxImage does) for accuracy and time.
+//
+//   jpeg_savings_bench [-q quality] <file or directory>...
+//   jpeg_savings_bench -g <directory> [count]    (write a synthetic corpus)
+#include "../jpeg_savings.h"
+#include "../analysis.h"
+#include <dirent.h>
+#include <math.h>
+#include <setjmp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <string>
+#include <vector>
+#include "jpeglib.h"
+
+static const int DEFAULT_QUALITY = 85;
+static const int TIMING_RUNS = 3;     // best of
+
+struct BenchErrorMgr {
+  struct jpeg_error_mgr pub;
+  jmp_buf               jump;
+};
+
+static void BenchErrorExit(j_common_ptr cinfo) {
+  longjmp(((BenchErrorMgr *)cinfo->err)->jump, 1);
+}
+
+/*-----------------------------------------------------------------------------
+-----------------------------------------------------------------------------*/
+static double NowMs() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+/*-----------------------------------------------------------------------------
+-----------------------------------------------------------------------------*/
+static bool ReadFile(const std::string& path, std::vector<unsigned char>& data) {
+  bool ok = false;
+  FILE * file = fopen(path.c_str(), "rb");
+  if (file) {
+    fseek(file, 0, SEEK_END);
+    long len = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    if (len > 0) {
+      data.resize(len);
+      ok = fread(&data[0], 1, len, file) == (size_t)len;
+    }
+    fclose(file);
+  }
+  return ok;
+}
+
+/*-----------------------------------------------------------------------------
+  The previous method: decode to pixels and re-encode
+-----------------------------------------------------------------------------*/
+static size_t ReencodeSize(const std::vector<unsigned char>& data,
+                           int quality) {
+  volatile size_t size = 0;
+  struct jpeg_decompress_struct src;
+  struct jpeg_compress_struct dst;
+  BenchErrorMgr err;
+  unsigned char * out = NULL;
+  unsigned long out_len = 0;
+  std::vector<JSAMPLE> pixels;
+  src.err = jpeg_std_error(&err.pub);
+  dst.err = &err.pub;
+  err.pub.error_exit = BenchErrorExit;
+  jpeg_create_decompress(&src);
+  jpeg_create_compress(&dst);
+  if (!setjmp(err.jump)) {
+    jpeg_mem_src(&src, (unsigned char *)&data[0], data.size());
+    jpeg_read_header(&src, TRUE);
+    jpeg_start_decompress(&src);
+    size_t row_len = src.output_width * src.output_components;
+    pixels.resize(row_len * src.output_height);
+    while (src.output_scanline < src.output_height) {
+      JSAMPROW row = &pixels[src.output_scanline * row_len];
+      jpeg_read_scanlines(&src, &row, 1);
+    }
+    jpeg_finish_decompress(&src);
+
+    jpeg_mem_dest(&dst, &out, &out_len);
+    dst.image_width = src.output_width;
+    dst.image_height = src.output_height;
+    dst.input_components = src.output_components;
+    dst.in_color_space = src.out_color_space;
+    jpeg_set_defaults(&dst);
+    jpeg_set_quality(&dst, quality, TRUE);
+    dst.optimize_coding = TRUE;
+    jpeg_simple_progression(&dst);
+    jpeg_start_compress(&dst, TRUE);
+    while (dst.next_scanline < dst.image_height) {
+      JSAMPROW row = &pixels[dst.next_scanline * row_len];
+      jpeg_write_scanlines(&dst, &row, 1);
+    }
+    jpeg_finish_compress(&dst);
+    size = out_len;
+  }
+  jpeg_destroy_compress(&dst);
+  jpeg_destroy_decompress(&src);
+  if (out)
+    free(out);
+  return size;
+}
+
+/*-----------------------------------------------------------------------------
+  Synthetic photo-like image: smooth gradients, blobs, edges and noise
+-----------------------------------------------------------------------------*/
+static bool WriteSynthetic(const std::string& path, int width, int height,
+                           int quality, bool progressive, unsigned seed) {
+  srand(seed);
+  std::vector<JSAMPLE> pixels(width * height * 3);
+  double fx = (rand() % 100 + 1) / 4000.0, fy = (rand() % 100 + 1) / 4000.0;
+  int blobs = rand() % 12 + 3;
+  std::vector<double> bx(blobs), by(blobs), br(blobs), bc(blobs * 3);
+  for (int b = 0; b < blobs; b++) {
+    bx[b] = rand() % width;
+    by[b] = rand() % height;
+    br[b] = rand() % (width / 3 + 1) + 10;
+    for (int c = 0; c < 3; c++)
+      bc[b * 3 + c] = rand() % 256;
+  }
+  int noise = rand() % 24;
+  for (int y = 0; y < height; y++) {
+    for (int x = 0; x < width; x++) {
+      for (int c = 0; c < 3; c++) {
+        double v = 128 + 80 * sin(x * fx * (c + 1) + y * fy);
+        for (int b = 0; b < blobs; b++) {
+          double dx = x - bx[b], dy = y - by[b];
+          if (dx * dx + dy * dy < br[b] * br[b])
+            v = v * 0.3 + bc[b * 3 + c] * 0.7;
+        }
+        if (noise)
+          v += (rand() % (noise * 2 + 1)) - noise;
+        pixels[(y * width + x) * 3 + c] =
+            (JSAMPLE)(v < 0 ? 0 : v > 255 ? 255 : v);
+      }
+    }
+  }
+  FILE * file = fopen(path.c_str(), "wb");
+  if (!file)
+    return false;
+  struct jpeg_compress_struct dst;
+  struct jpeg_error_mgr err;
+  dst.err = jpeg_std_error(&err);
+  jpeg_create_compress(&dst);
+  jpeg_stdio_dest(&dst, file);
+  dst.image_width = width;
+  dst.image_height = height;
+  dst.input_components = 3;
+  dst.in_color_space = JCS_RGB;
+  jpeg_set_defaults(&dst);
+  jpeg_set_quality(&dst, quality, TRUE);
+  if (progressive)
+    jpeg_simple_progression(&dst);
+  jpeg_start_compress(&dst, TRUE);
+  while (dst.next_scanline < dst.image_height) {
+    JSAMPROW row = &pixels[dst.next_scanline * width * 3];
+    jpeg_write_scanlines(&dst, &row, 1);
+  }
+  jpeg_finish_compress(&dst);
+  jpeg_destroy_compress(&dst);
+  fclose(file);
+  return true;
+}
+
+/*-----------------------------------------------------------------------------
+-----------------------------------------------------------------------------*/
+static void AddPath(const std::string& path, std::vector<std::string>& files) {
+  struct stat info;
+  if (stat(path.c_str(), &info))
+    return;
+  if (S_ISDIR(info.st_mode)) {
+    DIR * dir = opendir(path.c_str());
+    if (dir) {
+      struct dirent * entry;
+      while ((entry = readdir(dir)) != NULL) {
+        if (entry->d_name[0] != '.')
+          AddPath(path + "/" + entry->d_name, files);
+      }
+      closedir(dir);
+    }
+  } else {
+    files.push_back(path);
+  }
+}
+
+/*-----------------------------------------------------------------------------
+-----------------------------------------------------------------------------*/
+int main(int argc, char ** argv) {
+  if (argc > 2 && !strcmp(argv[1], "-g")) {
+    int count = argc > 3 ? atoi(argv[3]) : 40;
+    static const int qualities[] = {50, 65, 75, 80, 85, 90, 95, 100};
+    for (int i = 0; i < count; i++) {
+      char name[64];
+      snprintf(name, sizeof(name), "/synthetic_%03d.jpg", i);
+      int width = 64 + (i * 97) % 1200;
+      int height = 64 + (i * 61) % 900;
+      WriteSynthetic(argv[2] + std::string(name), width, height,
+                     qualities[i % 8], i % 3 == 0, i + 1);
+    }
+    return 0;
+  }
+
+  int quality = DEFAULT_QUALITY;
+  std::vector<std::string> files;
+  for (int i = 1; i < argc; i++) {
+    if (!strcmp(argv[i], "-q") && i + 1 < argc)
+      quality = atoi(argv[++i]);
+    else
+      AddPath(argv[i], files);
+  }
+  if (files.empty()) {
+    fprintf(stderr, "usage: %s [-q quality] <file or directory>...\n"
+                    "       %s -g <directory> [count]\n", argv[0], argv[0]);
+    return 1;
+  }
+
+  // Error is the difference from the re-encode target as a percentage of
+  // the original size.  Images settled by the exact lossless re-encode are
+  // counted separately (they can only find savings the re-encode missed).
+  printf("%-32s %4s %9s %9s %9s %9s %9s %7s\n", "file", "q", "original",
+         "reencode", "predict", "lossless", "target", "error%");
+  size_t images = 0, predicted = 0, lossless_runs = 0;
+  double original_total = 0, reencode_total = 0, estimate_total = 0;
+  double error_total = 0, error_max = 0, lossless_extra = 0;
+  double reencode_ms = 0, estimate_ms = 0;
+  for (size_t f = 0; f < files.size(); f++) {
+    std::vector<unsigned char> data;
+    if (!ReadFile(files[f], data) || !JpegIsJpeg(&data[0], data.size()))
+      continue;
+    size_t reencoded = 0;
+    JpegSavings savings;
+    bool ok = false;
+    double reencode_best = 0, estimate_best = 0;
+    for (int run = 0; run < TIMING_RUNS; run++) {
+      double start = NowMs();
+      reencoded = ReencodeSize(data, quality);
+      double middle = NowMs();
+      ok = JpegEstimateSavings(&data[0], data.size(), quality, savings);
+      double end = NowMs();
+      if (!run || middle - start < reencode_best)
+        reencode_best = middle - start;
+      if (!run || end - middle < estimate_best)
+        estimate_best = end - middle;
+    }
+    if (!reencoded || !ok)
+      continue;
+    // the check never reports a target above the original size
+    size_t expected = reencoded < data.size() ? reencoded : data.size();
+    double error = ((double)savings.target_size_ - (double)expected) * 100.0 /
+                   (double)data.size();
+    images++;
+    if (savings.lossless_size_) {
+      lossless_runs++;
+      if (savings.target_size_ < expected)
+        lossless_extra += (double)(expected - savings.target_size_);
+    } else {
+      predicted++;
+      error_total += fabs(error);
+      if (fabs(error) > error_max)
+        error_max = fabs(error);
+    }
+    original_total += data.size();
+    reencode_total += expected;
+    estimate_total += savings.target_size_;
+    reencode_ms += reencode_best;
+    estimate_ms += estimate_best;
+    std::string name = files[f];
+    if (name.length() > 32)
+      name = "..." + name.substr(name.length() - 29);
+    printf("%-32s %4d %9zu %9zu %9zu %9zu %9zu %+7.2f\n", name.c_str(),
+           savings.quality_, data.size(), expected, savings.predicted_size_,
+           savings.lossless_size_, savings.target_size_, error);
+  }
+  if (!images)
+    return 1;
+  printf("\n%zu images: %zu predicted, %zu lossless re-encodes\n", images,
+         predicted, lossless_runs);
+  printf("target bytes: re-encode %.0f, estimate %.0f (original %.0f)\n",
+         reencode_total, estimate_total, original_total);
+  if (predicted)
+    printf("predicted error (%% of original size): mean %.2f, max %.2f\n",
+           error_total / predicted, error_max);
+  printf("lossless savings the re-encode missed: %.0f bytes\n",
+         lossless_extra);
+  printf("time (best of %d): re-encode %.1fms, estimate %.1fms "
+         "(%.1fx faster)\n", TIMING_RUNS, reencode_ms, estimate_ms,
+         estimate_ms > 0 ? reencode_ms / estimate_ms : 0.0);
+  return 0;
+}
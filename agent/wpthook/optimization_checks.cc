@@ -29,6 +29,8 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include "StdAfx.h"
 #include "cdn.h"
 #include "optimization_checks.h"
+#include "analysis.h"
+#include "jpeg_savings.h"
 #include "shared_mem.h"
 #include "requests.h"
 #include "test_state.h"
@@ -36,8 +38,6 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include "../wptdriver/wpt_test.h"
 
 #include "cximage/ximage.h"
-#include <zlib.h>
-#include <regex>
 #include <string>
 #include <sstream>
 
@@ -57,6 +57,9 @@ OptimizationChecks::OptimizationChecks(Requests& requests,
   , _gzip_target(0)
   , _image_compression_score(-1)
   , _cache_score(-1)
+  , _repeat_view_cached(0)
+  , _repeat_view_validated(0)
+  , _repeat_view_fetched(0)
   , _combine_score(-1)
   , _static_cdn_score(-1)
   , _progressive_jpeg_score(-1)
@@ -77,14 +80,29 @@ void OptimizationChecks::Check(void) {
   WptTrace(loglevel::kFunction,
     _T("[wpthook] - OptimizationChecks::Check()\n"));
 
+  // copy what the checks need while the requests are locked
+  _requests.Lock();
+  BuildAnalysisRequests();
+  _requests.Unlock();
+
+  // the checks (the gzip, image and regex work on every body in particular)
+  // run on the copies so the hook threads aren't held up by them
   CheckKeepAlive();
   CheckGzip();
   CheckImageCompression();
   CheckProgressiveJpeg();
   CheckCacheStatic();
-  CheckCombine();
   CheckCDN();
+  CheckCombine();
   CheckCustomRules();
+
+  _requests.Lock();
+  SaveScores();
+  _analysis.clear();
+  _analysis_requests.RemoveAll();
+  _scores.RemoveAll();
+  _bodies.RemoveAll();
+  _requests.Unlock();
   _checked = true;
 
   WptTrace(loglevel::kFunction,
@@ -92,65 +110,98 @@ void OptimizationChecks::Check(void) {
 }
 
 /*-----------------------------------------------------------------------------
-﻿  Check all the connections for keep-alive and reuse.
+  Portable records of the processed requests for the shared checks, a copy
+  of their scores and the other things the checks look up on the requests
+  (cache policy, CDN).  Call with the requests locked, the bodies are kept
+  alive by _bodies until the scores have been saved.
 -----------------------------------------------------------------------------*/
-void OptimizationChecks::CheckKeepAlive()
-{
-  int count = 0;
-  int total = 0;
-
-  _requests.Lock();
+void OptimizationChecks::BuildAnalysisRequests() {
+  _analysis.clear();
+  _analysis_requests.RemoveAll();
+  _scores.RemoveAll();
+  _bodies.RemoveAll();
+  _repeat_view_cached = 0;
+  _repeat_view_validated = 0;
+  _repeat_view_fetched = 0;
+  _base_page_CDN.Empty();
+  bool decode = !_test._custom_rules.IsEmpty();
   POSITION pos = _requests._requests.GetHeadPosition();
   while( pos ) {
     Request *request = _requests._requests.GetNext(pos);
-    if (request && request->_processed && request->GetResult() == 200) {
-      CStringA connection = request->GetResponseHeader("connection");
-      connection.MakeLower();
-      if( connection.Find("keep-alive") > -1 &&
-          connection.Find("close") == -1)
-        request->_scores._keep_alive_score = 100;
-      else {
-        CStringA host = request->GetHost();
-        bool needed = false;
-        bool reused = false;
-        POSITION pos2 = _requests._requests.GetHeadPosition();
-        while( pos2 ) {
-          Request *request2 = _requests._requests.GetNext(pos2);
-          if( request != request2 && request2->_processed ) {
-            CStringA host2 = request2->GetHost();
-            if( host2.GetLength() && !host2.CompareNoCase(host) ) {
-              needed = true;
-              if( request2->_socket_id == request->_socket_id )
-                reused = true;
-            }
-          }
-        }
-
-        if( reused )
-          request->_scores._keep_alive_score = 100;
-        else if( needed ) {
-          // HTTP 1.1 default to keep-alive
-          if (connection.Find("close") > -1 ||
-              request->_response_data.GetProtocolVersion() < 1.1)
-            request->_scores._keep_alive_score = 0;
-          else
-            request->_scores._keep_alive_score = 100;
-        }
-        else
-          request->_scores._keep_alive_score = -1;
+    if (request && request->_processed) {
+      AnalysisRequest record;
+      CStringA host = request->GetHost();
+      host.MakeLower();
+      record.host_ = (LPCSTR)host;
+      record.result_ = request->GetResult();
+      record.socket_id_ = request->_socket_id;
+      record.http_version_ = request->_response_data.GetProtocolVersion();
+      record.is_static_ = request->IsStatic();
+      record.start_ = request->GetStartTime().QuadPart;
+      CStringA value = request->GetResponseHeader("connection");
+      record.connection_ = (LPCSTR)value.MakeLower();
+      value = request->GetResponseHeader("content-encoding");
+      record.content_encoding_ = (LPCSTR)value.MakeLower();
+      value = request->GetMime();
+      record.mime_ = (LPCSTR)value.MakeLower();
+      record.response_bytes_ = request->_response_data.GetDataSize();
+      record.header_bytes_ = request->_response_data.GetHeaders().GetLength();
+      DataChunk body = request->_response_data.GetBody();
+      record.body_ = (const unsigned char *)body.GetData();
+      record.body_len_ = body.GetLength();
+      _bodies.Add(body);
+      if (decode) {
+        // the decoded body for the custom rules
+        DataChunk text = request->_response_data.GetBody(true);
+        record.text_ = text.GetData();
+        record.text_len_ = text.GetLength();
+        _bodies.Add(text);
       }
-      if( request->_scores._keep_alive_score != -1 ) {
-        count++;
-        total += request->_scores._keep_alive_score;
+      record.has_expiration_ = request->GetExpiresRemaining(
+          record.expiration_set_, record.seconds_remaining_);
+      switch (request->GetCachePolicy().RepeatView()) {
+        case REPEAT_VIEW_CACHED: _repeat_view_cached++; break;
+        case REPEAT_VIEW_VALIDATE: _repeat_view_validated++; break;
+        default: _repeat_view_fetched++; break;
       }
+      OptimizationScores scores = request->_scores;
+      IsCDN(request, scores._cdn_provider);
+      record.cdn_provider_ = (LPCSTR)scores._cdn_provider;
+      if (request->_is_base_page)
+        _base_page_CDN = scores._cdn_provider;
+      _analysis.push_back(record);
+      _analysis_requests.Add(request);
+      _scores.Add(scores);
     }
   }
-  _requests.Unlock();
+}
 
+/*-----------------------------------------------------------------------------
+  Copy the scores back to the requests (call with the requests locked)
+-----------------------------------------------------------------------------*/
+void OptimizationChecks::SaveScores() {
+  for (size_t i = 0; i < _analysis.size(); i++) {
+    Request * request = _analysis_requests[i];
+    request->_scores = _scores[i];
+    std::vector<AnalysisRuleMatch>& matches = _analysis[i].rule_matches_;
+    for (size_t m = 0; m < matches.size(); m++) {
+      CustomRulesMatch match;
+      match._name = CA2T(matches[m].name_.c_str(), CP_UTF8);
+      match._count = matches[m].count_;
+      match._value = CA2T(matches[m].value_.c_str(), CP_UTF8);
+      request->_custom_rules_matches.AddTail(match);
+    }
+  }
+}
 
-  // average the Cache scores of all of the objects for the page
-  if( count )
-    _keep_alive_score = total / count;
+/*-----------------------------------------------------------------------------
+﻿  Check all the connections for keep-alive and reuse.
+-----------------------------------------------------------------------------*/
+void OptimizationChecks::CheckKeepAlive()
+{
+  _keep_alive_score = AnalysisCheckKeepAlive(_analysis);
+  for (size_t i = 0; i < _analysis.size(); i++)
+    _scores[i]._keep_alive_score = _analysis[i].keep_alive_score_;
   WptTrace(loglevel::kFunction,
     _T("[wpthook] - OptChecks::CheckKeepAlive() keep-alive score: %d\n"),
     _keep_alive_score);
@@ -158,101 +209,23 @@ void OptimizationChecks::CheckKeepAlive()
 
 /*-----------------------------------------------------------------------------
 ﻿  Check whether the gzip compression is used.
+  A quick LZ estimate rules out bodies that could not save enough, the rest
+  are gzipped in parallel.
 -----------------------------------------------------------------------------*/
 void OptimizationChecks::CheckGzip()
 {
-  int count = 0;
-  int total = 0;
-  DWORD totalBytes = 0;
-  DWORD targetBytes = 0;
-
-  _requests.Lock();
-  POSITION pos = _requests._requests.GetHeadPosition();
-  while( pos ) {
-    Request *request = _requests._requests.GetNext(pos);
-    if (request && request->_processed &&
-        request->GetResult() == 200) {
-      CStringA encoding = request->GetResponseHeader("content-encoding");
-      encoding.MakeLower();
-      request->_scores._gzip_score = 0;
-      DWORD numRequestBytes = request->_response_data.GetDataSize();
-      DWORD targetRequestBytes = numRequestBytes;
-
-      // If there is gzip encoding, then we are all set.
-      // Spare small (<1 packet) responses.
-      if( encoding.Find("gzip") >= 0 || encoding.Find("deflate") >= 0 ) 
-        request->_scores._gzip_score = 100;
-      else if (numRequestBytes < 1400)
-        request->_scores._gzip_score = -1;
-
-      if( !request->_scores._gzip_score ) {
-        // Try gzipping to see how smaller it will be.
-        DWORD origSize = numRequestBytes;
-        DataChunk body = request->_response_data.GetBody();
-        LPBYTE bodyData = (LPBYTE)body.GetData();
-        DWORD bodyLen = body.GetLength();
-        // don't try gzip for known image formats that shouldn't be gzipped
-        if ((bodyLen > 3 &&             // JPEG FF D8 FF
-             bodyData[0] == 0xFF &&
-             bodyData[1] == 0xD8 &&
-             bodyData[2] == 0xFF) ||
-            (bodyLen > 8 &&             // PNG 89 50 4E 47 0D 0A 1A 0A
-             bodyData[0] == 0x89 &&
-             bodyData[1] == 0x50 &&
-             bodyData[2] == 0x4E &&
-             bodyData[3] == 0x47 &&
-             bodyData[4] == 0x0D &&
-             bodyData[5] == 0x0A &&
-             bodyData[6] == 0x1A &&
-             bodyData[7] == 0x0A) ||
-            (bodyLen > 6 &&             // Gif 47 49 46 38 37(9) 61
-             bodyData[0] == 0x47 &&
-             bodyData[1] == 0x49 &&
-             bodyData[2] == 0x46 &&
-             bodyData[3] == 0x38 &&
-             bodyData[5] == 0x61)) {
-          request->_scores._gzip_score = -1;
-        } else {
-          DWORD headSize = request->_response_data.GetHeaders().GetLength();
-          if (bodyLen && bodyData) {
-            DWORD len = compressBound(bodyLen);
-            if( len ) {
-              char* buff = (char*) malloc(len);
-              if( buff ) {
-                // Do the compression and check the target bytes to set for this.
-                if (compress2((LPBYTE)buff, &len, bodyData, bodyLen, 7) == Z_OK)
-                  targetRequestBytes = len + headSize;
-                free(buff);
-              }
-            }
-            // allow a pass if we don't get 10% savings or less than 1400 bytes
-            if( targetRequestBytes >= (origSize * 0.9) || 
-                origSize - targetRequestBytes < 1400 ) {
-              targetRequestBytes = origSize;
-              request->_scores._gzip_score = -1;
-            }
-          }
-        }
-      }
-
-      if( request->_scores._gzip_score != -1 ) {
-        count++;
-        total += request->_scores._gzip_score;
-        request->_scores._gzip_total = numRequestBytes;
-        request->_scores._gzip_target = targetRequestBytes;
-        targetBytes += targetRequestBytes;
-        totalBytes += numRequestBytes;
-      }
-    }
+  size_t total_bytes = 0;
+  size_t target_bytes = 0;
+  _gzip_score = AnalysisCheckGzip(_analysis, total_bytes, target_bytes);
+  for (size_t i = 0; i < _analysis.size(); i++) {
+    AnalysisRequest& record = _analysis[i];
+    OptimizationScores& scores = _scores[i];
+    scores._gzip_score = record.gzip_score_;
+    scores._gzip_total = (DWORD)record.gzip_total_;
+    scores._gzip_target = (DWORD)record.gzip_target_;
   }
-  _requests.Unlock();
-
-  _gzip_total = totalBytes;
-  _gzip_target = targetBytes;
-
-  // average the Cache scores of all of the objects for the page
-  if( count && totalBytes )
-    _gzip_score = targetBytes * 100 / totalBytes;
+  _gzip_total = (DWORD)total_bytes;
+  _gzip_target = (DWORD)target_bytes;
   WptTrace(loglevel::kFunction,
     _T("[wpthook] - OptChecks::CheckGzip() gzip score: %d\n"),
     _gzip_score);
@@ -276,87 +249,76 @@ static bool DecodeImage(CxImage& img, BYTE * buffer, DWORD size,
 }
 
 /*-----------------------------------------------------------------------------
-﻿  Check whether the image compression is used well.
+  Estimate the quality-85 size of a JPEG straight from its quantization
+  tables and coefficients (no pixel decode or re-encode)
 -----------------------------------------------------------------------------*/
-void OptimizationChecks::CheckImageCompression()
-{
-  _image_compression_score = -1;
-  int count = 0;
-  int total = 0;
-  DWORD totalBytes = 0;
-  DWORD targetBytes = 0;
-
-  _requests.Lock();
-  POSITION pos = _requests._requests.GetHeadPosition();
-  int fileCount = 0;
-  while( pos ) {
-    Request *request = _requests._requests.GetNext(pos);
-    if (request && request->_processed && request->GetResult() == 200) {
-      int temp_pos = 0;
-      CStringA mime = request->GetResponseHeader("content-type").Tokenize(";",
-        temp_pos);
-      mime.MakeLower();
+static bool EstimateJpeg(BYTE * buffer, DWORD size, JpegSavings& savings) {
+  bool ret = false;
 
-      // If there is response body and it is an image.
-      DataChunk body = request->_response_data.GetBody();
-      if (mime.Find("image/") >= 0 && body.GetData() && body.GetLength() > 2) {
-        BYTE * buffer = (BYTE *)body.GetData();
-        if (buffer[0] == 0xFF && buffer[1] == 0xD8) {
-          DWORD targetRequestBytes = body.GetLength();
-          DWORD size = targetRequestBytes;
-          count++;
-        
-          CxImage img;
-          // Decode the image with an exception protected function.
-          if (DecodeImage(img, (BYTE*)body.GetData(),
-                          body.GetLength(), CXIMAGE_FORMAT_UNKNOWN) ) {
-            DWORD type = img.GetType();
-            switch (type) {
-            // TODO: Add appropriate scores for gif and png
-            //       once they are available.
-            // Currently, even DecodeImage doesn't support gif and png.
-            // case CXIMAGE_FORMAT_GIF:
-            // case CXIMAGE_FORMAT_PNG:
-            //  request->_scores._imageCompressionScore = 100;
-            //  break;
-            case CXIMAGE_FORMAT_JPG:
-              {
-                img.SetCodecOption(8, CXIMAGE_FORMAT_JPG);  // optimized encoding
-                img.SetCodecOption(16, CXIMAGE_FORMAT_JPG); // progressive
-                img.SetJpegQuality(85);
-                BYTE* mem = NULL;
-                int len = 0;
-                if( img.Encode(mem, len, CXIMAGE_FORMAT_JPG) && len ) {
-                  img.FreeMemory(mem);
-                  targetRequestBytes = (DWORD) len < size ? (DWORD)len: size;
-                }
-              }
-              break;
-            default:
-              request->_scores._image_compression_score = 0;
-            }
-            if( targetRequestBytes > size )
-              targetRequestBytes = size;
-            totalBytes += size;
-            targetBytes += targetRequestBytes;
-          
-            request->_scores._image_compress_total = size;
-            request->_scores._image_compress_target = targetRequestBytes;
-            request->_scores._image_compression_score = targetRequestBytes * 100 / size;
-          }
-        }
-      }
-    }
+  __try{
+    ret = JpegEstimateSavings(buffer, size, 85, savings);
+  }__except(1){
+    WptTrace(loglevel::kError,
+      _T("[wpthook] - Exception when estimating jpeg savings"));
   }
-  _requests.Unlock();
+  return ret;
+}
 
+/*-----------------------------------------------------------------------------
+  Target size of a JPEG for the image compression check: the quality-85
+  estimate, falling back to a full decode and re-encode
+-----------------------------------------------------------------------------*/
+static bool ImageTarget(const unsigned char * image, size_t len,
+                        size_t& target_len, void * context) {
+  BYTE * buffer = (BYTE *)image;
+  DWORD size = (DWORD)len;
+  JpegSavings savings;
+  if (EstimateJpeg(buffer, size, savings)) {
+    target_len = savings.target_size_;
+    return true;
+  }
 
-  _image_compress_total = totalBytes;
-  _image_compress_target = targetBytes;
+  CxImage img;
+  // Decode the image with an exception protected function.
+  if (!DecodeImage(img, buffer, size, CXIMAGE_FORMAT_UNKNOWN))
+    return false;
+  target_len = len;
+  // TODO: Add appropriate scores for gif and png once they are available.
+  // Currently, even DecodeImage doesn't support gif and png.
+  if (img.GetType() == CXIMAGE_FORMAT_JPG) {
+    img.SetCodecOption(8, CXIMAGE_FORMAT_JPG);  // optimized encoding
+    img.SetCodecOption(16, CXIMAGE_FORMAT_JPG); // progressive
+    img.SetJpegQuality(85);
+    BYTE* mem = NULL;
+    int encoded = 0;
+    if( img.Encode(mem, encoded, CXIMAGE_FORMAT_JPG) && encoded ) {
+      img.FreeMemory(mem);
+      target_len = (size_t)encoded;
+    }
+  }
+  return true;
+}
 
-  // Calculate the score based on target/total.
-  if( count && totalBytes )
-    _image_compression_score = targetBytes * 100 / totalBytes;
+/*-----------------------------------------------------------------------------
+﻿  Check whether the image compression is used well.
+-----------------------------------------------------------------------------*/
+void OptimizationChecks::CheckImageCompression()
+{
+  size_t total_bytes = 0;
+  size_t target_bytes = 0;
+  _image_compression_score = AnalysisCheckImageCompression(_analysis,
+      ImageTarget, NULL, total_bytes, target_bytes);
+  for (size_t i = 0; i < _analysis.size(); i++) {
+    AnalysisRequest& record = _analysis[i];
+    if (record.image_compression_score_ != -1) {
+      OptimizationScores& scores = _scores[i];
+      scores._image_compression_score = record.image_compression_score_;
+      scores._image_compress_total = (DWORD)record.image_compress_total_;
+      scores._image_compress_target = (DWORD)record.image_compress_target_;
+    }
+  }
+  _image_compress_total = (DWORD)total_bytes;
+  _image_compress_target = (DWORD)target_bytes;
   WptTrace(loglevel::kFunction,
     _T("[wpthook] - OptChecks::CheckImageCompression() score: %d\n"),
     _image_compression_score);
@@ -367,46 +329,19 @@ void OptimizationChecks::CheckImageCompression()
 -----------------------------------------------------------------------------*/
 void OptimizationChecks::CheckCacheStatic()
 {
-  int count = 0;
-  int total = 0;
-
-  _requests.Lock();
-  POSITION pos = _requests._requests.GetHeadPosition();
-  while( pos ) {
-    Request *request = _requests._requests.GetNext(pos);
-    bool expiration_set;
-    int seconds_remaining;
-    if( request && request->_processed && 
-      request->GetExpiresRemaining(expiration_set, seconds_remaining)) {
-      CString mime = request->GetMime().MakeLower();
-      if (mime.Find(_T("/cache-manifest")) == -1) {
-        count++;
-        request->_scores._cache_score = 0;
-
-        request->_scores._cache_time_secs = seconds_remaining;
-        if( expiration_set ) {
-          // If age more than 7 days give 100
-          // else if more than hour, give 50
-          if( seconds_remaining >= 604800 )
-            request->_scores._cache_score = 100;
-          else if( seconds_remaining >= 3600 )
-            request->_scores._cache_score = 50;
-        }
-
-        // Add the score to the total.
-        total += request->_scores._cache_score;
-      }
+  _cache_score = AnalysisCheckCache(_analysis);
+  for (size_t i = 0; i < _analysis.size(); i++) {
+    if (_analysis[i].cache_score_ != -1) {
+      OptimizationScores& scores = _scores[i];
+      scores._cache_score = _analysis[i].cache_score_;
+      scores._cache_time_secs = _analysis[i].cache_time_secs_;
     }
   }
-  _requests.Unlock();
-
-
-  // average the Cache scores of all of the objects for the page
-  if( count )
-    _cache_score = total / count;
   WptTrace(loglevel::kFunction,
-    _T("[wpthook] - OptimizationChecks::CheckCacheStatic() Cache score: %d\n"),
-    _cache_score);
+    _T("[wpthook] - OptimizationChecks::CheckCacheStatic() Cache score: %d, ")
+    _T("repeat view: %d cached, %d validated, %d fetched\n"),
+    _cache_score, _repeat_view_cached, _repeat_view_validated,
+    _repeat_view_fetched);
 }
 
 
@@ -415,64 +350,11 @@ void OptimizationChecks::CheckCacheStatic()
   domain).
 -----------------------------------------------------------------------------*/
 void OptimizationChecks::CheckCombine() {
-  // Default to 100 as "no applicable objects" is a success
-  _combine_score = 100;
-  int count = 0;
-  int total = 0;
-  int js_redundant_count = 0;
-  int css_redundant_count = 0;
-
-  _requests.Lock();
-  POSITION pos = _requests._requests.GetHeadPosition();
-  while( pos ) {
-    Request *request = _requests._requests.GetNext(pos);
-    // We consider only static results that come before start render.
-    if (request && request->_processed && request->GetResult() == 200 &&
-        (request->GetStartTime().QuadPart <= 
-         _test_state._render_start.QuadPart) &&
-        request->IsStatic()) {
-      CStringA  mime = request->GetMime().MakeLower();;
-      // Consider only css and js.
-      if( mime.Find("/css") < 0 && mime.Find("javascript") < 0 )
-        continue;
-
-      // Check if there is any combinable/redundant request for similar mime
-      // content.
-      int combinable_requests = 0;
-      POSITION pos2 = _requests._requests.GetHeadPosition();
-      while( pos2 ) {
-        Request *request2 = _requests._requests.GetNext(pos2);
-        if( request2 && request != request2 && request2->IsStatic()
-          && request2->GetStartTime().QuadPart
-          <= _test_state._render_start.QuadPart ) {
-          CStringA mime2 = request2->GetMime().MakeLower();
-          // If it has the same mime, then count as combinable.
-          if( mime2 == mime )
-            combinable_requests++;
-        }
-      }
-      // There is an applicable request.
-      count++;
-      if( combinable_requests <= 0 )
-        request->_scores._combine_score = 100;
-      else {
-        request->_scores._combine_score = 0;
-        if( mime.Find("/css") >= 0 )
-          css_redundant_count++;
-        else if( mime.Find("javascript") >= 0 )
-          js_redundant_count++;
-      }
-      total += request->_scores._combine_score;
-    }
-  }
-  _requests.Unlock();
-
-  // average the Combine scores of all of the objects for the page
-  if( count ) {
-    // For each redundant resource, reduce 10 for js and 5 for css.
-    _combine_score = max(100 - js_redundant_count *10 - css_redundant_count *5,
-      0);
-  }
+  _combine_score = AnalysisCheckCombine(_analysis,
+                                        _test_state._render_start.QuadPart);
+  for (size_t i = 0; i < _analysis.size(); i++)
+    if (_analysis[i].combine_score_ != -1)
+      _scores[i]._combine_score = _analysis[i].combine_score_;
 
   WptTrace(loglevel::kFunction,
     _T("[wpthook] - OptimizationChecks::CheckCombine() combine score: %d\n"),
@@ -484,38 +366,10 @@ void OptimizationChecks::CheckCombine() {
   used for all content.
 -----------------------------------------------------------------------------*/
 void OptimizationChecks::CheckCDN() {
-  _static_cdn_score = -1;
-  int count = 0;
-  int total = 0;
-  _base_page_CDN.Empty();
-
-  count = 0;
-  _requests.Lock();
-  POSITION pos = _requests._requests.GetHeadPosition();
-  while( pos ) {
-    Request *request = _requests._requests.GetNext(pos);
-    if (request && request->_processed) {
-      bool isStatic = false;
-      if (request->GetResult() == 200 && request->IsStatic() ) {
-        isStatic = true;
-        request->_scores._static_cdn_score = 0;
-      }
-      if (IsCDN(request, request->_scores._cdn_provider) && isStatic)
-        request->_scores._static_cdn_score = 100;
-      if (request->_is_base_page)
-        _base_page_CDN = request->_scores._cdn_provider;
-      
-      if (isStatic) {
-        count++;
-        total += request->_scores._static_cdn_score;
-      }
-    }
-  }
-  _requests.Unlock();
-
-  // Average the CDN scores of all the objects for this page.
-  if( count )
-    _static_cdn_score = total/count;
+  _static_cdn_score = AnalysisCheckStaticCdn(_analysis);
+  for (size_t i = 0; i < _analysis.size(); i++)
+    if (_analysis[i].static_cdn_score_ != -1)
+      _scores[i]._static_cdn_score = _analysis[i].static_cdn_score_;
 
   WptTrace(loglevel::kFunction,
     _T("[wpthook] - OptimizationChecks::CheckCDN() static cdn score: %d\n"),
@@ -563,45 +417,17 @@ bool OptimizationChecks::IsCDN(Request * request, CStringA &provider) {
 -----------------------------------------------------------------------------*/
 void OptimizationChecks::CheckCustomRules() {
   if (!_test._custom_rules.IsEmpty()) {
-    _requests.Lock();
-    POSITION pos = _requests._requests.GetHeadPosition();
-    while( pos ) {
-      Request *request = _requests._requests.GetNext(pos);
-      DataChunk body = request->_response_data.GetBody(true);
-      const char * body_data = body.GetData();
-      DWORD body_len = body.GetLength();
-      if (body_len && body_data) {
-        POSITION rule_pos = _test._custom_rules.GetHeadPosition();
-        while (rule_pos) {
-          CustomRule rule = _test._custom_rules.GetNext(rule_pos);
-          std::string mime = (LPCSTR)request->GetMime();
-          std::tr1::regex mime_regex(CT2A(rule._mime), 
-                                      std::tr1::regex_constants::icase | 
-                                      std::tr1::regex_constants::ECMAScript);
-          if (regex_search(mime.begin(), mime.end(), mime_regex)) {
-            CustomRulesMatch match;
-            match._name = rule._name;
-            std::string body(body_data, body_len);
-            std::tr1::regex match_regex(CT2A(rule._regex), 
-                                      std::tr1::regex_constants::icase | 
-                                      std::tr1::regex_constants::ECMAScript);
-            const std::tr1::sregex_token_iterator end;
-            std::tr1::sregex_token_iterator i(body.begin(), body.end(), 
-                                              match_regex);
-            while (i != end) {
-              match._count++;
-              if (match._value.IsEmpty()) {
-                std::string match_string = *i;
-                match._value = CA2T(match_string.c_str(), CP_UTF8);
-              }
-              i++;
-            }
-            request->_custom_rules_matches.AddTail(match);
-          }
-        }
-      }
+    std::vector<AnalysisCustomRule> rules;
+    POSITION rule_pos = _test._custom_rules.GetHeadPosition();
+    while (rule_pos) {
+      CustomRule rule = _test._custom_rules.GetNext(rule_pos);
+      AnalysisCustomRule analysis_rule;
+      analysis_rule.name_ = (LPCSTR)CT2A(rule._name, CP_UTF8);
+      analysis_rule.mime_ = (LPCSTR)CT2A(rule._mime, CP_UTF8);
+      analysis_rule.regex_ = (LPCSTR)CT2A(rule._regex, CP_UTF8);
+      rules.push_back(analysis_rule);
     }
-    _requests.Unlock();
+    AnalysisCheckCustomRules(_analysis, rules);
   }
 }
 
@@ -609,109 +435,11 @@ void OptimizationChecks::CheckCustomRules() {
 ﻿  If the object is a JPEG, see if it is progressive (and count the scans)
 -----------------------------------------------------------------------------*/
 void OptimizationChecks::CheckProgressiveJpeg() {
-  _progressive_jpeg_score = -1;
-  double progressive_bytes = 0;
-  double total_bytes = 0;
-
-  _requests.Lock();
-  POSITION pos = _requests._requests.GetHeadPosition();
-  int fileCount = 0;
-  while( pos ) {
-    Request *request = _requests._requests.GetNext(pos);
-    if (request && request->_processed && request->GetResult() == 200) {
-      int temp_pos = 0;
-      CStringA mime = request->GetResponseHeader("content-type").Tokenize(";",
-        temp_pos);
-      mime.MakeLower();
-
-      DataChunk body = request->_response_data.GetBody();
-      if (mime.Find("image/") >= 0 &&
-          body.GetData() &&
-          body.GetLength() > 0) {
-        BYTE * buffer = (BYTE *)body.GetData();
-        if (buffer[0] == 0xFF && buffer[1] == 0xD8) {
-          DWORD len = body.GetLength();
-          request->_scores._jpeg_scans = 0;
-          DWORD pos = 0;
-          BYTE * marker;
-          DWORD marker_length;
-          while (FindJPEGMarker(buffer, len, pos, marker, marker_length) &&
-                 marker) {
-            if (marker[0] == 0xff && marker[1] == 0xda)
-              request->_scores._jpeg_scans++;
-            pos += marker_length;
-          }
-
-          if (len > 10240 && request->_scores._jpeg_scans > 0) {
-            total_bytes += len;
-            if (request->_scores._jpeg_scans > 1)
-              progressive_bytes += len;
-          }
-        }
-      }
-    }
-  }
-  _requests.Unlock();
-
-  // Calculate the score based on target/total.
-  if (total_bytes > 0) {
-    _progressive_jpeg_score =
-      (int)((progressive_bytes * 100.0 / total_bytes) + 0.5);
-  }
+  _progressive_jpeg_score = AnalysisCheckProgressiveJpeg(_analysis);
+  for (size_t i = 0; i < _analysis.size(); i++)
+    if (_analysis[i].jpeg_scans_)
+      _scores[i]._jpeg_scans = _analysis[i].jpeg_scans_;
   WptTrace(loglevel::kFunction,
     _T("[wpthook] - OptChecks::CheckProgressiveJpeg() score: %d\n"),
     _progressive_jpeg_score);
 }
-
-/*-----------------------------------------------------------------------------
-  Given a JPEG byte stream, find the next marker
------------------------------------------------------------------------------*/
-bool OptimizationChecks::FindJPEGMarker(BYTE * buff, DWORD len, DWORD &pos,
-                                        BYTE * &marker, DWORD &marker_len) {
-  bool found = false;
-  marker = NULL;
-  marker_len = 0;
-  BYTE sos = 0xda;
-  if (pos < len) {
-    BYTE val = buff[pos];
-    if (val == 0xff) {
-      // ff can repeat, the actual marker comes from the first non-ff
-      while (val == 0xff && pos < len) {
-        pos++;
-        val = buff[pos];
-      }
-      marker = &buff[pos - 1];
-      pos++;
-      if ((val >= 0xd0 && val <= 0xd9) || val == 0x01) {
-        found = true;
-      } else if(val == sos) {
-        // image data
-        DWORD marker_end = pos + 1;
-        DWORD next_marker = len;
-        while (marker_end < len - 1 && !found) {
-          val = buff[marker_end];
-          if (val == 0xff) {
-            DWORD i = marker_end + 1;
-            val = buff[i];
-            if (val != 0x00) {   // escaping
-              while (i < len - 1 && val == 0xff) {
-                i++;
-                val = buff[i];
-              }
-              next_marker = marker_end;
-              found = true;
-            }
-          }
-          marker_end++;
-        }
-        marker_len = next_marker - pos;
-      } else if (pos + 1 < len) {
-        BYTE v1 = buff[pos];
-        BYTE v2 = buff[pos + 1];
-        marker_len = (DWORD)v1 * 256 + (DWORD)v2;
-        found = true;
-      }
-    }
-  }
-  return found;
-}
@@ -28,9 +28,11 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #pragma once
 
+#include "analysis.h"
+#include "request.h"
+
 class Requests;
 class TestState;
-class Request;
 class TrackDns;
 class WptTest;
 
@@ -51,6 +53,10 @@ public:
   DWORD _image_compress_total;
   DWORD _image_compress_target;
   int   _cache_score;
+  // repeat view prediction: requests served from cache, validated, fetched
+  int   _repeat_view_cached;
+  int   _repeat_view_validated;
+  int   _repeat_view_fetched;
   int   _combine_score;
   int   _static_cdn_score;
   int   _progressive_jpeg_score;
@@ -63,6 +69,7 @@ public:
   TrackDns&   _dns;
 
 private:
+  void BuildAnalysisRequests();
   void CheckCacheStatic();
   void CheckCDN();
   void CheckCombine();
@@ -72,9 +79,14 @@ private:
   void CheckKeepAlive();
   void CheckProgressiveJpeg();
   bool IsCDN(Request * request, CStringA &provider);
-
-  bool FindJPEGMarker(BYTE * buff, DWORD len, DWORD &pos,
-                      BYTE * &marker, DWORD &marker_len);
+  void SaveScores();
 
   CRITICAL_SECTION _cs_cdn;
+
+  // copies of the processed requests the checks run on without the requests
+  // lock (only valid during Check)
+  std::vector<AnalysisRequest>  _analysis;
+  CAtlArray<Request *>          _analysis_requests;
+  CAtlArray<OptimizationScores> _scores;    // saved back to the requests
+  CAtlArray<DataChunk>          _bodies;    // keep the body pointers valid
 };
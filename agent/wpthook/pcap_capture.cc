@@ -0,0 +1,298 @@
+/******************************************************************************
+Copyright (c) 2013, Google Inc.
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without 
+modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice, 
+      this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+    * Neither the name of the <ORGANIZATION> nor the names of its contributors 
+    may be used to endorse or promote products derived from this software 
+    without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE 
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE 
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL 
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR 
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER 
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, 
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE 
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+******************************************************************************/
+
+#include "StdAfx.h"
+#include "pcap_capture.h"
+
+static const LONG BLOCK_SIZE = 1024 * 1024;
+static const LONG MAX_CAPTURE_SIZE = 256 * 1024 * 1024;  // then drop packets
+static const uint32_t CLIENT_IP = 0x0100000A;           // 10.0.0.1
+static const uint64_t FILETIME_TO_UNIX_US = 11644473600000000ULL;
+
+/*-----------------------------------------------------------------------------
+  Writes the header blocks straight to the file
+-----------------------------------------------------------------------------*/
+class PcapFileSink : public PcapngSink {
+public:
+  PcapFileSink(HANDLE file):file_(file) {}
+  virtual bool Append(const PcapngPiece * pieces, int count) {
+    bool ok = true;
+    for (int i = 0; ok && i < count; i++) {
+      DWORD written = 0;
+      if (pieces[i].len)
+        ok = WriteFile(file_, pieces[i].data, (DWORD)pieces[i].len, &written,
+                       0) && written == pieces[i].len;
+    }
+    return ok;
+  }
+private:
+  HANDLE file_;
+};
+
+/*-----------------------------------------------------------------------------
+-----------------------------------------------------------------------------*/
+PcapCapture::PcapCapture(void):
+  writer_(chains_[0])
+  , generation_(0)
+  , allocated_(0)
+  , packets_(0)
+  , bytes_(0) {
+  writers_[0] = writers_[1] = 0;
+  chains_[0].capture_ = chains_[1].capture_ = this;
+  QueryPerformanceFrequency(&frequency_);
+  QueryPerformanceCounter(&start_counter_);
+  FILETIME now;
+  GetSystemTimeAsFileTime(&now);
+  ULARGE_INTEGER ft;
+  ft.LowPart = now.dwLowDateTime;
+  ft.HighPart = now.dwHighDateTime;
+  start_us_ = ft.QuadPart / 10 - FILETIME_TO_UNIX_US;
+}
+
+/*-----------------------------------------------------------------------------
+-----------------------------------------------------------------------------*/
+PcapCapture::~PcapCapture(void) {
+  Discard();
+}
+
+/*-----------------------------------------------------------------------------
+  Data for one socket, the first data sets the connection up (TLS sockets
+  that carry decrypted data are moved from 443 to 80 so Wireshark parses
+  them as HTTP).  Call with the streams locked, false if there is nothing
+  to write.
+-----------------------------------------------------------------------------*/
+bool PcapCapture::Reserve(PcapngStream& stream, DWORD socket_id,
+                          const struct sockaddr_in& server, int local_port,
+                          bool decrypted, PCAPNG_DIRECTION direction,
+                          DWORD len, PcapPacket& packet) {
+  if (!stream.initialized_) {
+    uint16_t server_port = ntohs(server.sin_port);
+    if (decrypted && server_port == 443)
+      server_port = 80;
+    if (!local_port)
+      local_port = 49152 + socket_id % 16384;
+    stream.Init(CLIENT_IP, (uint16_t)local_port, server.sin_addr.S_un.S_addr,
+                server_port, socket_id * 0x01000193);
+  }
+  if (!stream.open_ && !stream.closed_) {
+    const BYTE * ip = (const BYTE *)&server.sin_addr.S_un.S_addr;
+    packet.comment_.Format("socket %d %d.%d.%d.%d:%d%s", socket_id, ip[0],
+                           ip[1], ip[2], ip[3], ntohs(server.sin_port),
+                           decrypted ? " decrypted" : "");
+  }
+  packet.timestamp_ = Timestamp();
+  packet.direction_ = direction;
+  packet.len_ = len;
+  packet.close_ = false;
+  packet.stream_ = writer_.Reserve(stream, direction, len);
+  return stream.open_;
+}
+
+/*-----------------------------------------------------------------------------
+-----------------------------------------------------------------------------*/
+bool PcapCapture::ReserveClose(PcapngStream& stream, PcapPacket& packet) {
+  packet.timestamp_ = Timestamp();
+  packet.len_ = 0;
+  packet.close_ = true;
+  packet.stream_ = writer_.ReserveClose(stream);
+  return packet.stream_.open_;
+}
+
+/*-----------------------------------------------------------------------------
+  Build the reserved packets and copy them into the blocks, no lock needed
+-----------------------------------------------------------------------------*/
+void PcapCapture::Write(PcapPacket& packet, const char * data) {
+  LONG generation = StartWrite();
+  PcapngWriter writer(chains_[generation & 1]);
+  if (packet.close_) {
+    writer.Close(packet.stream_, packet.timestamp_);
+  } else {
+    writer.Open(packet.stream_, packet.timestamp_,
+                packet.comment_.IsEmpty() ? NULL : (LPCSTR)packet.comment_);
+    writer.Data(packet.stream_, packet.direction_, data, packet.len_,
+                packet.timestamp_);
+  }
+  InterlockedExchangeAdd(&packets_, (LONG)writer.packets_);
+  InterlockedExchangeAdd(&bytes_, (LONG)writer.bytes_);
+  InterlockedDecrement(&writers_[generation & 1]);
+}
+
+/*-----------------------------------------------------------------------------
+  Write everything captured so far and start over, false if there was
+  nothing to write
+-----------------------------------------------------------------------------*/
+bool PcapCapture::Save(const CString& file) {
+  bool ret = false;
+  Block * blocks = Detach();
+  if (blocks && blocks->filled_) {
+    HANDLE out = CreateFile(file, GENERIC_WRITE, 0, 0, CREATE_ALWAYS, 0, 0);
+    if (out != INVALID_HANDLE_VALUE) {
+      PcapFileSink sink(out);
+      ret = PcapngWriter::WriteHeader(sink, "WebPagetest wpthook");
+      for (Block * block = blocks; ret && block; block = block->next_) {
+        DWORD written = 0;
+        if (block->filled_)
+          ret = WriteFile(out, block->Data(), block->filled_, &written, 0) &&
+                written == (DWORD)block->filled_;
+      }
+      CloseHandle(out);
+      if (!ret)
+        DeleteFile(file);
+    }
+  }
+  WptTrace(loglevel::kFunction,
+           _T("[wpthook] - PcapCapture::Save() %d packets, %d bytes\n"),
+           packets_, bytes_);
+  FreeBlocks(blocks);
+  return ret;
+}
+
+/*-----------------------------------------------------------------------------
+-----------------------------------------------------------------------------*/
+void PcapCapture::Discard(void) {
+  FreeBlocks(Detach());
+}
+
+/*-----------------------------------------------------------------------------
+  Reserve space for the whole block in the current memory block, moving
+  on to (or chaining) the next one when it doesn't fit.  Reservations only
+  grow so the ones that fit are always a contiguous run from the start of
+  the block and filled_ is the length of the valid data.
+-----------------------------------------------------------------------------*/
+bool PcapCapture::Chain::Append(const PcapngPiece * pieces, int count) {
+  LONG len = 0;
+  for (int i = 0; i < count; i++)
+    len += (LONG)pieces[i].len;
+  for (;;) {
+    Block * block = current_;
+    if (!block) {
+      Block * first = capture_->NewBlock(len);
+      if (!first)
+        return false;
+      if (!InterlockedCompareExchangePointer((PVOID volatile *)&current_,
+                                             first, NULL))
+        head_ = first;
+      else
+        capture_->FreeBlocks(first);
+      continue;
+    }
+    LONG offset = InterlockedExchangeAdd(&block->reserved_, len);
+    if (offset + len <= block->size_) {
+      BYTE * out = block->Data() + offset;
+      for (int i = 0; i < count; i++) {
+        if (pieces[i].len)
+          memcpy(out, pieces[i].data, pieces[i].len);
+        out += pieces[i].len;
+      }
+      InterlockedExchangeAdd(&block->filled_, len);
+      return true;
+    }
+    Block * next = block->next_;
+    if (!next) {
+      Block * fresh = capture_->NewBlock(len);
+      if (!fresh)
+        return false;
+      next = (Block *)InterlockedCompareExchangePointer(
+          (PVOID volatile *)&block->next_, fresh, NULL);
+      if (next)
+        capture_->FreeBlocks(fresh);
+      else
+        next = fresh;
+    }
+    InterlockedCompareExchangePointer((PVOID volatile *)&current_, next,
+                                      block);
+  }
+}
+
+/*-----------------------------------------------------------------------------
+-----------------------------------------------------------------------------*/
+PcapCapture::Block * PcapCapture::NewBlock(size_t min_size) {
+  Block * block = NULL;
+  LONG size = max(BLOCK_SIZE, (LONG)min_size);
+  if (InterlockedExchangeAdd(&allocated_, size) + size <= MAX_CAPTURE_SIZE) {
+    block = (Block *)HeapAlloc(GetProcessHeap(), 0, sizeof(Block) + size);
+    if (block) {
+      block->next_ = NULL;
+      block->reserved_ = 0;
+      block->filled_ = 0;
+      block->size_ = size;
+    }
+  }
+  if (!block)
+    InterlockedExchangeAdd(&allocated_, -size);
+  return block;
+}
+
+/*-----------------------------------------------------------------------------
+-----------------------------------------------------------------------------*/
+void PcapCapture::FreeBlocks(Block * block) {
+  while (block) {
+    Block * next = block->next_;
+    InterlockedExchangeAdd(&allocated_, -block->size_);
+    HeapFree(GetProcessHeap(), 0, block);
+    block = next;
+  }
+}
+
+/*-----------------------------------------------------------------------------
+  Count a write against the current generation (trying again if a Detach
+  moves on in between) so Detach knows when the chain it took is idle
+-----------------------------------------------------------------------------*/
+LONG PcapCapture::StartWrite(void) {
+  for (;;) {
+    LONG generation = generation_;
+    InterlockedIncrement(&writers_[generation & 1]);
+    if (generation == generation_)
+      return generation;
+    InterlockedDecrement(&writers_[generation & 1]);
+  }
+}
+
+/*-----------------------------------------------------------------------------
+  Take the captured blocks, new writes go to the other (empty) chain
+-----------------------------------------------------------------------------*/
+PcapCapture::Block * PcapCapture::Detach(void) {
+  LONG generation = generation_;
+  InterlockedIncrement(&generation_);
+  while (writers_[generation & 1])
+    Sleep(0);
+  Chain& chain = chains_[generation & 1];
+  Block * blocks = chain.head_;
+  chain.head_ = NULL;
+  chain.current_ = NULL;
+  return blocks;
+}
+
+/*-----------------------------------------------------------------------------
+-----------------------------------------------------------------------------*/
+uint64_t PcapCapture::Timestamp(void) {
+  LARGE_INTEGER now;
+  QueryPerformanceCounter(&now);
+  return start_us_ + (uint64_t)(now.QuadPart - start_counter_.QuadPart) *
+                     1000000 / frequency_.QuadPart;
+}
@@ -0,0 +1,113 @@
+/******************************************************************************
+Copyright (c) 2013, Google Inc.
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without 
+modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice, 
+      this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+    * Neither the name of the <ORGANIZATION> nor the names of its contributors 
+    may be used to endorse or promote products derived from this software 
+    without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE 
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE 
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL 
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR 
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER 
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, 
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE 
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+******************************************************************************/
+
+#pragma once
+#include "pcapng_writer.h"
+
+struct sockaddr_in;
+
+// Packets for one chunk of socket data (or a close) that have been
+// reserved on the socket's stream but not built yet
+class PcapPacket {
+public:
+  PcapPacket():direction_(PCAPNG_TO_SERVER), len_(0), timestamp_(0),
+               close_(false) {}
+  PcapngStream      stream_;    // state the packets are built from
+  PCAPNG_DIRECTION  direction_;
+  DWORD             len_;
+  uint64_t          timestamp_;
+  bool              close_;
+  CStringA          comment_;   // goes on the SYN
+};
+
+/*-----------------------------------------------------------------------------
+  Synthetic per-process capture (the hookpcap test option): the socket data
+  the hooks see (decrypted for TLS) is framed as fake TCP connections by
+  PcapngWriter and appended to memory blocks without taking a lock.  A
+  packet reserves its space in the current block with an interlocked add
+  and copies itself in, whoever finds the block full chains the next one.
+  The blocks are written out to a .pcapng with the results.
+
+  Only Reserve and ReserveClose need the caller's lock (the TrackSockets
+  critical section, which owns the streams).  They just move the stream
+  along, the packets are built and copied by Write after the lock has been
+  released.  Writes count themselves against the current generation and
+  append to that generation's chain of blocks, Save/Discard switch to the
+  other chain and wait for the writes still using the old one before
+  taking it.  Save and Discard must not be called concurrently.
+-----------------------------------------------------------------------------*/
+class PcapCapture {
+public:
+  PcapCapture(void);
+  ~PcapCapture(void);
+
+  bool Reserve(PcapngStream& stream, DWORD socket_id,
+               const struct sockaddr_in& server, int local_port,
+               bool decrypted, PCAPNG_DIRECTION direction, DWORD len,
+               PcapPacket& packet);
+  bool ReserveClose(PcapngStream& stream, PcapPacket& packet);
+  void Write(PcapPacket& packet, const char * data);
+  bool Save(const CString& file);
+  void Discard(void);
+
+private:
+  class Block {
+  public:
+    Block *       next_;
+    volatile LONG reserved_;    // can run past size_ once the block is full
+    volatile LONG filled_;
+    LONG          size_;
+    BYTE *        Data() { return (BYTE *)(this + 1); }
+  };
+
+  class Chain : public PcapngSink {
+  public:
+    Chain():capture_(NULL), head_(NULL), current_(NULL) {}
+    virtual bool Append(const PcapngPiece * pieces, int count);
+    PcapCapture *     capture_;
+    Block *           head_;
+    Block * volatile  current_;
+  };
+
+  Block *  NewBlock(size_t min_size);
+  void     FreeBlocks(Block * block);
+  Block *  Detach(void);
+  LONG     StartWrite(void);
+  uint64_t Timestamp(void);
+
+  PcapngWriter      writer_;        // only for Reserve, writes use their own
+  Chain             chains_[2];     // by generation
+  volatile LONG     generation_;
+  volatile LONG     writers_[2];    // writes in progress, by generation
+  volatile LONG     allocated_;     // bytes in blocks, capped
+  volatile LONG     packets_;
+  volatile LONG     bytes_;
+  LARGE_INTEGER     start_counter_;
+  LARGE_INTEGER     frequency_;
+  uint64_t          start_us_;      // wall clock at start_counter_
+};
@@ -0,0 +1,334 @@
+/******************************************************************************
+Copyright (c) 2013, Google Inc.
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without 
+modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice, 
+      this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+    * Neither the name of the <ORGANIZATION> nor the names of its contributors 
+    may be used to endorse or promote products derived from this software 
+    without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE 
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE 
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL 
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR 
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER 
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, 
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE 
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+******************************************************************************/
+
+// No precompiled header, this file has to build without the Windows SDK
+#include "pcapng_writer.h"
+#include <string.h>
+
+static const uint32_t BLOCK_SECTION_HEADER = 0x0A0D0D0A;
+static const uint32_t BLOCK_INTERFACE = 1;
+static const uint32_t BLOCK_ENHANCED_PACKET = 6;
+static const uint32_t BYTE_ORDER_MAGIC = 0x1A2B3C4D;
+static const uint16_t LINKTYPE_RAW = 101;
+static const uint16_t OPT_END = 0;
+static const uint16_t OPT_COMMENT = 1;
+static const uint16_t OPT_IF_NAME = 2;
+static const uint16_t OPT_SHB_USERAPPL = 4;
+static const size_t MAX_OPTION_LEN = 256;   // longer strings are cut
+
+static const uint8_t TCP_FIN = 0x01;
+static const uint8_t TCP_SYN = 0x02;
+static const uint8_t TCP_PSH = 0x08;
+static const uint8_t TCP_ACK = 0x10;
+
+static const size_t IP_HEADER_LEN = 20;
+static const size_t TCP_HEADER_LEN = 20;
+static const size_t EPB_HEADER_LEN = 28;
+static const uint16_t MAX_MSS = 65535 - IP_HEADER_LEN - TCP_HEADER_LEN;
+
+static inline void Put16(uint8_t * out, uint16_t value) {
+  memcpy(out, &value, sizeof(value));
+}
+
+static inline void Put32(uint8_t * out, uint32_t value) {
+  memcpy(out, &value, sizeof(value));
+}
+
+static inline void Put16BE(uint8_t * out, uint16_t value) {
+  out[0] = (uint8_t)(value >> 8);
+  out[1] = (uint8_t)value;
+}
+
+static inline void Put32BE(uint8_t * out, uint32_t value) {
+  out[0] = (uint8_t)(value >> 24);
+  out[1] = (uint8_t)(value >> 16);
+  out[2] = (uint8_t)(value >> 8);
+  out[3] = (uint8_t)value;
+}
+
+static inline size_t Pad4(size_t len) {
+  return (4 - (len & 3)) & 3;
+}
+
+/*-----------------------------------------------------------------------------
+  Append a string option (value padded to 4 bytes), returns the new offset
+-----------------------------------------------------------------------------*/
+static size_t PutOption(uint8_t * out, size_t offset, uint16_t code,
+                        const char * value) {
+  size_t len = value ? strlen(value) : 0;
+  if (len > MAX_OPTION_LEN)
+    len = MAX_OPTION_LEN;
+  if (len) {
+    Put16(out + offset, code);
+    Put16(out + offset + 2, (uint16_t)len);
+    memcpy(out + offset + 4, value, len);
+    memset(out + offset + 4 + len, 0, Pad4(len));
+    offset += 4 + len + Pad4(len);
+  }
+  return offset;
+}
+
+/*-----------------------------------------------------------------------------
+  Close the options with opt_endofopt and write the trailing block length
+  (and the one in the block header), returns the block length
+-----------------------------------------------------------------------------*/
+static size_t FinishBlock(uint8_t * block, size_t offset) {
+  Put16(block + offset, OPT_END);
+  Put16(block + offset + 2, 0);
+  offset += 4;
+  uint32_t total = (uint32_t)(offset + 4);
+  Put32(block + offset, total);
+  Put32(block + 4, total);
+  return total;
+}
+
+/*-----------------------------------------------------------------------------
+-----------------------------------------------------------------------------*/
+static uint16_t IpChecksum(const uint8_t * header, size_t len) {
+  uint32_t sum = 0;
+  for (size_t i = 0; i + 1 < len; i += 2)
+    sum += ((uint32_t)header[i] << 8) | header[i + 1];
+  while (sum >> 16)
+    sum = (sum & 0xFFFF) + (sum >> 16);
+  return (uint16_t)~sum;
+}
+
+/*-----------------------------------------------------------------------------
+-----------------------------------------------------------------------------*/
+PcapngStream::PcapngStream():
+  initialized_(false)
+  , open_(false)
+  , closed_(false) {
+  ip_[0] = ip_[1] = 0;
+  port_[0] = port_[1] = 0;
+  next_seq_[0] = next_seq_[1] = 0;
+  ip_id_ = 0;
+}
+
+/*-----------------------------------------------------------------------------
+-----------------------------------------------------------------------------*/
+void PcapngStream::Init(uint32_t client_ip, uint16_t client_port,
+                        uint32_t server_ip, uint16_t server_port,
+                        uint32_t isn) {
+  ip_[PCAPNG_TO_SERVER] = client_ip;
+  ip_[PCAPNG_TO_CLIENT] = server_ip;
+  port_[PCAPNG_TO_SERVER] = client_port;
+  port_[PCAPNG_TO_CLIENT] = server_port;
+  next_seq_[PCAPNG_TO_SERVER] = isn;
+  next_seq_[PCAPNG_TO_CLIENT] = isn * 2654435761U;  // just has to differ
+  ip_id_ = 0;
+  initialized_ = true;
+  open_ = false;
+  closed_ = false;
+}
+
+/*-----------------------------------------------------------------------------
+-----------------------------------------------------------------------------*/
+PcapngWriter::PcapngWriter(PcapngSink& sink, uint16_t mss):
+  packets_(0)
+  , bytes_(0)
+  , sink_(sink)
+  , mss_(mss && mss <= MAX_MSS ? mss : MAX_MSS) {
+}
+
+/*-----------------------------------------------------------------------------
+-----------------------------------------------------------------------------*/
+bool PcapngWriter::WriteHeader(PcapngSink& sink, const char * application) {
+  uint8_t section[28 + MAX_OPTION_LEN + 8];
+  Put32(section, BLOCK_SECTION_HEADER);
+  Put32(section + 8, BYTE_ORDER_MAGIC);
+  Put16(section + 12, 1);                     // version 1.0
+  Put16(section + 14, 0);
+  Put32(section + 16, 0xFFFFFFFF);            // section length unknown
+  Put32(section + 20, 0xFFFFFFFF);
+  size_t section_len = FinishBlock(section,
+      PutOption(section, 24, OPT_SHB_USERAPPL, application));
+
+  uint8_t iface[16 + MAX_OPTION_LEN + 8];
+  Put32(iface, BLOCK_INTERFACE);
+  Put16(iface + 8, LINKTYPE_RAW);
+  Put16(iface + 10, 0);
+  Put32(iface + 12, 0);                       // no snap length
+  size_t iface_len = FinishBlock(iface,
+      PutOption(iface, 16, OPT_IF_NAME, "wpthook"));
+
+  PcapngPiece pieces[2] = {{section, section_len}, {iface, iface_len}};
+  return sink.Append(pieces, 1) && sink.Append(pieces + 1, 1);
+}
+
+/*-----------------------------------------------------------------------------
+  SYN, SYN/ACK and ACK (the comment goes on the SYN)
+-----------------------------------------------------------------------------*/
+void PcapngWriter::Open(PcapngStream& stream, uint64_t timestamp_us,
+                        const char * comment) {
+  if (stream.initialized_ && !stream.open_ && !stream.closed_) {
+    Packet(stream, PCAPNG_TO_SERVER, TCP_SYN, NULL, 0, timestamp_us, comment);
+    stream.next_seq_[PCAPNG_TO_SERVER]++;
+    Packet(stream, PCAPNG_TO_CLIENT, TCP_SYN | TCP_ACK, NULL, 0, timestamp_us,
+           NULL);
+    stream.next_seq_[PCAPNG_TO_CLIENT]++;
+    Packet(stream, PCAPNG_TO_SERVER, TCP_ACK, NULL, 0, timestamp_us, NULL);
+    stream.open_ = true;
+  }
+}
+
+/*-----------------------------------------------------------------------------
+  Split the data into MSS-sized segments, PSH on the last one
+-----------------------------------------------------------------------------*/
+void PcapngWriter::Data(PcapngStream& stream, PCAPNG_DIRECTION direction,
+                        const void * data, size_t len,
+                        uint64_t timestamp_us) {
+  if (!stream.open_)
+    Open(stream, timestamp_us);
+  if (stream.open_ && data && len) {
+    const uint8_t * payload = (const uint8_t *)data;
+    while (len) {
+      size_t segment = len > mss_ ? mss_ : len;
+      uint8_t flags = TCP_ACK;
+      if (segment == len)
+        flags |= TCP_PSH;
+      Packet(stream, direction, flags, payload, segment, timestamp_us, NULL);
+      stream.next_seq_[direction] += (uint32_t)segment;
+      payload += segment;
+      len -= segment;
+    }
+  }
+}
+
+/*-----------------------------------------------------------------------------
+  FIN from the client, FIN from the server and the last ACK
+-----------------------------------------------------------------------------*/
+void PcapngWriter::Close(PcapngStream& stream, uint64_t timestamp_us) {
+  if (stream.open_) {
+    Packet(stream, PCAPNG_TO_SERVER, TCP_FIN | TCP_ACK, NULL, 0,
+           timestamp_us, NULL);
+    stream.next_seq_[PCAPNG_TO_SERVER]++;
+    Packet(stream, PCAPNG_TO_CLIENT, TCP_FIN | TCP_ACK, NULL, 0,
+           timestamp_us, NULL);
+    stream.next_seq_[PCAPNG_TO_CLIENT]++;
+    Packet(stream, PCAPNG_TO_SERVER, TCP_ACK, NULL, 0, timestamp_us, NULL);
+    stream.open_ = false;
+    stream.closed_ = true;
+  }
+}
+
+/*-----------------------------------------------------------------------------
+  The same state changes as Open/Data and Close without writing anything
+  (3 packets for the handshake or close, one per segment)
+-----------------------------------------------------------------------------*/
+PcapngStream PcapngWriter::Reserve(PcapngStream& stream,
+                                   PCAPNG_DIRECTION direction,
+                                   size_t len) const {
+  PcapngStream packets = stream;
+  if (stream.initialized_ && !stream.open_ && !stream.closed_) {
+    stream.next_seq_[PCAPNG_TO_SERVER]++;
+    stream.next_seq_[PCAPNG_TO_CLIENT]++;
+    stream.ip_id_ += 3;
+    stream.open_ = true;
+  }
+  if (stream.open_ && len) {
+    stream.next_seq_[direction] += (uint32_t)len;
+    stream.ip_id_ += (uint16_t)((len + mss_ - 1) / mss_);
+  }
+  return packets;
+}
+
+PcapngStream PcapngWriter::ReserveClose(PcapngStream& stream) const {
+  PcapngStream packets = stream;
+  if (stream.open_) {
+    stream.next_seq_[PCAPNG_TO_SERVER]++;
+    stream.next_seq_[PCAPNG_TO_CLIENT]++;
+    stream.ip_id_ += 3;
+    stream.open_ = false;
+    stream.closed_ = true;
+  }
+  return packets;
+}
+
+/*-----------------------------------------------------------------------------
+  One enhanced packet block: block header + IPv4 + TCP, the payload, then
+  the padding, options and trailing length
+-----------------------------------------------------------------------------*/
+void PcapngWriter::Packet(PcapngStream& stream, PCAPNG_DIRECTION direction,
+                          uint8_t flags, const uint8_t * payload, size_t len,
+                          uint64_t timestamp_us, const char * comment) {
+  PCAPNG_DIRECTION other = direction == PCAPNG_TO_SERVER ?
+                           PCAPNG_TO_CLIENT : PCAPNG_TO_SERVER;
+  size_t packet_len = IP_HEADER_LEN + TCP_HEADER_LEN + len;
+
+  uint8_t header[EPB_HEADER_LEN + IP_HEADER_LEN + TCP_HEADER_LEN];
+  Put32(header, BLOCK_ENHANCED_PACKET);
+  Put32(header + 8, 0);                       // interface
+  Put32(header + 12, (uint32_t)(timestamp_us >> 32));
+  Put32(header + 16, (uint32_t)timestamp_us);
+  Put32(header + 20, (uint32_t)packet_len);
+  Put32(header + 24, (uint32_t)packet_len);
+
+  uint8_t * ip = header + EPB_HEADER_LEN;
+  ip[0] = 0x45;                               // IPv4, 20 byte header
+  ip[1] = 0;
+  Put16BE(ip + 2, (uint16_t)packet_len);
+  Put16BE(ip + 4, stream.ip_id_++);
+  Put16BE(ip + 6, 0x4000);                    // don't fragment
+  ip[8] = 64;                                 // TTL
+  ip[9] = 6;                                  // TCP
+  Put16BE(ip + 10, 0);
+  memcpy(ip + 12, &stream.ip_[direction], 4);
+  memcpy(ip + 16, &stream.ip_[other], 4);
+  Put16BE(ip + 10, IpChecksum(ip, IP_HEADER_LEN));
+
+  uint8_t * tcp = ip + IP_HEADER_LEN;
+  Put16BE(tcp, stream.port_[direction]);
+  Put16BE(tcp + 2, stream.port_[other]);
+  Put32BE(tcp + 4, stream.next_seq_[direction]);
+  Put32BE(tcp + 8, flags & TCP_ACK ? stream.next_seq_[other] : 0);
+  tcp[12] = (TCP_HEADER_LEN / 4) << 4;
+  tcp[13] = flags;
+  Put16BE(tcp + 14, 0xFFFF);                  // window
+  Put16BE(tcp + 16, 0);                       // checksum (offloaded)
+  Put16BE(tcp + 18, 0);
+
+  uint8_t trailer[3 + 4 + MAX_OPTION_LEN + 3 + 8];
+  size_t pad = Pad4(packet_len);
+  memset(trailer, 0, pad);
+  size_t trailer_len = PutOption(trailer, pad, OPT_COMMENT, comment);
+  Put16(trailer + trailer_len, OPT_END);
+  Put16(trailer + trailer_len + 2, 0);
+  trailer_len += 4;
+  uint32_t total = (uint32_t)(sizeof(header) + len + trailer_len + 4);
+  Put32(trailer + trailer_len, total);
+  trailer_len += 4;
+  Put32(header + 4, total);
+
+  PcapngPiece pieces[3] = {{header, sizeof(header)}, {payload, len},
+                           {trailer, trailer_len}};
+  if (sink_.Append(pieces, 3)) {
+    packets_++;
+    bytes_ += total;
+  }
+}
@@ -0,0 +1,113 @@
+/******************************************************************************
+Copyright (c) 2013, Google Inc.
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without 
+modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice, 
+      this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+    * Neither the name of the <ORGANIZATION> nor the names of its contributors 
+    may be used to endorse or promote products derived from this software 
+    without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE 
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE 
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL 
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR 
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER 
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, 
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE 
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+******************************************************************************/
+
+#pragma once
+// Portable (no Win32/ATL, no precompiled header) pcapng writer for the
+// synthetic capture that wpthook builds from the socket data it intercepts
+// (the decrypted HTTP/1 and HTTP/2 bytes).  Each socket becomes a fake
+// IPv4/TCP connection (handshake, MSS-sized segments with real sequence and
+// ack numbers, FIN on close) so Wireshark can follow and reassemble the
+// streams.  Built on Linux by pcapng_writer_test.
+//
+// Blocks are written in host byte order (the section header's byte-order
+// magic tells readers which), the link type is LINKTYPE_RAW (bare IPv4) and
+// timestamps are microseconds since 1970.  TCP checksums are left at 0, the
+// same as a capture of a NIC with checksum offload.
+#include <stddef.h>
+#include <stdint.h>
+
+typedef enum {
+  PCAPNG_TO_SERVER = 0,
+  PCAPNG_TO_CLIENT = 1
+} PCAPNG_DIRECTION;
+
+// One contiguous part of a block.  A block is handed to the sink as a few
+// pieces (headers, payload, trailer) so the payload is only copied once.
+struct PcapngPiece {
+  const void * data;
+  size_t       len;
+};
+
+// Destination for the blocks.  Append gets all of the pieces of one block
+// and has to keep them together and in order.
+class PcapngSink {
+public:
+  virtual ~PcapngSink() {}
+  virtual bool Append(const PcapngPiece * pieces, int count) = 0;
+};
+
+// TCP state of one synthetic connection.  Addresses are in network byte
+// order (as in sockaddr_in), ports in host byte order.  It is a plain
+// value: PcapngWriter::Reserve hands out a copy to build packets from.
+class PcapngStream {
+public:
+  PcapngStream();
+  void Init(uint32_t client_ip, uint16_t client_port,
+            uint32_t server_ip, uint16_t server_port, uint32_t isn);
+
+  uint32_t  ip_[2];             // indexed by the sending direction
+  uint16_t  port_[2];
+  uint32_t  next_seq_[2];
+  uint16_t  ip_id_;
+  bool      initialized_;
+  bool      open_;
+  bool      closed_;
+};
+
+class PcapngWriter {
+public:
+  explicit PcapngWriter(PcapngSink& sink, uint16_t mss = 1460);
+
+  // section header and interface blocks, once at the start of every file
+  static bool WriteHeader(PcapngSink& sink, const char * application);
+
+  void Open(PcapngStream& stream, uint64_t timestamp_us,
+            const char * comment = NULL);
+  void Data(PcapngStream& stream, PCAPNG_DIRECTION direction,
+            const void * data, size_t len, uint64_t timestamp_us);
+  void Close(PcapngStream& stream, uint64_t timestamp_us);
+
+  // Move the stream past what Data (or Close) is about to write and return
+  // its state from before, so the packets can be built from the copy
+  // outside of whatever lock protects the stream while later data carries
+  // on from where this leaves off.
+  PcapngStream Reserve(PcapngStream& stream, PCAPNG_DIRECTION direction,
+                       size_t len) const;
+  PcapngStream ReserveClose(PcapngStream& stream) const;
+
+  uint64_t  packets_;
+  uint64_t  bytes_;             // size of the blocks written
+
+private:
+  void Packet(PcapngStream& stream, PCAPNG_DIRECTION direction,
+              uint8_t flags, const uint8_t * payload, size_t len,
+              uint64_t timestamp_us, const char * comment);
+
+  PcapngSink& sink_;
+  uint16_t    mss_;
+};
@@ -0,0 +1,436 @@
+/******************************************************************************
+Copyright (c) 2013, Google Inc.
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without 
+modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice, 
+      this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+    * Neither the name of the <ORGANIZATION> nor the names of its contributors 
+    may be used to endorse or promote products derived from this software 
+    without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE 
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE 
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL 
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR 
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER 
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, 
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE 
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+******************************************************************************/
+
+// Round trip for the synthetic capture writer (pcapng_writer.cc): the
+// blocks are parsed back and the TCP streams reassembled.
+//
+//   make test
+//   ./pcapng_writer_test synthetic.pcapng   (also saves it for Wireshark)
+#include "../pcapng_writer.h"
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+static int failures = 0;
+static int checks = 0;
+
+#define CHECK(condition) \
+  do { \
+    checks++; \
+    if (!(condition)) { \
+      failures++; \
+      printf("%s:%d: %s: CHECK(%s) failed\n", __FILE__, __LINE__, \
+             current_test, #condition); \
+    } \
+  } while (0)
+
+static const char * current_test = "";
+
+static const uint32_t CLIENT_IP = 0x0100000A;   // 10.0.0.1
+static const uint32_t SERVER_IP = 0x0A00A8C0;   // 192.168.0.10
+
+class MemorySink : public PcapngSink {
+public:
+  virtual bool Append(const PcapngPiece * pieces, int count) {
+    for (int i = 0; i < count; i++)
+      data_.append((const char *)pieces[i].data, pieces[i].len);
+    appends_++;
+    return true;
+  }
+  MemorySink():appends_(0) {}
+  std::string data_;
+  int         appends_;
+};
+
+static uint32_t Get32(const uint8_t * in) {
+  uint32_t value;
+  memcpy(&value, in, sizeof(value));
+  return value;
+}
+
+static uint16_t Get16(const uint8_t * in) {
+  uint16_t value;
+  memcpy(&value, in, sizeof(value));
+  return value;
+}
+
+static uint32_t Get32BE(const uint8_t * in) {
+  return ((uint32_t)in[0] << 24) | ((uint32_t)in[1] << 16) |
+         ((uint32_t)in[2] << 8) | in[3];
+}
+
+static uint16_t Get16BE(const uint8_t * in) {
+  return (uint16_t)((in[0] << 8) | in[1]);
+}
+
+struct ParsedPacket {
+  uint64_t    timestamp;
+  uint32_t    src_ip;
+  uint16_t    src_port;
+  uint16_t    dst_port;
+  uint32_t    seq;
+  uint32_t    ack;
+  uint8_t     flags;
+  bool        checksum_ok;
+  std::string payload;
+  std::string comment;
+};
+
+/*-----------------------------------------------------------------------------
+  Walk the blocks, false if the framing is broken
+-----------------------------------------------------------------------------*/
+static bool Parse(const std::string& capture, std::string& application,
+                  uint16_t& link_type, std::vector<ParsedPacket>& packets) {
+  const uint8_t * data = (const uint8_t *)capture.data();
+  size_t len = capture.size();
+  size_t offset = 0;
+  while (offset < len) {
+    if (len - offset < 12)
+      return false;
+    uint32_t type = Get32(data + offset);
+    uint32_t total = Get32(data + offset + 4);
+    if (total < 12 || (total & 3) || total > len - offset ||
+        Get32(data + offset + total - 4) != total)
+      return false;
+    const uint8_t * block = data + offset;
+    size_t options = 0;
+    if (type == 0x0A0D0D0A) {
+      if (Get32(block + 8) != 0x1A2B3C4D || Get16(block + 12) != 1)
+        return false;
+      options = 24;
+    } else if (type == 1) {
+      link_type = Get16(block + 8);
+      options = 16;
+    } else if (type == 6) {
+      ParsedPacket packet;
+      uint32_t captured = Get32(block + 20);
+      if (captured != Get32(block + 24) || captured < 40)
+        return false;
+      packet.timestamp = ((uint64_t)Get32(block + 12) << 32) |
+                         Get32(block + 16);
+      const uint8_t * ip = block + 28;
+      uint32_t sum = 0;
+      for (int i = 0; i < 20; i += 2)
+        sum += ((uint32_t)ip[i] << 8) | ip[i + 1];
+      while (sum >> 16)
+        sum = (sum & 0xFFFF) + (sum >> 16);
+      packet.checksum_ok = sum == 0xFFFF && ip[0] == 0x45 && ip[9] == 6 &&
+                           Get16BE(ip + 2) == captured;
+      memcpy(&packet.src_ip, ip + 12, 4);
+      const uint8_t * tcp = ip + 20;
+      packet.src_port = Get16BE(tcp);
+      packet.dst_port = Get16BE(tcp + 2);
+      packet.seq = Get32BE(tcp + 4);
+      packet.ack = Get32BE(tcp + 8);
+      packet.flags = tcp[13];
+      packet.payload.assign((const char *)tcp + 20, captured - 40);
+      options = 28 + captured + ((4 - (captured & 3)) & 3);
+      if (options + 8 > total)
+        return false;
+      const uint8_t * option = block + options;
+      if (Get16(option) == 1)
+        packet.comment.assign((const char *)option + 4, Get16(option + 2));
+      packets.push_back(packet);
+      options = 0;
+    } else {
+      return false;
+    }
+    if (options && Get16(block + options) == 4)
+      application.assign((const char *)block + options + 4,
+                         Get16(block + options + 2));
+    offset += total;
+  }
+  return offset == len;
+}
+
+/*-----------------------------------------------------------------------------
+-----------------------------------------------------------------------------*/
+static void TestCapture(const char * save_as) {
+  current_test = "capture";
+  MemorySink sink;
+  CHECK(PcapngWriter::WriteHeader(sink, "wpthook test"));
+  PcapngWriter writer(sink, 1000);
+
+  std::string request = "GET / HTTP/1.1\r\nHost: www.example.com\r\n\r\n";
+  std::string response = "HTTP/1.1 200 OK\r\nContent-Length: 2500\r\n\r\n";
+  for (int i = 0; i < 2500; i++)
+    response += (char)('a' + i % 26);
+
+  PcapngStream stream;
+  stream.Init(CLIENT_IP, 50000, SERVER_IP, 80, 0xFFFFFFF0);  // seq wraps
+  writer.Open(stream, 1000000, "socket 1");
+  writer.Data(stream, PCAPNG_TO_SERVER, request.data(), request.size(),
+              1000100);
+  writer.Data(stream, PCAPNG_TO_CLIENT, response.data(), response.size(),
+              1050000);
+  writer.Close(stream, 1100000);
+  writer.Data(stream, PCAPNG_TO_SERVER, "x", 1, 1200000);  // after close
+
+  // data on a stream that was never opened explicitly gets a handshake
+  PcapngStream second;
+  second.Init(CLIENT_IP, 50001, SERVER_IP, 80, 7);
+  writer.Data(second, PCAPNG_TO_SERVER, request.data(), request.size(),
+              2000000);
+
+  std::string application;
+  uint16_t link_type = 0;
+  std::vector<ParsedPacket> packets;
+  CHECK(Parse(sink.data_, application, link_type, packets));
+  CHECK(application == "wpthook test");
+  CHECK(link_type == 101);
+  // 3 handshake + 1 request + 3 response segments + 3 close, 3 + 1 again
+  CHECK(packets.size() == 14);
+  CHECK(writer.packets_ == 14);
+  CHECK(sink.appends_ == 16);
+  if (packets.size() != 14)
+    return;
+
+  for (size_t i = 0; i < packets.size(); i++)
+    CHECK(packets[i].checksum_ok);
+
+  CHECK(packets[0].flags == 0x02);
+  CHECK(packets[0].comment == "socket 1");
+  CHECK(packets[0].src_ip == CLIENT_IP);
+  CHECK(packets[0].src_port == 50000 && packets[0].dst_port == 80);
+  CHECK(packets[0].timestamp == 1000000);
+  CHECK(packets[1].flags == 0x12);
+  CHECK(packets[1].src_ip == SERVER_IP);
+  CHECK(packets[1].ack == packets[0].seq + 1);
+  CHECK(packets[2].flags == 0x10);
+  CHECK(packets[2].ack == packets[1].seq + 1);
+
+  // reassemble both directions from the sequence numbers
+  std::string out, in;
+  uint32_t next_out = packets[0].seq + 1;
+  uint32_t next_in = packets[1].seq + 1;
+  for (size_t i = 3; i < 7; i++) {
+    ParsedPacket& packet = packets[i];
+    if (packet.src_ip == CLIENT_IP) {
+      CHECK(packet.seq == next_out);
+      CHECK(packet.ack == next_in);
+      out += packet.payload;
+      next_out += (uint32_t)packet.payload.size();
+    } else {
+      CHECK(packet.seq == next_in);
+      CHECK(packet.ack == next_out);
+      in += packet.payload;
+      next_in += (uint32_t)packet.payload.size();
+    }
+    CHECK(packet.payload.size() <= 1000);
+  }
+  CHECK(out == request);
+  CHECK(in == response);
+  CHECK(next_out < packets[0].seq);   // wrapped
+  CHECK(packets[3].flags == 0x18);
+  CHECK(packets[4].flags == 0x10 && packets[4].payload.size() == 1000);
+  CHECK(packets[6].flags == 0x18);
+  CHECK(packets[6].timestamp == 1050000);
+
+  CHECK(packets[7].flags == 0x11 && packets[7].seq == next_out);
+  CHECK(packets[8].flags == 0x11 && packets[8].seq == next_in);
+  CHECK(packets[8].ack == next_out + 1);
+  CHECK(packets[9].flags == 0x10 && packets[9].ack == next_in + 1);
+
+  CHECK(packets[10].flags == 0x02 && packets[10].src_port == 50001);
+  CHECK(packets[10].seq == 7);
+  CHECK(packets[13].payload == request && packets[13].seq == 8);
+  CHECK(packets[13].timestamp == 2000000);
+
+  if (save_as) {
+    FILE * file = fopen(save_as, "wb");
+    if (file) {
+      fwrite(sink.data_.data(), 1, sink.data_.size(), file);
+      fclose(file);
+    }
+  }
+}
+
+/*-----------------------------------------------------------------------------
+-----------------------------------------------------------------------------*/
+static void TestLimits() {
+  current_test = "limits";
+  MemorySink sink;
+  PcapngWriter writer(sink, 0);     // 0 -> largest segment that fits
+  PcapngStream stream;
+  writer.Data(stream, PCAPNG_TO_SERVER, "x", 1, 0);   // not initialized
+  CHECK(sink.data_.empty());
+
+  stream.Init(CLIENT_IP, 1, SERVER_IP, 2, 0);
+  std::string big(200000, 'z');
+  writer.Data(stream, PCAPNG_TO_CLIENT, big.data(), big.size(), 5);
+  writer.Close(stream, 6);
+
+  std::string application;
+  uint16_t link_type = 0;
+  std::vector<ParsedPacket> packets;
+  CHECK(Parse(sink.data_, application, link_type, packets));
+  // handshake + 4 segments of at most 65495 + close
+  CHECK(packets.size() == 10);
+  size_t total = 0;
+  for (size_t i = 3; i < 7 && i < packets.size(); i++) {
+    CHECK(packets[i].payload.size() <= 65495);
+    CHECK(packets[i].checksum_ok);
+    total += packets[i].payload.size();
+  }
+  CHECK(total == big.size());
+
+  MemorySink header;
+  std::string comment(1000, 'c');
+  PcapngWriter::WriteHeader(header, comment.c_str());
+  packets.clear();
+  CHECK(Parse(header.data_, application, link_type, packets));
+  CHECK(application.size() == 256);
+}
+
+/*-----------------------------------------------------------------------------
+  Packets reserved under a lock and built later (in any order) from the
+  copies of the stream
+-----------------------------------------------------------------------------*/
+struct ReservedWrite {
+  PcapngStream      stream;
+  PCAPNG_DIRECTION  direction;
+  std::string       data;
+  uint64_t          timestamp;
+  bool              close;
+};
+
+static void WriteReserved(PcapngWriter& writer, ReservedWrite& write) {
+  if (write.close) {
+    writer.Close(write.stream, write.timestamp);
+  } else {
+    writer.Open(write.stream, write.timestamp, "socket 1");
+    writer.Data(write.stream, write.direction, write.data.data(),
+                write.data.size(), write.timestamp);
+  }
+}
+
+static bool PacketBefore(const ParsedPacket& a, const ParsedPacket& b) {
+  if (a.src_ip != b.src_ip)
+    return a.src_ip < b.src_ip;
+  if (a.seq != b.seq)
+    return a.seq < b.seq;
+  return a.flags < b.flags;
+}
+
+static bool SamePacket(const ParsedPacket& a, const ParsedPacket& b) {
+  return a.timestamp == b.timestamp && a.src_ip == b.src_ip &&
+         a.src_port == b.src_port && a.dst_port == b.dst_port &&
+         a.seq == b.seq && a.ack == b.ack && a.flags == b.flags &&
+         a.payload == b.payload && a.comment == b.comment &&
+         a.checksum_ok && b.checksum_ok;
+}
+
+static void TestReserve() {
+  current_test = "reserve";
+  ReservedWrite writes[5];
+  writes[0].direction = PCAPNG_TO_SERVER;
+  writes[0].data = std::string(2500, 'q');
+  writes[1].direction = PCAPNG_TO_CLIENT;
+  writes[1].data = std::string(4200, 'r');
+  writes[2].direction = PCAPNG_TO_SERVER;
+  writes[2].data = "GET /next HTTP/1.1\r\n\r\n";
+  writes[3].direction = PCAPNG_TO_CLIENT;
+  writes[3].data = std::string(900, 's');
+  for (int i = 0; i < 5; i++) {
+    writes[i].timestamp = 1000 + i * 10;
+    writes[i].close = i == 4;
+  }
+
+  // written straight to the stream
+  MemorySink direct;
+  PcapngWriter writer(direct, 1000);
+  PcapngStream stream;
+  stream.Init(CLIENT_IP, 50000, SERVER_IP, 80, 12345);
+  for (int i = 0; i < 5; i++) {
+    ReservedWrite write = writes[i];
+    write.stream = stream;
+    WriteReserved(writer, write);
+    stream = write.stream;
+  }
+
+  // reserved in order, then built from the copies
+  PcapngStream reserved;
+  reserved.Init(CLIENT_IP, 50000, SERVER_IP, 80, 12345);
+  for (int i = 0; i < 5; i++)
+    writes[i].stream = writes[i].close ? writer.ReserveClose(reserved) :
+        writer.Reserve(reserved, writes[i].direction, writes[i].data.size());
+  CHECK(reserved.next_seq_[0] == stream.next_seq_[0]);
+  CHECK(reserved.next_seq_[1] == stream.next_seq_[1]);
+  CHECK(reserved.ip_id_ == stream.ip_id_);
+  CHECK(reserved.closed_ && !reserved.open_);
+
+  MemorySink in_order;
+  PcapngWriter in_order_writer(in_order, 1000);
+  for (int i = 0; i < 5; i++) {
+    ReservedWrite write = writes[i];
+    WriteReserved(in_order_writer, write);
+  }
+  CHECK(in_order.data_ == direct.data_);
+
+  // threads finishing in the opposite order still produce the same packets
+  MemorySink reversed;
+  PcapngWriter reversed_writer(reversed, 1000);
+  for (int i = 4; i >= 0; i--) {
+    ReservedWrite write = writes[i];
+    WriteReserved(reversed_writer, write);
+  }
+  CHECK(reversed.data_ != direct.data_);
+  std::string application;
+  uint16_t link_type = 0;
+  std::vector<ParsedPacket> expected, packets;
+  CHECK(Parse(direct.data_, application, link_type, expected));
+  CHECK(Parse(reversed.data_, application, link_type, packets));
+  // 3 handshake + 3 + 5 + 1 + 1 segments + 3 close
+  CHECK(expected.size() == 16);
+  CHECK(packets.size() == expected.size());
+  if (packets.size() == expected.size()) {
+    std::stable_sort(expected.begin(), expected.end(), PacketBefore);
+    std::stable_sort(packets.begin(), packets.end(), PacketBefore);
+    for (size_t i = 0; i < packets.size(); i++)
+      CHECK(SamePacket(packets[i], expected[i]));
+  }
+
+  // nothing to reserve on a stream that was never set up or is closed
+  PcapngStream unused;
+  PcapngStream copy = writer.Reserve(unused, PCAPNG_TO_SERVER, 100);
+  CHECK(!unused.open_ && unused.next_seq_[0] == 0 && unused.ip_id_ == 0);
+  copy = writer.Reserve(reserved, PCAPNG_TO_SERVER, 100);
+  CHECK(copy.closed_ && reserved.ip_id_ == stream.ip_id_);
+}
+
+/*-----------------------------------------------------------------------------
+-----------------------------------------------------------------------------*/
+int main(int argc, char ** argv) {
+  TestCapture(argc > 1 ? argv[1] : NULL);
+  TestLimits();
+  TestReserve();
+  printf("%d checks, %d failed\n", checks, failures);
+  return failures ? 1 : 0;
+}
@@ -0,0 +1,252 @@
+/******************************************************************************
+Copyright (c) 2013, Google Inc.
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without 
+modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice, 
+      this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+    * Neither the name of the <ORGANIZATION> nor the names of its contributors 
+    may be used to endorse or promote products derived from this software 
+    without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE 
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE 
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL 
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR 
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER 
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, 
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE 
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+******************************************************************************/
+
+// No precompiled header, this file has to build without the Windows SDK
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#endif
+#include "raw_events.h"
+#include <stdlib.h>
+#include <string.h>
+#include <zlib.h>
+
+static const size_t RAW_EVENTS_BLOCK_SIZE = 1024 * 1024;
+static const size_t RAW_EVENTS_LARGE_EVENT = RAW_EVENTS_BLOCK_SIZE / 4;
+static const size_t RAW_EVENTS_MAX_BODY = 256 * 1024 * 1024;
+
+/*-----------------------------------------------------------------------------
+-----------------------------------------------------------------------------*/
+RawEvents::RawEvents(void):
+  block_(NULL)
+  , block_used_(0)
+  , generation_(0)
+  , outstanding_(0) {
+#ifdef _WIN32
+  InitializeCriticalSection(&cs_);
+#else
+  pthread_mutex_init(&mutex_, NULL);
+#endif
+}
+
+/*-----------------------------------------------------------------------------
+-----------------------------------------------------------------------------*/
+RawEvents::~RawEvents(void) {
+  FreeBlocks(blocks_);
+  FreeBlocks(retired_);
+#ifdef _WIN32
+  DeleteCriticalSection(&cs_);
+#else
+  pthread_mutex_destroy(&mutex_);
+#endif
+}
+
+/*-----------------------------------------------------------------------------
+-----------------------------------------------------------------------------*/
+void RawEvents::Lock(void) {
+#ifdef _WIN32
+  EnterCriticalSection(&cs_);
+#else
+  pthread_mutex_lock(&mutex_);
+#endif
+}
+
+void RawEvents::Unlock(void) {
+#ifdef _WIN32
+  LeaveCriticalSection(&cs_);
+#else
+  pthread_mutex_unlock(&mutex_);
+#endif
+}
+
+/*-----------------------------------------------------------------------------
+  Space for an event of up to len bytes.  Nothing is visible until the
+  matching Commit (which must always be called, with a length of 0 to
+  give the space up).
+-----------------------------------------------------------------------------*/
+char * RawEvents::Reserve(size_t len, uint32_t& ticket) {
+  char * data = NULL;
+  Lock();
+  if (len >= RAW_EVENTS_LARGE_EVENT) {
+    data = (char *)malloc(len);
+    if (data)
+      blocks_.push_back(data);
+  } else {
+    if (!block_ || block_used_ + len > RAW_EVENTS_BLOCK_SIZE) {
+      block_ = (char *)malloc(RAW_EVENTS_BLOCK_SIZE);
+      block_used_ = 0;
+      if (block_)
+        blocks_.push_back(block_);
+    }
+    if (block_) {
+      data = block_ + block_used_;
+      block_used_ += len;
+    }
+  }
+  if (data)
+    outstanding_++;
+  ticket = generation_;
+  Unlock();
+  return data;
+}
+
+/*-----------------------------------------------------------------------------
+-----------------------------------------------------------------------------*/
+void RawEvents::Commit(char * data, size_t len, uint32_t ticket) {
+  if (!data)
+    return;
+  Lock();
+  if (ticket == generation_) {
+    if (len) {
+      RawEvent event;
+      event._data = data;
+      event._len = len;
+      events_.push_back(event);
+    }
+  }
+  outstanding_--;
+  if (!outstanding_ && !retired_.empty())
+    FreeBlocks(retired_);
+  Unlock();
+}
+
+/*-----------------------------------------------------------------------------
+  Copy an event that is already in memory into the store
+-----------------------------------------------------------------------------*/
+void RawEvents::Add(const char * data, size_t len) {
+  if (data && len) {
+    uint32_t ticket;
+    char * event = Reserve(len, ticket);
+    if (event) {
+      memcpy(event, data, len);
+      Commit(event, len, ticket);
+    }
+  }
+}
+
+/*-----------------------------------------------------------------------------
+  Read a POST body of len bytes straight into the store, inflating it on
+  the way if the extension gzipped it.  Returns the number of bytes stored.
+-----------------------------------------------------------------------------*/
+size_t RawEvents::Read(size_t len, bool gzip, RawEventsReader reader,
+                       void * context) {
+  size_t stored = 0;
+  if (!len || len > RAW_EVENTS_MAX_BODY || !reader)
+    return 0;
+  uint32_t ticket = 0;
+  if (gzip) {
+    unsigned char * compressed = (unsigned char *)malloc(len);
+    if (compressed) {
+      // the gzip trailer has the size of the original data so the whole
+      // thing can be inflated into a single reservation
+      if (reader(context, (char *)compressed, len) && len >= 18 &&
+          compressed[0] == 0x1F && compressed[1] == 0x8B) {
+        const unsigned char * trailer = compressed + len - 4;
+        size_t original = (size_t)trailer[0] | ((size_t)trailer[1] << 8) |
+                          ((size_t)trailer[2] << 16) |
+                          ((size_t)trailer[3] << 24);
+        char * data = NULL;
+        if (original && original <= RAW_EVENTS_MAX_BODY)
+          data = Reserve(original, ticket);
+        if (data) {
+          z_stream stream;
+          memset(&stream, 0, sizeof(stream));
+          if (inflateInit2(&stream, 16 + MAX_WBITS) == Z_OK) {
+            stream.next_in = compressed;
+            stream.avail_in = (uInt)len;
+            stream.next_out = (Bytef *)data;
+            stream.avail_out = (uInt)original;
+            if (inflate(&stream, Z_FINISH) == Z_STREAM_END &&
+                stream.total_out == original)
+              stored = original;
+            inflateEnd(&stream);
+          }
+          Commit(data, stored, ticket);
+        }
+      }
+      free(compressed);
+    }
+  } else {
+    char * data = Reserve(len, ticket);
+    if (data) {
+      if (reader(context, data, len))
+        stored = len;
+      Commit(data, stored, ticket);
+    }
+  }
+  return stored;
+}
+
+/*-----------------------------------------------------------------------------
+-----------------------------------------------------------------------------*/
+void RawEvents::Reset(void) {
+  Lock();
+  events_.clear();
+  if (outstanding_) {
+    retired_.insert(retired_.end(), blocks_.begin(), blocks_.end());
+    blocks_.clear();
+  } else {
+    FreeBlocks(blocks_);
+  }
+  block_ = NULL;
+  block_used_ = 0;
+  generation_++;
+  Unlock();
+}
+
+/*-----------------------------------------------------------------------------
+-----------------------------------------------------------------------------*/
+size_t RawEvents::GetCount(void) {
+  Lock();
+  size_t count = events_.size();
+  Unlock();
+  return count;
+}
+
+/*-----------------------------------------------------------------------------
+  Committed events never move so the pointer stays valid until Reset
+-----------------------------------------------------------------------------*/
+bool RawEvents::GetEvent(size_t index, const char *& data, size_t& len) {
+  bool ok = false;
+  Lock();
+  if (index < events_.size()) {
+    data = events_[index]._data;
+    len = events_[index]._len;
+    ok = true;
+  }
+  Unlock();
+  return ok;
+}
+
+/*-----------------------------------------------------------------------------
+-----------------------------------------------------------------------------*/
+void RawEvents::FreeBlocks(std::vector<char *>& blocks) {
+  for (size_t i = 0; i < blocks.size(); i++)
+    free(blocks[i]);
+  blocks.clear();
+}
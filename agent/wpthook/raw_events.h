@@ -0,0 +1,91 @@
+/******************************************************************************
+Copyright (c) 2013, Google Inc.
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without 
+modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice, 
+      this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+    * Neither the name of the <ORGANIZATION> nor the names of its contributors 
+    may be used to endorse or promote products derived from this software 
+    without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE 
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE 
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL 
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR 
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER 
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, 
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE 
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+******************************************************************************/
+
+#pragma once
+// Portable (no precompiled header) so the store and the body reading can be
+// benchmarked on Linux (raw_events_bench).
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <pthread.h>
+#endif
+
+// Reads exactly len bytes of a request body, false if it came up short
+typedef bool (*RawEventsReader)(void * context, char * buff, size_t len);
+
+/*-----------------------------------------------------------------------------
+  Append-only store for the large JSON payloads the browser POSTs to the
+  test server (traces, netlog and dev tools events).  The test server
+  reserves space for a whole POST body in the store's arena, reads (or
+  inflates) the body straight into it and then commits it, so a
+  multi-megabyte trace is never widened to UTF-16 or copied.  Small events
+  share 1MB blocks, large ones get a block of their own.
+
+  A Reset while a body is still being read retires the blocks instead of
+  freeing them and the late commit is dropped.
+-----------------------------------------------------------------------------*/
+class RawEvents {
+public:
+  RawEvents(void);
+  ~RawEvents(void);
+
+  char * Reserve(size_t len, uint32_t& ticket);
+  void   Commit(char * data, size_t len, uint32_t ticket);
+  void   Add(const char * data, size_t len);
+  size_t Read(size_t len, bool gzip, RawEventsReader reader, void * context);
+  void   Reset(void);
+  size_t GetCount(void);
+  bool   GetEvent(size_t index, const char *& data, size_t& len);
+
+private:
+  class RawEvent {
+  public:
+    const char * _data;
+    size_t       _len;
+  };
+
+  void Lock(void);
+  void Unlock(void);
+  void FreeBlocks(std::vector<char *>& blocks);
+
+#ifdef _WIN32
+  CRITICAL_SECTION      cs_;
+#else
+  pthread_mutex_t       mutex_;
+#endif
+  std::vector<RawEvent> events_;
+  std::vector<char *>   blocks_;
+  std::vector<char *>   retired_;   // freed once the outstanding reads finish
+  char *                block_;     // block that small events are packed into
+  size_t                block_used_;
+  uint32_t              generation_;
+  long                  outstanding_;
+};
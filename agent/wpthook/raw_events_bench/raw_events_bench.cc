@@ -0,0 +1,367 @@
+/******************************************************************************
+Copyright (c) 2013, Google Inc.
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without 
+modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice, 
+      this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+    * Neither the name of the <ORGANIZATION> nor the names of its contributors 
+    may be used to endorse or promote products derived from this software 
+    without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE 
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE 
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL 
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR 
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER 
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, 
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE 
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+******************************************************************************/
+
+// Compares reading trace/dev tools POST bodies straight into RawEvents (what
+// TestServer::ReadPostBody does) against the previous handler: read the
+// body a socket buffer at a time, widen each read to UTF-16 and append it,
+// narrow the whole thing again and copy it into the store.  Also times
+// several uploads arriving at once, with the old handler serialized behind
+// one lock the way the server lock serialized it, and checks the stored
+// bytes, gzip bodies, short reads and a Reset in the middle of a read.
+//
+//   raw_events_bench [megabytes]
+#include "../raw_events.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <string>
+#include <zlib.h>
+
+static const int TIMING_RUNS = 5;             // best of
+static const size_t SOCKET_CHUNK = 16 * 1024; // bytes per mg_read
+static const int UPLOAD_THREADS = 8;
+static const int UPLOADS_PER_THREAD = 32;
+static const size_t UPLOAD_SIZE = 256 * 1024;
+
+typedef std::basic_string<unsigned short> WideString;
+
+static int failed = 0;
+
+/*-----------------------------------------------------------------------------
+-----------------------------------------------------------------------------*/
+static double NowMs() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+/*-----------------------------------------------------------------------------
+  Synthetic trace upload, a JSON array of timeline events
+-----------------------------------------------------------------------------*/
+static void MakeBody(size_t len, std::string& body) {
+  srand(1);
+  body.reserve(len + 512);
+  body = "[";
+  char buff[512];
+  for (unsigned i = 0; body.length() < len; i++) {
+    snprintf(buff, sizeof(buff),
+             "%s{\"pid\":%d,\"tid\":%d,\"ts\":%u,\"ph\":\"X\",\"dur\":%d,"
+             "\"cat\":\"devtools.timeline\",\"name\":\"FunctionCall\","
+             "\"args\":{\"data\":{\"frame\":\"%08X\",\"url\":"
+             "\"https://www.example.com/static/app.%x.js\",\"lineNumber\":%d}}}",
+             i ? "," : "", 1000 + rand() % 4, rand() % 32, 1000000 + i * 37,
+             rand() % 5000, rand(), rand(), rand() % 20000);
+    body += buff;
+  }
+  body += "]";
+}
+
+static bool Gzip(const std::string& body, std::string& compressed) {
+  bool ok = false;
+  z_stream stream;
+  memset(&stream, 0, sizeof(stream));
+  if (deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 16 + MAX_WBITS,
+                   8, Z_DEFAULT_STRATEGY) == Z_OK) {
+    compressed.resize(deflateBound(&stream, (uLong)body.length()));
+    stream.next_in = (Bytef *)body.data();
+    stream.avail_in = (uInt)body.length();
+    stream.next_out = (Bytef *)&compressed[0];
+    stream.avail_out = (uInt)compressed.length();
+    if (deflate(&stream, Z_FINISH) == Z_STREAM_END) {
+      compressed.resize(stream.total_out);
+      ok = true;
+    }
+    deflateEnd(&stream);
+  }
+  return ok;
+}
+
+/*-----------------------------------------------------------------------------
+  The connection: hands the body out a socket buffer at a time like mg_read
+-----------------------------------------------------------------------------*/
+class BenchConnection {
+public:
+  BenchConnection(const std::string& body, size_t limit = (size_t)-1):
+    data_(body.data()), len_(body.length() < limit ? body.length() : limit),
+    pos_(0), reset_at_(0), reset_(NULL) {}
+  const char * data_;
+  size_t       len_;
+  size_t       pos_;
+  size_t       reset_at_;   // Reset this store once this much has been read
+  RawEvents *  reset_;
+};
+
+static int MgRead(BenchConnection& conn, char * buff, size_t len) {
+  size_t bytes = conn.len_ - conn.pos_;
+  if (bytes > len)
+    bytes = len;
+  if (bytes > SOCKET_CHUNK)
+    bytes = SOCKET_CHUNK;
+  memcpy(buff, conn.data_ + conn.pos_, bytes);
+  conn.pos_ += bytes;
+  if (conn.reset_ && conn.pos_ >= conn.reset_at_) {
+    conn.reset_->Reset();
+    conn.reset_ = NULL;
+  }
+  return (int)bytes;
+}
+
+// the same loop as ReadContent in test_server.cc
+static bool ReadContent(void * context, char * buff, size_t len) {
+  BenchConnection& conn = *(BenchConnection *)context;
+  while (len) {
+    int bytes = MgRead(conn, buff, len);
+    if (bytes <= 0 || (size_t)bytes > len)
+      return false;
+    buff += bytes;
+    len -= bytes;
+  }
+  return true;
+}
+
+/*-----------------------------------------------------------------------------
+  The previous handler.  The body is ASCII so a byte-for-byte widen and
+  narrow is what CA2T(CP_UTF8) and CT2A do with it.  Returns the most
+  memory that was held at once.
+-----------------------------------------------------------------------------*/
+static size_t OldReadPostBody(BenchConnection& conn, size_t length,
+                              RawEvents& events) {
+  size_t peak = 0;
+  WideString body;
+  char * buff = (char *)malloc(length + 1);
+  if (buff) {
+    while (length) {
+      int bytes = MgRead(conn, buff, length);
+      if (bytes <= 0)
+        break;
+      buff[bytes] = 0;
+      WideString wide(buff, buff + bytes);
+      body += wide;
+      length -= bytes;
+    }
+    peak = conn.len_ + 1 + body.capacity() * sizeof(unsigned short);
+    free(buff);
+  }
+  std::string narrow(body.begin(), body.end());
+  size_t held = body.capacity() * sizeof(unsigned short) + narrow.capacity() +
+                narrow.length();
+  if (held > peak)
+    peak = held;
+  events.Add(narrow.data(), narrow.length());
+  return peak;
+}
+
+static bool Stored(RawEvents& events, size_t index, const std::string& body) {
+  const char * data = NULL;
+  size_t len = 0;
+  return events.GetEvent(index, data, len) && len == body.length() &&
+         !memcmp(data, body.data(), len);
+}
+
+#define CHECK(condition) \
+  do { \
+    if (!(condition)) { \
+      printf("%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #condition); \
+      failed++; \
+    } \
+  } while (0)
+
+/*-----------------------------------------------------------------------------
+-----------------------------------------------------------------------------*/
+static void CheckReads(const std::string& body, const std::string& gzipped) {
+  RawEvents events;
+  BenchConnection plain(body);
+  CHECK(events.Read(body.length(), false, ReadContent, &plain) ==
+        body.length());
+  CHECK(Stored(events, 0, body));
+
+  BenchConnection compressed(gzipped);
+  CHECK(events.Read(gzipped.length(), true, ReadContent, &compressed) ==
+        body.length());
+  CHECK(Stored(events, 1, body));
+
+  BenchConnection old(body);
+  OldReadPostBody(old, body.length(), events);
+  CHECK(Stored(events, 2, body));
+
+  // small events are packed into shared blocks
+  std::string small = body.substr(0, 1000);
+  for (int i = 0; i < 100; i++) {
+    BenchConnection conn(small);
+    CHECK(events.Read(small.length(), false, ReadContent, &conn) == 1000);
+  }
+  CHECK(events.GetCount() == 103);
+  CHECK(Stored(events, 50, small));
+
+  // the client went away part way through
+  BenchConnection truncated(body, body.length() / 2);
+  CHECK(!events.Read(body.length(), false, ReadContent, &truncated));
+  BenchConnection truncated_gzip(gzipped, gzipped.length() / 2);
+  CHECK(!events.Read(gzipped.length(), true, ReadContent, &truncated_gzip));
+  CHECK(events.GetCount() == 103);
+
+  // not actually gzipped
+  BenchConnection not_gzip(body);
+  CHECK(!events.Read(body.length(), true, ReadContent, &not_gzip));
+  CHECK(!events.Read(0, false, ReadContent, &plain));
+
+  // the test moves on while an upload is still arriving
+  BenchConnection late(body);
+  late.reset_ = &events;
+  late.reset_at_ = body.length() / 2;
+  CHECK(events.Read(body.length(), false, ReadContent, &late) ==
+        body.length());
+  CHECK(events.GetCount() == 0);
+  BenchConnection after(small);
+  CHECK(events.Read(small.length(), false, ReadContent, &after) == 1000);
+  CHECK(events.GetCount() == 1);
+  CHECK(Stored(events, 0, small));
+}
+
+/*-----------------------------------------------------------------------------
+  Concurrent uploads
+-----------------------------------------------------------------------------*/
+class UploadWork {
+public:
+  const std::string * body_;
+  RawEvents *         events_;
+  pthread_mutex_t *   server_lock_;   // the old handler ran under it
+};
+
+static void * UploadThread(void * arg) {
+  UploadWork& work = *(UploadWork *)arg;
+  for (int i = 0; i < UPLOADS_PER_THREAD; i++) {
+    BenchConnection conn(*work.body_);
+    if (work.server_lock_) {
+      pthread_mutex_lock(work.server_lock_);
+      OldReadPostBody(conn, work.body_->length(), *work.events_);
+      pthread_mutex_unlock(work.server_lock_);
+    } else {
+      work.events_->Read(work.body_->length(), false, ReadContent, &conn);
+    }
+  }
+  return NULL;
+}
+
+static double Uploads(const std::string& body, bool old) {
+  RawEvents events;
+  pthread_mutex_t server_lock;
+  pthread_mutex_init(&server_lock, NULL);
+  UploadWork work;
+  work.body_ = &body;
+  work.events_ = &events;
+  work.server_lock_ = old ? &server_lock : NULL;
+  pthread_t threads[UPLOAD_THREADS];
+  double start = NowMs();
+  int started = 0;
+  for (int i = 0; i < UPLOAD_THREADS; i++)
+    if (!pthread_create(&threads[started], NULL, UploadThread, &work))
+      started++;
+  for (int i = 0; i < started; i++)
+    pthread_join(threads[i], NULL);
+  double elapsed = NowMs() - start;
+  CHECK(events.GetCount() == (size_t)(started * UPLOADS_PER_THREAD));
+  pthread_mutex_destroy(&server_lock);
+  return elapsed;
+}
+
+/*-----------------------------------------------------------------------------
+-----------------------------------------------------------------------------*/
+int main(int argc, char * argv[]) {
+  size_t megabytes = argc > 1 ? (size_t)atoi(argv[1]) : 32;
+  if (!megabytes)
+    megabytes = 1;
+  std::string body, gzipped;
+  MakeBody(megabytes * 1024 * 1024, body);
+  if (!Gzip(body, gzipped)) {
+    printf("Unable to gzip the body\n");
+    return 1;
+  }
+  CheckReads(body, gzipped);
+
+  double old_ms = 0, read_ms = 0, gzip_ms = 0;
+  size_t old_peak = 0;
+  for (int run = 0; run < TIMING_RUNS; run++) {
+    double start = NowMs();
+    {
+      RawEvents events;
+      BenchConnection conn(body);
+      old_peak = OldReadPostBody(conn, body.length(), events);
+    }
+    double elapsed = NowMs() - start;
+    if (!run || elapsed < old_ms)
+      old_ms = elapsed;
+
+    start = NowMs();
+    {
+      RawEvents events;
+      BenchConnection conn(body);
+      events.Read(body.length(), false, ReadContent, &conn);
+    }
+    elapsed = NowMs() - start;
+    if (!run || elapsed < read_ms)
+      read_ms = elapsed;
+
+    start = NowMs();
+    {
+      RawEvents events;
+      BenchConnection conn(gzipped);
+      events.Read(gzipped.length(), true, ReadContent, &conn);
+    }
+    elapsed = NowMs() - start;
+    if (!run || elapsed < gzip_ms)
+      gzip_ms = elapsed;
+  }
+
+  std::string upload = body.substr(0, UPLOAD_SIZE);
+  double old_uploads_ms = 0, uploads_ms = 0;
+  for (int run = 0; run < TIMING_RUNS; run++) {
+    double elapsed = Uploads(upload, true);
+    if (!run || elapsed < old_uploads_ms)
+      old_uploads_ms = elapsed;
+    elapsed = Uploads(upload, false);
+    if (!run || elapsed < uploads_ms)
+      uploads_ms = elapsed;
+  }
+
+  printf("%d byte body (%d gzipped)\n", (int)body.length(),
+         (int)gzipped.length());
+  printf("old handler:   %8.2f ms  %8d KB held\n", old_ms,
+         (int)(old_peak / 1024));
+  printf("ReadPostBody:  %8.2f ms  %8d KB held\n", read_ms,
+         (int)(body.length() / 1024));
+  printf("gzip body:     %8.2f ms  %8d KB held\n", gzip_ms,
+         (int)((body.length() + gzipped.length()) / 1024));
+  printf("%d threads x %d uploads of %d KB: old handler %.2f ms, "
+         "ReadPostBody %.2f ms\n", UPLOAD_THREADS, UPLOADS_PER_THREAD,
+         (int)(UPLOAD_SIZE / 1024), old_uploads_ms, uploads_ms);
+  printf("%d failed checks\n", failed);
+  return failed ? 1 : 0;
+}
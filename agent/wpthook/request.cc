@@ -33,11 +33,9 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include "track_dns.h"
 #include "../wptdriver/wpt_test.h"
 #include "requests.h"
-#include <wininet.h>
 #include <zlib.h>
 
 const DWORD MAX_DATA_TO_RETAIN = 10485760;  // 10MB
-const __int64 NS100_TO_SEC = 10000000;   // convert 100ns intervals to seconds
 
 /*-----------------------------------------------------------------------------
 -----------------------------------------------------------------------------*/
@@ -78,11 +76,15 @@ bool DataChunk::ModifyDataOut(const WptTest& test) {
       DWORD headers_len = headers.GetLength();
       DWORD new_len = headers_len + current_data_len;
       LPSTR new_data = new_chunk.AllocateLength(new_len);
-      memcpy(new_data, (LPCSTR)headers, headers_len);
-      if (current_data_len) {
-        memcpy(new_data + headers_len, current_data, current_data_len);
+      if (new_data) {
+        memcpy(new_data, (LPCSTR)headers, headers_len);
+        if (current_data_len) {
+          memcpy(new_data + headers_len, current_data, current_data_len);
+        }
+        *this = new_chunk;
+      } else {
+        is_modified = false;
       }
-      *this = new_chunk;
     }
   }
   return is_modified;
@@ -133,7 +135,8 @@ CStringA HttpData::GetHeader(CStringA field_name) {
 -----------------------------------------------------------------------------*/
 void HttpData::CopyData() {
   if (_data == NULL && _data_size) {
-    char * data = new char[_data_size + 1];  // +1 to NULL terminate
+    // +1 to NULL terminate
+    char * data = (char *)global_buffer_pool.Alloc(_data_size + 1);
     _data = data;
     while (!_data_chunks.IsEmpty()) {
       DataChunk chunk = _data_chunks.RemoveHead();
@@ -266,7 +269,7 @@ void ResponseData::Dechunk() {
     CopyData();
     if (!_body_chunks.IsEmpty() && _body_chunks_size > 0) {
       char * data = _body.AllocateLength(_body_chunks_size);
-      POSITION pos = _body_chunks.GetHeadPosition();
+      POSITION pos = data ? _body_chunks.GetHeadPosition() : NULL;
       while (pos) {
         DataChunk chunk = _body_chunks.GetNext(pos);
         memcpy(data, chunk.GetData(), chunk.GetLength());
@@ -300,7 +303,7 @@ void ResponseData::Dechunk() {
           // Allocate a new buffer to hold the dechunked body.
           if (data_size) {
             char * data = _body.AllocateLength(data_size);
-            POSITION pos = chunks.GetHeadPosition();
+            POSITION pos = data ? chunks.GetHeadPosition() : NULL;
             while (pos) {
               DataChunk chunk = chunks.GetNext(pos);
               memcpy(data, chunk.GetData(), chunk.GetLength());
@@ -391,6 +394,8 @@ Request::Request(TestState& test_state, DWORD socket_id, DWORD stream_id,
   , _reported(false)
   , _are_headers_complete(false)
   , _data_sent(false)
+  , long_lived_(false)
+  , cache_policy_parsed_(false)
   , _from_browser(false)
   , _is_base_page(false)
   , requests_(requests)
@@ -435,7 +440,10 @@ void Request::DataIn(DataChunk& chunk) {
     if (!_first_byte.QuadPart)
       _first_byte.QuadPart = _end.QuadPart;
     if (!_is_spdy) {
+      if (!_bytes_in && _test._adaptive_done)
+        CheckLongLivedResponse(chunk);
       _bytes_in += chunk.GetLength();
+      _arrivals.AddBytes(_end.QuadPart, chunk.GetLength());
       _response_data.AddChunk(chunk);
     }
   }
@@ -471,6 +479,8 @@ void Request::DataOut(DataChunk& chunk) {
   if (_is_active && !_is_spdy) {
     // Keep track of the data that was actually sent.
     unsigned long chunk_len = chunk.GetLength();
+    if (!_bytes_out && _test._adaptive_done)
+      CheckLongLivedRequest(chunk);
     _bytes_out += chunk_len;
     if (chunk_len > 0) {
       if (!_are_headers_complete &&
@@ -495,6 +505,9 @@ void Request::HeaderIn(const char * header, const char * value, bool pushed) {
     if (!_first_byte.QuadPart)
       _first_byte.QuadPart = _end.QuadPart;
     _response_data.AddHeader(header, value);
+    if (_test._adaptive_done && !lstrcmpiA(header, "content-type") &&
+        !_strnicmp(value, "text/event-stream", 17))
+      long_lived_ = true;
     if (pushed && initiator_.IsEmpty())
       initiator_ = "HTTP/2 Server Push";
   }
@@ -522,8 +535,12 @@ void Request::ObjectDataIn(DataChunk& chunk) {
 void Request::BytesIn(size_t len) {
   WptTrace(loglevel::kFunction, _T("[wpthook] - Request::BytesIn(%d)"), len);
   EnterCriticalSection(&cs);
-  if (_is_active)
+  if (_is_active) {
+    LARGE_INTEGER now;
+    QueryPerformanceCounter(&now);
     _bytes_in += len;
+    _arrivals.AddBytes(now.QuadPart, (DWORD)len);
+  }
   LeaveCriticalSection(&cs);
 }
 
@@ -540,6 +557,11 @@ void Request::HeaderOut(const char * header, const char * value, bool pushed) {
   }
   if (_is_active) {
     _request_data.AddHeader(header, value);
+    if (!lstrcmpiA(header, ":authority"))
+      authority_ = value;
+    else if (_test._adaptive_done && !lstrcmpiA(header, ":path") &&
+             _test.IgnoreActivity(CString(authority_), CString(value)))
+      long_lived_ = true;
     if (pushed && initiator_.IsEmpty())
       initiator_ = "HTTP/2 Server Push";
   }
@@ -700,17 +722,14 @@ bool Request::IsStatic() {
     return false;
 
   CString mime = GetMime().MakeLower();
-  CString exp = GetResponseHeader("expires").MakeLower();
-  CString cache = GetResponseHeader("cache-control").MakeLower();
-  CString pragma = GetResponseHeader("pragma").MakeLower();
   CString object = _request_data.GetObject().MakeLower();
+  const CachePolicy& policy = GetCachePolicy();
   int result = GetResult();
   // TODO: Include conditions below that it is not a base page and a network request.
   return (
     result == 304 ||
-    (result == 200 && exp != _T("0") && exp != _T("-1") &&
-     cache.Find(_T("no-store")) == -1 && cache.Find(_T("no-cache")) == -1 &&
-     pragma.Find(_T("no-cache")) == -1 && mime.Find(_T("/html")) == -1 &&
+    (result == 200 && !policy.expires_invalid_ && !policy.no_store_ &&
+     !policy.MustValidate() && mime.Find(_T("/html")) == -1 &&
      mime.Find(_T("/xhtml")) == -1 && mime.Find(_T("/cache-manifest")) == -1 &&
      (mime.Find(_T("shockwave-flash")) >= 0 || object.Right(4) == _T(".swf") ||
       mime.Find(_T("text/")) >= 0 || mime.Find(_T("javascript")) >= 0 ||
@@ -769,6 +788,90 @@ CStringA Request::GetHost() {
   return host;
 }
 
+/*-----------------------------------------------------------------------------
+  Long-lived requests (websockets, server-sent events and anything the test
+  asked to ignore) keep streaming data for as long as the page is open and
+  should not hold up the activity-based end of the test.
+-----------------------------------------------------------------------------*/
+bool Request::IsLongLived() {
+  EnterCriticalSection(&cs);
+  bool long_lived = long_lived_;
+  LeaveCriticalSection(&cs);
+  return long_lived;
+}
+
+/*-----------------------------------------------------------------------------
+  Request has gone out but nothing has come back yet.
+-----------------------------------------------------------------------------*/
+bool Request::IsPending() {
+  EnterCriticalSection(&cs);
+  bool pending = _is_active && _data_sent && !_first_byte.QuadPart &&
+                 !long_lived_;
+  LeaveCriticalSection(&cs);
+  return pending;
+}
+
+/*-----------------------------------------------------------------------------
+  Find a header value in the raw header block at the start of a chunk.
+  Works on the chunk directly so the request data doesn't get flattened
+  while it is still being written.
+-----------------------------------------------------------------------------*/
+static CStringA GetRawHeader(DataChunk& chunk, const char * name) {
+  CStringA value;
+  CStringA headers(chunk.GetData(), chunk.GetLength());
+  int end = headers.Find("\r\n\r\n");
+  if (end >= 0)
+    headers = headers.Left(end + 2);
+  CStringA lower = headers;
+  lower.MakeLower();
+  CStringA key = CStringA("\r\n") + name + ":";
+  int pos = lower.Find(key);
+  if (pos >= 0) {
+    pos += key.GetLength();
+    int line_end = headers.Find("\r\n", pos);
+    if (line_end >= pos)
+      value = headers.Mid(pos, line_end - pos).Trim();
+  }
+  return value;
+}
+
+/*-----------------------------------------------------------------------------
+  Classify the request from the first outbound chunk (must be called
+  within the critical section).
+-----------------------------------------------------------------------------*/
+void Request::CheckLongLivedRequest(DataChunk& chunk) {
+  if (!GetRawHeader(chunk, "upgrade").CompareNoCase("websocket")) {
+    long_lived_ = true;
+  } else {
+    // only the request line is needed
+    const char * data = chunk.GetData();
+    DWORD len = 0;
+    while (len < chunk.GetLength() && data[len] != '\r' && data[len] != '\n')
+      len++;
+    CStringA line(data, len);
+    int pos = 0;
+    line.Tokenize(" ", pos);
+    CStringA object;
+    if (pos > 0)
+      object = line.Tokenize(" ", pos);
+    CStringA host = GetRawHeader(chunk, "x-host");
+    if (host.IsEmpty())
+      host = GetRawHeader(chunk, "host");
+    if (_test.IgnoreActivity(CString(host), CString(object)))
+      long_lived_ = true;
+  }
+}
+
+/*-----------------------------------------------------------------------------
+  Classify the response from the first inbound chunk (must be called
+  within the critical section).
+-----------------------------------------------------------------------------*/
+void Request::CheckLongLivedResponse(DataChunk& chunk) {
+  CStringA mime = GetRawHeader(chunk, "content-type");
+  if (!_strnicmp(mime, "text/event-stream", 17))
+    long_lived_ = true;
+}
+
 /*-----------------------------------------------------------------------------
   Parse out the mime from the headers.
 -----------------------------------------------------------------------------*/
@@ -779,88 +882,56 @@ CStringA Request::GetMime() {
 }
 
 /*-----------------------------------------------------------------------------
-  See how much time is remaining for the object
-  Returns false if the object is explicitly not cacheable
-  (private or negative expires)
+  The response's caching headers, parsed the first time they are needed
 -----------------------------------------------------------------------------*/
-bool Request::GetExpiresRemaining(bool& expiration_set, 
-                                    int& seconds_remaining) {
-  bool is_cacheable = true;
-  expiration_set = false;
-  seconds_remaining = 0;
-
-  CStringA cache = GetResponseHeader("cache-control").MakeLower();
-  CStringA pragma = GetResponseHeader("pragma").MakeLower();
-
-  if (!HasResponseHeaders() ||
-      cache.Find("no-store") != -1 || 
-      cache.Find("no-cache") != -1 ||
-      pragma.Find("no-cache") != -1) {
-    is_cacheable = false;
-  } else {
-    CStringA date_string = GetResponseHeader("date").Trim();
-    CStringA age_string = GetResponseHeader("age").Trim();
-    CStringA expires_string = GetResponseHeader("expires").Trim();
-    SYSTEMTIME sys_time;
-    __int64 date_seconds = 0;
-    if (date_string.GetLength() && 
-        InternetTimeToSystemTimeA(date_string, &sys_time, 0)) {
-        date_seconds = SystemTimeToSeconds(sys_time);
-    }
-    if (!date_seconds) {
-      GetSystemTime(&sys_time);
-      date_seconds = SystemTimeToSeconds(sys_time);
-    }
-    if (date_seconds) {
-      if (expires_string.GetLength() && 
-          InternetTimeToSystemTimeA(expires_string, &sys_time, 0)) {
-        __int64 expires_seconds = SystemTimeToSeconds(sys_time);
-        if (expires_seconds) {
-          if (expires_seconds < date_seconds)
-            is_cacheable = false;
-          else {
-            expiration_set = true;
-            seconds_remaining = (int)(expires_seconds - date_seconds);
-          }
-        }
-      }
-    }
-    if (is_cacheable && !expiration_set) {
-      int index = cache.Find("max-age");
-      if( index > -1 ) {
-        int eq = cache.Find("=", index);
-        if( eq > -1 ) {
-          seconds_remaining = atol(cache.Mid(eq + 1).Trim());
-          if (seconds_remaining) {
-            expiration_set = true;
-            if (age_string.GetLength()) {
-              int age = atol(age_string);
-              seconds_remaining -= age;
-            }
-          }
-        }
-      }
+const CachePolicy& Request::GetCachePolicy() {
+  if (!cache_policy_parsed_ && _processed) {
+    cache_policy_.Reset();
+    cache_policy_.SetStatus(GetResult());
+    cache_policy_.SetResponseTime(GetResponseTime());
+    Fields& fields = _response_data.GetHeaderFields();
+    POSITION pos = fields.GetHeadPosition();
+    while (pos) {
+      HeaderField& field = fields.GetNext(pos);
+      cache_policy_.AddHeader(field._field_name, field._value);
     }
+    cache_policy_parsed_ = true;
   }
-
-  return is_cacheable;
+  return cache_policy_;
 }
 
 /*-----------------------------------------------------------------------------
-  Convert a System Time into a "seconds since X" format suitable for math
+  Wall-clock time (seconds since 1970) when the first byte of the response
+  arrived, from the step's start time and the performance counter
 -----------------------------------------------------------------------------*/
-__int64 Request::SystemTimeToSeconds(SYSTEMTIME& system_time) {
-  __int64 seconds = 0;
-  FILETIME file_time;
-  if (SystemTimeToFileTime(&system_time, &file_time)) {
-    LARGE_INTEGER convert;
-    convert.HighPart = file_time.dwHighDateTime;
-    convert.LowPart = file_time.dwLowDateTime;
-    seconds = convert.QuadPart / NS100_TO_SEC;
-  }
+int64_t Request::GetResponseTime() {
+  ULARGE_INTEGER start;
+  start.LowPart = _test_state._start_time.dwLowDateTime;
+  start.HighPart = _test_state._start_time.dwHighDateTime;
+  int64_t seconds = (int64_t)(start.QuadPart / 10000000) - 11644473600LL;
+  LONGLONG arrived = _first_byte.QuadPart ? _first_byte.QuadPart :
+                                            _end.QuadPart;
+  if (arrived && _test_state._step_start.QuadPart &&
+      _test_state._ms_frequency.QuadPart)
+    seconds += (arrived - _test_state._step_start.QuadPart) /
+               _test_state._ms_frequency.QuadPart / 1000;
   return seconds;
 }
 
+/*-----------------------------------------------------------------------------
+  See how much time is remaining for the object
+  Returns false if the object is explicitly not cacheable
+  (no-store, no-cache or an Expires that has already passed)
+-----------------------------------------------------------------------------*/
+bool Request::GetExpiresRemaining(bool& expiration_set, 
+                                    int& seconds_remaining) {
+  expiration_set = false;
+  seconds_remaining = 0;
+  if (!HasResponseHeaders())
+    return false;
+  return GetCachePolicy().ExpiresRemaining(expiration_set, seconds_remaining);
+}
+
 /*-----------------------------------------------------------------------------
   Get the start time of this request.
 -----------------------------------------------------------------------------*/
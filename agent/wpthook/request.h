@@ -27,6 +27,10 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 ******************************************************************************/
 
 #pragma once
+#include <new>
+#include "buffer_pool.h"
+#include "arrival_timeline.h"
+#include "cache_policy.h"
 
 class TestState;
 class TrackSockets;
@@ -52,20 +56,26 @@ public:
     }
     return *this;
   }
+  // The unowned data goes away with the caller's buffer so the chunk is
+  // left empty if it can't be copied.
   void CopyDataIfUnowned() {
     if (_value->_unowned_data) {
       DWORD len = _value->_data_len;
-      char *new_data = new char[len];
-      memcpy(new_data, _value->_unowned_data, len);
+      char *new_data = (char *)global_buffer_pool.Alloc(len);
+      if (new_data)
+        memcpy(new_data, _value->_unowned_data, len);
       _value->_unowned_data = NULL;
       _value->_data = new_data;
-      _value->_data_len = len;    }
+      _value->_data_len = new_data ? len : 0;
+    }
   }
+  // NULL (and an empty chunk) if the buffer can't be allocated
   char * AllocateLength(DWORD len) {
     if (--_value->_ref_count == 0) {
       delete _value;
     }
-    _value = new DataChunkValue(NULL, new char[len], len);
+    char * data = (char *)global_buffer_pool.Alloc(len);
+    _value = new DataChunkValue(NULL, data, data ? len : 0);
     return _value->_data;
   }
   const char * GetData() const {
@@ -89,7 +99,14 @@ private:
       _data = data;
       _data_len = data_len;
     }
-    ~DataChunkValue() { delete [] _data; }
+    ~DataChunkValue() { global_buffer_pool.Free(_data); }
+    static void * operator new(size_t size) {
+      void * p = global_buffer_pool.Alloc(size);
+      if (!p)
+        throw std::bad_alloc();
+      return p;
+    }
+    static void operator delete(void * p) { global_buffer_pool.Free(p); }
   };
   DataChunkValue * _value;
 };
@@ -117,7 +134,7 @@ typedef CAtlList<HeaderField> Fields;
 class HttpData {
  public:
   HttpData(): _data(NULL), _data_size(0), _body_chunks_size(0) {}
-  ~HttpData() { delete _data; }
+  ~HttpData() { global_buffer_pool.Free((void *)_data); }
 
   bool HasHeaders() { CopyData(); return _headers.GetLength() != 0; }
   CStringA GetHeaders() { CopyData(); return _headers; }
@@ -125,6 +142,7 @@ class HttpData {
 
   void AddChunk(DataChunk& chunk);
   CStringA GetHeader(CStringA field_name);
+  Fields& GetHeaderFields() { ExtractHeaderFields(); return _header_fields; }
 
   virtual void AddHeader(const char * header, const char * value);
   void AddBodyChunk(DataChunk& chunk);
@@ -227,6 +245,20 @@ public:
           TrackSockets& sockets, TrackDns& dns, WptTest& test, bool is_spdy,
           Requests& requests);
   ~Request(void);
+  static void * operator new(size_t size) {
+    void * p = global_buffer_pool.Alloc(size);
+    if (!p)
+      throw std::bad_alloc();
+    return p;
+  }
+  // the capture path uses new (std::nothrow) and skips the request on NULL
+  static void * operator new(size_t size, const std::nothrow_t&) throw() {
+    return global_buffer_pool.Alloc(size);
+  }
+  static void operator delete(void * p) { global_buffer_pool.Free(p); }
+  static void operator delete(void * p, const std::nothrow_t&) throw() {
+    global_buffer_pool.Free(p);
+  }
 
   void DataIn(DataChunk& chunk);
   bool ModifyDataOut(DataChunk& chunk);
@@ -253,8 +285,12 @@ public:
   CStringA GetMime();
   LARGE_INTEGER GetStartTime();
   bool GetExpiresRemaining(bool& expiration_set, int& seconds_remaining);
+  const CachePolicy& GetCachePolicy();
+  int64_t GetResponseTime();
   ULONG GetPeerAddress();
   CString GetUrl();
+  bool IsLongLived();
+  bool IsPending();
 
   bool  _processed;
   bool  _reported;
@@ -302,6 +338,9 @@ public:
   LARGE_INTEGER _ssl_start;
   LARGE_INTEGER _ssl_end;
 
+  // when the response bytes arrived
+  ArrivalTimeline _arrivals;
+
   OptimizationScores _scores;
   CAtlList<CustomRulesMatch>  _custom_rules_matches;
 
@@ -316,5 +355,10 @@ private:
   bool _is_active;
   bool _are_headers_complete;
   bool _data_sent;
-  __int64 SystemTimeToSeconds(SYSTEMTIME& system_time);
+  bool long_lived_;
+  CStringA authority_;
+  CachePolicy cache_policy_;
+  bool cache_policy_parsed_;
+  void CheckLongLivedRequest(DataChunk& chunk);
+  void CheckLongLivedResponse(DataChunk& chunk);
 };
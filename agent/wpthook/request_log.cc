@@ -0,0 +1,660 @@
+/******************************************************************************
+Copyright (c) 2013, Google Inc.
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without 
+modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice, 
+      this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+    * Neither the name of the <ORGANIZATION> nor the names of its contributors 
+    may be used to endorse or promote products derived from this software 
+    without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE 
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE 
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL 
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR 
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER 
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, 
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE 
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+******************************************************************************/
+
+// No precompiled header, this file has to build without the Windows SDK
+#include "request_log.h"
+#include <string.h>
+#include <map>
+
+// Names for the columns the server knows about (matching the keys in
+// LoadRequests in www/object_detail.inc) so readers can look columns up
+// without hard-coding their positions.
+static const struct {
+  uint32_t index;
+  const char * name;
+} COLUMN_NAMES[] = {
+  {1, "date"}, {2, "time"}, {3, "event_name"}, {4, "ip_addr"},
+  {5, "method"}, {6, "host"}, {7, "url"}, {8, "responseCode"},
+  {9, "load_ms"}, {10, "ttfb_ms"}, {11, "load_start"}, {12, "bytesOut"},
+  {13, "bytesIn"}, {14, "objectSize"}, {17, "expires"},
+  {18, "cacheControl"}, {19, "contentType"}, {20, "contentEncoding"},
+  {21, "type"}, {22, "socket"}, {24, "end_ms"}, {35, "sequence"},
+  {36, "score_cache"}, {37, "score_cdn"}, {38, "score_gzip"},
+  {39, "score_cookies"}, {40, "score_keep-alive"}, {42, "score_minify"},
+  {43, "score_combine"}, {44, "score_compress"}, {45, "score_etags"},
+  {47, "is_secure"}, {48, "dns_ms"}, {49, "connect_ms"}, {50, "ssl_ms"},
+  {51, "gzip_total"}, {52, "gzip_save"}, {53, "minify_total"},
+  {54, "minify_save"}, {55, "image_total"}, {56, "image_save"},
+  {57, "cache_time"}, {61, "cdn_provider"}, {62, "dns_start"},
+  {63, "dns_end"}, {64, "connect_start"}, {65, "connect_end"},
+  {66, "ssl_start"}, {67, "ssl_end"}, {68, "initiator"},
+  {69, "initiator_line"}, {70, "initiator_column"}, {71, "server_count"},
+  {72, "server_rtt"}, {73, "client_port"}, {74, "jpeg_scan_count"},
+  {75, "h2_blocked_ms"}, {76, "h2_hol_wait_ms"}, {77, "arrival_timeline"},
+  {78, "max_stall_ms"}, {79, "throughput"}, {80, "time_to_50_ms"},
+  {81, "time_to_90_ms"}
+};
+
+static const size_t ALIGNMENT = 8;
+
+/*-----------------------------------------------------------------------------
+  Parse a cell that is exactly how the agent formats an integer (no leading
+  zeros, no "+" or "-0") so the text can be reproduced from the value.
+-----------------------------------------------------------------------------*/
+static bool ParseCanonicalInt(const char * str, size_t len, int64_t& value) {
+  bool ok = false;
+  size_t pos = 0;
+  bool negative = false;
+  if (pos < len && str[pos] == '-') {
+    negative = true;
+    pos++;
+  }
+  size_t digits = len - pos;
+  if (digits > 0 && digits <= 10 && (str[pos] != '0' || digits == 1)) {
+    ok = true;
+    value = 0;
+    for (; pos < len && ok; pos++) {
+      if (str[pos] >= '0' && str[pos] <= '9')
+        value = value * 10 + (str[pos] - '0');
+      else
+        ok = false;
+    }
+    if (negative) {
+      if (value == 0)
+        ok = false;
+      value = -value;
+    }
+  }
+  return ok;
+}
+
+/*-----------------------------------------------------------------------------
+  Integer cell that fits in an INT32 column
+-----------------------------------------------------------------------------*/
+static bool ParseInt32(const char * str, size_t len, int32_t& value) {
+  int64_t parsed = 0;
+  bool ok = ParseCanonicalInt(str, len, parsed) &&
+            parsed > INT32_MIN && parsed <= INT32_MAX;
+  if (ok)
+    value = (int32_t)parsed;
+  return ok;
+}
+
+/*-----------------------------------------------------------------------------
+  Cell with exactly 3 decimal places ("12.345"), stored in thousandths
+-----------------------------------------------------------------------------*/
+static bool ParseFixed3(const char * str, size_t len, int32_t& value) {
+  bool ok = false;
+  if (len >= 5 && str[len - 4] == '.') {
+    int64_t whole = 0;
+    bool negative = str[0] == '-';
+    size_t whole_len = len - 4;
+    if (negative && whole_len == 2 && str[1] == '0') {
+      whole = 0;
+      ok = true;
+    } else {
+      ok = ParseCanonicalInt(str, whole_len, whole);
+    }
+    int64_t fraction = 0;
+    for (size_t i = len - 3; i < len && ok; i++) {
+      if (str[i] >= '0' && str[i] <= '9')
+        fraction = fraction * 10 + (str[i] - '0');
+      else
+        ok = false;
+    }
+    if (ok) {
+      int64_t thousandths = whole < 0 ? whole * 1000 - fraction :
+                                        whole * 1000 + fraction;
+      if (negative && whole == 0)
+        thousandths = -fraction;
+      // "-0.000" can't be reproduced from the value
+      ok = (!negative || thousandths < 0) &&
+           thousandths > INT32_MIN && thousandths <= INT32_MAX;
+      if (ok)
+        value = (int32_t)thousandths;
+    }
+  }
+  return ok;
+}
+
+/*-----------------------------------------------------------------------------
+-----------------------------------------------------------------------------*/
+static void AppendInt(std::string& out, int64_t value) {
+  char buff[24];
+  size_t pos = sizeof(buff);
+  bool negative = value < 0;
+  uint64_t remaining = negative ? (uint64_t)(-value) : (uint64_t)value;
+  do {
+    buff[--pos] = (char)('0' + remaining % 10);
+    remaining /= 10;
+  } while (remaining);
+  if (negative)
+    buff[--pos] = '-';
+  out.append(buff + pos, sizeof(buff) - pos);
+}
+
+/*-----------------------------------------------------------------------------
+-----------------------------------------------------------------------------*/
+static void AppendFixed3(std::string& out, int32_t value) {
+  int64_t magnitude = value < 0 ? -(int64_t)value : value;
+  if (value < 0)
+    out += '-';
+  AppendInt(out, magnitude / 1000);
+  int fraction = (int)(magnitude % 1000);
+  out += '.';
+  out += (char)('0' + fraction / 100);
+  out += (char)('0' + (fraction / 10) % 10);
+  out += (char)('0' + fraction % 10);
+}
+
+/*-----------------------------------------------------------------------------
+  Serialization helpers
+-----------------------------------------------------------------------------*/
+static void Align(std::string& out) {
+  while (out.length() % ALIGNMENT)
+    out += '\0';
+}
+
+template <class T>
+static void AppendRaw(std::string& out, const T& value) {
+  out.append((const char *)&value, sizeof(value));
+}
+
+/*-----------------------------------------------------------------------------
+  String table with identical strings only stored once
+-----------------------------------------------------------------------------*/
+class StringTable {
+public:
+  RequestLogString Add(const char * str, size_t len) {
+    RequestLogString entry;
+    std::string key(str, len);
+    std::map<std::string, uint32_t>::const_iterator existing =
+        offsets_.find(key);
+    if (existing != offsets_.end()) {
+      entry.offset = existing->second;
+    } else {
+      entry.offset = (uint32_t)data_.length();
+      data_.append(str, len);
+      offsets_[key] = entry.offset;
+    }
+    entry.length = (uint32_t)len;
+    return entry;
+  }
+  const std::string& Data(void) const { return data_; }
+
+private:
+  std::string                      data_;
+  std::map<std::string, uint32_t>  offsets_;
+};
+
+/*-----------------------------------------------------------------------------
+-----------------------------------------------------------------------------*/
+RequestLogWriter::RequestLogWriter(void):
+  column_count_(0) {
+}
+
+/*-----------------------------------------------------------------------------
+-----------------------------------------------------------------------------*/
+RequestLogWriter::~RequestLogWriter(void) {
+}
+
+/*-----------------------------------------------------------------------------
+  Add a single TSV row (without the line ending).  Every cell in the agent's
+  output is tab-terminated so a trailing tab doesn't start a new cell.
+-----------------------------------------------------------------------------*/
+void RequestLogWriter::AddRow(const char * line, size_t len) {
+  if (len && line[len - 1] == '\t')
+    len--;
+  rows_.push_back(std::vector<Cell>());
+  std::vector<Cell>& row = rows_.back();
+  size_t start = 0;
+  for (size_t pos = 0; pos <= len; pos++) {
+    if (pos == len || line[pos] == '\t') {
+      Cell cell;
+      cell.offset = (uint32_t)text_.length();
+      cell.length = (uint32_t)(pos - start);
+      text_.append(line + start, pos - start);
+      row.push_back(cell);
+      start = pos + 1;
+    }
+  }
+  if (row.size() > column_count_)
+    column_count_ = row.size();
+}
+
+/*-----------------------------------------------------------------------------
+  Add all of the rows in a block of TSV (CRLF or LF line endings)
+-----------------------------------------------------------------------------*/
+void RequestLogWriter::AddTsv(const char * data, size_t len) {
+  size_t start = 0;
+  while (start < len) {
+    const char * end = (const char *)memchr(data + start, '\n', len - start);
+    size_t line_end = end ? (size_t)(end - data) : len;
+    size_t next = end ? line_end + 1 : len;
+    if (line_end > start && data[line_end - 1] == '\r')
+      line_end--;
+    if (line_end > start)
+      AddRow(data + start, line_end - start);
+    start = next;
+  }
+}
+
+/*-----------------------------------------------------------------------------
+  Pick the column types and write out the binary log.  Rows that are short
+  some columns get empty cells for them.
+-----------------------------------------------------------------------------*/
+void RequestLogWriter::Serialize(std::string& out) const {
+  uint32_t row_count = (uint32_t)rows_.size();
+  uint32_t column_count = (uint32_t)column_count_;
+  StringTable strings;
+  std::vector<RequestLogColumn> columns(column_count);
+  std::vector<std::string> blocks(column_count);
+  const char * text = text_.data();
+
+  for (uint32_t c = 0; c < column_count; c++) {
+    RequestLogColumn& column = columns[c];
+    memset(&column, 0, sizeof(column));
+    column.index = c + 1;
+    for (size_t i = 0; i < sizeof(COLUMN_NAMES) / sizeof(COLUMN_NAMES[0]); i++) {
+      if (COLUMN_NAMES[i].index == column.index) {
+        size_t name_len = strlen(COLUMN_NAMES[i].name);
+        RequestLogString name = strings.Add(COLUMN_NAMES[i].name, name_len);
+        column.name_offset = name.offset;
+        column.name_length = name.length;
+      }
+    }
+
+    // find the most compact type that holds every cell exactly
+    bool is_empty = true;
+    bool is_int = true;
+    bool is_fixed = true;
+    std::map<std::string, uint32_t> distinct;
+    for (uint32_t r = 0; r < row_count; r++) {
+      const std::vector<Cell>& row = rows_[r];
+      if (c < row.size() && row[c].length) {
+        const char * str = text + row[c].offset;
+        size_t len = row[c].length;
+        int32_t value;
+        is_empty = false;
+        if (is_int && !ParseInt32(str, len, value))
+          is_int = false;
+        if (is_fixed && !ParseFixed3(str, len, value))
+          is_fixed = false;
+      }
+      if (distinct.size() * 2 <= row_count) {
+        std::string key;
+        if (c < row.size())
+          key.assign(text + row[c].offset, row[c].length);
+        if (distinct.find(key) == distinct.end()) {
+          uint32_t code = (uint32_t)distinct.size();
+          distinct[key] = code;
+        }
+      }
+    }
+    if (is_empty)
+      column.type = REQUEST_LOG_EMPTY;
+    else if (is_int)
+      column.type = REQUEST_LOG_INT32;
+    else if (is_fixed)
+      column.type = REQUEST_LOG_FIXED3;
+    else if (distinct.size() * 2 <= row_count)
+      column.type = REQUEST_LOG_DICT;
+    else
+      column.type = REQUEST_LOG_STRING;
+
+    std::string& block = blocks[c];
+    if (column.type == REQUEST_LOG_DICT) {
+      std::vector<RequestLogString> dictionary(distinct.size());
+      for (std::map<std::string, uint32_t>::const_iterator it =
+           distinct.begin(); it != distinct.end(); ++it)
+        dictionary[it->second] =
+            strings.Add(it->first.data(), it->first.length());
+      for (size_t i = 0; i < dictionary.size(); i++)
+        AppendRaw(block, dictionary[i]);
+      column.dict_count = (uint32_t)dictionary.size();
+      column.code_size = column.dict_count <= 0x100 ? 1 :
+                         column.dict_count <= 0x10000 ? 2 : 4;
+    }
+    for (uint32_t r = 0; r < row_count && column.type != REQUEST_LOG_EMPTY;
+         r++) {
+      const std::vector<Cell>& row = rows_[r];
+      const char * str = c < row.size() ? text + row[c].offset : "";
+      size_t len = c < row.size() ? row[c].length : 0;
+      if (column.type == REQUEST_LOG_INT32 ||
+          column.type == REQUEST_LOG_FIXED3) {
+        int32_t value = REQUEST_LOG_NULL;
+        if (len) {
+          if (column.type == REQUEST_LOG_INT32)
+            ParseInt32(str, len, value);
+          else
+            ParseFixed3(str, len, value);
+        }
+        AppendRaw(block, value);
+      } else if (column.type == REQUEST_LOG_DICT) {
+        uint32_t code = distinct[std::string(str, len)];
+        if (column.code_size == 1)
+          AppendRaw(block, (uint8_t)code);
+        else if (column.code_size == 2)
+          AppendRaw(block, (uint16_t)code);
+        else
+          AppendRaw(block, code);
+      } else {
+        AppendRaw(block, strings.Add(str, len));
+      }
+    }
+  }
+
+  // lay out the file
+  RequestLogHeader header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, REQUEST_LOG_MAGIC, sizeof(header.magic));
+  header.version = REQUEST_LOG_VERSION;
+  header.column_count = column_count;
+  header.row_count = row_count;
+  uint64_t offset = sizeof(header) + sizeof(RequestLogColumn) * column_count;
+  for (uint32_t c = 0; c < column_count; c++) {
+    offset = (offset + ALIGNMENT - 1) & ~(uint64_t)(ALIGNMENT - 1);
+    columns[c].data_offset = offset;
+    columns[c].data_size = blocks[c].length();
+    offset += blocks[c].length();
+  }
+  offset = (offset + ALIGNMENT - 1) & ~(uint64_t)(ALIGNMENT - 1);
+  header.strings_offset = offset;
+  header.strings_size = strings.Data().length();
+  header.file_size = offset + header.strings_size;
+
+  out.clear();
+  out.reserve((size_t)header.file_size);
+  AppendRaw(out, header);
+  for (uint32_t c = 0; c < column_count; c++)
+    AppendRaw(out, columns[c]);
+  for (uint32_t c = 0; c < column_count; c++) {
+    Align(out);
+    out += blocks[c];
+  }
+  Align(out);
+  out += strings.Data();
+}
+
+/*-----------------------------------------------------------------------------
+-----------------------------------------------------------------------------*/
+RequestLogReader::RequestLogReader(void):
+  data_(NULL)
+  , len_(0)
+  , header_(NULL)
+  , columns_(NULL)
+  , strings_(NULL) {
+}
+
+/*-----------------------------------------------------------------------------
+-----------------------------------------------------------------------------*/
+RequestLogReader::~RequestLogReader(void) {
+}
+
+/*-----------------------------------------------------------------------------
+  Validate the header and the column directory.  Everything the accessors
+  touch is bounds-checked here (or at access time for the string and
+  dictionary references) so a truncated or corrupt file can't be read past.
+-----------------------------------------------------------------------------*/
+bool RequestLogReader::Open(const void * data, size_t len) {
+  bool ok = false;
+  data_ = (const unsigned char *)data;
+  len_ = len;
+  header_ = NULL;
+  columns_ = NULL;
+  strings_ = NULL;
+  if (data_ && len_ >= sizeof(RequestLogHeader) &&
+      ((size_t)data_ % ALIGNMENT) == 0) {
+    const RequestLogHeader * header = (const RequestLogHeader *)data_;
+    uint64_t directory_end = sizeof(RequestLogHeader) +
+        (uint64_t)header->column_count * sizeof(RequestLogColumn);
+    if (!memcmp(header->magic, REQUEST_LOG_MAGIC, sizeof(header->magic)) &&
+        header->version == REQUEST_LOG_VERSION &&
+        header->file_size <= len_ &&
+        directory_end <= header->file_size &&
+        header->strings_offset <= header->file_size &&
+        header->strings_size <= header->file_size - header->strings_offset) {
+      header_ = header;
+      columns_ = (const RequestLogColumn *)(data_ + sizeof(RequestLogHeader));
+      strings_ = (const char *)data_ + header->strings_offset;
+      ok = true;
+      for (uint32_t c = 0; c < header->column_count && ok; c++)
+        ok = ValidColumn(columns_[c]);
+      if (!ok) {
+        header_ = NULL;
+        columns_ = NULL;
+        strings_ = NULL;
+      }
+    }
+  }
+  return ok;
+}
+
+/*-----------------------------------------------------------------------------
+-----------------------------------------------------------------------------*/
+bool RequestLogReader::ValidColumn(const RequestLogColumn& column) const {
+  uint64_t rows = header_->row_count;
+  uint64_t expected = 0;
+  switch (column.type) {
+    case REQUEST_LOG_INT32:
+    case REQUEST_LOG_FIXED3: expected = rows * sizeof(int32_t); break;
+    case REQUEST_LOG_DICT:
+      if (column.code_size != 1 && column.code_size != 2 &&
+          column.code_size != 4)
+        return false;
+      expected = column.dict_count * (uint64_t)sizeof(RequestLogString) +
+                 rows * column.code_size;
+      break;
+    case REQUEST_LOG_STRING: expected = rows * sizeof(RequestLogString); break;
+    case REQUEST_LOG_EMPTY: expected = 0; break;
+    default: return false;
+  }
+  return column.data_offset % ALIGNMENT == 0 &&
+         column.data_size == expected &&
+         column.data_offset <= header_->file_size &&
+         column.data_size <= header_->file_size - column.data_offset &&
+         (uint64_t)column.name_offset + column.name_length <=
+             header_->strings_size;
+}
+
+/*-----------------------------------------------------------------------------
+-----------------------------------------------------------------------------*/
+uint32_t RequestLogReader::RowCount(void) const {
+  return header_ ? header_->row_count : 0;
+}
+
+/*-----------------------------------------------------------------------------
+-----------------------------------------------------------------------------*/
+uint32_t RequestLogReader::ColumnCount(void) const {
+  return header_ ? header_->column_count : 0;
+}
+
+/*-----------------------------------------------------------------------------
+-----------------------------------------------------------------------------*/
+const RequestLogColumn * RequestLogReader::GetColumn(uint32_t column) const {
+  return header_ && column < header_->column_count ? &columns_[column] : NULL;
+}
+
+/*-----------------------------------------------------------------------------
+  Find a column by its 1-based position in the TSV, -1 if it isn't there
+-----------------------------------------------------------------------------*/
+int RequestLogReader::FindColumn(uint32_t tsv_index) const {
+  for (uint32_t c = 0; c < ColumnCount(); c++)
+    if (columns_[c].index == tsv_index)
+      return (int)c;
+  return -1;
+}
+
+/*-----------------------------------------------------------------------------
+-----------------------------------------------------------------------------*/
+int RequestLogReader::FindColumn(const char * name) const {
+  size_t len = strlen(name);
+  for (uint32_t c = 0; c < ColumnCount(); c++)
+    if (columns_[c].name_length == len &&
+        !memcmp(strings_ + columns_[c].name_offset, name, len))
+      return (int)c;
+  return -1;
+}
+
+/*-----------------------------------------------------------------------------
+-----------------------------------------------------------------------------*/
+std::string RequestLogReader::ColumnName(uint32_t column) const {
+  std::string name;
+  const RequestLogColumn * info = GetColumn(column);
+  if (info)
+    name.assign(strings_ + info->name_offset, info->name_length);
+  return name;
+}
+
+/*-----------------------------------------------------------------------------
+  Pointer to the text for a string table reference (NULL if out of range)
+-----------------------------------------------------------------------------*/
+const char * RequestLogReader::String(const RequestLogString& str) const {
+  if ((uint64_t)str.offset + str.length <= header_->strings_size)
+    return strings_ + str.offset;
+  return NULL;
+}
+
+/*-----------------------------------------------------------------------------
+-----------------------------------------------------------------------------*/
+bool RequestLogReader::IsNull(uint32_t column, uint32_t row) const {
+  const RequestLogColumn * info = GetColumn(column);
+  if (info && row < header_->row_count) {
+    if (info->type == REQUEST_LOG_INT32 || info->type == REQUEST_LOG_FIXED3) {
+      const int32_t * values = (const int32_t *)(data_ + info->data_offset);
+      return values[row] == REQUEST_LOG_NULL;
+    }
+    const char * str;
+    size_t len;
+    return !GetString(column, row, str, len) || !len;
+  }
+  return true;
+}
+
+/*-----------------------------------------------------------------------------
+  Raw value of a numeric cell (thousandths for FIXED3 columns)
+-----------------------------------------------------------------------------*/
+bool RequestLogReader::GetInt(uint32_t column, uint32_t row,
+                              int32_t& value) const {
+  const RequestLogColumn * info = GetColumn(column);
+  if (info && row < header_->row_count &&
+      (info->type == REQUEST_LOG_INT32 || info->type == REQUEST_LOG_FIXED3)) {
+    value = ((const int32_t *)(data_ + info->data_offset))[row];
+    return value != REQUEST_LOG_NULL;
+  }
+  return false;
+}
+
+/*-----------------------------------------------------------------------------
+  Dictionary entry for a row in a DICT column (NULL for an invalid code)
+-----------------------------------------------------------------------------*/
+const RequestLogString * RequestLogReader::DictEntry(
+    const RequestLogColumn& column, uint32_t row) const {
+  const RequestLogString * dictionary =
+      (const RequestLogString *)(data_ + column.data_offset);
+  const unsigned char * codes =
+      (const unsigned char *)(dictionary + column.dict_count);
+  uint32_t code;
+  if (column.code_size == 1)
+    code = codes[row];
+  else if (column.code_size == 2)
+    code = ((const uint16_t *)codes)[row];
+  else
+    code = ((const uint32_t *)codes)[row];
+  return code < column.dict_count ? &dictionary[code] : NULL;
+}
+
+/*-----------------------------------------------------------------------------
+  Text of a DICT or STRING cell (not NUL-terminated)
+-----------------------------------------------------------------------------*/
+bool RequestLogReader::GetString(uint32_t column, uint32_t row,
+                                 const char *& str, size_t& len) const {
+  const RequestLogColumn * info = GetColumn(column);
+  const RequestLogString * entry = NULL;
+  if (info && row < header_->row_count) {
+    if (info->type == REQUEST_LOG_DICT)
+      entry = DictEntry(*info, row);
+    else if (info->type == REQUEST_LOG_STRING)
+      entry = &((const RequestLogString *)(data_ + info->data_offset))[row];
+  }
+  if (entry) {
+    str = String(*entry);
+    len = entry->length;
+  }
+  return entry && str;
+}
+
+/*-----------------------------------------------------------------------------
+  Append the cell formatted the same way as the TSV
+-----------------------------------------------------------------------------*/
+void RequestLogReader::AppendCell(uint32_t column, uint32_t row,
+                                  std::string& out) const {
+  const RequestLogColumn * info = GetColumn(column);
+  if (info) {
+    int32_t value;
+    const char * str;
+    size_t len;
+    if (info->type == REQUEST_LOG_INT32 && GetInt(column, row, value))
+      AppendInt(out, value);
+    else if (info->type == REQUEST_LOG_FIXED3 && GetInt(column, row, value))
+      AppendFixed3(out, value);
+    else if (GetString(column, row, str, len))
+      out.append(str, len);
+  }
+}
+
+/*-----------------------------------------------------------------------------
+  Append a full TSV row (tab-terminated cells and a CRLF)
+-----------------------------------------------------------------------------*/
+void RequestLogReader::AppendRow(uint32_t row, std::string& out) const {
+  for (uint32_t c = 0; c < ColumnCount(); c++) {
+    AppendCell(c, row, out);
+    out += '\t';
+  }
+  out += "\r\n";
+}
+
+/*-----------------------------------------------------------------------------
+-----------------------------------------------------------------------------*/
+bool RequestLogFromTsv(const char * tsv, size_t len, std::string& out) {
+  RequestLogWriter writer;
+  writer.AddTsv(tsv, len);
+  writer.Serialize(out);
+  return writer.RowCount() > 0;
+}
+
+/*-----------------------------------------------------------------------------
+-----------------------------------------------------------------------------*/
+bool RequestLogToTsv(const void * data, size_t len, std::string& out) {
+  RequestLogReader reader;
+  bool ok = reader.Open(data, len);
+  if (ok)
+    for (uint32_t row = 0; row < reader.RowCount(); row++)
+      reader.AppendRow(row, out);
+  return ok;
+}
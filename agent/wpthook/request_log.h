@@ -0,0 +1,157 @@
+/******************************************************************************
+Copyright (c) 2013, Google Inc.
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without 
+modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice, 
+      this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+    * Neither the name of the <ORGANIZATION> nor the names of its contributors 
+    may be used to endorse or promote products derived from this software 
+    without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE 
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE 
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL 
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR 
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER 
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, 
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE 
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+******************************************************************************/
+
+#pragma once
+// Binary columnar version of the request data (_IEWTR.txt) so the server can
+// memory-map a run and pull individual columns without parsing text.
+// Portable like analysis.h: no Win32, ATL or precompiled header so the reader
+// and the TSV converter can be built and exercised on any platform.
+//
+// Layout (little-endian, every section 8-byte aligned, offsets from the start
+// of the file):
+//   RequestLogHeader
+//   RequestLogColumn[column_count]
+//   column data, one block per column
+//   string table (UTF-8, not NUL-terminated, identical strings stored once)
+//
+// Column data by type:
+//   INT32   int32_t[row_count], REQUEST_LOG_NULL for an empty cell
+//   FIXED3  int32_t[row_count] in thousandths ("12.345" -> 12345)
+//   DICT    RequestLogString[dict_count] then row_count codes, each
+//           code_size bytes (1, 2 or 4 depending on the dictionary size)
+//   STRING  RequestLogString[row_count]
+//   EMPTY   nothing, every cell is empty
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+const char REQUEST_LOG_MAGIC[8] = {'W', 'P', 'T', 'R', 'L', 'O', 'G', '\0'};
+const uint32_t REQUEST_LOG_VERSION = 1;
+const int32_t REQUEST_LOG_NULL = INT32_MIN;
+
+typedef enum {
+  REQUEST_LOG_INT32 = 1,
+  REQUEST_LOG_FIXED3 = 2,
+  REQUEST_LOG_DICT = 3,
+  REQUEST_LOG_STRING = 4,
+  REQUEST_LOG_EMPTY = 5
+} REQUEST_LOG_TYPE;
+
+struct RequestLogHeader {
+  char      magic[8];
+  uint32_t  version;
+  uint32_t  column_count;
+  uint32_t  row_count;
+  uint32_t  reserved;
+  uint64_t  strings_offset;
+  uint64_t  strings_size;
+  uint64_t  file_size;
+};
+
+struct RequestLogColumn {
+  uint32_t  index;        // 1-based column in the TSV
+  uint32_t  type;         // REQUEST_LOG_TYPE
+  uint64_t  data_offset;
+  uint64_t  data_size;
+  uint32_t  name_offset;  // column name in the string table
+  uint32_t  name_length;
+  uint32_t  dict_count;   // DICT only
+  uint32_t  code_size;    // DICT only, bytes per code
+};
+
+struct RequestLogString {
+  uint32_t  offset;       // in the string table
+  uint32_t  length;
+};
+
+/*-----------------------------------------------------------------------------
+  Builds a log from TSV rows.  Each column is stored with the most compact
+  type that reproduces every one of its cells exactly: integers and
+  3-decimal fixed point values as fixed-width numbers, repetitive text
+  (hosts, MIME types...) dictionary-encoded, anything else as plain strings.
+-----------------------------------------------------------------------------*/
+class RequestLogWriter {
+public:
+  RequestLogWriter(void);
+  ~RequestLogWriter(void);
+
+  void AddRow(const char * line, size_t len);
+  void AddTsv(const char * data, size_t len);
+  size_t RowCount(void) const { return rows_.size(); }
+  void Serialize(std::string& out) const;
+
+private:
+  struct Cell {
+    uint32_t offset;  // in text_
+    uint32_t length;
+  };
+  std::string                     text_;
+  std::vector<std::vector<Cell> > rows_;
+  size_t                          column_count_;
+};
+
+/*-----------------------------------------------------------------------------
+  Zero-copy view of a serialized log.  The buffer (usually a memory-mapped
+  file) has to stay valid for the lifetime of the reader.
+-----------------------------------------------------------------------------*/
+class RequestLogReader {
+public:
+  RequestLogReader(void);
+  ~RequestLogReader(void);
+
+  bool Open(const void * data, size_t len);
+  uint32_t RowCount(void) const;
+  uint32_t ColumnCount(void) const;
+  const RequestLogColumn * GetColumn(uint32_t column) const;
+  int FindColumn(uint32_t tsv_index) const;
+  int FindColumn(const char * name) const;
+  std::string ColumnName(uint32_t column) const;
+
+  bool IsNull(uint32_t column, uint32_t row) const;
+  bool GetInt(uint32_t column, uint32_t row, int32_t& value) const;
+  bool GetString(uint32_t column, uint32_t row, const char *& str,
+                 size_t& len) const;
+  void AppendCell(uint32_t column, uint32_t row, std::string& out) const;
+  void AppendRow(uint32_t row, std::string& out) const;
+
+private:
+  bool ValidColumn(const RequestLogColumn& column) const;
+  const RequestLogString * DictEntry(const RequestLogColumn& column,
+                                     uint32_t row) const;
+  const char * String(const RequestLogString& str) const;
+
+  const unsigned char *      data_;
+  size_t                     len_;
+  const RequestLogHeader *   header_;
+  const RequestLogColumn *   columns_;
+  const char *               strings_;
+};
+
+bool RequestLogFromTsv(const char * tsv, size_t len, std::string& out);
+bool RequestLogToTsv(const void * data, size_t len, std::string& out);
@@ -0,0 +1,141 @@
+/******************************************************************************
+Copyright (c) 2013, Google Inc.
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without 
+modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice, 
+      this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+    * Neither the name of the <ORGANIZATION> nor the names of its contributors 
+    may be used to endorse or promote products derived from this software 
+    without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE 
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE 
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL 
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR 
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER 
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, 
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE 
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+******************************************************************************/
+
+// Command-line converter between the agent's request TSV (_IEWTR.txt) and
+// the binary request log, for the server side and for exercising the
+// request_log code outside of the agent.
+//
+//   request_log_tool tsv2bin <in.txt> <out.bin>
+//   request_log_tool bin2tsv <in.bin> <out.txt>
+//   request_log_tool dump <in.bin>
+#include "../request_log.h"
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/*-----------------------------------------------------------------------------
+  Read-only memory map of a whole file
+-----------------------------------------------------------------------------*/
+class MappedFile {
+public:
+  MappedFile(): data_(NULL), len_(0) {}
+  ~MappedFile() {
+    if (data_)
+      munmap(data_, len_);
+  }
+  bool Open(const char * path) {
+    int fd = open(path, O_RDONLY);
+    if (fd >= 0) {
+      struct stat info;
+      if (!fstat(fd, &info) && info.st_size > 0) {
+        len_ = (size_t)info.st_size;
+        data_ = mmap(NULL, len_, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data_ == MAP_FAILED)
+          data_ = NULL;
+      }
+      close(fd);
+    }
+    return data_ != NULL;
+  }
+  const char * Data() const { return (const char *)data_; }
+  size_t Length() const { return len_; }
+
+private:
+  void *  data_;
+  size_t  len_;
+};
+
+/*-----------------------------------------------------------------------------
+-----------------------------------------------------------------------------*/
+static bool WriteFile(const char * path, const std::string& data) {
+  bool ok = false;
+  FILE * file = fopen(path, "wb");
+  if (file) {
+    ok = fwrite(data.data(), 1, data.length(), file) == data.length();
+    ok = !fclose(file) && ok;
+  }
+  return ok;
+}
+
+/*-----------------------------------------------------------------------------
+  Column directory and sizes for a binary log
+-----------------------------------------------------------------------------*/
+static bool Dump(const MappedFile& file) {
+  static const char * TYPES[] = {"?", "int32", "fixed3", "dict", "string",
+                                "empty"};
+  RequestLogReader reader;
+  if (!reader.Open(file.Data(), file.Length()))
+    return false;
+  printf("%u rows, %u columns, %zu bytes\n", reader.RowCount(),
+         reader.ColumnCount(), file.Length());
+  for (uint32_t c = 0; c < reader.ColumnCount(); c++) {
+    const RequestLogColumn * column = reader.GetColumn(c);
+    printf("%3u %-7s %8llu bytes", column->index,
+           TYPES[column->type < 6 ? column->type : 0],
+           (unsigned long long)column->data_size);
+    if (column->type == REQUEST_LOG_DICT)
+      printf(" (%u values)", column->dict_count);
+    printf(" %s\n", reader.ColumnName(c).c_str());
+  }
+  return true;
+}
+
+/*-----------------------------------------------------------------------------
+-----------------------------------------------------------------------------*/
+int main(int argc, char ** argv) {
+  if (argc < 3 || (strcmp(argv[1], "dump") && argc < 4)) {
+    fprintf(stderr, "usage: %s tsv2bin|bin2tsv <in> <out>\n"
+                    "       %s dump <in.bin>\n", argv[0], argv[0]);
+    return 2;
+  }
+  MappedFile in;
+  if (!in.Open(argv[2])) {
+    fprintf(stderr, "Unable to read %s\n", argv[2]);
+    return 1;
+  }
+  std::string out;
+  bool ok = false;
+  if (!strcmp(argv[1], "tsv2bin"))
+    ok = RequestLogFromTsv(in.Data(), in.Length(), out);
+  else if (!strcmp(argv[1], "bin2tsv"))
+    ok = RequestLogToTsv(in.Data(), in.Length(), out);
+  else if (!strcmp(argv[1], "dump"))
+    return Dump(in) ? 0 : 1;
+  if (!ok) {
+    fprintf(stderr, "Unable to convert %s\n", argv[2]);
+    return 1;
+  }
+  if (!WriteFile(argv[3], out)) {
+    fprintf(stderr, "Unable to write %s\n", argv[3]);
+    return 1;
+  }
+  return 0;
+}
@@ -32,8 +32,76 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include "test_state.h"
 #include "track_dns.h"
 #include "track_sockets.h"
+#include "hook_profiler.h"
 #include "../wptdriver/wpt_test.h"
 
+// Limit on the browser request data waiting to be claimed by a request
+static const size_t MAX_BROWSER_REQUESTS = 20000;
+
+/*-----------------------------------------------------------------------------
+  Zero-allocation view of a range of the browser request data.  The ranges
+  point into the POSTed buffer which has to outlive them.
+-----------------------------------------------------------------------------*/
+class TextRange {
+public:
+  TextRange():start_(NULL),length_(0){}
+  TextRange(LPCTSTR start, int length):start_(start),length_(length){}
+
+  void Trim() {
+    while (length_ && _istspace(*start_)) {
+      start_++;
+      length_--;
+    }
+    while (length_ && _istspace(start_[length_ - 1]))
+      length_--;
+  }
+  int Find(TCHAR ch) const {
+    for (int i = 0; i < length_; i++)
+      if (start_[i] == ch)
+        return i;
+    return -1;
+  }
+  TextRange Left(int count) const { return TextRange(start_, count); }
+  TextRange Mid(int offset) const {
+    return TextRange(start_ + offset, length_ - offset);
+  }
+  bool Equals(LPCTSTR value) const {
+    return lstrlen(value) == length_ && !_tcsnicmp(start_, value, length_);
+  }
+  // numbers are always followed by the line end so they parse in place
+  long ToLong() const { return _tcstol(start_, NULL, 10); }
+  double ToDouble() const { return _tcstod(start_, NULL); }
+  CString ToString() const { return CString(start_, length_); }
+  void AppendLine(CStringA& dest) const {
+    int len = WideCharToMultiByte(CP_ACP, 0, start_, length_, NULL, 0, NULL,
+                                  NULL);
+    int offset = dest.GetLength();
+    char * buff = dest.GetBufferSetLength(offset + len + 2);
+    WideCharToMultiByte(CP_ACP, 0, start_, length_, buff + offset, len, NULL,
+                        NULL);
+    buff[offset + len] = '\r';
+    buff[offset + len + 1] = '\n';
+    dest.ReleaseBufferSetLength(offset + len + 2);
+  }
+
+  LPCTSTR start_;
+  int     length_;
+};
+
+/*-----------------------------------------------------------------------------
+  Get the next line from the buffer (false when there are no more)
+-----------------------------------------------------------------------------*/
+static bool NextLine(LPCTSTR& pos, LPCTSTR end, TextRange& line) {
+  if (pos >= end)
+    return false;
+  LPCTSTR line_end = pos;
+  while (line_end < end && *line_end != _T('\n'))
+    line_end++;
+  line = TextRange(pos, (int)(line_end - pos));
+  pos = line_end < end ? line_end + 1 : end;
+  return true;
+}
+
 
 /*-----------------------------------------------------------------------------
 -----------------------------------------------------------------------------*/
@@ -45,6 +113,8 @@ Requests::Requests(TestState& test_state, TrackSockets& sockets,
   , _test(test) {
   _active_requests.InitHashTable(257);
   connections_.InitHashTable(257);
+  browser_request_data_.InitHashTable(1021);
+  browser_request_count_ = 0;
   InitializeCriticalSection(&cs);
   _start_browser_clock = 0;
 }
@@ -64,8 +134,11 @@ void Requests::Reset() {
   _active_requests.RemoveAll();
   while (!_requests.IsEmpty())
     delete _requests.RemoveHead();
-  browser_request_data_.RemoveAll();
+  ResetBrowserRequests();
   LeaveCriticalSection(&cs);
+  global_buffer_pool.Trim();
+  global_buffer_pool.ResetStats();
+  global_hook_profiler.Reset();
   _dns.ClaimAll();
   _sockets.ClaimAll();
   _start_browser_clock = 0;
@@ -100,8 +173,8 @@ void Requests::DataIn(DWORD socket_id, DataChunk& chunk) {
     key.HighPart = socket_id;
     key.LowPart = 0;
     if (_active_requests.Lookup(key.QuadPart, request) && request) {
-      _test_state.ActivityDetected();
       request->DataIn(chunk);
+      _test_state.ActivityDetected(request);
       WptTrace(loglevel::kFunction, 
                _T("[wpthook] - Requests::DataIn(socket_id=%d, len=%d)"),
                socket_id, chunk.GetLength());
@@ -124,7 +197,7 @@ bool Requests::ModifyDataOut(DWORD socket_id, DataChunk& chunk) {
     EnterCriticalSection(&cs);
     Request * request = GetOrCreateRequest(socket_id, 0, chunk);
     if (request) {
-      _test_state.ActivityDetected();
+      _test_state.ActivityDetected(request);
       is_modified = request->ModifyDataOut(chunk);
     } else {
       is_modified = chunk.ModifyDataOut(_test);
@@ -144,8 +217,8 @@ void Requests::DataOut(DWORD socket_id, DataChunk& chunk) {
     EnterCriticalSection(&cs);
     Request * request = GetOrCreateRequest(socket_id, 0, chunk);
     if (request) {
-      _test_state.ActivityDetected();
       request->DataOut(chunk);
+      _test_state.ActivityDetected(request);
       WptTrace(loglevel::kFunction, 
                _T("[wpthook] - Requests::DataOut(socket_id=%d, len=%d)"),
                socket_id, chunk.GetLength());
@@ -166,6 +239,23 @@ bool Requests::HasActiveRequest(DWORD socket_id, DWORD stream_id) {
   return GetActiveRequest(socket_id, stream_id) != NULL;
 }
 
+/*-----------------------------------------------------------------------------
+  Number of requests that have been sent and are still waiting for the
+  first byte of the response (long-lived requests are not counted).
+-----------------------------------------------------------------------------*/
+int Requests::GetPendingCount() {
+  int count = 0;
+  EnterCriticalSection(&cs);
+  POSITION pos = _active_requests.GetStartPosition();
+  while (pos) {
+    Request * request = _active_requests.GetNextValue(pos);
+    if (request && request->IsPending())
+      count++;
+  }
+  LeaveCriticalSection(&cs);
+  return count;
+}
+
 /*-----------------------------------------------------------------------------
   See if the beginning of the bugger matches any known HTTP method
   TODO: See if there is a more reliable way to detect HTTP traffic
@@ -227,8 +317,11 @@ Request * Requests::GetOrCreateRequest(DWORD socket_id, DWORD stream_id,
 -----------------------------------------------------------------------------*/
 Request * Requests::NewRequest(DWORD socket_id, DWORD stream_id,
                                bool is_spdy) {
-  Request * request = new Request(_test_state, socket_id, stream_id,
-                                  _sockets, _dns, _test, is_spdy, *this);
+  Request * request = new (std::nothrow) Request(_test_state, socket_id,
+                                  stream_id, _sockets, _dns, _test, is_spdy,
+                                  *this);
+  if (!request)
+    return NULL;
   EnterCriticalSection(&cs);
   ULARGE_INTEGER key;
   key.HighPart = socket_id;
@@ -278,88 +371,101 @@ void Requests::ProcessBrowserRequest(CString request_data) {
   bool processing_values = true;
   bool processing_request = false;
   bool processing_response = false;
-  int position = 0;
-  CString line = request_data.Tokenize(_T("\n"), position);
-  while (position >= 0) {
-    line = line.Trim();
-    if (line.GetLength()) {
-      if (!line.Left(1).Compare(_T("["))) {
+  LPCTSTR pos = request_data;
+  LPCTSTR end = pos + request_data.GetLength();
+  TextRange line;
+  while (NextLine(pos, end, line)) {
+    line.Trim();
+    if (line.length_) {
+      if (line.start_[0] == _T('[')) {
         processing_values = false;
         processing_request = false;
         processing_response = false;
-        if (!line.Compare(_T("[Request Headers]")))
+        if (line.Equals(_T("[Request Headers]")))
           processing_request = true;
-        else if (!line.Compare(_T("[Response Headers]")))
+        else if (line.Equals(_T("[Response Headers]")))
           processing_response = true;
       } else if (processing_values) {
         int separator = line.Find(_T('='));
         if (separator > 0) {
-          CString key = line.Left(separator).Trim();
-          CString value = line.Mid(separator + 1).Trim();
-          if (key.GetLength() && value.GetLength()) {
-            if (!key.CompareNoCase(_T("browser")))
-              browser = value;
-            else if (!key.CompareNoCase(_T("url")))
-              url = value;
-            else if (!key.CompareNoCase(_T("errorCode")))
-              error_code = _ttol(value);
-            else if (!key.CompareNoCase(_T("startTime")))
-              start_time = _ttof(value);
-            else if (!key.CompareNoCase(_T("requestStart")))
-              request_start = _ttof(value);
-            else if (!key.CompareNoCase(_T("firstByteTime")))
-              first_byte = _ttof(value);
-            else if (!key.CompareNoCase(_T("endTime")))
-              end_time = _ttof(value);
-            else if (!key.CompareNoCase(_T("bytesIn")))
-              bytes_in = _ttol(value);
-            else if (!key.CompareNoCase(_T("objectSize")))
-              object_size = _ttol(value);
-            else if (!key.CompareNoCase(_T("initiatorUrl")))
-              initiator = value;
-            else if (!key.CompareNoCase(_T("initiatorLineNumber")))
-              initiator_line = value;
-            else if (!key.CompareNoCase(_T("initiatorColumnNumber")))
-              initiator_column = value;
-            else if (!key.CompareNoCase(_T("status")))
-              status = _ttol(value);
-            else if (!key.CompareNoCase(_T("connectionId")))
-              connection = _ttol(value);
-            else if (!key.CompareNoCase(_T("dnsStart")))
-              dns_start = _ttof(value);
-            else if (!key.CompareNoCase(_T("dnsEnd")))
-              dns_end = _ttof(value);
-            else if (!key.CompareNoCase(_T("connectStart")))
-              connect_start = _ttof(value);
-            else if (!key.CompareNoCase(_T("connectEnd")))
-              connect_end = _ttof(value);
-            else if (!key.CompareNoCase(_T("sslStart")))
-              ssl_start = _ttof(value);
-            else if (!key.CompareNoCase(_T("sslEnd")))
-              ssl_end = _ttof(value);
+          TextRange key = line.Left(separator);
+          TextRange value = line.Mid(separator + 1);
+          key.Trim();
+          value.Trim();
+          if (key.length_ && value.length_) {
+            if (key.Equals(_T("browser")))
+              browser = value.ToString();
+            else if (key.Equals(_T("url")))
+              url = value.ToString();
+            else if (key.Equals(_T("errorCode")))
+              error_code = value.ToLong();
+            else if (key.Equals(_T("startTime")))
+              start_time = value.ToDouble();
+            else if (key.Equals(_T("requestStart")))
+              request_start = value.ToDouble();
+            else if (key.Equals(_T("firstByteTime")))
+              first_byte = value.ToDouble();
+            else if (key.Equals(_T("endTime")))
+              end_time = value.ToDouble();
+            else if (key.Equals(_T("bytesIn")))
+              bytes_in = value.ToLong();
+            else if (key.Equals(_T("objectSize")))
+              object_size = value.ToLong();
+            else if (key.Equals(_T("initiatorUrl")))
+              initiator = value.ToString();
+            else if (key.Equals(_T("initiatorLineNumber")))
+              initiator_line = value.ToString();
+            else if (key.Equals(_T("initiatorColumnNumber")))
+              initiator_column = value.ToString();
+            else if (key.Equals(_T("status")))
+              status = value.ToLong();
+            else if (key.Equals(_T("connectionId")))
+              connection = value.ToLong();
+            else if (key.Equals(_T("dnsStart")))
+              dns_start = value.ToDouble();
+            else if (key.Equals(_T("dnsEnd")))
+              dns_end = value.ToDouble();
+            else if (key.Equals(_T("connectStart")))
+              connect_start = value.ToDouble();
+            else if (key.Equals(_T("connectEnd")))
+              connect_end = value.ToDouble();
+            else if (key.Equals(_T("sslStart")))
+              ssl_start = value.ToDouble();
+            else if (key.Equals(_T("sslEnd")))
+              ssl_end = value.ToDouble();
           }
         }
       } else if (processing_request) {
-        request_headers += CStringA(CT2A(line)) + "\r\n";
+        line.AppendLine(request_headers);
       } else if (processing_response) {
-        response_headers += CStringA(CT2A(line)) + "\r\n";
+        line.AppendLine(response_headers);
       }
     }
-    line = request_data.Tokenize(_T("\n"), position);
   }
   if (url.GetLength() && initiator.GetLength()) {
     BrowserRequestData data(url);
     data.initiator_ = initiator;
     data.initiator_line_ = initiator_line;
     data.initiator_column_ = initiator_column;
+    CString key = NormalizeBrowserUrl(url);
     EnterCriticalSection(&cs);
-    browser_request_data_.AddTail(data);
+    if (browser_request_count_ < MAX_BROWSER_REQUESTS) {
+      CAtlList<BrowserRequestData> * list = NULL;
+      if (!browser_request_data_.Lookup(key, list) || !list) {
+        list = new CAtlList<BrowserRequestData>;
+        browser_request_data_.SetAt(key, list);
+      }
+      list->AddTail(data);
+      browser_request_count_++;
+    }
     LeaveCriticalSection(&cs);
   }
   _test_state.ActivityDetected();
-  if (end_time > 0 && request_start > 0) {
-    Request * request = new Request(_test_state, connection, stream_id,
-                                    _sockets, _dns, _test, false, *this);
+  Request * request = NULL;
+  if (end_time > 0 && request_start > 0)
+    request = new (std::nothrow) Request(_test_state, connection, stream_id,
+                                         _sockets, _dns, _test, false, *this);
+  if (request) {
     request->_from_browser = true;
     request->initiator_ = initiator;
     request->initiator_line_ = initiator_line;
@@ -483,30 +589,67 @@ void Requests::ProcessBrowserRequest(CString request_data) {
 
 /*-----------------------------------------------------------------------------
   Get the browser request information from the URL and optionally remove it
-  from the list (claiming it)
+  (claiming it).  Duplicate URLs are claimed in the order they arrived.
 -----------------------------------------------------------------------------*/
 bool Requests::GetBrowserRequest(BrowserRequestData &data, bool remove) {
   bool found = false;
+  CString key = NormalizeBrowserUrl(data.url_);
 
   EnterCriticalSection(&cs);
-  POSITION pos = browser_request_data_.GetHeadPosition();
-  while (pos && !found) {
-    POSITION current_pos = pos;
-    BrowserRequestData browser_data = browser_request_data_.GetNext(pos);
-    if (!browser_data.url_.Compare(data.url_)) {
-      found = true;
-      data = browser_data;
-      if (remove) {
-        browser_request_data_.RemoveAt(current_pos);
+  CAtlList<BrowserRequestData> * list = NULL;
+  if (browser_request_data_.Lookup(key, list) && list && !list->IsEmpty()) {
+    found = true;
+    data = list->GetHead();
+    if (remove) {
+      list->RemoveHead();
+      browser_request_count_--;
+      if (list->IsEmpty()) {
+        browser_request_data_.RemoveKey(key);
+        delete list;
       }
     }
   }
-  browser_request_data_.AddTail(data);
   LeaveCriticalSection(&cs);
 
   return found;
 }
 
+/*-----------------------------------------------------------------------------
+  Browser and wire URLs only differ in the case of the scheme and host and
+  the fragment (which is never sent)
+-----------------------------------------------------------------------------*/
+CString Requests::NormalizeBrowserUrl(const CString& url) {
+  CString normalized(url);
+  int fragment = normalized.Find(_T('#'));
+  if (fragment >= 0)
+    normalized.Truncate(fragment);
+  int host = normalized.Find(_T("://"));
+  if (host > 0) {
+    int path = normalized.Find(_T('/'), host + 3);
+    if (path < 0)
+      path = normalized.GetLength();
+    LPTSTR buff = normalized.GetBuffer();
+    for (int i = 0; i < path; i++)
+      buff[i] = (TCHAR)_totlower(buff[i]);
+    normalized.ReleaseBuffer();
+  }
+  return normalized;
+}
+
+/*-----------------------------------------------------------------------------
+  Must be called inside of the critical section
+-----------------------------------------------------------------------------*/
+void Requests::ResetBrowserRequests() {
+  POSITION pos = browser_request_data_.GetStartPosition();
+  while (pos) {
+    CAtlList<BrowserRequestData> * list = browser_request_data_.GetNextValue(pos);
+    if (list)
+      delete list;
+  }
+  browser_request_data_.RemoveAll();
+  browser_request_count_ = 0;
+}
+
 /*-----------------------------------------------------------------------------
 -----------------------------------------------------------------------------*/
 void Requests::StreamClosed(DWORD socket_id, DWORD stream_id) {
@@ -75,6 +75,7 @@ public:
   bool ModifyDataOut(DWORD socket_id, DataChunk& chunk);
   void DataOut(DWORD socket_id, DataChunk& chunk);
   bool HasActiveRequest(DWORD socket_id, DWORD stream_id);
+  int GetPendingCount();
   void ProcessBrowserRequest(CString request_data);
 
   // HTTP/2 interface
@@ -92,6 +93,7 @@ public:
   void Unlock();
   void Reset();
   bool GetBrowserRequest(BrowserRequestData &data, bool remove = true);
+  static CString NormalizeBrowserUrl(const CString& url);
 
   CAtlList<Request *>       _requests;        // all requests
   CAtlMap<DWORD, bool>      connections_;     // Connection IDs
@@ -103,7 +105,9 @@ private:
   TrackDns&         _dns;
   WptTest&          _test;
   double            _start_browser_clock;
-  CAtlList<BrowserRequestData>  browser_request_data_;
+  // browser-reported request data by normalized URL, oldest first
+  CAtlMap<CString, CAtlList<BrowserRequestData> *> browser_request_data_;
+  size_t            browser_request_count_;
   CAtlMap<ULONGLONG, Request *> _active_requests; // requests indexed by socket
 
   bool IsHttpRequest(const DataChunk& chunk) const;
@@ -113,6 +117,7 @@ private:
   Request * GetOrCreateRequest(DWORD socket_id, DWORD stream_id,
                                const DataChunk& chunk);
   Request * NewRequest(DWORD socket_id, DWORD stream_id, bool is_spdy);
+  void ResetBrowserRequests();
   Request * GetActiveRequest(DWORD socket_id, DWORD stream_id);
   LONGLONG GetRelativeTime(Request * request, double end_time, double time);
 };
@@ -0,0 +1,289 @@
+/******************************************************************************
+Copyright (c) 2013, Google Inc.
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without 
+modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice, 
+      this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+    * Neither the name of the <ORGANIZATION> nor the names of its contributors 
+    may be used to endorse or promote products derived from this software 
+    without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE 
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE 
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL 
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR 
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER 
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, 
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE 
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+******************************************************************************/
+
+// No precompiled header, this file has to build without the Windows SDK
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#endif
+#include "result_writer.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+static const char HEX_DIGITS[] = "0123456789abcdef";
+
+#ifdef _WIN32
+/*-----------------------------------------------------------------------------
+  Sink for a file handle
+-----------------------------------------------------------------------------*/
+static bool WriteToHandle(void * context, const char * data, size_t len) {
+  DWORD bytes = 0;
+  return WriteFile((HANDLE)context, data, (DWORD)len, &bytes, 0) &&
+         bytes == len;
+}
+
+/*-----------------------------------------------------------------------------
+-----------------------------------------------------------------------------*/
+ResultWriter::ResultWriter(HANDLE file, size_t buffer_size):
+  sink_(file == INVALID_HANDLE_VALUE ? NULL : WriteToHandle)
+  , context_(file) {
+  Init(buffer_size);
+}
+#endif
+
+/*-----------------------------------------------------------------------------
+-----------------------------------------------------------------------------*/
+ResultWriter::ResultWriter(ResultSink sink, void * context,
+                           size_t buffer_size):
+  sink_(sink)
+  , context_(context) {
+  Init(buffer_size);
+}
+
+/*-----------------------------------------------------------------------------
+-----------------------------------------------------------------------------*/
+void ResultWriter::Init(size_t buffer_size) {
+  size_ = buffer_size < 256 ? 256 : buffer_size;
+  used_ = 0;
+  written_ = 0;
+  failed_ = !sink_;
+  buffer_ = (char *)malloc(size_);
+  if (!buffer_)
+    failed_ = true;
+}
+
+/*-----------------------------------------------------------------------------
+-----------------------------------------------------------------------------*/
+ResultWriter::~ResultWriter(void) {
+  Flush();
+  if (buffer_)
+    free(buffer_);
+}
+
+/*-----------------------------------------------------------------------------
+  Write out the pending data (the writer stops once a write fails)
+-----------------------------------------------------------------------------*/
+bool ResultWriter::Flush(void) {
+  if (!failed_ && used_) {
+    if (sink_(context_, buffer_, used_))
+      written_ += used_;
+    else
+      failed_ = true;
+  }
+  used_ = 0;
+  return !failed_;
+}
+
+/*-----------------------------------------------------------------------------
+  Contiguous space for len bytes (NULL if it can't fit in the buffer)
+-----------------------------------------------------------------------------*/
+char * ResultWriter::Reserve(size_t len) {
+  char * space = NULL;
+  if (used_ + len > size_)
+    Flush();
+  if (!failed_ && used_ + len <= size_) {
+    space = buffer_ + used_;
+    used_ += len;
+  }
+  return space;
+}
+
+/*-----------------------------------------------------------------------------
+-----------------------------------------------------------------------------*/
+void ResultWriter::Write(const char * data, size_t len) {
+  while (len && !failed_) {
+    if (used_ >= size_ && !Flush())
+      break;
+    size_t count = len < size_ - used_ ? len : size_ - used_;
+    memcpy(buffer_ + used_, data, count);
+    used_ += count;
+    data += count;
+    len -= count;
+  }
+}
+
+#ifdef _WIN32
+/*-----------------------------------------------------------------------------
+  UTF-8 encoded (short strings are converted on the stack)
+-----------------------------------------------------------------------------*/
+void ResultWriter::Write(const CStringW& str) {
+  if (!str.IsEmpty()) {
+    char buff[1024];
+    int len = WideCharToMultiByte(CP_UTF8, 0, str, str.GetLength(), buff,
+                                  sizeof(buff), NULL, NULL);
+    if (len > 0) {
+      Write(buff, len);
+    } else {
+      CStringA utf8 = CW2A(str, CP_UTF8);
+      Write(utf8);
+    }
+  }
+}
+#endif
+
+/*-----------------------------------------------------------------------------
+  The sign is part of the padded width (-5 with 2 digits is "-5")
+-----------------------------------------------------------------------------*/
+void ResultWriter::Int(int64_t value, int min_digits) {
+  if (value < 0) {
+    Char('-');
+    UInt((uint64_t)(-(value + 1)) + 1, min_digits - 1);
+  } else {
+    UInt((uint64_t)value, min_digits);
+  }
+}
+
+/*-----------------------------------------------------------------------------
+-----------------------------------------------------------------------------*/
+void ResultWriter::UInt(uint64_t value, int min_digits) {
+  char digits[24];
+  int count = 0;
+  do {
+    digits[count++] = (char)('0' + (value % 10));
+    value /= 10;
+  } while (value);
+  while (count < min_digits && count < (int)sizeof(digits))
+    digits[count++] = '0';
+  char * out = Reserve(count);
+  if (out) {
+    while (count)
+      *out++ = digits[--count];
+  }
+}
+
+/*-----------------------------------------------------------------------------
+  Same output as printf's %0.*f for the values we write, except that
+  negative values that round to zero have no sign (falls back to printf for
+  anything too large to scale into an integer)
+-----------------------------------------------------------------------------*/
+void ResultWriter::Fixed(double value, int decimals) {
+  static const double scales[] = {1, 10, 100, 1000, 10000, 100000, 1000000};
+  if (decimals < 0)
+    decimals = 0;
+  if (decimals < (int)(sizeof(scales) / sizeof(scales[0])) &&
+      value > -1e12 && value < 1e12) {
+    bool negative = value < 0;
+    uint64_t scaled = (uint64_t)
+        ((negative ? -value : value) * scales[decimals] + 0.5);
+    uint64_t scale = (uint64_t)scales[decimals];
+    if (negative && scaled)
+      Char('-');
+    UInt(scaled / scale);
+    if (decimals) {
+      Char('.');
+      UInt(scaled % scale, decimals);
+    }
+  } else {
+    char buff[64];
+#ifdef _MSC_VER
+    int len = _snprintf_s(buff, sizeof(buff), _TRUNCATE, "%0.*f", decimals,
+                          value);
+#else
+    int len = snprintf(buff, sizeof(buff), "%0.*f", decimals, value);
+    if (len >= (int)sizeof(buff))
+      len = (int)sizeof(buff) - 1;
+#endif
+    if (len > 0)
+      Write(buff, len);
+  }
+}
+
+/*-----------------------------------------------------------------------------
+-----------------------------------------------------------------------------*/
+void ResultWriter::String(const char * str, size_t len) {
+  Char('"');
+  Escaped(str, len);
+  Char('"');
+}
+
+#ifdef _WIN32
+/*-----------------------------------------------------------------------------
+-----------------------------------------------------------------------------*/
+void ResultWriter::String(const CStringW& str) {
+  Char('"');
+  if (!str.IsEmpty()) {
+    char buff[1024];
+    int len = WideCharToMultiByte(CP_UTF8, 0, str, str.GetLength(), buff,
+                                  sizeof(buff), NULL, NULL);
+    if (len > 0) {
+      Escaped(buff, len);
+    } else {
+      CStringA utf8 = CW2A(str, CP_UTF8);
+      Escaped(utf8, utf8.GetLength());
+    }
+  }
+  Char('"');
+}
+#endif
+
+/*-----------------------------------------------------------------------------
+  Same escaping as JSONEscapeA plus \u escapes for the other control
+  characters
+-----------------------------------------------------------------------------*/
+void ResultWriter::Escaped(const char * str, size_t len) {
+  const char * run = str;
+  const char * end = str + len;
+  for (const char * pos = str; pos < end; pos++) {
+    unsigned char ch = (unsigned char)*pos;
+    if (ch >= 0x20 && ch != '"' && ch != '\\' && ch != '/')
+      continue;
+    if (pos > run)
+      Write(run, pos - run);
+    run = pos + 1;
+    char escaped[6] = {'\\', 0, 0, 0, 0, 0};
+    size_t escaped_len = 2;
+    switch (ch) {
+      case '"': escaped[1] = '"'; break;
+      case '\\': escaped[1] = '\\'; break;
+      case '/': escaped[1] = '/'; break;
+      case '\b': escaped[1] = 'b'; break;
+      case '\f': escaped[1] = 'f'; break;
+      case '\n': escaped[1] = 'n'; break;
+      case '\r': escaped[1] = 'r'; break;
+      case '\t': escaped[1] = 't'; break;
+      default:
+        escaped[1] = 'u';
+        escaped[2] = '0';
+        escaped[3] = '0';
+        escaped[4] = HEX_DIGITS[ch >> 4];
+        escaped[5] = HEX_DIGITS[ch & 0x0F];
+        escaped_len = 6;
+        break;
+    }
+    Write(escaped, escaped_len);
+  }
+  if (end > run)
+    Write(run, end - run);
+}
+
+/*-----------------------------------------------------------------------------
+-----------------------------------------------------------------------------*/
+void ResultWriter::Key(const char * name) {
+  String(name);
+  Char(':');
+}
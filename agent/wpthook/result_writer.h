@@ -0,0 +1,111 @@
+/******************************************************************************
+Copyright (c) 2013, Google Inc.
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without 
+modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice, 
+      this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+    * Neither the name of the <ORGANIZATION> nor the names of its contributors 
+    may be used to endorse or promote products derived from this software 
+    without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE 
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE 
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL 
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR 
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER 
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, 
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE 
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+******************************************************************************/
+
+#pragma once
+// Portable (no precompiled header) so the buffering and formatting can be
+// benchmarked on Linux (result_writer_bench).  The file handle and ATL
+// string overloads are only there on Windows.
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <string>
+#ifdef _WIN32
+#include <atlstr.h>
+#endif
+
+// Gets each buffer full of output, returning false stops the writer
+typedef bool (*ResultSink)(void * context, const char * data, size_t len);
+
+/*-----------------------------------------------------------------------------
+  Buffered writer for the result files.  Everything is appended to a
+  preallocated buffer (numbers are formatted and strings are escaped
+  directly into it) and the buffer is written to the file handle whenever
+  it fills up so the results never exist as one big string in memory.
+
+  The file handle is owned by the caller, pending data is flushed when the
+  writer goes out of scope.
+-----------------------------------------------------------------------------*/
+class ResultWriter {
+public:
+#ifdef _WIN32
+  ResultWriter(HANDLE file, size_t buffer_size = 64 * 1024);
+#endif
+  ResultWriter(ResultSink sink, void * context,
+               size_t buffer_size = 64 * 1024);
+  ~ResultWriter(void);
+
+  bool Flush(void);
+  bool IsValid(void) const { return !failed_; }
+  uint64_t BytesWritten(void) const { return written_ + used_; }
+
+  // raw output
+  void Write(const char * data, size_t len);
+  void Write(const char * str) { Write(str, strlen(str)); }
+  void Write(const std::string& str) { Write(str.data(), str.length()); }
+#ifdef _WIN32
+  void Write(const CStringA& str) { Write((LPCSTR)str, str.GetLength()); }
+  void Write(const CStringW& str);  // as UTF-8
+#endif
+  void Char(char ch) {
+    if (failed_ || (used_ >= size_ && !Flush()))
+      return;
+    buffer_[used_++] = ch;
+  }
+  void Tab(void) { Char('\t'); }
+
+  // numbers, zero padded to min_digits (which counts the sign, the same
+  // as printf's %0*d)
+  void Int(int64_t value, int min_digits = 1);
+  void UInt(uint64_t value, int min_digits = 1);
+  void Fixed(double value, int decimals);
+
+  // JSON strings (quoted and escaped)
+  void String(const char * str, size_t len);
+  void String(const char * str) { String(str, strlen(str)); }
+  void String(const std::string& str) { String(str.data(), str.length()); }
+#ifdef _WIN32
+  void String(const CStringA& str) { String((LPCSTR)str, str.GetLength()); }
+  void String(const CStringW& str);
+#endif
+  void Escaped(const char * str, size_t len);
+
+  // "name": prefix for an object member
+  void Key(const char * name);
+
+private:
+  void Init(size_t buffer_size);
+  char * Reserve(size_t len);
+
+  ResultSink  sink_;
+  void *      context_;
+  char *      buffer_;
+  size_t      size_;
+  size_t      used_;
+  uint64_t    written_;
+  bool        failed_;
+};
@@ -0,0 +1,291 @@
+/******************************************************************************
+Copyright (c) 2013, Google Inc.
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without 
+modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice, 
+      this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+    * Neither the name of the <ORGANIZATION> nor the names of its contributors 
+    may be used to endorse or promote products derived from this software 
+    without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE 
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE 
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL 
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR 
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER 
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, 
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE 
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+******************************************************************************/
+
+// Compares ResultWriter against building the whole file as one string with
+// printf-style appends (how the request data, headers and HAR used to be
+// written) for time and memory, and checks that both produce exactly the
+// same bytes and that the number formatting matches printf.
+//
+//   result_writer_bench [requests]
+#include "../result_writer.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <vector>
+
+static const int TIMING_RUNS = 5;     // best of
+
+/*-----------------------------------------------------------------------------
+-----------------------------------------------------------------------------*/
+static double NowMs() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+/*-----------------------------------------------------------------------------
+  Synthetic request, roughly what a request record and HAR entry hold
+-----------------------------------------------------------------------------*/
+class BenchRequest {
+public:
+  std::string host_;
+  std::string url_;
+  std::string content_type_;
+  std::string headers_;
+  int         numbers_[40];
+  double      timings_[8];
+};
+
+static void MakeRequests(size_t count, std::vector<BenchRequest>& requests) {
+  srand(1);
+  requests.resize(count);
+  char buff[256];
+  for (size_t i = 0; i < count; i++) {
+    BenchRequest& request = requests[i];
+    snprintf(buff, sizeof(buff), "cdn%d.example.com", rand() % 20);
+    request.host_ = buff;
+    snprintf(buff, sizeof(buff), "/static/js/app.%x.js?v=%d&cb=\"%d\"",
+             rand(), rand() % 1000, rand() % 100);
+    request.url_ = buff;
+    request.content_type_ = i % 3 ? "application/javascript" : "image/png";
+    request.headers_ = "HTTP/1.1 200 OK\r\nContent-Type: ";
+    request.headers_ += request.content_type_;
+    request.headers_ += "\r\nCache-Control: public, max-age=31536000\r\n"
+                        "Server: nginx/1.25\tx\r\nLink: </a.css>; rel=preload";
+    for (int n = 0; n < 40; n++)
+      request.numbers_[n] = (rand() % 200000) - (n % 7 == 0 ? 100000 : 0);
+    for (int n = 0; n < 8; n++)
+      request.timings_[n] = (rand() % 100000) / 97.0 - (n == 3 ? 500 : 0);
+  }
+}
+
+/*-----------------------------------------------------------------------------
+  The old way: printf-style appends to one string for the whole file
+-----------------------------------------------------------------------------*/
+static void AppendEscaped(std::string& out, const std::string& value) {
+  static const char hex[] = "0123456789abcdef";
+  out += '"';
+  for (size_t i = 0; i < value.length(); i++) {
+    unsigned char ch = (unsigned char)value[i];
+    switch (ch) {
+      case '"': out += "\\\""; break;
+      case '\\': out += "\\\\"; break;
+      case '/': out += "\\/"; break;
+      case '\b': out += "\\b"; break;
+      case '\f': out += "\\f"; break;
+      case '\n': out += "\\n"; break;
+      case '\r': out += "\\r"; break;
+      case '\t': out += "\\t"; break;
+      default:
+        if (ch < 0x20) {
+          out += "\\u00";
+          out += hex[ch >> 4];
+          out += hex[ch & 0x0F];
+        } else {
+          out += (char)ch;
+        }
+        break;
+    }
+  }
+  out += '"';
+}
+
+static void BuildString(const std::vector<BenchRequest>& requests,
+                        std::string& out) {
+  char buff[64];
+  for (size_t i = 0; i < requests.size(); i++) {
+    const BenchRequest& request = requests[i];
+    out += request.host_ + "\t" + request.url_ + "\t" +
+           request.content_type_ + "\t";
+    for (int n = 0; n < 40; n++) {
+      snprintf(buff, sizeof(buff), "%0*d\t", n % 3 + 1, request.numbers_[n]);
+      out += buff;
+    }
+    out += "\r\n{\"url\":";
+    AppendEscaped(out, request.url_);
+    out += ",\"headers\":";
+    AppendEscaped(out, request.headers_);
+    for (int n = 0; n < 8; n++) {
+      snprintf(buff, sizeof(buff), ",\"t%d\":%0.3f", n, request.timings_[n]);
+      out += buff;
+    }
+    out += "}\r\n";
+  }
+}
+
+/*-----------------------------------------------------------------------------
+  The same output through ResultWriter
+-----------------------------------------------------------------------------*/
+static void WriteRequests(const std::vector<BenchRequest>& requests,
+                          ResultWriter& out) {
+  for (size_t i = 0; i < requests.size(); i++) {
+    const BenchRequest& request = requests[i];
+    out.Write(request.host_);
+    out.Tab();
+    out.Write(request.url_);
+    out.Tab();
+    out.Write(request.content_type_);
+    out.Tab();
+    for (int n = 0; n < 40; n++) {
+      out.Int(request.numbers_[n], n % 3 + 1);
+      out.Tab();
+    }
+    out.Write("\r\n{\"url\":");
+    out.String(request.url_);
+    out.Write(",\"headers\":");
+    out.String(request.headers_);
+    for (int n = 0; n < 8; n++) {
+      out.Write(",\"t");
+      out.Int(n);
+      out.Write("\":");
+      out.Fixed(request.timings_[n], 3);
+    }
+    out.Write("}\r\n");
+  }
+}
+
+/*-----------------------------------------------------------------------------
+  Sinks
+-----------------------------------------------------------------------------*/
+static bool AppendSink(void * context, const char * data, size_t len) {
+  ((std::string *)context)->append(data, len);
+  return true;
+}
+
+static bool FileSink(void * context, const char * data, size_t len) {
+  return fwrite(data, 1, len, (FILE *)context) == len;
+}
+
+/*-----------------------------------------------------------------------------
+  Number formatting against printf
+-----------------------------------------------------------------------------*/
+static int CheckFormatting() {
+  static const long long values[] = {0, 5, -5, 9, -9, 10, -10, 123, -123,
+      2147483647LL, -2147483647LL - 1, 9223372036854775807LL,
+      -9223372036854775807LL - 1};
+  static const double doubles[] = {0, 0.0004, -0.0004, 1.5, -1.5, 2.0005,
+      -123.456789, 99999.9999, 1e13, -1e13};
+  int failed = 0;
+  char expected[64];
+  for (size_t i = 0; i < sizeof(values) / sizeof(values[0]); i++) {
+    for (int digits = 1; digits <= 4; digits++) {
+      std::string out;
+      {
+        ResultWriter writer(AppendSink, &out);
+        writer.Int(values[i], digits);
+      }
+      snprintf(expected, sizeof(expected), "%0*lld", digits, values[i]);
+      if (out != expected) {
+        printf("Int(%lld, %d): \"%s\" expected \"%s\"\n", values[i], digits,
+               out.c_str(), expected);
+        failed++;
+      }
+    }
+  }
+  for (size_t i = 0; i < sizeof(doubles) / sizeof(doubles[0]); i++) {
+    for (int decimals = 0; decimals <= 3; decimals++) {
+      std::string out;
+      {
+        ResultWriter writer(AppendSink, &out);
+        writer.Fixed(doubles[i], decimals);
+      }
+      // negative values that round to zero are written without the sign
+      snprintf(expected, sizeof(expected), "%0.*f", decimals, doubles[i]);
+      const char * compare = expected;
+      if (expected[0] == '-' && strspn(expected + 1, "0.") ==
+          strlen(expected + 1))
+        compare++;
+      if (out != compare) {
+        printf("Fixed(%g, %d): \"%s\" expected \"%s\"\n", doubles[i],
+               decimals, out.c_str(), compare);
+        failed++;
+      }
+    }
+  }
+  return failed;
+}
+
+int main(int argc, char * argv[]) {
+  size_t count = argc > 1 ? (size_t)atoi(argv[1]) : 20000;
+  int failed = CheckFormatting();
+
+  std::vector<BenchRequest> requests;
+  MakeRequests(count, requests);
+
+  // identical output
+  std::string built;
+  BuildString(requests, built);
+  std::string streamed;
+  {
+    ResultWriter writer(AppendSink, &streamed);
+    WriteRequests(requests, writer);
+  }
+  if (built != streamed) {
+    printf("ResultWriter output differs from the string build\n");
+    failed++;
+  }
+
+  FILE * file = fopen("/dev/null", "wb");
+  if (!file) {
+    printf("Unable to open /dev/null\n");
+    return 1;
+  }
+  double string_ms = 0, writer_ms = 0;
+  size_t string_peak = 0;
+  for (int run = 0; run < TIMING_RUNS; run++) {
+    double start = NowMs();
+    {
+      std::string out;
+      BuildString(requests, out);
+      fwrite(out.data(), 1, out.length(), file);
+      if (out.capacity() > string_peak)
+        string_peak = out.capacity();
+    }
+    double elapsed = NowMs() - start;
+    if (!run || elapsed < string_ms)
+      string_ms = elapsed;
+
+    start = NowMs();
+    {
+      ResultWriter writer(FileSink, file);
+      WriteRequests(requests, writer);
+    }
+    elapsed = NowMs() - start;
+    if (!run || elapsed < writer_ms)
+      writer_ms = elapsed;
+  }
+  fclose(file);
+
+  printf("%d requests, %d bytes\n", (int)count, (int)built.length());
+  printf("string build:  %8.2f ms  %8d KB buffered\n", string_ms,
+         (int)(string_peak / 1024));
+  printf("ResultWriter:  %8.2f ms  %8d KB buffered\n", writer_ms, 64);
+  printf("%d formatting/output mismatches\n", failed);
+  return failed ? 1 : 0;
+}
@@ -37,16 +37,24 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include "screen_capture.h"
 #include "dev_tools.h"
 #include "trace.h"
+#include "analysis.h"
+#include "buffer_pool.h"
+#include "hook_profiler.h"
+#include "result_writer.h"
+#include "request_log.h"
+#include "body_store.h"
 #include "../wptdriver/wpt_test.h"
 #include "cximage/ximage.h"
 #include <zlib.h>
 #include <zip.h>
-#include <regex>
+#include <vector>
+#include <algorithm>
 #include <Wincrypt.h>
 
 static const TCHAR * PAGE_DATA_FILE = _T("_IEWPG.txt");
 static const TCHAR * PAGE_TIMING_FILE = _T("_steps_timing.txt");
 static const TCHAR * REQUEST_DATA_FILE = _T("_IEWTR.txt");
+static const TCHAR * REQUEST_LOG_FILE = _T("_requests.bin");
 static const TCHAR * REQUEST_HEADERS_DATA_FILE = _T("_report.txt");
 static const TCHAR * PROGRESS_DATA_FILE = _T("_progress.csv");
 static const TCHAR * STATUS_MESSAGE_DATA_FILE = _T("_status.txt");
@@ -63,10 +71,87 @@ static const TCHAR * CUSTOM_METRICS_FILE = _T("_metrics.json");
 static const TCHAR * TRACE_FILE = _T("_trace.json");
 static const TCHAR * TRACE_NETLOG_FILE = _T("_trace_netlog.json");
 static const TCHAR * CUSTOM_RULES_DATA_FILE = _T("_custom_rules.json");
+static const TCHAR * PROCESSING_STAGES_FILE = _T("_processing.json");
+static const TCHAR * HOOK_STATS_FILE = _T("_hook_stats.json");
+static const TCHAR * COMPLETION_FILE = _T("_completion.json");
+static const TCHAR * SYSTEM_SAMPLES_FILE = _T("_process_samples.json");
+static const TCHAR * H2_FRAMES_FILE = _T("_h2_frames.json");
+static const TCHAR * CONNECTION_ARRIVALS_FILE = _T("_arrivals.json");
+static const TCHAR * HOOK_PCAP_FILE = _T("_hook.pcapng");
+static const TCHAR * HAR_FILE = _T("_har.json");
 static const DWORD RIGHT_MARGIN = 25;
 static const DWORD BOTTOM_MARGIN = 25;
 
 
+/*-----------------------------------------------------------------------------
+-----------------------------------------------------------------------------*/
+ProcessingStages::ProcessingStages(void) {
+  start_.QuadPart = 0;
+  QueryPerformanceFrequency(&frequency_);
+}
+
+/*-----------------------------------------------------------------------------
+-----------------------------------------------------------------------------*/
+ProcessingStages::~ProcessingStages(void) {
+}
+
+/*-----------------------------------------------------------------------------
+-----------------------------------------------------------------------------*/
+void ProcessingStages::Start(void) {
+  QueryPerformanceCounter(&start_);
+}
+
+/*-----------------------------------------------------------------------------
+  Record the time since the previous stage finished along with the memory
+  use of the process at the end of the stage (the process-wide peak is
+  included so growth during a stage shows up even if it was freed again).
+-----------------------------------------------------------------------------*/
+void ProcessingStages::Finish(const char * stage) {
+  LARGE_INTEGER now;
+  QueryPerformanceCounter(&now);
+  double ms = 0;
+  if (frequency_.QuadPart && start_.QuadPart)
+    ms = (double)(now.QuadPart - start_.QuadPart) * 1000.0 /
+         (double)frequency_.QuadPart;
+  start_.QuadPart = now.QuadPart;
+
+  unsigned __int64 working_set = 0;
+  unsigned __int64 peak_working_set = 0;
+  unsigned __int64 private_bytes = 0;
+  PROCESS_MEMORY_COUNTERS mem;
+  if (GetProcessMemoryInfo(GetCurrentProcess(), &mem, sizeof(mem))) {
+    working_set = mem.WorkingSetSize / 1024;
+    peak_working_set = mem.PeakWorkingSetSize / 1024;
+    private_bytes = mem.PagefileUsage / 1024;
+  }
+
+  CStringA entry;
+  entry.Format("{\"stage\":\"%s\",\"ms\":%0.3f,\"workingSetKB\":%I64u,"
+               "\"peakWorkingSetKB\":%I64u,\"privateKB\":%I64u}",
+               stage, ms, working_set, peak_working_set, private_bytes);
+  if (!stages_.IsEmpty())
+    stages_ += ",";
+  stages_ += entry;
+}
+
+/*-----------------------------------------------------------------------------
+-----------------------------------------------------------------------------*/
+bool ProcessingStages::Write(CString file) {
+  bool ok = false;
+  if (!stages_.IsEmpty()) {
+    CStringA json = CStringA("[") + stages_ + "]";
+    HANDLE file_handle = CreateFile(file, GENERIC_WRITE, 0, 0,
+                                    CREATE_ALWAYS, 0, 0);
+    if (file_handle != INVALID_HANDLE_VALUE) {
+      DWORD bytes;
+      ok = WriteFile(file_handle, (LPCSTR)json, json.GetLength(), &bytes, 0)
+           ? true : false;
+      CloseHandle(file_handle);
+    }
+  }
+  return ok;
+}
+
 /*-----------------------------------------------------------------------------
 -----------------------------------------------------------------------------*/
 Results::Results(TestState& test_state, WptTest& test, Requests& requests, 
@@ -100,6 +185,7 @@ Results::~Results(void) {
 -----------------------------------------------------------------------------*/
 void Results::Reset(void) {
   _requests.Reset();
+  _sockets.ResetArrivals();
   _screen_capture.Reset();
   _dev_tools.Reset();
   _trace.Reset();
@@ -139,8 +225,12 @@ void Results::Save(bool merge) {
   WptTrace(loglevel::kFunction, _T("[wpthook] - Results::Save()\n"));
 
   if (!_saved) {
+    ProcessingStages stages;
+    stages.Start();
     SaveResultImage();
+    stages.Finish("SaveResultImage");
     ProcessRequests(merge);
+    stages.Finish("ProcessRequests");
     if (_test._log_data) {
       if (!merge) {
         reported_step_++;
@@ -151,18 +241,40 @@ void Results::Save(bool merge) {
         OptimizationChecks checks(_requests, _test_state, _test, _dns);
         // checks.Check();
         base_page_CDN_ = checks._base_page_CDN;
+        stages.Finish("OptimizationChecks");
         SaveImages();
+        stages.Finish("SaveImages");
         SaveProgressData();
+        SaveSystemSamples();
         SaveStatusMessages();
+        stages.Finish("SaveProgressData");
         SavePageData(checks);
+        stages.Finish("SavePageData");
         SaveResponseBodies();
+        stages.Finish("SaveResponseBodies");
         SaveConsoleLog();
         SaveTimedEvents();
         SaveCustomMetrics();
+        SaveH2Frames();
+        SaveConnectionArrivals();
+        if (_test._hook_pcap)
+          SaveHookPcap();
+        stages.Finish("SaveLogs");
         _trace.Write(_file_base + TRACE_FILE);
         _trace_netlog.Write(_file_base + TRACE_NETLOG_FILE);
+        stages.Finish("SaveTraces");
+        SaveHookStats();
+        SaveCompletion();
+        stages.Finish("SaveStats");
       }
       SaveRequests(merge);
+      stages.Finish("SaveRequests");
+      if (_test._binary_request_log) {
+        SaveRequestLog();
+        stages.Finish("SaveRequestLog");
+      }
+      if (!merge)
+        stages.Write(_file_base + PROCESSING_STAGES_FILE);
     }
     if (shared_result == -1 || shared_result == 0 || shared_result == 99999)
       shared_result = _test_state._test_result;
@@ -172,6 +284,89 @@ void Results::Save(bool merge) {
   SetThreadPriority(GetCurrentThread(), priority);
 }
 
+/*-----------------------------------------------------------------------------
+  Save the hook's own overhead (memory used by the capture path, the
+  time spent in each of the hooked functions and the video capture)
+-----------------------------------------------------------------------------*/
+void Results::SaveHookStats(void) {
+  CStringA stats = "{\"memory\":";
+  stats += global_buffer_pool.GetStatsJSON();
+  stats += ",\"hooks\":";
+  stats += global_hook_profiler.GetStatsJSON();
+  stats += ",\"video\":";
+  stats += _test_state.GetVideoStatsJSON();
+  stats += "}";
+  HANDLE file = CreateFile(_file_base + HOOK_STATS_FILE, GENERIC_WRITE, 0,
+                           NULL, CREATE_ALWAYS, 0, 0);
+  if (file != INVALID_HANDLE_VALUE) {
+    DWORD bytes;
+    WriteFile(file, (LPCSTR)stats, stats.GetLength(), &bytes, 0);
+    CloseHandle(file);
+  }
+}
+
+/*-----------------------------------------------------------------------------
+  Save what decided the end of the step (and what each signal was doing)
+-----------------------------------------------------------------------------*/
+void Results::SaveCompletion(void) {
+  CStringA json = _test_state.GetCompletionJSON();
+  HANDLE file = CreateFile(_file_base + COMPLETION_FILE, GENERIC_WRITE, 0,
+                           NULL, CREATE_ALWAYS, 0, 0);
+  if (file != INVALID_HANDLE_VALUE) {
+    DWORD bytes;
+    WriteFile(file, (LPCSTR)json, json.GetLength(), &bytes, 0);
+    CloseHandle(file);
+  }
+}
+
+/*-----------------------------------------------------------------------------
+  Save the per-stream frame timelines for the HTTP/2 connections
+-----------------------------------------------------------------------------*/
+void Results::SaveH2Frames(void) {
+  CStringA connections = _sockets.GetH2TimelineJSON();
+  if (connections.GetLength() > 2) {
+    CStringA json = "{\"connections\":";
+    json += connections;
+    json += "}";
+    HANDLE file = CreateFile(_file_base + H2_FRAMES_FILE, GENERIC_WRITE, 0,
+                             NULL, CREATE_ALWAYS, 0, 0);
+    if (file != INVALID_HANDLE_VALUE) {
+      DWORD bytes;
+      WriteFile(file, (LPCSTR)json, json.GetLength(), &bytes, 0);
+      CloseHandle(file);
+    }
+  }
+}
+
+/*-----------------------------------------------------------------------------
+  Save the byte arrival timeline and goodput for each connection
+-----------------------------------------------------------------------------*/
+void Results::SaveConnectionArrivals(void) {
+  CStringA sockets = _sockets.GetArrivalsJSON();
+  if (sockets.GetLength() > 2) {
+    CStringA json = "{\"sockets\":";
+    json += sockets;
+    json += "}";
+    HANDLE file = CreateFile(_file_base + CONNECTION_ARRIVALS_FILE,
+                             GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, 0, 0);
+    if (file != INVALID_HANDLE_VALUE) {
+      DWORD bytes;
+      WriteFile(file, (LPCSTR)json, json.GetLength(), &bytes, 0);
+      CloseHandle(file);
+    }
+  }
+}
+
+/*-----------------------------------------------------------------------------
+  Synthetic capture of the socket data, one per hooked process
+-----------------------------------------------------------------------------*/
+void Results::SaveHookPcap(void) {
+  CString file;
+  file.Format(_T("%s_%d%s"), (LPCTSTR)_file_base, GetCurrentProcessId(),
+              HOOK_PCAP_FILE);
+  _sockets.SavePcap(file);
+}
+
 /*-----------------------------------------------------------------------------
   Save the cpu, memory and bandwidth progress data during the test.
 -----------------------------------------------------------------------------*/
@@ -205,6 +400,25 @@ void Results::SaveProgressData(void) {
   }
 }
 
+/*-----------------------------------------------------------------------------
+  Save the high-frequency per-process samples (cpu, memory, page faults,
+  context switches and busiest thread for each browser process).
+-----------------------------------------------------------------------------*/
+void Results::SaveSystemSamples(void) {
+  HANDLE file = CreateFile(_file_base + SYSTEM_SAMPLES_FILE, GENERIC_WRITE, 0,
+                           NULL, CREATE_ALWAYS, 0, 0);
+  if (file != INVALID_HANDLE_VALUE) {
+    DWORD count = 0;
+    {
+      ResultWriter out(file);
+      count = _test_state.WriteSystemSamplesJSON(out);
+    }
+    CloseHandle(file);
+    if (!count)
+      DeleteFile(_file_base + SYSTEM_SAMPLES_FILE);
+  }
+}
+
 /*-----------------------------------------------------------------------------
   Save the browser status messages
 -----------------------------------------------------------------------------*/
@@ -252,22 +466,44 @@ void Results::SaveImages(void) {
 -----------------------------------------------------------------------------*/
 void Results::SaveVideo() {
   _screen_capture.Lock();
-  CStringA histograms = "[";
-  DWORD histogram_count = 0;
   CxImage * last_image = NULL;
   DWORD width, height;
   CString file_name;
+
+  // the combined histograms are streamed out as the frames are processed
+  CString histograms_file;
+  TCHAR path[MAX_PATH];
+  lstrcpy(path, _file_base);
+  TCHAR * file = PathFindFileName(path);
+  int run = _tstoi(file);
+  if (run) {
+    int cached = _tcsstr(file, _T("_Cached")) ? 1 : 0;
+    *file = 0;
+    if (!_test.IsServerMultistepCapable()) {
+      histograms_file.Format(_T("%s%d.%d.histograms.json"), path, run, cached);
+    } else {
+      histograms_file.Format(_T("%s%d.%d.%d.histograms.json"), path, run,
+                             cached, reported_step_);
+    }
+  }
+  HANDLE histograms_handle = INVALID_HANDLE_VALUE;
+  if (!histograms_file.IsEmpty())
+    histograms_handle = CreateFile(histograms_file, GENERIC_WRITE, 0, 0,
+                                   CREATE_ALWAYS, 0, 0);
+  ResultWriter histograms(histograms_handle);
+  histograms.Char('[');
+
+  // the frame differences, histograms and timings are shared with the
+  // offline replay
+  AnalysisVideo video(RIGHT_MARGIN, BOTTOM_MARGIN);
+  std::string histogram_entry;
   POSITION pos = _screen_capture._captured_images.GetHeadPosition();
   while (pos) {
-    CStringA histogram;
     CapturedImage& image = _screen_capture._captured_images.GetNext(pos);
     if (image._type != CapturedImage::RESPONSIVE_CHECK) {
       CxImage * img = new CxImage;
       if (image.Get(*img)) {
         DWORD image_time_ms = _test_state.ElapsedMsFromStart(image._capture_time);
-        // we save the frames in increments of 100ms (for now anyway)
-        // round it to the closest interval
-        DWORD image_time = ((image_time_ms + 50) / 100);
         if (last_image) {
           RGBQUAD black = {0,0,0,0};
           if (img->GetWidth() > width)
@@ -278,56 +514,48 @@ void Results::SaveVideo() {
             img->Expand(0, 0, width - img->GetWidth(), 0, black);
           if (img->GetHeight() < height)
             img->Expand(0, 0, 0, height - img->GetHeight(), black);
-          if (ImagesAreDifferent(last_image, img)) {
+        } else {
+          width = img->GetWidth();
+          height = img->GetHeight();
+        }
+        // the histograms need the color channels
+        if (img->GetBpp() < 24)
+          img->IncreaseBpp(24);
+
+        AnalysisVideoFrame frame;
+        if (video.AddFrame(GetAnalysisBitmap(*img),
+                           last_image ? GetAnalysisBitmap(*last_image) :
+                                        AnalysisBitmap(),
+                           image_time_ms, frame)) {
+          if (last_image) {
             if (!_test_state._render_start.QuadPart)
               _test_state._render_start.QuadPart = image._capture_time.QuadPart;
-            histogram = GetHistogramJSON(*img);
-            if (_test._video) {
+            if (_test._video)
               _visually_complete.QuadPart = image._capture_time.QuadPart;
-              if (!_test.IsServerMultistepCapable()) {
-                file_name.Format(_T("progress_%04d.png"), image_time);
-              } else {
-                file_name.Format(_T("progress_%d_%04d.png"), reported_step_, image_time);
-              }
-              SaveImage(*img, _test._progress_dir + file_name, _test._image_quality, false, _test._full_size_video);
-            }
           }
-        } else {
-          width = img->GetWidth();
-          height = img->GetHeight();
-          // always save the first image at time zero
-          image_time = 0;
-          image_time_ms = 0;
-          histogram = GetHistogramJSON(*img);
           if (_test._video) {
             if (!_test.IsServerMultistepCapable()) {
-              file_name.Format(_T("progress_0000.png"));
+              file_name.Format(_T("progress_%04d.png"), frame.interval_);
             } else {
-              file_name.Format(_T("progress_%d_0000.png"), reported_step_);
+              file_name.Format(_T("progress_%d_%04d.png"), reported_step_,
+                               frame.interval_);
             }
             SaveImage(*img, _test._progress_dir + file_name, _test._image_quality, false, _test._full_size_video);
           }
         }
 
-
-        if (!histogram.IsEmpty()) {
-          if (histogram_count)
-            histograms += ", ";
-          histograms += "{\"histogram\": ";
-          histograms += histogram;
-          histograms += ", \"time\": ";
-          CStringA buff;
-          buff.Format("%d", image_time_ms);
-          histograms += buff;
-          histograms += "}";
-          histogram_count++;
+        if (!frame.histogram_.empty()) {
+          histogram_entry.clear();
+          video.AppendHistogram(frame, histogram_entry);
+          histograms.Write(histogram_entry);
           if (_test._video) {
             if (!_test.IsServerMultistepCapable()) {
               file_name.Format(_T("%s_progress_%04d.hist"), (LPCTSTR)_file_base,
-                image_time);
+                frame.interval_);
             } else {
-              file_name.Format(_T("%s_progress_%d_%04d.hist"), (LPCTSTR)_file_base, reported_step_, image_time);
+              file_name.Format(_T("%s_progress_%d_%04d.hist"), (LPCTSTR)_file_base, reported_step_, frame.interval_);
             }
+            CStringA histogram(frame.histogram_.c_str());
             SaveHistogram(histogram, file_name);
           }
         }
@@ -344,44 +572,27 @@ void Results::SaveVideo() {
   if (last_image)
     delete last_image;
   
-  if (histogram_count > 1) {
-    histograms += "]";
-    TCHAR path[MAX_PATH];
-    lstrcpy(path, _file_base);
-    TCHAR * file = PathFindFileName(path);
-    int run = _tstoi(file);
-    if (run) {
-      int cached = _tcsstr(file, _T("_Cached")) ? 1 : 0;
-      *file = 0;
-      if (!_test.IsServerMultistepCapable()) {
-        file_name.Format(_T("%s%d.%d.histograms.json"), path, run, cached);
-      } else {
-        file_name.Format(_T("%s%d.%d.%d.histograms.json"), path, run, cached, reported_step_);
-      }
-      SaveHistogram(histograms, file_name);
-    }
+  histograms.Char(']');
+  histograms.Flush();
+  if (histograms_handle != INVALID_HANDLE_VALUE) {
+    CloseHandle(histograms_handle);
+    if (video.histogram_count_ <= 1)
+      DeleteFile(histograms_file);
   }
 
   _screen_capture.Unlock();
 }
 
 /*-----------------------------------------------------------------------------
+  Raw view of the image bits for the portable analysis code
 -----------------------------------------------------------------------------*/
-bool Results::ImagesAreDifferent(CxImage * img1, CxImage* img2) {
-  if (img1 && img2 && img1->GetWidth() == img2->GetWidth() && img1->GetHeight() == img2->GetHeight()) {
-    DWORD width = max(img1->GetWidth() - RIGHT_MARGIN, 0);
-    DWORD height = img1->GetHeight();
-    DWORD row_bytes = img1->GetEffWidth();
-    DWORD row_length = width * (DWORD)(row_bytes / width);
-    for (DWORD row = BOTTOM_MARGIN; row < height; row++) {
-      BYTE * r1 = img1->GetBits(row);
-      BYTE * r2 = img2->GetBits(row);
-      if (r1 && r2 && memcmp(r1, r2, row_length))
-        return true;
-    }
-  }
- 
-  return false;
+AnalysisBitmap Results::GetAnalysisBitmap(CxImage& image) {
+  AnalysisBitmap bitmap;
+  if (image.IsValid() && image.GetBpp() >= 8)
+    bitmap = AnalysisBitmap(image.GetBits(), image.GetWidth(),
+                            image.GetHeight(), image.GetEffWidth(),
+                            image.GetBpp() / 8);
+  return bitmap;
 }
 
 /*-----------------------------------------------------------------------------
@@ -410,57 +621,6 @@ void Results::SaveImage(CxImage& image, CString file, BYTE quality,
 }
 
 
-/*-----------------------------------------------------------------------------
-  Calculate the image histogram as a json data structure (ignoring white pixels)
------------------------------------------------------------------------------*/
-CStringA Results::GetHistogramJSON(CxImage& image) {
-  CStringA histogram;
-  if (image.IsValid()) {
-    DWORD r[256], g[256], b[256];
-    for (int i = 0; i < 256; i++) {
-      r[i] = g[i] = b[i] = 0;
-    }
-    DWORD width = max(image.GetWidth() - RIGHT_MARGIN, 0);
-    DWORD height = image.GetHeight();
-    for (DWORD y = BOTTOM_MARGIN; y < height; y++) {
-      for (DWORD x = 0; x < width; x++) {
-        RGBQUAD pixel = image.GetPixelColor(x,y);
-        if (pixel.rgbRed != 255 || 
-            pixel.rgbGreen != 255 || 
-            pixel.rgbBlue != 255) {
-          r[pixel.rgbRed]++;
-          g[pixel.rgbGreen]++;
-          b[pixel.rgbBlue]++;
-        }
-      }
-    }
-    CStringA red = "\"r\":[";
-    CStringA green = "\"g\":[";
-    CStringA blue = "\"b\":[";
-    CStringA buff;
-    for (int i = 0; i < 256; i++) {
-      if (i) {
-        red += ",";
-        green += ",";
-        blue += ",";
-      }
-      buff.Format("%d", r[i]);
-      red += buff;
-      buff.Format("%d", g[i]);
-      green += buff;
-      buff.Format("%d", b[i]);
-      blue += buff;
-    }
-    red += "]";
-    green += "]";
-    blue += "]";
-    histogram = CStringA("{") + red + 
-                CStringA(",") + green + 
-                CStringA(",") + blue + CStringA("}");
-  }
-  return histogram;
-}
-
 /*-----------------------------------------------------------------------------
   Save the image histogram as a json data structure (ignoring white pixels)
 -----------------------------------------------------------------------------*/
@@ -824,6 +984,10 @@ void Results::SavePageData(OptimizationChecks& checks){
     // Is Responsive
     buff.Format("%d\t", _test_state._is_responsive);
     result += buff;
+    // Predicted repeat view: requests from cache, validated, re-fetched
+    buff.Format("%d\t%d\t%d\t", checks._repeat_view_cached,
+                checks._repeat_view_validated, checks._repeat_view_fetched);
+    result += buff;
 
     result += "\r\n";
 
@@ -835,21 +999,6 @@ void Results::SavePageData(OptimizationChecks& checks){
 }
 
 void Results::ProcessRequests(bool merge) {
-  count_connect_ = 0;
-  count_connect_doc_ = 0;
-  count_dns_ = 0;
-  count_dns_doc_ = 0;
-  count_ok_ = 0;
-  count_ok_doc_ = 0;
-  count_redirect_ = 0;
-  count_redirect_doc_ = 0;
-  count_not_modified_ = 0;
-  count_not_modified_doc_ = 0;
-  count_not_found_ = 0;
-  count_not_found_doc_ = 0;
-  count_other_ = 0;
-  count_other_doc_ = 0;
-
   _requests.Lock();
   // first pass, reset the actual start time to be the first measured action
   // to eliminate the gap at startup for browser initialization
@@ -885,185 +1034,171 @@ void Results::ProcessRequests(bool merge) {
   // Next do all of the processing.  We want to do ALL of the processing
   // before recording the results so we can include any socket connections
   // or DNS lookups that are not associated with a request
+  std::vector<AnalysisRequest> records;
+  CAtlArray<Request *> processed;
   POSITION pos = _requests._requests.GetHeadPosition();
-  bool base_page = true;
-  base_page_redirects_ = 0;
-  adult_site_ = false;
-  LONGLONG new_end = 0;
-  LONGLONG new_first_byte = 0;
-  std::tr1::regex adult_regex("[^0-9a-zA-Z]2257[^0-9a-zA-Z]");
   while (pos) {
     Request * request = _requests._requests.GetNext(pos);
     WptTrace(loglevel::kFunction, _T("[wpthook] - Processing request %S%S"), (LPCSTR)request->GetHost(), (LPCSTR)request->_request_data.GetObject());
     if (request && 
         (!request->_from_browser || !NativeRequestExists(request))) {
       request->Process(merge ? _test_state._prev_step_start : _test_state._start);
-      int result_code = request->GetResult();
-      int doc_increment = 0;
-      if (request->_start.QuadPart <= _test_state._on_load.QuadPart)
-        doc_increment = 1;
-      switch (result_code) {
-        case 200:
-          count_ok_++;
-          count_ok_doc_ += doc_increment;
-          break;
-        case 301:
-        case 302:
-          count_redirect_++;
-          count_redirect_doc_ += doc_increment;
-          break;
-        case 304:
-          count_not_modified_++;
-          count_not_modified_doc_ += doc_increment;
-          break;
-        case 404:
-          count_not_found_++;
-          count_not_found_doc_ += doc_increment;
-          break;
-        default:
-          count_other_++;
-          count_other_ += doc_increment;
-          break;
-      }
-      if (request->_dns_start.QuadPart) {
-        count_dns_++;
-        count_dns_doc_ += doc_increment;
-      }
-      if (request->_connect_start.QuadPart) {
-        count_connect_++;
-        count_connect_doc_ += doc_increment;
-      }
-      if (base_page) { 
-        if (result_code == 301 || result_code == 302 || result_code == 401) {
-          base_page_redirects_++;
-        } else {
-          base_page = false;
-          base_page_result_ = result_code;
-          base_page_server_rtt_ = request->rtt_;
-          base_page_address_count_ = _dns.GetAddressCount(
-              (LPCTSTR)CA2T(request->GetHost(), CP_UTF8));
-          request->_is_base_page = true;
-          base_page_complete_.QuadPart = request->_end.QuadPart;
-          if ((!_test_state._test_result ||  _test_state._test_result == 99999)
-              && base_page_result_ >= 400) {
-            _test_state._test_result = result_code;
-          }
-          // check for adult content
-          if (result_code == 200) {
-            DataChunk body_chunk = request->_response_data.GetBody(true);
-            CStringA body(body_chunk.GetData(), body_chunk.GetLength());
-            if (regex_search((LPCSTR)body, adult_regex) ||
-                body.Find("RTA-5042-1996-1400-1577-RTA") >= 0)
-              adult_site_ = true;
-          }
-        }
-      }
-      new_end = max(new_end, request->_end.QuadPart);
-      new_end = max(new_end, request->_start.QuadPart);
-      new_end = max(new_end, request->_first_byte.QuadPart);
-      new_end = max(new_end, request->_dns_start.QuadPart);
-      new_end = max(new_end, request->_dns_end.QuadPart);
-      new_end = max(new_end, request->_connect_start.QuadPart);
-      new_end = max(new_end, request->_connect_end.QuadPart);
-      if (request->_first_byte.QuadPart &&
-          result_code != 301 && result_code != 302 && result_code != 401 &&
-          (!new_first_byte || request->_first_byte.QuadPart < new_first_byte))
-        new_first_byte = request->_first_byte.QuadPart;
+      AnalysisRequest record;
+      record.result_ = request->GetResult();
+      record.start_ = request->_start.QuadPart;
+      record.first_byte_ = request->_first_byte.QuadPart;
+      record.end_ = request->_end.QuadPart;
+      record.dns_start_ = request->_dns_start.QuadPart;
+      record.dns_end_ = request->_dns_end.QuadPart;
+      record.connect_start_ = request->_connect_start.QuadPart;
+      record.connect_end_ = request->_connect_end.QuadPart;
+      records.push_back(record);
+      processed.Add(request);
     }
   }
-  if (new_end)
-    _test_state._last_activity.QuadPart = new_end;
-  if (new_first_byte)
-    _test_state._first_byte.QuadPart = new_first_byte;
+
+  // the counts, base page and page times are shared with the offline replay
+  AnalysisRequestSummary summary;
+  AnalysisSummarizeRequests(records, _test_state._on_load.QuadPart, summary);
+  count_connect_ = summary.count_connect_;
+  count_connect_doc_ = summary.count_connect_doc_;
+  count_dns_ = summary.count_dns_;
+  count_dns_doc_ = summary.count_dns_doc_;
+  count_ok_ = summary.count_ok_;
+  count_ok_doc_ = summary.count_ok_doc_;
+  count_redirect_ = summary.count_redirect_;
+  count_redirect_doc_ = summary.count_redirect_doc_;
+  count_not_modified_ = summary.count_not_modified_;
+  count_not_modified_doc_ = summary.count_not_modified_doc_;
+  count_not_found_ = summary.count_not_found_;
+  count_not_found_doc_ = summary.count_not_found_doc_;
+  count_other_ = summary.count_other_;
+  count_other_doc_ = summary.count_other_doc_;
+  base_page_redirects_ = summary.base_page_redirects_;
+  adult_site_ = false;
+  if (summary.base_page_ >= 0) {
+    Request * request = processed[summary.base_page_];
+    int result_code = records[summary.base_page_].result_;
+    base_page_result_ = result_code;
+    base_page_server_rtt_ = request->rtt_;
+    base_page_address_count_ = _dns.GetAddressCount(
+        (LPCTSTR)CA2T(request->GetHost(), CP_UTF8));
+    request->_is_base_page = true;
+    base_page_complete_.QuadPart = request->_end.QuadPart;
+    if ((!_test_state._test_result ||  _test_state._test_result == 99999)
+        && base_page_result_ >= 400) {
+      _test_state._test_result = result_code;
+    }
+    // check for adult content
+    if (result_code == 200) {
+      DataChunk body_chunk = request->_response_data.GetBody(true);
+      adult_site_ = AnalysisIsAdultContent(body_chunk.GetData(),
+                                           body_chunk.GetLength());
+    }
+  }
+  if (summary.last_activity_)
+    _test_state._last_activity.QuadPart = summary.last_activity_;
+  if (summary.first_byte_)
+    _test_state._first_byte.QuadPart = summary.first_byte_;
   _requests.Unlock();
 }
 
+/*-----------------------------------------------------------------------------
+  Order the requests by start time (stable so ties keep the capture order)
+-----------------------------------------------------------------------------*/
+static bool CompareRequestStart(const Request * a, const Request * b) {
+  return a->_start.QuadPart < b->_start.QuadPart;
+}
+
 /*-----------------------------------------------------------------------------
 -----------------------------------------------------------------------------*/
 void Results::SaveRequests(bool merge) {
   HANDLE file = CreateFile(_file_base + REQUEST_DATA_FILE, GENERIC_WRITE, 0, 
                             NULL, OPEN_ALWAYS, 0, 0);
   if (file != INVALID_HANDLE_VALUE) {
-    DWORD bytes;
-    CStringA buff;
     SetFilePointer( file, 0, 0, FILE_END );
 
     HANDLE headers_file = CreateFile(_file_base + REQUEST_HEADERS_DATA_FILE,
                             GENERIC_WRITE, 0, NULL, OPEN_ALWAYS, 0, 0);
 
     HANDLE custom_rules_file = INVALID_HANDLE_VALUE;
-    if (!_test._custom_rules.IsEmpty()) {
+    if (!_test._custom_rules.IsEmpty())
       custom_rules_file = CreateFile(_file_base +CUSTOM_RULES_DATA_FILE,
                                     GENERIC_WRITE, 0, 0, CREATE_ALWAYS, 0, 0);
-      if (custom_rules_file != INVALID_HANDLE_VALUE) {
-        WriteFile(custom_rules_file, "{", 1, &bytes, 0);
-      }
-    }
+    HANDLE har_file = INVALID_HANDLE_VALUE;
+    if (!merge)
+      har_file = CreateFile(_file_base + HAR_FILE, GENERIC_WRITE, 0, 0,
+                            CREATE_ALWAYS, 0, 0);
 
     _requests.Lock();
-    // now record the results
-    // do a selection sort to pick out the requests in order of start time
-    int i = merge ? _test_state.GetOverallRequests() : 0;
-    bool first_custom_rule = true;
-    Request * request = NULL;
-    do {
-      request = NULL;
+    {
+      ResultWriter out(file);
+      ResultWriter headers(headers_file);
+      ResultWriter custom_rules(custom_rules_file);
+      ResultWriter har(har_file);
+      if (headers_file != INVALID_HANDLE_VALUE)
+        SetFilePointer(headers_file, 0, 0, FILE_END);
+      custom_rules.Char('{');
+      StartHar(har);
+
+      // record the results in order of start time
+      std::vector<Request *> requests;
+      requests.reserve(_requests._requests.GetCount());
       POSITION pos = _requests._requests.GetHeadPosition();
       while (pos) {
-        Request * candidate = _requests._requests.GetNext(pos);
-        if (!candidate->_reported && 
-            (!request || 
-            candidate->_start.QuadPart < request->_start.QuadPart)) {
-          request = candidate;
-        }
+        Request * request = _requests._requests.GetNext(pos);
+        if (!request->_reported)
+          requests.push_back(request);
       }
-      if (request) {
+      std::stable_sort(requests.begin(), requests.end(), CompareRequestStart);
+
+      int i = merge ? _test_state.GetOverallRequests() : 0;
+      bool first_custom_rule = true;
+      bool first_har_entry = true;
+      for (size_t index = 0; index < requests.size(); index++) {
+        Request * request = requests[index];
         request->_reported = true;
         if (request->_processed) {
           i++;
-          SaveRequest(file, headers_file, request, i);
-          if (!request->_custom_rules_matches.IsEmpty() && 
-              custom_rules_file != INVALID_HANDLE_VALUE) {
-            if (first_custom_rule) {
-              first_custom_rule = false;
-            } else {
-              WriteFile(custom_rules_file, ",", 1, &bytes, 0);
-            }
-            buff.Format("\"%d\"", i);
-            WriteFile(custom_rules_file, (LPCSTR)buff, buff.GetLength(),
-                      &bytes, 0);
-            WriteFile(custom_rules_file, ":{", 2, &bytes, 0);
+          SaveRequest(out, headers, request, i);
+          SaveHarEntry(har, request, first_har_entry);
+          first_har_entry = false;
+          if (!request->_custom_rules_matches.IsEmpty()) {
+            if (!first_custom_rule)
+              custom_rules.Char(',');
+            first_custom_rule = false;
+            custom_rules.Char('"');
+            custom_rules.Int(i);
+            custom_rules.Write("\":{");
             POSITION match_pos =
                 request->_custom_rules_matches.GetHeadPosition();
             DWORD match_count = 0;
             while (match_pos) {
               match_count++;
-              CustomRulesMatch match = 
+              CustomRulesMatch& match = 
                   request->_custom_rules_matches.GetNext(match_pos);
-              CT2A name((LPCTSTR)match._name, CP_UTF8);
-              CT2A value((LPCTSTR)match._value, CP_UTF8);
-              CStringA entry = "";
               if (match_count > 1)
-                entry += ",";
-              entry += CStringA("\"") + JSONEscapeA((LPCSTR)name) + "\":{";
-              entry += CStringA("\"value\":\"") +
-                       JSONEscapeA((LPCSTR)value)+"\",";
-              buff.Format("%d", match._count);
-              entry += CStringA("\"count\":") + buff + "}";
-              WriteFile(custom_rules_file, (LPCSTR)entry, entry.GetLength(), 
-                        &bytes, 0);
+                custom_rules.Char(',');
+              custom_rules.String(match._name);
+              custom_rules.Write(":{\"value\":");
+              custom_rules.String(match._value);
+              custom_rules.Write(",\"count\":");
+              custom_rules.Int(match._count);
+              custom_rules.Char('}');
             }
-            WriteFile(custom_rules_file, "}", 1, &bytes, 0);
+            custom_rules.Char('}');
           }
         }
       }
-    } while (request);
-    _test_state.SetOverallRequests(i);
+      _test_state.SetOverallRequests(i);
+      custom_rules.Char('}');
+      har.Write("]}}");
+    }
     _requests.Unlock();
-    if (custom_rules_file != INVALID_HANDLE_VALUE) {
-      WriteFile(custom_rules_file, "}", 1, &bytes, 0);
+    if (custom_rules_file != INVALID_HANDLE_VALUE)
       CloseHandle(custom_rules_file);
-    }
+    if (har_file != INVALID_HANDLE_VALUE)
+      CloseHandle(har_file);
     if (headers_file != INVALID_HANDLE_VALUE)
       CloseHandle(headers_file);
     CloseHandle(file);
@@ -1071,240 +1206,492 @@ void Results::SaveRequests(bool merge) {
 }
 
 /*-----------------------------------------------------------------------------
+  Convert the request data (all of the steps so far) into the binary
+  columnar log.  The headers stay in the text report.
 -----------------------------------------------------------------------------*/
-void Results::SaveRequest(HANDLE file, HANDLE headers, Request * request, 
-                                                                   int index) {
-  CStringA result;
-  CStringA buff;
+void Results::SaveRequestLog(void) {
+  std::string tsv;
+  HANDLE file = CreateFile(_file_base + REQUEST_DATA_FILE, GENERIC_READ,
+                           FILE_SHARE_READ, NULL, OPEN_EXISTING, 0, 0);
+  if (file != INVALID_HANDLE_VALUE) {
+    DWORD len = GetFileSize(file, NULL);
+    if (len && len != INVALID_FILE_SIZE) {
+      tsv.resize(len);
+      DWORD bytes = 0;
+      if (!ReadFile(file, &tsv[0], len, &bytes, 0) || bytes != len)
+        tsv.clear();
+    }
+    CloseHandle(file);
+  }
+  std::string log;
+  if (!tsv.empty() && RequestLogFromTsv(tsv.data(), tsv.length(), log)) {
+    file = CreateFile(_file_base + REQUEST_LOG_FILE, GENERIC_WRITE, 0, NULL,
+                      CREATE_ALWAYS, 0, 0);
+    if (file != INVALID_HANDLE_VALUE) {
+      DWORD bytes;
+      WriteFile(file, log.data(), (DWORD)log.length(), &bytes, 0);
+      CloseHandle(file);
+    }
+  }
+}
 
+/*-----------------------------------------------------------------------------
+-----------------------------------------------------------------------------*/
+void Results::SaveRequest(ResultWriter& out, ResultWriter& headers,
+                          Request * request, int index) {
   WptTrace(loglevel::kFunction, _T("[wpthook] - Saving request %S%S"), (LPCSTR)request->GetHost(), (LPCSTR)request->_request_data.GetObject());
   SYSTEMTIME start_time;
   FileTimeToSystemTime(&_test_state._start_time, &start_time);
 
   // Date
-  buff.Format("%02d/%02d/%02d\t", start_time.wMonth,
-        start_time.wDay, start_time.wYear);
-  result += buff;
+  out.Int(start_time.wMonth, 2);
+  out.Char('/');
+  out.Int(start_time.wDay, 2);
+  out.Char('/');
+  out.Int(start_time.wYear, 2);
+  out.Tab();
   // Time
-  buff.Format("%02d:%02d:%02d.%d\t", start_time.wHour,
-        start_time.wMinute, start_time.wSecond, start_time.wMilliseconds);
-  result += buff;
+  out.Int(start_time.wHour, 2);
+  out.Char(':');
+  out.Int(start_time.wMinute, 2);
+  out.Char(':');
+  out.Int(start_time.wSecond, 2);
+  out.Char('.');
+  out.Int(start_time.wMilliseconds);
+  out.Tab();
   // Event Name
-  result += current_step_name_ + "\t";
+  out.Write(current_step_name_);
+  out.Tab();
   // IP Address
   struct sockaddr_in addr;
   addr.sin_addr.S_un.S_addr = request->_peer_address;
   if (addr.sin_addr.S_un.S_addr) {
-    buff.Format("%d.%d.%d.%d", addr.sin_addr.S_un.S_un_b.s_b1, 
-      addr.sin_addr.S_un.S_un_b.s_b2, addr.sin_addr.S_un.S_un_b.s_b3, 
-      addr.sin_addr.S_un.S_un_b.s_b4);
-    result += buff;
+    out.Int(addr.sin_addr.S_un.S_un_b.s_b1);
+    out.Char('.');
+    out.Int(addr.sin_addr.S_un.S_un_b.s_b2);
+    out.Char('.');
+    out.Int(addr.sin_addr.S_un.S_un_b.s_b3);
+    out.Char('.');
+    out.Int(addr.sin_addr.S_un.S_un_b.s_b4);
   }
-  result += "\t";
+  out.Tab();
   // Action
-  result += request->_request_data.GetMethod() + "\t";
+  out.Write(request->_request_data.GetMethod());
+  out.Tab();
   // Host
-  result += request->GetHost() + "\t";
+  out.Write(request->GetHost());
+  out.Tab();
   // URL
-  result += request->_request_data.GetObject() + "\t";
+  out.Write(request->_request_data.GetObject());
+  out.Tab();
   // Response Code
-  buff.Format("%d\t", request->_response_data.GetResult());
-  result += buff;
+  out.Int(request->_response_data.GetResult());
+  out.Tab();
   // Time to Load (ms)
-  buff.Format("%d\t", request->_ms_end - request->_ms_start);
-  result += buff;
+  out.Int(request->_ms_end - request->_ms_start);
+  out.Tab();
   // Time to First Byte (ms)
-  if (request->_ms_first_byte >= request->_ms_start) {
-    buff.Format("%d\t", request->_ms_first_byte - request->_ms_start);
-  } else {
-    buff = "\t";
-  }
-  result += buff;
+  if (request->_ms_first_byte >= request->_ms_start)
+    out.Int(request->_ms_first_byte - request->_ms_start);
+  out.Tab();
   // Start Time (ms)
-  buff.Format("%d\t", request->_ms_start);
-  result += buff;
+  out.Int(request->_ms_start);
+  out.Tab();
   // Bytes Out
-  buff.Format("%d\t", request->_bytes_out ? request->_bytes_out:
-              request->_request_data.GetDataSize());
-  result += buff;
+  out.Int((int)(request->_bytes_out ? request->_bytes_out:
+                request->_request_data.GetDataSize()));
+  out.Tab();
   // Bytes In
-  buff.Format("%d\t", request->_bytes_in ? request->_bytes_in :
-              request->_response_data.GetDataSize());
-  result += buff;
+  out.Int((int)(request->_bytes_in ? request->_bytes_in :
+                request->_response_data.GetDataSize()));
+  out.Tab();
   // Object Size
   DWORD size = request->_response_data.GetBody().GetLength();
   if (size <= 0 && request->_object_size > 0)
     size = request->_object_size;
-  buff.Format("%d\t", size);
-  result += buff;
+  out.Int((int)size);
+  out.Tab();
   // Cookie Size (out)
-  result += "\t";
+  out.Tab();
   // Cookie Count(out)
-  result += "\t";
+  out.Tab();
   // Expires
-  result += request->GetResponseHeader("expires") + "\t";
+  out.Write(request->GetResponseHeader("expires"));
+  out.Tab();
   // Cache Control
-  result += request->GetResponseHeader("cache-control") + "\t";
+  out.Write(request->GetResponseHeader("cache-control"));
+  out.Tab();
   // Content Type
-  int pos = 0;
-  result += request->GetResponseHeader("content-type").Tokenize(";", pos) 
-            + "\t";
+  CStringA content_type = request->GetResponseHeader("content-type");
+  int separator = content_type.Find(';');
+  out.Write((LPCSTR)content_type,
+            separator >= 0 ? separator : content_type.GetLength());
+  out.Tab();
   // Content Encoding
-  result += request->GetResponseHeader("content-encoding") + "\t";
+  out.Write(request->GetResponseHeader("content-encoding"));
+  out.Tab();
   // Transaction Type (3 = request - legacy reasons)
-  result += "3\t";
+  out.Write("3\t");
   // Socket ID
-  buff.Format("%d\t", request->_socket_id);
-  result += buff;
+  out.Int(request->_socket_id);
+  out.Tab();
   // Document ID
-  result += "\t";
+  out.Tab();
   // End Time (ms)
-  buff.Format("%d\t", request->_ms_end);
-  result += buff;
-  // Descriptor
-  result += "\t";
-  // Lab ID
-  result += "\t";
-  // Dialer ID
-  result += "\t";
-  // Connection Type
-  result += "\t";
-  // Cached
-  result += "\t";
-  // Event URL
-  result += "\t";
-  // IEWatch Build
-  result += "\t";
-  // Measurement Type - (DWORD - 1 for web 1.0, 2 for web 2.0)
-  result += "\t";
-  // Experimental (DWORD)
-  result += "\t";
-  // Event GUID - (matches with Event GUID in object data) - Added in build 42
-  result += "\t";
+  out.Int(request->_ms_end);
+  out.Tab();
+  // Descriptor, Lab ID, Dialer ID, Connection Type, Cached, Event URL,
+  // IEWatch Build, Measurement Type, Experimental, Event GUID
+  out.Write("\t\t\t\t\t\t\t\t\t\t");
   // Sequence Number - Incremented for each record in the object data
-  buff.Format("%d\t", index);
-  result += buff;
+  out.Int(index);
+  out.Tab();
   // Cache Score
-  buff.Format("%d\t", request->_scores._cache_score);
-  result += buff;
+  out.Int(request->_scores._cache_score);
+  out.Tab();
   // Static CDN Score
-  buff.Format("%d\t", request->_scores._static_cdn_score);
-  result += buff;
+  out.Int(request->_scores._static_cdn_score);
+  out.Tab();
   // GZIP Score
-  buff.Format("%d\t", request->_scores._gzip_score);
-  result += buff;
+  out.Int(request->_scores._gzip_score);
+  out.Tab();
   // Cookie Score
-  result += "-1\t";
+  out.Write("-1\t");
   // Keep-Alive Score
-  buff.Format("%d\t", request->_scores._keep_alive_score);
-  result += buff;
-  // DOCTYPE Score
-  result += "-1\t";
-  // Minify Score
-  result += "-1\t";
+  out.Int(request->_scores._keep_alive_score);
+  out.Tab();
+  // DOCTYPE Score, Minify Score
+  out.Write("-1\t-1\t");
   // Combine Score
-  buff.Format("%d\t", request->_scores._combine_score);
-  result += buff;
+  out.Int(request->_scores._combine_score);
+  out.Tab();
   // Image Compression Score
-  buff.Format("%d\t", request->_scores._image_compression_score);
-  result += buff;
-  // ETag Score
-  result += "-1\t";
-  // Flagged
-  result += "0\t";
+  out.Int(request->_scores._image_compression_score);
+  out.Tab();
+  // ETag Score, Flagged
+  out.Write("-1\t0\t");
   // Secure
-  result += request->_is_ssl ? "1\t" : "0\t";
-  // DNS Time (ms)
-  result += "-1\t";
-  // Socket Connect time (ms)
-  result += "-1\t";
-  // SSL time (ms)
-  result += "-1\t";
+  out.Write(request->_is_ssl ? "1\t" : "0\t");
+  // DNS Time (ms), Socket Connect time (ms), SSL time (ms)
+  out.Write("-1\t-1\t-1\t");
   // Gzip Total Bytes
-  buff.Format("%d\t", request->_scores._gzip_total);
-  result += buff;
+  out.Int((int)request->_scores._gzip_total);
+  out.Tab();
   // Gzip Savings
-  buff.Format("%d\t",
-    request->_scores._gzip_total - request->_scores._gzip_target);
-  result += buff;
-  // Minify Total Bytes
-  result += "0\t";
-  // Minify Savings
-  result += "0\t";
+  out.Int((int)(request->_scores._gzip_total - request->_scores._gzip_target));
+  out.Tab();
+  // Minify Total Bytes, Minify Savings
+  out.Write("0\t0\t");
   // Image Compression Total Bytes
-  buff.Format("%d\t", request->_scores._image_compress_total);
-  result += buff;
+  out.Int((int)request->_scores._image_compress_total);
+  out.Tab();
   // Image Compression Savings
-  buff.Format("%d\t",
-    request->_scores._image_compress_total
-    - request->_scores._image_compress_target);
-  result += buff;
+  out.Int((int)(request->_scores._image_compress_total
+                - request->_scores._image_compress_target));
+  out.Tab();
   // Cache Time (sec)
-  buff.Format("%d\t", request->_scores._cache_time_secs);
-  result += buff;
-  // Real Start Time (ms)
-  result += "\t";
-  // Full Time to Load (ms)
-  result += "\t";
+  out.Int((int)request->_scores._cache_time_secs);
+  out.Tab();
+  // Real Start Time (ms), Full Time to Load (ms)
+  out.Write("\t\t");
   // Optimization Checked
-  result += "1\t";
+  out.Write("1\t");
   // CDN Provider
-  result += request->_scores._cdn_provider + "\t";
+  out.Write(request->_scores._cdn_provider);
+  out.Tab();
   // DNS start
-  buff.Format("%d\t", request->_ms_dns_start);
-  result += buff;
+  out.Int(request->_ms_dns_start);
+  out.Tab();
   // DNS end
-  buff.Format("%d\t", request->_ms_dns_end);
-  result += buff;
+  out.Int(request->_ms_dns_end);
+  out.Tab();
   // connect start
-  buff.Format("%d\t", request->_ms_connect_start);
-  result += buff;
+  out.Int(request->_ms_connect_start);
+  out.Tab();
   // connect end
-  buff.Format("%d\t", request->_ms_connect_end);
-  result += buff;
+  out.Int(request->_ms_connect_end);
+  out.Tab();
   // ssl negotiation start
-  buff.Format("%d\t", request->_ms_ssl_start);
-  result += buff;
+  out.Int(request->_ms_ssl_start);
+  out.Tab();
   // ssl negotiation end
-  buff.Format("%d\t", request->_ms_ssl_end);
-  result += buff;
+  out.Int(request->_ms_ssl_end);
+  out.Tab();
   // initiator
-  result += request->initiator_ + _T("\t");
-  result += request->initiator_line_ + _T("\t");
-  result += request->initiator_column_ + _T("\t");
+  out.Write(CStringA(request->initiator_));
+  out.Tab();
+  out.Write(CStringA(request->initiator_line_));
+  out.Tab();
+  out.Write(CStringA(request->initiator_column_));
+  out.Tab();
   // Server Count
-  buff.Format("%d\t",
-      _dns.GetAddressCount((LPCTSTR)CA2T(request->GetHost(), CP_UTF8)));
-  result += buff;
+  out.Int(_dns.GetAddressCount((LPCTSTR)CA2T(request->GetHost(), CP_UTF8)));
+  out.Tab();
   // Server RTT
-  result += request->rtt_ + "\t";
+  out.Write(request->rtt_);
+  out.Tab();
   // Local Port
-  buff.Format("%d\t", request->_local_port);
-  result += buff;
+  out.Int(request->_local_port);
+  out.Tab();
   // JPEG scan count
-  buff.Format("%d\t", request->_scores._jpeg_scans);
-  result += buff;
-
-  result += "\r\n";
+  out.Int(request->_scores._jpeg_scans);
+  out.Tab();
+  // HTTP/2 flow control blocked (ms) and head-of-line wait (ms)
+  LONGLONG ms_frequency = _test_state._ms_frequency.QuadPart;
+  LONGLONG h2_blocked = 0, h2_hol_wait = 0;
+  if (request->_stream_id && ms_frequency &&
+      _sockets.GetH2StreamTimes(request->_socket_id, request->_stream_id,
+                                h2_blocked, h2_hol_wait)) {
+    out.Fixed((double)h2_blocked / (double)ms_frequency, 3);
+    out.Tab();
+    out.Fixed((double)h2_hol_wait / (double)ms_frequency, 3);
+    out.Tab();
+  } else {
+    out.Write("\t\t");
+  }
+  // Response arrival timeline ("ms:bytes,..." delta-encoded from the step
+  // start), max stall (ms), throughput (bytes/sec) and time from the first
+  // byte to 50% and 90% of the bytes (ms)
+  const ArrivalTimeline& arrivals = request->_arrivals;
+  if (!arrivals.IsEmpty() && ms_frequency) {
+    out.Write(arrivals.GetTimeline(_test_state._start.QuadPart, ms_frequency));
+    out.Tab();
+    out.Fixed((double)arrivals.MaxStall() / (double)ms_frequency, 3);
+    out.Tab();
+    out.Fixed(arrivals.Throughput(ms_frequency * 1000), 0);
+    out.Tab();
+    out.Fixed((double)arrivals.TimeToPercent(50) / (double)ms_frequency, 3);
+    out.Tab();
+    out.Fixed((double)arrivals.TimeToPercent(90) / (double)ms_frequency, 3);
+    out.Tab();
+  } else {
+    out.Write("\t\t\t\t\t");
+  }
+  // Predicted repeat view cache behavior (cache, validate or fetch)
+  out.Write(CachePolicy::RepeatViewName(
+      request->GetCachePolicy().RepeatView()));
+  out.Tab();
 
-  DWORD written;
-  WriteFile(file, (LPCSTR)result, result.GetLength(), &written, 0);
+  out.Write("\r\n");
 
   // write out the raw headers
-  if (headers != INVALID_HANDLE_VALUE) {
-    SetFilePointer(headers, 0, 0, FILE_END);
-    buff.Format("Request details:\r\nStep name:%s\r\nRequest %d:\r\nRequest Headers:\r\n", 
-                  current_step_name_.GetBuffer(), index);
-    buff += request->_request_data.GetHeaders();
-    buff.Trim("\r\n");
-    buff += "\r\nResponse Headers:\r\n";
-    buff += request->_response_data.GetHeaders();
-    buff.Trim("\r\n");
-    buff += "\r\n";
-    WriteFile(headers, (LPCSTR)buff, buff.GetLength(), &written, 0);
+  headers.Write("Request details:\r\nStep name:");
+  headers.Write(current_step_name_);
+  headers.Write("\r\nRequest ");
+  headers.Int(index);
+  headers.Write(":\r\nRequest Headers:\r\n");
+  CStringA raw = request->_request_data.GetHeaders();
+  raw.Trim("\r\n");
+  headers.Write(raw);
+  headers.Write("\r\nResponse Headers:\r\n");
+  raw = request->_response_data.GetHeaders();
+  raw.Trim("\r\n");
+  headers.Write(raw);
+  headers.Write("\r\n");
+}
+
+/*-----------------------------------------------------------------------------
+  ISO 8601 UTC time for the given offset (in ms) from the step start
+-----------------------------------------------------------------------------*/
+void Results::WriteHarTime(ResultWriter& out, int offset_ms) {
+  ULARGE_INTEGER time;
+  time.LowPart = _test_state._start_time.dwLowDateTime;
+  time.HighPart = _test_state._start_time.dwHighDateTime;
+  time.QuadPart += (ULONGLONG)ElapsedMs(_test_state._step_start,
+                                        _test_state._start) * 10000;
+  time.QuadPart += (LONGLONG)offset_ms * 10000;
+  FILETIME file_time;
+  file_time.dwLowDateTime = time.LowPart;
+  file_time.dwHighDateTime = time.HighPart;
+  SYSTEMTIME t;
+  FileTimeToSystemTime(&file_time, &t);
+  out.Char('"');
+  out.Int(t.wYear, 4);
+  out.Char('-');
+  out.Int(t.wMonth, 2);
+  out.Char('-');
+  out.Int(t.wDay, 2);
+  out.Char('T');
+  out.Int(t.wHour, 2);
+  out.Char(':');
+  out.Int(t.wMinute, 2);
+  out.Char(':');
+  out.Int(t.wSecond, 2);
+  out.Char('.');
+  out.Int(t.wMilliseconds, 3);
+  out.Write("Z\"");
+}
+
+/*-----------------------------------------------------------------------------
+  HAR 1.2 log header and the page for the current step (the entries follow)
+-----------------------------------------------------------------------------*/
+void Results::StartHar(ResultWriter& har) {
+  har.Write("{\"log\":{\"version\":\"1.2\",\"creator\":"
+            "{\"name\":\"WebPagetest\",\"version\":\"\"},"
+            "\"browser\":{\"name\":");
+  har.String(CStringA(_test._browser));
+  har.Write(",\"version\":\"\"},\"pages\":[{\"id\":\"page_");
+  har.Int(reported_step_);
+  har.Write("\",\"title\":");
+  har.String(current_step_name_.IsEmpty() ? CStringA(CT2A(_test._url, CP_UTF8))
+                                          : current_step_name_);
+  har.Write(",\"startedDateTime\":");
+  WriteHarTime(har, 0);
+  har.Write(",\"pageTimings\":{\"onContentLoad\":-1,\"onLoad\":");
+  har.Int(_test_state._on_load.QuadPart ?
+          (int)_test_state.ElapsedMsFromStart(_test_state._on_load) : -1);
+  har.Write(",\"_startRender\":");
+  har.Int(_test_state._render_start.QuadPart ?
+          (int)_test_state.ElapsedMsFromStart(_test_state._render_start) : -1);
+  har.Write("}}],\"entries\":[");
+}
+
+/*-----------------------------------------------------------------------------
+  Name/value pairs from raw headers (the request or status line is skipped
+  but its HTTP version is returned)
+-----------------------------------------------------------------------------*/
+static void WriteHarHeaders(ResultWriter& har, const CStringA& raw,
+                            CStringA& version, int& headers_size) {
+  LPCSTR pos = raw;
+  LPCSTR end = pos + raw.GetLength();
+  bool first = true;
+  headers_size = raw.GetLength() ? raw.GetLength() : -1;
+  har.Char('[');
+  while (pos < end) {
+    LPCSTR line_end = pos;
+    while (line_end < end && *line_end != '\r' && *line_end != '\n')
+      line_end++;
+    LPCSTR colon = pos;
+    while (colon < line_end && *colon != ':')
+      colon++;
+    if (colon > pos && colon < line_end) {
+      LPCSTR value = colon + 1;
+      while (value < line_end && *value == ' ')
+        value++;
+      if (!first)
+        har.Char(',');
+      first = false;
+      har.Write("{\"name\":");
+      har.String(pos, colon - pos);
+      har.Write(",\"value\":");
+      har.String(value, line_end - value);
+      har.Char('}');
+    } else if (line_end > pos && version.IsEmpty()) {
+      LPCSTR http = strstr(pos, "HTTP/");
+      if (http && http + 8 <= line_end)
+        version.SetString(http + 5, 3);
+    }
+    pos = line_end;
+    while (pos < end && (*pos == '\r' || *pos == '\n'))
+      pos++;
   }
+  har.Char(']');
 }
 
+/*-----------------------------------------------------------------------------
+  HAR entry for a request with the same timing breakdown the server uses
+  (connect includes ssl, send is folded into wait)
+-----------------------------------------------------------------------------*/
+void Results::SaveHarEntry(ResultWriter& har, Request * request, bool first) {
+  if (!har.IsValid())
+    return;
+  int dns = request->_ms_dns_end - request->_ms_dns_start;
+  int connect = max(request->_ms_connect_end - request->_ms_connect_start, 0);
+  int ssl = max(request->_ms_ssl_end - request->_ms_ssl_start, 0);
+  int wait = request->_ms_first_byte >= request->_ms_start ?
+             request->_ms_first_byte - request->_ms_start : 0;
+  int receive = request->_ms_first_byte >= request->_ms_start ?
+                request->_ms_end - request->_ms_first_byte :
+                request->_ms_end - request->_ms_start;
+  if (dns <= 0 || request->_ms_dns_start < 0)
+    dns = -1;
+  connect += ssl;
+  if (!connect || request->_ms_connect_start < 0)
+    connect = -1;
+  if (!ssl || request->_ms_ssl_start < 0)
+    ssl = -1;
+  int time = max(dns, 0) + max(connect, 0) + wait + max(receive, 0);
+
+  if (!first)
+    har.Char(',');
+  har.Write("{\"pageref\":\"page_");
+  har.Int(reported_step_);
+  har.Write("\",\"startedDateTime\":");
+  WriteHarTime(har, request->_ms_start);
+  har.Write(",\"time\":");
+  har.Int(time);
+
+  // request
+  CStringA version;
+  int headers_size;
+  CStringA url = request->_is_ssl ? "https://" : "http://";
+  url += request->GetHost();
+  url += request->_request_data.GetObject();
+  har.Write(",\"request\":{\"method\":");
+  har.String(request->_request_data.GetMethod());
+  har.Write(",\"url\":");
+  har.String(url);
+  har.Write(",\"headers\":");
+  WriteHarHeaders(har, request->_request_data.GetHeaders(), version,
+                  headers_size);
+  har.Write(",\"httpVersion\":");
+  har.String(version);
+  har.Write(",\"headersSize\":");
+  har.Int(headers_size);
+  har.Write(",\"bodySize\":-1,\"cookies\":[],\"queryString\":[]}");
+
+  // response
+  version.Empty();
+  CStringA mime = request->GetResponseHeader("content-type");
+  int separator = mime.Find(';');
+  if (separator >= 0)
+    mime = mime.Left(separator);
+  DWORD size = request->_response_data.GetBody().GetLength();
+  if (size <= 0 && request->_object_size > 0)
+    size = request->_object_size;
+  har.Write(",\"response\":{\"status\":");
+  har.Int(request->_response_data.GetResult());
+  har.Write(",\"statusText\":\"\",\"headers\":");
+  WriteHarHeaders(har, request->_response_data.GetHeaders(), version,
+                  headers_size);
+  har.Write(",\"httpVersion\":");
+  har.String(version);
+  har.Write(",\"headersSize\":");
+  har.Int(headers_size);
+  har.Write(",\"bodySize\":");
+  har.Int((int)size);
+  har.Write(",\"redirectURL\":");
+  har.String(request->GetResponseHeader("location"));
+  har.Write(",\"cookies\":[],\"content\":{\"size\":");
+  har.Int((int)size);
+  har.Write(",\"mimeType\":");
+  har.String(mime.Trim());
+  har.Write("}},\"cache\":{},\"timings\":{\"blocked\":-1,\"dns\":");
+  har.Int(dns);
+  har.Write(",\"connect\":");
+  har.Int(connect);
+  har.Write(",\"ssl\":");
+  har.Int(ssl);
+  har.Write(",\"send\":0,\"wait\":");
+  har.Int(wait);
+  har.Write(",\"receive\":");
+  har.Int(max(receive, 0));
+  har.Write("},\"serverIPAddress\":\"");
+  struct sockaddr_in addr;
+  addr.sin_addr.S_un.S_addr = request->_peer_address;
+  if (addr.sin_addr.S_un.S_addr) {
+    har.Int(addr.sin_addr.S_un.S_un_b.s_b1);
+    har.Char('.');
+    har.Int(addr.sin_addr.S_un.S_un_b.s_b2);
+    har.Char('.');
+    har.Int(addr.sin_addr.S_un.S_un_b.s_b3);
+    har.Char('.');
+    har.Int(addr.sin_addr.S_un.S_un_b.s_b4);
+  }
+  har.Write("\",\"connection\":\"");
+  har.Int(request->_socket_id);
+  har.Write("\"}");
+}
 
 /*-----------------------------------------------------------------------------
   Format as the number of milliseconds since the start (with trailing tab).
@@ -1322,7 +1709,10 @@ CStringA Results::FormatTime(LARGE_INTEGER t) {
   HTML will still be captured
 -----------------------------------------------------------------------------*/
 void Results::SaveResponseBodies(void) {
-  if (_test._save_response_bodies || _test._save_html_body) {
+  if (_test._save_response_bodies && _test._dedup_bodies &&
+      !_test._save_html_body) {
+    SaveDedupedResponseBodies();
+  } else if (_test._save_response_bodies || _test._save_html_body) {
     CString file = _file_base + _T("_bodies.zip");
     zipFile zip = zipOpen(CT2A(file), APPEND_STATUS_CREATE);
     if (zip) {
@@ -1367,33 +1757,73 @@ void Results::SaveResponseBodies(void) {
   }
 }
 
+/*-----------------------------------------------------------------------------
+  Same bodies as SaveResponseBodies but each distinct body is only
+  compressed and uploaded by the first run of the test that sees it
+  (see BodyStore for the layout)
+-----------------------------------------------------------------------------*/
+void Results::SaveDedupedResponseBodies(void) {
+  CString file = _file_base + _T("_bodies.zip");
+  BodyStore store;
+  if (store.Open(file)) {
+    DWORD count = 0;
+    _requests.Lock();
+    POSITION pos = _requests._requests.GetHeadPosition();
+    while (pos) {
+      Request * request = _requests._requests.GetNext(pos);
+      if (request && request->_processed) {
+        CString mime =
+            request->GetResponseHeader("content-type").MakeLower();
+        count++;
+        if (request->GetResult() == 200 && 
+            ( mime.Find(_T("text/")) >= 0 || 
+              mime.Find(_T("javascript")) >= 0 || 
+              mime.Find(_T("json")) >= 0))  {
+          DataChunk body = request->_response_data.GetBody(true);
+          store.Add(count, (const BYTE *)body.GetData(), body.GetLength());
+        }
+      }
+    }
+    _requests.Unlock();
+    if (!store.Close())
+      DeleteFile(file);
+    WptTrace(loglevel::kFunction,
+      _T("[wpthook] - Results::SaveDedupedResponseBodies() %d bodies, ")
+      _T("%d new\n"), store.bodies_, store.stored_);
+  }
+}
+
 /*-----------------------------------------------------------------------------
 -----------------------------------------------------------------------------*/
 void Results::SaveConsoleLog(void) {
-  CStringA log = CT2A(_test_state.GetConsoleLogJSON());
-  if (log.GetLength()) {
-    HANDLE file = CreateFile(_file_base + CONSOLE_LOG_FILE, GENERIC_WRITE, 0, 
-                              NULL, CREATE_ALWAYS, 0, 0);
-    if (file != INVALID_HANDLE_VALUE) {
-      DWORD written;
-      WriteFile(file, (LPCSTR)log, log.GetLength(), &written, 0);
-      CloseHandle(file);
+  HANDLE file = CreateFile(_file_base + CONSOLE_LOG_FILE, GENERIC_WRITE, 0, 
+                            NULL, CREATE_ALWAYS, 0, 0);
+  if (file != INVALID_HANDLE_VALUE) {
+    size_t count = 0;
+    {
+      ResultWriter out(file);
+      count = _test_state.WriteConsoleLogJSON(out);
     }
+    CloseHandle(file);
+    if (!count)
+      DeleteFile(_file_base + CONSOLE_LOG_FILE);
   }
 }
 
 /*-----------------------------------------------------------------------------
 -----------------------------------------------------------------------------*/
 void Results::SaveTimedEvents(void) {
-  CStringA log = CT2A(_test_state.GetTimedEventsJSON(), CP_UTF8);
-  if (log.GetLength()) {
-    HANDLE file = CreateFile(_file_base + TIMED_EVENTS_FILE, GENERIC_WRITE, 0, 
-                              NULL, CREATE_ALWAYS, 0, 0);
-    if (file != INVALID_HANDLE_VALUE) {
-      DWORD written;
-      WriteFile(file, (LPCSTR)log, log.GetLength(), &written, 0);
-      CloseHandle(file);
+  HANDLE file = CreateFile(_file_base + TIMED_EVENTS_FILE, GENERIC_WRITE, 0, 
+                            NULL, CREATE_ALWAYS, 0, 0);
+  if (file != INVALID_HANDLE_VALUE) {
+    size_t count = 0;
+    {
+      ResultWriter out(file);
+      count = _test_state.WriteTimedEventsJSON(out);
     }
+    CloseHandle(file);
+    if (!count)
+      DeleteFile(_file_base + TIMED_EVENTS_FILE);
   }
 }
 
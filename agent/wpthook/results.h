@@ -38,7 +38,27 @@ class CxImage;
 class WptTest;
 class OptimizationChecks;
 class DevTools;
+class ResultWriter;
 class Trace;
+class AnalysisBitmap;
+
+/*-----------------------------------------------------------------------------
+  Wall time and memory use of each stage of the result processing
+-----------------------------------------------------------------------------*/
+class ProcessingStages {
+public:
+  ProcessingStages(void);
+  ~ProcessingStages(void);
+
+  void Start(void);
+  void Finish(const char * stage);
+  bool Write(CString file);
+
+private:
+  LARGE_INTEGER start_;
+  LARGE_INTEGER frequency_;
+  CStringA      stages_;
+};
 
 class Results {
 public:
@@ -98,21 +118,32 @@ private:
   void ProcessRequests(bool merge);
   void SavePageData(OptimizationChecks&);
   void SaveRequests(bool merge);
-  void SaveRequest(HANDLE file, HANDLE headers, Request * request, int index);
+  void SaveRequestLog(void);
+  void SaveRequest(ResultWriter& out, ResultWriter& headers,
+                   Request * request, int index);
+  void StartHar(ResultWriter& har);
+  void SaveHarEntry(ResultWriter& har, Request * request, bool first);
+  void WriteHarTime(ResultWriter& out, int offset_ms);
   void SaveImages(void);
   void SaveResultImage(void);
   void SaveVideo(void);
   void SaveProgressData(void);
   void SaveStatusMessages(void);
+  void SaveHookStats(void);
+  void SaveCompletion(void);
+  void SaveSystemSamples(void);
+  void SaveH2Frames(void);
+  void SaveConnectionArrivals(void);
+  void SaveHookPcap(void);
   void SaveImage(CxImage& image, CString file, BYTE quality,
                  bool force_small = false, bool _full_size_video = false);
-  bool ImagesAreDifferent(CxImage * img1, CxImage* img2);
+  AnalysisBitmap GetAnalysisBitmap(CxImage& image);
   CStringA FormatTime(LARGE_INTEGER t);
   void SaveResponseBodies(void);
+  void SaveDedupedResponseBodies(void);
   void SaveConsoleLog(void);
   void SaveTimedEvents(void);
   void SaveCustomMetrics(void);
   void SaveHistogram(CStringA& histogram, CString file);
-  CStringA GetHistogramJSON(CxImage& image);
   bool NativeRequestExists(Request * browser_request);
 };
@@ -31,6 +31,10 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include "shared_mem.h"
 #include "cximage/ximage.h"
 #include "test_state.h"
+#include "analysis.h"
+
+static const DWORD FRAME_RIGHT_MARGIN = 25;
+static const DWORD FRAME_BOTTOM_MARGIN = 25;
 
 // global indicator that we are capturing a screen shot
 // (so that any GDI hooks can ignore our activity)
@@ -62,16 +66,27 @@ void ScreenCapture::Reset() {
 }
 
 /*-----------------------------------------------------------------------------
-  Capture a screen shot and save it in our list
+  Capture a screen shot and save it in our list.  If a dirty rectangle is
+  provided (relative to the capture area) then only that part is read from
+  the screen and the rest is copied from the previous frame of the same type.
 -----------------------------------------------------------------------------*/
 void ScreenCapture::Capture(HWND wnd, CapturedImage::TYPE type,
-                            bool crop_viewport) {
+                            bool crop_viewport, RECT * dirty) {
   if (wnd) {
     EnterCriticalSection(&cs);
     RECT * rect = NULL;
     if (crop_viewport && _viewport_set)
       rect = &_viewport;
-    CapturedImage image(wnd, type, rect);
+    const CapturedImage * base = NULL;
+    if (dirty) {
+      POSITION pos = _captured_images.GetTailPosition();
+      while (pos && !base) {
+        CapturedImage& previous = _captured_images.GetPrev(pos);
+        if (previous._type == type)
+          base = &previous;
+      }
+    }
+    CapturedImage image(wnd, type, rect, base, dirty);
     _captured_images.AddTail(image);
     LeaveCriticalSection(&cs);
   }
@@ -115,6 +130,44 @@ bool ScreenCapture::GetImage(CapturedImage::TYPE type, CxImage& image) {
   return ret;
 }
 
+/*-----------------------------------------------------------------------------
+  See if the last two images of the requested type differ (ignoring the
+  margins where scroll bars and the resize grip live)
+-----------------------------------------------------------------------------*/
+bool ScreenCapture::FrameChanged(CapturedImage::TYPE type) {
+  bool changed = false;
+  CxImage images[2];
+  int count = 0;
+  EnterCriticalSection(&cs);
+  POSITION pos = _captured_images.GetTailPosition();
+  while (pos && count < 2) {
+    CapturedImage& captured_image = _captured_images.GetPrev(pos);
+    if (captured_image._type == type) {
+      if (!captured_image.Get(images[count]))
+        break;
+      count++;
+    }
+  }
+  LeaveCriticalSection(&cs);
+
+  if (count == 2 &&
+      images[0].GetWidth() == images[1].GetWidth() &&
+      images[0].GetHeight() == images[1].GetHeight() &&
+      images[0].GetBpp() == images[1].GetBpp() && images[0].GetBpp() >= 8) {
+    AnalysisBitmap current(images[0].GetBits(), images[0].GetWidth(),
+                           images[0].GetHeight(), images[0].GetEffWidth(),
+                           images[0].GetBpp() / 8);
+    AnalysisBitmap previous(images[1].GetBits(), images[1].GetWidth(),
+                            images[1].GetHeight(), images[1].GetEffWidth(),
+                            images[1].GetBpp() / 8);
+    changed = BitmapsDiffer(current, previous, FRAME_RIGHT_MARGIN,
+                            FRAME_BOTTOM_MARGIN);
+  } else if (count == 2) {
+    changed = true;
+  }
+  return changed;
+}
+
 /*-----------------------------------------------------------------------------
 -----------------------------------------------------------------------------*/
 void ScreenCapture::Lock() {
@@ -147,6 +200,30 @@ bool ScreenCapture::IsViewportSet() {
   return _viewport_set;
 }
 
+/*-----------------------------------------------------------------------------
+  Convert a rectangle in screen coordinates to coordinates relative to the
+  captured area (the viewport if one is set), clipped to that area.
+  Returns false if none of it is visible in the capture.
+-----------------------------------------------------------------------------*/
+bool ScreenCapture::ClipToCapture(HWND wnd, RECT& rect) {
+  bool visible = false;
+  RECT window_rect;
+  if (wnd && GetWindowRect(wnd, &window_rect)) {
+    RECT bounds;
+    if (_viewport_set)
+      bounds = _viewport;
+    else
+      SetRect(&bounds, 0, 0, window_rect.right - window_rect.left,
+              window_rect.bottom - window_rect.top);
+    OffsetRect(&rect, -window_rect.left, -window_rect.top);
+    if (IntersectRect(&rect, &rect, &bounds)) {
+      OffsetRect(&rect, -bounds.left, -bounds.top);
+      visible = true;
+    }
+  }
+  return visible;
+}
+
 /*-----------------------------------------------------------------------------
 -----------------------------------------------------------------------------*/
 CapturedImage::CapturedImage():_bitmap_handle(NULL), _type(UNKNOWN) {
@@ -155,7 +232,8 @@ CapturedImage::CapturedImage():_bitmap_handle(NULL), _type(UNKNOWN) {
 
 /*-----------------------------------------------------------------------------
 -----------------------------------------------------------------------------*/
-CapturedImage::CapturedImage(HWND wnd, TYPE type, RECT * rect):
+CapturedImage::CapturedImage(HWND wnd, TYPE type, RECT * rect,
+                             const CapturedImage * base, RECT * dirty):
   _bitmap_handle(NULL)
   , _type(UNKNOWN) {
   _capture_time.QuadPart = 0;
@@ -184,7 +262,31 @@ CapturedImage::CapturedImage(HWND wnd, TYPE type, RECT * rect):
             _type = type;
 
             HBITMAP hOriginal = (HBITMAP)SelectObject(dc, _bitmap_handle);
-            BitBlt(dc, 0, 0, width, height, src, left, top,SRCCOPY|CAPTUREBLT);
+            RECT area = {0, 0, width, height};
+            BITMAP base_info;
+            if (base && dirty && base->_bitmap_handle &&
+                GetObject(base->_bitmap_handle, sizeof(base_info), &base_info)
+                && base_info.bmWidth == width
+                && base_info.bmHeight == height
+                && IntersectRect(&area, &area, dirty)) {
+              // start from the previous frame (a memory copy) and only read
+              // the region that was painted back from the screen
+              HDC base_dc = CreateCompatibleDC(src);
+              if (base_dc) {
+                HBITMAP base_original =
+                    (HBITMAP)SelectObject(base_dc, base->_bitmap_handle);
+                BitBlt(dc, 0, 0, width, height, base_dc, 0, 0, SRCCOPY);
+                SelectObject(base_dc, base_original);
+                DeleteDC(base_dc);
+              } else {
+                SetRect(&area, 0, 0, width, height);
+              }
+            } else {
+              SetRect(&area, 0, 0, width, height);
+            }
+            BitBlt(dc, area.left, area.top, area.right - area.left,
+                   area.bottom - area.top, src, left + area.left,
+                   top + area.top, SRCCOPY|CAPTUREBLT);
 
             SelectObject(dc, hOriginal);
           }
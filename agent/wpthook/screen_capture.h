@@ -44,7 +44,8 @@ public:
 
   CapturedImage();
   CapturedImage(const CapturedImage& src){*this = src;}
-  CapturedImage(HWND wnd, TYPE type = UNKNOWN, RECT * rect = NULL);
+  CapturedImage(HWND wnd, TYPE type = UNKNOWN, RECT * rect = NULL,
+                const CapturedImage * base = NULL, RECT * dirty = NULL);
   ~CapturedImage();
   const CapturedImage& operator =(const CapturedImage& src);
   void Free();
@@ -59,17 +60,20 @@ class ScreenCapture {
 public:
   ScreenCapture();
   ~ScreenCapture(void);
-  void Capture(HWND wnd, CapturedImage::TYPE type, bool crop_viewport = true);
+  void Capture(HWND wnd, CapturedImage::TYPE type, bool crop_viewport = true,
+               RECT * dirty = NULL);
   CapturedImage CaptureImage(HWND wnd, 
                     CapturedImage::TYPE type = CapturedImage::UNKNOWN,
                     bool crop_viewport = true);
   bool GetImage(CapturedImage::TYPE type, CxImage& image);
+  bool FrameChanged(CapturedImage::TYPE type);
   void Lock();
   void Unlock();
   void Reset();
   void SetViewport(RECT& viewport);
   void ClearViewport();
   bool IsViewportSet();
+  bool ClipToCapture(HWND wnd, RECT& rect);
 
   CAtlList<CapturedImage> _captured_images;
   RECT _viewport;
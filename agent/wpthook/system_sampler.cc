@@ -0,0 +1,400 @@
+/******************************************************************************
+Copyright (c) 2013, Google Inc.
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without 
+modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice, 
+      this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+    * Neither the name of the <ORGANIZATION> nor the names of its contributors 
+    may be used to endorse or promote products derived from this software 
+    without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE 
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE 
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL 
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR 
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER 
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, 
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE 
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+******************************************************************************/
+
+#include "StdAfx.h"
+#include "system_sampler.h"
+#include "result_writer.h"
+#include "test_state.h"
+
+static const DWORD SAMPLE_INTERVAL = 10;
+static const DWORD SAMPLE_CAPACITY = 12000;          // 2 minutes at 10ms
+static const ULONG SNAPSHOT_SIZE = 256 * 1024;
+static const ULONG SNAPSHOT_GROWTH = 64 * 1024;
+static const DWORD STOP_TIMEOUT = 1000;
+
+// NtQuerySystemInformation(SystemProcessInformation) layout
+static const int  SYSTEM_PROCESS_INFORMATION_CLASS = 5;
+static const LONG STATUS_INFO_LENGTH_MISMATCH_CODE = (LONG)0xC0000004L;
+
+typedef struct {
+  LARGE_INTEGER KernelTime;
+  LARGE_INTEGER UserTime;
+  LARGE_INTEGER CreateTime;
+  ULONG         WaitTime;
+  PVOID         StartAddress;
+  HANDLE        UniqueProcess;
+  HANDLE        UniqueThread;
+  LONG          Priority;
+  LONG          BasePriority;
+  ULONG         ContextSwitches;
+  ULONG         ThreadState;
+  ULONG         WaitReason;
+} SAMPLER_THREAD_INFO;
+
+typedef struct {
+  ULONG         NextEntryOffset;
+  ULONG         NumberOfThreads;
+  LARGE_INTEGER WorkingSetPrivateSize;
+  ULONG         HardFaultCount;
+  ULONG         NumberOfThreadsHighWatermark;
+  ULONGLONG     CycleTime;
+  LARGE_INTEGER CreateTime;
+  LARGE_INTEGER UserTime;
+  LARGE_INTEGER KernelTime;
+  USHORT        ImageNameLength;
+  USHORT        ImageNameMaximumLength;
+  PWSTR         ImageNameBuffer;
+  LONG          BasePriority;
+  HANDLE        UniqueProcessId;
+  HANDLE        InheritedFromUniqueProcessId;
+  ULONG         HandleCount;
+  ULONG         SessionId;
+  ULONG_PTR     UniqueProcessKey;
+  SIZE_T        PeakVirtualSize;
+  SIZE_T        VirtualSize;
+  ULONG         PageFaultCount;
+  SIZE_T        PeakWorkingSetSize;
+  SIZE_T        WorkingSetSize;
+  SIZE_T        QuotaPeakPagedPoolUsage;
+  SIZE_T        QuotaPagedPoolUsage;
+  SIZE_T        QuotaPeakNonPagedPoolUsage;
+  SIZE_T        QuotaNonPagedPoolUsage;
+  SIZE_T        PagefileUsage;
+  SIZE_T        PeakPagefileUsage;
+  SIZE_T        PrivatePageCount;
+  LARGE_INTEGER ReadOperationCount;
+  LARGE_INTEGER WriteOperationCount;
+  LARGE_INTEGER OtherOperationCount;
+  LARGE_INTEGER ReadTransferCount;
+  LARGE_INTEGER WriteTransferCount;
+  LARGE_INTEGER OtherTransferCount;
+  SAMPLER_THREAD_INFO Threads[1];
+} SAMPLER_PROCESS_INFO;
+
+typedef LONG (WINAPI * PFN_NTQUERYSYSTEMINFORMATION)(int, PVOID, ULONG,
+                                                     PULONG);
+
+/*-----------------------------------------------------------------------------
+-----------------------------------------------------------------------------*/
+static unsigned __stdcall SamplerThreadProc(void* arg) {
+  SystemSampler * sampler = (SystemSampler *)arg;
+  if (sampler)
+    sampler->ThreadProc();
+  return 0;
+}
+
+/*-----------------------------------------------------------------------------
+-----------------------------------------------------------------------------*/
+SystemSampler::SystemSampler(void):
+  thread_(NULL)
+  ,ms_frequency_(1)
+  ,samples_(NULL)
+  ,capacity_(0)
+  ,head_(0)
+  ,count_(0)
+  ,dropped_(0)
+  ,snapshot_(NULL)
+  ,snapshot_size_(0)
+  ,samples_taken_(0)
+  ,sample_time_(0)
+  ,thread_cpu_100ns_(0) {
+  InitializeCriticalSection(&cs_);
+  stop_event_ = CreateEvent(NULL, TRUE, FALSE, NULL);
+  TCHAR file_name[MAX_PATH];
+  if (GetModuleFileName(NULL, file_name, _countof(file_name)))
+    exe_ = PathFindFileName(file_name);
+}
+
+/*-----------------------------------------------------------------------------
+-----------------------------------------------------------------------------*/
+SystemSampler::~SystemSampler(void) {
+  Stop();
+  if (stop_event_)
+    CloseHandle(stop_event_);
+  delete [] samples_;
+  if (snapshot_)
+    free(snapshot_);
+  DeleteCriticalSection(&cs_);
+}
+
+/*-----------------------------------------------------------------------------
+  Start a fresh time series (the buffers are allocated on the first start
+  and re-used after that).
+-----------------------------------------------------------------------------*/
+void SystemSampler::Start(LONGLONG ms_frequency) {
+  if (thread_ || !stop_event_ || exe_.IsEmpty())
+    return;
+  EnterCriticalSection(&cs_);
+  ms_frequency_ = ms_frequency > 0 ? ms_frequency : 1;
+  if (!samples_) {
+    samples_ = new SystemSample[SAMPLE_CAPACITY];
+    capacity_ = SAMPLE_CAPACITY;
+  }
+  head_ = 0;
+  count_ = 0;
+  dropped_ = 0;
+  samples_taken_ = 0;
+  sample_time_ = 0;
+  thread_cpu_100ns_ = 0;
+  LeaveCriticalSection(&cs_);
+  if (!snapshot_) {
+    snapshot_ = (BYTE *)malloc(SNAPSHOT_SIZE);
+    snapshot_size_ = snapshot_ ? SNAPSHOT_SIZE : 0;
+  }
+  process_state_.RemoveAll();
+  ResetEvent(stop_event_);
+  thread_ = (HANDLE)_beginthreadex(0, 0, ::SamplerThreadProc, this, 0, 0);
+}
+
+/*-----------------------------------------------------------------------------
+-----------------------------------------------------------------------------*/
+void SystemSampler::Stop(void) {
+  if (thread_) {
+    SetEvent(stop_event_);
+    WaitForSingleObject(thread_, STOP_TIMEOUT);
+    FILETIME create_time, exit_time, kernel_time, user_time;
+    if (GetThreadTimes(thread_, &create_time, &exit_time, &kernel_time,
+                       &user_time)) {
+      ULARGE_INTEGER k, u;
+      k.LowPart = kernel_time.dwLowDateTime;
+      k.HighPart = kernel_time.dwHighDateTime;
+      u.LowPart = user_time.dwLowDateTime;
+      u.HighPart = user_time.dwHighDateTime;
+      EnterCriticalSection(&cs_);
+      thread_cpu_100ns_ = (LONGLONG)(k.QuadPart + u.QuadPart);
+      LeaveCriticalSection(&cs_);
+    }
+    CloseHandle(thread_);
+    thread_ = NULL;
+  }
+}
+
+/*-----------------------------------------------------------------------------
+  Sampling loop (runs on the sampler thread).
+-----------------------------------------------------------------------------*/
+void SystemSampler::ThreadProc(void) {
+  timeBeginPeriod(1);
+  SystemSample sample;
+  do {
+    LARGE_INTEGER start, end;
+    QueryPerformanceCounter(&start);
+    bool ok = Sample(sample);
+    QueryPerformanceCounter(&end);
+    EnterCriticalSection(&cs_);
+    if (ok) {
+      if (count_ < capacity_) {
+        samples_[(head_ + count_) % capacity_] = sample;
+        count_++;
+      } else {
+        samples_[head_] = sample;
+        head_ = (head_ + 1) % capacity_;
+        dropped_++;
+      }
+    }
+    samples_taken_++;
+    sample_time_ += end.QuadPart - start.QuadPart;
+    LeaveCriticalSection(&cs_);
+  } while (WaitForSingleObject(stop_event_, SAMPLE_INTERVAL) == WAIT_TIMEOUT);
+  timeEndPeriod(1);
+}
+
+/*-----------------------------------------------------------------------------
+  Take one snapshot of all of the browser processes.
+-----------------------------------------------------------------------------*/
+bool SystemSampler::Sample(SystemSample& sample) {
+  static PFN_NTQUERYSYSTEMINFORMATION query =
+      (PFN_NTQUERYSYSTEMINFORMATION)GetProcAddress(
+          GetModuleHandle(_T("ntdll.dll")), "NtQuerySystemInformation");
+  if (!query || !snapshot_)
+    return false;
+
+  ULONG len = 0;
+  LONG status = query(SYSTEM_PROCESS_INFORMATION_CLASS, snapshot_,
+                      snapshot_size_, &len);
+  while (status == STATUS_INFO_LENGTH_MISMATCH_CODE) {
+    ULONG size = max(len, snapshot_size_) + SNAPSHOT_GROWTH;
+    BYTE * buff = (BYTE *)realloc(snapshot_, size);
+    if (!buff)
+      return false;
+    snapshot_ = buff;
+    snapshot_size_ = size;
+    status = query(SYSTEM_PROCESS_INFORMATION_CLASS, snapshot_,
+                   snapshot_size_, &len);
+  }
+  if (status < 0)
+    return false;
+
+  LARGE_INTEGER now;
+  QueryPerformanceCounter(&now);
+  sample.time = now.QuadPart;
+  sample.process_count = 0;
+  CT2W exe(exe_);
+  size_t exe_len = wcslen(exe);
+  BYTE * pos = snapshot_;
+  while (pos && sample.process_count < SAMPLER_MAX_PROCESSES) {
+    SAMPLER_PROCESS_INFO * proc = (SAMPLER_PROCESS_INFO *)pos;
+    if (proc->ImageNameBuffer &&
+        proc->ImageNameLength == exe_len * sizeof(wchar_t) &&
+        !_wcsnicmp(proc->ImageNameBuffer, exe, exe_len)) {
+      DWORD pid = (DWORD)(ULONG_PTR)proc->UniqueProcessId;
+      ProcessState current;
+      current.cpu = proc->KernelTime.QuadPart + proc->UserTime.QuadPart;
+      current.page_faults = proc->PageFaultCount;
+      current.context_switches = 0;
+      current.main_thread = 0;
+      current.main_thread_cpu = 0;
+      for (ULONG i = 0; i < proc->NumberOfThreads; i++) {
+        SAMPLER_THREAD_INFO& thread = proc->Threads[i];
+        current.context_switches += thread.ContextSwitches;
+        LONGLONG thread_cpu = thread.KernelTime.QuadPart +
+                              thread.UserTime.QuadPart;
+        if (!current.main_thread || thread_cpu > current.main_thread_cpu) {
+          current.main_thread = (DWORD)(ULONG_PTR)thread.UniqueThread;
+          current.main_thread_cpu = thread_cpu;
+        }
+      }
+
+      ProcessSample& process = sample.processes[sample.process_count];
+      process.pid = pid;
+      process.working_set_kb = (DWORD)(proc->WorkingSetSize / 1024);
+      process.main_thread = current.main_thread;
+      process.cpu_us = 0;
+      process.page_faults = 0;
+      process.context_switches = 0;
+      process.main_thread_cpu_us = 0;
+      ProcessState previous;
+      if (process_state_.Lookup(pid, previous)) {
+        if (current.cpu > previous.cpu)
+          process.cpu_us = (DWORD)((current.cpu - previous.cpu) / 10);
+        process.page_faults = current.page_faults - previous.page_faults;
+        process.context_switches =
+            current.context_switches - previous.context_switches;
+        if (current.main_thread == previous.main_thread &&
+            current.main_thread_cpu > previous.main_thread_cpu)
+          process.main_thread_cpu_us = (DWORD)
+              ((current.main_thread_cpu - previous.main_thread_cpu) / 10);
+      }
+      process_state_.SetAt(pid, current);
+      sample.process_count++;
+    }
+    pos = proc->NextEntryOffset ? pos + proc->NextEntryOffset : NULL;
+  }
+  return true;
+}
+
+/*-----------------------------------------------------------------------------
+  Browser memory and process count from the most recent sample.
+-----------------------------------------------------------------------------*/
+bool SystemSampler::GetLatest(DWORD& working_set_kb, DWORD& process_count) {
+  bool ok = false;
+  EnterCriticalSection(&cs_);
+  if (count_) {
+    SystemSample& sample = samples_[(head_ + count_ - 1) % capacity_];
+    working_set_kb = 0;
+    for (DWORD i = 0; i < sample.process_count; i++)
+      working_set_kb += sample.processes[i].working_set_kb;
+    process_count = sample.process_count;
+    ok = true;
+  }
+  LeaveCriticalSection(&cs_);
+  return ok;
+}
+
+/*-----------------------------------------------------------------------------
+  Stream the columnar time series (one row per process per sample, times in
+  ms from the test start) along with the sampler's own overhead.  Returns
+  the number of samples written (nothing is written if there are none).
+-----------------------------------------------------------------------------*/
+DWORD SystemSampler::WriteJSON(ResultWriter& out,
+                               const TestState& test_state) {
+  EnterCriticalSection(&cs_);
+  DWORD count = count_;
+  if (count) {
+    LONGLONG first = samples_[head_].time;
+    LONGLONG last = samples_[(head_ + count - 1) % capacity_].time;
+    out.Write("{");
+    out.Key("intervalMs");
+    out.Fixed(count > 1 ? (double)(last - first) /
+                          (double)ms_frequency_ / (double)(count - 1) :
+                          (double)SAMPLE_INTERVAL, 1);
+    out.Write(",");
+    out.Key("samples");
+    out.UInt(count);
+    out.Write(",");
+    out.Key("dropped");
+    out.UInt(dropped_);
+    out.Write(",");
+    out.Key("overhead");
+    out.Write("{");
+    out.Key("cpuMs");
+    out.Int(thread_cpu_100ns_ / 10000);
+    out.Write(",");
+    out.Key("sampleAvgUs");
+    out.Int(samples_taken_ ?
+            (sample_time_ * 1000 / ms_frequency_) / samples_taken_ : 0);
+    out.Write(",");
+    out.Key("sampleTotalMs");
+    out.Int(sample_time_ / ms_frequency_);
+    out.Write("},\"columns\":[\"ms\",\"pid\",\"cpuUs\",\"workingSetKB\","
+              "\"pageFaults\",\"contextSwitches\",\"mainThread\","
+              "\"mainThreadCpuUs\"],");
+    out.Key("data");
+    out.Write("[");
+    bool first_row = true;
+    for (DWORD i = 0; i < count; i++) {
+      SystemSample& sample = samples_[(head_ + i) % capacity_];
+      LARGE_INTEGER time;
+      time.QuadPart = sample.time;
+      DWORD ms = test_state.ElapsedMsFromStart(time);
+      for (DWORD p = 0; p < sample.process_count; p++) {
+        ProcessSample& process = sample.processes[p];
+        out.Write(first_row ? "[" : ",[");
+        out.UInt(ms);
+        out.Char(',');
+        out.UInt(process.pid);
+        out.Char(',');
+        out.UInt(process.cpu_us);
+        out.Char(',');
+        out.UInt(process.working_set_kb);
+        out.Char(',');
+        out.UInt(process.page_faults);
+        out.Char(',');
+        out.UInt(process.context_switches);
+        out.Char(',');
+        out.UInt(process.main_thread);
+        out.Char(',');
+        out.UInt(process.main_thread_cpu_us);
+        out.Char(']');
+        first_row = false;
+      }
+    }
+    out.Write("]}");
+  }
+  LeaveCriticalSection(&cs_);
+  return count;
+}
@@ -0,0 +1,114 @@
+/******************************************************************************
+Copyright (c) 2013, Google Inc.
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without 
+modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice, 
+      this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+    * Neither the name of the <ORGANIZATION> nor the names of its contributors 
+    may be used to endorse or promote products derived from this software 
+    without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE 
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE 
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL 
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR 
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER 
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, 
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE 
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+******************************************************************************/
+
+#pragma once
+
+class ResultWriter;
+class TestState;
+
+const DWORD SAMPLER_MAX_PROCESSES = 8;
+
+class ProcessSample {
+public:
+  DWORD pid;
+  DWORD cpu_us;               // CPU used since the previous sample
+  DWORD working_set_kb;
+  DWORD page_faults;          // since the previous sample
+  DWORD context_switches;     // since the previous sample
+  DWORD main_thread;          // busiest thread in the process
+  DWORD main_thread_cpu_us;   // since the previous sample
+};
+
+class SystemSample {
+public:
+  LONGLONG      time;
+  DWORD         process_count;
+  ProcessSample processes[SAMPLER_MAX_PROCESSES];
+};
+
+/*-----------------------------------------------------------------------------
+  Samples the browser processes on a dedicated thread at a fixed interval
+  (10ms, the thread raises the timer resolution itself since the default
+  15.6ms tick would quietly stretch it) into a ring buffer that is allocated before sampling starts.
+  Everything comes from a single NtQuerySystemInformation snapshot per
+  sample: per-process CPU, working set and page faults and per-thread CPU
+  and context switches.  The busiest thread of each process is reported
+  on its own (for a renderer that is the main thread) so main-thread
+  saturation can be lined up with the waterfall.
+
+  If the test runs longer than the buffer the oldest samples are dropped.
+  The sampler keeps track of its own CPU and wall-clock cost and reports
+  the interval it actually achieved.  It only runs when the test asks for
+  it (processSamples=1).
+-----------------------------------------------------------------------------*/
+class SystemSampler {
+public:
+  SystemSampler(void);
+  ~SystemSampler(void);
+
+  void  Start(LONGLONG ms_frequency);
+  void  Stop(void);
+  bool  GetLatest(DWORD& working_set_kb, DWORD& process_count);
+  DWORD WriteJSON(ResultWriter& out, const TestState& test_state);
+  void  ThreadProc(void);
+
+private:
+  class ProcessState {
+  public:
+    LONGLONG  cpu;
+    DWORD     page_faults;
+    DWORD     context_switches;
+    DWORD     main_thread;
+    LONGLONG  main_thread_cpu;
+  };
+
+  bool  Sample(SystemSample& sample);
+
+  CRITICAL_SECTION cs_;
+  HANDLE    thread_;
+  HANDLE    stop_event_;
+  LONGLONG  ms_frequency_;
+  CString   exe_;
+
+  // ring buffer
+  SystemSample * samples_;
+  DWORD     capacity_;
+  DWORD     head_;              // oldest sample
+  DWORD     count_;
+  DWORD     dropped_;
+
+  // snapshot buffer and previous values (only used by the sampler thread)
+  BYTE *    snapshot_;
+  ULONG     snapshot_size_;
+  CAtlMap<DWORD, ProcessState>  process_state_;
+
+  // overhead
+  DWORD     samples_taken_;
+  LONGLONG  sample_time_;       // QPC ticks spent sampling
+  LONGLONG  thread_cpu_100ns_;
+};
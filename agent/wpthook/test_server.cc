@@ -171,6 +171,10 @@ void TestServer::MongooseCallback(enum mg_event event,
                       struct mg_connection *conn,
                       const struct mg_request_info *request_info){
 
+  // bulk uploads don't need the server lock
+  if (event == MG_NEW_REQUEST && ProcessRawEvents(conn, request_info))
+    return;
+
   EnterCriticalSection(&cs);
   if (event == MG_NEW_REQUEST) {
     //OutputDebugStringA(CStringA(request_info->uri) + CStringA("?") + request_info->query_string);
@@ -179,14 +183,7 @@ void TestServer::MongooseCallback(enum mg_event event,
     WptTrace(loglevel::kFrequentEvent, _T("[wpthook] HTTP Query String: %s\n"), 
                     (LPCTSTR)CA2T(request_info->query_string));
 
-    if (strcmp(request_info->uri, "/event/trace_netlog") == 0) {
-      if (test_state_._active) {
-        CStringA body = CT2A(GetPostBody(conn, request_info));
-        if (body.GetLength())
-          trace_netlog_.AddEvents(body);
-      }
-      SendResponse(conn, request_info, RESPONSE_OK, RESPONSE_OK_STR, "");
-    } else if (strcmp(request_info->uri, "/event/request_data") == 0) {
+    if (strcmp(request_info->uri, "/event/request_data") == 0) {
       if (test_state_._active) {
         test_state_.ActivityDetected();
         CString body = GetPostBody(conn, request_info);
@@ -348,16 +345,6 @@ void TestServer::MongooseCallback(enum mg_event event,
           dom_count)
         test_state_._dom_element_count = dom_count;
       SendResponse(conn, request_info, RESPONSE_OK, RESPONSE_OK_STR, "");
-    } else if (strcmp(request_info->uri, "/event/devTools") == 0) {
-      CStringA body = CT2A(GetPostBody(conn, request_info));
-      if (body.GetLength())
-        dev_tools_.AddRawEvents(body);
-      SendResponse(conn, request_info, RESPONSE_OK, RESPONSE_OK_STR, "");
-    } else if (strcmp(request_info->uri, "/event/trace") == 0) {
-      CStringA body = CT2A(GetPostBody(conn, request_info));
-      if (body.GetLength())
-        trace_.AddEvents(body);
-      SendResponse(conn, request_info, RESPONSE_OK, RESPONSE_OK_STR, "");
     } else if (strcmp(request_info->uri, "/event/paint") == 0) {
       //test_state_.PaintEvent(0, 0, 0, 0);
       SendResponse(conn, request_info, RESPONSE_OK, RESPONSE_OK_STR, "");
@@ -531,6 +518,21 @@ CString TestServer::GetUnescapedParam(const CString query_string,
   return value;
 }
 
+/*-----------------------------------------------------------------------------
+  Read exactly len bytes of the request body
+-----------------------------------------------------------------------------*/
+static bool ReadContent(void * context, char * buff, size_t len) {
+  struct mg_connection *conn = (struct mg_connection *)context;
+  while (len) {
+    int bytes = mg_read(conn, buff, len);
+    if (bytes <= 0 || (size_t)bytes > len)
+      return false;
+    buff += bytes;
+    len -= bytes;
+  }
+  return true;
+}
+
 /*-----------------------------------------------------------------------------
   Process the body of a post and return it as a string
 -----------------------------------------------------------------------------*/
@@ -540,25 +542,57 @@ CString TestServer::GetPostBody(struct mg_connection *conn,
   const char * length_string = mg_get_header(conn, "Content-Length");
   if (length_string) {
     int length = atoi(length_string);
-    if (length) {
-      char * buff = (char *)malloc(length + 1);
-      if (buff) {
-        while (length) {
-          int bytes = mg_read(conn, buff, length);
-          if (bytes && bytes <= length) {
-            buff[bytes] = 0;
-            body += CA2T(buff, CP_UTF8);
-            length -= bytes;
-          }
-        }
-        free(buff);
-      }
+    if (length > 0) {
+      // convert all at once so multi-byte characters can't get split
+      CStringA raw;
+      char * buff = raw.GetBuffer(length);
+      bool ok = ReadContent(conn, buff, length);
+      raw.ReleaseBuffer(ok ? length : 0);
+      if (ok)
+        body = CA2T(raw, CP_UTF8);
     }
   }
 
   return body;
 }
 
+/*-----------------------------------------------------------------------------
+  Read the body of a post straight into an event store, inflating it on
+  the way if the extension gzipped it.  Returns the number of bytes stored.
+-----------------------------------------------------------------------------*/
+size_t TestServer::ReadPostBody(struct mg_connection *conn,
+                                RawEvents& events) {
+  const char * length_string = mg_get_header(conn, "Content-Length");
+  const char * encoding = mg_get_header(conn, "Content-Encoding");
+  size_t length = length_string ? (size_t)_atoi64(length_string) : 0;
+  bool gzip = encoding && !_stricmp(encoding, "gzip");
+  return events.Read(length, gzip, ReadContent, conn);
+}
+
+/*-----------------------------------------------------------------------------
+  Trace and dev tools uploads can be many megabytes.  They go straight into
+  their stores (which have their own locks) without holding the server
+  lock so the other requests aren't stuck behind them.
+-----------------------------------------------------------------------------*/
+bool TestServer::ProcessRawEvents(struct mg_connection *conn,
+                              const struct mg_request_info *request_info) {
+  bool handled = true;
+  if (strcmp(request_info->uri, "/event/trace_netlog") == 0) {
+    if (test_state_._active)
+      ReadPostBody(conn, trace_netlog_.Events());
+  } else if (strcmp(request_info->uri, "/event/devTools") == 0) {
+    if (ReadPostBody(conn, dev_tools_.Raw()))
+      dev_tools_.UseRawEvents();
+  } else if (strcmp(request_info->uri, "/event/trace") == 0) {
+    ReadPostBody(conn, trace_.Events());
+  } else {
+    handled = false;
+  }
+  if (handled)
+    SendResponse(conn, request_info, RESPONSE_OK, RESPONSE_OK_STR, "");
+  return handled;
+}
+
 bool TestServer::OkToStart() {
   if (!started_) {
     LARGE_INTEGER now;
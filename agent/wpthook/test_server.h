@@ -33,6 +33,7 @@ class WptTestHook;
 class TestState;
 class Requests;
 class DevTools;
+class RawEvents;
 class Trace;
 
 class TestServer {
@@ -81,6 +82,9 @@ private:
                              const CString key) const;
   CString GetPostBody(struct mg_connection *conn,
                       const struct mg_request_info *request_info);
+  size_t ReadPostBody(struct mg_connection *conn, RawEvents& events);
+  bool ProcessRawEvents(struct mg_connection *conn,
+                        const struct mg_request_info *request_info);
   bool OkToStart();
 
   void SaveResults();
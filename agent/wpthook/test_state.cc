@@ -28,8 +28,10 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #include "StdAfx.h"
 #include "test_state.h"
+#include "result_writer.h"
 #include "results.h"
 #include "screen_capture.h"
+#include "requests.h"
 #include "shared_mem.h"
 #include "../wptdriver/util.h"
 #include "cximage/ximage.h"
@@ -40,8 +42,8 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include "trace.h"
 
 static const DWORD ON_LOAD_GRACE_PERIOD = 100;
-static const DWORD SCREEN_CAPTURE_INCREMENTS = 200;
 static const DWORD DATA_COLLECTION_INTERVAL = 100;
+static const DWORD VIDEO_TIMER_INTERVAL = 1000;
 static const DWORD START_RENDER_MARGIN = 30;
 static const DWORD MS_IN_SEC = 1000;
 static const DWORD SCRIPT_TIMEOUT_MULTIPLIER = 10;
@@ -51,16 +53,18 @@ static const DWORD RESPONSIVE_BROWSER_WIDTH = 480;
 -----------------------------------------------------------------------------*/
 TestState::TestState(Results& results, ScreenCapture& screen_capture, 
                       WptTestHook &test, DevTools& dev_tools, Trace& trace,
-                      Trace& trace_netlog):
+                      Trace& trace_netlog, Requests& requests):
   _results(results)
   ,_screen_capture(screen_capture)
   ,_frame_window(NULL)
   ,_exit(false)
   ,_data_timer(NULL)
+  ,video_timer_(NULL)
   ,_test(test)
   ,_dev_tools(dev_tools)
   ,_trace(trace)
   ,_trace_netlog(trace_netlog)
+  ,requests_(requests)
   ,no_gdi_(false)
   ,gdi_only_(false)
   ,navigated_(false)
@@ -103,6 +107,7 @@ void TestState::Reset(bool cascade) {
   _dom_element_count = 0;
   _is_responsive = -1;
   _viewport_specified = -1;
+  completion_.Reset(_ms_frequency.QuadPart, _test._activity_timeout);
   if (cascade && _test._combine_steps) {
     LARGE_INTEGER now;
     QueryPerformanceCounter(&now);
@@ -120,7 +125,7 @@ void TestState::Reset(bool cascade) {
     _bytes_out = 0;
     _last_bytes_in = 0;
     _last_data.QuadPart = 0;
-    _video_capture_count = 0;
+    capture_scheduler_.Reset(_ms_frequency.QuadPart);
     _start.QuadPart = 0;
     _on_load.QuadPart = 0;
     _dom_content_loaded_event_start = 0;
@@ -134,7 +139,6 @@ void TestState::Reset(bool cascade) {
     _first_activity.QuadPart = 0;
     _last_activity.QuadPart = 0;
     _first_byte.QuadPart = 0;
-    _last_video_time.QuadPart = 0;
     _last_cpu_idle.QuadPart = 0;
     _last_cpu_kernel.QuadPart = 0;
     _last_cpu_user.QuadPart = 0;
@@ -167,6 +171,13 @@ void __stdcall CollectData(PVOID lpParameter, BOOLEAN TimerOrWaitFired) {
     ((TestState *)lpParameter)->CollectData();
 }
 
+/*-----------------------------------------------------------------------------
+-----------------------------------------------------------------------------*/
+void __stdcall CaptureVideo(PVOID lpParameter, BOOLEAN TimerOrWaitFired) {
+  if( lpParameter )
+    ((TestState *)lpParameter)->CaptureVideo();
+}
+
 /*-----------------------------------------------------------------------------
 -----------------------------------------------------------------------------*/
 void TestState::Start() {
@@ -198,22 +209,39 @@ void TestState::Start() {
       received_data_ = true;
       
     timeBeginPeriod(1);
+    if (_test._process_samples)
+      system_sampler_.Start(_ms_frequency.QuadPart);
     CreateTimerQueueTimer(&_data_timer, NULL, ::CollectData, this, 
         DATA_COLLECTION_INTERVAL, DATA_COLLECTION_INTERVAL, WT_EXECUTEDEFAULT);
   }
+  if (!video_timer_) {
+    // paints move this timer up so they are captured without waiting for
+    // the next data collection interval
+    CreateTimerQueueTimer(&video_timer_, NULL, ::CaptureVideo, this,
+        VIDEO_TIMER_INTERVAL, VIDEO_TIMER_INTERVAL, WT_EXECUTEDEFAULT);
+    capture_scheduler_.AttachTimer(video_timer_, VIDEO_TIMER_INTERVAL);
+  }
   GrabVideoFrame(true);
   CollectData();
 }
 
 /*-----------------------------------------------------------------------------
 -----------------------------------------------------------------------------*/
-void TestState::ActivityDetected() {
+void TestState::ActivityDetected(Request * request) {
   if (_active) {
     WptTrace(loglevel::kFunction,
              _T("[wpthook] TestState::ActivityDetected()\n"));
-    QueryPerformanceCounter(&_last_activity);
-    if (!_first_activity.QuadPart)
-      _first_activity.QuadPart = _last_activity.QuadPart;
+    // traffic on websockets, event streams and ignored beacons doesn't
+    // keep the test running
+    if (request && request->IsLongLived()) {
+      completion_.Ignored();
+    } else {
+      QueryPerformanceCounter(&_last_activity);
+      if (!_first_activity.QuadPart)
+        _first_activity.QuadPart = _last_activity.QuadPart;
+      completion_.Busy(CompletionDetector::NETWORK,
+                       _last_activity.QuadPart);
+    }
   }
 }
 
@@ -335,6 +363,7 @@ bool TestState::IsDone() {
   DWORD test_ms = ElapsedMs(_step_start, now);
   if (_active) {
     bool is_page_done = false;
+    bool is_adaptive = false;
     CString done_reason;
     DWORD navigated = navigated_ ? 1 : 0;
     DWORD navigating = navigating_ ? 1 : 0;
@@ -365,12 +394,27 @@ bool TestState::IsDone() {
                test_ms, load_ms, inactive_ms, _test._measurement_timeout,
                navigating, navigated);
       
+      bool is_settled = false;
+      if (is_loaded) {
+        if (requests_.GetPendingCount() > 0)
+          completion_.Busy(CompletionDetector::REQUESTS, now.QuadPart);
+        is_settled = completion_.IsComplete(
+            _on_load.QuadPart ? _on_load.QuadPart : now.QuadPart,
+            now.QuadPart);
+      }
+
       if (_test_result) {
         is_page_done = true;
         done_reason = _T("Page Error");
       } else if (is_loaded && _test._doc_complete) {
         is_page_done = true;
         done_reason = _T("Stop at document complete (i.e. onload).");
+      } else if (is_loaded && _test._adaptive_done && is_settled) {
+        // Network, outstanding requests, rendering and CPU have all been
+        // quiet for their own windows since onload.
+        is_page_done = true;
+        is_adaptive = true;
+        done_reason = _T("Page settled (network, requests, visual and cpu).");
       } else if (is_loaded && inactive_ms > _test._activity_timeout) {
         // This is the default done criteria: onload is done and at least
         // 2 more seconds have elapsed since the last network activity.
@@ -386,6 +430,7 @@ bool TestState::IsDone() {
       WptTrace(loglevel::kFrequentEvent,
                 _T("[wpthook] - TestState::IsDone() -> true; %s"),
                 done_reason);
+      completion_.Finish(now.QuadPart, done_reason, is_adaptive);
       Done();
       is_done = true;
     }
@@ -403,9 +448,15 @@ void TestState::Done(bool force) {
 
     if (force || !_test._combine_steps) {
       // kill the timer that was collecting periodic data (cpu, video, etc)
+      if (video_timer_) {
+        capture_scheduler_.AttachTimer(NULL, 0);
+        DeleteTimerQueueTimer(NULL, video_timer_, NULL);
+        video_timer_ = NULL;
+      }
       if (_data_timer) {
         DeleteTimerQueueTimer(NULL, _data_timer, NULL);
         _data_timer = NULL;
+        system_sampler_.Stop();
         timeEndPeriod(1);
       }
     }
@@ -494,36 +545,93 @@ void TestState::UpdateBrowserWindow() {
 }
 
 /*-----------------------------------------------------------------------------
-    Grab a video frame if it is appropriate
+    Grab a video frame if it is appropriate (the capture scheduler decides
+    based on the paints it has seen)
 -----------------------------------------------------------------------------*/
 void TestState::GrabVideoFrame(bool force) {
   if (!_test._useHawk && _active && _frame_window && (force || received_data_)) {
-    // use a falloff on the resolution with which we capture video
-    bool grab_video = false;
     LARGE_INTEGER now;
     QueryPerformanceCounter(&now);
-    if (!_last_video_time.QuadPart || _test._continuous_video) {
-      grab_video = true;
-    } else {
-      DWORD interval = DATA_COLLECTION_INTERVAL;
-      if (_video_capture_count > SCREEN_CAPTURE_INCREMENTS * 2)
-        interval *= 20;
-      else if (_video_capture_count > SCREEN_CAPTURE_INCREMENTS)
-        interval *= 5;
-      LARGE_INTEGER min_time;
-      min_time.QuadPart = _last_video_time.QuadPart + 
-                            (interval * _ms_frequency.QuadPart);
-      if (now.QuadPart >= min_time.QuadPart)
-        grab_video = true;
+    RECT dirty;
+    bool full = true;
+    LONGLONG paint_time = 0;
+    bool due = capture_scheduler_.CaptureDue(now.QuadPart, dirty, full,
+                                             paint_time);
+    if (due || force || _test._continuous_video) {
+      FILETIME create_time, exit_time, kernel_start, user_start;
+      FILETIME kernel_end, user_end;
+      GetThreadTimes(GetCurrentThread(), &create_time, &exit_time,
+                     &kernel_start, &user_start);
+      _screen_capture.Capture(_frame_window, CapturedImage::VIDEO, true,
+                              (due && !full) ? &dirty : NULL);
+      GetThreadTimes(GetCurrentThread(), &create_time, &exit_time,
+                     &kernel_end, &user_end);
+      ULARGE_INTEGER ks, us, ke, ue;
+      ks.LowPart = kernel_start.dwLowDateTime;
+      ks.HighPart = kernel_start.dwHighDateTime;
+      us.LowPart = user_start.dwLowDateTime;
+      us.HighPart = user_start.dwHighDateTime;
+      ke.LowPart = kernel_end.dwLowDateTime;
+      ke.HighPart = kernel_end.dwHighDateTime;
+      ue.LowPart = user_end.dwLowDateTime;
+      ue.HighPart = user_end.dwHighDateTime;
+      capture_scheduler_.OnCapture(now.QuadPart, paint_time,
+          (LONGLONG)((ke.QuadPart - ks.QuadPart) + (ue.QuadPart - us.QuadPart)));
+      // diff the full frames once the page has loaded so the completion
+      // detector sees changes that didn't come through GDI paints
+      if (navigated_ && !navigating_ && !(due && !full) &&
+          _screen_capture.FrameChanged(CapturedImage::VIDEO))
+        completion_.Busy(CompletionDetector::VISUAL, now.QuadPart);
     }
-    if (grab_video) {
-      _last_video_time.QuadPart = now.QuadPart;
-      _video_capture_count++;
-      _screen_capture.Capture(_frame_window, CapturedImage::VIDEO);
+  }
+}
+
+/*-----------------------------------------------------------------------------
+    The browser painted part of its window (screen coordinates).  Called
+    from the GDI hooks on the browser's UI thread so it must not block on
+    _data_cs.
+-----------------------------------------------------------------------------*/
+void TestState::OnPaint(RECT rect) {
+  if (_active && received_data_ && !_test._continuous_video) {
+    HWND frame_window = _frame_window;
+    if (frame_window && _screen_capture.ClipToCapture(frame_window, rect)) {
+      LARGE_INTEGER now;
+      QueryPerformanceCounter(&now);
+      capture_scheduler_.OnPaint(rect, now.QuadPart);
+      completion_.Busy(CompletionDetector::VISUAL, now.QuadPart);
     }
   }
 }
 
+/*-----------------------------------------------------------------------------
+    Video timer (moved up by paints)
+-----------------------------------------------------------------------------*/
+void TestState::CaptureVideo() {
+  EnterCriticalSection(&_data_cs);
+  GrabVideoFrame();
+  LeaveCriticalSection(&_data_cs);
+}
+
+/*-----------------------------------------------------------------------------
+-----------------------------------------------------------------------------*/
+CStringA TestState::GetVideoStatsJSON() {
+  return capture_scheduler_.GetStatsJSON();
+}
+
+/*-----------------------------------------------------------------------------
+    High-frequency per-process samples from the system sampler
+-----------------------------------------------------------------------------*/
+DWORD TestState::WriteSystemSamplesJSON(ResultWriter& out) {
+  return system_sampler_.WriteJSON(out, *this);
+}
+
+/*-----------------------------------------------------------------------------
+    How the end of the step was decided
+-----------------------------------------------------------------------------*/
+CStringA TestState::GetCompletionJSON() {
+  return completion_.GetJSON(_step_start.QuadPart);
+}
+
 /*-----------------------------------------------------------------------------
     Collect the periodic system stats like cpu/memory/bandwidth.
 -----------------------------------------------------------------------------*/
@@ -563,6 +671,7 @@ void TestState::CollectSystemStats(LARGE_INTEGER &now) {
         int cpu_utilization = (int)((((kernel + user) - idle) * 100) 
                                       / (kernel + user));
         data._cpu = max(min(cpu_utilization, 100), 0);
+        completion_.CpuUtilization(data._cpu, now.QuadPart);
       }
     }
     _last_cpu_idle.QuadPart = i.QuadPart;
@@ -570,6 +679,9 @@ void TestState::CollectSystemStats(LARGE_INTEGER &now) {
     _last_cpu_user.QuadPart = u.QuadPart;
   }
 
+  // browser memory and process count from the sampler thread
+  system_sampler_.GetLatest(data._mem, data._process_count);
+
   if (msElapsed)
     _progress_data.AddTail(data);
 }
@@ -812,50 +924,43 @@ void TestState::SetCustomMetrics(CString custom_metrics) {
 
 /*-----------------------------------------------------------------------------
 -----------------------------------------------------------------------------*/
-CString TestState::GetConsoleLogJSON() {
-  CString ret;
+size_t TestState::WriteConsoleLogJSON(ResultWriter& out) {
   EnterCriticalSection(&_data_cs);
-  if (!_console_log_messages.IsEmpty()) {
-    ret = _T("[");
-    bool first = true;
-    POSITION pos = _console_log_messages.GetHeadPosition();
-    while (pos) {
-      CString entry = _console_log_messages.GetNext(pos);
-      if (entry.GetLength()) {
-        if (!first)
-          ret += _T(",");
-        ret += entry;
-        first = false;
-      }
-    }
-    ret += _T("]");
-  }
+  size_t count = WriteJSONArray(_console_log_messages, out);
   LeaveCriticalSection(&_data_cs);
-  return ret;
+  return count;
 }
 
 /*-----------------------------------------------------------------------------
 -----------------------------------------------------------------------------*/
-CString TestState::GetTimedEventsJSON() {
-  CString ret;
+size_t TestState::WriteTimedEventsJSON(ResultWriter& out) {
   EnterCriticalSection(&_data_cs);
-  if (!_timed_events.IsEmpty()) {
-    ret = _T("[");
-    bool first = true;
-    POSITION pos = _timed_events.GetHeadPosition();
+  size_t count = WriteJSONArray(_timed_events, out);
+  LeaveCriticalSection(&_data_cs);
+  return count;
+}
+
+/*-----------------------------------------------------------------------------
+  Stream a list of JSON entries out as an array (nothing if it is empty)
+-----------------------------------------------------------------------------*/
+size_t TestState::WriteJSONArray(CAtlList<CString>& entries,
+                                 ResultWriter& out) {
+  size_t count = 0;
+  if (!entries.IsEmpty()) {
+    out.Char('[');
+    POSITION pos = entries.GetHeadPosition();
     while (pos) {
-      CString entry = _timed_events.GetNext(pos);
+      CString& entry = entries.GetNext(pos);
       if (entry.GetLength()) {
-        if (!first)
-          ret += _T(",");
-        ret += entry;
-        first = false;
+        if (count)
+          out.Char(',');
+        out.Write(entry);
+        count++;
       }
     }
-    ret += _T("]");
+    out.Char(']');
   }
-  LeaveCriticalSection(&_data_cs);
-  return ret;
+  return count;
 }
 
 /*-----------------------------------------------------------------------------
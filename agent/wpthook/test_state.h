@@ -27,12 +27,18 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 ******************************************************************************/
 
 #pragma once
+#include "capture_scheduler.h"
+#include "completion_detector.h"
+#include "system_sampler.h"
 
 class Results;
 class ScreenCapture;
 class WptTestHook;
 class DevTools;
 class Trace;
+class ResultWriter;
+class Request;
+class Requests;
 
 const int TEST_RESULT_NO_ERROR = 0;
 const int TEST_RESULT_TIMEOUT = 99997;
@@ -84,11 +90,11 @@ class TestState {
 public:
   TestState(Results& results, ScreenCapture& screen_capture,
             WptTestHook &test, DevTools& dev_tools, Trace& trace,
-            Trace& trace_netlog);
+            Trace& trace_netlog, Requests& requests);
   ~TestState(void);
 
   void Start();
-  void ActivityDetected();
+  void ActivityDetected(Request * request = NULL);
   void OnNavigate();
   void OnNavigateComplete();
   void OnAllDOMElementsLoaded(DWORD load_time);
@@ -101,6 +107,11 @@ public:
   bool IsDone();
   void GrabVideoFrame(bool force = false);
   void GrabResultScreenshot();
+  void OnPaint(RECT rect);
+  void CaptureVideo();
+  CStringA GetVideoStatsJSON();
+  CStringA GetCompletionJSON();
+  DWORD WriteSystemSamplesJSON(ResultWriter& out);
   void CollectData();
   void Reset(bool cascade = true);
   void Init();
@@ -112,8 +123,8 @@ public:
   void AddConsoleLogMessage(CString message);
   void AddTimedEvent(CString timed_event);
   void SetCustomMetrics(CString custom_metrics);
-  CString GetConsoleLogJSON();
-  CString GetTimedEventsJSON();
+  size_t WriteConsoleLogJSON(ResultWriter& out);
+  size_t WriteTimedEventsJSON(ResultWriter& out);
   void GetElapsedCPUTimes(double &doc, double &end,
                           double &doc_total, double &end_total);
   void Lock();
@@ -193,7 +204,9 @@ private:
   DevTools &_dev_tools;
   Trace &_trace;
   Trace &_trace_netlog;
+  Requests& requests_;
   HANDLE  _data_timer;
+  HANDLE  video_timer_;
   CAtlList<CString>        _console_log_messages; // messages to the console
   CAtlList<CString>        _timed_events; // any supported timed events
   CString process_full_path_;
@@ -206,8 +219,9 @@ private:
   ULARGE_INTEGER _last_cpu_idle;
   ULARGE_INTEGER _last_cpu_kernel;
   ULARGE_INTEGER _last_cpu_user;
-  DWORD _video_capture_count;
-  LARGE_INTEGER  _last_video_time;
+  CaptureScheduler capture_scheduler_;
+  CompletionDetector completion_;
+  SystemSampler system_sampler_;
   FILETIME      _start_cpu_time;
   FILETIME      _doc_cpu_time;
   FILETIME      _end_cpu_time;
@@ -223,4 +237,5 @@ private:
   void RecordTime(CString time_name, DWORD time, LARGE_INTEGER * out_time);
   void GetCPUTime(FILETIME &cpu_time, FILETIME &total_time);
   double GetElapsedMilliseconds(FILETIME &start, FILETIME &end);
+  size_t WriteJSONArray(CAtlList<CString>& entries, ResultWriter& out);
 };
@@ -44,7 +44,7 @@ Trace::~Trace(void) {
 -----------------------------------------------------------------------------*/
 void Trace::Reset() {
   EnterCriticalSection(&cs_);
-  events_.RemoveAll();
+  events_.Reset();
   LeaveCriticalSection(&cs_);
 }
 
@@ -53,7 +53,8 @@ void Trace::Reset() {
 bool Trace::Write(CString file) {
   bool ok = false;
   EnterCriticalSection(&cs_);
-  if (!events_.IsEmpty()) {
+  size_t count = events_.GetCount();
+  if (count) {
     HANDLE file_handle = CreateFile(file, GENERIC_WRITE, 0, 0,
                                     CREATE_ALWAYS, 0, 0);
     if (file_handle != INVALID_HANDLE_VALUE) {
@@ -62,17 +63,24 @@ bool Trace::Write(CString file) {
       bool first = true;
       CStringA event_string = "{\"traceEvents\": [";
       WriteFile(file_handle, (LPCSTR)event_string, event_string.GetLength(), &bytes_written, 0);
-      POSITION pos = events_.GetHeadPosition();
-      while (pos) {
-        event_string = events_.GetNext(pos);
-        event_string.Trim("[]");
-        if (event_string.GetLength()) {
-          if (first)
-            first = false;
-          else
-            event_string = CStringA(",") + event_string;
-          WriteFile(file_handle, (LPCSTR)event_string,
-                    event_string.GetLength(), &bytes_written, 0);
+      for (size_t i = 0; i < count; i++) {
+        // each POST is an array of events, strip the brackets
+        const char * data;
+        size_t len;
+        if (events_.GetEvent(i, data, len)) {
+          while (len && (*data == '[' || *data == ']')) {
+            data++;
+            len--;
+          }
+          while (len && (data[len - 1] == '[' || data[len - 1] == ']'))
+            len--;
+          if (len) {
+            if (first)
+              first = false;
+            else
+              WriteFile(file_handle, ",", 1, &bytes_written, 0);
+            WriteFile(file_handle, data, (DWORD)len, &bytes_written, 0);
+          }
         }
       }
       event_string = "]}";
@@ -84,10 +92,3 @@ bool Trace::Write(CString file) {
   return ok;
 }
 
-/*-----------------------------------------------------------------------------
------------------------------------------------------------------------------*/
-void Trace::AddEvents(CStringA data) {
-  EnterCriticalSection(&cs_);
-  events_.AddTail(data);
-  LeaveCriticalSection(&cs_);
-}
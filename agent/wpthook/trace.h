@@ -26,6 +26,8 @@ OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
 OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 ******************************************************************************/
 #pragma once
+#include "raw_events.h"
+
 class Trace {
 public:
   Trace(void);
@@ -33,9 +35,9 @@ public:
 
   void Reset();
   bool Write(CString file);
-  void AddEvents(CStringA data);
+  RawEvents& Events(void) { return events_; }
 
 private:
   CRITICAL_SECTION cs_;
-  CAtlList<CStringA> events_;
+  RawEvents events_;
 };
@@ -43,6 +43,7 @@ TrackDns::TrackDns(TestState& test_state, WptTest& test):
   _test_state(test_state)
   , _test(test) {
   _dns_lookups.InitHashTable(257);
+  _host_addresses.InitHashTable(257);
   InitializeCriticalSection(&cs);
 }
 
@@ -87,6 +88,7 @@ void * TrackDns::LookupStart(CString& name) {
     EnterCriticalSection(&cs);
     info->_tracked = true;
     _dns_lookups.SetAt(info, info);
+    _lookup_index.Add((LPCSTR)CT2A(info->_name), info);
     LeaveCriticalSection(&cs);
   }
 
@@ -139,9 +141,11 @@ void TrackDns::LookupDone(void * context, int result) {
       EnterCriticalSection(&cs);
       DnsInfo * dns_info = NULL;
       if (_dns_lookups.Lookup(context, dns_info) && dns_info) {
-        QueryPerformanceCounter(&dns_info->_end);
+        LARGE_INTEGER now;
+        QueryPerformanceCounter(&now);
+        dns_info->end_ = now.QuadPart;
         if (!result)
-          dns_info->_success = true;
+          dns_info->success_ = true;
       }
       LeaveCriticalSection(&cs);
     }
@@ -164,12 +168,15 @@ void TrackDns::Reset() {
       delete info;
   }
   _dns_lookups.RemoveAll();
+  _lookup_index.Reset();
   _dns_hosts.RemoveAll();
   LeaveCriticalSection(&cs);
 }
 
 /*-----------------------------------------------------------------------------
   For undecoded SPDY sessions (all of them), claim with IP instead of host.
+  All of the completed lookups for the host before the given time are
+  claimed and the most recent one is returned.
 -----------------------------------------------------------------------------*/
 bool TrackDns::Claim(CString name, ULONG addr, LARGE_INTEGER before,
                      LARGE_INTEGER& start, LARGE_INTEGER& end) {
@@ -177,21 +184,8 @@ bool TrackDns::Claim(CString name, ULONG addr, LARGE_INTEGER before,
   if (!name.GetLength())
     name = GetHost(addr);
   EnterCriticalSection(&cs);
-  POSITION pos = _dns_lookups.GetStartPosition();
-  while (pos) {
-    DnsInfo * info = NULL;
-    void * key = NULL;
-    _dns_lookups.GetNextAssoc(pos, key, info);
-    if (info && !info->_accounted_for && info->_success &&
-        info->_start.QuadPart <= before.QuadPart &&
-        info->_end.QuadPart <= before.QuadPart &&
-        name == info->_name) {
-      info->_accounted_for = true;
-      is_claimed = true;
-      start = info->_start;
-      end = info->_end;
-    }
-  }
+  is_claimed = _lookup_index.Claim((LPCSTR)CT2A(name), before.QuadPart,
+                                   start.QuadPart, end.QuadPart);
   LeaveCriticalSection(&cs);
   return is_claimed;
 }
@@ -201,14 +195,7 @@ bool TrackDns::Claim(CString name, ULONG addr, LARGE_INTEGER before,
 -----------------------------------------------------------------------------*/
 void TrackDns::ClaimAll() {
   EnterCriticalSection(&cs);
-  POSITION pos = _dns_lookups.GetStartPosition();
-  while (pos) {
-    DnsInfo * info = NULL;
-    void * key = NULL;
-    _dns_lookups.GetNextAssoc(pos, key, info);
-    if (info)
-      info->_accounted_for = true;
-  }
+  _lookup_index.ClaimAll();
   LeaveCriticalSection(&cs);
 }
 
@@ -220,27 +207,17 @@ bool TrackDns::Find(CString name, DNSAddressList &addresses,
   bool found = false;
   addresses.RemoveAll();
   EnterCriticalSection(&cs);
-  POSITION pos = _dns_lookups.GetStartPosition();
-  while (pos && !found) {
-    DnsInfo * info = NULL;
-    void * key = NULL;
-    _dns_lookups.GetNextAssoc(pos, key, info);
-    if (info && info->_success && name == info->_name) {
-      found = true;
-      start = info->_start;
-      end = info->_end;
-    }
+  const DnsLookup * lookup = _lookup_index.FindSuccessful((LPCSTR)CT2A(name));
+  if (lookup) {
+    found = true;
+    start.QuadPart = lookup->start_;
+    end.QuadPart = lookup->end_;
   }
   if (found) {
-    pos = _host_addresses.GetHeadPosition();
-    bool done = false;
-    while (pos && !done) {
-      DnsHostAddresses& host_addresses = _host_addresses.GetNext(pos);
-      if (host_addresses.name_ == name) {
-        addresses.AddTailList(&host_addresses.addresses_);
-        done = true;
-      }
-    }
+    const CAtlMap<CString, DnsHostAddresses>::CPair * host_addresses =
+        _host_addresses.Lookup(name);
+    if (host_addresses)
+      addresses.AddTailList(&host_addresses->m_value.addresses_);
   }
   LeaveCriticalSection(&cs);
   return found;
@@ -252,17 +229,7 @@ bool TrackDns::Find(CString name, DNSAddressList &addresses,
 LONGLONG TrackDns::GetEarliest(LONGLONG& after) {
   LONGLONG earliest = 0;
   EnterCriticalSection(&cs);
-  POSITION pos = _dns_lookups.GetStartPosition();
-  while (pos) {
-    DnsInfo * info = NULL;
-    void * key = NULL;
-    _dns_lookups.GetNextAssoc(pos, key, info);
-    if (info && info->_start.QuadPart &&
-        info->_start.QuadPart >= after && 
-        (!earliest || info->_start.QuadPart <= earliest)) {
-      earliest = info->_start.QuadPart;
-    }
-  }
+  earliest = _lookup_index.GetEarliest(after);
   LeaveCriticalSection(&cs);
   return earliest;
 }
@@ -281,22 +248,10 @@ CString TrackDns::GetHost(ULONG addr) {
 /*-----------------------------------------------------------------------------
 -----------------------------------------------------------------------------*/
 void TrackDns::AddAddress(CString host, DWORD address) {
-  bool found = false;
   EnterCriticalSection(&cs);
-  POSITION pos = _host_addresses.GetHeadPosition();
-  while (pos && !found) {
-    DnsHostAddresses& host_addresses = _host_addresses.GetNext(pos);
-    if (host_addresses.name_ == host) {
-      host_addresses.AddAddress(address);
-      found = true;
-    }
-  }
-  if (!found) {
-    DnsHostAddresses host_addresses;
-    host_addresses.name_ = host;
-    host_addresses.AddAddress(address);
-    _host_addresses.AddTail(host_addresses);
-  }
+  DnsHostAddresses& host_addresses = _host_addresses[host];
+  host_addresses.name_ = host;
+  host_addresses.AddAddress(address);
   LeaveCriticalSection(&cs);
 }
 
@@ -304,16 +259,11 @@ void TrackDns::AddAddress(CString host, DWORD address) {
 -----------------------------------------------------------------------------*/
 int TrackDns::GetAddressCount(CString host) {
   int count = 0;
-  bool found = false;
   EnterCriticalSection(&cs);
-  POSITION pos = _host_addresses.GetHeadPosition();
-  while (pos && !found) {
-    DnsHostAddresses& host_addresses = _host_addresses.GetNext(pos);
-    if (host_addresses.name_ == host) {
-      count = host_addresses.addresses_.GetCount();
-      found = true;
-    }
-  }
+  const CAtlMap<CString, DnsHostAddresses>::CPair * host_addresses =
+      _host_addresses.Lookup(host);
+  if (host_addresses)
+    count = (int)host_addresses->m_value.addresses_.GetCount();
   LeaveCriticalSection(&cs);
   return count;
 }
@@ -27,6 +27,7 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 ******************************************************************************/
 
 #pragma once
+#include "dns_index.h"
 
 class TestState;
 class WptTest;
@@ -36,24 +37,19 @@ typedef struct {
   struct sockaddr_in	addr; 
 } ADDRINFOA_ADDR;
 
-class DnsInfo {
+class DnsInfo : public DnsLookup {
 public:
   DnsInfo(CString name):
-    _success(false)
-    , _accounted_for(false)
-    , _tracked(false)
+    _tracked(false)
     ,_name(name) {
-      QueryPerformanceCounter(&_start);
-      _end.QuadPart = 0;
+      LARGE_INTEGER now;
+      QueryPerformanceCounter(&now);
+      start_ = now.QuadPart;
       _override_addr.S_un.S_addr = 0;
   }
   ~DnsInfo(){}
 
   CString         _name;
-  LARGE_INTEGER   _start;
-  LARGE_INTEGER   _end;
-  bool            _success;
-  bool            _accounted_for;
   bool            _tracked;
   struct in_addr	_override_addr;
 };
@@ -124,11 +120,12 @@ public:
   CStringA GetCDNProvider(CString host);
 
   CAtlMap<void *, DnsInfo *>  _dns_lookups;
+  DnsLookupIndex              _lookup_index;
   CAtlMap<ULONG, CString>     _dns_hosts;
   CRITICAL_SECTION            cs;
   TestState&                  _test_state;
   WptTest&                    _test;
-  CAtlList<DnsHostAddresses>  _host_addresses;
+  CAtlMap<CString, DnsHostAddresses>  _host_addresses;
   CAtlList<CDNEntry>          _cdn_hosts;
 
 private:
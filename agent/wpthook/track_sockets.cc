@@ -31,8 +31,8 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include "track_sockets.h"
 #include "requests.h"
 #include "test_state.h"
+#include "h2_connection.h"
 #include "../wptdriver/wpt_test.h"
-#include <nghttp2/nghttp2.h>
 
 const DWORD LOCALHOST = 0x0100007F; // 127.0.0.1
 const DWORD LINK_LOCAL_MASK = 0x0000FFFF;
@@ -48,8 +48,7 @@ SocketInfo::SocketInfo():
   , _is_ssl_handshake_complete(false)
   , _local_port(0)
   , _protocol(PROTO_NOT_CHECKED)
-  , _h2_in(NULL)
-  , _h2_out(NULL) {
+  , _h2(NULL) {
   memset(&_addr, 0, sizeof(_addr));
   _connect_start.QuadPart = 0;
   _connect_end.QuadPart = 0;
@@ -60,16 +59,8 @@ SocketInfo::SocketInfo():
 /*-----------------------------------------------------------------------------
 -----------------------------------------------------------------------------*/
 SocketInfo::~SocketInfo(void) {
-  if (_h2_in) {
-    if (_h2_in->session)
-      nghttp2_session_del(_h2_in->session);
-    delete _h2_in;
-  }
-  if (_h2_out) {
-    if (_h2_out->session)
-      nghttp2_session_del(_h2_out->session);
-    delete _h2_out;
-  }
+  if (_h2)
+    delete _h2;
 }
 
 /*-----------------------------------------------------------------------------
@@ -120,8 +111,16 @@ void TrackSockets::Close(SOCKET s) {
   EnterCriticalSection(&cs);
   _openSockets.Lookup(s, socket_id);
   _openSockets.RemoveKey(s);
+  SocketInfo* info = NULL;
+  PcapPacket packet;
+  bool capture = socket_id && _test._hook_pcap &&
+                 _socketInfo.Lookup(socket_id, info) && info &&
+                 _pcap.ReserveClose(info->_pcap, packet);
   LeaveCriticalSection(&cs);
 
+  if (capture)
+    _pcap.Write(packet, NULL);
+
   if (socket_id)
     _requests.SocketClosed(socket_id);
 }
@@ -147,7 +146,9 @@ bool TrackSockets::Connect(SOCKET s, const struct sockaddr FAR * name,
     EnterCriticalSection(&cs);
     SocketInfo* info = GetSocketInfo(s, false);
     memcpy(&info->_addr, ip_name, sizeof(struct sockaddr_in));
+    LONGLONG previous = info->_connect_start.QuadPart;
     QueryPerformanceCounter(&info->_connect_start);
+    IndexConnectStart(previous, info->_connect_start.QuadPart);
     localhost = info->IsLocalhost();
     allowed = !info->IsLinkLocal();
     LeaveCriticalSection(&cs);
@@ -230,8 +231,7 @@ bool TrackSockets::ModifyDataOut(SOCKET s, DataChunk& chunk,
             !memcmp(data, HTTP2_HEADER, lstrlenA(HTTP2_HEADER))) {
           AtlTrace(_T("[%d] ********* HTTP 2 Connection detected"), socket_id);
           info->_protocol = PROTO_H2;
-          info->_h2_in = NewHttp2Session(socket_id, DATA_IN);
-          info->_h2_out = NewHttp2Session(socket_id, DATA_OUT);
+          info->_h2 = new H2Connection(*this, socket_id);
         }
 
         if (info->_protocol == PROTO_UNKNOWN) {
@@ -276,6 +276,8 @@ bool TrackSockets::ModifyDataOut(SOCKET s, DataChunk& chunk,
   and pass the data on to the request tracker
 -----------------------------------------------------------------------------*/
 void TrackSockets::DataOut(SOCKET s, DataChunk& chunk, bool is_unencrypted) {
+  PcapPacket packet;
+  bool capture = false;
   EnterCriticalSection(&cs);
   SocketInfo* info = GetSocketInfo(s);
   if (info->_connect_start.QuadPart && !info->_connect_end.QuadPart) {
@@ -283,6 +285,9 @@ void TrackSockets::DataOut(SOCKET s, DataChunk& chunk, bool is_unencrypted) {
   }
   DWORD socket_id = info->_id;
   if (!info->IsLocalhost()) {
+    if (_test._hook_pcap)
+      capture = CapturePcap(info, PCAPNG_TO_SERVER, chunk, is_unencrypted,
+                            packet);
     if (_test_state._active && !is_unencrypted) {
       _test_state._bytes_out += chunk.GetLength();
       if (!_test_state._on_load.QuadPart)
@@ -290,14 +295,8 @@ void TrackSockets::DataOut(SOCKET s, DataChunk& chunk, bool is_unencrypted) {
     }
     if (is_unencrypted || !info->_is_ssl) {
       if (info->_protocol == PROTO_H2) {
-        size_t len = chunk.GetLength();
-        const uint8_t * buff = (const uint8_t *)chunk.GetData();
-        if (buff && len && info->_h2_out && info->_h2_out->session) {
-          int r = nghttp2_session_mem_recv(info->_h2_out->session, buff, len);
-          if (r < 0) {
-            AtlTrace("nghttp2_session_mem_recv - DataOut Error %d", r);
-          }
-        }
+        if (info->_h2)
+          info->_h2->DataOut(chunk.GetData(), chunk.GetLength());
       } else {
         _requests.DataOut(socket_id, chunk);
       }
@@ -306,6 +305,9 @@ void TrackSockets::DataOut(SOCKET s, DataChunk& chunk, bool is_unencrypted) {
     }
   }
   LeaveCriticalSection(&cs);
+
+  if (capture)
+    _pcap.Write(packet, chunk.GetData());
 }
 
 /*-----------------------------------------------------------------------------
@@ -313,11 +315,19 @@ void TrackSockets::DataOut(SOCKET s, DataChunk& chunk, bool is_unencrypted) {
   and pass the data on to the request tracker
 -----------------------------------------------------------------------------*/
 void TrackSockets::DataIn(SOCKET s, DataChunk& chunk, bool is_unencrypted) {
+  PcapPacket packet;
+  bool capture = false;
   EnterCriticalSection(&cs);
   SocketInfo* info = GetSocketInfo(s);
   DWORD socket_id = info->_id;
   if (!info->IsLocalhost()) {
+    if (_test._hook_pcap)
+      capture = CapturePcap(info, PCAPNG_TO_CLIENT, chunk, is_unencrypted,
+                            packet);
     if (_test_state._active && !is_unencrypted) {
+      LARGE_INTEGER now;
+      QueryPerformanceCounter(&now);
+      info->_arrivals.AddBytes(now.QuadPart, chunk.GetLength());
       _test_state._bytes_in_bandwidth += chunk.GetLength();
       if (!_test_state.received_data_ && !IsSSLHandshake(chunk))
         _test_state.received_data_ = true;
@@ -327,14 +337,8 @@ void TrackSockets::DataIn(SOCKET s, DataChunk& chunk, bool is_unencrypted) {
     }
     if (is_unencrypted || !info->_is_ssl) {
       if (info->_protocol == PROTO_H2) {
-        size_t len = chunk.GetLength();
-        const uint8_t * buff = (const uint8_t *)chunk.GetData();
-        if (buff && len && info->_h2_in && info->_h2_in->session) {
-          int r = nghttp2_session_mem_recv(info->_h2_in->session, buff, len);
-          if (r < 0) {
-            AtlTrace("nghttp2_session_mem_recv - DataIn Error %d", r);
-          }
-        }
+        if (info->_h2)
+          info->_h2->DataIn(chunk.GetData(), chunk.GetLength());
       } else {
         _requests.DataIn(socket_id, chunk);
       }
@@ -343,6 +347,38 @@ void TrackSockets::DataIn(SOCKET s, DataChunk& chunk, bool is_unencrypted) {
     }
   }
   LeaveCriticalSection(&cs);
+
+  if (capture)
+    _pcap.Write(packet, chunk.GetData());
+}
+
+/*-----------------------------------------------------------------------------
+  Add the application data to the synthetic capture: the decrypted side of
+  TLS sockets and the raw data of everything else (skipping TLS records
+  that show up before the socket is known to be TLS).
+  Call from within the critical section, this only reserves the packets on
+  the socket's stream; write them with _pcap.Write once the critical
+  section has been released.
+-----------------------------------------------------------------------------*/
+bool TrackSockets::CapturePcap(SocketInfo* info, PCAPNG_DIRECTION direction,
+                               const DataChunk& chunk, bool is_unencrypted,
+                               PcapPacket& packet) {
+  bool ret = false;
+  if (_test_state._active && chunk.GetLength() &&
+      (is_unencrypted || (!info->_is_ssl && !IsSSLHandshake(chunk))))
+    ret = _pcap.Reserve(info->_pcap, info->_id, info->_addr,
+                        info->_local_port, is_unencrypted, direction,
+                        chunk.GetLength(), packet);
+  return ret;
+}
+
+/*-----------------------------------------------------------------------------
+  Write out the synthetic capture (and start a new one).  Called without the
+  critical section, the capture swaps its blocks out on its own and the
+  file write would stall every hooked socket call.
+-----------------------------------------------------------------------------*/
+bool TrackSockets::SavePcap(const CString& file) {
+  return _pcap.Save(file);
 }
 
 /*-----------------------------------------------------------------------------
@@ -358,10 +394,28 @@ void TrackSockets::Reset() {
       delete info;
   }
   _socketInfo.RemoveAll();
+  _connect_starts.RemoveAll();
   _ssl_sockets.RemoveAll();
   LeaveCriticalSection(&cs);
 }
 
+/*-----------------------------------------------------------------------------
+  Start of a step: sockets stay open across steps so throw away the bytes
+  that arrived during the previous one
+-----------------------------------------------------------------------------*/
+void TrackSockets::ResetArrivals() {
+  EnterCriticalSection(&cs);
+  POSITION pos = _socketInfo.GetStartPosition();
+  while (pos) {
+    DWORD id = 0;
+    SocketInfo* info = NULL;
+    _socketInfo.GetNextAssoc(pos, id, info);
+    if (info)
+      info->_arrivals.Reset();
+  }
+  LeaveCriticalSection(&cs);
+}
+
 /*-----------------------------------------------------------------------------
   Claim ownership of a connection (associate it with a request)
 -----------------------------------------------------------------------------*/
@@ -626,21 +680,46 @@ SocketInfo* TrackSockets::GetSocketInfoById(DWORD socket_id) {
 LONGLONG TrackSockets::GetEarliest(LONGLONG& after) {
   LONGLONG earliest = 0;
   EnterCriticalSection(&cs);
-  POSITION pos = _socketInfo.GetStartPosition();
-  while (pos) {
-    SocketInfo * info = NULL;
-    DWORD key = 0;
-    _socketInfo.GetNextAssoc(pos, key, info);
-    if (info && info->_connect_start.QuadPart && 
-        info->_connect_start.QuadPart >= after && 
-        (!earliest || info->_connect_start.QuadPart <= earliest)) {
-      earliest = info->_connect_start.QuadPart;
-    }
+  size_t low = 0;
+  size_t high = _connect_starts.GetCount();
+  while (low < high) {
+    size_t mid = low + (high - low) / 2;
+    if (_connect_starts[mid] < after)
+      low = mid + 1;
+    else
+      high = mid;
+  }
+  while (low < _connect_starts.GetCount() && !earliest) {
+    earliest = _connect_starts[low];
+    low++;
   }
   LeaveCriticalSection(&cs);
   return earliest;
 }
 
+/*-----------------------------------------------------------------------------
+  Keep the sorted list of connect start times up to date (replacing the
+  previous start if a socket is re-used).  Connects arrive in time order so
+  the insert normally lands at the end.  Must be called inside of the
+  critical section.
+-----------------------------------------------------------------------------*/
+void TrackSockets::IndexConnectStart(LONGLONG previous, LONGLONG start) {
+  size_t count = _connect_starts.GetCount();
+  if (previous) {
+    for (size_t i = count; i > 0; i--) {
+      if (_connect_starts[i - 1] == previous) {
+        _connect_starts.RemoveAt(i - 1);
+        count--;
+        break;
+      }
+    }
+  }
+  size_t index = count;
+  while (index && _connect_starts[index - 1] > start)
+    index--;
+  _connect_starts.InsertAt(index, start);
+}
+
 /*-----------------------------------------------------------------------------
   Return the estimated RTT for the given IPV4 server as a string
 -----------------------------------------------------------------------------*/
@@ -653,6 +732,82 @@ CStringA TrackSockets::GetRTT(DWORD ipv4_address) {
   return ret;
 }
 
+/*-----------------------------------------------------------------------------
+  Frame timelines for all of the HTTP/2 connections (JSON array)
+-----------------------------------------------------------------------------*/
+CStringA TrackSockets::GetH2TimelineJSON(void) {
+  CStringA json = "[";
+  bool first = true;
+  EnterCriticalSection(&cs);
+  POSITION pos = _socketInfo.GetStartPosition();
+  while (pos) {
+    SocketInfo * info = NULL;
+    DWORD key = 0;
+    _socketInfo.GetNextAssoc(pos, key, info);
+    if (info && info->_h2) {
+      CStringA connection = info->_h2->GetTimelineJSON(_test_state);
+      if (!connection.IsEmpty()) {
+        if (!first)
+          json += ",";
+        first = false;
+        json += connection;
+      }
+    }
+  }
+  LeaveCriticalSection(&cs);
+  json += "]";
+  return json;
+}
+
+/*-----------------------------------------------------------------------------
+  Per-connection arrival timelines for the current step:
+  [{"id":socket,"arrivals":{"bytes":n,"max_stall_ms":n,...}},...]
+-----------------------------------------------------------------------------*/
+CStringA TrackSockets::GetArrivalsJSON(void) {
+  CStringA json = "[";
+  bool first = true;
+  EnterCriticalSection(&cs);
+  POSITION pos = _socketInfo.GetStartPosition();
+  while (pos) {
+    SocketInfo * info = NULL;
+    DWORD key = 0;
+    _socketInfo.GetNextAssoc(pos, key, info);
+    if (info && !info->_arrivals.IsEmpty() &&
+        info->_arrivals.Last() >= _test_state._start.QuadPart) {
+      CStringA socket = info->_arrivals.GetJSON(_test_state._start.QuadPart,
+                                        _test_state._ms_frequency.QuadPart);
+      if (!socket.IsEmpty()) {
+        CStringA id;
+        id.Format("{\"id\":%d,\"arrivals\":", info->_id);
+        if (!first)
+          json += ",";
+        first = false;
+        json += id + socket + "}";
+      }
+    }
+  }
+  LeaveCriticalSection(&cs);
+  json += "]";
+  return json;
+}
+
+/*-----------------------------------------------------------------------------
+  HTTP/2 flow-control blocked and head-of-line wait times for a stream
+  (in performance counter ticks)
+-----------------------------------------------------------------------------*/
+bool TrackSockets::GetH2StreamTimes(DWORD socket_id, DWORD stream_id,
+                                    LONGLONG& blocked, LONGLONG& hol_wait) {
+  bool found = false;
+  blocked = 0;
+  hol_wait = 0;
+  EnterCriticalSection(&cs);
+  SocketInfo* info = GetSocketInfoById(socket_id);
+  if (info && info->_h2)
+    found = info->_h2->GetStreamTimes(stream_id, blocked, hol_wait);
+  LeaveCriticalSection(&cs);
+  return found;
+}
+
 /*-----------------------------------------------------------------------------
 -----------------------------------------------------------------------------*/
 void TrackSockets::H2BeginHeaders(DATA_DIRECTION direction, DWORD socket_id,
@@ -696,169 +851,3 @@ void TrackSockets::H2Bytes(DATA_DIRECTION direction, DWORD socket_id, int stream
   else
     _requests.BytesOut(socket_id, stream_id, len);
 }
-
-/******************************************************************************
-  nghttp2 c-interface callbacks (trampoline back to TrackSockets callbacks)
-*******************************************************************************/
-ssize_t h2_send_callback(nghttp2_session *session, const uint8_t *data,
-                          size_t length, int flags, void *user_data) {
-  return length;
-}
-
-const char * h2_frame_type(int type) {
-  switch (type) {
-    case NGHTTP2_DATA: return "DATA";
-    case NGHTTP2_HEADERS: return "HEADERS";
-    case NGHTTP2_PRIORITY: return "PRIORITY";
-    case NGHTTP2_RST_STREAM: return "RST_STREAM";
-    case NGHTTP2_SETTINGS: return "SETTINGS";
-    case NGHTTP2_PUSH_PROMISE: return "PUSH_PROMISE";
-    case NGHTTP2_PING: return "PING";
-    case NGHTTP2_GOAWAY: return "GOAWAY";
-    case NGHTTP2_WINDOW_UPDATE: return "WINDOW_UPDATE";
-    case NGHTTP2_CONTINUATION: return "CONTINUATION";
-    default: return "UNKNOWN";
-  }
-}
-
-int h2_on_begin_frame_callback(nghttp2_session *session,
-                               const nghttp2_frame_hd *hd, void *user_data) {
-  AtlTrace("h2_on_begin_frame_callback [%s] - stream %d, %d bytes",
-           h2_frame_type(hd->type), hd->stream_id, hd->length);
-  return 0;
-}
-
-int h2_on_frame_recv_callback(nghttp2_session *session,
-                              const nghttp2_frame *frame, void *user_data) {
-  AtlTrace("h2_on_frame_recv_callback [%s] - stream %d, %d bytes",
-           h2_frame_type(frame->hd.type), frame->hd.stream_id,
-           frame->hd.length);
-  // Keep track of the bytes-in for headers by looking at the frame
-  if (user_data && frame->hd.type == NGHTTP2_HEADERS) {
-    H2_USER_DATA * u = (H2_USER_DATA *)user_data;
-    if (u->connection) {
-      TrackSockets * c = (TrackSockets *)u->connection;
-      c->H2Bytes(u->direction, u->socket_id, frame->hd.stream_id,
-                 frame->hd.length);
-    }
-  }
-  return 0;
-}
-
-int h2_on_data_chunk_recv_callback(nghttp2_session *session, uint8_t flags,
-                                   int32_t stream_id, const uint8_t *data,
-                                   size_t len, void *user_data) {
-  AtlTrace("h2_on_data_chunk_recv_callback - stream %d, %d bytes", stream_id, len);
-  if (user_data) {
-    H2_USER_DATA * u = (H2_USER_DATA *)user_data;
-    if (u->connection) {
-      TrackSockets * c = (TrackSockets *)u->connection;
-      c->H2Data(u->direction, u->socket_id, stream_id, len, (const char *)data);
-      c->H2Bytes(u->direction, u->socket_id, stream_id, len);
-    }
-  }
-  return 0;
-}
-
-int h2_on_stream_close_callback(nghttp2_session *session, int32_t stream_id,
-                                uint32_t error_code, void *user_data) {
-  AtlTrace("h2_on_stream_close_callback - stream %d", stream_id);
-  if (user_data) {
-    H2_USER_DATA * u = (H2_USER_DATA *)user_data;
-    if (u->connection) {
-      TrackSockets * c = (TrackSockets *)u->connection;
-      c->H2CloseStream(u->direction, u->socket_id, stream_id);
-    }
-  }
-  return 0;
-}
-
-int h2_on_begin_headers_callback(nghttp2_session *session,
-                                 const nghttp2_frame *frame, void *user_data) {
-  AtlTrace("h2_on_begin_headers_callback - stream %d, %d bytes", frame->hd.stream_id, frame->hd.length);
-  if (user_data) {
-    H2_USER_DATA * u = (H2_USER_DATA *)user_data;
-    if (u->connection) {
-      TrackSockets * c = (TrackSockets *)u->connection;
-      c->H2BeginHeaders(u->direction, u->socket_id, frame->hd.stream_id);
-    }
-  }
-  return 0;
-}
-
-int h2_on_header_callback(nghttp2_session *session, const nghttp2_frame *frame,
-                          const uint8_t *name, size_t namelen,
-                          const uint8_t *value, size_t valuelen,
-                          uint8_t flags, void *user_data) {
-  int32_t stream_id = frame->hd.stream_id;
-  if (frame->hd.type == NGHTTP2_PUSH_PROMISE)
-    stream_id = frame->push_promise.promised_stream_id;
-
-  AtlTrace("h2_on_header_callback - stream %d '%S' : '%S'",
-           stream_id, name, value);
-  if (user_data && name && value) {
-    H2_USER_DATA * u = (H2_USER_DATA *)user_data;
-    if (u->connection) {
-      DATA_DIRECTION direction = u->direction;
-      // if we are processing a PUSH_PROMISE, flip the header direction
-      bool pushed = false;
-      if (frame->hd.type == NGHTTP2_PUSH_PROMISE) {
-        direction = u->direction == DATA_IN ? DATA_OUT : DATA_IN;
-        pushed = true;
-      }
-      TrackSockets * c = (TrackSockets *)u->connection;
-      c->H2Header(direction, u->socket_id, stream_id,
-                  (const char *)name, (const char *)value, pushed);
-    }
-  }
-  return 0;
-}
-
-/*-----------------------------------------------------------------------------
-  Create a new HTTP2 session 
------------------------------------------------------------------------------*/
-H2_USER_DATA * TrackSockets::NewHttp2Session(DWORD socket_id,
-                                             DATA_DIRECTION direction) {
-  H2_USER_DATA * user_data = NULL;
-  nghttp2_session_callbacks * cb = NULL;
-  if (!nghttp2_session_callbacks_new(&cb) && cb) {
-    nghttp2_session_callbacks_set_send_callback(cb, h2_send_callback);
-    nghttp2_session_callbacks_set_on_begin_frame_callback(
-        cb, h2_on_begin_frame_callback);
-    nghttp2_session_callbacks_set_on_frame_recv_callback(
-        cb, h2_on_frame_recv_callback);
-    nghttp2_session_callbacks_set_on_data_chunk_recv_callback(
-        cb, h2_on_data_chunk_recv_callback);
-    nghttp2_session_callbacks_set_on_stream_close_callback(
-        cb, h2_on_stream_close_callback);
-    nghttp2_session_callbacks_set_on_begin_headers_callback(
-        cb, h2_on_begin_headers_callback);
-    nghttp2_session_callbacks_set_on_header_callback(
-        cb, h2_on_header_callback);
-
-
-    nghttp2_option * options = NULL;
-    if (!nghttp2_option_new(&options) && options) {
-      nghttp2_option_set_no_auto_window_update(options, 1);
-      nghttp2_option_set_no_http_messaging(options, 1);
-
-      user_data = new H2_USER_DATA;
-      user_data->direction = direction;
-      user_data->connection = this;
-      user_data->socket_id = socket_id;
-      bool ok = false;
-      if (direction == DATA_OUT) {
-        ok = !nghttp2_session_server_new2(&user_data->session, cb, user_data, options);
-      } else {
-        ok = !nghttp2_session_client_new2(&user_data->session, cb, user_data, options);
-      }
-      if (!ok) {
-        delete user_data;
-        user_data = NULL;
-      }
-      nghttp2_option_del(options);
-    }
-    nghttp2_session_callbacks_del(cb);
-  }
-  return user_data;
-}
@@ -27,13 +27,15 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 ******************************************************************************/
 
 #pragma once
+#include "arrival_timeline.h"
+#include "pcap_capture.h"
 
 class DataChunk;
+class H2Connection;
 class Requests;
 class TestState;
 class WptTest;
 struct PRFileDesc;
-struct nghttp2_session;
 
 typedef enum {
   PROTO_NOT_CHECKED,
@@ -48,13 +50,6 @@ typedef enum {
   DATA_OUT
 } DATA_DIRECTION;
 
-typedef struct {
-  nghttp2_session * session;
-  void *            connection;
-  DWORD             socket_id;
-  DATA_DIRECTION    direction;
-} H2_USER_DATA;
-
 class SocketInfo {
 public:
   SocketInfo();
@@ -75,8 +70,9 @@ public:
   LARGE_INTEGER       _ssl_start;
   LARGE_INTEGER       _ssl_end;
   SOCKET_PROTOCOL     _protocol;
-  H2_USER_DATA *      _h2_in;
-  H2_USER_DATA *      _h2_out;
+  H2Connection *      _h2;
+  ArrivalTimeline     _arrivals;  // wire bytes in during the test
+  PcapngStream        _pcap;      // synthetic capture (hookpcap)
 };
 
 class TrackSockets {
@@ -103,6 +99,7 @@ public:
   bool SslSocketLookup(PRFileDesc* fd, SOCKET& s);
 
   void Reset();
+  void ResetArrivals();
 
   bool ClaimConnect(DWORD socket_id, LARGE_INTEGER before,
                     LARGE_INTEGER& start, LARGE_INTEGER& end,
@@ -112,6 +109,11 @@ public:
   int GetLocalPort(DWORD socket_id);
   LONGLONG GetEarliest(LONGLONG& after);
   CStringA GetRTT(DWORD ipv4_address);
+  CStringA GetH2TimelineJSON(void);
+  CStringA GetArrivalsJSON(void);
+  bool SavePcap(const CString& file);
+  bool GetH2StreamTimes(DWORD socket_id, DWORD stream_id, LONGLONG& blocked,
+                        LONGLONG& hol_wait);
 
   void H2BeginHeaders(DATA_DIRECTION direction, DWORD socket_id, int stream_id);
   void H2CloseStream(DATA_DIRECTION direction, DWORD socket_id, int stream_id);
@@ -129,8 +131,10 @@ private:
   void SslDataOut(SocketInfo* info, const DataChunk& chunk);
   void SslDataIn(SocketInfo* info, const DataChunk& chunk);
   bool IsSSLHandshake(const DataChunk& chunk);
-  H2_USER_DATA * NewHttp2Session(DWORD socket_id,
-                                 DATA_DIRECTION direction);
+  void IndexConnectStart(LONGLONG previous, LONGLONG start);
+  bool CapturePcap(SocketInfo* info, PCAPNG_DIRECTION direction,
+                   const DataChunk& chunk, bool is_unencrypted,
+                   PcapPacket& packet);
 
   CRITICAL_SECTION cs;
   Requests&                   _requests;
@@ -139,6 +143,8 @@ private:
   DWORD	_nextSocketId;	// ID to assign to the next socket
   CAtlMap<SOCKET, DWORD>	    _openSockets;
   CAtlMap<DWORD, SocketInfo*>  _socketInfo;
+  CAtlArray<LONGLONG>          _connect_starts;  // sorted
+  PcapCapture                  _pcap;
 
   CAtlMap<DWORD, PRFileDesc*>    _last_ssl_fd;  // per-thread
   CAtlMap<PRFileDesc*, SOCKET>   _ssl_sockets;
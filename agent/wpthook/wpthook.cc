@@ -57,11 +57,12 @@ WptHook::WptHook(void):
   ,background_thread_started_(NULL)
   ,message_window_(NULL)
   ,test_state_(results_, screen_capture_, test_, dev_tools_, trace_,
-               trace_netlog_)
+               trace_netlog_, requests_)
   ,winsock_hook_(dns_, sockets_, test_state_)
   ,nspr_hook_(sockets_, test_state_, test_)
   ,schannel_hook_(sockets_, test_state_, test_)
   ,wininet_hook_(sockets_, test_state_, test_)
+  ,gdi_hook_(test_state_)
   ,sockets_(requests_, test_state_, test_)
   ,requests_(test_state_, sockets_, dns_, test_)
   ,results_(test_state_, test_, requests_, sockets_, dns_, screen_capture_,
@@ -134,6 +135,8 @@ void WptHook::Init(){
     schannel_hook_.Init();
     wininet_hook_.Init();
   }
+  if (!test_state_.no_gdi_)
+    gdi_hook_.Init();
   test_state_.Init();
   ResetEvent(background_thread_started_);
   background_thread_ = (HANDLE)_beginthreadex(0, 0, ::ThreadProc, this, 0, 0);
@@ -208,6 +211,8 @@ void WptHook::UnregisterHooks() {
     schannel_hook_.Unregister();
     wininet_hook_.Unregister();
   }
+  if (!test_state_.no_gdi_)
+    gdi_hook_.Unregister();
 }
 
 /*-----------------------------------------------------------------------------
@@ -31,6 +31,7 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include "hook_nspr.h"
 #include "hook_schannel.h"
 #include "hook_wininet.h"
+#include "hook_gdi.h"
 #include "requests.h"
 #include "track_dns.h"
 #include "track_sockets.h"
@@ -84,6 +85,7 @@ private:
   NsprHook  nspr_hook_;
   SchannelHook  schannel_hook_;
   WinInetHook wininet_hook_;
+  GdiHook   gdi_hook_;
   HANDLE    background_thread_;
   HANDLE    background_thread_started_;
   HWND      message_window_;
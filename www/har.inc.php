@@ -411,15 +411,11 @@ function BuildHAR(&$pageData, $allRequests, $id, $testPath, $options) {
         // add the bodies to the requests
         if (isset($options['bodies']) && $options['bodies']) {
           $bodies_file = $testPath . '/' . $run . $cached_text . '_bodies.zip';
-          if (is_file($bodies_file)) {
-            $zip = new ZipArchive;
-            if ($zip->open($bodies_file) === TRUE) {
-              for ($i = 0; $i < $zip->numFiles; $i++) {
-                $index = intval($zip->getNameIndex($i), 10) - 1;
-                if (array_key_exists($index, $entries))
-                  $entries[$index]['response']['content']['text'] = utf8_encode($zip->getFromIndex($i));
-              }
-            }
+          $bodies = GetResponseBodies($bodies_file);
+          foreach ($bodies as $number => $body) {
+            $index = $number - 1;
+            if (array_key_exists($index, $entries))
+              $entries[$index]['response']['content']['text'] = utf8_encode($body);
           }
         }
       }
@@ -21,18 +21,10 @@ if (isset($_GET['request'])) {
 }
 if ($request) {
     $bodies_file = $testPath . '/' . $run . $cachedText . '_bodies.zip';
-    if (is_file($bodies_file)) {
-        $zip = new ZipArchive;
-        if ($zip->open($bodies_file) === TRUE) {
-            for( $i = 0; $i < $zip->numFiles; $i++ ) {
-                $index = intval($zip->getNameIndex($i), 10);
-                if ($index == $request) {
-                    $body = $zip->getFromIndex($i);
-                    break;
-                }
-            }
-        }
-    }
+    require_once('object_detail.inc');
+    $bodies = GetResponseBodies($bodies_file, $request);
+    if (array_key_exists($request, $bodies))
+        $body = $bodies[$request];
 }
 
 if (isset($body)) {
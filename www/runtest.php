@@ -108,6 +108,9 @@
             $test['notify'] = trim($req_notify);
             $test['video'] = $req_video;
             $test['continuousVideo'] = isset($req_continuousVideo) && $req_continuousVideo ? 1 : 0;
+            $test['adaptiveDone'] = isset($req_adaptiveDone) && $req_adaptiveDone ? 1 : 0;
+            $test['processSamples'] = isset($req_processSamples) && $req_processSamples ? 1 : 0;
+            $test['ignoreActivity'] = isset($req_ignoreActivity) ? trim(str_replace(array("\r", "\n"), ' ', $req_ignoreActivity)) : '';
             $test['label'] = preg_replace('/[^a-zA-Z0-9 \-_\.]/', '', trim($req_label));
             $test['industry'] = trim($req_ig);
             $test['industry_page'] = trim($req_ip);
@@ -132,6 +135,7 @@
             $test['aftEarlyCutoff'] = (int)$req_aftec;
             $test['aftMinChanges'] = (int)$req_aftmc;
             $test['tcpdump'] = $req_tcpdump;
+            $test['hookpcap'] = $req_hookpcap;
             $test['timeline'] = $req_timeline;
             $test['timelineStackDepth'] = array_key_exists('timelineStack', $_REQUEST) && $_REQUEST['timelineStack'] ? 5 : 0;
             $test['swrender'] = $req_swrender;
@@ -156,6 +160,7 @@
             if (!array_key_exists('bodies', $_REQUEST) && GetSetting('bodies'))
               $test['bodies'] = 1;
             $test['htmlbody'] = $req_htmlbody;
+            $test['legacy_bodies'] = array_key_exists('legacyBodies', $_REQUEST) && $_REQUEST['legacyBodies'] ? 1 : 0;
             $test['time'] = (int)$req_time;
             $test['clear_rv'] = (int)$req_clearRV;
             $test['keepua'] = 0;
@@ -173,6 +178,7 @@
             $test['clearcerts'] = array_key_exists('clearcerts', $_REQUEST) && $_REQUEST['clearcerts'] ? 1 : 0;
             $test['orientation'] = array_key_exists('orientation', $_REQUEST) ? trim($_REQUEST['orientation']) : 'default';
             $test['responsive'] = array_key_exists('responsive', $_REQUEST) && $_REQUEST['responsive'] ? 1 : 0;
+            $test['binaryRequestLog'] = array_key_exists('binaryRequestLog', $_REQUEST) && $_REQUEST['binaryRequestLog'] ? 1 : 0;
 
             if (array_key_exists('tsview_id', $_REQUEST)){
               $test['tsview_id'] = $_REQUEST['tsview_id'];
@@ -1059,7 +1065,17 @@ function ValidateParameters(&$test, $locations, &$error, $destination_url = null
         }
 
         if( !$test['batch'] )
-            ValidateURL($test['url'], $error, $settings);
+        {
+            if( isset($test['type']) && $test['type'] == 'traceroute' )
+            {
+                // several hosts can be traced in one test
+                foreach( TracerouteHosts($test['url']) as $host )
+                    if( !$error )
+                        ValidateURL($host, $error, $settings);
+            }
+            else
+                ValidateURL($test['url'], $error, $settings);
+        }
 
         if( !$error )
         {
@@ -1084,6 +1100,7 @@ function ValidateParameters(&$test, $locations, &$error, $destination_url = null
             $test['web10'] = $test['web10'] ? 1 : 0;
             $test['ignoreSSL'] = $test['ignoreSSL'] ? 1 : 0;
             $test['tcpdump'] = $test['tcpdump'] ? 1 : 0;
+            $test['hookpcap'] = $test['hookpcap'] ? 1 : 0;
             $test['standards'] = $test['standards'] ? 1 : 0;
             $test['timeline'] = $test['timeline'] ? 1 : 0;
             $test['swrender'] = $test['swrender'] ? 1 : 0;
@@ -1145,9 +1162,8 @@ function ValidateParameters(&$test, $locations, &$error, $destination_url = null
             {
                 if( $test['type'] == 'traceroute' )
                 {
-                    // make sure we're just passing a host name
-                    $parts = parse_url($test['url']);
-                    $test['url'] = $parts['host'];
+                    // make sure we're just passing host names
+                    $test['url'] = implode(' ', TracerouteHosts($test['url']));
                 }
             }
             else
@@ -1359,6 +1375,26 @@ function ScriptParameterCount($command)
     return $count;
 }
 
+/**
+* Split a traceroute target list (hosts or URLs separated by spaces, commas
+* or semicolons) into just the host names
+*
+* @param mixed $targets
+*/
+function TracerouteHosts($targets)
+{
+    $hosts = array();
+    foreach( preg_split('/[\s,;]+/', $targets, -1, PREG_SPLIT_NO_EMPTY) as $target )
+    {
+        if( strncasecmp($target, 'http:', 5) && strncasecmp($target, 'https:', 6))
+            $target = 'http://' . $target;
+        $parts = parse_url($target);
+        if( isset($parts['host']) && strlen($parts['host']) )
+            $hosts[] = $parts['host'];
+    }
+    return $hosts;
+}
+
 /**
 * Make sure the URL they requested looks valid
 *
@@ -1899,6 +1935,8 @@ function CreateTest(&$test, $url, $batch = 0, $batch_locations = 0)
                 $testFile .= "\r\nignoreSSL=1";
             if( $test['tcpdump'] )
                 $testFile .= "\r\ntcpdump=1";
+            if( $test['hookpcap'] )
+                $testFile .= "\r\nhookpcap=1";
             if( $test['standards'] )
                 $testFile .= "\r\nstandards=1";
             if( $test['timeline'] ) {
@@ -1958,8 +1996,13 @@ function CreateTest(&$test, $url, $batch = 0, $batch_locations = 0)
                 $testFile .= "imageQuality={$test['iq']}\r\n";
             elseif( $settings['iq'] )
                 $testFile .= "imageQuality={$settings['iq']}\r\n";
-            if( $test['bodies'] )
+            if( $test['bodies'] ) {
                 $testFile .= "bodies=1\r\n";
+                // median_video deletes the bodies of the other runs so
+                // they can't be shared
+                if( !$test['htmlbody'] && !$test['median_video'] && !@$test['legacy_bodies'] )
+                    $testFile .= "dedupBodies=1\r\n";
+            }
             if( $test['htmlbody'] )
                 $testFile .= "htmlbody=1\r\n";
             if( $test['time'] )
@@ -1981,8 +2024,16 @@ function CreateTest(&$test, $url, $batch = 0, $batch_locations = 0)
             }
             if (array_key_exists('continuousVideo', $test) && $test['continuousVideo'])
                 $testFile .= "continuousVideo=1\r\n";
+            if (array_key_exists('adaptiveDone', $test) && $test['adaptiveDone'])
+                $testFile .= "adaptiveDone=1\r\n";
+            if (array_key_exists('processSamples', $test) && $test['processSamples'])
+                $testFile .= "processSamples=1\r\n";
+            if (array_key_exists('ignoreActivity', $test) && strlen($test['ignoreActivity']))
+                $testFile .= "ignoreActivity={$test['ignoreActivity']}\r\n";
             if (array_key_exists('responsive', $test) && $test['responsive'])
                 $testFile .= "responsive=1\r\n";
+            if (array_key_exists('binaryRequestLog', $test) && $test['binaryRequestLog'])
+                $testFile .= "binaryRequestLog=1\r\n";
             if (array_key_exists('cmdLine', $test) && strlen($test['cmdLine']))
                 $testFile .= "cmdLine={$test['cmdLine']}\r\n";
             if (array_key_exists('addCmdLine', $test) && strlen($test['addCmdLine']))
@@ -439,6 +439,7 @@ function KeepVideoForRun($testPath, $run)
             if (strcmp("$run", $match_run) &&
                 (strpos($file, '_bodies.zip') ||
                  strpos($file, '.cap') ||
+                 strpos($file, '.pcapng') ||
                  strpos($file, '_devtools.json') ||
                  strpos($file, '_netlog.txt') ||
                  strpos($file, '_doc.') ||